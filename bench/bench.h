@@ -0,0 +1,115 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+/* microbenchmark harness, in the spirit of tests/test.h
+ * a benchmark is a function that performs `ops` operations and returns the
+ * seconds they took (so multi-threaded benchmarks time only their own
+ * steady state). bench_run() warms it up once, repeats it BENCH_REPS times
+ * and keeps the median and the best run. progress goes to stderr; the
+ * suite's results go to stdout as one JSON object from bench_summarise().
+ *
+ * environment:
+ *   BENCH_REPS   repetitions per benchmark (default 5)
+ *   BENCH_SCALE  multiplier on every op count, e.g. 0.1 for a smoke run
+ */
+
+#define BENCH_MAX_RESULTS 64
+#define BENCH_REPS_MAX 101
+
+typedef double (*bench_fn)(void *ctx, uint64_t ops);
+
+typedef struct {
+    char name[64];
+    char params[96];
+    uint64_t ops;
+    double ns_median;
+    double ns_min;
+} BenchResult;
+
+static BenchResult g_bench_results[BENCH_MAX_RESULTS];
+static int g_bench_nresults = 0;
+
+static inline double bench_now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+static inline int bench_reps(void)
+{
+    const char *s = getenv("BENCH_REPS");
+    int n = s ? atoi(s) : 5;
+    if (n < 1) {
+        n = 1;
+    }
+    return n > BENCH_REPS_MAX ? BENCH_REPS_MAX : n;
+}
+
+// ops scaled by BENCH_SCALE, never below 1
+static inline uint64_t bench_ops(uint64_t ops)
+{
+    const char *s = getenv("BENCH_SCALE");
+    double scale = s ? strtod(s, NULL) : 1.0;
+    if (scale <= 0.0) {
+        scale = 1.0;
+    }
+    uint64_t n = (uint64_t)((double)ops * scale);
+    return n > 0 ? n : 1;
+}
+
+static int bench_cmp_double(const void *a, const void *b)
+{
+    double x = *(const double *)a;
+    double y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+// run fn for ops (before BENCH_SCALE) operations and record the result
+static inline void bench_run(const char *name, const char *params, bench_fn fn, void *ctx,
+                             uint64_t ops)
+{
+    if (g_bench_nresults >= BENCH_MAX_RESULTS) {
+        fprintf(stderr, "  [SKIP] %s: BENCH_MAX_RESULTS reached\n", name);
+        return;
+    }
+    ops = bench_ops(ops);
+    int reps = bench_reps();
+    double secs[BENCH_REPS_MAX];
+
+    fn(ctx, ops); // warm caches, allocators and page tables
+    for (int r = 0; r < reps; r++) {
+        secs[r] = fn(ctx, ops);
+    }
+    qsort(secs, (size_t)reps, sizeof(secs[0]), bench_cmp_double);
+
+    BenchResult *res = &g_bench_results[g_bench_nresults++];
+    snprintf(res->name, sizeof(res->name), "%s", name);
+    snprintf(res->params, sizeof(res->params), "%s", params ? params : "");
+    res->ops = ops;
+    res->ns_median = secs[reps / 2] * 1e9 / (double)ops;
+    res->ns_min = secs[0] * 1e9 / (double)ops;
+    fprintf(stderr, "  [BENCH] %-28s %-26s %12.1f ns/op  %14.0f ops/s\n", res->name,
+            res->params, res->ns_median,
+            res->ns_median > 0.0 ? 1e9 / res->ns_median : 0.0);
+}
+
+// print the suite as one JSON object; returns the process exit code
+static inline int bench_summarise(const char *suite)
+{
+    printf("{\"suite\":\"%s\",\"reps\":%d,\"results\":[", suite, bench_reps());
+    for (int i = 0; i < g_bench_nresults; i++) {
+        const BenchResult *r = &g_bench_results[i];
+        printf("%s\n  {\"name\":\"%s\",\"params\":\"%s\",\"ops\":%llu,"
+               "\"ns_per_op\":%.2f,\"ns_per_op_min\":%.2f,\"ops_per_sec\":%.0f}",
+               i ? "," : "", r->name, r->params, (unsigned long long)r->ops, r->ns_median,
+               r->ns_min, r->ns_median > 0.0 ? 1e9 / r->ns_median : 0.0);
+    }
+    printf("\n]}\n");
+    return g_bench_nresults > 0 ? 0 : 1;
+}
@@ -0,0 +1,130 @@
+#define _POSIX_C_SOURCE 200809L
+#define _DEFAULT_SOURCE
+
+#include "bench.h"
+#include "../src/jsonw.h"
+#include "../src/llm.h"
+#include "../src/simd.h"
+
+typedef struct {
+    char *src; // reasoning-model reply: think blocks with answer text between
+    char *work;
+    size_t len;
+} ThinkCtx;
+
+static void build_reply(ThinkCtx *c, size_t len)
+{
+    static const char think[] = "<think>The user asks about the weather. I should check "
+                                "what I know and keep the reply short.</think>";
+    static const char answer[] = "It looks sunny in the afternoon with a light breeze. ";
+    c->src = malloc(len + 1);
+    c->work = malloc(len + 1);
+    if (!c->src || !c->work) {
+        exit(1);
+    }
+    size_t off = 0;
+    for (int i = 0; off < len; i++) {
+        const char *piece = i % 3 == 0 ? think : answer;
+        size_t n = strlen(piece);
+        if (n > len - off) {
+            n = len - off;
+        }
+        memcpy(c->src + off, piece, n);
+        off += n;
+    }
+    c->src[len] = '\0';
+    c->len = len;
+}
+
+// one in-place strip per op; the copy that restores the input is included
+static double bench_strip(void *ctx, uint64_t ops)
+{
+    ThinkCtx *c = (ThinkCtx *)ctx;
+    volatile size_t out = 0;
+    double t0 = bench_now();
+    for (uint64_t i = 0; i < ops; i++) {
+        memcpy(c->work, c->src, c->len + 1);
+        out += llm_strip_think_tags(c->work);
+    }
+    double t = bench_now() - t0;
+    (void)out;
+    return t;
+}
+
+// the streaming filter over the same text in 16-byte chunks, as SSE deltas arrive
+static double bench_stream_filter(void *ctx, uint64_t ops)
+{
+    ThinkCtx *c = (ThinkCtx *)ctx;
+    volatile size_t out = 0;
+    double t0 = bench_now();
+    for (uint64_t i = 0; i < ops; i++) {
+        LlmThinkFilter f;
+        llm_think_filter_init(&f);
+        size_t w = 0;
+        for (size_t off = 0; off < c->len; off += 16) {
+            size_t n = c->len - off < 16 ? c->len - off : 16;
+            w += llm_think_filter_feed(&f, c->src + off, n, c->work + w, c->len + 1 - w);
+        }
+        w += llm_think_filter_finish(&f, c->work + w, c->len + 1 - w);
+        out += w;
+    }
+    double t = bench_now() - t0;
+    (void)out;
+    return t;
+}
+
+// the reply escaped into a sendMessage body, as bot_send_message does
+static double bench_escape(void *ctx, uint64_t ops)
+{
+    ThinkCtx *c = (ThinkCtx *)ctx;
+    volatile size_t out = 0;
+    JsonW w;
+    jsonw_init(&w);
+    double t0 = bench_now();
+    for (uint64_t i = 0; i < ops; i++) {
+        jsonw_reset(&w);
+        jsonw_obj_begin(&w);
+        jsonw_kv_str(&w, "text", c->src);
+        jsonw_obj_end(&w);
+        size_t len = 0;
+        jsonw_finish(&w, &len);
+        out += len;
+    }
+    double t = bench_now() - t0;
+    jsonw_free(&w);
+    (void)out;
+    return t;
+}
+
+// the UTF-8 check every outbound message text gets
+static double bench_utf8(void *ctx, uint64_t ops)
+{
+    ThinkCtx *c = (ThinkCtx *)ctx;
+    volatile size_t out = 0;
+    double t0 = bench_now();
+    for (uint64_t i = 0; i < ops; i++) {
+        out += simd_utf8_valid(c->src, c->len);
+    }
+    double t = bench_now() - t0;
+    (void)out;
+    return t;
+}
+
+int main(void)
+{
+    static const size_t sizes[] = {4096, 65536, 1048576};
+    for (size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+        ThinkCtx c;
+        build_reply(&c, sizes[i]);
+        char params[64];
+        snprintf(params, sizeof(params), "bytes=%zu", sizes[i]);
+        uint64_t ops = 256ULL * 1048576ULL / sizes[i]; // ~256 MiB of text per run
+        bench_run("llm_strip_think_tags", params, bench_strip, &c, ops);
+        bench_run("llm_think_filter_feed", params, bench_stream_filter, &c, ops);
+        bench_run("jsonw_kv_str", params, bench_escape, &c, ops);
+        bench_run("simd_utf8_valid", params, bench_utf8, &c, ops);
+        free(c.src);
+        free(c.work);
+    }
+    return bench_summarise("llm");
+}
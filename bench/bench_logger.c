@@ -0,0 +1,88 @@
+#define _POSIX_C_SOURCE 200809L
+#define _DEFAULT_SOURCE
+
+#include "bench.h"
+#include "../src/logger.h"
+
+#include <fcntl.h>
+#include <pthread.h>
+#include <unistd.h>
+
+#define LOG_BENCH_PATH "/tmp/tgbot_bench.log"
+#define LOG_BENCH_BYTES (64UL * 1024UL * 1024UL)
+
+typedef struct {
+    int threads;
+    int async; // log_start_async before writing
+    int mmap;  // log_init_mmap instead of log_init
+} LogShape;
+
+typedef struct {
+    uint64_t lines;
+    int id;
+} WriterArg;
+
+static void *writer(void *arg)
+{
+    const WriterArg *wa = (const WriterArg *)arg;
+    for (uint64_t i = 0; i < wa->lines; i++) {
+        log_write(LOG_INFO, "worker %d: sent reply to chat %lu (%d tokens, %.2fs)", wa->id,
+                  (unsigned long)(i * 7919 % 100000), (int)(i % 512), (double)(i % 100) / 10.0);
+    }
+    return NULL;
+}
+
+/* ops lines from `threads` writers, until every line is in the file
+ * log_write also copies each line to stderr, which is pointed at /dev/null
+ * for the run so the terminal does not dominate the numbers
+ */
+static double bench_log(void *ctx, uint64_t ops)
+{
+    const LogShape *ls = (const LogShape *)ctx;
+    unlink(LOG_BENCH_PATH);
+    int rc = ls->mmap ? log_init_mmap(LOG_BENCH_PATH, LOG_BENCH_BYTES)
+                      : log_init(LOG_BENCH_PATH, LOG_BENCH_BYTES);
+    if (rc != 0 || (ls->async && log_start_async(1024) != 0)) {
+        fprintf(stderr, "bench_logger: cannot open %s\n", LOG_BENCH_PATH);
+        exit(1);
+    }
+
+    fflush(stderr);
+    int saved = dup(STDERR_FILENO);
+    int devnull = open("/dev/null", O_WRONLY);
+    dup2(devnull, STDERR_FILENO);
+
+    pthread_t th[16];
+    WriterArg wa[16];
+    double t0 = bench_now();
+    for (int i = 0; i < ls->threads; i++) {
+        wa[i].lines = ops / (uint64_t)ls->threads;
+        wa[i].id = i;
+        pthread_create(&th[i], NULL, writer, &wa[i]);
+    }
+    for (int i = 0; i < ls->threads; i++) {
+        pthread_join(th[i], NULL);
+    }
+    log_close(); // drains the async ring
+    double t = bench_now() - t0;
+
+    dup2(saved, STDERR_FILENO);
+    close(saved);
+    close(devnull);
+    unlink(LOG_BENCH_PATH);
+    return t;
+}
+
+int main(void)
+{
+    static const LogShape shapes[] = {
+        {1, 0, 0}, {4, 0, 0}, {1, 1, 0}, {4, 1, 0}, {8, 1, 0}, {4, 1, 1},
+    };
+    for (size_t i = 0; i < sizeof(shapes) / sizeof(shapes[0]); i++) {
+        char params[64];
+        snprintf(params, sizeof(params), "threads=%d,async=%d,mmap=%d", shapes[i].threads,
+                 shapes[i].async, shapes[i].mmap);
+        bench_run("log_write", params, bench_log, (void *)&shapes[i], 200000);
+    }
+    return bench_summarise("logger");
+}
@@ -0,0 +1,124 @@
+#define _POSIX_C_SOURCE 200809L
+#define _DEFAULT_SOURCE
+
+#include "bench.h"
+#include "../src/queue.h"
+
+#include <inttypes.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+
+// users per producer; rings are per user, so this bounds queued messages
+#define USERS_PER_PRODUCER 64
+#define RING_SIZE 32
+
+typedef struct {
+    int producers;
+    int consumers;
+} QueueShape;
+
+typedef struct {
+    int id;
+    uint64_t msgs;
+} ProducerArg;
+
+static atomic_int g_go;
+
+static void *producer(void *arg)
+{
+    const ProducerArg *pa = (const ProducerArg *)arg;
+    while (!atomic_load_explicit(&g_go, memory_order_acquire)) {
+        sched_yield();
+    }
+    int64_t base = (int64_t)pa->id * USERS_PER_PRODUCER + 1;
+    for (uint64_t i = 0; i < pa->msgs; i++) {
+        int64_t uid = base + (int64_t)(i % USERS_PER_PRODUCER);
+        // a full ring drops the newest; retry so every message is counted
+        while (queue_push(uid, uid, "hello there, how are you doing today?") != 0) {
+            sched_yield();
+        }
+    }
+    return NULL;
+}
+
+static void *consumer(void *arg)
+{
+    int worker = (int)(intptr_t)arg;
+    QueueMsg msg = {0};
+    while (queue_pop_worker(worker, &msg) == 0) {
+    }
+    queue_msg_release(&msg);
+    return NULL;
+}
+
+// ops messages pushed by the producers and popped by the consumers
+static double bench_push_pop(void *ctx, uint64_t ops)
+{
+    const QueueShape *qs = (const QueueShape *)ctx;
+    if (queue_init_sharded(RING_SIZE, qs->consumers) != 0) {
+        fprintf(stderr, "bench_queue: queue_init_sharded failed\n");
+        exit(1);
+    }
+    atomic_store(&g_go, 0);
+
+    pthread_t prod[16];
+    pthread_t cons[16];
+    ProducerArg pa[16];
+    for (int i = 0; i < qs->consumers; i++) {
+        pthread_create(&cons[i], NULL, consumer, (void *)(intptr_t)i);
+    }
+    for (int i = 0; i < qs->producers; i++) {
+        pa[i].id = i;
+        pa[i].msgs = ops / (uint64_t)qs->producers;
+        pthread_create(&prod[i], NULL, producer, &pa[i]);
+    }
+
+    double t0 = bench_now();
+    atomic_store_explicit(&g_go, 1, memory_order_release);
+    for (int i = 0; i < qs->producers; i++) {
+        pthread_join(prod[i], NULL);
+    }
+    // consumers exit once shutdown is signalled and every shard has drained
+    queue_shutdown();
+    for (int i = 0; i < qs->consumers; i++) {
+        pthread_join(cons[i], NULL);
+    }
+    double t = bench_now() - t0;
+    queue_destroy();
+    return t;
+}
+
+// single-threaded cost of one push followed by one pop (no contention)
+static double bench_push_pop_inline(void *ctx, uint64_t ops)
+{
+    (void)ctx;
+    queue_init(RING_SIZE);
+    QueueMsg msg = {0};
+    double t0 = bench_now();
+    for (uint64_t i = 0; i < ops; i++) {
+        int64_t uid = (int64_t)(i % USERS_PER_PRODUCER) + 1;
+        queue_push(uid, uid, "hello there, how are you doing today?");
+        queue_pop(&msg);
+    }
+    double t = bench_now() - t0;
+    queue_shutdown();
+    queue_destroy();
+    queue_msg_release(&msg);
+    return t;
+}
+
+int main(void)
+{
+    bench_run("queue_push_pop_inline", "producers=0,consumers=0", bench_push_pop_inline, NULL,
+              2000000);
+
+    static const QueueShape shapes[] = {{1, 1}, {4, 1}, {4, 4}, {8, 4}, {8, 8}};
+    for (size_t i = 0; i < sizeof(shapes) / sizeof(shapes[0]); i++) {
+        char params[64];
+        snprintf(params, sizeof(params), "producers=%d,consumers=%d", shapes[i].producers,
+                 shapes[i].consumers);
+        bench_run("queue_push_pop", params, bench_push_pop, (void *)&shapes[i], 1000000);
+    }
+    return bench_summarise("queue");
+}
@@ -0,0 +1,142 @@
+#define _POSIX_C_SOURCE 200809L
+#define _DEFAULT_SOURCE
+
+#include "bench.h"
+#include "../lib/cJSON.h"
+#include "../src/update.h"
+
+#include <inttypes.h>
+
+#define BATCH_UPDATES 100
+
+// one update as Telegram sends it for a group text message with an entity
+static int format_update(char *out, size_t cap, int64_t id, const char *text)
+{
+    return snprintf(out, cap,
+                    "{\"update_id\":%" PRId64 ",\"message\":{\"message_id\":%" PRId64 ","
+                    "\"from\":{\"id\":%" PRId64 ",\"is_bot\":false,\"first_name\":\"J\\u00fcrgen\","
+                    "\"last_name\":\"Schmidt\",\"username\":\"jschmidt\",\"language_code\":\"de\"},"
+                    "\"chat\":{\"id\":-100%" PRId64 ",\"title\":\"Home group\",\"type\":\"supergroup\"},"
+                    "\"date\":1700000000,\"reply_to_message\":{\"message_id\":1,\"from\":{\"id\":1,"
+                    "\"is_bot\":true,\"first_name\":\"bot\"},\"chat\":{\"id\":-1001,\"type\":\"supergroup\"},"
+                    "\"date\":1699999999,\"text\":\"earlier reply\"},"
+                    "\"text\":\"%s\",\"entities\":[{\"offset\":0,\"length\":5,\"type\":\"bold\"}]}}",
+                    id, id, 1000 + id % 50, 1000 + id % 7, text);
+}
+
+typedef struct {
+    char *body; // getUpdates response with BATCH_UPDATES updates
+    size_t len;
+    char one[2048]; // a single update, as a webhook delivers it
+    size_t one_len;
+} UpdateCtx;
+
+static void build_payloads(UpdateCtx *c)
+{
+    static const char *texts[] = {
+        "hi",
+        "Can you summarise the last episode for me? No spoilers past season two please.",
+        "\\u041f\\u0440\\u0438\\u0432\\u0435\\u0442! \\u041a\\u0430\\u043a \\u0434\\u0435\\u043b\\u0430?",
+        "line one\\nline two\\n\\\"quoted\\\" and a tab\\there",
+    };
+    size_t cap = 2048 * BATCH_UPDATES + 64;
+    c->body = malloc(cap);
+    if (!c->body) {
+        exit(1);
+    }
+    size_t off = (size_t)snprintf(c->body, cap, "{\"ok\":true,\"result\":[");
+    for (int i = 0; i < BATCH_UPDATES; i++) {
+        if (i) {
+            c->body[off++] = ',';
+        }
+        off += (size_t)format_update(c->body + off, cap - off, 500000 + i, texts[i % 4]);
+    }
+    off += (size_t)snprintf(c->body + off, cap - off, "]}");
+    c->len = off;
+    c->one_len = (size_t)format_update(c->one, sizeof(c->one), 42, texts[1]);
+}
+
+// per update: scan a getUpdates batch and decode each text, as the poll loop does
+static double bench_iter(void *ctx, uint64_t ops)
+{
+    const UpdateCtx *c = (const UpdateCtx *)ctx;
+    char text[UPDATE_TEXT_MAX];
+    uint64_t seen = 0;
+    double t0 = bench_now();
+    while (seen < ops) {
+        UpdateIter it;
+        UpdateView v;
+        if (update_iter_init(&it, c->body, c->len) != 0) {
+            fprintf(stderr, "bench_update: scanner rejected the batch\n");
+            exit(1);
+        }
+        while (update_iter_next(&it, &v) == 1) {
+            update_str_copy(&v.text, text, sizeof(text), "");
+            seen++;
+        }
+    }
+    return (bench_now() - t0) * (double)ops / (double)seen;
+}
+
+// one webhook body through the selective scanner
+static double bench_view_parse(void *ctx, uint64_t ops)
+{
+    const UpdateCtx *c = (const UpdateCtx *)ctx;
+    char text[UPDATE_TEXT_MAX];
+    double t0 = bench_now();
+    for (uint64_t i = 0; i < ops; i++) {
+        UpdateView v;
+        if (update_view_parse(c->one, c->one_len, &v) != 0) {
+            exit(1);
+        }
+        update_str_copy(&v.text, text, sizeof(text), "");
+    }
+    return bench_now() - t0;
+}
+
+// the same body through the cJSON fallback, for comparison
+static double bench_cjson(void *ctx, uint64_t ops)
+{
+    const UpdateCtx *c = (const UpdateCtx *)ctx;
+    char text[UPDATE_TEXT_MAX];
+    double t0 = bench_now();
+    for (uint64_t i = 0; i < ops; i++) {
+        cJSON *root = cJSON_ParseWithLength(c->one, c->one_len);
+        if (!root) {
+            exit(1);
+        }
+        UpdateView v;
+        update_view_from_cjson(root, &v);
+        update_str_copy(&v.text, text, sizeof(text), "");
+        cJSON_Delete(root);
+    }
+    return bench_now() - t0;
+}
+
+// per batch: find the next offset without dispatching (the poller's scan)
+static double bench_batch_offset(void *ctx, uint64_t ops)
+{
+    const UpdateCtx *c = (const UpdateCtx *)ctx;
+    double t0 = bench_now();
+    for (uint64_t i = 0; i < ops; i++) {
+        int64_t off = 0;
+        update_batch_offset(c->body, c->len, &off);
+    }
+    return bench_now() - t0;
+}
+
+int main(void)
+{
+    UpdateCtx c;
+    build_payloads(&c);
+    char params[64];
+    snprintf(params, sizeof(params), "batch=%d,bytes=%zu", BATCH_UPDATES, c.len);
+    bench_run("update_iter_batch", params, bench_iter, &c, 1000000);
+    snprintf(params, sizeof(params), "bytes=%zu", c.one_len);
+    bench_run("update_view_parse", params, bench_view_parse, &c, 1000000);
+    bench_run("update_cjson_parse", params, bench_cjson, &c, 300000);
+    snprintf(params, sizeof(params), "batch=%d,bytes=%zu", BATCH_UPDATES, c.len);
+    bench_run("update_batch_offset", params, bench_batch_offset, &c, 10000);
+    free(c.body);
+    return bench_summarise("update");
+}
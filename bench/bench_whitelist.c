@@ -0,0 +1,78 @@
+#define _POSIX_C_SOURCE 200809L
+#define _DEFAULT_SOURCE
+
+#include "bench.h"
+#include "../src/whitelist.h"
+
+#include <inttypes.h>
+#include <unistd.h>
+
+#define WL_BENCH_PATH "/tmp/tgbot_bench_whitelist.txt"
+#define PROBES 4096 // power of two
+
+typedef struct {
+    Whitelist wl;
+    int64_t probes[PROBES]; // half present, half absent
+} WlCtx;
+
+// a whitelist of n ids loaded from disk, as at startup
+static int load(WlCtx *c, int n)
+{
+    FILE *f = fopen(WL_BENCH_PATH, "w");
+    if (!f) {
+        return -1;
+    }
+    // ids spread like Telegram user ids, in no particular order
+    uint64_t x = 88172645463325252ULL;
+    for (int i = 0; i < n; i++) {
+        x ^= x << 13;
+        x ^= x >> 7;
+        x ^= x << 17;
+        int64_t id = (int64_t)(x % 7000000000ULL) * 2 + 1; // odd: present
+        fprintf(f, "%" PRId64 "\n", id);
+        if (i < PROBES / 2) {
+            c->probes[2 * i] = id;
+        }
+    }
+    fclose(f);
+    for (int i = 0; i < PROBES / 2; i++) {
+        if (i >= n) {
+            c->probes[2 * i] = c->probes[2 * (i % n)];
+        }
+        c->probes[2 * i + 1] = (int64_t)(i + 1) * 2; // even: absent
+    }
+    unlink(WL_BENCH_PATH ".journal");
+    return whitelist_load(&c->wl, WL_BENCH_PATH);
+}
+
+static double bench_contains(void *ctx, uint64_t ops)
+{
+    WlCtx *c = (WlCtx *)ctx;
+    volatile int hits = 0;
+    double t0 = bench_now();
+    for (uint64_t i = 0; i < ops; i++) {
+        hits += whitelist_contains(&c->wl, c->probes[i & (PROBES - 1)]);
+    }
+    double t = bench_now() - t0;
+    (void)hits;
+    return t;
+}
+
+int main(void)
+{
+    static const int sizes[] = {10, 1000, 100000};
+    static WlCtx c;
+    for (size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+        if (load(&c, sizes[i]) != 0) {
+            fprintf(stderr, "bench_whitelist: cannot load %s\n", WL_BENCH_PATH);
+            return 1;
+        }
+        char params[64];
+        snprintf(params, sizeof(params), "ids=%d,hit_ratio=0.5", whitelist_count(&c.wl));
+        bench_run("whitelist_contains", params, bench_contains, &c, 20000000);
+        whitelist_cleanup(&c.wl);
+    }
+    unlink(WL_BENCH_PATH);
+    unlink(WL_BENCH_PATH ".journal");
+    return bench_summarise("whitelist");
+}
@@ -0,0 +1,59 @@
+#!/usr/bin/env python3
+"""Compare two `make bench` result files and flag regressions.
+
+usage: compare.py [--threshold PCT] BASELINE.json CURRENT.json
+
+Benchmarks are matched by suite, name and params. A benchmark regresses
+when its median ns/op grew by more than PCT percent (default 10). Exits 1
+if anything regressed, so it can gate an upgrade.
+"""
+
+import argparse
+import json
+import sys
+
+
+def load(path):
+    with open(path) as f:
+        suites = json.load(f)
+    out = {}
+    for suite in suites:
+        for r in suite["results"]:
+            out[(suite["suite"], r["name"], r["params"])] = r["ns_per_op"]
+    return out
+
+
+def main():
+    ap = argparse.ArgumentParser()
+    ap.add_argument("--threshold", type=float, default=10.0)
+    ap.add_argument("baseline")
+    ap.add_argument("current")
+    args = ap.parse_args()
+
+    base = load(args.baseline)
+    cur = load(args.current)
+    regressions = 0
+    for key in sorted(cur):
+        suite, name, params = key
+        label = f"{suite}/{name} {params}"
+        if key not in base:
+            print(f"  [NEW ] {label}: {cur[key]:.1f} ns/op")
+            continue
+        old, new = base[key], cur[key]
+        change = (new - old) / old * 100.0 if old > 0 else 0.0
+        tag = "SLOW" if change > args.threshold else "ok  "
+        if change > args.threshold:
+            regressions += 1
+        print(f"  [{tag}] {label}: {old:.1f} -> {new:.1f} ns/op ({change:+.1f}%)")
+    for key in sorted(set(base) - set(cur)):
+        print(f"  [GONE] {key[0]}/{key[1]} {key[2]}")
+
+    if regressions:
+        print(f"{regressions} benchmark(s) regressed by more than {args.threshold:g}%")
+        return 1
+    print("no regressions")
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,566 @@
+#define _GNU_SOURCE // strcasestr
+
+/* end-to-end load generator for the whole daemon
+ *
+ *   loadgen [--mode webhook|poll] [--rate N] [--users N] [--duration S]
+ *           [--drain S] [--tg-port N] [--webhook HOST:PORT] [--secret S]
+ *           [--senders N] [--pid-file PATH]
+ *
+ * serves a mock Telegram Bot API on 127.0.0.1:tg-port (point [bot] api_base
+ * at it) and feeds the bot `rate` private messages per second from `users`
+ * distinct users. In webhook mode they are POSTed to /webhook from
+ * `senders` keep-alive connections; in poll mode they are handed out by
+ * getUpdates as they fall due. Each message text carries "#<seq>", which
+ * bench/mock_llm echoes, so a sendMessage or editMessageText that contains
+ * it marks the reply.
+ *
+ * the load is open-loop: every message has a scheduled send time and all
+ * latencies are measured from it, so a stalled daemon shows up as latency
+ * instead of as a lower send rate. Ack latency is the webhook response (or,
+ * polling, the getUpdates that first hands the message out); reply latency
+ * is the first outgoing message that carries the tag. Messages not
+ * answered within the drain period count as dropped.
+ *
+ * a summary goes to stderr and one JSON object to stdout.
+ */
+
+#include "mockhttp.h"
+
+#include <arpa/inet.h>
+#include <math.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+#define LOADGEN_MAX_MSGS 10000000L
+#define LOADGEN_MAX_SENDERS 256
+#define LOADGEN_USER_BASE 100001L
+
+static struct {
+    int poll_mode;
+    double rate;
+    long users;
+    double duration;
+    double drain;
+    int tg_port;
+    char wh_host[64];
+    int wh_port;
+    char secret[256];
+    int senders;
+    const char *pid_file;
+} g_opt = {
+    .rate = 100.0,
+    .users = 50,
+    .duration = 10.0,
+    .drain = 10.0,
+    .tg_port = 18081,
+    .wh_host = "127.0.0.1",
+    .wh_port = 8443,
+    .senders = 16,
+};
+
+static struct {
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    int started;  // the bot called getMe
+    double t0;    // scheduled time of message 0
+    long n;       // messages in the run
+    double *ack;  // ack time per message, 0 until acked
+    double *reply; // first reply time per message, 0 until answered
+    long acked;
+    long replied;
+    long busy; // webhook 503s
+    long failed; // webhook transport errors and non-2xx other than 503
+    int64_t next_mid;
+} g_run = {.lock = PTHREAD_MUTEX_INITIALIZER, .cond = PTHREAD_COND_INITIALIZER};
+
+static double monotonic_sec(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+static void sleep_until(double t)
+{
+    double d = t - monotonic_sec();
+    if (d <= 0) {
+        return;
+    }
+    struct timespec ts = {.tv_sec = (time_t)d, .tv_nsec = (long)((d - floor(d)) * 1e9)};
+    nanosleep(&ts, NULL);
+}
+
+static double sched_time(long seq)
+{
+    return g_run.t0 + (double)seq / g_opt.rate;
+}
+
+static int update_json(long seq, char *buf, size_t cap)
+{
+    long user = LOADGEN_USER_BASE + seq % g_opt.users;
+    return snprintf(buf, cap,
+                    "{\"update_id\":%ld,\"message\":{\"message_id\":%ld,"
+                    "\"from\":{\"id\":%ld,\"is_bot\":false,\"first_name\":\"load%ld\"},"
+                    "\"chat\":{\"id\":%ld,\"type\":\"private\"},\"date\":%ld,"
+                    "\"text\":\"load test message #%ld\"}}",
+                    seq + 1, seq + 1, user, user, user, (long)time(NULL), seq);
+}
+
+// ── mock Telegram ───────────────────────────────────────────────────
+
+// mark every "#<seq>" in an outgoing message as answered
+static void mark_replies(const char *body)
+{
+    double now = monotonic_sec();
+    pthread_mutex_lock(&g_run.lock);
+    for (const char *p = body; (p = strchr(p, '#')) != NULL; p++) {
+        char *end;
+        long seq = strtol(p + 1, &end, 10);
+        if (end == p + 1 || seq < 0 || seq >= g_run.n || g_run.reply[seq] != 0) {
+            continue;
+        }
+        g_run.reply[seq] = now;
+        g_run.replied++;
+    }
+    pthread_mutex_unlock(&g_run.lock);
+}
+
+/* long-poll getUpdates: hand out every due message from offset on, or wait
+ * for the next one to fall due
+ */
+static void serve_updates(const MockReq *req, MockConn *c)
+{
+    long offset = mock_query_long(req->path, "offset", 0);
+    long limit = mock_query_long(req->path, "limit", 100);
+    long timeout = mock_query_long(req->path, "timeout", 0);
+    long first = offset > 0 ? offset - 1 : 0;
+    double deadline = monotonic_sec() + (double)timeout;
+
+    long due;
+    for (;;) {
+        double now = monotonic_sec();
+        pthread_mutex_lock(&g_run.lock);
+        double t0 = g_run.t0;
+        pthread_mutex_unlock(&g_run.lock);
+        int running = t0 > 0 && now >= t0;
+        due = running ? (long)((now - t0) * g_opt.rate) + 1 : 0;
+        if (due > g_run.n) {
+            due = g_run.n;
+        }
+        if (due > first || now >= deadline) {
+            break;
+        }
+        double next = t0 > 0 && first < g_run.n ? sched_time(first) : now + 0.05;
+        sleep_until(next < deadline ? next : deadline);
+    }
+    if (due - first > limit) {
+        due = first + limit;
+    }
+
+    size_t cap = 64 + (size_t)(due > first ? due - first : 0) * 320;
+    char *out = malloc(cap);
+    if (!out) {
+        mock_respond(c, 500, "application/json", "{}", 2);
+        return;
+    }
+    size_t len = (size_t)snprintf(out, cap, "{\"ok\":true,\"result\":[");
+    double now = monotonic_sec();
+    pthread_mutex_lock(&g_run.lock);
+    for (long seq = first; seq < due; seq++) {
+        if (seq > first) {
+            out[len++] = ',';
+        }
+        len += (size_t)update_json(seq, out + len, cap - len);
+        if (g_run.ack[seq] == 0) {
+            g_run.ack[seq] = now;
+            g_run.acked++;
+        }
+    }
+    pthread_mutex_unlock(&g_run.lock);
+    len += (size_t)snprintf(out + len, cap - len, "]}");
+    mock_respond(c, 200, "application/json", out, len);
+    free(out);
+}
+
+static void tg_handle(void *ud, const MockReq *req, MockConn *c)
+{
+    (void)ud;
+    static const char ctype[] = "application/json";
+    // /bot<token>/<method>[?query]
+    const char *method = strrchr(req->path, '/');
+    method = method ? method + 1 : req->path;
+    size_t mlen = strcspn(method, "?");
+
+#define IS(m) (mlen == sizeof(m) - 1 && strncmp(method, (m), mlen) == 0)
+    if (IS("getMe")) {
+        static const char me[] = "{\"ok\":true,\"result\":{\"id\":1,\"is_bot\":true,"
+                                 "\"first_name\":\"loadgen\",\"username\":\"loadgen_bot\"}}";
+        pthread_mutex_lock(&g_run.lock);
+        g_run.started = 1;
+        pthread_cond_broadcast(&g_run.cond);
+        pthread_mutex_unlock(&g_run.lock);
+        mock_respond(c, 200, ctype, me, sizeof(me) - 1);
+    } else if (IS("getUpdates")) {
+        if (g_opt.poll_mode) {
+            serve_updates(req, c);
+        } else {
+            mock_respond(c, 200, ctype, "{\"ok\":true,\"result\":[]}", 23);
+        }
+    } else if (IS("sendMessage") || IS("editMessageText")) {
+        mark_replies(req->body);
+        pthread_mutex_lock(&g_run.lock);
+        int64_t mid = ++g_run.next_mid;
+        pthread_mutex_unlock(&g_run.lock);
+        char resp[192];
+        int n = snprintf(resp, sizeof(resp),
+                         "{\"ok\":true,\"result\":{\"message_id\":%lld,\"date\":%ld,"
+                         "\"chat\":{\"id\":0,\"type\":\"private\"},\"text\":\"\"}}",
+                         (long long)mid, (long)time(NULL));
+        mock_respond(c, 200, ctype, resp, (size_t)n);
+    } else {
+        mock_respond(c, 200, ctype, "{\"ok\":true,\"result\":true}", 25);
+    }
+#undef IS
+}
+
+// ── webhook senders ─────────────────────────────────────────────────
+
+static int wh_connect(void)
+{
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons((uint16_t)g_opt.wh_port);
+    if (inet_pton(AF_INET, g_opt.wh_host, &addr.sin_addr) != 1) {
+        return -1;
+    }
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (fd < 0) {
+        return -1;
+    }
+    int one = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+// one request/response on fd; returns the HTTP status, or -1 on a broken connection
+static int wh_post(int fd, const char *body, int body_len)
+{
+    char req[2048];
+    int n = snprintf(req, sizeof(req),
+                     "POST /webhook HTTP/1.1\r\nHost: %s\r\nContent-Type: application/json\r\n"
+                     "X-Telegram-Bot-Api-Secret-Token: %s\r\nContent-Length: %d\r\n\r\n%s",
+                     g_opt.wh_host, g_opt.secret, body_len, body);
+    if (n <= 0 || (size_t)n >= sizeof(req)) {
+        return -1;
+    }
+    for (int off = 0; off < n;) {
+        ssize_t w = send(fd, req + off, (size_t)(n - off), MSG_NOSIGNAL);
+        if (w <= 0) {
+            return -1;
+        }
+        off += (int)w;
+    }
+
+    char resp[4096];
+    size_t have = 0;
+    char *end = NULL;
+    while (!end) {
+        if (have + 1 >= sizeof(resp)) {
+            return -1;
+        }
+        ssize_t r = recv(fd, resp + have, sizeof(resp) - 1 - have, 0);
+        if (r <= 0) {
+            return -1;
+        }
+        have += (size_t)r;
+        resp[have] = '\0';
+        end = strstr(resp, "\r\n\r\n");
+    }
+    int status = 0;
+    if (sscanf(resp, "HTTP/1.%*d %d", &status) != 1) {
+        return -1;
+    }
+    size_t clen = 0;
+    const char *cl = strcasestr(resp, "\r\nContent-Length:");
+    if (cl && cl < end) {
+        clen = (size_t)strtoul(cl + 17, NULL, 10);
+    }
+    size_t body_have = have - (size_t)(end + 4 - resp);
+    while (body_have < clen) {
+        ssize_t r = recv(fd, resp, sizeof(resp), 0);
+        if (r <= 0) {
+            return -1;
+        }
+        body_have += (size_t)r;
+    }
+    return status;
+}
+
+static void *sender_main(void *arg)
+{
+    long id = (long)(intptr_t)arg;
+    int fd = -1;
+    char body[1024];
+    for (long seq = id; seq < g_run.n; seq += g_opt.senders) {
+        sleep_until(sched_time(seq));
+        int len = update_json(seq, body, sizeof(body));
+        int status = -1;
+        for (int attempt = 0; attempt < 2 && status < 0; attempt++) {
+            if (fd < 0) {
+                fd = wh_connect();
+            }
+            if (fd >= 0 && (status = wh_post(fd, body, len)) < 0) {
+                close(fd); // stale keep-alive connection; reconnect once
+                fd = -1;
+            }
+        }
+        double now = monotonic_sec();
+        pthread_mutex_lock(&g_run.lock);
+        if (status >= 200 && status < 300) {
+            g_run.ack[seq] = now;
+            g_run.acked++;
+        } else if (status == 503) {
+            g_run.busy++;
+        } else {
+            g_run.failed++;
+        }
+        pthread_mutex_unlock(&g_run.lock);
+    }
+    if (fd >= 0) {
+        close(fd);
+    }
+    return NULL;
+}
+
+// ── report ──────────────────────────────────────────────────────────
+
+// utime + stime of pid in seconds, or -1
+static double proc_cpu_sec(long pid)
+{
+    char path[64];
+    snprintf(path, sizeof(path), "/proc/%ld/stat", pid);
+    FILE *f = fopen(path, "r");
+    if (!f) {
+        return -1;
+    }
+    char buf[1024];
+    size_t n = fread(buf, 1, sizeof(buf) - 1, f);
+    fclose(f);
+    buf[n] = '\0';
+    // the command name may contain spaces; fields resume after the last ')'
+    const char *p = strrchr(buf, ')');
+    unsigned long ut = 0, st = 0;
+    if (!p || sscanf(p + 2, "%*c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %lu %lu", &ut, &st) != 2) {
+        return -1;
+    }
+    return (double)(ut + st) / (double)sysconf(_SC_CLK_TCK);
+}
+
+static long read_pid(void)
+{
+    if (!g_opt.pid_file) {
+        return 0;
+    }
+    FILE *f = fopen(g_opt.pid_file, "r");
+    long pid = 0;
+    if (f) {
+        if (fscanf(f, "%ld", &pid) != 1) {
+            pid = 0;
+        }
+        fclose(f);
+    }
+    return pid;
+}
+
+static int cmp_double(const void *a, const void *b)
+{
+    double x = *(const double *)a, y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+typedef struct {
+    double p50, p99, p999, max;
+} Quantiles;
+
+// latency quantiles in ms of done[i] - scheduled(i) over the messages that have one
+static Quantiles latencies(const double *done)
+{
+    Quantiles q = {0};
+    double *v = malloc((size_t)g_run.n * sizeof(double));
+    size_t k = 0;
+    for (long i = 0; v && i < g_run.n; i++) {
+        if (done[i] != 0) {
+            v[k++] = (done[i] - sched_time(i)) * 1000.0;
+        }
+    }
+    if (k > 0) {
+        qsort(v, k, sizeof(double), cmp_double);
+        q.p50 = v[(size_t)((double)(k - 1) * 0.5)];
+        q.p99 = v[(size_t)((double)(k - 1) * 0.99)];
+        q.p999 = v[(size_t)((double)(k - 1) * 0.999)];
+        q.max = v[k - 1];
+    }
+    free(v);
+    return q;
+}
+
+static void usage(void)
+{
+    fprintf(stderr, "usage: loadgen [--mode webhook|poll] [--rate N] [--users N] [--duration S]\n"
+                    "               [--drain S] [--tg-port N] [--webhook HOST:PORT] [--secret S]\n"
+                    "               [--senders N] [--pid-file PATH]\n");
+}
+
+static int parse_args(int argc, char **argv)
+{
+    for (int i = 1; i < argc; i += 2) {
+        const char *k = argv[i];
+        const char *v = i + 1 < argc ? argv[i + 1] : NULL;
+        if (!v) {
+            return -1;
+        }
+        if (strcmp(k, "--mode") == 0) {
+            if (strcmp(v, "poll") != 0 && strcmp(v, "webhook") != 0) {
+                return -1;
+            }
+            g_opt.poll_mode = strcmp(v, "poll") == 0;
+        } else if (strcmp(k, "--rate") == 0) {
+            g_opt.rate = atof(v);
+        } else if (strcmp(k, "--users") == 0) {
+            g_opt.users = atol(v);
+        } else if (strcmp(k, "--duration") == 0) {
+            g_opt.duration = atof(v);
+        } else if (strcmp(k, "--drain") == 0) {
+            g_opt.drain = atof(v);
+        } else if (strcmp(k, "--tg-port") == 0) {
+            g_opt.tg_port = atoi(v);
+        } else if (strcmp(k, "--webhook") == 0) {
+            const char *colon = strrchr(v, ':');
+            if (!colon || (size_t)(colon - v) >= sizeof(g_opt.wh_host)) {
+                return -1;
+            }
+            snprintf(g_opt.wh_host, sizeof(g_opt.wh_host), "%.*s", (int)(colon - v), v);
+            g_opt.wh_port = atoi(colon + 1);
+        } else if (strcmp(k, "--secret") == 0) {
+            snprintf(g_opt.secret, sizeof(g_opt.secret), "%s", v);
+        } else if (strcmp(k, "--senders") == 0) {
+            g_opt.senders = atoi(v);
+        } else if (strcmp(k, "--pid-file") == 0) {
+            g_opt.pid_file = v;
+        } else {
+            return -1;
+        }
+    }
+    if (g_opt.rate <= 0 || g_opt.users < 1 || g_opt.duration <= 0 || g_opt.senders < 1 ||
+        g_opt.senders > LOADGEN_MAX_SENDERS) {
+        return -1;
+    }
+    return 0;
+}
+
+int main(int argc, char **argv)
+{
+    if (parse_args(argc, argv) != 0) {
+        usage();
+        return 2;
+    }
+    g_run.n = (long)(g_opt.rate * g_opt.duration);
+    if (g_run.n < 1 || g_run.n > LOADGEN_MAX_MSGS) {
+        fprintf(stderr, "loadgen: rate * duration must be 1..%ld messages\n", LOADGEN_MAX_MSGS);
+        return 2;
+    }
+    g_run.ack = calloc((size_t)g_run.n, sizeof(double));
+    g_run.reply = calloc((size_t)g_run.n, sizeof(double));
+    if (!g_run.ack || !g_run.reply) {
+        fprintf(stderr, "loadgen: out of memory\n");
+        return 1;
+    }
+
+    MockServer *tg = mock_listen(g_opt.tg_port, tg_handle, NULL);
+    if (!tg) {
+        return 1;
+    }
+    fprintf(stderr, "loadgen: mock Telegram on 127.0.0.1:%d, waiting for getMe\n", mock_port(tg));
+    pthread_mutex_lock(&g_run.lock);
+    while (!g_run.started) {
+        pthread_cond_wait(&g_run.cond, &g_run.lock);
+    }
+    pthread_mutex_unlock(&g_run.lock);
+    sleep_until(monotonic_sec() + 1.0); // let the webhook server and workers come up
+
+    long pid = read_pid();
+    double cpu0 = pid > 0 ? proc_cpu_sec(pid) : -1;
+    fprintf(stderr, "loadgen: %s mode, %ld messages at %.0f/s from %ld users\n",
+            g_opt.poll_mode ? "poll" : "webhook", g_run.n, g_opt.rate, g_opt.users);
+
+    pthread_t senders[LOADGEN_MAX_SENDERS];
+    int nsenders = g_opt.poll_mode ? 0 : g_opt.senders;
+    pthread_mutex_lock(&g_run.lock);
+    g_run.t0 = monotonic_sec() + 0.1;
+    pthread_mutex_unlock(&g_run.lock);
+    for (int i = 0; i < nsenders; i++) {
+        pthread_create(&senders[i], NULL, sender_main, (void *)(intptr_t)i);
+    }
+    for (int i = 0; i < nsenders; i++) {
+        pthread_join(senders[i], NULL);
+    }
+
+    // wait out the drain period, or less if everything has been answered
+    double drain_end = sched_time(g_run.n) + g_opt.drain;
+    for (;;) {
+        pthread_mutex_lock(&g_run.lock);
+        int done = g_run.replied >= g_run.n;
+        pthread_mutex_unlock(&g_run.lock);
+        if (done || monotonic_sec() >= drain_end) {
+            break;
+        }
+        sleep_until(monotonic_sec() + 0.05);
+    }
+    double cpu1 = pid > 0 ? proc_cpu_sec(pid) : -1;
+
+    pthread_mutex_lock(&g_run.lock);
+    Quantiles ack = latencies(g_run.ack);
+    Quantiles rep = latencies(g_run.reply);
+    long acked = g_run.acked, replied = g_run.replied, busy = g_run.busy, failed = g_run.failed;
+    pthread_mutex_unlock(&g_run.lock);
+    double drop = (double)(g_run.n - replied) / (double)g_run.n;
+    double cpu_ms = cpu0 >= 0 && cpu1 >= 0 && replied > 0
+                        ? (cpu1 - cpu0) * 1000.0 / (double)replied
+                        : -1.0;
+
+    fprintf(stderr,
+            "loadgen: sent %ld, acked %ld, busy %ld, failed %ld, replied %ld (drop %.2f%%)\n"
+            "loadgen: ack   p50 %.2f ms  p99 %.2f ms  p999 %.2f ms  max %.2f ms\n"
+            "loadgen: reply p50 %.2f ms  p99 %.2f ms  p999 %.2f ms  max %.2f ms\n",
+            g_run.n, acked, busy, failed, replied, drop * 100.0, ack.p50, ack.p99, ack.p999,
+            ack.max, rep.p50, rep.p99, rep.p999, rep.max);
+    if (cpu_ms >= 0) {
+        fprintf(stderr, "loadgen: daemon cpu %.3f ms/message\n", cpu_ms);
+    }
+    printf("{\"mode\":\"%s\",\"rate\":%g,\"users\":%ld,\"duration\":%g,"
+           "\"sent\":%ld,\"acked\":%ld,\"busy\":%ld,\"failed\":%ld,\"replied\":%ld,"
+           "\"drop_rate\":%.6f,"
+           "\"ack_ms\":{\"p50\":%.3f,\"p99\":%.3f,\"p999\":%.3f,\"max\":%.3f},"
+           "\"reply_ms\":{\"p50\":%.3f,\"p99\":%.3f,\"p999\":%.3f,\"max\":%.3f},"
+           "\"cpu_ms_per_msg\":%.4f}\n",
+           g_opt.poll_mode ? "poll" : "webhook", g_opt.rate, g_opt.users, g_opt.duration, g_run.n,
+           acked, busy, failed, replied, drop, ack.p50, ack.p99, ack.p999, ack.max, rep.p50,
+           rep.p99, rep.p999, rep.max, cpu_ms);
+    fflush(stdout);
+
+    // the poll thread may still be parked in a long poll; exit without joining
+    _exit(0);
+}
@@ -0,0 +1,106 @@
+#!/bin/sh
+# end-to-end load test: tgbot against bench/loadgen (mock Telegram) and
+# bench/mock_llm, one run per invocation. Prints loadgen's JSON report on
+# stdout; everything else goes to stderr.
+#
+#   make -C bench loadtest MODE=webhook RATE=200 USERS=100 WORKERS=4
+#
+# knobs (environment): MODE webhook|poll, RATE msgs/s, USERS, DURATION and
+# DRAIN seconds, WORKERS ([workers] count), WEBHOOK_THREADS, POOL_SIZE,
+# DISPATCHERS, STREAM true|false, FIRST_TOKEN_MS, TOKEN_MS, TOKENS, and
+# TGBOT (path to the daemon binary).
+set -eu
+
+here=$(cd "$(dirname "$0")" && pwd)
+build="$here/build"
+TGBOT=${TGBOT:-$here/../tgbot}
+MODE=${MODE:-webhook}
+RATE=${RATE:-100}
+USERS=${USERS:-50}
+DURATION=${DURATION:-10}
+DRAIN=${DRAIN:-10}
+WORKERS=${WORKERS:-4}
+WEBHOOK_THREADS=${WEBHOOK_THREADS:-4}
+POOL_SIZE=${POOL_SIZE:-8}
+DISPATCHERS=${DISPATCHERS:-1}
+STREAM=${STREAM:-false}
+FIRST_TOKEN_MS=${FIRST_TOKEN_MS:-50}
+TOKEN_MS=${TOKEN_MS:-5}
+TOKENS=${TOKENS:-20}
+TG_PORT=${TG_PORT:-18081}
+LLM_PORT=${LLM_PORT:-18082}
+WH_PORT=${WH_PORT:-18443}
+SECRET=loadtest-secret
+
+[ -x "$TGBOT" ] || { echo "loadtest: $TGBOT not built (run make first)" >&2; exit 1; }
+
+dir=$(mktemp -d /tmp/tgbot-loadtest.XXXXXX)
+pids=""
+cleanup() {
+    for p in $pids; do kill "$p" 2>/dev/null || true; done
+    wait 2>/dev/null || true
+    rm -rf "$dir"
+}
+trap cleanup EXIT INT TERM
+
+webhook=false
+[ "$MODE" = webhook ] && webhook=true
+
+i=0
+: > "$dir/whitelist.txt"
+while [ "$i" -lt "$USERS" ]; do
+    echo $((100001 + i)) >> "$dir/whitelist.txt"
+    i=$((i + 1))
+done
+
+cat > "$dir/tgbot.ini" <<EOF
+[bot]
+token = 123456:loadtest
+reply_delay = 0
+send_rate = 0
+chat_rate = 0
+group_rate = 0
+poll_timeout = 5
+whitelist_path = $dir/whitelist.txt
+api_base = http://127.0.0.1:$TG_PORT/bot
+
+[webhook]
+enabled = $webhook
+port = $WH_PORT
+secret = $SECRET
+threads = $WEBHOOK_THREADS
+pool_size = $POOL_SIZE
+dispatchers = $DISPATCHERS
+
+[workers]
+count = $WORKERS
+
+[log]
+path = $dir/tgbot.log
+
+[llm]
+endpoint = http://127.0.0.1:$LLM_PORT
+stream = $STREAM
+EOF
+
+"$build/mock_llm" --port "$LLM_PORT" --first-token-ms "$FIRST_TOKEN_MS" \
+    --token-ms "$TOKEN_MS" --tokens "$TOKENS" &
+pids="$pids $!"
+
+"$build/loadgen" --mode "$MODE" --rate "$RATE" --users "$USERS" \
+    --duration "$DURATION" --drain "$DRAIN" --tg-port "$TG_PORT" \
+    --webhook "127.0.0.1:$WH_PORT" --secret "$SECRET" \
+    --pid-file "$dir/tgbot.pid" > "$dir/report.json" &
+loadgen=$!
+
+sleep 0.2
+(cd "$dir" && unset T_TOKEN TELEGRAM_BOT_TOKEN T_SECRET WEBHOOK_SECRET && exec "$TGBOT" > "$dir/tgbot.out" 2>&1) &
+echo $! > "$dir/tgbot.pid"
+pids="$pids $!"
+
+if ! wait "$loadgen"; then
+    echo "loadtest: loadgen failed; daemon log tail:" >&2
+    tail -n 20 "$dir/tgbot.log" >&2 2>/dev/null || true
+    exit 1
+fi
+cat "$dir/report.json"
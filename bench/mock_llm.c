@@ -0,0 +1,160 @@
+#define _POSIX_C_SOURCE 200809L
+#define _DEFAULT_SOURCE
+
+/* mock OpenAI-compatible LLM for load tests
+ *
+ *   mock_llm [--port N] [--first-token-ms N] [--token-ms N] [--tokens N]
+ *
+ * answers POST /v1/chat/completions after first-token-ms, then one token
+ * every token-ms (streamed as SSE when the request asks for it, otherwise
+ * one completion at the end). The reply starts with every "#<seq>" tag in
+ * the last user message so loadgen can match replies to the updates it
+ * sent. GET /v1/models answers 200 for health probes.
+ */
+
+#include "mockhttp.h"
+
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+static struct {
+    int first_token_ms;
+    int token_ms;
+    int tokens;
+} g_opt = {.first_token_ms = 50, .token_ms = 5, .tokens = 20};
+
+static volatile sig_atomic_t g_stop;
+
+static void on_signal(int sig)
+{
+    (void)sig;
+    g_stop = 1;
+}
+
+static void sleep_ms(int ms)
+{
+    if (ms <= 0) {
+        return;
+    }
+    struct timespec ts = {.tv_sec = ms / 1000, .tv_nsec = (long)(ms % 1000) * 1000000L};
+    nanosleep(&ts, NULL);
+}
+
+// copy the "#<digits>" tags after the last user turn into out, space separated
+static void collect_tags(const char *body, char *out, size_t cap)
+{
+    const char *p = body;
+    const char *last = NULL;
+    while ((p = strstr(p, "\"role\":\"user\"")) != NULL) {
+        last = p++;
+    }
+    size_t n = 0;
+    out[0] = '\0';
+    for (p = last ? last : body; (p = strchr(p, '#')) != NULL; p++) {
+        size_t d = 1;
+        while (p[d] >= '0' && p[d] <= '9') {
+            d++;
+        }
+        if (d == 1 || n + d + 1 >= cap) {
+            continue;
+        }
+        memcpy(out + n, p, d);
+        n += d;
+        out[n++] = ' ';
+        out[n] = '\0';
+    }
+}
+
+static void handle(void *ud, const MockReq *req, MockConn *c)
+{
+    (void)ud;
+    static const char ctype_json[] = "application/json";
+
+    if (strcmp(req->method, "GET") == 0 && strstr(req->path, "/v1/models")) {
+        static const char models[] = "{\"object\":\"list\",\"data\":[{\"id\":\"mock\"}]}";
+        mock_respond(c, 200, ctype_json, models, sizeof(models) - 1);
+        return;
+    }
+    if (strcmp(req->method, "POST") != 0 || !strstr(req->path, "/v1/chat/completions")) {
+        mock_respond(c, 404, ctype_json, "{}", 2);
+        return;
+    }
+
+    char tags[1024];
+    collect_tags(req->body, tags, sizeof(tags));
+    int stream = strstr(req->body, "\"stream\":true") != NULL;
+
+    sleep_ms(g_opt.first_token_ms);
+    if (stream) {
+        char ev[1280];
+        if (mock_chunk_begin(c, 200, "text/event-stream") != 0) {
+            return;
+        }
+        int n = snprintf(ev, sizeof(ev),
+                         "data: {\"choices\":[{\"delta\":{\"content\":\"%s\"}}]}\n\n", tags);
+        mock_chunk(c, ev, (size_t)n);
+        for (int i = 0; i < g_opt.tokens; i++) {
+            sleep_ms(g_opt.token_ms);
+            n = snprintf(ev, sizeof(ev),
+                         "data: {\"choices\":[{\"delta\":{\"content\":\"tok%d \"}}]}\n\n", i);
+            if (mock_chunk(c, ev, (size_t)n) != 0) {
+                return;
+            }
+        }
+        static const char done[] = "data: [DONE]\n\n";
+        mock_chunk(c, done, sizeof(done) - 1);
+        mock_chunk_end(c);
+        return;
+    }
+
+    sleep_ms(g_opt.token_ms * g_opt.tokens);
+    char text[8192];
+    size_t len = (size_t)snprintf(text, sizeof(text), "%s", tags);
+    for (int i = 0; i < g_opt.tokens && len + 16 < sizeof(text); i++) {
+        len += (size_t)snprintf(text + len, sizeof(text) - len, "tok%d ", i);
+    }
+    char resp[8448];
+    int n = snprintf(resp, sizeof(resp),
+                     "{\"choices\":[{\"index\":0,\"message\":{\"role\":\"assistant\","
+                     "\"content\":\"%s\"},\"finish_reason\":\"stop\"}]}",
+                     text);
+    mock_respond(c, 200, ctype_json, resp, (size_t)n);
+}
+
+int main(int argc, char **argv)
+{
+    int port = 18082;
+    for (int i = 1; i + 1 < argc; i += 2) {
+        int v = atoi(argv[i + 1]);
+        if (strcmp(argv[i], "--port") == 0) {
+            port = v;
+        } else if (strcmp(argv[i], "--first-token-ms") == 0) {
+            g_opt.first_token_ms = v;
+        } else if (strcmp(argv[i], "--token-ms") == 0) {
+            g_opt.token_ms = v;
+        } else if (strcmp(argv[i], "--tokens") == 0) {
+            g_opt.tokens = v;
+        } else {
+            fprintf(stderr, "mock_llm: unknown option %s\n", argv[i]);
+            return 2;
+        }
+    }
+
+    signal(SIGINT, on_signal);
+    signal(SIGTERM, on_signal);
+    MockServer *srv = mock_listen(port, handle, NULL);
+    if (!srv) {
+        return 1;
+    }
+    fprintf(stderr, "mock_llm: listening on 127.0.0.1:%d (first token %d ms, %d x %d ms)\n",
+            mock_port(srv), g_opt.first_token_ms, g_opt.tokens, g_opt.token_ms);
+    while (!g_stop) {
+        pause();
+    }
+    mock_stop(srv);
+    return 0;
+}
@@ -0,0 +1,279 @@
+#define _GNU_SOURCE // strcasestr
+
+#include "mockhttp.h"
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#define MOCK_HDR_MAX 16384
+
+struct MockServer {
+    int fd;
+    int port;
+    mock_handler handler;
+    void *ud;
+    pthread_t acceptor;
+};
+
+struct MockConn {
+    int fd;
+    int failed;
+};
+
+typedef struct {
+    MockServer *srv;
+    int fd;
+} ConnArg;
+
+static int write_all(MockConn *c, const char *p, size_t len)
+{
+    while (len > 0 && !c->failed) {
+        ssize_t n = send(c->fd, p, len, MSG_NOSIGNAL);
+        if (n <= 0) {
+            c->failed = 1;
+            break;
+        }
+        p += n;
+        len -= (size_t)n;
+    }
+    return c->failed ? -1 : 0;
+}
+
+static const char *reason(int status)
+{
+    switch (status) {
+    case 200:
+        return "OK";
+    case 404:
+        return "Not Found";
+    case 429:
+        return "Too Many Requests";
+    default:
+        return "Error";
+    }
+}
+
+int mock_respond(MockConn *c, int status, const char *ctype, const char *body, size_t len)
+{
+    char hdr[256];
+    int n = snprintf(hdr, sizeof(hdr),
+                     "HTTP/1.1 %d %s\r\nContent-Type: %s\r\nContent-Length: %zu\r\n\r\n", status,
+                     reason(status), ctype, len);
+    if (write_all(c, hdr, (size_t)n) != 0) {
+        return -1;
+    }
+    return write_all(c, body, len);
+}
+
+int mock_chunk_begin(MockConn *c, int status, const char *ctype)
+{
+    char hdr[256];
+    int n = snprintf(hdr, sizeof(hdr),
+                     "HTTP/1.1 %d %s\r\nContent-Type: %s\r\nTransfer-Encoding: chunked\r\n\r\n",
+                     status, reason(status), ctype);
+    return write_all(c, hdr, (size_t)n);
+}
+
+int mock_chunk(MockConn *c, const char *data, size_t len)
+{
+    if (len == 0) {
+        return 0; // an empty chunk would end the body
+    }
+    char size[32];
+    int n = snprintf(size, sizeof(size), "%zx\r\n", len);
+    if (write_all(c, size, (size_t)n) != 0 || write_all(c, data, len) != 0) {
+        return -1;
+    }
+    return write_all(c, "\r\n", 2);
+}
+
+int mock_chunk_end(MockConn *c)
+{
+    return write_all(c, "0\r\n\r\n", 5);
+}
+
+long mock_query_long(const char *path, const char *name, long dflt)
+{
+    const char *q = strchr(path, '?');
+    size_t nlen = strlen(name);
+    while (q) {
+        q++;
+        if (strncmp(q, name, nlen) == 0 && q[nlen] == '=') {
+            return strtol(q + nlen + 1, NULL, 10);
+        }
+        q = strchr(q, '&');
+    }
+    return dflt;
+}
+
+// Content-Length from a header block, 0 when absent
+static size_t content_length(const char *hdrs)
+{
+    for (const char *p = hdrs; (p = strchr(p, '\n')) != NULL;) {
+        p++;
+        if (strncasecmp(p, "Content-Length:", 15) == 0) {
+            return (size_t)strtoul(p + 15, NULL, 10);
+        }
+    }
+    return 0;
+}
+
+static void *conn_main(void *arg)
+{
+    ConnArg ca = *(ConnArg *)arg;
+    free(arg);
+    MockConn c = {.fd = ca.fd};
+    int one = 1;
+    setsockopt(ca.fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+    size_t cap = MOCK_HDR_MAX;
+    char *buf = malloc(cap + 1);
+    size_t have = 0;
+    while (buf && !c.failed) {
+        // read a full header block
+        char *end;
+        buf[have] = '\0';
+        while ((end = strstr(buf, "\r\n\r\n")) == NULL) {
+            if (have >= MOCK_HDR_MAX) {
+                goto out;
+            }
+            ssize_t n = recv(ca.fd, buf + have, MOCK_HDR_MAX - have, 0);
+            if (n <= 0) {
+                goto out;
+            }
+            have += (size_t)n;
+            buf[have] = '\0';
+        }
+        size_t hdr_len = (size_t)(end - buf) + 4;
+
+        MockReq req;
+        memset(&req, 0, sizeof(req));
+        if (sscanf(buf, "%7s %2047s", req.method, req.path) != 2) {
+            break;
+        }
+        int closing = strcasestr(buf, "\r\nConnection: close") != NULL &&
+                      strcasestr(buf, "\r\nConnection: close") < end;
+        end[2] = '\0'; // headers only, for the Content-Length lookup
+        size_t body_len = content_length(buf);
+
+        // then the body
+        if (hdr_len + body_len > cap) {
+            cap = hdr_len + body_len;
+            char *nb = realloc(buf, cap + 1);
+            if (!nb) {
+                break;
+            }
+            buf = nb;
+        }
+        while (have < hdr_len + body_len) {
+            ssize_t n = recv(ca.fd, buf + have, hdr_len + body_len - have, 0);
+            if (n <= 0) {
+                goto out;
+            }
+            have += (size_t)n;
+        }
+        char saved = buf[hdr_len + body_len];
+        buf[hdr_len + body_len] = '\0';
+        req.body = buf + hdr_len;
+        req.body_len = body_len;
+        ca.srv->handler(ca.srv->ud, &req, &c);
+        buf[hdr_len + body_len] = saved;
+
+        // keep whatever of the next request was already read
+        size_t used = hdr_len + body_len;
+        memmove(buf, buf + used, have - used);
+        have -= used;
+        if (closing) {
+            break;
+        }
+    }
+out:
+    free(buf);
+    close(ca.fd);
+    return NULL;
+}
+
+static void *accept_main(void *arg)
+{
+    MockServer *s = (MockServer *)arg;
+    for (;;) {
+        int fd = accept(s->fd, NULL, NULL);
+        if (fd < 0) {
+            break; // listening socket shut down
+        }
+        ConnArg *ca = malloc(sizeof(*ca));
+        pthread_t t;
+        if (!ca) {
+            close(fd);
+            continue;
+        }
+        ca->srv = s;
+        ca->fd = fd;
+        if (pthread_create(&t, NULL, conn_main, ca) != 0) {
+            free(ca);
+            close(fd);
+            continue;
+        }
+        pthread_detach(t);
+    }
+    return NULL;
+}
+
+MockServer *mock_listen(int port, mock_handler h, void *ud)
+{
+    MockServer *s = calloc(1, sizeof(*s));
+    if (!s) {
+        return NULL;
+    }
+    s->handler = h;
+    s->ud = ud;
+    s->fd = socket(AF_INET, SOCK_STREAM, 0);
+    int one = 1;
+    setsockopt(s->fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons((uint16_t)port);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    socklen_t alen = sizeof(addr);
+    if (s->fd < 0 || bind(s->fd, (struct sockaddr *)&addr, sizeof(addr)) != 0 ||
+        listen(s->fd, 512) != 0 || getsockname(s->fd, (struct sockaddr *)&addr, &alen) != 0) {
+        perror("mockhttp: listen");
+        if (s->fd >= 0) {
+            close(s->fd);
+        }
+        free(s);
+        return NULL;
+    }
+    s->port = ntohs(addr.sin_port);
+    if (pthread_create(&s->acceptor, NULL, accept_main, s) != 0) {
+        close(s->fd);
+        free(s);
+        return NULL;
+    }
+    return s;
+}
+
+int mock_port(const MockServer *s)
+{
+    return s ? s->port : 0;
+}
+
+void mock_stop(MockServer *s)
+{
+    if (!s) {
+        return;
+    }
+    shutdown(s->fd, SHUT_RDWR);
+    pthread_join(s->acceptor, NULL);
+    close(s->fd);
+    free(s);
+}
@@ -0,0 +1,43 @@
+#pragma once
+
+#include <stddef.h>
+
+/* minimal HTTP/1.1 server for the load-test mocks
+ * one thread per connection, keep-alive, Content-Length request bodies.
+ * enough for curl talking to a mock Telegram or LLM on loopback; not a
+ * general-purpose server.
+ */
+
+typedef struct {
+    char method[8];
+    char path[2048]; // request target, query string included
+    const char *body; // valid only during the handler call
+    size_t body_len;
+} MockReq;
+
+typedef struct MockConn MockConn;
+typedef struct MockServer MockServer;
+
+typedef void (*mock_handler)(void *ud, const MockReq *req, MockConn *c);
+
+/* listen on 127.0.0.1:port (0 picks a free port) and serve requests with h
+ * returns NULL on error
+ */
+MockServer *mock_listen(int port, mock_handler h, void *ud);
+
+// the bound port
+int mock_port(const MockServer *s);
+
+// stop accepting; open connections finish on their own
+void mock_stop(MockServer *s);
+
+// send a whole response; returns 0, or -1 if the peer went away
+int mock_respond(MockConn *c, int status, const char *ctype, const char *body, size_t len);
+
+// send a response incrementally with chunked transfer encoding
+int mock_chunk_begin(MockConn *c, int status, const char *ctype);
+int mock_chunk(MockConn *c, const char *data, size_t len);
+int mock_chunk_end(MockConn *c);
+
+// value of a query parameter in path, or dflt when absent
+long mock_query_long(const char *path, const char *name, long dflt);
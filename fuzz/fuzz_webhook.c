@@ -4,6 +4,7 @@
 #include "../src/commands.h"
 #include "../src/config.h"
 #include "../src/queue.h"
+#include "../src/update.h"
 #include "../src/whitelist.h"
 #include "../lib/cJSON.h"
 
@@ -59,6 +60,43 @@ int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size)
     memcpy(body, data, size);
     body[size] = '\0';
 
+    // selective scanner: must never read past the input and must agree with
+    // cJSON on every body both accept (cJSON is stricter about surrogates)
+    UpdateView view;
+    cJSON *ref = cJSON_ParseWithLength(body, size);
+    if (update_view_parse(body, size, &view) == 0 && ref) {
+        UpdateView rv;
+        update_view_from_cjson(ref, &rv);
+        if (rv.has_update_id != view.has_update_id || rv.has_chat_id != view.has_chat_id ||
+            rv.has_from_id != view.has_from_id) {
+            abort();
+        }
+        // ids past 2^53 are exact here but rounded through cJSON's double
+        if (view.has_chat_id && rv.chat_id != view.chat_id &&
+            llabs(view.chat_id) < (1LL << 53)) {
+            abort();
+        }
+        if (!view.text.p != !rv.text.p) {
+            abort();
+        }
+        char a[UPDATE_TEXT_MAX];
+        char b[UPDATE_TEXT_MAX];
+        update_str_copy(&view.text, a, sizeof(a), "");
+        update_str_copy(&rv.text, b, sizeof(b), "");
+        if (strcmp(a, b) != 0) {
+            abort();
+        }
+    }
+    cJSON_Delete(ref);
+
+    UpdateIter it;
+    if (update_iter_init(&it, body, size) == 0) {
+        char name[256];
+        while (update_iter_next(&it, &view) > 0) {
+            update_str_copy(&view.first_name, name, sizeof(name), "?");
+        }
+    }
+
     cJSON *root = cJSON_Parse(body);
     if (root) {
         // try to extract message text and dispatch as command
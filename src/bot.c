@@ -3,13 +3,23 @@
 #include "bot.h"
 #include "cJSON.h"
 #include "config.h"
+#include "http.h"
+#include "jsonw.h"
 #include "logger.h"
+#include "metrics.h"
+#include "ratelimit.h"
+#include "respbuf.h"
+#include "simd.h"
 
+#include <arpa/inet.h>
 #include <curl/curl.h>
 #include <inttypes.h>
+#include <pthread.h>
+#include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <strings.h>
 #include <unistd.h>
 
 struct BotHandle {
@@ -20,62 +30,32 @@ struct BotHandle {
     size_t url_prefix_len;
     volatile sig_atomic_t *abort_flag;
     int allow_http;
+    JsonW jw;     // request body encoder, reused across calls
+    RespBuf resp; // response body, retained across calls
 };
 
-typedef struct {
-    char *data;
-    size_t len;
-    size_t cap;
-} Buffer;
-
 typedef struct {
     const char *url;
     const char *post_body;
+    size_t post_len;
     struct curl_slist *headers;
     long timeout;
     int parse_retry_after;
     int retry_once_on_429;
+    int governed;    // a send to chat_id: wait for the rate governor first
+    int64_t chat_id;
     const char *curl_error_msg;
     const char *curl_retry_error_msg;
     const char *json_error_msg;
     const char *api_error_msg;
 } ApiRequestSpec;
 
-static size_t write_cb(char *ptr, size_t size, size_t nmemb, void *userdata)
+// async sends only look at the status code, so their bodies are dropped
+static size_t discard_cb(char *ptr, size_t size, size_t nmemb, void *userdata)
 {
-    Buffer *buf = (Buffer *)userdata;
-
-    // guard against size_t overflow on 32bit targets
-    if (nmemb != 0 && size > SIZE_MAX / nmemb) {
-        return 0;
-    }
-    size_t bytes = size * nmemb;
-
-    if (buf->len + bytes + 1 > RESPONSE_BUF_MAX) {
-        log_error("bot: response too large (>%d bytes)", RESPONSE_BUF_MAX);
-        return 0; // signal error to curl
-    }
-
-    if (buf->len + bytes + 1 > buf->cap) {
-        size_t new_cap = (buf->cap == 0) ? 4096 : buf->cap * 2;
-        while (new_cap < buf->len + bytes + 1) {
-            if (new_cap > SIZE_MAX / 2) {
-                return 0; // capacity would overflow
-            }
-            new_cap *= 2;
-        }
-        char *tmp = realloc(buf->data, new_cap);
-        if (!tmp) {
-            return 0;
-        }
-        buf->data = tmp;
-        buf->cap = new_cap;
-    }
-
-    memcpy(buf->data + buf->len, ptr, bytes);
-    buf->len += bytes;
-    buf->data[buf->len] = '\0';
-    return bytes;
+    (void)ptr;
+    (void)userdata;
+    return size * nmemb;
 }
 
 // build URL by appending method to pre-built prefix
@@ -99,6 +79,7 @@ static void curl_set_tls(CURL *c)
     curl_easy_setopt(c, CURLOPT_SSL_VERIFYHOST, 2L);
     curl_easy_setopt(c, CURLOPT_PROTOCOLS_STR, "https");
     curl_easy_setopt(c, CURLOPT_NOSIGNAL, 1L);
+    http_easy_apply(c);
 }
 
 // variant that allows http if bot->allow_http is set
@@ -151,15 +132,16 @@ static size_t header_cb(char *buffer, size_t size, size_t nitems, void *userdata
     return total;
 }
 
-static void curl_prepare_request(BotHandle *bot, const ApiRequestSpec *spec, Buffer *buf, long *retry_after)
+static void curl_prepare_request(BotHandle *bot, const ApiRequestSpec *spec, long *retry_after)
 {
     curl_easy_reset(bot->curl);
     curl_set_tls_bot(bot);
     curl_set_abort(bot);
 
     curl_easy_setopt(bot->curl, CURLOPT_URL, spec->url);
-    curl_easy_setopt(bot->curl, CURLOPT_WRITEFUNCTION, write_cb);
-    curl_easy_setopt(bot->curl, CURLOPT_WRITEDATA, buf);
+    respbuf_begin(&bot->resp, bot->curl);
+    curl_easy_setopt(bot->curl, CURLOPT_WRITEFUNCTION, respbuf_write_cb);
+    curl_easy_setopt(bot->curl, CURLOPT_WRITEDATA, &bot->resp);
     curl_easy_setopt(bot->curl, CURLOPT_TIMEOUT, spec->timeout);
 
     if (spec->headers) {
@@ -167,6 +149,7 @@ static void curl_prepare_request(BotHandle *bot, const ApiRequestSpec *spec, Buf
     }
 
     if (spec->post_body) {
+        curl_easy_setopt(bot->curl, CURLOPT_POSTFIELDSIZE_LARGE, (curl_off_t)spec->post_len);
         curl_easy_setopt(bot->curl, CURLOPT_POSTFIELDS, spec->post_body);
     }
 
@@ -176,43 +159,85 @@ static void curl_prepare_request(BotHandle *bot, const ApiRequestSpec *spec, Buf
     }
 }
 
-static cJSON *api_perform_json(BotHandle *bot, const ApiRequestSpec *spec)
+// record the round trip of a finished send and count it failed unless 200
+static void observe_send(CURL *c, long http_code)
+{
+    curl_off_t us = 0;
+    if (curl_easy_getinfo(c, CURLINFO_TOTAL_TIME_T, &us) == CURLE_OK) {
+        metrics_observe(MET_SEND, (double)us / 1e6);
+    }
+    if (http_code != 200) {
+        metrics_add(MET_SEND_ERRORS, 1);
+    }
+}
+
+// run a request (with the optional single 429 retry); the body lands in bot->resp
+static int api_perform(BotHandle *bot, const ApiRequestSpec *spec, long *http_code_out)
 {
-    Buffer buf = {0};
     long retry_after = 1;
 
-    curl_prepare_request(bot, spec, &buf, &retry_after);
+    if (spec->governed && ratelimit_acquire(spec->chat_id, bot->abort_flag) != 0) {
+        return -1;
+    }
+    curl_prepare_request(bot, spec, &retry_after);
 
-    CURLcode rc = curl_easy_perform(bot->curl);
+    CURLcode rc = http_perform(bot->curl);
     if (rc != CURLE_OK) {
         log_error("bot: %s: %s", spec->curl_error_msg, curl_easy_strerror(rc));
-        free(buf.data);
-        return NULL;
+        if (spec->governed) {
+            metrics_add(MET_SEND_ERRORS, 1);
+        }
+        return -1;
     }
 
     long http_code = 0;
     curl_easy_getinfo(bot->curl, CURLINFO_RESPONSE_CODE, &http_code);
+    if (http_code == 429) {
+        metrics_add(MET_RATELIMITED, 1);
+    }
 
     // handle 429 Too Many Requests with retry
     if (spec->retry_once_on_429 && http_code == 429) {
-        log_warn("bot: rate-limited (429), retrying after %lds", retry_after);
-        free(buf.data);
-        sleep((unsigned int)retry_after);
+        if (spec->governed) {
+            // every sender holds off, so the rest of a burst is not rejected too
+            ratelimit_pause((double)retry_after);
+            if (ratelimit_acquire(spec->chat_id, bot->abort_flag) != 0) {
+                return -1;
+            }
+        } else {
+            log_warn("bot: rate-limited (429), retrying after %lds", retry_after);
+            sleep((unsigned int)retry_after);
+        }
 
         // retry once
-        buf = (Buffer){0};
         retry_after = 1;
-        curl_prepare_request(bot, spec, &buf, &retry_after);
-        rc = curl_easy_perform(bot->curl);
+        curl_prepare_request(bot, spec, &retry_after);
+        rc = http_perform(bot->curl);
         if (rc != CURLE_OK) {
             log_error("bot: %s: %s", spec->curl_retry_error_msg, curl_easy_strerror(rc));
-            free(buf.data);
-            return NULL;
+            if (spec->governed) {
+                metrics_add(MET_SEND_ERRORS, 1);
+            }
+            return -1;
         }
+        curl_easy_getinfo(bot->curl, CURLINFO_RESPONSE_CODE, &http_code);
     }
 
-    cJSON *root = cJSON_Parse(buf.data);
-    free(buf.data);
+    // governed requests are the sends; polls and lookups are not timed
+    if (spec->governed) {
+        observe_send(bot->curl, http_code);
+    }
+
+    if (http_code_out) {
+        *http_code_out = http_code;
+    }
+    return 0;
+}
+
+// parse bot->resp and check "ok"; logs the API description on failure
+static cJSON *api_parse_response(BotHandle *bot, const ApiRequestSpec *spec)
+{
+    cJSON *root = bot->resp.len ? cJSON_ParseWithLength(bot->resp.data, bot->resp.len) : NULL;
 
     if (!root) {
         log_error("bot: %s", spec->json_error_msg);
@@ -231,6 +256,14 @@ static cJSON *api_perform_json(BotHandle *bot, const ApiRequestSpec *spec)
     return root;
 }
 
+static cJSON *api_perform_json(BotHandle *bot, const ApiRequestSpec *spec)
+{
+    if (api_perform(bot, spec, NULL) != 0) {
+        return NULL;
+    }
+    return api_parse_response(bot, spec);
+}
+
 static cJSON *api_get(BotHandle *bot, const char *url)
 {
     ApiRequestSpec spec = {
@@ -249,15 +282,20 @@ static cJSON *api_get(BotHandle *bot, const char *url)
     return api_perform_json(bot, &spec);
 }
 
-static cJSON *api_post_json(BotHandle *bot, const char *url, const char *json_body)
+// chat_id != 0 marks a send to that chat, paced by the rate governor
+static cJSON *api_post_json(BotHandle *bot, const char *url, const char *json_body, size_t json_len,
+                            int64_t chat_id)
 {
     ApiRequestSpec spec = {
         .url = url,
         .post_body = json_body,
+        .post_len = json_len,
         .headers = bot->json_hdrs,
         .timeout = 60L,
         .parse_retry_after = 1,
         .retry_once_on_429 = 1,
+        .governed = chat_id != 0,
+        .chat_id = chat_id,
         .curl_error_msg = "curl POST failed",
         .curl_retry_error_msg = "curl POST retry failed",
         .json_error_msg = "JSON parse failed",
@@ -294,8 +332,10 @@ BotHandle *bot_init(const char *token)
         free(bot);
         return NULL;
     }
+    http_easy_apply(bot->curl);
 
     bot->json_hdrs = curl_slist_append(NULL, "Content-Type: application/json");
+    respbuf_init(&bot->resp, RESPONSE_BUF_MAX, "bot");
 
     return bot;
 }
@@ -323,6 +363,8 @@ void bot_cleanup(BotHandle *bot)
     if (bot->json_hdrs) {
         curl_slist_free_all(bot->json_hdrs);
     }
+    jsonw_free(&bot->jw);
+    respbuf_free(&bot->resp);
     // scrub the token from memory before freeing
     explicit_bzero(bot->token, sizeof(bot->token));
     explicit_bzero(bot->url_prefix, sizeof(bot->url_prefix));
@@ -339,19 +381,20 @@ cJSON *bot_get_me(BotHandle *bot)
     return api_get(bot, url);
 }
 
-cJSON *bot_get_updates(BotHandle *bot, int64_t offset, int timeout, int limit)
+// URL and request spec shared by both getUpdates variants
+static int get_updates_spec(BotHandle *bot, int64_t offset, int timeout, int limit,
+                            char *url, size_t url_sz, ApiRequestSpec *spec)
 {
-    char url[API_URL_MAX];
-    int url_len = snprintf(url, sizeof(url),
+    int url_len = snprintf(url, url_sz,
                            "%sgetUpdates?offset=%" PRId64
                            "&limit=%d&timeout=%d&allowed_updates=[\"message\"]",
                            bot->url_prefix, offset, limit, timeout);
-    if (url_len < 0 || (size_t)url_len >= sizeof(url)) {
+    if (url_len < 0 || (size_t)url_len >= url_sz) {
         log_error("bot: getUpdates URL truncated");
-        return NULL;
+        return -1;
     }
 
-    ApiRequestSpec spec = {
+    *spec = (ApiRequestSpec){
         .url = url,
         .post_body = NULL,
         .headers = NULL,
@@ -363,32 +406,141 @@ cJSON *bot_get_updates(BotHandle *bot, int64_t offset, int timeout, int limit)
         .json_error_msg = "getUpdates JSON parse failed",
         .api_error_msg = "getUpdates error",
     };
+    return 0;
+}
 
+cJSON *bot_get_updates(BotHandle *bot, int64_t offset, int timeout, int limit)
+{
+    char url[API_URL_MAX];
+    ApiRequestSpec spec;
+    if (get_updates_spec(bot, offset, timeout, limit, url, sizeof(url), &spec) != 0) {
+        return NULL;
+    }
     return api_perform_json(bot, &spec);
 }
 
+int bot_get_updates_raw(BotHandle *bot, int64_t offset, int timeout, int limit,
+                        const char **body, size_t *len)
+{
+    char url[API_URL_MAX];
+    ApiRequestSpec spec;
+    if (get_updates_spec(bot, offset, timeout, limit, url, sizeof(url), &spec) != 0) {
+        return -1;
+    }
+
+    long http_code = 0;
+    if (api_perform(bot, &spec, &http_code) != 0) {
+        return -1;
+    }
+    if (http_code != 200 || bot->resp.len == 0) {
+        // error bodies are small; parse them only to log the description
+        cJSON *root = api_parse_response(bot, &spec);
+        if (root) {
+            log_error("bot: getUpdates returned HTTP %ld", http_code);
+            cJSON_Delete(root);
+        }
+        return -1;
+    }
+
+    *body = bot->resp.data;
+    *len = bot->resp.len;
+    return 0;
+}
+
+/* "text": message text as Telegram accepts it: invalid UTF-8 (an LLM can
+ * emit a broken sequence, a byte-limited copy can split one) is answered
+ * with a 400 and the whole message lost, so bad bytes become '?' and the
+ * text is cut to TG_TEXT_MAX on a character boundary
+ */
+static void put_text(JsonW *w, const char *text)
+{
+    size_t n = strlen(text);
+    size_t valid = simd_utf8_valid(text, n);
+    jsonw_key(w, "text");
+    if (valid == n) {
+        jsonw_strn(w, text, simd_utf8_fit(text, n, TG_TEXT_MAX));
+        return;
+    }
+    // a character split at the very end is dropped rather than marked
+    n = simd_utf8_cut(text, n);
+    char *copy = malloc(n + 1);
+    if (!copy) {
+        jsonw_strn(w, text, valid);
+        return;
+    }
+    memcpy(copy, text, n);
+    copy[n] = '\0';
+    size_t fixed = simd_utf8_repair(copy, n);
+    if (fixed > 0) {
+        log_warn("bot: replaced %zu invalid UTF-8 byte(s) in message text", fixed);
+    }
+    jsonw_strn(w, copy, simd_utf8_fit(copy, n, TG_TEXT_MAX));
+    free(copy);
+}
+
+// {"chat_id":<id>,"text":"<text>"} encoded into w; returns the body or NULL
+static const char *encode_send_message(JsonW *w, int64_t chat_id, const char *text, size_t *len)
+{
+    jsonw_reset(w);
+    jsonw_obj_begin(w);
+    jsonw_kv_int(w, "chat_id", chat_id);
+    put_text(w, text);
+    jsonw_obj_end(w);
+    return jsonw_finish(w, len);
+}
+
 int bot_send_message(BotHandle *bot, int64_t chat_id, const char *text)
+{
+    return bot_send_message_id(bot, chat_id, text, NULL);
+}
+
+int bot_send_message_id(BotHandle *bot, int64_t chat_id, const char *text, int64_t *message_id)
 {
     char url[API_URL_MAX];
     if (build_url(bot, "sendMessage", url, sizeof(url)) != 0) {
         return -1;
     }
 
-    // build JSON with cJSON to get correct string escaping
-    cJSON *body = cJSON_CreateObject();
-    char id_str[32];
-    snprintf(id_str, sizeof(id_str), "%" PRId64, chat_id);
-    cJSON_AddRawToObject(body, "chat_id", id_str);
-    cJSON_AddStringToObject(body, "text", text);
+    size_t body_len = 0;
+    const char *body = encode_send_message(&bot->jw, chat_id, text, &body_len);
+    if (!body) {
+        return -1;
+    }
 
-    char *json_str = cJSON_PrintUnformatted(body);
-    cJSON_Delete(body);
-    if (!json_str) {
+    cJSON *resp = api_post_json(bot, url, body, body_len, chat_id);
+    if (!resp) {
         return -1;
     }
+    if (message_id) {
+        const cJSON *result = cJSON_GetObjectItemCaseSensitive(resp, "result");
+        const cJSON *mid = cJSON_GetObjectItemCaseSensitive(result, "message_id");
+        *message_id = cJSON_IsNumber(mid) ? (int64_t)mid->valuedouble : 0;
+    }
+    cJSON_Delete(resp);
+    return 0;
+}
 
-    cJSON *resp = api_post_json(bot, url, json_str);
-    cJSON_free(json_str);
+int bot_edit_message_text(BotHandle *bot, int64_t chat_id, int64_t message_id, const char *text)
+{
+    char url[API_URL_MAX];
+    if (build_url(bot, "editMessageText", url, sizeof(url)) != 0) {
+        return -1;
+    }
+
+    JsonW *w = &bot->jw;
+    jsonw_reset(w);
+    jsonw_obj_begin(w);
+    jsonw_kv_int(w, "chat_id", chat_id);
+    jsonw_kv_int(w, "message_id", message_id);
+    put_text(w, text);
+    jsonw_obj_end(w);
+    size_t body_len = 0;
+    const char *body = jsonw_finish(w, &body_len);
+    if (!body) {
+        return -1;
+    }
+
+    cJSON *resp = api_post_json(bot, url, body, body_len, chat_id);
     if (!resp) {
         return -1;
     }
@@ -396,6 +548,344 @@ int bot_send_message(BotHandle *bot, int64_t chat_id, const char *text)
     return 0;
 }
 
+/* a self-contained transfer for the async path: owns its own
+ * easy handle and body so the BotHandle stays free for
+ * synchronous calls while this one is in flight
+ */
+typedef struct AsyncSend {
+    CURL *curl;
+    struct curl_slist *hdrs;
+    JsonW body;
+    volatile sig_atomic_t *abort_flag;
+    long retry_after;
+    const char *method; // string literal, for the log
+    bool governed;      // a message send: timed and counted like the blocking path
+    bool chained;       // one at a time per chat, in the order queued
+    int64_t chat_id;
+    BotSentFn done;     // told the outcome, when set
+    void *done_ud;
+    struct AsyncSend *next; // behind it in its chat's chain
+} AsyncSend;
+
+/* a chat with a chained send on the engine, and the sends queued behind it;
+ * the entry goes once the last of them finishes
+ */
+typedef struct ChatChain {
+    int64_t chat_id;
+    AsyncSend *head;
+    AsyncSend *tail;
+    struct ChatChain *next;
+} ChatChain;
+
+static struct {
+    pthread_mutex_t lock;
+    ChatChain *buckets[SEND_CHAIN_BUCKETS];
+} g_chain = {.lock = PTHREAD_MUTEX_INITIALIZER};
+
+// MurmurHash3 fmix64
+static unsigned chain_slot(int64_t chat_id)
+{
+    uint64_t h = (uint64_t)chat_id;
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+    h *= 0xc4ceb9fe1a85ec53ULL;
+    h ^= h >> 33;
+    return (unsigned)(h & (SEND_CHAIN_BUCKETS - 1));
+}
+
+/* queue as behind the send in flight for its chat, if there is one: returns
+ * true if so (it is submitted when the one ahead finishes). otherwise marks
+ * the chat busy and returns false, and the caller submits as now; with no
+ * memory for the entry as goes out unchained
+ */
+static bool chain_join(AsyncSend *as)
+{
+    unsigned slot = chain_slot(as->chat_id);
+    pthread_mutex_lock(&g_chain.lock);
+    ChatChain *c = g_chain.buckets[slot];
+    while (c && c->chat_id != as->chat_id) {
+        c = c->next;
+    }
+    if (c) {
+        as->next = NULL;
+        if (c->tail) {
+            c->tail->next = as;
+        } else {
+            c->head = as;
+        }
+        c->tail = as;
+        pthread_mutex_unlock(&g_chain.lock);
+        return true;
+    }
+    c = calloc(1, sizeof(*c));
+    if (c) {
+        c->chat_id = as->chat_id;
+        c->next = g_chain.buckets[slot];
+        g_chain.buckets[slot] = c;
+    } else {
+        as->chained = false;
+    }
+    pthread_mutex_unlock(&g_chain.lock);
+    return false;
+}
+
+static void async_send_free(AsyncSend *as);
+static void async_send_done(CURL *easy, CURLcode rc, void *ud);
+
+/* the chained send for chat_id has finished: submit the next one queued
+ * behind it, or retire the chat's entry. a send the engine refuses (it is
+ * stopping) fails in turn
+ */
+static void chain_next(int64_t chat_id)
+{
+    unsigned slot = chain_slot(chat_id);
+    for (;;) {
+        pthread_mutex_lock(&g_chain.lock);
+        ChatChain **pp = &g_chain.buckets[slot];
+        while (*pp && (*pp)->chat_id != chat_id) {
+            pp = &(*pp)->next;
+        }
+        ChatChain *c = *pp;
+        AsyncSend *as = c ? c->head : NULL;
+        if (as) {
+            c->head = as->next;
+            if (!c->head) {
+                c->tail = NULL;
+            }
+        } else if (c) {
+            *pp = c->next;
+            free(c);
+        }
+        pthread_mutex_unlock(&g_chain.lock);
+        if (!as || http_submit(as->curl, async_send_done, as) == 0) {
+            return;
+        }
+        log_error("bot: async %s dropped: engine stopped", as->method);
+        if (as->done) {
+            as->done(-1, as->done_ud);
+        }
+        async_send_free(as);
+    }
+}
+
+static void async_send_free(AsyncSend *as)
+{
+    if (as->curl) {
+        curl_easy_cleanup(as->curl);
+    }
+    curl_slist_free_all(as->hdrs);
+    jsonw_free(&as->body);
+    free(as);
+}
+
+static int async_abort_cb(void *clientp, curl_off_t dltotal, curl_off_t dlnow, curl_off_t ultotal,
+                          curl_off_t ulnow)
+{
+    (void)dltotal;
+    (void)dlnow;
+    (void)ultotal;
+    (void)ulnow;
+    const AsyncSend *as = (const AsyncSend *)clientp;
+    return (as->abort_flag && *as->abort_flag == 0) ? 1 : 0;
+}
+
+// completion callback on the HTTP engine thread: log failures, then free
+static void async_send_done(CURL *easy, CURLcode rc, void *ud)
+{
+    AsyncSend *as = (AsyncSend *)ud;
+    int outcome = -1;
+    if (rc != CURLE_OK) {
+        log_error("bot: async %s failed: %s", as->method, curl_easy_strerror(rc));
+        if (as->governed) {
+            metrics_add(MET_SEND_ERRORS, 1);
+        }
+    } else {
+        long http_code = 0;
+        curl_easy_getinfo(easy, CURLINFO_RESPONSE_CODE, &http_code);
+        if (as->governed) {
+            observe_send(easy, http_code);
+        }
+        // the limit is per bot, so a rejected chat action holds off the sends too
+        if (http_code == 429) {
+            metrics_add(MET_RATELIMITED, 1);
+            ratelimit_pause((double)as->retry_after);
+            outcome = BOT_SEND_RETRY;
+        } else if (http_code != 200) {
+            log_warn("bot: async %s returned HTTP %ld", as->method, http_code);
+        } else {
+            outcome = 0;
+        }
+    }
+    if (as->done) {
+        as->done(outcome, as->done_ud);
+    }
+    if (as->chained) {
+        chain_next(as->chat_id);
+    }
+    async_send_free(as);
+}
+
+static AsyncSend *async_new(BotHandle *bot, const char *method, size_t body_cap)
+{
+    AsyncSend *as = calloc(1, sizeof(*as));
+    if (!as) {
+        return NULL;
+    }
+    as->abort_flag = bot->abort_flag;
+    as->retry_after = 1;
+    as->method = method;
+    // the transfer outlives the call, so it owns its body; size the buffer
+    // once so encoding does not reallocate
+    jsonw_reserve(&as->body, body_cap);
+    return as;
+}
+
+/* hand as (body already encoded) to the HTTP engine, waiting for the rate
+ * governor first when governed; a chained send waits its chat's turn too.
+ * returns 0 once submitted or queued, 1 if the engine refused it (the
+ * caller falls back to a blocking call), -1 on error; as is consumed
+ */
+static int async_submit(BotHandle *bot, AsyncSend *as, const char *body, size_t body_len,
+                        int64_t chat_id, bool governed)
+{
+    char url[API_URL_MAX];
+    as->governed = governed;
+    as->chat_id = chat_id;
+    as->curl = curl_easy_init();
+    as->hdrs = curl_slist_append(NULL, "Content-Type: application/json");
+    if (!body || !as->curl || !as->hdrs || build_url(bot, as->method, url, sizeof(url)) != 0) {
+        async_send_free(as);
+        return -1;
+    }
+
+    curl_set_tls(as->curl);
+    if (bot->allow_http) {
+        curl_easy_setopt(as->curl, CURLOPT_PROTOCOLS_STR, "http,https");
+        curl_easy_setopt(as->curl, CURLOPT_SSL_VERIFYPEER, 0L);
+        curl_easy_setopt(as->curl, CURLOPT_SSL_VERIFYHOST, 0L);
+    }
+    if (as->abort_flag) {
+        curl_easy_setopt(as->curl, CURLOPT_NOPROGRESS, 0L);
+        curl_easy_setopt(as->curl, CURLOPT_XFERINFOFUNCTION, async_abort_cb);
+        curl_easy_setopt(as->curl, CURLOPT_XFERINFODATA, as);
+    }
+    curl_easy_setopt(as->curl, CURLOPT_URL, url);
+    curl_easy_setopt(as->curl, CURLOPT_HTTPHEADER, as->hdrs);
+    curl_easy_setopt(as->curl, CURLOPT_POSTFIELDSIZE_LARGE, (curl_off_t)body_len);
+    curl_easy_setopt(as->curl, CURLOPT_POSTFIELDS, body);
+    curl_easy_setopt(as->curl, CURLOPT_WRITEFUNCTION, discard_cb);
+    curl_easy_setopt(as->curl, CURLOPT_TIMEOUT, 60L);
+    curl_easy_setopt(as->curl, CURLOPT_HEADERFUNCTION, header_cb);
+    curl_easy_setopt(as->curl, CURLOPT_HEADERDATA, &as->retry_after);
+
+    if (governed && ratelimit_acquire(chat_id, bot->abort_flag) != 0) {
+        async_send_free(as);
+        return -1;
+    }
+    if (as->chained && chain_join(as)) {
+        return 0; // submitted once the send ahead of it finishes
+    }
+    if (http_submit(as->curl, async_send_done, as) != 0) {
+        if (as->chained) {
+            chain_next(chat_id);
+        }
+        async_send_free(as);
+        return 1;
+    }
+    return 0;
+}
+
+int bot_send_message_async(BotHandle *bot, int64_t chat_id, const char *text)
+{
+    return bot_send_message_then(bot, chat_id, text, NULL, NULL);
+}
+
+int bot_send_message_then(BotHandle *bot, int64_t chat_id, const char *text, BotSentFn done,
+                          void *ud)
+{
+    bool engine = http_engine_running();
+    AsyncSend *as = engine ? async_new(bot, "sendMessage", strlen(text) + 64) : NULL;
+    int rc = engine ? -1 : 1; // 1: send it blocking instead
+    if (as) {
+        // a reply already paid for: shutdown drains it instead of cutting it off
+        as->abort_flag = NULL;
+        as->chained = true;
+        as->done = done;
+        as->done_ud = ud;
+        size_t body_len = 0;
+        const char *body = encode_send_message(&as->body, chat_id, text, &body_len);
+        rc = async_submit(bot, as, body, body_len, chat_id, true);
+        if (rc == 0) {
+            return 0; // done runs on the engine thread
+        }
+    }
+    if (rc == 1) {
+        rc = bot_send_message(bot, chat_id, text);
+    }
+    if (done) {
+        done(rc, ud);
+    }
+    return rc;
+}
+
+// {"chat_id":<id>,"action":"<action>"} encoded into w; returns the body or NULL
+static const char *encode_chat_action(JsonW *w, int64_t chat_id, const char *action, size_t *len)
+{
+    jsonw_reset(w);
+    jsonw_obj_begin(w);
+    jsonw_kv_int(w, "chat_id", chat_id);
+    jsonw_kv_str(w, "action", action);
+    jsonw_obj_end(w);
+    return jsonw_finish(w, len);
+}
+
+int bot_send_chat_action(BotHandle *bot, int64_t chat_id, const char *action)
+{
+    char url[API_URL_MAX];
+    if (build_url(bot, "sendChatAction", url, sizeof(url)) != 0) {
+        return -1;
+    }
+    size_t body_len = 0;
+    const char *body = encode_chat_action(&bot->jw, chat_id, action, &body_len);
+    if (!body) {
+        return -1;
+    }
+
+    // an indicator is only worth sending now: no governor wait, no retry
+    ApiRequestSpec spec = {
+        .url = url,
+        .post_body = body,
+        .post_len = body_len,
+        .headers = bot->json_hdrs,
+        .timeout = 10L,
+        .curl_error_msg = "curl sendChatAction failed",
+        .json_error_msg = "JSON parse failed",
+        .api_error_msg = "API error",
+    };
+    cJSON *resp = api_perform_json(bot, &spec);
+    if (!resp) {
+        return -1;
+    }
+    cJSON_Delete(resp);
+    return 0;
+}
+
+int bot_send_chat_action_async(BotHandle *bot, int64_t chat_id, const char *action)
+{
+    if (!http_engine_running()) {
+        return bot_send_chat_action(bot, chat_id, action);
+    }
+    AsyncSend *as = async_new(bot, "sendChatAction", strlen(action) + 64);
+    if (!as) {
+        return -1;
+    }
+    size_t body_len = 0;
+    const char *body = encode_chat_action(&as->body, chat_id, action, &body_len);
+    int rc = async_submit(bot, as, body, body_len, chat_id, false);
+    return rc == 1 ? bot_send_chat_action(bot, chat_id, action) : rc;
+}
+
 int bot_set_webhook(BotHandle *bot, const char *url, const char *secret)
 {
     char api_url[API_URL_MAX];
@@ -403,22 +893,27 @@ int bot_set_webhook(BotHandle *bot, const char *url, const char *secret)
         return -1;
     }
 
-    cJSON *body = cJSON_CreateObject();
-    cJSON_AddStringToObject(body, "url", url);
+    JsonW *w = &bot->jw;
+    jsonw_reset(w);
+    jsonw_obj_begin(w);
+    jsonw_kv_str(w, "url", url);
     if (secret && secret[0] != '\0') {
-        cJSON_AddStringToObject(body, "secret_token", secret);
-    }
-    cJSON *allowed = cJSON_AddArrayToObject(body, "allowed_updates");
-    cJSON_AddItemToArray(allowed, cJSON_CreateString("message"));
-
-    char *json_str = cJSON_PrintUnformatted(body);
-    cJSON_Delete(body);
-    if (!json_str) {
+        jsonw_kv_str(w, "secret_token", secret);
+    }
+    jsonw_key(w, "allowed_updates");
+    jsonw_arr_begin(w);
+    jsonw_str(w, "message");
+    jsonw_arr_end(w);
+    jsonw_obj_end(w);
+    size_t body_len = 0;
+    const char *body = jsonw_finish(w, &body_len);
+    if (!body) {
         return -1;
     }
 
-    cJSON *resp = api_post_json(bot, api_url, json_str);
-    cJSON_free(json_str);
+    cJSON *resp = api_post_json(bot, api_url, body, body_len, 0);
+    // the body carries the webhook secret; don't leave it in the reused buffer
+    explicit_bzero(w->buf, w->len);
     if (!resp) {
         return -1;
     }
@@ -434,7 +929,7 @@ int bot_delete_webhook(BotHandle *bot)
         return -1;
     }
 
-    cJSON *resp = api_post_json(bot, api_url, "{}");
+    cJSON *resp = api_post_json(bot, api_url, "{}", 2, 0);
     if (!resp) {
         return -1;
     }
@@ -443,6 +938,30 @@ int bot_delete_webhook(BotHandle *bot)
     return 0;
 }
 
+/* true for an http:// URL whose host is this machine: localhost, [::1] or
+ * a dotted IPv4 address in 127.0.0.0/8. the host comes from curl's own
+ * parser, so userinfo ("http://127.0.0.1@evil/") and look-alike names
+ * ("http://127.evil/") are judged by the host curl would connect to
+ */
+static int is_loopback_http(const char *url)
+{
+    CURLU *u = curl_url();
+    char *scheme = NULL;
+    char *host = NULL;
+    int ok = 0;
+    if (u && curl_url_set(u, CURLUPART_URL, url, 0) == CURLUE_OK &&
+        curl_url_get(u, CURLUPART_SCHEME, &scheme, 0) == CURLUE_OK &&
+        curl_url_get(u, CURLUPART_HOST, &host, 0) == CURLUE_OK && strcmp(scheme, "http") == 0) {
+        struct in_addr a4;
+        ok = strcasecmp(host, "localhost") == 0 || strcmp(host, "[::1]") == 0 ||
+             (inet_pton(AF_INET, host, &a4) == 1 && (ntohl(a4.s_addr) >> 24) == 127);
+    }
+    curl_free(scheme);
+    curl_free(host);
+    curl_url_cleanup(u);
+    return ok;
+}
+
 void bot_set_api_base(BotHandle *bot, const char *base_url)
 {
     if (!bot || !base_url) {
@@ -454,6 +973,12 @@ void bot_set_api_base(BotHandle *bot, const char *base_url)
         return;
     }
     bot->url_prefix_len = (size_t)plen;
+    // the token travels in the URL, so cleartext is only for a local mock;
+    // any other http:// base fails on the https-only protocol list
+    bot->allow_http = is_loopback_http(bot->url_prefix);
+    if (!bot->allow_http && strncmp(base_url, "http://", 7) == 0) {
+        log_error("bot: plain http API base refused - only loopback hosts may skip TLS");
+    }
 }
 
 #ifdef TESTING
@@ -463,4 +988,9 @@ void bot_set_allow_http(BotHandle *bot, int allow)
         bot->allow_http = allow;
     }
 }
+
+int bot_is_loopback_http(const char *url)
+{
+    return is_loopback_http(url);
+}
 #endif
@@ -2,6 +2,7 @@
 #include "cJSON.h"
 
 #include <signal.h>
+#include <stddef.h>
 #include <stdint.h>
 
 // opaque handle that holds the bot token and a reusable CURL handle
@@ -27,9 +28,52 @@ cJSON *bot_get_me(BotHandle *bot);
 // call getUpdates and return parsed JSON root, caller frees with cJSON_Delete
 cJSON *bot_get_updates(BotHandle *bot, int64_t offset, int timeout, int limit);
 
+/* call getUpdates and hand back the raw HTTP 200 body without parsing it
+ * *body points into the handle's response buffer and stays valid until the
+ * next request on this handle. returns 0 on success, -1 on error
+ */
+int bot_get_updates_raw(BotHandle *bot, int64_t offset, int timeout, int limit,
+                        const char **body, size_t *len);
+
 // call sendMessage with plain text, returns 0 on success
 int bot_send_message(BotHandle *bot, int64_t chat_id, const char *text);
 
+// like bot_send_message, but stores the new message's id in *message_id
+int bot_send_message_id(BotHandle *bot, int64_t chat_id, const char *text, int64_t *message_id);
+
+// call editMessageText to replace the text of a message the bot sent
+// returns 0 on success (Telegram rejects edits that leave the text unchanged)
+int bot_edit_message_text(BotHandle *bot, int64_t chat_id, int64_t message_id, const char *text);
+
+// queue a sendMessage on the shared HTTP engine and return without waiting
+// for the response; failures are only logged. falls back to the blocking
+// bot_send_message when the engine is not running. returns 0 if queued/sent
+int bot_send_message_async(BotHandle *bot, int64_t chat_id, const char *text);
+
+// outcome passed to a BotSentFn besides 0 (sent) and -1 (failed)
+#define BOT_SEND_RETRY 1 // answered 429: the governor is paused, send it again later
+
+typedef void (*BotSentFn)(int rc, void *ud);
+
+/* bot_send_message_async that reports how the send ended: done(rc, ud) is
+ * called exactly once, on the HTTP engine thread (where it must not block),
+ * or before returning when the message could not be queued or went out
+ * blocking. sends to one chat go out one at a time, in the order queued;
+ * no retry on the engine. the abort flag only cuts short the wait for the
+ * governor: once queued the send runs to completion, or until
+ * http_engine_stop()
+ * returns 0 if queued/sent
+ */
+int bot_send_message_then(BotHandle *bot, int64_t chat_id, const char *text, BotSentFn done,
+                          void *ud);
+
+// call sendChatAction (e.g. "typing"); not paced by the rate governor and
+// never retried, since a late indicator is useless. returns 0 on success
+int bot_send_chat_action(BotHandle *bot, int64_t chat_id, const char *action);
+
+// bot_send_chat_action on the shared HTTP engine, like bot_send_message_async
+int bot_send_chat_action_async(BotHandle *bot, int64_t chat_id, const char *action);
+
 // register a webhook URL with Telegram (with secret_token)
 int bot_set_webhook(BotHandle *bot, const char *url, const char *secret);
 
@@ -37,10 +81,14 @@ int bot_set_webhook(BotHandle *bot, const char *url, const char *secret);
 int bot_delete_webhook(BotHandle *bot);
 
 // override the API base URL (default: https://api.telegram.org/bot)
-// useful for testing against a local mock server
+// useful for testing against a local mock server; plain http is allowed
+// for loopback hosts only
 void bot_set_api_base(BotHandle *bot, const char *base_url);
 
 #ifdef TESTING
 // allow plain HTTP connections (for mock server testing only)
 void bot_set_allow_http(BotHandle *bot, int allow);
+
+// the check bot_set_api_base applies before letting a base skip TLS
+int bot_is_loopback_http(const char *url);
 #endif
@@ -0,0 +1,166 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "budget.h"
+#include "config.h"
+#include "logger.h"
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+typedef struct {
+    int depth;
+    int tokens;
+} BudgetStep;
+
+static struct {
+    pthread_mutex_t lock;
+    BudgetStep steps[BUDGET_STEPS_MAX];
+    int n;
+    int full_tokens;
+    double slow_sec;
+    char fallback[128];
+    double latency; // EWMA of successful request times, 0 = none yet
+    uint64_t picks;
+    uint64_t reduced;
+    uint64_t fallbacks;
+    int level;
+} g_budget = {.lock = PTHREAD_MUTEX_INITIALIZER};
+
+// one "depth:tokens" step; end is where it stops
+static int parse_step(const char *p, const char *end, BudgetStep *out)
+{
+    char tmp[32];
+    size_t len = (size_t)(end - p);
+    if (len >= sizeof(tmp)) {
+        return -1;
+    }
+    memcpy(tmp, p, len);
+    tmp[len] = '\0';
+    char *colon = strchr(tmp, ':');
+    if (!colon) {
+        return -1;
+    }
+    *colon = '\0';
+    char *e1;
+    char *e2;
+    long depth = strtol(tmp, &e1, 10);
+    long tokens = strtol(colon + 1, &e2, 10);
+    while (*e1 == ' ' || *e1 == '\t') {
+        e1++;
+    }
+    while (*e2 == ' ' || *e2 == '\t') {
+        e2++;
+    }
+    if (e1 == tmp || *e1 != '\0' || e2 == colon + 1 || *e2 != '\0' || depth < 1 ||
+        depth > 1000000 || tokens < 1 || tokens > 1000000) {
+        return -1;
+    }
+    out->depth = (int)depth;
+    out->tokens = (int)tokens;
+    return 0;
+}
+
+int budget_init(const char *curve, double slow_sec, const char *fallback_model, int full_tokens)
+{
+    BudgetStep steps[BUDGET_STEPS_MAX];
+    int n = 0;
+    const char *p = curve ? curve : "";
+    while (*p) {
+        while (*p == ' ' || *p == '\t' || *p == ',') {
+            p++;
+        }
+        const char *end = p;
+        while (*end && *end != ',') {
+            end++;
+        }
+        const char *last = end;
+        while (last > p && (last[-1] == ' ' || last[-1] == '\t')) {
+            last--;
+        }
+        if (last > p) {
+            BudgetStep st;
+            if (n == BUDGET_STEPS_MAX || parse_step(p, last, &st) != 0) {
+                log_error("budget: bad curve step or too many steps in \"%s\"", curve);
+                return -1;
+            }
+            if (st.tokens > full_tokens ||
+                (n > 0 && (st.depth <= steps[n - 1].depth || st.tokens > steps[n - 1].tokens))) {
+                log_error("budget: curve depths must rise and tokens fall, at most %d",
+                          full_tokens);
+                return -1;
+            }
+            steps[n++] = st;
+        }
+        p = end;
+    }
+
+    pthread_mutex_lock(&g_budget.lock);
+    memcpy(g_budget.steps, steps, sizeof(steps[0]) * (size_t)n);
+    g_budget.n = n;
+    g_budget.full_tokens = full_tokens;
+    g_budget.slow_sec = slow_sec > 0 ? slow_sec : 0;
+    snprintf(g_budget.fallback, sizeof(g_budget.fallback), "%s",
+             fallback_model ? fallback_model : "");
+    g_budget.latency = 0;
+    g_budget.picks = g_budget.reduced = g_budget.fallbacks = 0;
+    g_budget.level = 0;
+    pthread_mutex_unlock(&g_budget.lock);
+    return 0;
+}
+
+void budget_pick(int depth, Budget *out)
+{
+    pthread_mutex_lock(&g_budget.lock);
+    int level = 0;
+    while (level < g_budget.n && depth >= g_budget.steps[level].depth) {
+        level++;
+    }
+    // a backlog behind slow replies drains faster one step down
+    if (depth > 0 && level < g_budget.n && g_budget.slow_sec > 0 &&
+        g_budget.latency > g_budget.slow_sec) {
+        level++;
+    }
+    out->level = level;
+    out->max_tokens = level > 0 ? g_budget.steps[level - 1].tokens : g_budget.full_tokens;
+    out->model = level > 0 && level == g_budget.n && g_budget.fallback[0] ? g_budget.fallback : NULL;
+    g_budget.picks++;
+    g_budget.reduced += out->max_tokens < g_budget.full_tokens;
+    g_budget.fallbacks += out->model != NULL;
+    g_budget.level = level;
+    pthread_mutex_unlock(&g_budget.lock);
+}
+
+void budget_observe(double sec)
+{
+    pthread_mutex_lock(&g_budget.lock);
+    if (g_budget.latency <= 0) {
+        g_budget.latency = sec;
+    } else {
+        g_budget.latency += BUDGET_EWMA_ALPHA * (sec - g_budget.latency);
+    }
+    pthread_mutex_unlock(&g_budget.lock);
+}
+
+void budget_stats(BudgetStats *out)
+{
+    pthread_mutex_lock(&g_budget.lock);
+    out->picks = g_budget.picks;
+    out->reduced = g_budget.reduced;
+    out->fallback = g_budget.fallbacks;
+    out->latency = g_budget.latency;
+    out->level = g_budget.level;
+    pthread_mutex_unlock(&g_budget.lock);
+}
+
+void budget_reset(void)
+{
+    pthread_mutex_lock(&g_budget.lock);
+    g_budget.n = 0;
+    g_budget.fallback[0] = '\0';
+    g_budget.latency = 0;
+    g_budget.picks = g_budget.reduced = g_budget.fallbacks = 0;
+    g_budget.level = 0;
+    pthread_mutex_unlock(&g_budget.lock);
+}
@@ -0,0 +1,45 @@
+#pragma once
+
+#include <stdint.h>
+
+/* load-adaptive generation budget ([llm] budget_curve, budget_slow_ms,
+ * fallback_model)
+ * the curve is a list of "depth:tokens" steps, e.g. "8:256, 32:128, 64:64":
+ * a worker picking up a prompt while at least depth messages still wait
+ * asks for at most tokens. while the average LLM request takes longer than
+ * budget_slow_ms the pick drops one step further, and the deepest step also
+ * switches to fallback_model when one is set. an empty queue always gets
+ * the full [llm] max_tokens and model.
+ */
+
+/* curve: "" = disabled (every pick is the full budget)
+ * depths must be strictly ascending and tokens non-increasing, 1..full_tokens
+ * slow_sec: 0 = ignore latency; fallback_model may be NULL or empty
+ * returns 0 on success, -1 if the curve does not parse
+ */
+int budget_init(const char *curve, double slow_sec, const char *fallback_model, int full_tokens);
+
+typedef struct {
+    int max_tokens;
+    const char *model; // fallback model to use, or NULL for the configured one
+    int level;         // 0 = full budget, else the curve step taken (1-based)
+} Budget;
+
+// the budget for a prompt picked up with depth messages still queued
+void budget_pick(int depth, Budget *out);
+
+// a request under the budget took sec seconds (successful requests only)
+void budget_observe(double sec);
+
+typedef struct {
+    uint64_t picks;    // budget_pick calls
+    uint64_t reduced;  // ...that got less than the full budget
+    uint64_t fallback; // ...that were sent to the fallback model
+    double latency;    // current LLM latency average in seconds
+    int level;         // level of the last pick
+} BudgetStats;
+
+void budget_stats(BudgetStats *out);
+
+// forget the curve and the counters
+void budget_reset(void);
@@ -0,0 +1,354 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "cache.h"
+#include "config.h"
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+/* one cached reply; key and reply are stored inline:
+ *   data = key bytes, then reply bytes plus NUL
+ * the full key is compared on lookup, so a hash collision is only a miss
+ */
+typedef struct CacheEntry {
+    uint64_t hash;
+    struct CacheEntry *next;     // hash chain
+    struct CacheEntry *lru_prev; // towards most recently used
+    struct CacheEntry *lru_next; // towards least recently used
+    double expires;              // CLOCK_MONOTONIC seconds
+    size_t key_len;
+    size_t reply_len;
+    char data[];
+} CacheEntry;
+
+static struct {
+    pthread_mutex_t lock;
+    int ready;
+    CacheEntry **table;
+    unsigned table_mask;
+    CacheEntry *lru_head;
+    CacheEntry *lru_tail;
+    int entries;
+    size_t bytes;
+    size_t max_bytes;
+    double ttl;
+    uint64_t hits;
+    uint64_t misses;
+    uint64_t evictions;
+} g_cache = {.lock = PTHREAD_MUTEX_INITIALIZER};
+
+static double monotonic_sec(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+// FNV-1a
+static uint64_t hash_bytes(const char *p, size_t len)
+{
+    uint64_t h = 0xcbf29ce484222325ULL;
+    for (size_t i = 0; i < len; i++) {
+        h ^= (unsigned char)p[i];
+        h *= 0x100000001b3ULL;
+    }
+    return h;
+}
+
+static int is_space(char c)
+{
+    return c == ' ' || c == '\t' || c == '\n' || c == '\r' || c == '\f' || c == '\v';
+}
+
+size_t cache_normalise(const char *in, char *out, size_t out_cap)
+{
+    if (!out || out_cap == 0) {
+        return 0;
+    }
+    size_t n = 0;
+    int gap = 0;
+    for (const char *p = in ? in : ""; *p && n + 1 < out_cap; p++) {
+        char c = *p;
+        if (is_space(c)) {
+            gap = n > 0;
+            continue;
+        }
+        if (gap) {
+            out[n++] = ' ';
+            gap = 0;
+            if (n + 1 >= out_cap) {
+                break;
+            }
+        }
+        if (c >= 'A' && c <= 'Z') {
+            c = (char)(c - 'A' + 'a');
+        }
+        out[n++] = c;
+    }
+    while (n > 0 && (out[n - 1] == '.' || out[n - 1] == '!' || out[n - 1] == '?' ||
+                     out[n - 1] == ' ')) {
+        n--;
+    }
+    out[n] = '\0';
+    return n;
+}
+
+// build the lookup key into buf; returns its length, or 0 if not cacheable
+static size_t build_key(const char *model, const char *system_prompt, const char *user_msg,
+                        int max_tokens, char *buf, size_t cap)
+{
+    char norm[CACHE_PROMPT_MAX + 2];
+    size_t nlen = cache_normalise(user_msg, norm, sizeof(norm));
+    if (nlen == 0 || nlen > CACHE_PROMPT_MAX) {
+        return 0; // long prompts rarely repeat and would crowd out short ones
+    }
+    int n = snprintf(buf, cap, "%s\x1f%s\x1f%d\x1f%s", model ? model : "",
+                     system_prompt ? system_prompt : "", max_tokens, norm);
+    if (n < 0 || (size_t)n >= cap) {
+        return 0;
+    }
+    return (size_t)n;
+}
+
+// LRU list and hash table maintenance (caller holds g_cache.lock)
+
+static void lru_unlink(CacheEntry *e)
+{
+    if (e->lru_prev) {
+        e->lru_prev->lru_next = e->lru_next;
+    } else {
+        g_cache.lru_head = e->lru_next;
+    }
+    if (e->lru_next) {
+        e->lru_next->lru_prev = e->lru_prev;
+    } else {
+        g_cache.lru_tail = e->lru_prev;
+    }
+    e->lru_prev = NULL;
+    e->lru_next = NULL;
+}
+
+static void lru_push_front(CacheEntry *e)
+{
+    e->lru_next = g_cache.lru_head;
+    if (g_cache.lru_head) {
+        g_cache.lru_head->lru_prev = e;
+    }
+    g_cache.lru_head = e;
+    if (!g_cache.lru_tail) {
+        g_cache.lru_tail = e;
+    }
+}
+
+static size_t entry_bytes(const CacheEntry *e)
+{
+    return sizeof(*e) + e->key_len + e->reply_len + 1;
+}
+
+// double the hash table once the load factor passes 1
+static void table_grow(void)
+{
+    unsigned size = g_cache.table_mask + 1;
+    CacheEntry **t = calloc((size_t)size * 2, sizeof(*t));
+    if (!t) {
+        return; // keep chaining in the old table
+    }
+    unsigned mask = size * 2 - 1;
+    for (unsigned i = 0; i < size; i++) {
+        CacheEntry *e = g_cache.table[i];
+        while (e) {
+            CacheEntry *next = e->next;
+            e->next = t[e->hash & mask];
+            t[e->hash & mask] = e;
+            e = next;
+        }
+    }
+    free(g_cache.table);
+    g_cache.table = t;
+    g_cache.table_mask = mask;
+}
+
+static CacheEntry *entry_find(const char *key, size_t key_len, uint64_t h)
+{
+    for (CacheEntry *e = g_cache.table[h & g_cache.table_mask]; e; e = e->next) {
+        if (e->hash == h && e->key_len == key_len && memcmp(e->data, key, key_len) == 0) {
+            return e;
+        }
+    }
+    return NULL;
+}
+
+static void entry_free(CacheEntry *e)
+{
+    CacheEntry **pp = &g_cache.table[e->hash & g_cache.table_mask];
+    while (*pp && *pp != e) {
+        pp = &(*pp)->next;
+    }
+    if (*pp) {
+        *pp = e->next;
+    }
+    lru_unlink(e);
+    g_cache.entries--;
+    g_cache.bytes -= entry_bytes(e);
+    free(e);
+}
+
+int cache_init(size_t max_bytes, int ttl_sec)
+{
+    if (max_bytes == 0 || ttl_sec <= 0) {
+        return -1;
+    }
+    pthread_mutex_lock(&g_cache.lock);
+    if (g_cache.ready) {
+        pthread_mutex_unlock(&g_cache.lock);
+        return -1;
+    }
+    g_cache.table = calloc(CACHE_BUCKETS, sizeof(*g_cache.table));
+    if (!g_cache.table) {
+        pthread_mutex_unlock(&g_cache.lock);
+        return -1;
+    }
+    g_cache.table_mask = CACHE_BUCKETS - 1;
+    g_cache.lru_head = NULL;
+    g_cache.lru_tail = NULL;
+    g_cache.entries = 0;
+    g_cache.bytes = 0;
+    g_cache.max_bytes = max_bytes;
+    g_cache.ttl = (double)ttl_sec;
+    g_cache.hits = 0;
+    g_cache.misses = 0;
+    g_cache.evictions = 0;
+    g_cache.ready = 1;
+    pthread_mutex_unlock(&g_cache.lock);
+    return 0;
+}
+
+void cache_destroy(void)
+{
+    pthread_mutex_lock(&g_cache.lock);
+    if (g_cache.ready) {
+        while (g_cache.lru_head) {
+            entry_free(g_cache.lru_head);
+        }
+        free(g_cache.table);
+        g_cache.table = NULL;
+        g_cache.ready = 0;
+    }
+    pthread_mutex_unlock(&g_cache.lock);
+}
+
+int cache_lookup(const char *model, const char *system_prompt, const char *user_msg,
+                 int max_tokens, char *out, size_t out_cap)
+{
+    if (!out || out_cap == 0) {
+        return -1;
+    }
+    char key[CACHE_KEY_MAX];
+    size_t key_len = build_key(model, system_prompt, user_msg, max_tokens, key, sizeof(key));
+
+    pthread_mutex_lock(&g_cache.lock);
+    if (!g_cache.ready) {
+        pthread_mutex_unlock(&g_cache.lock);
+        return -1;
+    }
+    if (key_len == 0) {
+        g_cache.misses++;
+        pthread_mutex_unlock(&g_cache.lock);
+        return -1;
+    }
+
+    uint64_t h = hash_bytes(key, key_len);
+    CacheEntry *e = entry_find(key, key_len, h);
+    if (e && e->expires <= monotonic_sec()) {
+        entry_free(e);
+        e = NULL;
+    }
+    if (!e || e->reply_len >= out_cap) {
+        g_cache.misses++;
+        pthread_mutex_unlock(&g_cache.lock);
+        return -1;
+    }
+
+    memcpy(out, e->data + e->key_len, e->reply_len + 1);
+    lru_unlink(e);
+    lru_push_front(e);
+    g_cache.hits++;
+    pthread_mutex_unlock(&g_cache.lock);
+    return 0;
+}
+
+int cache_store(const char *model, const char *system_prompt, const char *user_msg,
+                int max_tokens, const char *reply)
+{
+    if (!reply) {
+        return -1;
+    }
+    char key[CACHE_KEY_MAX];
+    size_t key_len = build_key(model, system_prompt, user_msg, max_tokens, key, sizeof(key));
+    if (key_len == 0) {
+        return -1;
+    }
+    size_t reply_len = strlen(reply);
+    size_t need = sizeof(CacheEntry) + key_len + reply_len + 1;
+
+    // built outside the lock; a racing store of the same key simply replaces it
+    CacheEntry *e = malloc(need);
+    if (!e) {
+        return -1;
+    }
+    e->hash = hash_bytes(key, key_len);
+    e->lru_prev = NULL;
+    e->lru_next = NULL;
+    e->key_len = key_len;
+    e->reply_len = reply_len;
+    memcpy(e->data, key, key_len);
+    memcpy(e->data + key_len, reply, reply_len + 1);
+
+    pthread_mutex_lock(&g_cache.lock);
+    if (!g_cache.ready || need > g_cache.max_bytes) {
+        pthread_mutex_unlock(&g_cache.lock);
+        free(e);
+        return -1;
+    }
+
+    double now = monotonic_sec();
+    e->expires = now + g_cache.ttl;
+
+    CacheEntry *old = entry_find(key, key_len, e->hash);
+    if (old) {
+        entry_free(old);
+    }
+    while (g_cache.lru_tail && g_cache.bytes + need > g_cache.max_bytes) {
+        if (g_cache.lru_tail->expires > now) {
+            g_cache.evictions++;
+        }
+        entry_free(g_cache.lru_tail);
+    }
+
+    e->next = g_cache.table[e->hash & g_cache.table_mask];
+    g_cache.table[e->hash & g_cache.table_mask] = e;
+    lru_push_front(e);
+    g_cache.bytes += need;
+    if (++g_cache.entries > (int)g_cache.table_mask + 1) {
+        table_grow();
+    }
+    pthread_mutex_unlock(&g_cache.lock);
+    return 0;
+}
+
+void cache_stats(CacheStats *out)
+{
+    if (!out) {
+        return;
+    }
+    pthread_mutex_lock(&g_cache.lock);
+    out->hits = g_cache.hits;
+    out->misses = g_cache.misses;
+    out->evictions = g_cache.evictions;
+    out->entries = g_cache.entries;
+    out->bytes = g_cache.bytes;
+    pthread_mutex_unlock(&g_cache.lock);
+}
@@ -0,0 +1,47 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* in-process cache of LLM replies to repeated single-turn prompts
+ * keyed by (model, system prompt, normalised user text, max_tokens);
+ * entries expire after a TTL and the least recently used go first once
+ * the byte budget is reached. all calls are thread-safe and are no-ops
+ * (lookups miss) until cache_init() succeeds.
+ */
+
+// max_bytes bounds keys + replies + per-entry overhead; ttl_sec > 0
+// returns 0 on success, -1 on error
+int cache_init(size_t max_bytes, int ttl_sec);
+
+// drop every entry and free the cache
+void cache_destroy(void);
+
+/* copy the cached reply for this prompt into out (NUL-terminated)
+ * returns 0 on a hit, -1 on a miss (no entry, expired, or too long for out)
+ */
+int cache_lookup(const char *model, const char *system_prompt, const char *user_msg,
+                 int max_tokens, char *out, size_t out_cap);
+
+// remember reply for this prompt, replacing any previous entry
+// returns 0 if stored, -1 if not cacheable (too long) or out of memory
+int cache_store(const char *model, const char *system_prompt, const char *user_msg,
+                int max_tokens, const char *reply);
+
+/* fold case, collapse whitespace runs and drop surrounding whitespace and
+ * trailing sentence punctuation, so "Hi!" and "  hi " share an entry.
+ * ASCII only; other bytes are kept as they are.
+ * returns the length written to out (truncated to out_cap - 1).
+ * exported for testability.
+ */
+size_t cache_normalise(const char *in, char *out, size_t out_cap);
+
+typedef struct {
+    uint64_t hits;
+    uint64_t misses;
+    uint64_t evictions; // entries dropped for space (not expiry)
+    int entries;
+    size_t bytes;
+} CacheStats;
+
+void cache_stats(CacheStats *out);
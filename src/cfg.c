@@ -1,6 +1,7 @@
 #include "cfg.h"
 #include "config.h"
 #include "ini.h"
+#include "queue.h"
 
 #include <errno.h>
 #include <inttypes.h>
@@ -32,24 +33,60 @@ static void config_set_defaults(Config *cfg)
 {
     memset(cfg, 0, sizeof(*cfg));
     cfg->reply_delay = CFG_DEFAULT_REPLY_DELAY;
+    cfg->coalesce_ms = CFG_DEFAULT_COALESCE_MS;
+    cfg->send_rate = CFG_DEFAULT_SEND_RATE;
+    cfg->chat_rate = CFG_DEFAULT_CHAT_RATE;
+    cfg->group_rate = CFG_DEFAULT_GROUP_RATE;
     cfg->poll_timeout = CFG_DEFAULT_POLL_TIMEOUT;
     cfg->poll_limit = CFG_DEFAULT_POLL_LIMIT;
     snprintf(cfg->whitelist_path, sizeof(cfg->whitelist_path), "%s",
              CFG_DEFAULT_WHITELIST_PATH);
+    snprintf(cfg->api_base, sizeof(cfg->api_base), "%s", API_BASE);
 
     cfg->webhook_enabled = false;
     cfg->webhook_port = CFG_DEFAULT_WEBHOOK_PORT;
     cfg->webhook_threads = CFG_DEFAULT_WEBHOOK_THREADS;
     cfg->webhook_pool_size = CFG_DEFAULT_WEBHOOK_POOL_SIZE;
+    cfg->webhook_ingress_slots = CFG_DEFAULT_WEBHOOK_INGRESS_SLOTS;
+    cfg->webhook_dispatchers = CFG_DEFAULT_WEBHOOK_DISPATCHERS;
 
     cfg->home_group_id = 0;
     cfg->admin_user_id = 0;
 
     cfg->worker_count = CFG_DEFAULT_WORKER_COUNT;
+    cfg->worker_min = 0; // = count unless set
+    cfg->worker_max = 0;
+    cfg->worker_grow_depth = CFG_DEFAULT_WORKER_GROW_DEPTH;
+    cfg->worker_grow_wait_ms = CFG_DEFAULT_WORKER_GROW_WAIT_MS;
+    cfg->worker_idle_sec = CFG_DEFAULT_WORKER_IDLE_SEC;
+    cfg->worker_overflow = QUEUE_DROP_NEWEST;
+    cfg->worker_max_queue_age = 0;
+    cfg->worker_journal_path[0] = '\0';
+    cfg->worker_journal_segment_mb = CFG_DEFAULT_WORKER_JOURNAL_SEGMENT_MB;
+    snprintf(cfg->worker_busy_reply, sizeof(cfg->worker_busy_reply), "%s",
+             CFG_DEFAULT_WORKER_BUSY_REPLY);
     cfg->user_ring_size = CFG_DEFAULT_USER_RING_SIZE;
 
+    cfg->http_engine = true;
+    cfg->http_max_connections = CFG_DEFAULT_HTTP_MAX_CONNS;
+    cfg->http_share = true;
+    cfg->http2 = false;
+
+    cfg->metrics_enabled = false;
+    cfg->metrics_port = CFG_DEFAULT_METRICS_PORT;
+
+    cfg->trace_enabled = false;
+    cfg->trace_sample = CFG_DEFAULT_TRACE_SAMPLE;
+    cfg->trace_slow_ms = CFG_DEFAULT_TRACE_SLOW_MS;
+    cfg->trace_slots = CFG_DEFAULT_TRACE_SLOTS;
+    snprintf(cfg->trace_path, sizeof(cfg->trace_path), "%s", CFG_DEFAULT_TRACE_PATH);
+    cfg->cluster_procs = CFG_DEFAULT_CLUSTER_PROCS;
+
     snprintf(cfg->log_path, sizeof(cfg->log_path), "%s", LOG_DEFAULT_PATH);
     cfg->log_max_size_mb = LOG_DEFAULT_MAX_MB;
+    cfg->log_async = true;
+    cfg->log_mmap = false;
+    cfg->log_async_slots = LOG_DEFAULT_ASYNC_SLOTS;
 
     snprintf(cfg->llm_endpoint, sizeof(cfg->llm_endpoint), "%s",
              CFG_DEFAULT_LLM_ENDPOINT);
@@ -58,6 +95,19 @@ static void config_set_defaults(Config *cfg)
     cfg->llm_max_tokens = CFG_DEFAULT_LLM_MAX_TOKENS;
     snprintf(cfg->llm_system_prompt, sizeof(cfg->llm_system_prompt), "%s",
              CFG_DEFAULT_LLM_SYSTEM_PROMPT);
+    cfg->llm_stream = false;
+    cfg->llm_stream_edit_ms = CFG_DEFAULT_LLM_STREAM_EDIT_MS;
+    cfg->llm_context = false;
+    cfg->llm_context_window = CFG_DEFAULT_LLM_CONTEXT_WINDOW;
+    cfg->llm_context_chat_kb = CFG_DEFAULT_LLM_CONTEXT_CHAT_KB;
+    cfg->llm_context_total_mb = CFG_DEFAULT_LLM_CONTEXT_TOTAL_MB;
+    cfg->llm_cache = false;
+    cfg->llm_cache_kb = CFG_DEFAULT_LLM_CACHE_KB;
+    cfg->llm_cache_ttl = CFG_DEFAULT_LLM_CACHE_TTL;
+    cfg->llm_health_check_sec = CFG_DEFAULT_LLM_HEALTH_CHECK_SEC;
+    cfg->llm_warmup = true;
+    cfg->llm_keepalive_sec = CFG_DEFAULT_LLM_KEEPALIVE_SEC;
+    cfg->llm_budget_slow_ms = CFG_DEFAULT_LLM_BUDGET_SLOW_MS;
 }
 
 static int ini_handler_cb(void *user, const char *section, const char *name, const char *value)
@@ -70,12 +120,22 @@ static int ini_handler_cb(void *user, const char *section, const char *name, con
         snprintf(cfg->token, sizeof(cfg->token), "%s", value);
     } else if (MATCH("bot", "reply_delay")) {
         parse_int(value, 0, 300, &cfg->reply_delay);
+    } else if (MATCH("bot", "coalesce_ms")) {
+        parse_int(value, 0, 300000, &cfg->coalesce_ms);
+    } else if (MATCH("bot", "send_rate")) {
+        parse_int(value, 0, 1000, &cfg->send_rate);
+    } else if (MATCH("bot", "chat_rate")) {
+        parse_int(value, 0, 6000, &cfg->chat_rate);
+    } else if (MATCH("bot", "group_rate")) {
+        parse_int(value, 0, 6000, &cfg->group_rate);
     } else if (MATCH("bot", "poll_timeout")) {
         parse_int(value, 1, 120, &cfg->poll_timeout);
     } else if (MATCH("bot", "poll_limit")) {
         parse_int(value, 1, 100, &cfg->poll_limit);
     } else if (MATCH("bot", "whitelist_path")) {
         snprintf(cfg->whitelist_path, sizeof(cfg->whitelist_path), "%s", value);
+    } else if (MATCH("bot", "api_base")) {
+        snprintf(cfg->api_base, sizeof(cfg->api_base), "%s", value);
     } else if (MATCH("webhook", "enabled")) {
         cfg->webhook_enabled =
             (strcmp(value, "true") == 0 || strcmp(value, "1") == 0 || strcmp(value, "yes") == 0);
@@ -87,18 +147,88 @@ static int ini_handler_cb(void *user, const char *section, const char *name, con
         parse_int(value, 1, 32, &cfg->webhook_threads);
     } else if (MATCH("webhook", "pool_size")) {
         parse_int(value, 1, 64, &cfg->webhook_pool_size);
+    } else if (MATCH("webhook", "ingress_slots")) {
+        parse_int(value, 16, 65536, &cfg->webhook_ingress_slots);
+    } else if (MATCH("webhook", "dispatchers")) {
+        parse_int(value, 1, 8, &cfg->webhook_dispatchers);
     } else if (MATCH("group", "home_group_id")) {
         cfg->home_group_id = strtoll(value, NULL, 10);
     } else if (MATCH("admin", "admin_user_id")) {
         cfg->admin_user_id = strtoll(value, NULL, 10);
     } else if (MATCH("workers", "count")) {
         parse_int(value, 1, 16, &cfg->worker_count);
+    } else if (MATCH("workers", "min")) {
+        parse_int(value, 1, 16, &cfg->worker_min);
+    } else if (MATCH("workers", "max")) {
+        parse_int(value, 1, 16, &cfg->worker_max);
+    } else if (MATCH("workers", "grow_depth")) {
+        parse_int(value, 1, 10000, &cfg->worker_grow_depth);
+    } else if (MATCH("workers", "grow_wait_ms")) {
+        parse_int(value, 0, 600000, &cfg->worker_grow_wait_ms);
+    } else if (MATCH("workers", "idle_sec")) {
+        parse_int(value, 1, 86400, &cfg->worker_idle_sec);
     } else if (MATCH("workers", "ring_size")) {
         parse_int(value, 4, 256, &cfg->user_ring_size);
+    } else if (MATCH("workers", "overflow")) {
+        if (strcmp(value, "drop-newest") == 0) {
+            cfg->worker_overflow = QUEUE_DROP_NEWEST;
+        } else if (strcmp(value, "drop-oldest") == 0) {
+            cfg->worker_overflow = QUEUE_DROP_OLDEST;
+        } else if (strcmp(value, "merge") == 0) {
+            cfg->worker_overflow = QUEUE_MERGE;
+        } else {
+            fprintf(stderr, "cfg: [workers] overflow must be drop-newest, drop-oldest or merge\n");
+            return 0;
+        }
+    } else if (MATCH("workers", "max_queue_age_sec")) {
+        parse_int(value, 0, 86400, &cfg->worker_max_queue_age);
+    } else if (MATCH("workers", "busy_reply")) {
+        snprintf(cfg->worker_busy_reply, sizeof(cfg->worker_busy_reply), "%s", value);
+    } else if (MATCH("workers", "journal_path")) {
+        snprintf(cfg->worker_journal_path, sizeof(cfg->worker_journal_path), "%s", value);
+    } else if (MATCH("workers", "journal_segment_mb")) {
+        parse_int(value, 1, 1024, &cfg->worker_journal_segment_mb);
+    } else if (MATCH("http", "engine")) {
+        cfg->http_engine =
+            (strcmp(value, "true") == 0 || strcmp(value, "1") == 0 || strcmp(value, "yes") == 0);
+    } else if (MATCH("http", "max_connections")) {
+        parse_int(value, 1, 1024, &cfg->http_max_connections);
+    } else if (MATCH("http", "share")) {
+        cfg->http_share =
+            (strcmp(value, "true") == 0 || strcmp(value, "1") == 0 || strcmp(value, "yes") == 0);
+    } else if (MATCH("http", "http2")) {
+        cfg->http2 =
+            (strcmp(value, "true") == 0 || strcmp(value, "1") == 0 || strcmp(value, "yes") == 0);
+    } else if (MATCH("metrics", "enabled")) {
+        cfg->metrics_enabled =
+            (strcmp(value, "true") == 0 || strcmp(value, "1") == 0 || strcmp(value, "yes") == 0);
+    } else if (MATCH("metrics", "port")) {
+        parse_int(value, 1, 65535, &cfg->metrics_port);
+    } else if (MATCH("trace", "enabled")) {
+        cfg->trace_enabled =
+            (strcmp(value, "true") == 0 || strcmp(value, "1") == 0 || strcmp(value, "yes") == 0);
+    } else if (MATCH("trace", "sample")) {
+        parse_int(value, 0, 1000000, &cfg->trace_sample);
+    } else if (MATCH("trace", "slow_ms")) {
+        parse_int(value, 0, 3600000, &cfg->trace_slow_ms);
+    } else if (MATCH("trace", "slots")) {
+        parse_int(value, 64, 1048576, &cfg->trace_slots);
+    } else if (MATCH("trace", "path")) {
+        snprintf(cfg->trace_path, sizeof(cfg->trace_path), "%s", value);
+    } else if (MATCH("cluster", "procs")) {
+        parse_int(value, 1, CLUSTER_PROCS_MAX, &cfg->cluster_procs);
     } else if (MATCH("log", "path")) {
         snprintf(cfg->log_path, sizeof(cfg->log_path), "%s", value);
     } else if (MATCH("log", "max_size_mb")) {
         parse_int(value, 1, 1024, &cfg->log_max_size_mb);
+    } else if (MATCH("log", "async")) {
+        cfg->log_async =
+            (strcmp(value, "true") == 0 || strcmp(value, "1") == 0 || strcmp(value, "yes") == 0);
+    } else if (MATCH("log", "mmap")) {
+        cfg->log_mmap =
+            (strcmp(value, "true") == 0 || strcmp(value, "1") == 0 || strcmp(value, "yes") == 0);
+    } else if (MATCH("log", "async_slots")) {
+        parse_int(value, 64, 65536, &cfg->log_async_slots);
     } else if (MATCH("llm", "endpoint")) {
         snprintf(cfg->llm_endpoint, sizeof(cfg->llm_endpoint), "%s", value);
     } else if (MATCH("llm", "model")) {
@@ -107,6 +237,40 @@ static int ini_handler_cb(void *user, const char *section, const char *name, con
         parse_int(value, 32, 4096, &cfg->llm_max_tokens);
     } else if (MATCH("llm", "system_prompt")) {
         snprintf(cfg->llm_system_prompt, sizeof(cfg->llm_system_prompt), "%s", value);
+    } else if (MATCH("llm", "stream")) {
+        cfg->llm_stream =
+            (strcmp(value, "true") == 0 || strcmp(value, "1") == 0 || strcmp(value, "yes") == 0);
+    } else if (MATCH("llm", "stream_edit_ms")) {
+        parse_int(value, 250, 10000, &cfg->llm_stream_edit_ms);
+    } else if (MATCH("llm", "context")) {
+        cfg->llm_context =
+            (strcmp(value, "true") == 0 || strcmp(value, "1") == 0 || strcmp(value, "yes") == 0);
+    } else if (MATCH("llm", "context_window")) {
+        parse_int(value, 512, 262144, &cfg->llm_context_window);
+    } else if (MATCH("llm", "context_chat_kb")) {
+        parse_int(value, 4, 1024, &cfg->llm_context_chat_kb);
+    } else if (MATCH("llm", "context_total_mb")) {
+        parse_int(value, 1, 4096, &cfg->llm_context_total_mb);
+    } else if (MATCH("llm", "cache")) {
+        cfg->llm_cache =
+            (strcmp(value, "true") == 0 || strcmp(value, "1") == 0 || strcmp(value, "yes") == 0);
+    } else if (MATCH("llm", "cache_kb")) {
+        parse_int(value, 16, 1048576, &cfg->llm_cache_kb);
+    } else if (MATCH("llm", "cache_ttl")) {
+        parse_int(value, 1, 604800, &cfg->llm_cache_ttl);
+    } else if (MATCH("llm", "health_check_sec")) {
+        parse_int(value, 0, 3600, &cfg->llm_health_check_sec);
+    } else if (MATCH("llm", "warmup")) {
+        cfg->llm_warmup =
+            (strcmp(value, "true") == 0 || strcmp(value, "1") == 0 || strcmp(value, "yes") == 0);
+    } else if (MATCH("llm", "keepalive_sec")) {
+        parse_int(value, 0, 86400, &cfg->llm_keepalive_sec);
+    } else if (MATCH("llm", "budget_curve")) {
+        snprintf(cfg->llm_budget_curve, sizeof(cfg->llm_budget_curve), "%s", value);
+    } else if (MATCH("llm", "budget_slow_ms")) {
+        parse_int(value, 0, 3600000, &cfg->llm_budget_slow_ms);
+    } else if (MATCH("llm", "fallback_model")) {
+        snprintf(cfg->llm_fallback_model, sizeof(cfg->llm_fallback_model), "%s", value);
     } else {
         fprintf(stderr, "cfg: unknown key [%s] %s\n", section, name);
         return 0; // unknown key - treat as error
@@ -174,6 +338,22 @@ int config_load(Config *cfg, const char *ini_path)
     if (cfg->worker_count > 16) {
         cfg->worker_count = 16;
     }
+    // the pool is fixed at count unless min or max widen it; count stays inside
+    if (cfg->worker_min < 1) {
+        cfg->worker_min = cfg->worker_count;
+    }
+    if (cfg->worker_max < 1) {
+        cfg->worker_max = cfg->worker_count;
+    }
+    if (cfg->worker_max < cfg->worker_min) {
+        cfg->worker_max = cfg->worker_min;
+    }
+    if (cfg->worker_count < cfg->worker_min) {
+        cfg->worker_count = cfg->worker_min;
+    }
+    if (cfg->worker_count > cfg->worker_max) {
+        cfg->worker_count = cfg->worker_max;
+    }
     if (cfg->user_ring_size < 4) {
         cfg->user_ring_size = 4;
     }
@@ -198,21 +378,57 @@ int config_load(Config *cfg, const char *ini_path)
 
 void config_dump(const Config *cfg)
 {
-    printf("cfg: [bot]     token=******** reply_delay=%d "
+    printf("cfg: [bot]     token=******** reply_delay=%d coalesce_ms=%d "
            "poll_timeout=%d poll_limit=%d\n",
-           cfg->reply_delay, cfg->poll_timeout, cfg->poll_limit);
-    printf("cfg: [bot]     whitelist_path=%s\n", cfg->whitelist_path);
-    printf("cfg: [webhook] enabled=%s port=%d secret=%s threads=%d pool_size=%d\n",
+           cfg->reply_delay, cfg->coalesce_ms, cfg->poll_timeout, cfg->poll_limit);
+    printf("cfg: [bot]     send_rate=%d chat_rate=%d group_rate=%d whitelist_path=%s\n",
+           cfg->send_rate, cfg->chat_rate, cfg->group_rate, cfg->whitelist_path);
+    printf("cfg: [bot]     api_base=%s\n", cfg->api_base);
+    printf("cfg: [webhook] enabled=%s port=%d secret=%s threads=%d pool_size=%d "
+           "ingress_slots=%d dispatchers=%d\n",
            cfg->webhook_enabled ? "true" : "false",
            cfg->webhook_port, cfg->webhook_secret[0] ? "********" : "(none)",
-           cfg->webhook_threads, cfg->webhook_pool_size);
+           cfg->webhook_threads, cfg->webhook_pool_size, cfg->webhook_ingress_slots,
+           cfg->webhook_dispatchers);
     printf("cfg: [group]   home_group_id=%s\n",
            cfg->home_group_id != 0 ? "****" : "(none)");
     printf("cfg: [admin]   admin_user_id=%s\n",
            cfg->admin_user_id != 0 ? "****" : "(none)");
     printf("cfg: [workers] count=%d ring_size=%d\n", cfg->worker_count, cfg->user_ring_size);
-    printf("cfg: [log]     path=%s max_size_mb=%d\n", cfg->log_path, cfg->log_max_size_mb);
-    printf("cfg: [llm]     endpoint=%s model=%s max_tokens=%d\n",
+    printf("cfg: [workers] min=%d max=%d grow_depth=%d grow_wait_ms=%d idle_sec=%d\n",
+           cfg->worker_min, cfg->worker_max, cfg->worker_grow_depth, cfg->worker_grow_wait_ms,
+           cfg->worker_idle_sec);
+    static const char *const overflow_names[] = {"drop-newest", "drop-oldest", "merge"};
+    printf("cfg: [workers] overflow=%s max_queue_age_sec=%d busy_reply=%s\n",
+           overflow_names[cfg->worker_overflow], cfg->worker_max_queue_age,
+           cfg->worker_busy_reply[0] ? cfg->worker_busy_reply : "(none)");
+    printf("cfg: [workers] journal_path=%s journal_segment_mb=%d\n",
+           cfg->worker_journal_path[0] ? cfg->worker_journal_path : "(off)",
+           cfg->worker_journal_segment_mb);
+    printf("cfg: [http]    engine=%s max_connections=%d share=%s http2=%s\n",
+           cfg->http_engine ? "true" : "false", cfg->http_max_connections,
+           cfg->http_share ? "true" : "false", cfg->http2 ? "true" : "false");
+    printf("cfg: [metrics] enabled=%s port=%d\n", cfg->metrics_enabled ? "true" : "false",
+           cfg->metrics_port);
+    printf("cfg: [trace]   enabled=%s sample=%d slow_ms=%d slots=%d path=%s\n",
+           cfg->trace_enabled ? "true" : "false", cfg->trace_sample, cfg->trace_slow_ms,
+           cfg->trace_slots, cfg->trace_path);
+    printf("cfg: [cluster] procs=%d\n", cfg->cluster_procs);
+    printf("cfg: [log]     path=%s max_size_mb=%d async=%s async_slots=%d mmap=%s\n",
+           cfg->log_path, cfg->log_max_size_mb, cfg->log_async ? "true" : "false",
+           cfg->log_async_slots, cfg->log_mmap ? "true" : "false");
+    printf("cfg: [llm]     endpoint=%s model=%s max_tokens=%d stream=%s stream_edit_ms=%d\n",
            cfg->llm_endpoint, cfg->llm_model[0] ? cfg->llm_model : "(server default)",
-           cfg->llm_max_tokens);
+           cfg->llm_max_tokens, cfg->llm_stream ? "true" : "false", cfg->llm_stream_edit_ms);
+    printf("cfg: [llm]     context=%s context_window=%d context_chat_kb=%d context_total_mb=%d\n",
+           cfg->llm_context ? "true" : "false", cfg->llm_context_window,
+           cfg->llm_context_chat_kb, cfg->llm_context_total_mb);
+    printf("cfg: [llm]     cache=%s cache_kb=%d cache_ttl=%d health_check_sec=%d\n",
+           cfg->llm_cache ? "true" : "false", cfg->llm_cache_kb, cfg->llm_cache_ttl,
+           cfg->llm_health_check_sec);
+    printf("cfg: [llm]     warmup=%s keepalive_sec=%d\n", cfg->llm_warmup ? "true" : "false",
+           cfg->llm_keepalive_sec);
+    printf("cfg: [llm]     budget_curve=%s budget_slow_ms=%d fallback_model=%s\n",
+           cfg->llm_budget_curve[0] ? cfg->llm_budget_curve : "(fixed)", cfg->llm_budget_slow_ms,
+           cfg->llm_fallback_model[0] ? cfg->llm_fallback_model : "(none)");
 }
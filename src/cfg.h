@@ -8,16 +8,23 @@ typedef struct {
     // [bot]
     char token[256];
     int reply_delay;
+    int coalesce_ms; // merge a user's burst within this window into one reply (0 = off)
+    int send_rate;   // messages/s across all chats (0 = not limited)
+    int chat_rate;   // messages/min per private chat (0 = not limited)
+    int group_rate;  // messages/min per group (0 = not limited)
     int poll_timeout;
     int poll_limit;
     char whitelist_path[256];
+    char api_base[256]; // Bot API URL prefix; plain http only for a loopback mock
 
     // [webhook]
     bool webhook_enabled;
     int webhook_port;
     char webhook_secret[256];
     int webhook_threads;
-    int webhook_pool_size;
+    int webhook_pool_size; // request bodies cached per webhook thread
+    int webhook_ingress_slots;
+    int webhook_dispatchers;
 
     // [group]
     int64_t home_group_id; // 0 = not set (accept all groups)
@@ -26,18 +33,66 @@ typedef struct {
     int64_t admin_user_id; // 0 = no admin commands
 
     // [workers]
-    int worker_count;
+    int worker_count;        // workers started at boot
+    int worker_min;          // idle workers retire down to this
+    int worker_max;          // queue pressure grows the pool up to this
+    int worker_grow_depth;   // queued messages per worker before another starts
+    int worker_grow_wait_ms; // queue wait beyond reply_delay before another starts (0 = off)
+    int worker_idle_sec;     // a worker above the floor retires after this long idle
     int user_ring_size;
+    int worker_overflow;      // QueueOverflow when a user's ring is full
+    int worker_max_queue_age; // seconds a message may wait before it is shed (0 = never)
+    char worker_busy_reply[256]; // sent in place of shed messages ("" = shed silently)
+    char worker_journal_path[256]; // queue journal segments "<path>.<n>" ("" = off)
+    int worker_journal_segment_mb; // size of each journal segment
+
+    // [http]
+    bool http_engine;         // drive transfers from the shared curl_multi loop
+    int http_max_connections; // connection cap for the engine
+    bool http_share;          // process-wide DNS/TLS/connection cache
+    bool http2;               // prefer multiplexed HTTP/2 over TLS
+
+    // [metrics]
+    bool metrics_enabled; // export /metrics (webhook daemon, or a local port when polling)
+    int metrics_port;     // 127.0.0.1 port for /metrics in poll mode
+
+    // [trace]
+    bool trace_enabled;  // per-message stage traces, dumped on SIGUSR1
+    int trace_sample;    // keep 1 in N traces (0 = slow ones only)
+    int trace_slow_ms;   // always keep replies slower than this (0 = off)
+    int trace_slots;     // traces held for the next dump
+    char trace_path[256];
+
+    // [cluster]
+    int cluster_procs; // daemon copies sharing the work (1 = single process)
 
     // [log]
     char log_path[256];
     int log_max_size_mb;
+    bool log_async;      // format on the caller, write from a flusher thread
+    bool log_mmap;       // fixed-size mapped file with a cursor header
+    int log_async_slots; // lines the async ring holds before callers write inline
 
     // [llm]
-    char llm_endpoint[256];
+    char llm_endpoint[1024]; // base URL, or a comma-separated list to balance across
     char llm_model[128];
     int llm_max_tokens;
     char llm_system_prompt[512];
+    bool llm_stream;        // stream tokens and edit the reply in place
+    int llm_stream_edit_ms; // minimum gap between progressive edits
+    bool llm_context;       // send earlier turns of the chat with each request
+    int llm_context_window; // model context length in tokens
+    int llm_context_chat_kb;  // history kept per chat
+    int llm_context_total_mb; // history kept across all chats
+    bool llm_cache;         // answer repeated prompts from memory
+    int llm_cache_kb;       // cache size bound
+    int llm_cache_ttl;      // seconds a cached reply stays valid
+    int llm_health_check_sec; // probe interval for endpoint lists, 0 = passive only
+    bool llm_warmup;          // send each endpoint a tiny completion at startup
+    int llm_keepalive_sec;    // repeat it after this long without LLM traffic, 0 = never
+    char llm_budget_curve[256]; // "depth:tokens, ..." adaptive max_tokens, "" = fixed
+    int llm_budget_slow_ms;     // LLM latency that drops one step further, 0 = ignore
+    char llm_fallback_model[128]; // model for the deepest curve step, "" = same model
 } Config;
 
 // load config from INI file, then overlay environment variables
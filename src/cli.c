@@ -24,6 +24,8 @@ static void print_usage(void)
            "  restart          Restart the systemd service\n"
            "  status           Show service status\n"
            "  logs [-n N] [-f] Show log output (last N lines, or follow)\n"
+           "  logs --since D   Show lines from the last D (e.g. 90s, 10m, 2h, 1d)\n"
+           "  trace            Write the held message traces ([trace] path)\n"
            "  help, --help     Show this help message\n");
 }
 
@@ -82,12 +84,57 @@ static int cmd_status(void)
     return run_cmd(args);
 }
 
+// ask the running service to dump its traces; the daemon writes the file
+static int cmd_trace(void)
+{
+    Config cfg;
+    if (config_load(&cfg, "tgbot.ini") != 0 && config_load(&cfg, "/etc/tgbot/tgbot.ini") != 0) {
+        fprintf(stderr, "tgbot: cannot determine trace path from config\n");
+        return 1;
+    }
+    if (!cfg.trace_enabled) {
+        fprintf(stderr, "tgbot: tracing is off (set [trace] enabled = true)\n");
+        return 1;
+    }
+    const char *args[] = {"systemctl", "kill", "--signal=SIGUSR1", SERVICE_NAME, NULL};
+    int rc = run_cmd(args);
+    if (rc == 0) {
+        printf("tgbot: traces are being written to %s\n", cfg.trace_path);
+    }
+    return rc;
+}
+
+// parse a duration like "90", "90s", "10m", "2h" or "1d" into seconds; -1 if invalid
+static long parse_duration(const char *s)
+{
+    char *end = NULL;
+    long v = strtol(s, &end, 10);
+    if (end == s || v < 0) {
+        return -1;
+    }
+    long unit = 1;
+    if (*end == 'm') {
+        unit = 60;
+    } else if (*end == 'h') {
+        unit = 3600;
+    } else if (*end == 'd') {
+        unit = 86400;
+    } else if (*end != 's' && *end != '\0') {
+        return -1;
+    }
+    if (*end != '\0' && end[1] != '\0') {
+        return -1;
+    }
+    return v * unit;
+}
+
 static int cmd_logs(int argc, char **argv)
 {
     int n = 20;    // default lines
     int follow = 0;
+    long since = -1;
 
-    // parse sub-options: -n <N>, -f
+    // parse sub-options: -n <N>, -f, --since <D>
     for (int i = 0; i < argc; i++) {
         if (strcmp(argv[i], "-n") == 0 && i + 1 < argc) {
             n = atoi(argv[++i]);
@@ -96,6 +143,12 @@ static int cmd_logs(int argc, char **argv)
             }
         } else if (strcmp(argv[i], "-f") == 0) {
             follow = 1;
+        } else if (strcmp(argv[i], "--since") == 0 && i + 1 < argc) {
+            since = parse_duration(argv[++i]);
+            if (since < 0) {
+                fprintf(stderr, "tgbot: invalid duration '%s'\n", argv[i]);
+                return 1;
+            }
         }
     }
 
@@ -110,11 +163,18 @@ static int cmd_logs(int argc, char **argv)
     }
 
     if (follow) {
-        // print last n lines then follow
-        log_read_last_n(cfg.log_path, n);
+        // print recent lines then follow
+        if (since >= 0) {
+            log_read_since(cfg.log_path, since);
+        } else {
+            log_read_last_n(cfg.log_path, n);
+        }
         return log_follow(cfg.log_path);
     }
 
+    if (since >= 0) {
+        return log_read_since(cfg.log_path, since);
+    }
     return log_read_last_n(cfg.log_path, n);
 }
 
@@ -158,6 +218,11 @@ int cli_dispatch(int argc, char **argv, int *exit_code)
         return 0;
     }
 
+    if (strcmp(cmd, "trace") == 0) {
+        *exit_code = cmd_trace();
+        return 0;
+    }
+
     if (strcmp(cmd, "logs") == 0) {
         *exit_code = cmd_logs(argc - 2, argv + 2);
         return 0;
@@ -0,0 +1,369 @@
+#define _GNU_SOURCE // struct ucred
+
+#include "cluster.h"
+#include "config.h"
+#include "logger.h"
+#include "metrics.h"
+#include "queue.h"
+#include "trace.h"
+#include "update.h"
+
+#include <errno.h>
+#include <inttypes.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/prctl.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+// one datagram per forwarded message or whitelist change
+typedef struct {
+    char type; // 'M' message, 'W' whitelist change
+    char op;   // 'W': '+' or '-'
+    int64_t user_id;
+    int64_t chat_id;
+    char text[UPDATE_TEXT_MAX]; // 'M': only the used part (and its NUL) is sent
+} Datagram;
+
+static struct {
+    pid_t supervisor; // names the sockets, so copies of one daemon find each other
+    int self;
+    int procs;
+    int rx_fd;
+    int tx_fd;
+    Whitelist *wl;
+    bool started;
+    atomic_bool stop;
+    pthread_t rx;
+    atomic_uint_fast64_t forwarded;
+    atomic_uint_fast64_t received;
+    atomic_uint_fast64_t fallbacks;
+} g_cluster = {.rx_fd = -1, .tx_fd = -1};
+
+// Lamping & Veach jump consistent hash: going from n to n+1 copies moves
+// only 1/(n+1) of the users
+int cluster_owner(int64_t user_id, int procs)
+{
+    if (procs <= 1) {
+        return 0;
+    }
+    uint64_t key = queue_hash_user(user_id);
+    int64_t b = -1;
+    int64_t j = 0;
+    while (j < procs) {
+        b = j;
+        key = key * 2862933555777941757ULL + 1;
+        j = (int64_t)((double)(b + 1) * ((double)(1LL << 31) / (double)((key >> 33) + 1)));
+    }
+    return (int)b;
+}
+
+/* abstract-namespace address of copy idx: nothing on disk to clean up
+ * the namespace has no permissions and the name is guessable, so the
+ * receiver checks every sender's credentials instead
+ */
+static socklen_t copy_addr(int idx, struct sockaddr_un *sa)
+{
+    memset(sa, 0, sizeof(*sa));
+    sa->sun_family = AF_UNIX;
+    int n = snprintf(sa->sun_path + 1, sizeof(sa->sun_path) - 1, "tgbot-cluster-%d-%d",
+                     (int)g_cluster.supervisor, idx);
+    return (socklen_t)(offsetof(struct sockaddr_un, sun_path) + 1 + (size_t)n);
+}
+
+static pid_t spawn_child(int idx)
+{
+    pid_t pid = fork();
+    if (pid == 0) {
+        // a copy must not outlive its supervisor
+        prctl(PR_SET_PDEATHSIG, SIGTERM);
+        if (getppid() != g_cluster.supervisor) {
+            _exit(1);
+        }
+    } else if (pid < 0) {
+        log_error("cluster: fork failed for copy %d: %s", idx, strerror(errno));
+    }
+    return pid;
+}
+
+int cluster_spawn(int procs, volatile sig_atomic_t *running)
+{
+    if (procs < 1 || procs > CLUSTER_PROCS_MAX) {
+        return -1;
+    }
+    g_cluster.supervisor = getpid();
+    pid_t pids[CLUSTER_PROCS_MAX] = {0};
+    int alive = 0;
+    for (int i = 0; i < procs; i++) {
+        pids[i] = spawn_child(i);
+        if (pids[i] == 0) {
+            return i;
+        }
+        alive += pids[i] > 0;
+    }
+    log_info("cluster: supervising %d copies", alive);
+
+    bool stopping = false;
+    while (alive > 0) {
+        if (!*running && !stopping) {
+            stopping = true;
+            for (int i = 0; i < procs; i++) {
+                if (pids[i] > 0) {
+                    kill(pids[i], SIGTERM);
+                }
+            }
+        }
+        int status = 0;
+        pid_t pid = waitpid(-1, &status, 0);
+        if (pid < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            break;
+        }
+        int idx = -1;
+        for (int i = 0; i < procs; i++) {
+            if (pids[i] == pid) {
+                idx = i;
+            }
+        }
+        if (idx < 0) {
+            continue;
+        }
+        pids[idx] = 0;
+        alive--;
+        if (WIFEXITED(status) && WEXITSTATUS(status) == 0) {
+            continue;
+        }
+        log_warn("cluster: copy %d (pid %d) died (%s %d)", idx, (int)pid,
+                 WIFSIGNALED(status) ? "signal" : "status",
+                 WIFSIGNALED(status) ? WTERMSIG(status) : WEXITSTATUS(status));
+        if (!*running) {
+            continue;
+        }
+        // its users are queued by whoever takes their updates until it is back
+        sleep(CLUSTER_RESTART_SEC);
+        if (!*running) {
+            continue;
+        }
+        pids[idx] = spawn_child(idx);
+        if (pids[idx] == 0) {
+            return idx;
+        }
+        if (pids[idx] > 0) {
+            alive++;
+            log_info("cluster: restarted copy %d as pid %d", idx, (int)pids[idx]);
+        }
+    }
+    return -1;
+}
+
+static void receive(const Datagram *d, size_t len)
+{
+    if (d->type == 'W' && len >= offsetof(Datagram, text)) {
+        if (g_cluster.wl && whitelist_apply(g_cluster.wl, d->op, d->user_id) == 0) {
+            log_info("cluster: whitelist %c%" PRId64 " from another copy", d->op, d->user_id);
+        }
+        return;
+    }
+    size_t head = offsetof(Datagram, text);
+    if (d->type != 'M' || len <= head || d->text[len - head - 1] != '\0') {
+        log_warn("cluster: malformed datagram (%zu bytes) ignored", len);
+        return;
+    }
+    atomic_fetch_add_explicit(&g_cluster.received, 1, memory_order_relaxed);
+    int rc = queue_push_traced(d->user_id, d->chat_id, d->text, trace_next_id());
+    if (rc < 0) {
+        log_warn("cluster: queue full for user %" PRId64 " - message dropped", d->user_id);
+    }
+    if (rc != 0) {
+        metrics_add(MET_QUEUE_DROPS, 1);
+    }
+}
+
+/* receive one datagram into d; 0 if there was none, -1 if it was dropped
+ * because the kernel did not vouch for a sender of our own uid
+ */
+static ssize_t recv_trusted(Datagram *d)
+{
+    union {
+        char buf[CMSG_SPACE(sizeof(struct ucred))];
+        struct cmsghdr align;
+    } ctl;
+    struct iovec iov = {.iov_base = d, .iov_len = sizeof(*d)};
+    struct msghdr mh = {.msg_iov = &iov,
+                        .msg_iovlen = 1,
+                        .msg_control = ctl.buf,
+                        .msg_controllen = sizeof(ctl.buf)};
+    ssize_t n = recvmsg(g_cluster.rx_fd, &mh, MSG_DONTWAIT);
+    if (n <= 0) {
+        return 0;
+    }
+    for (struct cmsghdr *c = CMSG_FIRSTHDR(&mh); c; c = CMSG_NXTHDR(&mh, c)) {
+        if (c->cmsg_level == SOL_SOCKET && c->cmsg_type == SCM_CREDENTIALS &&
+            c->cmsg_len == CMSG_LEN(sizeof(struct ucred))) {
+            struct ucred cred;
+            memcpy(&cred, CMSG_DATA(c), sizeof(cred));
+            if (cred.uid == getuid()) {
+                return n;
+            }
+            log_warn("cluster: datagram from uid %u (pid %d) dropped", (unsigned)cred.uid,
+                     (int)cred.pid);
+            return -1;
+        }
+    }
+    log_warn("cluster: datagram without credentials dropped");
+    return -1;
+}
+
+static void *receiver_main(void *arg)
+{
+    (void)arg;
+    static Datagram d; // one receiver thread
+    struct pollfd pfd = {.fd = g_cluster.rx_fd, .events = POLLIN};
+    while (!atomic_load(&g_cluster.stop)) {
+        if (poll(&pfd, 1, 250) <= 0) {
+            continue;
+        }
+        ssize_t n;
+        while ((n = recv_trusted(&d)) != 0) {
+            if (n > 0) {
+                receive(&d, (size_t)n);
+            }
+        }
+    }
+    return NULL;
+}
+
+int cluster_start(int self, int procs, Whitelist *wl)
+{
+    if (g_cluster.started || procs < 2 || procs > CLUSTER_PROCS_MAX || self < 0 ||
+        self >= procs) {
+        return -1;
+    }
+    if (g_cluster.supervisor == 0) {
+        g_cluster.supervisor = getpid();
+    }
+
+    int rx = socket(AF_UNIX, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+    int tx = socket(AF_UNIX, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+    struct sockaddr_un sa;
+    socklen_t sa_len = copy_addr(self, &sa);
+    if (rx < 0 || tx < 0 || bind(rx, (struct sockaddr *)&sa, sa_len) != 0) {
+        log_error("cluster: cannot bind copy %d socket: %s", self, strerror(errno));
+        if (rx >= 0) {
+            close(rx);
+        }
+        if (tx >= 0) {
+            close(tx);
+        }
+        return -1;
+    }
+    // the kernel attaches every sender's pid/uid/gid for recv_trusted
+    int on = 1;
+    if (setsockopt(rx, SOL_SOCKET, SO_PASSCRED, &on, sizeof(on)) != 0) {
+        log_error("cluster: SO_PASSCRED: %s", strerror(errno));
+        close(rx);
+        close(tx);
+        return -1;
+    }
+    // room for bursts of forwarded messages; a full buffer makes senders wait
+    int rcvbuf = 4 * 1024 * 1024;
+    setsockopt(rx, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof(rcvbuf));
+    struct timeval tv = {.tv_sec = 0, .tv_usec = CLUSTER_SEND_TIMEOUT_MS * 1000};
+    setsockopt(tx, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+
+    g_cluster.self = self;
+    g_cluster.procs = procs;
+    g_cluster.rx_fd = rx;
+    g_cluster.tx_fd = tx;
+    g_cluster.wl = wl;
+    atomic_store(&g_cluster.stop, false);
+    if (pthread_create(&g_cluster.rx, NULL, receiver_main, NULL) != 0) {
+        close(rx);
+        close(tx);
+        g_cluster.rx_fd = g_cluster.tx_fd = -1;
+        return -1;
+    }
+    g_cluster.started = true;
+    log_info("cluster: copy %d of %d ready", self, procs);
+    return 0;
+}
+
+static int send_to(int idx, const Datagram *d, size_t len)
+{
+    struct sockaddr_un sa;
+    socklen_t sa_len = copy_addr(idx, &sa);
+    ssize_t n = sendto(g_cluster.tx_fd, d, len, 0, (const struct sockaddr *)&sa, sa_len);
+    return n == (ssize_t)len ? 0 : -1;
+}
+
+int cluster_forward(int64_t user_id, int64_t chat_id, const char *text)
+{
+    if (!g_cluster.started) {
+        return 0;
+    }
+    int owner = cluster_owner(user_id, g_cluster.procs);
+    if (owner == g_cluster.self) {
+        return 0;
+    }
+    Datagram d = {.type = 'M', .user_id = user_id, .chat_id = chat_id};
+    size_t tlen = strlen(text);
+    if (tlen >= sizeof(d.text)) {
+        tlen = sizeof(d.text) - 1;
+    }
+    memcpy(d.text, text, tlen);
+    d.text[tlen] = '\0';
+    if (send_to(owner, &d, offsetof(Datagram, text) + tlen + 1) != 0) {
+        // restarting or swamped: better out of order here than dropped
+        atomic_fetch_add_explicit(&g_cluster.fallbacks, 1, memory_order_relaxed);
+        log_debug("cluster: copy %d unreachable (%s) - queueing user %" PRId64 " here", owner,
+                  strerror(errno), user_id);
+        return 0;
+    }
+    atomic_fetch_add_explicit(&g_cluster.forwarded, 1, memory_order_relaxed);
+    return 1;
+}
+
+void cluster_whitelist_changed(char op, int64_t user_id)
+{
+    if (!g_cluster.started) {
+        return;
+    }
+    Datagram d = {.type = 'W', .op = op, .user_id = user_id};
+    for (int i = 0; i < g_cluster.procs; i++) {
+        if (i != g_cluster.self && send_to(i, &d, offsetof(Datagram, text)) != 0) {
+            // a copy that is down reloads the file when it restarts
+            log_warn("cluster: whitelist change not delivered to copy %d: %s", i,
+                     strerror(errno));
+        }
+    }
+}
+
+void cluster_stats(ClusterStats *out)
+{
+    out->forwarded = atomic_load_explicit(&g_cluster.forwarded, memory_order_relaxed);
+    out->received = atomic_load_explicit(&g_cluster.received, memory_order_relaxed);
+    out->fallbacks = atomic_load_explicit(&g_cluster.fallbacks, memory_order_relaxed);
+}
+
+void cluster_stop(void)
+{
+    if (!g_cluster.started) {
+        return;
+    }
+    atomic_store(&g_cluster.stop, true);
+    pthread_join(g_cluster.rx, NULL);
+    close(g_cluster.rx_fd);
+    close(g_cluster.tx_fd);
+    g_cluster.rx_fd = g_cluster.tx_fd = -1;
+    g_cluster.wl = NULL;
+    g_cluster.started = false;
+}
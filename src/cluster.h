@@ -0,0 +1,58 @@
+#pragma once
+
+#include "whitelist.h"
+
+#include <signal.h>
+#include <stdint.h>
+
+/* multi-process mode ([cluster] procs > 1)
+ * a supervisor forks procs copies of the daemon and restarts any that die.
+ * any copy can take an update (webhook: they share the port through
+ * SO_REUSEPORT; polling: copy 0 polls), but each user has one owner copy,
+ * picked by jump consistent hashing over queue_hash_user, so the user's
+ * ordering, reply_delay, coalescing and per-chat rate limit all live in
+ * one queue. a message for another owner travels as one datagram over a
+ * Unix socket in the abstract namespace; while that owner is down (being
+ * restarted) the message is queued locally instead of dropped. that
+ * namespace has no permissions, so a datagram whose kernel-attached
+ * credentials are not this uid's is dropped. /allow and /revoke are
+ * journaled by the copy that took them and broadcast the same way, so every
+ * copy's whitelist agrees; the others apply them in memory only.
+ */
+
+// owner copy (0..procs-1) of a user; stable while procs is unchanged
+int cluster_owner(int64_t user_id, int procs);
+
+/* fork procs children and supervise them until *running is cleared, then
+ * SIGTERM them and wait. a child that dies (anything but exit status 0) is
+ * restarted after CLUSTER_RESTART_SEC. returns the child's index
+ * (0..procs-1) in each child, and -1 in the supervisor once every child
+ * has exited
+ */
+int cluster_spawn(int procs, volatile sig_atomic_t *running);
+
+/* bind this copy's socket and start the receiver thread, which queues
+ * forwarded messages and applies whitelist changes to wl
+ * call after queue_init; returns 0 on success
+ */
+int cluster_start(int self, int procs, Whitelist *wl);
+
+/* queue a message at its owner copy, which also draws its trace id
+ * returns 1 if another copy took it, 0 if the caller should queue it here
+ * (this copy owns the user, clustering is off, or the owner is unreachable)
+ */
+int cluster_forward(int64_t user_id, int64_t chat_id, const char *text);
+
+// tell every other copy about a whitelist change ('+' added, '-' removed)
+void cluster_whitelist_changed(char op, int64_t user_id);
+
+typedef struct {
+    uint64_t forwarded; // messages handed to another owner
+    uint64_t received;  // messages queued here for another copy
+    uint64_t fallbacks; // messages queued here because their owner was unreachable
+} ClusterStats;
+
+void cluster_stats(ClusterStats *out);
+
+// stop the receiver and close the sockets
+void cluster_stop(void);
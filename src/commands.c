@@ -62,10 +62,15 @@ static const char *parse_command(const char *text, char *cmd_buf, size_t cmd_buf
     return end;
 }
 
+// queue literal text for the sender's chat; workers send it without the LLM
+static void reply(const CmdCtx *ctx, QueueKind kind, const char *text)
+{
+    queue_push_reply(ctx->sender_id, ctx->chat_id, text, kind, 0);
+}
+
 static void cmd_start(const CmdCtx *ctx)
 {
-    queue_push(ctx->sender_id, ctx->chat_id,
-               "Hello! I'm tgbot. Use /help to see available commands.");
+    reply(ctx, QUEUE_REPLY, "Hello! I'm tgbot. Use /help to see available commands.");
 }
 
 static void cmd_help(const CmdCtx *ctx)
@@ -75,18 +80,18 @@ static void cmd_help(const CmdCtx *ctx)
                       "/status - (admin) operational status\n"
                       "/allow <user_id>  - (admin) add user to whitelist\n"
                       "/revoke <user_id> - (admin) remove user from whitelist";
-    queue_push(ctx->sender_id, ctx->chat_id, msg);
+    reply(ctx, QUEUE_REPLY, msg);
 }
 
 static void cmd_allow(const CmdCtx *ctx, const char *args)
 {
     if (ctx->cfg->admin_user_id == 0 || ctx->sender_id != ctx->cfg->admin_user_id) {
-        queue_push(ctx->sender_id, ctx->chat_id, "permission denied: admin only.");
+        reply(ctx, QUEUE_SYSTEM, "permission denied: admin only.");
         return;
     }
 
     if (!args || args[0] == '\0') {
-        queue_push(ctx->sender_id, ctx->chat_id, "Usage: /allow <user_id>");
+        reply(ctx, QUEUE_SYSTEM, "Usage: /allow <user_id>");
         return;
     }
 
@@ -94,36 +99,39 @@ static void cmd_allow(const CmdCtx *ctx, const char *args)
     char *endptr = NULL;
     int64_t target = strtoll(args, &endptr, 10);
     if (endptr == args || *endptr != '\0' || errno == ERANGE || target == 0) {
-        queue_push(ctx->sender_id, ctx->chat_id, "Invalid user ID.");
+        reply(ctx, QUEUE_SYSTEM, "Invalid user ID.");
         return;
     }
 
     int rc = whitelist_add(ctx->wl, target);
     if (rc == 1) {
-        queue_push(ctx->sender_id, ctx->chat_id, "User already whitelisted.");
+        reply(ctx, QUEUE_SYSTEM, "User already whitelisted.");
     } else if (rc == 0) {
+        if (ctx->wl_changed) {
+            ctx->wl_changed('+', target);
+        }
         char buf[128];
         snprintf(buf, sizeof(buf), "User %" PRId64 " added to whitelist.", target);
-        queue_push(ctx->sender_id, ctx->chat_id, buf);
+        reply(ctx, QUEUE_SYSTEM, buf);
 
         // notify the newly allowed user
         char welcome[128];
         snprintf(welcome, sizeof(welcome), "You have been granted access to this bot.");
-        queue_push(target, target, welcome);
+        queue_push_reply(target, target, welcome, QUEUE_SYSTEM, 0);
     } else {
-        queue_push(ctx->sender_id, ctx->chat_id, "Failed to add user (whitelist full?).");
+        reply(ctx, QUEUE_SYSTEM, "Failed to add user (whitelist full?).");
     }
 }
 
 static void cmd_revoke(const CmdCtx *ctx, const char *args)
 {
     if (ctx->cfg->admin_user_id == 0 || ctx->sender_id != ctx->cfg->admin_user_id) {
-        queue_push(ctx->sender_id, ctx->chat_id, "permission denied: admin only.");
+        reply(ctx, QUEUE_SYSTEM, "permission denied: admin only.");
         return;
     }
 
     if (!args || args[0] == '\0') {
-        queue_push(ctx->sender_id, ctx->chat_id, "Usage: /revoke <user_id>");
+        reply(ctx, QUEUE_SYSTEM, "Usage: /revoke <user_id>");
         return;
     }
 
@@ -131,19 +139,22 @@ static void cmd_revoke(const CmdCtx *ctx, const char *args)
     char *endptr = NULL;
     int64_t target = strtoll(args, &endptr, 10);
     if (endptr == args || *endptr != '\0' || errno == ERANGE || target == 0) {
-        queue_push(ctx->sender_id, ctx->chat_id, "Invalid user ID.");
+        reply(ctx, QUEUE_SYSTEM, "Invalid user ID.");
         return;
     }
 
     int rc = whitelist_remove(ctx->wl, target);
     if (rc == 1) {
-        queue_push(ctx->sender_id, ctx->chat_id, "User was not whitelisted.");
+        reply(ctx, QUEUE_SYSTEM, "User was not whitelisted.");
     } else if (rc == 0) {
+        if (ctx->wl_changed) {
+            ctx->wl_changed('-', target);
+        }
         char buf[128];
         snprintf(buf, sizeof(buf), "User %" PRId64 " removed from whitelist.", target);
-        queue_push(ctx->sender_id, ctx->chat_id, buf);
+        reply(ctx, QUEUE_SYSTEM, buf);
     } else {
-        queue_push(ctx->sender_id, ctx->chat_id, "Failed to remove user.");
+        reply(ctx, QUEUE_SYSTEM, "Failed to remove user.");
     }
 }
 
@@ -157,7 +168,7 @@ static double monotonic_sec(void)
 static void cmd_status(const CmdCtx *ctx)
 {
     if (ctx->cfg->admin_user_id == 0 || ctx->sender_id != ctx->cfg->admin_user_id) {
-        queue_push(ctx->sender_id, ctx->chat_id, "permission denied: admin only.");
+        reply(ctx, QUEUE_SYSTEM, "permission denied: admin only.");
         return;
     }
 
@@ -170,15 +181,18 @@ static void cmd_status(const CmdCtx *ctx)
     int depth = queue_depth();
     int wl_count = whitelist_count(ctx->wl);
     int workers = ctx->worker_count;
+    QueueMemStats qm;
+    queue_mem_stats(&qm);
+    size_t qkib = (qm.ring_bytes + qm.text_bytes + 1023) / 1024;
 
-    char buf[256];
+    char buf[320];
     snprintf(buf, sizeof(buf),
              "uptime: %dh %dm %ds\n"
-             "queue: %d pending\n"
+             "queue: %d pending, %d ring(s), %zu KiB\n"
              "whitelist: %d user(s)\n"
              "workers: %d",
-             hours, mins, secs, depth, wl_count, workers);
-    queue_push(ctx->sender_id, ctx->chat_id, buf);
+             hours, mins, secs, depth, qm.rings_live, qkib, wl_count, workers);
+    reply(ctx, QUEUE_SYSTEM, buf);
 }
 
 typedef enum { CMD_NOARG, CMD_HASARG } CmdArgType;
@@ -15,6 +15,8 @@ typedef struct {
     const char *bot_username; // e.g. "mybot" (without @)
     double boot_time;         // CLOCK_MONOTONIC seconds at startup
     int worker_count;
+    // optional: told about each /allow ('+') and /revoke ('-') that succeeded
+    void (*wl_changed)(char op, int64_t user_id);
 } CmdCtx;
 
 // try to dispatch a slash command
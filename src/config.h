@@ -1,8 +1,7 @@
 #pragma once
 
-// maximum number of whitelisted users
-// TODO: consider dynamic growth (realloc) instead of fixed ceiling
-#define WHITELIST_MAX 256
+// whitelist journal entries appended before they are folded into the base file
+#define WHITELIST_COMPACT_OPS 256
 
 // Telegram Bot API base URL (no trailing slash)
 #define API_BASE "https://api.telegram.org/bot"
@@ -13,31 +12,164 @@
 // maximum HTTP response body size (512 KiB)
 #define RESPONSE_BUF_MAX (512 * 1024)
 
+// message text limit in UTF-16 code units; longer text is cut to fit
+#define TG_TEXT_MAX 4096
+
 // webhook secret-token header name
 #define WEBHOOK_SECRET_HEADER "X-Telegram-Bot-Api-Secret-Token"
 
-// hash-map bucket count for the per-user message queue (must be power-of-2)
+// initial per-shard user hash table size (must be power-of-2); doubles as users grow
 #define QUEUE_BUCKETS 64
 #define QUEUE_BUCKET_MASK (QUEUE_BUCKETS - 1)
 
+// upper bound on queue shards (one per worker)
+#define QUEUE_SHARDS_MAX 64
+
+// literal replies a shard's direct lane holds before queue_push_reply refuses
+#define QUEUE_LANE_MAX 256
+
+// coalescing and the merge overflow policy stop growing a prompt at this size
+#define QUEUE_MERGE_MAX (16 * 1024)
+
+// upper bound on worker threads ([workers] count, min and max)
+#define WORKERS_MAX 16
+
+// initial conversation context hash table size (power-of-2); doubles as chats grow
+#define CONTEXT_BUCKETS 64
+
+// history messages kept per chat; reaching it trims the chat to half
+#define CONTEXT_MSGS_MAX 64
+
+// initial response cache hash table size (power-of-2); doubles as entries grow
+#define CACHE_BUCKETS 64
+
+// normalised prompts longer than this are never cached
+#define CACHE_PROMPT_MAX 256
+
+// cache key buffer: model + system prompt + max_tokens + prompt
+#define CACHE_KEY_MAX 1024
+
+// LLM backend pool: size limit, passive ejection and active probing
+#define LLM_POOL_MAX            16
+#define LLM_POOL_BASE_MAX       256  // one base URL, NUL included
+#define LLM_POOL_FAIL_MAX       3    // consecutive failures before ejection
+#define LLM_POOL_EJECT_SEC      5    // first ejection; doubles while failing
+#define LLM_POOL_EJECT_MAX_SEC  120
+#define LLM_POOL_SLOW_FACTOR    3.0  // first-byte latency vs the best backend
+#define LLM_POOL_SLOW_MIN_SEC   2.0  // never eject for latency below this
+#define LLM_POOL_PROBE_TIMEOUT  3
+
+// outbound send governor: initial chat bucket table size (power-of-2, doubles
+// as chats grow), sends a chat may burst before its rate applies, and the
+// longest single sleep while waiting (so shutdown is noticed)
+#define RATELIMIT_BUCKETS      64
+#define RATELIMIT_CHAT_BURST   3
+#define RATELIMIT_GROUP_BURST  3
+#define RATELIMIT_SLEEP_SLICE  0.25
+
+// async replies: buckets of the table of chats with a send on the HTTP
+// engine (power-of-2; only chats busy right now have an entry)
+#define SEND_CHAIN_BUCKETS 64
+
+// metrics: per-thread shards (threads past this many share one), registered gauges
+// and the largest /metrics body rendered
+#define METRICS_SHARDS      64
+#define METRICS_GAUGES_MAX  16
+#define METRICS_TEXT_MAX    16384
+
+// getUpdates retry backoff after consecutive failures (doubles, jittered)
+#define POLL_BACKOFF_MIN_SEC 1
+#define POLL_BACKOFF_MAX_SEC 60
+
+// elastic worker pool: how often the scaler looks at the queue
+#define WORKER_SCALE_TICK_SEC 0.5
+
+// messages one worker holds at once: LLM completions on the HTTP engine and
+// those queued behind one for the same chat; while any are out it looks for
+// finished ones this often
+#define LLM_WORKER_INFLIGHT 4
+#define WORKER_REAP_SEC     0.05
+
+// shutdown: longest wait for replies still on the HTTP engine to be sent
+#define HTTP_DRAIN_SEC 5.0
+
+// multi-process mode: most copies, the supervisor's pause before restarting
+// a dead copy, and how long a forward may wait on a busy owner's socket
+#define CLUSTER_PROCS_MAX       64
+#define CLUSTER_RESTART_SEC     1
+#define CLUSTER_SEND_TIMEOUT_MS 200
+
+// typing indicator: Telegram shows "typing" for 5 s, so it is renewed a
+// little sooner; a reply ready within the grace never shows one. at most
+// LLM_WORKER_INFLIGHT chats per busy worker are tracked
+#define TYPING_REFRESH_SEC 4.5
+#define TYPING_GRACE_SEC   0.5
+#define TYPING_TICK_SEC    0.1
+#define TYPING_CHATS_MAX   (WORKERS_MAX * LLM_WORKER_INFLIGHT)
+
+// LLM keep-alive: how often an idle warm-up thread checks for LLM traffic
+#define WARMUP_TICK_SEC 1.0
+
+// adaptive generation budget: steps in a [llm] budget_curve, and the weight
+// of each finished request in the LLM latency average
+#define BUDGET_STEPS_MAX 8
+#define BUDGET_EWMA_ALPHA 0.2
+
+// queue journal: smallest segment, how often appends are handed to msync, and
+// the segment count past which a rotation copies the oldest one's live
+// messages forward (when they fill at most 1/QJOURNAL_COMPACT_SHARE of it)
+// so it can be deleted
+#define QJOURNAL_SEGMENT_MIN (64 * 1024)
+#define QJOURNAL_SYNC_SEC 1.0
+#define QJOURNAL_COMPACT_SEGMENTS 4
+#define QJOURNAL_COMPACT_SHARE 4
+
 // default log file path and maximum size
 #define LOG_DEFAULT_PATH "/var/log/tgbot/tgbot.log"
 #define LOG_DEFAULT_MAX_MB 10
+#define LOG_DEFAULT_ASYNC_SLOTS 1024
 #define LOG_PATH_MAX 256
 
 // default config values (used by cfg.c; override in INI or env)
 #define CFG_DEFAULT_REPLY_DELAY       3
+#define CFG_DEFAULT_COALESCE_MS       0
+#define CFG_DEFAULT_SEND_RATE         30
+#define CFG_DEFAULT_CHAT_RATE         60
+#define CFG_DEFAULT_GROUP_RATE        20
 #define CFG_DEFAULT_POLL_TIMEOUT      30
 #define CFG_DEFAULT_POLL_LIMIT        100
 #define CFG_DEFAULT_WHITELIST_PATH    "whitelist.txt"
 #define CFG_DEFAULT_WEBHOOK_PORT      8443
 #define CFG_DEFAULT_WEBHOOK_THREADS   4
 #define CFG_DEFAULT_WEBHOOK_POOL_SIZE 8
+#define CFG_DEFAULT_WEBHOOK_INGRESS_SLOTS 256
+#define CFG_DEFAULT_WEBHOOK_DISPATCHERS   1
 #define CFG_DEFAULT_WORKER_COUNT      1
+#define CFG_DEFAULT_WORKER_GROW_DEPTH 4
+#define CFG_DEFAULT_WORKER_GROW_WAIT_MS 2000
+#define CFG_DEFAULT_WORKER_IDLE_SEC   300
 #define CFG_DEFAULT_USER_RING_SIZE    30
+#define CFG_DEFAULT_WORKER_BUSY_REPLY "I'm busy right now - please try again in a minute."
+#define CFG_DEFAULT_WORKER_JOURNAL_SEGMENT_MB 4
+#define CFG_DEFAULT_HTTP_MAX_CONNS    64
+#define CFG_DEFAULT_METRICS_PORT      9464
+#define CFG_DEFAULT_TRACE_SAMPLE      100
+#define CFG_DEFAULT_TRACE_SLOW_MS     5000
+#define CFG_DEFAULT_TRACE_SLOTS       4096
+#define CFG_DEFAULT_TRACE_PATH        "/var/log/tgbot/trace.json"
+#define CFG_DEFAULT_CLUSTER_PROCS     1
 
 // LLM defaults
 #define CFG_DEFAULT_LLM_ENDPOINT      "http://127.0.0.1:11434"
 #define CFG_DEFAULT_LLM_MODEL          ""
 #define CFG_DEFAULT_LLM_MAX_TOKENS     512
 #define CFG_DEFAULT_LLM_SYSTEM_PROMPT  "You are a helpful Telegram bot assistant. Keep replies concise."
+#define CFG_DEFAULT_LLM_STREAM_EDIT_MS 1000
+#define CFG_DEFAULT_LLM_CONTEXT_WINDOW 4096
+#define CFG_DEFAULT_LLM_CONTEXT_CHAT_KB 16
+#define CFG_DEFAULT_LLM_CONTEXT_TOTAL_MB 16
+#define CFG_DEFAULT_LLM_CACHE_KB       1024
+#define CFG_DEFAULT_LLM_CACHE_TTL      600
+#define CFG_DEFAULT_LLM_HEALTH_CHECK_SEC 10
+#define CFG_DEFAULT_LLM_KEEPALIVE_SEC  0
+#define CFG_DEFAULT_LLM_BUDGET_SLOW_MS 0
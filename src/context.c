@@ -0,0 +1,422 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "context.h"
+#include "config.h"
+#include "logger.h"
+
+#include <inttypes.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* arena record layout, oldest at head:
+ *   [role:1][len:4][len bytes of text]
+ * records are never rewritten in place, so the history a chat sends is
+ * always a prefix of the history it sends next, until a trim cuts the front.
+ */
+#define REC_HDR 5
+
+enum { ROLE_USER = 0, ROLE_ASSISTANT = 1 };
+
+static const char *const k_roles[] = {"user", "assistant"};
+
+// chat template overhead per message (role markers, separators)
+#define CTX_MSG_TOKENS 4
+
+// initial arena size; doubles up to the per-chat cap
+#define CTX_ARENA_MIN 1024
+
+typedef struct ChatCtx {
+    int64_t chat_id;
+    uint64_t hash;
+    struct ChatCtx *next;     // hash chain
+    struct ChatCtx *lru_prev; // towards most recently used
+    struct ChatCtx *lru_next; // towards least recently used
+    char *arena;
+    size_t cap;
+    size_t head; // first live record
+    size_t tail; // end of the last record
+    int count;   // live records
+    int tokens;  // estimated tokens of the live records
+} ChatCtx;
+
+static struct {
+    pthread_mutex_t lock;
+    int ready;
+    ChatCtx **table;
+    unsigned table_mask;
+    size_t chats;
+    ChatCtx *lru_head;
+    ChatCtx *lru_tail;
+    size_t bytes;      // arena bytes across all chats
+    size_t chat_cap;   // per-chat arena limit
+    size_t total_cap;  // process-wide arena limit
+} g_ctx = {.lock = PTHREAD_MUTEX_INITIALIZER};
+
+static uint64_t hash_chat(int64_t chat_id)
+{
+    uint64_t h = (uint64_t)chat_id;
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL; // MurmurHash3 fmix64 finalizer
+    h ^= h >> 33;
+    h *= 0xc4ceb9fe1a85ec53ULL;
+    h ^= h >> 33;
+    return h;
+}
+
+int context_estimate_tokens(size_t len)
+{
+    // three bytes a token errs high for latin text and about right for
+    // multi-byte scripts, so the estimate does not overrun the window
+    size_t t = (len + 2) / 3;
+    return t > (size_t)(INT32_MAX / 2) ? INT32_MAX / 2 : (int)t;
+}
+
+static int rec_tokens(size_t len)
+{
+    return context_estimate_tokens(len) + CTX_MSG_TOKENS;
+}
+
+static size_t rec_len(const ChatCtx *c, size_t off)
+{
+    uint32_t len;
+    memcpy(&len, c->arena + off + 1, sizeof(len));
+    return len;
+}
+
+// LRU list and hash table maintenance (caller holds g_ctx.lock)
+
+static void lru_unlink(ChatCtx *c)
+{
+    if (c->lru_prev) {
+        c->lru_prev->lru_next = c->lru_next;
+    } else {
+        g_ctx.lru_head = c->lru_next;
+    }
+    if (c->lru_next) {
+        c->lru_next->lru_prev = c->lru_prev;
+    } else {
+        g_ctx.lru_tail = c->lru_prev;
+    }
+    c->lru_prev = NULL;
+    c->lru_next = NULL;
+}
+
+static void lru_touch(ChatCtx *c)
+{
+    if (g_ctx.lru_head == c) {
+        return;
+    }
+    if (c->lru_prev || c->lru_next || g_ctx.lru_tail == c) {
+        lru_unlink(c);
+    }
+    c->lru_next = g_ctx.lru_head;
+    if (g_ctx.lru_head) {
+        g_ctx.lru_head->lru_prev = c;
+    }
+    g_ctx.lru_head = c;
+    if (!g_ctx.lru_tail) {
+        g_ctx.lru_tail = c;
+    }
+}
+
+// double the hash table once the load factor passes 1
+static void table_grow(void)
+{
+    unsigned size = g_ctx.table_mask + 1;
+    ChatCtx **t = calloc((size_t)size * 2, sizeof(*t));
+    if (!t) {
+        return; // keep chaining in the old table
+    }
+    unsigned mask = size * 2 - 1;
+    for (unsigned i = 0; i < size; i++) {
+        ChatCtx *c = g_ctx.table[i];
+        while (c) {
+            ChatCtx *next = c->next;
+            c->next = t[c->hash & mask];
+            t[c->hash & mask] = c;
+            c = next;
+        }
+    }
+    free(g_ctx.table);
+    g_ctx.table = t;
+    g_ctx.table_mask = mask;
+}
+
+static ChatCtx *chat_find(int64_t chat_id)
+{
+    uint64_t h = hash_chat(chat_id);
+    for (ChatCtx *c = g_ctx.table[h & g_ctx.table_mask]; c; c = c->next) {
+        if (c->chat_id == chat_id) {
+            return c;
+        }
+    }
+    return NULL;
+}
+
+static ChatCtx *chat_new(int64_t chat_id)
+{
+    ChatCtx *c = calloc(1, sizeof(*c));
+    if (!c) {
+        return NULL;
+    }
+    c->chat_id = chat_id;
+    c->hash = hash_chat(chat_id);
+    c->next = g_ctx.table[c->hash & g_ctx.table_mask];
+    g_ctx.table[c->hash & g_ctx.table_mask] = c;
+    lru_touch(c);
+    if (++g_ctx.chats > (size_t)g_ctx.table_mask + 1) {
+        table_grow();
+    }
+    return c;
+}
+
+static void chat_free(ChatCtx *c)
+{
+    ChatCtx **pp = &g_ctx.table[c->hash & g_ctx.table_mask];
+    while (*pp && *pp != c) {
+        pp = &(*pp)->next;
+    }
+    if (*pp) {
+        *pp = c->next;
+    }
+    lru_unlink(c);
+    g_ctx.chats--;
+    g_ctx.bytes -= c->cap;
+    free(c->arena);
+    free(c);
+}
+
+// history editing (caller holds g_ctx.lock)
+
+static void drop_oldest(ChatCtx *c)
+{
+    size_t len = rec_len(c, c->head);
+    c->head += REC_HDR + len;
+    c->count--;
+    c->tokens -= rec_tokens(len);
+    if (c->count == 0) {
+        c->head = 0;
+        c->tail = 0;
+        c->tokens = 0;
+    }
+}
+
+// drop the oldest exchange, so history always opens with a user message
+static void drop_turn(ChatCtx *c)
+{
+    drop_oldest(c);
+    while (c->count > 0 && c->arena[c->head] == ROLE_ASSISTANT) {
+        drop_oldest(c);
+    }
+}
+
+// make room for need more bytes at the tail, compacting then growing the arena
+static int reserve(ChatCtx *c, size_t need)
+{
+    if (c->tail + need <= c->cap) {
+        return 0;
+    }
+    if (c->head > 0) {
+        memmove(c->arena, c->arena + c->head, c->tail - c->head);
+        c->tail -= c->head;
+        c->head = 0;
+        if (c->tail + need <= c->cap) {
+            return 0;
+        }
+    }
+    size_t cap = c->cap ? c->cap : CTX_ARENA_MIN;
+    while (cap < c->tail + need) {
+        cap *= 2;
+    }
+    if (cap > g_ctx.chat_cap) {
+        cap = g_ctx.chat_cap;
+    }
+    char *a = realloc(c->arena, cap);
+    if (!a) {
+        return -1;
+    }
+    g_ctx.bytes += cap - c->cap;
+    c->arena = a;
+    c->cap = cap;
+    return 0;
+}
+
+static void append_rec(ChatCtx *c, int role, const char *text, size_t len)
+{
+    uint32_t len32 = (uint32_t)len;
+    c->arena[c->tail] = (char)role;
+    memcpy(c->arena + c->tail + 1, &len32, sizeof(len32));
+    memcpy(c->arena + c->tail + REC_HDR, text, len);
+    c->tail += REC_HDR + len;
+    c->count++;
+    c->tokens += rec_tokens(len);
+}
+
+int context_init(size_t chat_bytes, size_t total_bytes)
+{
+    if (chat_bytes < CTX_ARENA_MIN) {
+        return -1;
+    }
+    pthread_mutex_lock(&g_ctx.lock);
+    if (g_ctx.ready) {
+        pthread_mutex_unlock(&g_ctx.lock);
+        return -1;
+    }
+    g_ctx.table = calloc(CONTEXT_BUCKETS, sizeof(*g_ctx.table));
+    if (!g_ctx.table) {
+        pthread_mutex_unlock(&g_ctx.lock);
+        return -1;
+    }
+    g_ctx.table_mask = CONTEXT_BUCKETS - 1;
+    g_ctx.chats = 0;
+    g_ctx.lru_head = NULL;
+    g_ctx.lru_tail = NULL;
+    g_ctx.bytes = 0;
+    g_ctx.chat_cap = chat_bytes;
+    g_ctx.total_cap = total_bytes > chat_bytes ? total_bytes : chat_bytes;
+    g_ctx.ready = 1;
+    pthread_mutex_unlock(&g_ctx.lock);
+    return 0;
+}
+
+void context_destroy(void)
+{
+    pthread_mutex_lock(&g_ctx.lock);
+    if (g_ctx.ready) {
+        while (g_ctx.lru_head) {
+            chat_free(g_ctx.lru_head);
+        }
+        free(g_ctx.table);
+        g_ctx.table = NULL;
+        g_ctx.ready = 0;
+    }
+    pthread_mutex_unlock(&g_ctx.lock);
+}
+
+int context_add_turn(int64_t chat_id, const char *user_msg, const char *reply)
+{
+    if (!user_msg || !reply) {
+        return -1;
+    }
+    size_t ulen = strlen(user_msg);
+    size_t rlen = strlen(reply);
+    size_t need = 2 * REC_HDR + ulen + rlen;
+
+    pthread_mutex_lock(&g_ctx.lock);
+    if (!g_ctx.ready) {
+        pthread_mutex_unlock(&g_ctx.lock);
+        return -1;
+    }
+
+    ChatCtx *c = chat_find(chat_id);
+    if (need > g_ctx.chat_cap) {
+        // a turn that can never fit: forget the chat rather than keep a gap
+        if (c) {
+            chat_free(c);
+        }
+        pthread_mutex_unlock(&g_ctx.lock);
+        log_warn("context: turn of %zu bytes exceeds the per-chat cap in chat %" PRId64,
+                 need, chat_id);
+        return -1;
+    }
+    if (!c && !(c = chat_new(chat_id))) {
+        pthread_mutex_unlock(&g_ctx.lock);
+        return -1;
+    }
+
+    // over a limit: cut to half of it in one go so the prefix changes rarely
+    if (c->tail - c->head + need > g_ctx.chat_cap || c->count + 2 > CONTEXT_MSGS_MAX) {
+        while (c->count > 0 && (c->tail - c->head + need > g_ctx.chat_cap / 2 ||
+                                c->count + 2 > CONTEXT_MSGS_MAX / 2)) {
+            drop_turn(c);
+        }
+    }
+
+    if (reserve(c, need) != 0) {
+        pthread_mutex_unlock(&g_ctx.lock);
+        return -1;
+    }
+    append_rec(c, ROLE_USER, user_msg, ulen);
+    append_rec(c, ROLE_ASSISTANT, reply, rlen);
+    lru_touch(c);
+
+    // over the global cap: the least recently used chats go first
+    while (g_ctx.bytes > g_ctx.total_cap && g_ctx.lru_tail && g_ctx.lru_tail != c) {
+        chat_free(g_ctx.lru_tail);
+    }
+    pthread_mutex_unlock(&g_ctx.lock);
+    return 0;
+}
+
+int context_get(int64_t chat_id, int budget_tokens, LlmMsg *msgs, int max,
+                char *buf, size_t cap)
+{
+    if (!msgs || max <= 0 || !buf) {
+        return -1;
+    }
+
+    pthread_mutex_lock(&g_ctx.lock);
+    if (!g_ctx.ready) {
+        pthread_mutex_unlock(&g_ctx.lock);
+        return -1;
+    }
+    ChatCtx *c = chat_find(chat_id);
+    if (!c || budget_tokens <= 0) {
+        pthread_mutex_unlock(&g_ctx.lock);
+        return 0;
+    }
+    lru_touch(c);
+
+    if (c->tokens > budget_tokens || c->count > max) {
+        while (c->count > 0 && (c->tokens > budget_tokens / 2 || c->count > max / 2)) {
+            drop_turn(c);
+        }
+    }
+
+    int n = 0;
+    size_t used = 0;
+    for (size_t off = c->head; off < c->tail; n++) {
+        size_t len = rec_len(c, off);
+        if (used + len + 1 > cap) {
+            pthread_mutex_unlock(&g_ctx.lock);
+            return -1;
+        }
+        memcpy(buf + used, c->arena + off + REC_HDR, len);
+        buf[used + len] = '\0';
+        msgs[n].role = k_roles[(int)c->arena[off]];
+        msgs[n].content = buf + used;
+        used += len + 1;
+        off += REC_HDR + len;
+    }
+    pthread_mutex_unlock(&g_ctx.lock);
+    return n;
+}
+
+void context_forget(int64_t chat_id)
+{
+    pthread_mutex_lock(&g_ctx.lock);
+    if (g_ctx.ready) {
+        ChatCtx *c = chat_find(chat_id);
+        if (c) {
+            chat_free(c);
+        }
+    }
+    pthread_mutex_unlock(&g_ctx.lock);
+}
+
+size_t context_chat_cap(void)
+{
+    pthread_mutex_lock(&g_ctx.lock);
+    size_t cap = g_ctx.chat_cap;
+    pthread_mutex_unlock(&g_ctx.lock);
+    return cap;
+}
+
+size_t context_bytes(void)
+{
+    pthread_mutex_lock(&g_ctx.lock);
+    size_t bytes = g_ctx.bytes;
+    pthread_mutex_unlock(&g_ctx.lock);
+    return bytes;
+}
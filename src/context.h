@@ -0,0 +1,45 @@
+#pragma once
+
+#include "llm.h"
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* per-chat conversation history for multi-turn LLM requests
+ * each chat keeps its turns in one contiguous arena, oldest first. history is
+ * only ever appended to, and trimmed in large steps (down to half of whatever
+ * limit was hit), so the serialised prompt prefix stays byte-identical from
+ * one request to the next and the server's prompt cache keeps hitting.
+ * all calls are thread-safe.
+ */
+
+// set the per-chat and process-wide arena limits in bytes
+// returns 0 on success, -1 on error
+int context_init(size_t chat_bytes, size_t total_bytes);
+
+// drop every chat and free the store
+void context_destroy(void);
+
+// record one completed exchange: the user's message and the assistant reply
+// returns 0 on success, -1 if the store is not initialised or out of memory
+int context_add_turn(int64_t chat_id, const char *user_msg, const char *reply);
+
+/* copy the history of chat_id into msgs (at most max entries), with the text
+ * stored in buf. history estimated above budget_tokens is trimmed from the
+ * oldest turn down to half the budget first, and the trim is kept.
+ * returns the number of messages, 0 for an unknown chat, -1 on error
+ */
+int context_get(int64_t chat_id, int budget_tokens, LlmMsg *msgs, int max,
+                char *buf, size_t cap);
+
+// forget the history of one chat
+void context_forget(int64_t chat_id);
+
+// bytes context_get may need in buf for a single chat
+size_t context_chat_cap(void);
+
+// rough token count of len bytes of text, as used for budgeting
+int context_estimate_tokens(size_t len);
+
+// total bytes held across all chats
+size_t context_bytes(void);
@@ -0,0 +1,393 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "http.h"
+#include "logger.h"
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <time.h>
+
+// how long the event loop waits for socket activity before re-checking state
+#define HTTP_POLL_MS 1000
+// how often http_engine_drain() looks at the in-flight count
+#define HTTP_DRAIN_TICK_MS 10
+
+/* a submitted transfer; found again from the easy handle via CURLOPT_PRIVATE
+ * next links the pending list, then the active list (with prev) once added
+ */
+typedef struct HttpXfer {
+    CURL *easy;
+    http_done_cb cb;
+    void *ud;
+    struct HttpXfer *prev;
+    struct HttpXfer *next;
+} HttpXfer;
+
+static struct {
+    CURLM *multi;
+    pthread_t thread;
+    pthread_mutex_t mtx; // guards pending and the running transition
+    HttpXfer *pending;   // submitted but not yet added to the multi (LIFO)
+    HttpXfer *active;    // added to the multi (engine thread only)
+    int running;
+    _Atomic int inflight;
+} g_http = {.mtx = PTHREAD_MUTEX_INITIALIZER};
+
+// move submitted transfers into the multi handle (engine thread only)
+static void add_pending(void)
+{
+    pthread_mutex_lock(&g_http.mtx);
+    HttpXfer *x = g_http.pending;
+    g_http.pending = NULL;
+    pthread_mutex_unlock(&g_http.mtx);
+
+    while (x) {
+        HttpXfer *next = x->next;
+        curl_easy_setopt(x->easy, CURLOPT_PRIVATE, x);
+        CURLMcode mrc = curl_multi_add_handle(g_http.multi, x->easy);
+        if (mrc != CURLM_OK) {
+            log_error("http: multi_add_handle: %s", curl_multi_strerror(mrc));
+            x->cb(x->easy, CURLE_FAILED_INIT, x->ud);
+            atomic_fetch_sub_explicit(&g_http.inflight, 1, memory_order_relaxed);
+            free(x);
+        } else {
+            x->prev = NULL;
+            x->next = g_http.active;
+            if (g_http.active) {
+                g_http.active->prev = x;
+            }
+            g_http.active = x;
+        }
+        x = next;
+    }
+}
+
+// detach a finished transfer from the multi and run its callback
+static void finish(HttpXfer *x, CURLcode rc)
+{
+    if (x->prev) {
+        x->prev->next = x->next;
+    } else {
+        g_http.active = x->next;
+    }
+    if (x->next) {
+        x->next->prev = x->prev;
+    }
+    curl_multi_remove_handle(g_http.multi, x->easy);
+    x->cb(x->easy, rc, x->ud);
+    // after the callback, so a transfer it chains on keeps the count above 0
+    atomic_fetch_sub_explicit(&g_http.inflight, 1, memory_order_relaxed);
+    free(x);
+}
+
+// dispatch completion callbacks for finished transfers (engine thread only)
+static void reap_done(void)
+{
+    CURLMsg *m;
+    int left = 0;
+    while ((m = curl_multi_info_read(g_http.multi, &left)) != NULL) {
+        if (m->msg != CURLMSG_DONE) {
+            continue;
+        }
+        // the message is invalidated by remove_handle, so copy first
+        CURL *easy = m->easy_handle;
+        CURLcode rc = m->data.result;
+
+        HttpXfer *x = NULL;
+        curl_easy_getinfo(easy, CURLINFO_PRIVATE, (char **)&x);
+        if (x) {
+            finish(x, rc);
+        } else {
+            curl_multi_remove_handle(g_http.multi, easy);
+        }
+    }
+}
+
+// abort everything still owned by the engine (engine thread, after loop exit)
+static void abort_all(void)
+{
+    add_pending();
+    while (g_http.active) {
+        finish(g_http.active, CURLE_ABORTED_BY_CALLBACK);
+    }
+}
+
+static void *engine_main(void *arg)
+{
+    (void)arg;
+    for (;;) {
+        pthread_mutex_lock(&g_http.mtx);
+        int running = g_http.running;
+        pthread_mutex_unlock(&g_http.mtx);
+        if (!running) {
+            break;
+        }
+
+        add_pending();
+
+        int still = 0;
+        CURLMcode mrc = curl_multi_perform(g_http.multi, &still);
+        if (mrc != CURLM_OK) {
+            log_error("http: multi_perform: %s", curl_multi_strerror(mrc));
+        }
+        reap_done();
+
+        // sleeps until socket activity, a timeout, or curl_multi_wakeup()
+        curl_multi_poll(g_http.multi, NULL, 0, HTTP_POLL_MS, NULL);
+    }
+
+    abort_all();
+    return NULL;
+}
+
+int http_engine_start(int max_connections)
+{
+    pthread_mutex_lock(&g_http.mtx);
+    if (g_http.running) {
+        pthread_mutex_unlock(&g_http.mtx);
+        return 0;
+    }
+
+    g_http.multi = curl_multi_init();
+    if (!g_http.multi) {
+        pthread_mutex_unlock(&g_http.mtx);
+        return -1;
+    }
+    if (max_connections > 0) {
+        curl_multi_setopt(g_http.multi, CURLMOPT_MAX_TOTAL_CONNECTIONS, (long)max_connections);
+    }
+    // let HTTP/2 transfers share one connection when http2 is enabled
+    curl_multi_setopt(g_http.multi, CURLMOPT_PIPELINING, (long)CURLPIPE_MULTIPLEX);
+
+    g_http.running = 1;
+    if (pthread_create(&g_http.thread, NULL, engine_main, NULL) != 0) {
+        g_http.running = 0;
+        curl_multi_cleanup(g_http.multi);
+        g_http.multi = NULL;
+        pthread_mutex_unlock(&g_http.mtx);
+        return -1;
+    }
+    pthread_mutex_unlock(&g_http.mtx);
+
+    log_info("http: engine started (max_connections=%d)", max_connections);
+    return 0;
+}
+
+void http_engine_stop(void)
+{
+    pthread_mutex_lock(&g_http.mtx);
+    if (!g_http.running) {
+        pthread_mutex_unlock(&g_http.mtx);
+        return;
+    }
+    g_http.running = 0;
+    pthread_mutex_unlock(&g_http.mtx);
+
+    curl_multi_wakeup(g_http.multi);
+    pthread_join(g_http.thread, NULL);
+
+    curl_multi_cleanup(g_http.multi);
+    g_http.multi = NULL;
+    log_info("http: engine stopped");
+}
+
+int http_engine_drain(double max_sec)
+{
+    struct timespec tick = {.tv_sec = 0, .tv_nsec = HTTP_DRAIN_TICK_MS * 1000000L};
+    int left = http_inflight();
+    for (double waited = 0; left > 0 && waited < max_sec; waited += HTTP_DRAIN_TICK_MS / 1000.0) {
+        nanosleep(&tick, NULL);
+        left = http_inflight();
+    }
+    return left;
+}
+
+bool http_engine_running(void)
+{
+    pthread_mutex_lock(&g_http.mtx);
+    bool r = g_http.running != 0;
+    pthread_mutex_unlock(&g_http.mtx);
+    return r;
+}
+
+int http_submit(CURL *easy, http_done_cb cb, void *ud)
+{
+    if (!easy || !cb) {
+        return -1;
+    }
+
+    HttpXfer *x = calloc(1, sizeof(*x));
+    if (!x) {
+        return -1;
+    }
+    x->easy = easy;
+    x->cb = cb;
+    x->ud = ud;
+
+    pthread_mutex_lock(&g_http.mtx);
+    if (!g_http.running) {
+        pthread_mutex_unlock(&g_http.mtx);
+        free(x);
+        return -1;
+    }
+    x->next = g_http.pending;
+    g_http.pending = x;
+    atomic_fetch_add_explicit(&g_http.inflight, 1, memory_order_relaxed);
+    // wake the loop while still holding mtx so stop cannot free the multi
+    curl_multi_wakeup(g_http.multi);
+    pthread_mutex_unlock(&g_http.mtx);
+    return 0;
+}
+
+// rendezvous for a blocking http_perform() caller
+typedef struct {
+    pthread_mutex_t mtx;
+    pthread_cond_t cond;
+    int done;
+    CURLcode rc;
+} SyncWait;
+
+static void sync_done(CURL *easy, CURLcode rc, void *ud)
+{
+    (void)easy;
+    SyncWait *w = (SyncWait *)ud;
+    pthread_mutex_lock(&w->mtx);
+    w->rc = rc;
+    w->done = 1;
+    pthread_cond_signal(&w->cond);
+    pthread_mutex_unlock(&w->mtx);
+}
+
+CURLcode http_perform(CURL *easy)
+{
+    SyncWait w = {.done = 0, .rc = CURLE_OK};
+    pthread_mutex_init(&w.mtx, NULL);
+    pthread_cond_init(&w.cond, NULL);
+
+    CURLcode rc;
+    if (http_submit(easy, sync_done, &w) == 0) {
+        pthread_mutex_lock(&w.mtx);
+        while (!w.done) {
+            pthread_cond_wait(&w.cond, &w.mtx);
+        }
+        rc = w.rc;
+        pthread_mutex_unlock(&w.mtx);
+    } else {
+        rc = curl_easy_perform(easy);
+    }
+
+    pthread_cond_destroy(&w.cond);
+    pthread_mutex_destroy(&w.mtx);
+    return rc;
+}
+
+int http_inflight(void)
+{
+    return atomic_load_explicit(&g_http.inflight, memory_order_relaxed);
+}
+
+// shared caches
+
+static struct {
+    CURLSH *sh;
+    bool http2;
+    pthread_mutex_t locks[CURL_LOCK_DATA_LAST];
+} g_share;
+
+static void share_lock(CURL *easy, curl_lock_data data, curl_lock_access access, void *ud)
+{
+    (void)easy; (void)access; (void)ud;
+    if ((unsigned)data < CURL_LOCK_DATA_LAST) {
+        pthread_mutex_lock(&g_share.locks[data]);
+    }
+}
+
+static void share_unlock(CURL *easy, curl_lock_data data, void *ud)
+{
+    (void)easy; (void)ud;
+    if ((unsigned)data < CURL_LOCK_DATA_LAST) {
+        pthread_mutex_unlock(&g_share.locks[data]);
+    }
+}
+
+int http_share_init(bool http2)
+{
+    if (g_share.sh) {
+        return 0;
+    }
+
+    CURLSH *sh = curl_share_init();
+    if (!sh) {
+        return -1;
+    }
+    for (int i = 0; i < CURL_LOCK_DATA_LAST; i++) {
+        pthread_mutex_init(&g_share.locks[i], NULL);
+    }
+
+    CURLSHcode src = CURLSHE_OK;
+    if (src == CURLSHE_OK) {
+        src = curl_share_setopt(sh, CURLSHOPT_LOCKFUNC, share_lock);
+    }
+    if (src == CURLSHE_OK) {
+        src = curl_share_setopt(sh, CURLSHOPT_UNLOCKFUNC, share_unlock);
+    }
+    if (src == CURLSHE_OK) {
+        src = curl_share_setopt(sh, CURLSHOPT_SHARE, CURL_LOCK_DATA_DNS);
+    }
+    if (src == CURLSHE_OK) {
+        src = curl_share_setopt(sh, CURLSHOPT_SHARE, CURL_LOCK_DATA_SSL_SESSION);
+    }
+    if (src == CURLSHE_OK) {
+        src = curl_share_setopt(sh, CURLSHOPT_SHARE, CURL_LOCK_DATA_CONNECT);
+    }
+    if (src != CURLSHE_OK) {
+        log_error("http: share setup: %s", curl_share_strerror(src));
+        curl_share_cleanup(sh);
+        for (int i = 0; i < CURL_LOCK_DATA_LAST; i++) {
+            pthread_mutex_destroy(&g_share.locks[i]);
+        }
+        return -1;
+    }
+
+    g_share.sh = sh;
+    g_share.http2 = http2;
+    log_info("http: shared dns/tls/connection cache enabled (http2=%s)", http2 ? "on" : "off");
+    return 0;
+}
+
+void http_share_cleanup(void)
+{
+    if (!g_share.sh) {
+        return;
+    }
+    CURLSHcode src = curl_share_cleanup(g_share.sh);
+    if (src != CURLSHE_OK) {
+        // a handle still holds it; leaking beats freeing it under their feet
+        log_warn("http: share cleanup: %s", curl_share_strerror(src));
+        return;
+    }
+    g_share.sh = NULL;
+    g_share.http2 = false;
+    for (int i = 0; i < CURL_LOCK_DATA_LAST; i++) {
+        pthread_mutex_destroy(&g_share.locks[i]);
+    }
+}
+
+void http_easy_apply(CURL *easy)
+{
+    if (!easy) {
+        return;
+    }
+    // keep idle pooled connections alive so the first send after a lull
+    // does not pay for a fresh handshake
+    curl_easy_setopt(easy, CURLOPT_TCP_KEEPALIVE, 1L);
+    if (!g_share.sh) {
+        return;
+    }
+    curl_easy_setopt(easy, CURLOPT_SHARE, g_share.sh);
+    if (g_share.http2) {
+        curl_easy_setopt(easy, CURLOPT_HTTP_VERSION, (long)CURL_HTTP_VERSION_2TLS);
+        curl_easy_setopt(easy, CURLOPT_PIPEWAIT, 1L);
+    }
+}
@@ -0,0 +1,67 @@
+#pragma once
+
+#include <curl/curl.h>
+#include <stdbool.h>
+
+/* process-wide event-driven HTTP engine built on curl_multi
+ * a single event-loop thread drives every transfer, so all bot and LLM
+ * handles share one connection cache and any number of requests can be in
+ * flight at once. callers either block on http_perform() or hand a prepared
+ * easy handle to http_submit() and get a completion callback.
+ */
+
+// completion callback; runs on the engine thread and must not block
+typedef void (*http_done_cb)(CURL *easy, CURLcode rc, void *ud);
+
+/* start the engine thread
+ * max_connections: cap on concurrent connections (0 = libcurl default)
+ * returns 0 on success, -1 on error
+ */
+int http_engine_start(int max_connections);
+
+/* stop the engine thread; transfers still in flight are completed with
+ * CURLE_ABORTED_BY_CALLBACK. safe to call if the engine was never started.
+ */
+void http_engine_stop(void);
+
+/* wait up to max_sec for every submitted transfer to finish, including
+ * any submitted from completion callbacks meanwhile, so a following
+ * http_engine_stop() aborts only what is left. returns the number still
+ * in flight (0 once drained)
+ */
+int http_engine_drain(double max_sec);
+
+// returns true if the engine thread is running
+bool http_engine_running(void);
+
+/* submit a fully prepared easy handle; cb is invoked exactly once on the
+ * engine thread when the transfer finishes. the caller must not touch the
+ * handle until then. returns 0 if queued, -1 if the engine is not running.
+ */
+int http_submit(CURL *easy, http_done_cb cb, void *ud);
+
+/* perform a prepared easy handle and block until it completes
+ * routes through the engine when it is running, otherwise falls back to
+ * curl_easy_perform on the calling thread
+ */
+CURLcode http_perform(CURL *easy);
+
+// number of transfers currently submitted or in flight (thread-safe)
+int http_inflight(void);
+
+/* process-wide CURLSH holding the DNS, TLS session and connection caches
+ * every easy handle that goes through http_easy_apply() joins it, so one
+ * handshake to api.telegram.org is reused by all workers instead of each
+ * paying its own. http2: prefer HTTP/2 over TLS and multiplex requests on
+ * an existing connection rather than opening another.
+ * call after curl_global_init(); returns 0 on success, -1 on error
+ */
+int http_share_init(bool http2);
+
+// release the share; every handle using it must be cleaned up first
+void http_share_cleanup(void);
+
+/* attach the share and protocol preferences to an easy handle
+ * curl_easy_reset() clears these, so call it after every reset
+ */
+void http_easy_apply(CURL *easy);
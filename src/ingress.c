@@ -0,0 +1,146 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "ingress.h"
+
+#include <errno.h>
+#include <sched.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+/* cell sequence numbers (Vyukov bounded queue):
+ *   seq == pos          free, the producer claiming pos may write it
+ *   seq == pos + 1      published, the consumer at pos may read it
+ *   seq == pos + cap    consumed, free again for the producer one lap later
+ */
+
+int ingress_init(Ingress *r, size_t capacity)
+{
+    size_t cap = 2;
+    while (cap < capacity) {
+        cap <<= 1;
+    }
+
+    r->cells = calloc(cap, sizeof(*r->cells));
+    if (!r->cells) {
+        return -1;
+    }
+    for (size_t i = 0; i < cap; i++) {
+        atomic_init(&r->cells[i].seq, i);
+    }
+    r->mask = cap - 1;
+    atomic_init(&r->head, 0);
+    atomic_init(&r->tail, 0);
+    atomic_init(&r->closed, false);
+    if (sem_init(&r->ready, 0, 0) != 0) {
+        free(r->cells);
+        r->cells = NULL;
+        return -1;
+    }
+    return 0;
+}
+
+void ingress_destroy(Ingress *r)
+{
+    if (!r->cells) {
+        return;
+    }
+    sem_destroy(&r->ready);
+    free(r->cells);
+    r->cells = NULL;
+}
+
+int ingress_push(Ingress *r, void *item)
+{
+    if (!item || atomic_load_explicit(&r->closed, memory_order_acquire)) {
+        return -1;
+    }
+
+    size_t pos = atomic_load_explicit(&r->tail, memory_order_relaxed);
+    IngressCell *cell;
+    for (;;) {
+        cell = &r->cells[pos & r->mask];
+        size_t seq = atomic_load_explicit(&cell->seq, memory_order_acquire);
+        intptr_t diff = (intptr_t)seq - (intptr_t)pos;
+        if (diff == 0) {
+            if (atomic_compare_exchange_weak_explicit(&r->tail, &pos, pos + 1,
+                                                      memory_order_relaxed,
+                                                      memory_order_relaxed)) {
+                break;
+            }
+        } else if (diff < 0) {
+            return -1; // full: the consumer has not freed this cell yet
+        } else {
+            pos = atomic_load_explicit(&r->tail, memory_order_relaxed);
+        }
+    }
+
+    cell->item = item;
+    atomic_store_explicit(&cell->seq, pos + 1, memory_order_release);
+    sem_post(&r->ready);
+    return 0;
+}
+
+void *ingress_try_pop(Ingress *r)
+{
+    size_t pos = atomic_load_explicit(&r->head, memory_order_relaxed);
+    IngressCell *cell;
+    for (;;) {
+        cell = &r->cells[pos & r->mask];
+        size_t seq = atomic_load_explicit(&cell->seq, memory_order_acquire);
+        intptr_t diff = (intptr_t)seq - (intptr_t)(pos + 1);
+        if (diff == 0) {
+            if (atomic_compare_exchange_weak_explicit(&r->head, &pos, pos + 1,
+                                                      memory_order_relaxed,
+                                                      memory_order_relaxed)) {
+                break;
+            }
+        } else if (diff < 0) {
+            return NULL; // empty
+        } else {
+            pos = atomic_load_explicit(&r->head, memory_order_relaxed);
+        }
+    }
+
+    void *item = cell->item;
+    cell->item = NULL;
+    atomic_store_explicit(&cell->seq, pos + r->mask + 1, memory_order_release);
+    return item;
+}
+
+void *ingress_pop(Ingress *r)
+{
+    for (;;) {
+        while (sem_wait(&r->ready) != 0 && errno == EINTR) {
+        }
+        for (;;) {
+            void *item = ingress_try_pop(r);
+            if (item) {
+                return item;
+            }
+            if (ingress_depth(r) == 0) {
+                break;
+            }
+            // a producer that claimed an earlier cell has not published yet;
+            // our token belongs to a later cell, so wait for the gap to fill
+            sched_yield();
+        }
+        if (atomic_load_explicit(&r->closed, memory_order_acquire)) {
+            // pass the wakeup on so every other consumer sees the close too
+            sem_post(&r->ready);
+            return NULL;
+        }
+    }
+}
+
+void ingress_close(Ingress *r)
+{
+    atomic_store_explicit(&r->closed, true, memory_order_release);
+    sem_post(&r->ready);
+}
+
+size_t ingress_depth(Ingress *r)
+{
+    size_t tail = atomic_load_explicit(&r->tail, memory_order_relaxed);
+    size_t head = atomic_load_explicit(&r->head, memory_order_relaxed);
+    return tail >= head ? tail - head : 0;
+}
@@ -0,0 +1,52 @@
+#pragma once
+
+#include <semaphore.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+/* bounded lock-free MPSC ring of opaque pointers
+ * producers (libmicrohttpd threads) never take a lock: a push is one CAS on
+ * the tail plus a sem_post, which only enters the kernel when a consumer is
+ * asleep. consumers block in ingress_pop(); more than one consumer is safe
+ * but gives up FIFO order between them.
+ */
+
+typedef struct {
+    _Atomic size_t seq;
+    void *item;
+} IngressCell;
+
+typedef struct {
+    IngressCell *cells;
+    size_t mask;
+    _Atomic size_t head; // next cell to consume
+    _Atomic size_t tail; // next cell to produce
+    _Atomic bool closed;
+    sem_t ready;         // one token per published item (plus close wakeups)
+} Ingress;
+
+/* allocate a ring; capacity is rounded up to a power of two (minimum 2)
+ * returns 0 on success, -1 on error
+ */
+int ingress_init(Ingress *r, size_t capacity);
+
+// free the ring; items still queued are not touched
+void ingress_destroy(Ingress *r);
+
+// enqueue item (non-NULL); returns 0, or -1 if the ring is full or closed
+int ingress_push(Ingress *r, void *item);
+
+// dequeue without blocking; returns NULL if the ring is empty
+void *ingress_try_pop(Ingress *r);
+
+/* block until an item is available; after ingress_close() the remaining
+ * items are still handed out, then NULL is returned to every consumer
+ */
+void *ingress_pop(Ingress *r);
+
+// refuse further pushes and wake every blocked consumer
+void ingress_close(Ingress *r);
+
+// approximate number of queued items
+size_t ingress_depth(Ingress *r);
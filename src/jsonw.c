@@ -0,0 +1,272 @@
+#include "jsonw.h"
+#include "simd.h"
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// first allocation; most Telegram bodies fit without growing
+#define JSONW_INITIAL_CAP 1024
+
+void jsonw_init(JsonW *w)
+{
+    if (w) {
+        memset(w, 0, sizeof(*w));
+    }
+}
+
+void jsonw_free(JsonW *w)
+{
+    if (w) {
+        free(w->buf);
+        memset(w, 0, sizeof(*w));
+    }
+}
+
+void jsonw_reset(JsonW *w)
+{
+    w->len = 0;
+    w->depth = 0;
+    w->has_items = 0;
+    w->after_key = false;
+    w->err = false;
+}
+
+int jsonw_reserve(JsonW *w, size_t n)
+{
+    if (w->err) {
+        return -1;
+    }
+    // +1 keeps room for the terminator jsonw_finish() adds
+    if (n > SIZE_MAX - w->len - 1) {
+        w->err = true;
+        return -1;
+    }
+    size_t need = w->len + n + 1;
+    if (need <= w->cap) {
+        return 0;
+    }
+    size_t new_cap = w->cap ? w->cap : JSONW_INITIAL_CAP;
+    while (new_cap < need) {
+        if (new_cap > SIZE_MAX / 2) {
+            w->err = true;
+            return -1;
+        }
+        new_cap *= 2;
+    }
+    char *tmp = realloc(w->buf, new_cap);
+    if (!tmp) {
+        w->err = true;
+        return -1;
+    }
+    w->buf = tmp;
+    w->cap = new_cap;
+    return 0;
+}
+
+static void put(JsonW *w, const char *s, size_t n)
+{
+    if (jsonw_reserve(w, n) == 0) {
+        memcpy(w->buf + w->len, s, n);
+        w->len += n;
+    }
+}
+
+static void put_c(JsonW *w, char c)
+{
+    if (jsonw_reserve(w, 1) == 0) {
+        w->buf[w->len++] = c;
+    }
+}
+
+// emit the separator that precedes a value (or key) at the current level
+static void before_value(JsonW *w)
+{
+    if (w->after_key) {
+        w->after_key = false;
+        return;
+    }
+    uint32_t bit = 1u << w->depth;
+    if (w->has_items & bit) {
+        put_c(w, ',');
+    }
+    w->has_items |= bit;
+}
+
+static void open_level(JsonW *w, char c)
+{
+    before_value(w);
+    if (w->depth + 1 >= JSONW_MAX_DEPTH) {
+        w->err = true;
+        return;
+    }
+    put_c(w, c);
+    w->depth++;
+    w->has_items &= ~(1u << w->depth);
+}
+
+static void close_level(JsonW *w, char c)
+{
+    if (w->depth == 0 || w->after_key) {
+        w->err = true;
+        return;
+    }
+    w->depth--;
+    put_c(w, c);
+}
+
+void jsonw_obj_begin(JsonW *w)
+{
+    open_level(w, '{');
+}
+
+void jsonw_obj_end(JsonW *w)
+{
+    close_level(w, '}');
+}
+
+void jsonw_arr_begin(JsonW *w)
+{
+    open_level(w, '[');
+}
+
+void jsonw_arr_end(JsonW *w)
+{
+    close_level(w, ']');
+}
+
+// escape like cJSON: quote, backslash and control characters only
+static void put_escaped(JsonW *w, const char *s, size_t n)
+{
+    static const char hex[] = "0123456789abcdef";
+
+    // worst case isn't worth reserving; typical text needs only the quotes
+    if (jsonw_reserve(w, n + 2) != 0) {
+        return;
+    }
+    w->buf[w->len++] = '"';
+
+    size_t run = 0; // start of the pending run of bytes that need no escape
+    for (size_t i = 0; i < n; i++) {
+        // replies are mostly plain text; find the next byte to escape a vector at a time
+        i += simd_json_plain(s + i, n - i);
+        if (i == n) {
+            break;
+        }
+        unsigned char c = (unsigned char)s[i];
+        put(w, s + run, i - run);
+        run = i + 1;
+        switch (c) {
+        case '"': put(w, "\\\"", 2); break;
+        case '\\': put(w, "\\\\", 2); break;
+        case '\b': put(w, "\\b", 2); break;
+        case '\f': put(w, "\\f", 2); break;
+        case '\n': put(w, "\\n", 2); break;
+        case '\r': put(w, "\\r", 2); break;
+        case '\t': put(w, "\\t", 2); break;
+        default: {
+            char u[6] = {'\\', 'u', '0', '0', hex[c >> 4], hex[c & 0xF]};
+            put(w, u, sizeof(u));
+            break;
+        }
+        }
+    }
+    put(w, s + run, n - run);
+    put_c(w, '"');
+}
+
+void jsonw_key(JsonW *w, const char *key)
+{
+    if (w->after_key) {
+        w->err = true;
+        return;
+    }
+    before_value(w);
+    put_escaped(w, key, strlen(key));
+    put_c(w, ':');
+    w->after_key = true;
+}
+
+void jsonw_strn(JsonW *w, const char *s, size_t n)
+{
+    before_value(w);
+    put_escaped(w, s ? s : "", s ? n : 0);
+}
+
+void jsonw_str(JsonW *w, const char *s)
+{
+    jsonw_strn(w, s, s ? strlen(s) : 0);
+}
+
+void jsonw_int(JsonW *w, int64_t v)
+{
+    char tmp[24];
+    int n = snprintf(tmp, sizeof(tmp), "%" PRId64, v);
+    before_value(w);
+    put(w, tmp, (size_t)n);
+}
+
+void jsonw_num(JsonW *w, double v)
+{
+    char tmp[32];
+    int n;
+    if (v != v || v - v != 0.0) {
+        // JSON has no NaN/Inf; cJSON prints null as well
+        n = snprintf(tmp, sizeof(tmp), "null");
+    } else {
+        // shortest of 15/17 significant digits that round-trips, as cJSON does
+        n = snprintf(tmp, sizeof(tmp), "%1.15g", v);
+        if (strtod(tmp, NULL) != v) {
+            n = snprintf(tmp, sizeof(tmp), "%1.17g", v);
+        }
+    }
+    before_value(w);
+    put(w, tmp, (size_t)n);
+}
+
+void jsonw_bool(JsonW *w, bool v)
+{
+    before_value(w);
+    if (v) {
+        put(w, "true", 4);
+    } else {
+        put(w, "false", 5);
+    }
+}
+
+void jsonw_kv_str(JsonW *w, const char *key, const char *s)
+{
+    jsonw_key(w, key);
+    jsonw_str(w, s);
+}
+
+void jsonw_kv_int(JsonW *w, const char *key, int64_t v)
+{
+    jsonw_key(w, key);
+    jsonw_int(w, v);
+}
+
+void jsonw_kv_num(JsonW *w, const char *key, double v)
+{
+    jsonw_key(w, key);
+    jsonw_num(w, v);
+}
+
+void jsonw_kv_bool(JsonW *w, const char *key, bool v)
+{
+    jsonw_key(w, key);
+    jsonw_bool(w, v);
+}
+
+const char *jsonw_finish(JsonW *w, size_t *len_out)
+{
+    if (w->err || w->depth != 0 || w->after_key || jsonw_reserve(w, 0) != 0) {
+        return NULL;
+    }
+    w->buf[w->len] = '\0';
+    if (len_out) {
+        *len_out = w->len;
+    }
+    return w->buf;
+}
@@ -0,0 +1,63 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/* minimal streaming JSON writer for outbound request bodies
+ * values are escaped straight into one growable buffer that the owner keeps
+ * between requests, so a warmed-up writer encodes a body without touching
+ * the allocator. commas are tracked per nesting level; errors (allocation
+ * failure, nesting too deep, unbalanced end) are sticky and reported once
+ * by jsonw_finish().
+ */
+
+#define JSONW_MAX_DEPTH 32
+
+typedef struct {
+    char *buf;
+    size_t len;
+    size_t cap;
+    int depth;
+    uint32_t has_items; // bit d set once level d holds a value
+    bool after_key;     // a key was written and awaits its value
+    bool err;
+} JsonW;
+
+// zero-initialised writers are also valid
+void jsonw_init(JsonW *w);
+
+// release the buffer
+void jsonw_free(JsonW *w);
+
+// start a new document, keeping the allocated buffer
+void jsonw_reset(JsonW *w);
+
+// make room for at least n more bytes up front; returns 0 or -1
+int jsonw_reserve(JsonW *w, size_t n);
+
+void jsonw_obj_begin(JsonW *w);
+void jsonw_obj_end(JsonW *w);
+void jsonw_arr_begin(JsonW *w);
+void jsonw_arr_end(JsonW *w);
+
+// object key; the next call must write its value
+void jsonw_key(JsonW *w, const char *key);
+
+void jsonw_str(JsonW *w, const char *s);
+void jsonw_strn(JsonW *w, const char *s, size_t n);
+void jsonw_int(JsonW *w, int64_t v);
+void jsonw_num(JsonW *w, double v);
+void jsonw_bool(JsonW *w, bool v);
+
+// key/value shorthands
+void jsonw_kv_str(JsonW *w, const char *key, const char *s);
+void jsonw_kv_int(JsonW *w, const char *key, int64_t v);
+void jsonw_kv_num(JsonW *w, const char *key, double v);
+void jsonw_kv_bool(JsonW *w, const char *key, bool v);
+
+/* NUL-terminate and return the encoded document (owned by the writer, valid
+ * until the next reset), or NULL if any error occurred or it is unbalanced
+ * *len_out (optional) receives the length without the terminator
+ */
+const char *jsonw_finish(JsonW *w, size_t *len_out);
@@ -2,14 +2,21 @@
 
 #include "llm.h"
 #include "cJSON.h"
+#include "http.h"
+#include "jsonw.h"
+#include "llmpool.h"
 #include "logger.h"
+#include "respbuf.h"
+#include "simd.h"
 
 #include <curl/curl.h>
+#include <pthread.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <strings.h>
+#include <time.h>
 
 // maximum response body from LM Studio (256 KiB)
 #define LLM_RESPONSE_MAX (256 * 1024)
@@ -20,48 +27,11 @@ struct LlmHandle {
     char url[512];
     char model[128];
     volatile sig_atomic_t *abort_flag;
+    int direct;   // bypass the backend pool
+    JsonW jw;     // request body encoder, reused across calls
+    RespBuf resp; // response body, retained across calls
 };
 
-typedef struct {
-    char *data;
-    size_t len;
-    size_t cap;
-} LlmBuffer;
-
-static size_t llm_write_cb(char *ptr, size_t size, size_t nmemb, void *userdata)
-{
-    LlmBuffer *buf = (LlmBuffer *)userdata;
-    if (nmemb != 0 && size > SIZE_MAX / nmemb) {
-        return 0;
-    }
-    size_t bytes = size * nmemb;
-
-    if (buf->len + bytes + 1 > LLM_RESPONSE_MAX) {
-        return 0;
-    }
-
-    if (buf->len + bytes + 1 > buf->cap) {
-        size_t new_cap = (buf->cap == 0) ? 4096 : buf->cap * 2;
-        while (new_cap < buf->len + bytes + 1) {
-            if (new_cap > SIZE_MAX / 2) {
-                return 0;
-            }
-            new_cap *= 2;
-        }
-        char *tmp = realloc(buf->data, new_cap);
-        if (!tmp) {
-            return 0;
-        }
-        buf->data = tmp;
-        buf->cap = new_cap;
-    }
-
-    memcpy(buf->data + buf->len, ptr, bytes);
-    buf->len += bytes;
-    buf->data[buf->len] = '\0';
-    return bytes;
-}
-
 static int llm_abort_cb(void *clientp, curl_off_t dltotal, curl_off_t dlnow,
                         curl_off_t ultotal, curl_off_t ulnow)
 {
@@ -89,6 +59,7 @@ LlmHandle *llm_init(const char *endpoint, const char *model)
         free(llm);
         return NULL;
     }
+    http_easy_apply(llm->curl);
 
     snprintf(llm->url, sizeof(llm->url), "%s/v1/chat/completions", endpoint);
 
@@ -96,6 +67,7 @@ LlmHandle *llm_init(const char *endpoint, const char *model)
         snprintf(llm->model, sizeof(llm->model), "%s", model);
     }
 
+    respbuf_init(&llm->resp, LLM_RESPONSE_MAX, "llm");
     llm->headers = curl_slist_append(NULL, "Content-Type: application/json");
     if (!llm->headers) {
         curl_easy_cleanup(llm->curl);
@@ -117,6 +89,8 @@ void llm_cleanup(LlmHandle *llm)
     if (llm->curl) {
         curl_easy_cleanup(llm->curl);
     }
+    jsonw_free(&llm->jw);
+    respbuf_free(&llm->resp);
     free(llm);
 }
 
@@ -127,6 +101,20 @@ void llm_set_abort_flag(LlmHandle *llm, volatile sig_atomic_t *flag)
     }
 }
 
+void llm_set_direct(LlmHandle *llm, int direct)
+{
+    if (llm) {
+        llm->direct = direct;
+    }
+}
+
+void llm_set_model(LlmHandle *llm, const char *model)
+{
+    if (llm) {
+        snprintf(llm->model, sizeof(llm->model), "%s", model ? model : "");
+    }
+}
+
 // strip all <think>...</think> blocks (and self-closing <think/>) from text in-place.
 // handles nested occurrences, missing close tags, and leading/trailing whitespace.
 size_t llm_strip_think_tags(char *text)
@@ -141,9 +129,20 @@ size_t llm_strip_think_tags(char *text)
     const char *end = text + len;
 
     while (src < end) {
-        // look for <think at current position (case-insensitive)
-        if (*src == '<' && (size_t)(end - src) >= 7 &&
-            strncasecmp(src, "<think", 6) == 0) {
+        // text up to the next '<' is kept as is; memchr skips it word-wide
+        const char *lt = memchr(src, '<', (size_t)(end - src));
+        size_t run = (size_t)((lt ? lt : end) - src);
+        if (dst != src) {
+            memmove(dst, src, run);
+        }
+        dst += run;
+        src += run;
+        if (!lt) {
+            break;
+        }
+
+        // <think at current position (case-insensitive)
+        if ((size_t)(end - src) >= 7 && strncasecmp(src, "<think", 6) == 0) {
 
             const char *after_tag = src + 6;
 
@@ -162,19 +161,17 @@ size_t llm_strip_think_tags(char *text)
                 continue;
             }
 
-            // opening <think> - find matching </think>
+            // opening <think> - find matching </think>, one '<' at a time
             if (after_tag < end && *after_tag == '>') {
                 const char *close = after_tag + 1;
-                // search for </think>
-                while (close < end) {
-                    if (*close == '<' && (size_t)(end - close) >= 8 &&
-                        strncasecmp(close, "</think>", 8) == 0) {
+                while ((close = memchr(close, '<', (size_t)(end - close))) != NULL) {
+                    if ((size_t)(end - close) >= 8 && strncasecmp(close, "</think>", 8) == 0) {
                         src = close + 8;
                         break;
                     }
                     close++;
                 }
-                if (close >= end) {
+                if (!close) {
                     // no closing tag found - strip rest of string
                     src = end;
                 }
@@ -207,100 +204,128 @@ size_t llm_strip_think_tags(char *text)
     return (size_t)(dst - text);
 }
 
-int llm_chat(LlmHandle *llm, const char *system_prompt,
-             const char *user_msg, char *out_buf, size_t out_cap,
-             int max_tokens)
+static void encode_msg(JsonW *w, const char *role, const char *content)
 {
-    if (!llm || !user_msg || !out_buf || out_cap == 0) {
-        return -1;
-    }
+    jsonw_obj_begin(w);
+    jsonw_kv_str(w, "role", role);
+    jsonw_kv_str(w, "content", content);
+    jsonw_obj_end(w);
+}
 
-    // build the JSON request body
-    cJSON *root = cJSON_CreateObject();
-    if (!root) {
-        snprintf(out_buf, out_cap, "[llm error: alloc failed]");
-        return -1;
-    }
+const char *llm_encode_request(JsonW *w, const char *model,
+                               const char *system_prompt,
+                               const LlmMsg *history, int n_history,
+                               const char *user_msg, int max_tokens, int stream,
+                               size_t *len)
+{
+    jsonw_reset(w);
+    jsonw_obj_begin(w);
 
-    if (llm->model[0]) {
-        cJSON_AddStringToObject(root, "model", llm->model);
+    if (model && model[0]) {
+        jsonw_kv_str(w, "model", model);
     }
 
-    cJSON_AddNumberToObject(root, "max_tokens", max_tokens);
-    cJSON_AddNumberToObject(root, "temperature", 0.7);
-
-    cJSON *messages = cJSON_AddArrayToObject(root, "messages");
-    if (!messages) {
-        cJSON_Delete(root);
-        snprintf(out_buf, out_cap, "[llm error: alloc failed]");
-        return -1;
+    jsonw_kv_int(w, "max_tokens", max_tokens);
+    jsonw_kv_num(w, "temperature", 0.7);
+    if (stream) {
+        jsonw_kv_bool(w, "stream", true);
     }
 
+    jsonw_key(w, "messages");
+    jsonw_arr_begin(w);
+
     // optional system prompt
     if (system_prompt && system_prompt[0]) {
-        cJSON *sys_msg = cJSON_CreateObject();
-        cJSON_AddStringToObject(sys_msg, "role", "system");
-        cJSON_AddStringToObject(sys_msg, "content", system_prompt);
-        cJSON_AddItemToArray(messages, sys_msg);
+        encode_msg(w, "system", system_prompt);
     }
 
-    // user message
-    cJSON *usr_msg = cJSON_CreateObject();
-    cJSON_AddStringToObject(usr_msg, "role", "user");
-    cJSON_AddStringToObject(usr_msg, "content", user_msg);
-    cJSON_AddItemToArray(messages, usr_msg);
-
-    char *body = cJSON_PrintUnformatted(root);
-    cJSON_Delete(root);
-    if (!body) {
-        snprintf(out_buf, out_cap, "[llm error: JSON print failed]");
-        return -1;
+    // earlier turns, oldest first, exactly as stored so the prefix repeats
+    for (int i = 0; history && i < n_history; i++) {
+        encode_msg(w, history[i].role, history[i].content);
     }
 
-    // set up the curl request
-    LlmBuffer resp = {0};
+    // user message
+    encode_msg(w, "user", user_msg);
 
-    curl_easy_reset(llm->curl);
-    curl_easy_setopt(llm->curl, CURLOPT_URL, llm->url);
-    curl_easy_setopt(llm->curl, CURLOPT_HTTPHEADER, llm->headers);
-    curl_easy_setopt(llm->curl, CURLOPT_POSTFIELDS, body);
-    curl_easy_setopt(llm->curl, CURLOPT_WRITEFUNCTION, llm_write_cb);
-    curl_easy_setopt(llm->curl, CURLOPT_WRITEDATA, &resp);
-    curl_easy_setopt(llm->curl, CURLOPT_TIMEOUT, 120L);
-    curl_easy_setopt(llm->curl, CURLOPT_CONNECTTIMEOUT, 10L);
-    curl_easy_setopt(llm->curl, CURLOPT_NOSIGNAL, 1L);
+    jsonw_arr_end(w);
+    jsonw_obj_end(w);
+    return jsonw_finish(w, len);
+}
 
-    if (llm->abort_flag) {
-        curl_easy_setopt(llm->curl, CURLOPT_XFERINFOFUNCTION, llm_abort_cb);
-        curl_easy_setopt(llm->curl, CURLOPT_XFERINFODATA, (void *)llm->abort_flag);
-        curl_easy_setopt(llm->curl, CURLOPT_NOPROGRESS, 0L);
+// common request options for the blocking, streamed and submitted paths
+static void setup_easy(CURL *curl, struct curl_slist *headers, volatile sig_atomic_t *abort_flag,
+                       const char *url, const char *body, size_t body_len,
+                       curl_write_callback write_cb, void *wdata)
+{
+    curl_easy_reset(curl);
+    curl_easy_setopt(curl, CURLOPT_URL, url);
+    curl_easy_setopt(curl, CURLOPT_HTTPHEADER, headers);
+    curl_easy_setopt(curl, CURLOPT_POSTFIELDSIZE_LARGE, (curl_off_t)body_len);
+    curl_easy_setopt(curl, CURLOPT_POSTFIELDS, body);
+    curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, write_cb);
+    curl_easy_setopt(curl, CURLOPT_WRITEDATA, wdata);
+    curl_easy_setopt(curl, CURLOPT_TIMEOUT, 120L);
+    curl_easy_setopt(curl, CURLOPT_CONNECTTIMEOUT, 10L);
+    curl_easy_setopt(curl, CURLOPT_NOSIGNAL, 1L);
+    http_easy_apply(curl);
+
+    if (abort_flag) {
+        curl_easy_setopt(curl, CURLOPT_XFERINFOFUNCTION, llm_abort_cb);
+        curl_easy_setopt(curl, CURLOPT_XFERINFODATA, (void *)abort_flag);
+        curl_easy_setopt(curl, CURLOPT_NOPROGRESS, 0L);
     }
+}
 
-    CURLcode res = curl_easy_perform(llm->curl);
-    free(body);
+static void setup_request(LlmHandle *llm, const char *url, const char *body, size_t body_len,
+                          curl_write_callback write_cb, void *wdata)
+{
+    setup_easy(llm->curl, llm->headers, llm->abort_flag, url, body, body_len, write_cb, wdata);
+}
 
-    if (res != CURLE_OK) {
-        log_error("llm: curl error: %s", curl_easy_strerror(res));
-        free(resp.data);
-        snprintf(out_buf, out_cap, "[llm error: request failed]");
-        return -1;
-    }
+/* pool backend for the next attempt, or -1 to use the own endpoint
+ * (always, when direct)
+ */
+static int pick_backend(int avoid, const char **url, int direct, const char *own)
+{
+    int be = direct ? -1 : llm_pool_acquire(avoid);
+    const char *pool_url = be >= 0 ? llm_pool_url(be) : NULL;
+    *url = pool_url ? pool_url : own;
+    return be;
+}
 
-    if (!resp.data) {
-        snprintf(out_buf, out_cap, "[llm error: empty response]");
-        return -1;
+static int connect_failed(CURLcode rc)
+{
+    return rc == CURLE_COULDNT_CONNECT || rc == CURLE_COULDNT_RESOLVE_HOST;
+}
+
+/* report a finished attempt to the pool
+ * returns non-zero if the backend itself failed (unreachable or 5xx), so
+ * the request may be worth retrying elsewhere
+ */
+static int finish_attempt(CURL *curl, int be, CURLcode rc)
+{
+    long code = 0;
+    curl_off_t ttfb = 0;
+    curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &code);
+    curl_easy_getinfo(curl, CURLINFO_STARTTRANSFER_TIME_T, &ttfb);
+    // our own shutdown abort says nothing about the backend
+    int failed = rc != CURLE_ABORTED_BY_CALLBACK && (rc != CURLE_OK || code >= 500);
+    if (be >= 0) {
+        llm_pool_release(be, !failed, rc == CURLE_OK ? (double)ttfb / 1e6 : 0.0);
     }
+    return failed;
+}
 
-    // parse the response
-    cJSON *json = cJSON_Parse(resp.data);
-    free(resp.data);
+// extract choices[0].message.content from a non-streamed completion into out_buf
+static int parse_completion(const char *data, size_t len, char *out_buf, size_t out_cap)
+{
+    cJSON *json = cJSON_ParseWithLength(data, len);
     if (!json) {
         log_error("llm: failed to parse response JSON");
         snprintf(out_buf, out_cap, "[llm error: bad response]");
         return -1;
     }
 
-    // extract choices[0].message.content
     const cJSON *choices = cJSON_GetObjectItemCaseSensitive(json, "choices");
     const cJSON *first = cJSON_GetArrayItem(choices, 0);
     const cJSON *message = cJSON_GetObjectItemCaseSensitive(first, "message");
@@ -313,15 +338,734 @@ int llm_chat(LlmHandle *llm, const char *system_prompt,
         return -1;
     }
 
-    snprintf(out_buf, out_cap, "%s", content->valuestring);
-    cJSON_Delete(json);
-
-    // strip <think>...</think> reasoning blocks from the response
-    size_t stripped_len = llm_strip_think_tags(out_buf);
+    // strip <think>...</think> reasoning blocks before the reply is cut to
+    // out_cap: a long one would otherwise leave nothing but an open tag
+    size_t stripped_len = llm_strip_think_tags(content->valuestring);
     if (stripped_len == 0) {
+        cJSON_Delete(json);
         snprintf(out_buf, out_cap, "[llm error: empty after stripping think tags]");
         return -1;
     }
+    size_t n = stripped_len < out_cap ? stripped_len : simd_utf8_cut(content->valuestring, out_cap - 1);
+    memcpy(out_buf, content->valuestring, n);
+    out_buf[n] = '\0';
+    cJSON_Delete(json);
+    return 0;
+}
+
+// the reply in resp of a finished non-streamed request, or the error text
+static int completion_result(CURLcode res, const RespBuf *resp, char *out_buf, size_t out_cap)
+{
+    if (res != CURLE_OK) {
+        log_error("llm: curl error: %s", curl_easy_strerror(res));
+        snprintf(out_buf, out_cap, "[llm error: request failed]");
+        return -1;
+    }
+
+    if (resp->len == 0) {
+        snprintf(out_buf, out_cap, "[llm error: empty response]");
+        return -1;
+    }
+
+    return parse_completion(resp->data, resp->len, out_buf, out_cap);
+}
+
+int llm_chat(LlmHandle *llm, const char *system_prompt,
+             const char *user_msg, char *out_buf, size_t out_cap,
+             int max_tokens)
+{
+    return llm_chat_ctx(llm, system_prompt, NULL, 0, user_msg, out_buf, out_cap, max_tokens);
+}
+
+int llm_chat_ctx(LlmHandle *llm, const char *system_prompt,
+                 const LlmMsg *history, int n_history,
+                 const char *user_msg, char *out_buf, size_t out_cap,
+                 int max_tokens)
+{
+    if (!llm || !user_msg || !out_buf || out_cap == 0) {
+        return -1;
+    }
+
+    size_t body_len = 0;
+    const char *body = llm_encode_request(&llm->jw, llm->model, system_prompt, history,
+                                          n_history, user_msg, max_tokens, 0, &body_len);
+    if (!body) {
+        snprintf(out_buf, out_cap, "[llm error: JSON encode failed]");
+        return -1;
+    }
+
+    // one retry on another backend when the first could not answer at all
+    int attempts = !llm->direct && llm_pool_size() > 1 ? 2 : 1;
+    int be = -1;
+    CURLcode res;
+    for (int attempt = 0;; attempt++) {
+        const char *url;
+        be = pick_backend(be, &url, llm->direct, llm->url);
+        respbuf_begin(&llm->resp, llm->curl);
+        setup_request(llm, url, body, body_len, respbuf_write_cb, &llm->resp);
+        res = http_perform(llm->curl);
+        if (!finish_attempt(llm->curl, be, res) || attempt + 1 >= attempts) {
+            break;
+        }
+        log_warn("llm: backend failed (%s) - retrying on another", curl_easy_strerror(res));
+    }
+    return completion_result(res, &llm->resp, out_buf, out_cap);
+}
+
+// non-streamed chat on the engine
+
+/* a completion started by llm_chat_submit; it owns its easy handle,
+ * headers, body and response, so the LlmHandle is free again at once
+ */
+typedef struct {
+    CURL *curl;
+    struct curl_slist *headers;
+    volatile sig_atomic_t *abort_flag;
+    char url[512]; // the handle's own endpoint
+    int direct;
+    JsonW jw;
+    const char *body;
+    size_t body_len;
+    RespBuf resp;
+    int be;
+    int attempts; // left, this one included
+    char *out;
+    size_t out_cap;
+    llm_done_cb done;
+    void *ud;
+} LlmCall;
+
+static void call_free(LlmCall *c)
+{
+    if (c->curl) {
+        curl_easy_cleanup(c->curl);
+    }
+    curl_slist_free_all(c->headers);
+    jsonw_free(&c->jw);
+    respbuf_free(&c->resp);
+    free(c);
+}
+
+static void call_done(CURL *easy, CURLcode rc, void *ud);
+
+// hand c's next attempt to the engine; returns 0 if submitted
+static int call_attempt(LlmCall *c)
+{
+    const char *url;
+    c->be = pick_backend(c->be, &url, c->direct, c->url);
+    c->attempts--;
+    respbuf_begin(&c->resp, c->curl);
+    setup_easy(c->curl, c->headers, c->abort_flag, url, c->body, c->body_len, respbuf_write_cb,
+               &c->resp);
+    if (http_submit(c->curl, call_done, c) != 0) {
+        if (c->be >= 0) {
+            llm_pool_release(c->be, true, 0.0); // never reached the backend
+        }
+        return -1;
+    }
+    return 0;
+}
+
+// engine thread: retry elsewhere as llm_chat_ctx would, else report and free
+static void call_done(CURL *easy, CURLcode rc, void *ud)
+{
+    LlmCall *c = (LlmCall *)ud;
+    if (finish_attempt(easy, c->be, rc) && c->attempts > 0) {
+        log_warn("llm: backend failed (%s) - retrying on another", curl_easy_strerror(rc));
+        if (call_attempt(c) == 0) {
+            return;
+        }
+    }
+    int out = completion_result(rc, &c->resp, c->out, c->out_cap);
+    c->done(out, c->ud);
+    call_free(c);
+}
+
+int llm_chat_submit(LlmHandle *llm, const char *system_prompt,
+                    const LlmMsg *history, int n_history,
+                    const char *user_msg, char *out_buf, size_t out_cap,
+                    int max_tokens, llm_done_cb done, void *ud)
+{
+    if (!llm || !user_msg || !out_buf || out_cap == 0 || !done || !http_engine_running()) {
+        return -1;
+    }
+    LlmCall *c = calloc(1, sizeof(*c));
+    if (!c) {
+        return -1;
+    }
+    c->curl = curl_easy_init();
+    c->headers = curl_slist_append(NULL, "Content-Type: application/json");
+    c->abort_flag = llm->abort_flag;
+    snprintf(c->url, sizeof(c->url), "%s", llm->url);
+    c->direct = llm->direct;
+    c->be = -1;
+    c->attempts = !llm->direct && llm_pool_size() > 1 ? 2 : 1;
+    c->out = out_buf;
+    c->out_cap = out_cap;
+    c->done = done;
+    c->ud = ud;
+    respbuf_init(&c->resp, LLM_RESPONSE_MAX, "llm");
+    c->body = llm_encode_request(&c->jw, llm->model, system_prompt, history, n_history,
+                                 user_msg, max_tokens, 0, &c->body_len);
+    if (!c->curl || !c->headers || !c->body || call_attempt(c) != 0) {
+        call_free(c);
+        return -1;
+    }
+    return 0;
+}
+
+int llm_warm(LlmHandle *llm, const char *system_prompt)
+{
+    if (!llm) {
+        return -1;
+    }
+    // the reply is discarded; a thinking model's one token is usually "<think>"
+    size_t body_len = 0;
+    const char *body = llm_encode_request(&llm->jw, llm->model, system_prompt, NULL, 0, "hi", 1,
+                                          0, &body_len);
+    if (!body) {
+        return -1;
+    }
+    const char *url;
+    int be = pick_backend(-1, &url, llm->direct, llm->url);
+    respbuf_begin(&llm->resp, llm->curl);
+    setup_request(llm, url, body, body_len, respbuf_write_cb, &llm->resp);
+    CURLcode res = http_perform(llm->curl);
+    finish_attempt(llm->curl, be, res);
+    long code = 0;
+    curl_easy_getinfo(llm->curl, CURLINFO_RESPONSE_CODE, &code);
+    return res == CURLE_OK && code == 200 ? 0 : -1;
+}
+
+// streaming <think> filter
+
+enum { TF_TEXT = 0, TF_THINK = 1 };
+
+// tags recognised in text state; "<think/ />" mirrors llm_strip_think_tags
+static const char *const k_open_tags[] = {"<think>", "<think/>", "<think />", "<think/ />"};
+#define TF_OPEN_TAGS (sizeof(k_open_tags) / sizeof(k_open_tags[0]))
+static const char k_close_tag[] = "</think>";
+
+static int is_ws(char c)
+{
+    return c == ' ' || c == '\t' || c == '\n' || c == '\r';
+}
+
+static int ci_eq(char a, char b)
+{
+    if (a >= 'A' && a <= 'Z') {
+        a = (char)(a - 'A' + 'a');
+    }
+    return a == b;
+}
+
+typedef struct {
+    char *out;
+    size_t cap;
+    size_t len;
+} TfOut;
+
+static void tf_emit(LlmThinkFilter *f, TfOut *o, char c)
+{
+    if (!f->emitted) {
+        if (is_ws(c)) {
+            return;
+        }
+        f->emitted = 1;
+    }
+    if (o->len + 1 < o->cap) {
+        o->out[o->len++] = c;
+    }
+}
+
+// classify pend against the opening tags: -1 no match, 0 prefix, 1 open, 2 self-closing
+static int tf_classify(const LlmThinkFilter *f)
+{
+    int prefix = 0;
+    for (size_t t = 0; t < TF_OPEN_TAGS; t++) {
+        const char *tag = k_open_tags[t];
+        size_t tlen = strlen(tag);
+        if (f->pend_len > tlen) {
+            continue;
+        }
+        size_t i = 0;
+        while (i < f->pend_len && ci_eq(f->pend[i], tag[i])) {
+            i++;
+        }
+        if (i < f->pend_len) {
+            continue;
+        }
+        if (i == tlen) {
+            return t == 0 ? 1 : 2;
+        }
+        prefix = 1;
+    }
+    return prefix ? 0 : -1;
+}
+
+static void tf_byte(LlmThinkFilter *f, TfOut *o, char c)
+{
+    if (f->state == TF_THINK) {
+        if (ci_eq(c, k_close_tag[f->pend_len])) {
+            f->pend[f->pend_len++] = c;
+            if (f->pend_len == sizeof(k_close_tag) - 1) {
+                f->state = TF_TEXT;
+                f->pend_len = 0;
+            }
+        } else {
+            f->pend_len = 0;
+            if (c == '<') {
+                f->pend[f->pend_len++] = c;
+            }
+        }
+        return;
+    }
+
+    if (f->pend_len == 0) {
+        if (c == '<') {
+            f->pend[f->pend_len++] = c;
+        } else {
+            tf_emit(f, o, c);
+        }
+        return;
+    }
+
+    f->pend[f->pend_len++] = c;
+    switch (tf_classify(f)) {
+    case 0:
+        return;
+    case 1:
+        f->state = TF_THINK;
+        f->pend_len = 0;
+        return;
+    case 2:
+        f->pend_len = 0;
+        return;
+    default: {
+        // not a tag: the '<' is literal, rescan whatever followed it
+        char tail[sizeof(f->pend)];
+        size_t n = f->pend_len - 1;
+        memcpy(tail, f->pend + 1, n);
+        f->pend_len = 0;
+        tf_emit(f, o, '<');
+        for (size_t i = 0; i < n; i++) {
+            tf_byte(f, o, tail[i]);
+        }
+        return;
+    }
+    }
+}
+
+void llm_think_filter_init(LlmThinkFilter *f)
+{
+    if (f) {
+        memset(f, 0, sizeof(*f));
+        f->state = TF_TEXT;
+    }
+}
+
+size_t llm_think_filter_feed(LlmThinkFilter *f, const char *in, size_t len, char *out, size_t out_cap)
+{
+    if (!f || !out || out_cap == 0) {
+        return 0;
+    }
+    TfOut o = {.out = out, .cap = out_cap, .len = 0};
+    size_t i = 0;
+    while (in && i < len) {
+        // between tags only a '<' can change state: skip past reasoning, or
+        // copy visible text once the leading whitespace is gone
+        if (f->pend_len == 0 && (f->state == TF_THINK || f->emitted)) {
+            const char *lt = memchr(in + i, '<', len - i);
+            size_t run = (size_t)((lt ? lt : in + len) - (in + i));
+            if (f->state == TF_TEXT) {
+                size_t room = o.cap - 1 - o.len;
+                size_t n = run < room ? run : room;
+                memcpy(o.out + o.len, in + i, n);
+                o.len += n;
+            }
+            i += run;
+            if (!lt) {
+                break;
+            }
+        }
+        tf_byte(f, &o, in[i++]);
+    }
+    out[o.len] = '\0';
+    return o.len;
+}
+
+size_t llm_think_filter_finish(LlmThinkFilter *f, char *out, size_t out_cap)
+{
+    if (!f || !out || out_cap == 0) {
+        return 0;
+    }
+    TfOut o = {.out = out, .cap = out_cap, .len = 0};
+    if (f->state == TF_TEXT) {
+        // an incomplete tag at end of stream is literal text
+        for (size_t i = 0; i < f->pend_len; i++) {
+            tf_emit(f, &o, f->pend[i]);
+        }
+    }
+    // an unclosed <think> swallows the rest, as in llm_strip_think_tags
+    f->pend_len = 0;
+    out[o.len] = '\0';
+    return o.len;
+}
+
+// SSE parsing
+
+void llm_sse_init(LlmSse *p)
+{
+    if (p) {
+        memset(p, 0, sizeof(*p));
+        llm_think_filter_init(&p->think);
+    }
+}
+
+void llm_sse_free(LlmSse *p)
+{
+    if (p) {
+        free(p->line);
+        p->line = NULL;
+        p->line_len = 0;
+        p->line_cap = 0;
+    }
+}
+
+// handle one complete line (without the newline)
+static int sse_line(LlmSse *p, const char *line, size_t len, char *out, size_t out_cap, size_t *out_len)
+{
+    if (len > 0 && line[len - 1] == '\r') {
+        len--;
+    }
+    // blank lines end an event; comments and other fields are ignored
+    if (len < 5 || strncmp(line, "data:", 5) != 0) {
+        return 0;
+    }
+    line += 5;
+    len -= 5;
+    if (len > 0 && *line == ' ') {
+        line++;
+        len--;
+    }
+
+    p->events++;
+    if (len == 6 && memcmp(line, "[DONE]", 6) == 0) {
+        p->done = 1;
+        return 0;
+    }
+
+    cJSON *ev = cJSON_ParseWithLength(line, len);
+    if (!ev) {
+        log_error("llm: malformed stream event");
+        return -1;
+    }
+    if (cJSON_GetObjectItemCaseSensitive(ev, "error")) {
+        log_error("llm: error event in stream");
+        cJSON_Delete(ev);
+        return -1;
+    }
+
+    const cJSON *choices = cJSON_GetObjectItemCaseSensitive(ev, "choices");
+    const cJSON *first = cJSON_GetArrayItem(choices, 0);
+    const cJSON *delta = cJSON_GetObjectItemCaseSensitive(first, "delta");
+    const cJSON *content = cJSON_GetObjectItemCaseSensitive(delta, "content");
+    if (cJSON_IsString(content) && content->valuestring[0] && *out_len < out_cap) {
+        *out_len += llm_think_filter_feed(&p->think, content->valuestring,
+                                          strlen(content->valuestring),
+                                          out + *out_len, out_cap - *out_len);
+    }
+    cJSON_Delete(ev);
+    return 0;
+}
+
+int llm_sse_feed(LlmSse *p, const char *data, size_t len, char *out, size_t out_cap, size_t *out_len)
+{
+    if (!p || !out || out_cap == 0 || !out_len) {
+        return -1;
+    }
+
+    size_t i = 0;
+    while (i < len) {
+        const char *nl = memchr(data + i, '\n', len - i);
+        size_t seg = nl ? (size_t)(nl - (data + i)) : len - i;
 
+        if (p->line_len == 0 && nl) {
+            // whole line inside this chunk: no copy needed
+            if (sse_line(p, data + i, seg, out, out_cap, out_len) != 0) {
+                return -1;
+            }
+        } else {
+            if (p->line_len + seg + 1 > LLM_RESPONSE_MAX) {
+                log_error("llm: stream line too long");
+                return -1;
+            }
+            if (p->line_len + seg + 1 > p->line_cap) {
+                size_t new_cap = p->line_cap ? p->line_cap : 1024;
+                while (new_cap < p->line_len + seg + 1) {
+                    new_cap *= 2;
+                }
+                char *tmp = realloc(p->line, new_cap);
+                if (!tmp) {
+                    return -1;
+                }
+                p->line = tmp;
+                p->line_cap = new_cap;
+            }
+            memcpy(p->line + p->line_len, data + i, seg);
+            p->line_len += seg;
+            if (nl) {
+                int rc = sse_line(p, p->line, p->line_len, out, out_cap, out_len);
+                p->line_len = 0;
+                if (rc != 0) {
+                    return -1;
+                }
+            }
+        }
+        i += seg + (nl ? 1 : 0);
+    }
     return 0;
 }
+
+// streamed chat
+
+typedef struct {
+    pthread_mutex_t mtx;
+    pthread_cond_t cond;
+    LlmSse sse;
+    RespBuf *raw;   // body kept until the first event, for non-streaming servers
+    char *out;
+    size_t out_cap;
+    size_t out_len;
+    int failed;
+    int done;
+    CURLcode rc;
+    // progress reporting (caller's thread only)
+    llm_progress_cb cb;
+    void *ud;
+    double interval;
+    double last_report;
+    size_t reported;
+    char *snap;
+    int direct;  // write callback runs on the caller's thread
+} LlmStream;
+
+static double llm_now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+// hand the visible text so far to the caller if it grew and the interval elapsed
+static void stream_report(LlmStream *st)
+{
+    if (!st->cb) {
+        return;
+    }
+    double now = llm_now();
+    pthread_mutex_lock(&st->mtx);
+    size_t n = simd_utf8_cut(st->out, st->out_len);
+    // the first visible text goes out immediately, later updates are throttled
+    if (n <= st->reported || (st->reported > 0 && now - st->last_report < st->interval)) {
+        pthread_mutex_unlock(&st->mtx);
+        return;
+    }
+    memcpy(st->snap, st->out, n);
+    st->snap[n] = '\0';
+    pthread_mutex_unlock(&st->mtx);
+
+    st->reported = n;
+    st->last_report = now;
+    st->cb(st->ud, st->snap, n);
+}
+
+static size_t stream_write_cb(char *ptr, size_t size, size_t nmemb, void *userdata)
+{
+    LlmStream *st = (LlmStream *)userdata;
+    if (nmemb != 0 && size > SIZE_MAX / nmemb) {
+        return 0;
+    }
+    size_t bytes = size * nmemb;
+
+    pthread_mutex_lock(&st->mtx);
+    int had_text = st->out_len > 0;
+    if (st->sse.events == 0 && respbuf_append(st->raw, ptr, bytes) != 0) {
+        st->failed = 1;
+    }
+    if (!st->failed && llm_sse_feed(&st->sse, ptr, bytes, st->out, st->out_cap, &st->out_len) != 0) {
+        st->failed = 1;
+    }
+    if (st->sse.events > 0 && st->raw->len > 0) {
+        respbuf_begin(st->raw, NULL);
+    }
+    if (!had_text && st->out_len > 0) {
+        pthread_cond_signal(&st->cond);
+    }
+    int failed = st->failed;
+    pthread_mutex_unlock(&st->mtx);
+
+    if (failed) {
+        return 0;
+    }
+    if (st->direct) {
+        stream_report(st);
+    }
+    return bytes;
+}
+
+static void stream_done(CURL *easy, CURLcode rc, void *ud)
+{
+    (void)easy;
+    LlmStream *st = (LlmStream *)ud;
+    pthread_mutex_lock(&st->mtx);
+    st->rc = rc;
+    st->done = 1;
+    pthread_cond_signal(&st->cond);
+    pthread_mutex_unlock(&st->mtx);
+}
+
+static void add_seconds(struct timespec *ts, double sec)
+{
+    time_t whole = (time_t)sec;
+    long nsec = ts->tv_nsec + (long)((sec - (double)whole) * 1e9);
+    ts->tv_sec += whole + nsec / 1000000000L;
+    ts->tv_nsec = nsec % 1000000000L;
+}
+
+// run one streamed transfer to url, reporting progress from this thread
+static void stream_attempt(LlmHandle *llm, LlmStream *st, const char *url,
+                           const char *body, size_t body_len)
+{
+    respbuf_begin(&llm->resp, NULL);
+    setup_request(llm, url, body, body_len, stream_write_cb, st);
+
+    if (http_submit(llm->curl, stream_done, st) == 0) {
+        // engine drives the transfer; report progress from this thread
+        pthread_mutex_lock(&st->mtx);
+        while (!st->done) {
+            struct timespec ts;
+            clock_gettime(CLOCK_MONOTONIC, &ts);
+            add_seconds(&ts, st->interval > 0 ? st->interval : 1.0);
+            if (st->out_len == 0) {
+                pthread_cond_wait(&st->cond, &st->mtx);
+            } else {
+                pthread_cond_timedwait(&st->cond, &st->mtx, &ts);
+            }
+            if (!st->done && st->out_len > 0) {
+                pthread_mutex_unlock(&st->mtx);
+                stream_report(st);
+                pthread_mutex_lock(&st->mtx);
+            }
+        }
+        pthread_mutex_unlock(&st->mtx);
+    } else {
+        st->direct = 1;
+        st->rc = curl_easy_perform(llm->curl);
+    }
+}
+
+int llm_chat_stream(LlmHandle *llm, const char *system_prompt,
+                    const char *user_msg, char *out_buf, size_t out_cap,
+                    int max_tokens, double interval_sec,
+                    llm_progress_cb cb, void *ud)
+{
+    return llm_chat_stream_ctx(llm, system_prompt, NULL, 0, user_msg, out_buf, out_cap,
+                               max_tokens, interval_sec, cb, ud);
+}
+
+int llm_chat_stream_ctx(LlmHandle *llm, const char *system_prompt,
+                        const LlmMsg *history, int n_history,
+                        const char *user_msg, char *out_buf, size_t out_cap,
+                        int max_tokens, double interval_sec,
+                        llm_progress_cb cb, void *ud)
+{
+    if (!llm || !user_msg || !out_buf || out_cap == 0) {
+        return -1;
+    }
+
+    size_t body_len = 0;
+    const char *body = llm_encode_request(&llm->jw, llm->model, system_prompt, history,
+                                          n_history, user_msg, max_tokens, 1, &body_len);
+    if (!body) {
+        snprintf(out_buf, out_cap, "[llm error: JSON encode failed]");
+        return -1;
+    }
+
+    LlmStream st = {
+        .raw = &llm->resp,
+        .out = out_buf,
+        .out_cap = out_cap,
+        .cb = cb,
+        .ud = ud,
+        .interval = interval_sec > 0 ? interval_sec : 0,
+        .snap = cb ? malloc(out_cap) : NULL,
+    };
+    if (cb && !st.snap) {
+        snprintf(out_buf, out_cap, "[llm error: alloc failed]");
+        return -1;
+    }
+    out_buf[0] = '\0';
+    llm_sse_init(&st.sse);
+    pthread_mutex_init(&st.mtx, NULL);
+    pthread_condattr_t ca;
+    pthread_condattr_init(&ca);
+    pthread_condattr_setclock(&ca, CLOCK_MONOTONIC);
+    pthread_cond_init(&st.cond, &ca);
+    pthread_condattr_destroy(&ca);
+
+    int attempts = !llm->direct && llm_pool_size() > 1 ? 2 : 1;
+    int be = -1;
+    for (int attempt = 0;; attempt++) {
+        const char *url;
+        be = pick_backend(be, &url, llm->direct, llm->url);
+        stream_attempt(llm, &st, url, body, body_len);
+        // nothing was received from an unreachable backend, so the stream
+        // state is untouched and the request can simply go elsewhere
+        if (!finish_attempt(llm->curl, be, st.rc) || !connect_failed(st.rc) ||
+            attempt + 1 >= attempts) {
+            break;
+        }
+        log_warn("llm: backend unreachable - retrying on another");
+        st.done = 0;
+        st.direct = 0;
+    }
+
+    int rc = 0;
+    if (st.rc != CURLE_OK && !(st.failed && st.rc == CURLE_WRITE_ERROR)) {
+        log_error("llm: curl error: %s", curl_easy_strerror(st.rc));
+        snprintf(out_buf, out_cap, "[llm error: request failed]");
+        rc = -1;
+    } else if (st.failed) {
+        snprintf(out_buf, out_cap, "[llm error: bad response]");
+        rc = -1;
+    } else if (st.sse.events == 0) {
+        // server ignored "stream": true and sent a plain completion
+        if (st.raw->len > 0) {
+            rc = parse_completion(st.raw->data, st.raw->len, out_buf, out_cap);
+        } else {
+            snprintf(out_buf, out_cap, "[llm error: empty response]");
+            rc = -1;
+        }
+    } else {
+        if (st.out_len < out_cap) {
+            st.out_len += llm_think_filter_finish(&st.sse.think, out_buf + st.out_len,
+                                                  out_cap - st.out_len);
+        }
+        st.out_len = simd_utf8_cut(out_buf, st.out_len);
+        while (st.out_len > 0 && is_ws(out_buf[st.out_len - 1])) {
+            st.out_len--;
+        }
+        out_buf[st.out_len] = '\0';
+        if (st.out_len == 0) {
+            snprintf(out_buf, out_cap, "[llm error: empty after stripping think tags]");
+            rc = -1;
+        }
+    }
+
+    free(st.snap);
+    llm_sse_free(&st.sse);
+    pthread_cond_destroy(&st.cond);
+    pthread_mutex_destroy(&st.mtx);
+    return rc;
+}
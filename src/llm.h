@@ -1,6 +1,9 @@
 #pragma once
 
+#include "jsonw.h"
+
 #include <signal.h>
+#include <stddef.h>
 
 // opaque handle for LLM chat completions via local LM Studio server
 typedef struct LlmHandle LlmHandle;
@@ -17,6 +20,13 @@ void llm_cleanup(LlmHandle *llm);
 // set a pointer to a volatile abort flag (same pattern as bot_set_abort_flag)
 void llm_set_abort_flag(LlmHandle *llm, volatile sig_atomic_t *flag);
 
+// send every request to the handle's own endpoint, never through the
+// backend pool (for requests aimed at one particular server)
+void llm_set_direct(LlmHandle *llm, int direct);
+
+// switch the model sent with later requests; NULL or "" = server default
+void llm_set_model(LlmHandle *llm, const char *model);
+
 // perform a single-turn chat completion.
 // system_prompt may be NULL for no system message.
 // user_msg is the user's input text.
@@ -28,7 +38,116 @@ int llm_chat(LlmHandle *llm, const char *system_prompt,
              const char *user_msg, char *out_buf, size_t out_cap,
              int max_tokens);
 
+/* one earlier message of a multi-turn conversation; role is "user" or
+ * "assistant". history is sent between the system prompt and user_msg, in
+ * order, so a server prompt cache can reuse everything before the new turn.
+ */
+typedef struct {
+    const char *role;
+    const char *content;
+} LlmMsg;
+
+// llm_chat with n_history earlier messages (history may be NULL when n_history is 0)
+int llm_chat_ctx(LlmHandle *llm, const char *system_prompt,
+                 const LlmMsg *history, int n_history,
+                 const char *user_msg, char *out_buf, size_t out_cap,
+                 int max_tokens);
+
+// completion callback for llm_chat_submit; runs on the HTTP engine thread and must not block
+typedef void (*llm_done_cb)(int rc, void *ud);
+
+/* llm_chat_ctx without holding the caller: the request (and its retry on
+ * another backend) runs on the HTTP engine, and done(rc, ud) is called
+ * exactly once with out_buf filled as llm_chat_ctx would leave it. the body
+ * is encoded before this returns, so history need not outlive the call,
+ * and llm is free for other requests; out_buf must stay valid until done.
+ * returns 0 if submitted, -1 if not (engine not running or out of memory),
+ * in which case done is never called
+ */
+int llm_chat_submit(LlmHandle *llm, const char *system_prompt,
+                    const LlmMsg *history, int n_history,
+                    const char *user_msg, char *out_buf, size_t out_cap,
+                    int max_tokens, llm_done_cb done, void *ud);
+
+/* send a one-token completion with system_prompt and discard the answer, so
+ * the server loads the model and caches the prompt before real traffic
+ * returns 0 if the server answered 200, -1 otherwise
+ */
+int llm_warm(LlmHandle *llm, const char *system_prompt);
+
 // strip <think>...</think> blocks (including self-closing <think/>) from text.
 // modifies the string in-place and returns the new length.
 // exported for testability.
 size_t llm_strip_think_tags(char *text);
+
+/* streaming <think> filter: the incremental counterpart of
+ * llm_strip_think_tags. feed it arbitrary chunks; tags split across chunk
+ * boundaries are held back until they can be classified. leading whitespace
+ * of the visible output is dropped; trailing whitespace is left to the caller.
+ */
+typedef struct {
+    int state;        // internal: text / in-think
+    int emitted;      // non-zero once a visible non-space byte was produced
+    size_t pend_len;  // bytes held back in pend while matching a tag
+    char pend[16];
+} LlmThinkFilter;
+
+void llm_think_filter_init(LlmThinkFilter *f);
+
+// filter len bytes of in, writing the visible part to out (NUL-terminated)
+// returns bytes appended; output beyond out_cap - 1 is discarded
+size_t llm_think_filter_feed(LlmThinkFilter *f, const char *in, size_t len, char *out, size_t out_cap);
+
+// flush held-back bytes at end of stream; returns bytes appended
+size_t llm_think_filter_finish(LlmThinkFilter *f, char *out, size_t out_cap);
+
+/* incremental parser for an OpenAI-style text/event-stream completion
+ * splits "data:" events, extracts choices[0].delta.content and runs it through
+ * an LlmThinkFilter. exported for testability.
+ */
+typedef struct {
+    LlmThinkFilter think;
+    char *line;      // partial line carried between chunks
+    size_t line_len;
+    size_t line_cap;
+    int events;      // number of data events seen
+    int done;        // "data: [DONE]" received
+} LlmSse;
+
+void llm_sse_init(LlmSse *p);
+void llm_sse_free(LlmSse *p);
+
+// consume raw response bytes; visible text is appended to out at *out_len
+// returns 0 on success, -1 on a malformed or oversized stream
+int llm_sse_feed(LlmSse *p, const char *data, size_t len, char *out, size_t out_cap, size_t *out_len);
+
+/* progress callback for llm_chat_stream, always invoked on the calling
+ * thread with the visible reply so far (cut at a UTF-8 boundary)
+ */
+typedef void (*llm_progress_cb)(void *ud, const char *text, size_t len);
+
+/* streamed variant of llm_chat: sends "stream": true and reports partial
+ * visible text through cb at most every interval_sec while generating.
+ * same return contract and <think> stripping as llm_chat.
+ */
+int llm_chat_stream(LlmHandle *llm, const char *system_prompt,
+                    const char *user_msg, char *out_buf, size_t out_cap,
+                    int max_tokens, double interval_sec,
+                    llm_progress_cb cb, void *ud);
+
+// llm_chat_stream with n_history earlier messages, as in llm_chat_ctx
+int llm_chat_stream_ctx(LlmHandle *llm, const char *system_prompt,
+                        const LlmMsg *history, int n_history,
+                        const char *user_msg, char *out_buf, size_t out_cap,
+                        int max_tokens, double interval_sec,
+                        llm_progress_cb cb, void *ud);
+
+/* encode the request body llm_chat_ctx would send into w; the bytes up to
+ * the new user message depend only on the model, options and history.
+ * returns the body (valid until w is next reset) or NULL. exported for testability.
+ */
+const char *llm_encode_request(JsonW *w, const char *model,
+                               const char *system_prompt,
+                               const LlmMsg *history, int n_history,
+                               const char *user_msg, int max_tokens, int stream,
+                               size_t *len);
@@ -0,0 +1,415 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "llmpool.h"
+#include "config.h"
+#include "http.h"
+#include "logger.h"
+
+#include <curl/curl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+typedef struct {
+    char base[LLM_POOL_BASE_MAX];
+    char chat_url[512];
+    char probe_url[512];
+    int inflight;
+    int fails;       // consecutive failures
+    bool ejected;
+    bool slow;          // ejected for latency, which a probe cannot judge
+    double eject_until; // CLOCK_MONOTONIC seconds
+    double backoff;     // current ejection length
+    double latency;     // EWMA of first-byte latency
+    unsigned long requests;
+    unsigned long failures;
+} Backend;
+
+static struct {
+    pthread_mutex_t lock;
+    Backend *b;
+    int n;
+    unsigned rr; // rotates the tie-break start
+    // prober
+    pthread_t prober;
+    pthread_cond_t cond;
+    bool probing;
+    bool stop;
+    int interval;
+} g_pool = {.lock = PTHREAD_MUTEX_INITIALIZER};
+
+static double monotonic_sec(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+int llm_pool_parse(const char *endpoints, char bases[][LLM_POOL_BASE_MAX], int max)
+{
+    int n = 0;
+    const char *p = endpoints;
+    while (*p) {
+        while (*p == ' ' || *p == '\t' || *p == ',') {
+            p++;
+        }
+        const char *end = p;
+        while (*end && *end != ',') {
+            end++;
+        }
+        const char *last = end;
+        while (last > p && (last[-1] == ' ' || last[-1] == '\t' || last[-1] == '/')) {
+            last--;
+        }
+        size_t len = (size_t)(last - p);
+        if (len > 0) {
+            if (n == max || len >= LLM_POOL_BASE_MAX) {
+                return -1;
+            }
+            memcpy(bases[n], p, len);
+            bases[n][len] = '\0';
+            n++;
+        }
+        p = end;
+    }
+    return n;
+}
+
+int llm_pool_init(const char *endpoints)
+{
+    if (!endpoints) {
+        return -1;
+    }
+    char bases[LLM_POOL_MAX][LLM_POOL_BASE_MAX];
+    int n = llm_pool_parse(endpoints, bases, LLM_POOL_MAX);
+    if (n < 0) {
+        log_error("llm pool: too many endpoints or endpoint too long");
+    }
+    if (n <= 0) {
+        return -1;
+    }
+    Backend *b = calloc(LLM_POOL_MAX, sizeof(*b));
+    if (!b) {
+        return -1;
+    }
+    for (int i = 0; i < n; i++) {
+        memcpy(b[i].base, bases[i], sizeof(b[i].base));
+        snprintf(b[i].chat_url, sizeof(b[i].chat_url), "%s/v1/chat/completions", b[i].base);
+        snprintf(b[i].probe_url, sizeof(b[i].probe_url), "%s/v1/models", b[i].base);
+    }
+
+    llm_pool_destroy();
+    pthread_mutex_lock(&g_pool.lock);
+    g_pool.b = b;
+    g_pool.n = n;
+    g_pool.rr = 0;
+    pthread_mutex_unlock(&g_pool.lock);
+    return n;
+}
+
+void llm_pool_destroy(void)
+{
+    pthread_mutex_lock(&g_pool.lock);
+    bool probing = g_pool.probing;
+    g_pool.stop = true;
+    if (probing) {
+        pthread_cond_signal(&g_pool.cond);
+    }
+    pthread_mutex_unlock(&g_pool.lock);
+
+    if (probing) {
+        pthread_join(g_pool.prober, NULL);
+        pthread_cond_destroy(&g_pool.cond);
+    }
+
+    pthread_mutex_lock(&g_pool.lock);
+    free(g_pool.b);
+    g_pool.b = NULL;
+    g_pool.n = 0;
+    g_pool.probing = false;
+    g_pool.stop = false;
+    pthread_mutex_unlock(&g_pool.lock);
+}
+
+int llm_pool_size(void)
+{
+    pthread_mutex_lock(&g_pool.lock);
+    int n = g_pool.n;
+    pthread_mutex_unlock(&g_pool.lock);
+    return n;
+}
+
+const char *llm_pool_url(int idx)
+{
+    pthread_mutex_lock(&g_pool.lock);
+    const char *url = idx >= 0 && idx < g_pool.n ? g_pool.b[idx].chat_url : NULL;
+    pthread_mutex_unlock(&g_pool.lock);
+    return url;
+}
+
+// backend health transitions (caller holds g_pool.lock)
+
+static void eject(Backend *b, double now, bool slow, const char *why)
+{
+    b->backoff = b->backoff > 0.0 ? b->backoff * 2.0 : (double)LLM_POOL_EJECT_SEC;
+    if (b->backoff > (double)LLM_POOL_EJECT_MAX_SEC) {
+        b->backoff = (double)LLM_POOL_EJECT_MAX_SEC;
+    }
+    b->eject_until = now + b->backoff;
+    b->ejected = true;
+    b->slow = slow;
+    log_warn("llm pool: ejecting %s for %.0fs (%s)", b->base, b->backoff, why);
+}
+
+static void reinstate(Backend *b)
+{
+    if (b->ejected) {
+        log_info("llm pool: %s back in rotation", b->base);
+    }
+    b->ejected = false;
+    b->slow = false;
+    b->fails = 0;
+    b->backoff = 0.0;
+}
+
+static void record_failure(Backend *b, double now)
+{
+    b->failures++;
+    b->fails++;
+    // a failed trial after ejection goes straight back out, for longer
+    if (b->ejected) {
+        eject(b, now, false, "trial request failed");
+    } else if (b->fails >= LLM_POOL_FAIL_MAX) {
+        eject(b, now, false, "consecutive failures");
+    }
+}
+
+// eject b if its latency is far above the best of the other healthy backends
+static void check_slow(Backend *b, double now)
+{
+    if (b->ejected || b->latency < LLM_POOL_SLOW_MIN_SEC) {
+        return;
+    }
+    double best = 0.0;
+    for (int i = 0; i < g_pool.n; i++) {
+        Backend *o = &g_pool.b[i];
+        if (o != b && !o->ejected && o->latency > 0.0 && (best == 0.0 || o->latency < best)) {
+            best = o->latency;
+        }
+    }
+    if (best > 0.0 && b->latency > best * LLM_POOL_SLOW_FACTOR) {
+        eject(b, now, true, "slow");
+        // forget the slow average so the trial request is judged on its own
+        b->latency = 0.0;
+    }
+}
+
+int llm_pool_acquire(int avoid)
+{
+    pthread_mutex_lock(&g_pool.lock);
+    if (g_pool.n == 0) {
+        pthread_mutex_unlock(&g_pool.lock);
+        return -1;
+    }
+
+    double now = monotonic_sec();
+    int pick = -1;
+    unsigned start = g_pool.rr++;
+    for (int k = 0; k < g_pool.n; k++) {
+        int i = (int)((start + (unsigned)k) % (unsigned)g_pool.n);
+        Backend *b = &g_pool.b[i];
+        // an ejected backend whose backoff expired gets one request at a time
+        if (i == avoid || (b->ejected && (now < b->eject_until || b->inflight > 0))) {
+            continue;
+        }
+        if (pick < 0) {
+            pick = i;
+            continue;
+        }
+        Backend *p = &g_pool.b[pick];
+        if (b->inflight < p->inflight ||
+            (b->inflight == p->inflight && b->latency > 0.0 && p->latency > 0.0 &&
+             b->latency < p->latency)) {
+            pick = i;
+        }
+    }
+    if (pick < 0 && avoid >= 0 && avoid < g_pool.n && !g_pool.b[avoid].ejected) {
+        pick = avoid;
+    }
+    if (pick < 0) {
+        // everything is ejected: fail open to the backend due back first
+        pick = 0;
+        for (int i = 1; i < g_pool.n; i++) {
+            if (g_pool.b[i].eject_until < g_pool.b[pick].eject_until) {
+                pick = i;
+            }
+        }
+    }
+
+    g_pool.b[pick].inflight++;
+    g_pool.b[pick].requests++;
+    pthread_mutex_unlock(&g_pool.lock);
+    return pick;
+}
+
+void llm_pool_release(int idx, bool ok, double first_byte_sec)
+{
+    pthread_mutex_lock(&g_pool.lock);
+    if (idx < 0 || idx >= g_pool.n) {
+        pthread_mutex_unlock(&g_pool.lock);
+        return;
+    }
+    Backend *b = &g_pool.b[idx];
+    if (b->inflight > 0) {
+        b->inflight--;
+    }
+    double now = monotonic_sec();
+    if (!ok) {
+        record_failure(b, now);
+    } else {
+        // a slow backend is only cleared by its trial, not by requests it
+        // was already serving when it was ejected
+        if (!b->slow || now >= b->eject_until) {
+            reinstate(b);
+        }
+        if (first_byte_sec > 0.0) {
+            b->latency = b->latency > 0.0 ? b->latency * 0.8 + first_byte_sec * 0.2
+                                          : first_byte_sec;
+        }
+        check_slow(b, now);
+    }
+    pthread_mutex_unlock(&g_pool.lock);
+}
+
+// active checks
+
+static size_t discard_cb(char *ptr, size_t size, size_t nmemb, void *ud)
+{
+    (void)ptr;
+    (void)ud;
+    return size * nmemb;
+}
+
+static bool probe(CURL *curl, const char *url)
+{
+    curl_easy_reset(curl);
+    curl_easy_setopt(curl, CURLOPT_URL, url);
+    curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, discard_cb);
+    curl_easy_setopt(curl, CURLOPT_TIMEOUT, (long)LLM_POOL_PROBE_TIMEOUT);
+    curl_easy_setopt(curl, CURLOPT_CONNECTTIMEOUT, (long)LLM_POOL_PROBE_TIMEOUT);
+    curl_easy_setopt(curl, CURLOPT_NOSIGNAL, 1L);
+    http_easy_apply(curl);
+
+    long code = 0;
+    if (http_perform(curl) != CURLE_OK) {
+        return false;
+    }
+    curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &code);
+    return code >= 200 && code < 300;
+}
+
+void llm_pool_check(void)
+{
+    pthread_mutex_lock(&g_pool.lock);
+    int n = g_pool.n;
+    const Backend *b = g_pool.b;
+    pthread_mutex_unlock(&g_pool.lock);
+    if (n == 0) {
+        return;
+    }
+
+    CURL *curl = curl_easy_init();
+    if (!curl) {
+        return;
+    }
+    // urls are immutable until llm_pool_destroy, which joins this thread first
+    bool up[LLM_POOL_MAX];
+    for (int i = 0; i < n; i++) {
+        up[i] = probe(curl, b[i].probe_url);
+    }
+    curl_easy_cleanup(curl);
+
+    pthread_mutex_lock(&g_pool.lock);
+    double now = monotonic_sec();
+    for (int i = 0; i < n && i < g_pool.n; i++) {
+        Backend *be = &g_pool.b[i];
+        if (up[i]) {
+            // a slow backend answers probes fine; it waits for its trial request
+            if (!be->slow) {
+                reinstate(be);
+            }
+        } else if (!be->ejected) {
+            record_failure(be, now);
+        }
+    }
+    pthread_mutex_unlock(&g_pool.lock);
+}
+
+static void *prober_main(void *arg)
+{
+    (void)arg;
+    pthread_mutex_lock(&g_pool.lock);
+    while (!g_pool.stop) {
+        struct timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        ts.tv_sec += g_pool.interval;
+        pthread_cond_timedwait(&g_pool.cond, &g_pool.lock, &ts);
+        if (g_pool.stop) {
+            break;
+        }
+        pthread_mutex_unlock(&g_pool.lock);
+        llm_pool_check();
+        pthread_mutex_lock(&g_pool.lock);
+    }
+    pthread_mutex_unlock(&g_pool.lock);
+    return NULL;
+}
+
+int llm_pool_start_probe(int interval_sec)
+{
+    if (interval_sec <= 0) {
+        return -1;
+    }
+    pthread_mutex_lock(&g_pool.lock);
+    if (g_pool.n == 0 || g_pool.probing) {
+        pthread_mutex_unlock(&g_pool.lock);
+        return -1;
+    }
+    pthread_condattr_t ca;
+    pthread_condattr_init(&ca);
+    pthread_condattr_setclock(&ca, CLOCK_MONOTONIC);
+    pthread_cond_init(&g_pool.cond, &ca);
+    pthread_condattr_destroy(&ca);
+    g_pool.interval = interval_sec;
+    g_pool.stop = false;
+    if (pthread_create(&g_pool.prober, NULL, prober_main, NULL) != 0) {
+        pthread_cond_destroy(&g_pool.cond);
+        pthread_mutex_unlock(&g_pool.lock);
+        return -1;
+    }
+    g_pool.probing = true;
+    pthread_mutex_unlock(&g_pool.lock);
+    return 0;
+}
+
+int llm_pool_stats(int idx, LlmPoolStats *out)
+{
+    if (!out) {
+        return -1;
+    }
+    pthread_mutex_lock(&g_pool.lock);
+    if (idx < 0 || idx >= g_pool.n) {
+        pthread_mutex_unlock(&g_pool.lock);
+        return -1;
+    }
+    const Backend *b = &g_pool.b[idx];
+    out->inflight = b->inflight;
+    out->ejected = b->ejected;
+    out->latency = b->latency;
+    out->requests = b->requests;
+    out->failures = b->failures;
+    pthread_mutex_unlock(&g_pool.lock);
+    return 0;
+}
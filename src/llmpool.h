@@ -0,0 +1,68 @@
+#pragma once
+
+#include "config.h"
+
+#include <stdbool.h>
+
+/* process-wide pool of LLM backends shared by every worker's LlmHandle
+ * each request goes to the healthy backend with the fewest requests in
+ * flight (ties go to the lower first-byte latency, then round-robin).
+ * passive checks: consecutive transport failures or 5xx answers, or a
+ * first-byte latency far above the best backend's, eject a backend for a
+ * backoff that doubles while it keeps failing; once it expires one trial
+ * request is let through. active checks: a prober thread GETs /v1/models
+ * on every backend and returns a recovered one to rotation early.
+ * when every backend is ejected the pool fails open to the one due back first.
+ * all calls are thread-safe.
+ */
+
+/* split a comma-separated list of base URLs ("http://a:1234, http://b:1234/")
+ * into bases, trimming blanks and trailing slashes; empty items are skipped
+ * returns the number found (0..max), or -1 past max or LLM_POOL_BASE_MAX
+ */
+int llm_pool_parse(const char *endpoints, char bases[][LLM_POOL_BASE_MAX], int max);
+
+/* set up a backend for each base URL in endpoints (llm_pool_parse syntax)
+ * returns the number of backends (1..LLM_POOL_MAX), or -1 on error
+ */
+int llm_pool_init(const char *endpoints);
+
+// stop the prober and forget every backend; safe if never initialised
+void llm_pool_destroy(void);
+
+// start the active health checker, probing every interval_sec (> 0)
+// returns 0 on success, -1 on error
+int llm_pool_start_probe(int interval_sec);
+
+// number of backends (0 when the pool is not initialised)
+int llm_pool_size(void);
+
+/* pick a backend for one request and count it as in flight
+ * avoid: index to pass over (a backend that just failed this request), or -1;
+ * it is still chosen if nothing else is available.
+ * returns its index, or -1 if the pool is not initialised
+ */
+int llm_pool_acquire(int avoid);
+
+// chat completions URL of backend idx (stable until llm_pool_destroy)
+const char *llm_pool_url(int idx);
+
+/* finish a request started with llm_pool_acquire
+ * ok: the backend answered (transport succeeded, status below 500)
+ * first_byte_sec: time to the first response byte, used for slow ejection
+ */
+void llm_pool_release(int idx, bool ok, double first_byte_sec);
+
+// run one active probe pass on the calling thread (the prober's loop body)
+void llm_pool_check(void);
+
+typedef struct {
+    int inflight;
+    bool ejected;
+    double latency;          // smoothed first-byte latency, 0 until measured
+    unsigned long requests;
+    unsigned long failures;
+} LlmPoolStats;
+
+// snapshot backend idx; returns 0, or -1 if idx is out of range
+int llm_pool_stats(int idx, LlmPoolStats *out);
@@ -1,9 +1,12 @@
 #define _POSIX_C_SOURCE 200809L
+#define _GNU_SOURCE // pwritev, memmem, memrchr
 
 #include "logger.h"
 
 #include <errno.h>
 #include <pthread.h>
+#include <sched.h>
+#include <semaphore.h>
 #include <signal.h>
 #include <stdarg.h>
 #include <stdatomic.h>
@@ -11,8 +14,12 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <fcntl.h>
 #include <sys/inotify.h>
+#include <sys/mman.h>
 #include <sys/select.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
 #include <time.h>
 #include <unistd.h>
 
@@ -22,6 +29,30 @@
 #define MIN_FILE_CAP    256   // smallest permissible max_bytes
 #define TIMESTAMP_LEN   22    // "[2026-02-07 12:34:56] "
 #define TIMESTAMP_BUF   32    // extra room to satisfy -Wformat-truncation
+#define LOG_CELL_BYTES  512   // one async ring cell, header included
+#define LOG_BATCH_MAX   64    // lines per writev
+#define LOG_FLUSH_MS    50    // the flusher drains at least this often
+#define MMAP_MAGIC      "#TGBLOG\n"
+#define MMAP_HDR_BYTES  64    // header at the start of an mmap log
+#define FOLLOW_POLL_MS  100   // mmap writes raise no inotify events
+#define SCAN_CHUNK      65536 // reader and marker-search read size
+
+/* mmap log layout: a fixed-size file, header first, then the circular data
+ * region [MMAP_HDR_BYTES, size). the header carries the write cursor, so
+ * log_init_mmap recovers its position without reading the data; the marker
+ * is still written after the newest line so the data region reads the same
+ * as a stdio log.
+ */
+typedef struct {
+    char magic[8];    // MMAP_MAGIC
+    uint64_t size;    // whole file, header included
+    uint64_t cursor;  // next write offset (absolute)
+    uint64_t wraps;   // times writing returned to the top of the data region
+    uint64_t wrap_at; // data end at the most recent wrap
+    char reserved[MMAP_HDR_BYTES - 40];
+} MmapHeader;
+
+_Static_assert(sizeof(MmapHeader) == MMAP_HDR_BYTES, "mmap log header size");
 
 static const char *const g_level_tags[] = {
     [LOG_DEBUG] = "DEBUG",
@@ -37,15 +68,38 @@ static size_t g_max_bytes;
 static size_t g_write_pos;
 static int g_overwriting;
 static int g_initialised;
+static char *g_map;        // mmap mode: the whole file, NULL for stdio mode
+static size_t g_data_start; // first data byte: 0, or MMAP_HDR_BYTES in mmap mode
 static _Atomic int g_min_level = LOG_INFO;
 
-// format a timestamp into @buf (must be >= TIMESTAMP_LEN + 1 bytes)
-static void fmt_timestamp(char *buf, size_t cap)
+/* async mode: callers format on their own stack and publish the line into
+ * a bounded MPSC ring of cells (Vyukov sequence numbers, as in ingress.c);
+ * the flusher thread drains it under g_lock and writes whole batches with
+ * one writev to stderr and one pwritev per run to the circular file.
+ * draining always happens under g_lock, so there is a single consumer.
+ */
+typedef struct {
+    _Atomic size_t seq;
+    size_t len;
+    char data[LOG_CELL_BYTES - 2 * sizeof(size_t)];
+} LogCell;
+
+static struct {
+    LogCell *cells;
+    size_t mask;
+    _Atomic size_t head; // next cell to drain
+    _Atomic size_t tail; // next cell to claim
+    _Atomic int running;
+    _Atomic int stop;
+    sem_t wake;
+    pthread_t thread;
+} g_async;
+
+// format @t as a line timestamp into @buf (must be >= TIMESTAMP_LEN + 1 bytes)
+static void fmt_stamp(char *buf, size_t cap, time_t t)
 {
-    struct timespec ts;
-    clock_gettime(CLOCK_REALTIME, &ts);
     struct tm tm;
-    gmtime_r(&ts.tv_sec, &tm);
+    gmtime_r(&t, &tm);
     int year = tm.tm_year + 1900;
     if (year < 0) {
         year = 0;
@@ -57,98 +111,313 @@ static void fmt_timestamp(char *buf, size_t cap)
              tm.tm_mday % 100, tm.tm_hour % 100, tm.tm_min % 100, tm.tm_sec % 100);
 }
 
+// format the current time into @buf (must be >= TIMESTAMP_LEN + 1 bytes)
+static void fmt_timestamp(char *buf, size_t cap)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    fmt_stamp(buf, cap, ts.tv_sec);
+}
+
 /**
- * search the file for the overwrite marker. Returns the byte offset of the
- * marker if found, or -1.
+ * search the file for the overwrite marker at the start of a line, reading
+ * SCAN_CHUNK bytes at a time. Returns the byte offset of the marker if
+ * found, or -1.
  */
-static long find_marker(FILE *fp, size_t file_size)
+static long find_marker(int fd, size_t file_size)
 {
-    if (file_size < MARKER_LEN) {
-        return -1;
-    }
-
-    // read entire file into a stack buffer, or heap if too large
-    char stack_buf[65536];
-    char *buf = stack_buf;
-    int heap = 0;
-    if (file_size > sizeof(stack_buf)) {
-        buf = malloc(file_size);
-        if (!buf) {
-            return -1;
+    // one byte before the chunk to check the line start, MARKER_LEN - 1 after
+    // so a marker straddling two chunks is still seen whole
+    char buf[1 + SCAN_CHUNK + MARKER_LEN - 1];
+    for (size_t off = 0; off + MARKER_LEN <= file_size; off += SCAN_CHUNK) {
+        size_t lead = off > 0 ? 1 : 0;
+        ssize_t got = pread(fd, buf, sizeof(buf) - 1 + lead, (off_t)(off - lead));
+        if (got < (ssize_t)(lead + MARKER_LEN)) {
+            break;
+        }
+        const char *base = buf + lead;
+        const char *end = buf + got;
+        const char *p = base;
+        while ((p = memmem(p, (size_t)(end - p), MARKER, MARKER_LEN)) != NULL) {
+            if (p - base >= SCAN_CHUNK) {
+                break; // the next chunk starts here and will see it
+            }
+            if (p == buf || p[-1] == '\n') {
+                return (long)(off + (size_t)(p - base));
+            }
+            p++;
         }
-        heap = 1;
     }
+    return -1;
+}
 
-    if (fseek(fp, 0, SEEK_SET) != 0) {
-        if (heap) {
-            free(buf);
-        }
-        return -1;
+/**
+ * Write one run of contiguous lines to the circular file at @pos and move
+ * g_write_pos to its end.  Caller must hold g_lock.
+ */
+static void write_run(const struct iovec *run, int n, size_t pos)
+{
+    if (n == 0) {
+        return;
     }
-    size_t got = fread(buf, 1, file_size, fp);
-    if (got < MARKER_LEN) {
-        if (heap) {
-            free(buf);
+    if (g_map) {
+        for (int i = 0; i < n; i++) {
+            memcpy(g_map + pos, run[i].iov_base, run[i].iov_len);
+            pos += run[i].iov_len;
         }
-        return -1;
+        g_write_pos = pos;
+        return;
     }
+    ssize_t written = pwritev(fileno(g_fp), run, n, (off_t)pos);
+    g_write_pos = pos + (written > 0 ? (size_t)written : 0);
+}
 
-    // scan for the marker
-    const char *p = buf;
-    const char *end = buf + got - MARKER_LEN;
-    long result = -1;
-    while (p <= end) {
-        if (memcmp(p, MARKER, MARKER_LEN) == 0) {
-            result = (long)(p - buf);
-            break;
-        }
-        // skip to next newline for efficiency
-        const char *nl = memchr(p, '\n', (size_t)(end - p + MARKER_LEN));
-        if (!nl) {
-            break;
-        }
-        p = nl + 1;
+// write @len bytes at @pos without moving g_write_pos (caller holds g_lock)
+static void write_at(const char *data, size_t len, size_t pos)
+{
+    if (g_map) {
+        memcpy(g_map + pos, data, len);
+        return;
     }
+    ssize_t w = pwrite(fileno(g_fp), data, len, (off_t)pos);
+    (void)w; // best effort, as before
+}
 
-    if (heap) {
-        free(buf);
+/**
+ * Write the overwrite marker at the current g_write_pos (only if overwriting).
+ * Caller must hold g_lock.
+ */
+static void write_marker(void)
+{
+    if (!g_overwriting || (!g_fp && !g_map)) {
+        return;
     }
-    return result;
+    // DO NOT advance g_write_pos - next write will overwrite the marker
+    write_at(MARKER, MARKER_LEN, g_write_pos);
 }
 
 /**
- * Raw write to the circular file at g_write_pos.
- * Caller must hold g_lock.
+ * Write @n formatted lines to stderr and, if open, the circular file.
+ * Lines that fit before the cap go out as one pwritev; the marker is written
+ * once after the batch.  Caller must hold g_lock.
  */
-static void raw_write(const char *data, size_t len)
+static void emit_lines(const struct iovec *lines, int n)
 {
-    if (!g_fp || len == 0) {
+    if (n == 0) {
         return;
     }
 
-    if (fseek(g_fp, (long)g_write_pos, SEEK_SET) != 0) {
+    // always write to stderr for journal/terminal
+    ssize_t err = writev(STDERR_FILENO, lines, n);
+    (void)err; // a closed stderr must not stop file logging
+
+    if (!g_fp && !g_map) {
         return;
     }
-    size_t written = fwrite(data, 1, len, g_fp);
-    fflush(g_fp);
-    g_write_pos += written;
+
+    // ensure a single line can never exceed the data region minus the marker
+    size_t usable = g_max_bytes - g_data_start - MARKER_LEN;
+    MmapHeader *hdr = (MmapHeader *)g_map;
+    struct iovec run[LOG_BATCH_MAX];
+    int run_n = 0;
+    size_t run_pos = g_write_pos;
+    size_t pos = g_write_pos;
+
+    for (int i = 0; i < n; i++) {
+        size_t line_len = lines[i].iov_len > usable ? usable : lines[i].iov_len;
+
+        // check if this line would push us past the cap
+        size_t space_needed = line_len + (g_overwriting ? MARKER_LEN : 0);
+        if (pos + space_needed > g_max_bytes) {
+            write_run(run, run_n, run_pos);
+            run_n = 0;
+            // erase the stale marker before wrapping so only one exists
+            if (g_overwriting && g_write_pos + MARKER_LEN <= g_max_bytes) {
+                char blanks[MARKER_LEN];
+                memset(blanks, ' ', MARKER_LEN - 1);
+                blanks[MARKER_LEN - 1] = '\n';
+                write_at(blanks, MARKER_LEN, g_write_pos);
+            }
+            if (hdr) {
+                hdr->wrap_at = g_write_pos;
+                hdr->wraps++;
+            }
+            // wrap to the top
+            g_write_pos = g_data_start;
+            g_overwriting = 1;
+            run_pos = g_data_start;
+            pos = g_data_start;
+        }
+
+        run[run_n].iov_base = lines[i].iov_base;
+        run[run_n].iov_len = line_len;
+        run_n++;
+        pos += line_len;
+    }
+
+    write_run(run, run_n, run_pos);
+    write_marker();
+    if (hdr) {
+        hdr->cursor = g_write_pos;
+    }
 }
 
 /**
- * Write the overwrite marker at the current g_write_pos (only if overwriting).
- * Caller must hold g_lock.
+ * Drain every published cell of the async ring, oldest first.
+ * Stops at a cell that is claimed but not yet published; the next drain
+ * picks it up.  Caller must hold g_lock.
  */
-static void write_marker(void)
+static void async_drain_locked(void)
 {
-    if (!g_overwriting || !g_fp) {
+    if (!g_async.cells) {
         return;
     }
-    if (fseek(g_fp, (long)g_write_pos, SEEK_SET) != 0) {
+
+    struct iovec lines[LOG_BATCH_MAX];
+    for (;;) {
+        size_t head = atomic_load_explicit(&g_async.head, memory_order_relaxed);
+        int n = 0;
+        while (n < LOG_BATCH_MAX) {
+            size_t pos = head + (size_t)n;
+            LogCell *cell = &g_async.cells[pos & g_async.mask];
+            if (atomic_load_explicit(&cell->seq, memory_order_acquire) != pos + 1) {
+                break;
+            }
+            lines[n].iov_base = cell->data;
+            lines[n].iov_len = cell->len;
+            n++;
+        }
+        if (n == 0) {
+            return;
+        }
+
+        emit_lines(lines, n);
+
+        // hand the cells back to producers one lap later
+        for (int i = 0; i < n; i++) {
+            size_t pos = head + (size_t)i;
+            atomic_store_explicit(&g_async.cells[pos & g_async.mask].seq,
+                                  pos + g_async.mask + 1, memory_order_release);
+        }
+        atomic_store_explicit(&g_async.head, head + (size_t)n, memory_order_release);
+    }
+}
+
+/**
+ * Publish a formatted line into the async ring without taking a lock.
+ * Returns 0 if queued, -1 if async mode is off, the line does not fit a
+ * cell, or the ring is full - the caller then writes it synchronously.
+ */
+static int async_push(const char *line, size_t len)
+{
+    if (!atomic_load_explicit(&g_async.running, memory_order_acquire) ||
+        len > sizeof(((LogCell *)0)->data)) {
+        return -1;
+    }
+
+    size_t pos = atomic_load_explicit(&g_async.tail, memory_order_relaxed);
+    LogCell *cell;
+    for (;;) {
+        cell = &g_async.cells[pos & g_async.mask];
+        size_t seq = atomic_load_explicit(&cell->seq, memory_order_acquire);
+        intptr_t diff = (intptr_t)seq - (intptr_t)pos;
+        if (diff == 0) {
+            if (atomic_compare_exchange_weak_explicit(&g_async.tail, &pos, pos + 1,
+                                                      memory_order_relaxed,
+                                                      memory_order_relaxed)) {
+                break;
+            }
+        } else if (diff < 0) {
+            return -1; // full: the flusher is behind
+        } else {
+            pos = atomic_load_explicit(&g_async.tail, memory_order_relaxed);
+        }
+    }
+
+    memcpy(cell->data, line, len);
+    cell->len = len;
+    atomic_store_explicit(&cell->seq, pos + 1, memory_order_release);
+
+    // wake the flusher early once a quarter of the ring is waiting
+    size_t head = atomic_load_explicit(&g_async.head, memory_order_relaxed);
+    if (pos - head == (g_async.mask + 1) / 4) {
+        sem_post(&g_async.wake);
+    }
+    return 0;
+}
+
+static void *flusher_main(void *arg)
+{
+    (void)arg;
+    while (!atomic_load_explicit(&g_async.stop, memory_order_acquire)) {
+        struct timespec ts;
+        clock_gettime(CLOCK_REALTIME, &ts);
+        ts.tv_nsec += LOG_FLUSH_MS * 1000000L;
+        if (ts.tv_nsec >= 1000000000L) {
+            ts.tv_sec++;
+            ts.tv_nsec -= 1000000000L;
+        }
+        while (sem_timedwait(&g_async.wake, &ts) != 0 && errno == EINTR) {
+        }
+
+        pthread_mutex_lock(&g_lock);
+        async_drain_locked();
+        pthread_mutex_unlock(&g_lock);
+    }
+    return NULL;
+}
+
+// stop the flusher and write out everything still queued
+static void async_stop(void)
+{
+    if (!atomic_load_explicit(&g_async.running, memory_order_acquire)) {
         return;
     }
-    fwrite(MARKER, 1, MARKER_LEN, g_fp);
-    fflush(g_fp);
-    // DO NOT advance g_write_pos - next write will overwrite the marker
+    // new lines take the synchronous path from here on
+    atomic_store_explicit(&g_async.running, 0, memory_order_release);
+    atomic_store_explicit(&g_async.stop, 1, memory_order_release);
+    sem_post(&g_async.wake);
+    pthread_join(g_async.thread, NULL);
+
+    // a producer that claimed a cell just before the switch may still be copying
+    for (;;) {
+        pthread_mutex_lock(&g_lock);
+        async_drain_locked();
+        size_t head = atomic_load_explicit(&g_async.head, memory_order_acquire);
+        size_t tail = atomic_load_explicit(&g_async.tail, memory_order_acquire);
+        pthread_mutex_unlock(&g_lock);
+        if (head == tail) {
+            break;
+        }
+        sched_yield();
+    }
+
+    sem_destroy(&g_async.wake);
+    free(g_async.cells);
+    g_async.cells = NULL;
+}
+
+// close whichever backing file is open (caller holds g_lock)
+static void close_file_locked(void)
+{
+    if (g_fp) {
+        fflush(g_fp);
+        fclose(g_fp);
+        g_fp = NULL;
+    }
+    if (g_map) {
+        msync(g_map, g_max_bytes, MS_ASYNC);
+        munmap(g_map, g_max_bytes);
+        g_map = NULL;
+    }
+}
+
+// a header is trusted only if it matches the expected size and its cursor is in range
+static int mmap_header_valid(const MmapHeader *h, size_t size)
+{
+    return memcmp(h->magic, MMAP_MAGIC, sizeof(h->magic)) == 0 && h->size == size &&
+           h->cursor >= MMAP_HDR_BYTES && h->cursor + MARKER_LEN <= size &&
+           h->wrap_at <= size;
 }
 
 // API
@@ -160,10 +429,7 @@ int log_init(const char *path, size_t max_bytes)
 
     pthread_mutex_lock(&g_lock);
 
-    if (g_fp) {
-        fclose(g_fp);
-        g_fp = NULL;
-    }
+    close_file_locked();
 
     // open in r+b if file exists, otherwise w+b to create
     g_fp = fopen(path, "r+b");
@@ -178,6 +444,7 @@ int log_init(const char *path, size_t max_bytes)
     }
 
     g_max_bytes = max_bytes;
+    g_data_start = 0;
     g_overwriting = 0;
     g_write_pos = 0;
 
@@ -188,7 +455,7 @@ int log_init(const char *path, size_t max_bytes)
 
     if (file_size > 0) {
         // try to recover write position from marker
-        long marker_off = find_marker(g_fp, file_size);
+        long marker_off = find_marker(fileno(g_fp), file_size);
         if (marker_off >= 0) {
             g_write_pos = (size_t)marker_off;
             g_overwriting = 1;
@@ -207,14 +474,127 @@ int log_init(const char *path, size_t max_bytes)
     return 0;
 }
 
-void log_close(void)
+int log_start_async(size_t slots)
+{
+    if (atomic_load_explicit(&g_async.running, memory_order_acquire)) {
+        return 0;
+    }
+
+    size_t cap = 2;
+    while (cap < slots) {
+        cap <<= 1;
+    }
+    g_async.cells = calloc(cap, sizeof(*g_async.cells));
+    if (!g_async.cells) {
+        return -1;
+    }
+    for (size_t i = 0; i < cap; i++) {
+        atomic_init(&g_async.cells[i].seq, i);
+    }
+    g_async.mask = cap - 1;
+    atomic_store(&g_async.head, 0);
+    atomic_store(&g_async.tail, 0);
+    atomic_store(&g_async.stop, 0);
+
+    if (sem_init(&g_async.wake, 0, 0) != 0) {
+        free(g_async.cells);
+        g_async.cells = NULL;
+        return -1;
+    }
+    if (pthread_create(&g_async.thread, NULL, flusher_main, NULL) != 0) {
+        sem_destroy(&g_async.wake);
+        free(g_async.cells);
+        g_async.cells = NULL;
+        return -1;
+    }
+    atomic_store_explicit(&g_async.running, 1, memory_order_release);
+    return 0;
+}
+
+void log_flush(void)
 {
     pthread_mutex_lock(&g_lock);
-    if (g_fp) {
-        fflush(g_fp);
-        fclose(g_fp);
-        g_fp = NULL;
+    async_drain_locked();
+    pthread_mutex_unlock(&g_lock);
+}
+
+int log_init_mmap(const char *path, size_t max_bytes)
+{
+    if (!path || max_bytes < MIN_FILE_CAP + MMAP_HDR_BYTES) {
+        return -1;
+    }
+
+    pthread_mutex_lock(&g_lock);
+    close_file_locked();
+
+    int fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0640);
+    if (fd < 0) {
+        pthread_mutex_unlock(&g_lock);
+        return -1;
+    }
+
+    struct stat st;
+    memset(&st, 0, sizeof(st));
+    MmapHeader hdr;
+    int valid = fstat(fd, &st) == 0 && (size_t)st.st_size == max_bytes &&
+                pread(fd, &hdr, sizeof(hdr), 0) == (ssize_t)sizeof(hdr) &&
+                mmap_header_valid(&hdr, max_bytes);
+
+    if (!valid && st.st_size > 0) {
+        // a stdio log, or one mapped at another size: keep it beside the new one
+        char old[512];
+        snprintf(old, sizeof(old), "%s.1", path);
+        close(fd);
+        if (rename(path, old) != 0) {
+            pthread_mutex_unlock(&g_lock);
+            return -1;
+        }
+        fd = open(path, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0640);
+        if (fd < 0) {
+            pthread_mutex_unlock(&g_lock);
+            return -1;
+        }
+    }
+    if (!valid && ftruncate(fd, (off_t)max_bytes) != 0) {
+        close(fd);
+        pthread_mutex_unlock(&g_lock);
+        return -1;
     }
+
+    void *map = mmap(NULL, max_bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd); // the mapping keeps the file open
+    if (map == MAP_FAILED) {
+        pthread_mutex_unlock(&g_lock);
+        return -1;
+    }
+
+    g_map = map;
+    g_max_bytes = max_bytes;
+    g_data_start = MMAP_HDR_BYTES;
+    MmapHeader *h = (MmapHeader *)g_map;
+    if (!valid) {
+        // fresh file: ftruncate zero-filled it, so only the header needs writing
+        memcpy(h->magic, MMAP_MAGIC, sizeof(h->magic));
+        h->size = max_bytes;
+        h->cursor = MMAP_HDR_BYTES;
+        h->wraps = 0;
+        h->wrap_at = 0;
+    }
+    // recovery is two loads from the header, whatever the file size
+    g_write_pos = (size_t)h->cursor;
+    g_overwriting = h->wraps > 0;
+
+    g_initialised = 1;
+    pthread_mutex_unlock(&g_lock);
+    return 0;
+}
+
+void log_close(void)
+{
+    async_stop();
+
+    pthread_mutex_lock(&g_lock);
+    close_file_locked();
     g_initialised = 0;
     pthread_mutex_unlock(&g_lock);
 }
@@ -260,177 +640,314 @@ void log_write(LogLevel level, const char *fmt, ...)
     }
     line[total] = '\0';
 
-    // always write to stderr for journal/terminal
-    fputs(line, stderr);
+    // hot path: hand the line to the flusher without touching a lock
+    if (async_push(line, total) == 0) {
+        return;
+    }
 
-    // write to circular file if initialised
     pthread_mutex_lock(&g_lock);
-    if (!g_fp) {
-        pthread_mutex_unlock(&g_lock);
-        return;
+    // queued lines go first so the file keeps their order
+    async_drain_locked();
+    struct iovec one = {.iov_base = line, .iov_len = total};
+    emit_lines(&one, 1);
+    pthread_mutex_unlock(&g_lock);
+}
+
+// reading
+
+/* a log file seen in logical order: the older part after the marker, then
+ * the newer part before it. offsets into the view are "logical"; either
+ * part may be empty.
+ */
+typedef struct {
+    int fd;
+    uint64_t start[2];
+    uint64_t end[2];
+} LogView;
+
+static int view_open(const char *path, LogView *v)
+{
+    v->fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (v->fd < 0) {
+        fprintf(stderr, "tgbot: cannot open log file: %s: %s\n", path, strerror(errno));
+        return -1;
     }
+    struct stat st;
+    if (fstat(v->fd, &st) != 0 || st.st_size <= 0) {
+        close(v->fd);
+        fprintf(stderr, "tgbot: log file is empty\n");
+        return -1;
+    }
+    uint64_t size = (uint64_t)st.st_size;
 
-    size_t line_len = total;
+    // an mmap log says where its data ends and its marker is
+    MmapHeader h;
+    if (pread(v->fd, &h, sizeof(h), 0) == (ssize_t)sizeof(h) &&
+        mmap_header_valid(&h, (size_t)size)) {
+        v->start[1] = MMAP_HDR_BYTES;
+        v->end[1] = h.cursor;
+        v->start[0] = h.cursor + MARKER_LEN;
+        v->end[0] = h.wraps > 0 && h.wrap_at > v->start[0] ? h.wrap_at : v->start[0];
+        return 0;
+    }
 
-    // ensure a single line can never exceed (max_bytes - MARKER_LEN)
-    size_t usable = g_max_bytes - MARKER_LEN;
-    if (line_len > usable) {
-        line_len = usable;
+    long marker = find_marker(v->fd, (size_t)size);
+    if (marker >= 0) {
+        v->start[0] = (uint64_t)marker + MARKER_LEN;
+        v->end[0] = size;
+        v->start[1] = 0;
+        v->end[1] = (uint64_t)marker;
+    } else {
+        v->start[0] = v->end[0] = 0;
+        v->start[1] = 0;
+        v->end[1] = size;
     }
+    return 0;
+}
 
-    // check if this line would push us past the cap
-    size_t space_needed = line_len + (g_overwriting ? MARKER_LEN : 0);
-    if (g_write_pos + space_needed > g_max_bytes) {
-        // erase the stale marker before wrapping so only one exists
-        if (g_overwriting && g_write_pos + MARKER_LEN <= g_max_bytes) {
-            char blanks[MARKER_LEN];
-            memset(blanks, ' ', MARKER_LEN - 1);
-            blanks[MARKER_LEN - 1] = '\n';
-            if (fseek(g_fp, (long)g_write_pos, SEEK_SET) == 0) {
-                fwrite(blanks, 1, MARKER_LEN, g_fp);
-            }
+static uint64_t view_len(const LogView *v)
+{
+    return (v->end[0] - v->start[0]) + (v->end[1] - v->start[1]);
+}
+
+// read up to @len bytes at logical offset @at; returns bytes read
+static size_t view_read(const LogView *v, uint64_t at, char *buf, size_t len)
+{
+    size_t done = 0;
+    uint64_t older = v->end[0] - v->start[0];
+    while (done < len) {
+        uint64_t off = at + done;
+        int part = off >= older;
+        uint64_t pos = part ? v->start[1] + (off - older) : v->start[0] + off;
+        if (pos >= v->end[part]) {
+            break;
+        }
+        size_t want = len - done;
+        if (want > v->end[part] - pos) {
+            want = (size_t)(v->end[part] - pos);
         }
-        // wrap to the top
-        g_write_pos = 0;
-        g_overwriting = 1;
+        ssize_t got = pread(v->fd, buf + done, want, (off_t)pos);
+        if (got <= 0) {
+            break;
+        }
+        done += (size_t)got;
     }
+    return done;
+}
 
-    raw_write(line, line_len);
-    write_marker();
+// print the view from logical offset @from to its end
+static void view_print(const LogView *v, uint64_t from)
+{
+    char buf[SCAN_CHUNK];
+    uint64_t len = view_len(v);
+    while (from < len) {
+        size_t got = view_read(v, from, buf, sizeof(buf));
+        if (got == 0) {
+            break;
+        }
+        fwrite(buf, 1, got, stdout);
+        from += got;
+    }
+    fflush(stdout);
+}
 
-    pthread_mutex_unlock(&g_lock);
+// first line start at or after logical offset @at (view_len if none)
+static uint64_t view_line_start(const LogView *v, uint64_t at)
+{
+    char buf[4096]; // lines are short; most calls find the newline here
+    uint64_t len = view_len(v);
+    if (at == 0) {
+        return 0;
+    }
+    uint64_t p = at - 1; // a line starts after a newline
+    while (p < len) {
+        size_t got = view_read(v, p, buf, sizeof(buf));
+        if (got == 0) {
+            break;
+        }
+        const char *nl = memchr(buf, '\n', got);
+        if (nl) {
+            return p + (uint64_t)(nl - buf) + 1;
+        }
+        p += got;
+    }
+    return len;
 }
 
-// reading
+// does @s begin with "[YYYY-MM-DD HH:MM:SS] "?
+static int is_stamp(const char *s)
+{
+    static const char shape[] = "[0000-00-00 00:00:00] ";
+    for (size_t i = 0; i < TIMESTAMP_LEN; i++) {
+        if (shape[i] == '0' ? (s[i] < '0' || s[i] > '9') : s[i] != shape[i]) {
+            return 0;
+        }
+    }
+    return 1;
+}
 
 /**
- * Read the entire log file, reconstruct logical order if wrapped, and return
- * the last n lines via stdout.
+ * Find the first timestamped line at or after logical offset @at.
+ * Lines without a timestamp (a fragment after the marker, or continuation
+ * lines of a multi-line message) are skipped.  Returns 0 and fills @line /
+ * @ts, or -1 if there is none.
  */
-int log_read_last_n(const char *path, int n)
+static int view_stamped_line(const LogView *v, uint64_t at, uint64_t *line, char *ts)
 {
-    if (!path || n <= 0) {
-        return -1;
+    uint64_t len = view_len(v);
+    for (uint64_t p = view_line_start(v, at); p + TIMESTAMP_LEN <= len;
+         p = view_line_start(v, p + 1)) {
+        if (view_read(v, p, ts, TIMESTAMP_LEN) == TIMESTAMP_LEN && is_stamp(ts)) {
+            *line = p;
+            return 0;
+        }
     }
+    return -1;
+}
 
-    FILE *fp = fopen(path, "rb");
-    if (!fp) {
-        fprintf(stderr, "tgbot: cannot open log file: %s: %s\n", path, strerror(errno));
+/**
+ * Print the last n lines by reading backwards from the write cursor in
+ * SCAN_CHUNK pieces; stops as soon as n line breaks have been seen, so the
+ * cost depends on n, not on the file size.
+ */
+int log_read_last_n(const char *path, int n)
+{
+    if (!path || n <= 0) {
         return -1;
     }
 
-    fseek(fp, 0, SEEK_END);
-    long fsize = ftell(fp);
-    if (fsize <= 0) {
-        fclose(fp);
-        fprintf(stderr, "tgbot: log file is empty\n");
+    LogView v;
+    if (view_open(path, &v) != 0) {
         return -1;
     }
-    size_t file_size = (size_t)fsize;
 
-    char *buf = malloc(file_size + 1);
-    if (!buf) {
-        fclose(fp);
-        return -1;
-    }
-    fseek(fp, 0, SEEK_SET);
-    size_t got = fread(buf, 1, file_size, fp);
-    fclose(fp);
-    buf[got] = '\0';
-
-    // find marker to determine logical order
-    const char *logical_start;
-    size_t logical_len;
-    const char *marker_pos = NULL;
-
-    // scan for marker
-    const char *p = buf;
-    const char *end = buf + got;
-    while (p <= end - MARKER_LEN) {
-        if (memcmp(p, MARKER, MARKER_LEN) == 0) {
-            marker_pos = p;
-            break;
-        }
-        const char *nl = memchr(p, '\n', (size_t)(end - p));
-        if (!nl) {
+    char buf[SCAN_CHUNK];
+    uint64_t len = view_len(&v);
+    uint64_t start = 0;
+    uint64_t pos = len;
+    int found = 0;
+    while (pos > 0 && found < n) {
+        size_t chunk = pos > SCAN_CHUNK ? SCAN_CHUNK : (size_t)pos;
+        uint64_t at = pos - chunk;
+        if (view_read(&v, at, buf, chunk) != chunk) {
             break;
         }
-        p = nl + 1;
-    }
-
-    /*
-     * if marker found the logical order is: [marker+MARKER_LEN .. EOF] then [0 .. marker)
-     * (skip the marker itself)
-     */
-    char *ordered = NULL;
-    if (marker_pos) {
-        size_t after_marker = got - (size_t)(marker_pos - buf) - MARKER_LEN;
-        size_t before_marker = (size_t)(marker_pos - buf);
-        logical_len = after_marker + before_marker;
-        ordered = malloc(logical_len + 1);
-        if (!ordered) {
-            free(buf);
-            return -1;
+        size_t i = chunk;
+        char *nl;
+        while (found < n && (nl = memrchr(buf, '\n', i)) != NULL) {
+            i = (size_t)(nl - buf);
+            // the newline ending the newest line does not start a line
+            if (at + i + 1 < len && ++found == n) {
+                start = at + i + 1;
+            }
         }
-        memcpy(ordered, marker_pos + MARKER_LEN, after_marker);
-        memcpy(ordered + after_marker, buf, before_marker);
-        ordered[logical_len] = '\0';
-        logical_start = ordered;
-    } else {
-        logical_start = buf;
-        logical_len = got;
+        pos = at;
     }
 
-    // collect line offsets (pointers into logical_start)
-    int capacity = 256;
-    const char **lines = malloc((size_t)capacity * sizeof(const char *));
-    if (!lines) {
-        free(ordered);
-        free(buf);
+    view_print(&v, start);
+    close(v.fd);
+    return 0;
+}
+
+/**
+ * Print every line stamped within the last @seconds.  Timestamps grow in
+ * logical order, so a binary search over them finds the first such line
+ * with O(log size) small reads - the lines' own stamps are the index.
+ */
+int log_read_since(const char *path, long seconds)
+{
+    if (!path || seconds < 0) {
         return -1;
     }
-    int line_count = 0;
 
-    const char *lp = logical_start;
-    const char *lend = logical_start + logical_len;
-    while (lp < lend) {
-        // skip empty/partial lines at the very beginning (from overwrite)
-        if (*lp == '\0') {
-            lp++;
-            continue;
-        }
-        if (line_count >= capacity) {
-            capacity *= 2;
-            const char **tmp = realloc(lines, (size_t)capacity * sizeof(const char *));
-            if (!tmp) {
-                break;
-            }
-            lines = tmp;
-        }
-        lines[line_count++] = lp;
-        const char *nl = memchr(lp, '\n', (size_t)(lend - lp));
-        if (nl) {
-            lp = nl + 1;
+    LogView v;
+    if (view_open(path, &v) != 0) {
+        return -1;
+    }
+
+    char want[TIMESTAMP_BUF];
+    struct timespec now;
+    clock_gettime(CLOCK_REALTIME, &now);
+    fmt_stamp(want, sizeof(want), now.tv_sec - (time_t)seconds);
+
+    // lowest offset whose next stamped line is recent enough (or has none)
+    char ts[TIMESTAMP_LEN];
+    uint64_t line;
+    uint64_t lo = 0;
+    uint64_t hi = view_len(&v);
+    while (lo < hi) {
+        uint64_t mid = lo + (hi - lo) / 2;
+        if (view_stamped_line(&v, mid, &line, ts) != 0 ||
+            memcmp(ts, want, TIMESTAMP_LEN) >= 0) {
+            hi = mid;
         } else {
-            break;
+            lo = line + 1;
         }
     }
 
-    // print last n lines
-    int start = line_count - n;
-    if (start < 0) {
-        start = 0;
+    if (view_stamped_line(&v, lo, &line, ts) == 0) {
+        view_print(&v, line);
     }
-    for (int i = start; i < line_count; i++) {
-        const char *line = lines[i];
-        const char *nl = memchr(line, '\n', (size_t)(lend - line));
-        size_t len = nl ? (size_t)(nl - line + 1) : strlen(line);
-        fwrite(line, 1, len, stdout);
+    close(v.fd);
+    return 0;
+}
+
+// print bytes [from, to) of an mmap log to stdout
+static void follow_print(int fd, uint64_t from, uint64_t to)
+{
+    char read_buf[8192];
+    while (from < to) {
+        size_t chunk = to - from > sizeof(read_buf) ? sizeof(read_buf) : (size_t)(to - from);
+        ssize_t got = pread(fd, read_buf, chunk, (off_t)from);
+        if (got <= 0) {
+            break;
+        }
+        fwrite(read_buf, 1, (size_t)got, stdout);
+        from += (uint64_t)got;
     }
+    fflush(stdout);
+}
+
+/**
+ * Follow an mmap log by polling its header cursor: stores into the mapping
+ * raise no inotify events.  Blocks until SIGINT / SIGTERM.
+ */
+static int follow_mmap(int fd, const MmapHeader *start)
+{
+    uint64_t last = start->cursor;
+    uint64_t wraps = start->wraps;
 
-    free(lines);
-    free(ordered);
-    free(buf);
+    sigset_t mask, oldmask;
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGINT);
+    sigaddset(&mask, SIGTERM);
+
+    for (;;) {
+        struct timespec ts = {.tv_sec = 0, .tv_nsec = FOLLOW_POLL_MS * 1000000L};
+        sigprocmask(SIG_BLOCK, &mask, &oldmask);
+        int ret = pselect(0, NULL, NULL, NULL, &ts, &oldmask);
+        sigprocmask(SIG_UNBLOCK, &mask, NULL);
+        if (ret < 0) {
+            break; // signal received - clean exit
+        }
+
+        MmapHeader h;
+        if (pread(fd, &h, sizeof(h), 0) != (ssize_t)sizeof(h)) {
+            break;
+        }
+        if (h.wraps == wraps + 1) {
+            // finish the lap we were on, then start again at the top
+            follow_print(fd, last, h.wrap_at);
+            last = MMAP_HDR_BYTES;
+        } else if (h.wraps != wraps) {
+            last = MMAP_HDR_BYTES; // lapped more than once; show only the newest
+        }
+        wraps = h.wraps;
+        if (h.cursor > last) {
+            follow_print(fd, last, h.cursor);
+        }
+        last = h.cursor;
+    }
     return 0;
 }
 
@@ -440,6 +957,19 @@ int log_follow(const char *path)
         return -1;
     }
 
+    int mfd = open(path, O_RDONLY | O_CLOEXEC);
+    if (mfd >= 0) {
+        struct stat st;
+        MmapHeader h;
+        if (fstat(mfd, &st) == 0 && pread(mfd, &h, sizeof(h), 0) == (ssize_t)sizeof(h) &&
+            mmap_header_valid(&h, (size_t)st.st_size)) {
+            int rc = follow_mmap(mfd, &h);
+            close(mfd);
+            return rc;
+        }
+        close(mfd);
+    }
+
     int ifd = inotify_init1(IN_CLOEXEC);
     if (ifd < 0) {
         fprintf(stderr, "tgbot: inotify_init failed: %s\n", strerror(errno));
@@ -20,7 +20,32 @@ typedef enum {
 int log_init(const char *path, size_t max_bytes);
 
 /**
- * Flush and close the log file, destroy the internal mutex.
+ * Like log_init, but the file is a fixed @max_bytes mapping written by
+ * memcpy, with a small header holding the write cursor and wrap count, so
+ * reopening recovers the position in O(1) without reading the data.
+ * An existing file that is not an mmap log of the same size is renamed to
+ * @path.1 and a fresh one is created.  Returns 0 on success, -1 on error.
+ */
+int log_init_mmap(const char *path, size_t max_bytes);
+
+/**
+ * Switch to asynchronous logging: log_write only formats the line and
+ * publishes it into a lock-free ring of @slots cells (rounded up to a power
+ * of two); a background thread writes batches to stderr and the file.
+ * Lines too long for a cell, or written while the ring is full, fall back to
+ * the synchronous path after draining what is queued, so nothing is dropped
+ * and the file keeps its order.  Returns 0 on success, -1 on error.
+ */
+int log_start_async(size_t slots);
+
+/**
+ * Write out every line queued by async mode.  No-op in synchronous mode.
+ */
+void log_flush(void);
+
+/**
+ * Stop the async flusher (draining its ring), then flush and close the log
+ * file.  Call after every other logging thread has stopped.
  * Safe to call even if log_init was never called (no-op).
  */
 void log_close(void);
@@ -34,7 +59,8 @@ void log_set_level(LogLevel level);
 /**
  * Write a formatted log line.  Thread-safe.
  * The line is written both to the circular log file AND to stderr so that
- * systemd journal / terminal output works out of the box.
+ * systemd journal / terminal output works out of the box - directly, or by
+ * the flusher thread within ~50 ms once log_start_async has been called.
  *
  * If log_init has not been called yet, the line goes to stderr only.
  */
@@ -43,10 +69,18 @@ void log_write(LogLevel level, const char *fmt, ...);
 
 /**
  * Read the log file at @path (respecting circular layout) and print the last
- * @n lines to stdout.  Returns 0 on success, -1 on error.
+ * @n lines to stdout.  Reads backwards from the write cursor and stops once
+ * @n lines are found.  Returns 0 on success, -1 on error.
  */
 int log_read_last_n(const char *path, int n);
 
+/**
+ * Print every line of the log file at @path stamped within the last
+ * @seconds, found by binary search over the line timestamps.
+ * Returns 0 on success, -1 on error.
+ */
+int log_read_since(const char *path, long seconds);
+
 /**
  * Tail-follow the log file using inotify.  Blocks until SIGINT / SIGTERM.
  * Returns 0 on clean exit, -1 on error.
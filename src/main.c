@@ -2,21 +2,36 @@
 #define _DEFAULT_SOURCE
 
 #include "bot.h"
+#include "budget.h"
+#include "cache.h"
 #include "cfg.h"
 #include "cli.h"
+#include "cluster.h"
 #include "commands.h"
 #include "config.h"
+#include "context.h"
+#include "http.h"
 #include "llm.h"
+#include "llmpool.h"
+#include "metrics.h"
+#include "poller.h"
 #include "logger.h"
+#include "qjournal.h"
 #include "queue.h"
+#include "ratelimit.h"
+#include "trace.h"
+#include "typing.h"
+#include "update.h"
+#include "warmup.h"
 #include "webhook.h"
 #include "whitelist.h"
 
 #include <curl/curl.h>
-#include <errno.h>
 #include <inttypes.h>
 #include <pthread.h>
 #include <signal.h>
+#include <stdatomic.h>
+#include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -28,6 +43,7 @@ static volatile sig_atomic_t g_running = 1;
 static Config g_cfg;
 static char g_bot_username[128];
 static double g_boot_time;
+static int g_copy; // this process's index under [cluster] procs > 1, else 0
 
 static void on_signal(int sig)
 {
@@ -35,18 +51,54 @@ static void on_signal(int sig)
     g_running = 0;
 }
 
+static void on_dump_signal(int sig)
+{
+    (void)sig;
+    trace_request_dump();
+}
+
+// the typing thread's sender; ud is its own send-only handle
+static int send_typing(int64_t chat_id, void *ud)
+{
+    return bot_send_chat_action_async((BotHandle *)ud, chat_id, "typing");
+}
+
 // worker thread
 typedef struct {
     int id;
     const char *token;
-    int reply_delay;
+    const char *api_base;
     volatile sig_atomic_t *running;
     const char *llm_endpoint;
     const char *llm_model;
     int llm_max_tokens;
     const char *llm_system_prompt;
+    int llm_stream;
+    double llm_stream_interval;
+    int llm_context;
+    int llm_context_window;
+    int llm_cache;
+    const char *busy_reply; // sent for shed messages, "" = none
+    double idle_sec; // retire after this long without work (0 = never)
 } WorkerArg;
 
+/* the worker pool; a worker's slot is its id, and so its home queue shard
+ * (the queue has one per slot, so a pool at its floor steals the others')
+ * with [workers] max above min a scaler thread adds workers under queue
+ * pressure, and workers above min retire themselves once idle
+ */
+static struct {
+    pthread_mutex_t lock;
+    pthread_t threads[WORKERS_MAX];
+    bool used[WORKERS_MAX];          // slot holds a thread not yet joined
+    atomic_bool exited[WORKERS_MAX]; // ...which has returned
+    int live;                        // workers neither retiring nor exited
+    _Atomic double max_wait;         // longest queue wait picked up since the last tick
+    atomic_bool stop;
+    bool scaling;
+    pthread_t scaler;
+} g_pool = {.lock = PTHREAD_MUTEX_INITIALIZER};
+
 static double monotonic_sec(void)
 {
     struct timespec ts;
@@ -54,75 +106,780 @@ static double monotonic_sec(void)
     return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
 }
 
+// progressive edit target for a streamed reply
+typedef struct {
+    BotHandle *bot;
+    int64_t chat_id;
+    int64_t message_id;
+    char shown[4096]; // text currently displayed, trailing whitespace trimmed
+} StreamEdit;
+
+static void on_stream_progress(void *ud, const char *text, size_t len)
+{
+    StreamEdit *se = (StreamEdit *)ud;
+    if (se->message_id == 0) {
+        return;
+    }
+    // telegram trims messages, so trim here too to keep edits comparable
+    while (len > 0 && (text[len - 1] == ' ' || text[len - 1] == '\n' ||
+                       text[len - 1] == '\t' || text[len - 1] == '\r')) {
+        len--;
+    }
+    if (len == 0 || len >= sizeof(se->shown) ||
+        (strlen(se->shown) == len && memcmp(se->shown, text, len) == 0)) {
+        return;
+    }
+    // skip an edit that would have to wait for the rate governor; the next
+    // one carries this text too, and the final reply is not held behind it
+    if (ratelimit_peek(se->chat_id) > 0.0) {
+        return;
+    }
+    char next[sizeof(se->shown)];
+    memcpy(next, text, len);
+    next[len] = '\0';
+    if (bot_edit_message_text(se->bot, se->chat_id, se->message_id, next) == 0) {
+        memcpy(se->shown, next, len + 1);
+    }
+}
+
+// earlier turns of msg's chat that fit beside it and b's reply in the context window
+static int history_for(const WorkerArg *wa, const QueueMsg *msg, const Budget *b, LlmMsg *hist,
+                       char *buf, size_t cap)
+{
+    if (!wa->llm_context || !buf) {
+        return 0;
+    }
+    int budget = wa->llm_context_window - b->max_tokens -
+                 context_estimate_tokens(strlen(wa->llm_system_prompt)) -
+                 context_estimate_tokens(msg->len);
+    int n = context_get(msg->chat_id, budget, hist, CONTEXT_MSGS_MAX, buf, cap);
+    return n > 0 ? n : 0;
+}
+
+// record a successful reply in the chat history and the response cache
+static void remember_reply(const WorkerArg *wa, const QueueMsg *msg, const Budget *b, int n_hist,
+                           const char *reply)
+{
+    if (wa->llm_context) {
+        context_add_turn(msg->chat_id, msg->text, reply);
+    }
+    // with history the reply depends on more than the prompt
+    if (wa->llm_cache && n_hist == 0) {
+        cache_store(b->model, wa->llm_system_prompt, msg->text, b->max_tokens, reply);
+    }
+}
+
+// a cached reply to msg; a full-budget one is as good under load as one cut short
+static int cached_reply(const WorkerArg *wa, const QueueMsg *msg, const Budget *b, char *out,
+                        size_t cap)
+{
+    if (cache_lookup(wa->llm_model, wa->llm_system_prompt, msg->text, wa->llm_max_tokens, out,
+                     cap) == 0) {
+        return 0;
+    }
+    if (b->max_tokens == wa->llm_max_tokens && b->model == wa->llm_model) {
+        return -1;
+    }
+    return cache_lookup(b->model, wa->llm_system_prompt, msg->text, b->max_tokens, out, cap);
+}
+
+/* the worker is finished with msg: its journal records go, unless shutdown
+ * cut the send short - then the next start answers it instead
+ */
+static void msg_finished(const WorkerArg *wa, QueueMsg *msg, int send_rc)
+{
+    if (send_rc == 0 || *wa->running) {
+        queue_msg_done(msg);
+    }
+}
+
+// a finished reply in flight on the HTTP engine, and the records it answers
+typedef struct {
+    volatile sig_atomic_t *running;
+    int64_t user_id;
+    int64_t chat_id;
+    TraceCtx tr; // committed once the send ends
+    double t0;   // when the send was handed over
+    char *text;  // after jseq
+    int jseqs;
+    uint64_t jseq[];
+} ReplySent;
+
+/* how the send of a finished reply ended (HTTP engine thread): acked as
+ * msg_finished would; a 429 goes back to the lane as a literal reply, with
+ * a record of its own, for the governor to pace. the send span ends here
+ */
+static void reply_sent(int rc, void *ud)
+{
+    ReplySent *rs = ud;
+    trace_stage(&rs->tr, TRACE_SEND, rs->t0, monotonic_sec());
+    trace_commit(&rs->tr);
+    if (rc == BOT_SEND_RETRY && *rs->running) {
+        if (queue_push_reply(rs->user_id, rs->chat_id, rs->text, QUEUE_REPLY, 0) == 0) {
+            rc = 0;
+        } else {
+            log_warn("tgbot: reply to chat %" PRId64 " rate-limited and not requeued",
+                     rs->chat_id);
+        }
+    }
+    if (rc == 0 || *rs->running) {
+        for (int i = 0; i < rs->jseqs; i++) {
+            qjournal_ack(rs->jseq[i]);
+        }
+    }
+    free(rs);
+}
+
+/* send the reply that finishes msg without holding the worker for the
+ * round trip; msg's journal records are acked, and tr committed with its
+ * send span, once it is delivered
+ */
+static void send_final(const WorkerArg *wa, BotHandle *bot, QueueMsg *msg, const char *text,
+                       TraceCtx *tr)
+{
+    double t0 = monotonic_sec();
+    size_t len = strlen(text);
+    size_t seqs = (size_t)msg->jseqs * sizeof(uint64_t);
+    ReplySent *rs = malloc(sizeof(*rs) + seqs + len + 1);
+    if (!rs) {
+        msg_finished(wa, msg, bot_send_message(bot, msg->chat_id, text));
+        trace_stage(tr, TRACE_SEND, t0, monotonic_sec());
+        trace_commit(tr);
+        return;
+    }
+    rs->running = wa->running;
+    rs->user_id = msg->user_id;
+    rs->chat_id = msg->chat_id;
+    rs->tr = *tr;
+    rs->t0 = t0;
+    rs->jseqs = msg->jseqs;
+    memcpy(rs->jseq, msg->jseq, seqs);
+    rs->text = (char *)rs->jseq + seqs;
+    memcpy(rs->text, text, len + 1);
+    msg->jseqs = 0; // the records are rs's to ack now
+    bot_send_message_then(bot, msg->chat_id, text, reply_sent, rs);
+}
+
+/* stream the reply into a placeholder message, editing it as tokens arrive,
+ * and finish msg: the final text is an edit, or a send_final when there is
+ * no placeholder to edit
+ */
+static void reply_streamed(const WorkerArg *wa, BotHandle *bot, LlmHandle *llm, QueueMsg *msg,
+                           const Budget *b, const LlmMsg *hist, int n_hist, TraceCtx *tr)
+{
+    StreamEdit se = {.bot = bot, .chat_id = msg->chat_id};
+    double t0 = monotonic_sec();
+    if (bot_send_message_id(bot, msg->chat_id, "\xE2\x9C\x8D Thinking...", &se.message_id) != 0) {
+        se.message_id = 0;
+    }
+
+    char reply[4096];
+    double t1 = monotonic_sec();
+    trace_stage(tr, TRACE_THINKING, t0, t1);
+    if (llm_chat_stream_ctx(llm, wa->llm_system_prompt, hist, n_hist, msg->text,
+                            reply, sizeof(reply), b->max_tokens,
+                            wa->llm_stream_interval, on_stream_progress, &se) != 0) {
+        if (!*wa->running) {
+            trace_commit(tr);
+            return; // cut short by shutdown: answered after the restart
+        }
+        metrics_add(MET_LLM_ERRORS, 1);
+        snprintf(reply, sizeof(reply), "Hello! You said: %s", msg->text);
+    } else {
+        metrics_observe(MET_LLM, monotonic_sec() - t1);
+        budget_observe(monotonic_sec() - t1);
+        remember_reply(wa, msg, b, n_hist, reply);
+    }
+
+    // the progressive edits ride inside the LLM span
+    t0 = monotonic_sec();
+    trace_stage(tr, TRACE_LLM, t1, t0);
+    // the placeholder may be gone; then the reply goes as a new message
+    if (se.message_id == 0 ||
+        (strcmp(se.shown, reply) != 0 &&
+         bot_edit_message_text(bot, msg->chat_id, se.message_id, reply) != 0)) {
+        send_final(wa, bot, msg, reply, tr);
+        return;
+    }
+    trace_stage(tr, TRACE_SEND, t0, monotonic_sec());
+    trace_commit(tr);
+    msg_finished(wa, msg, 0);
+}
+
+// an idle worker may leave while the pool is above its floor
+static bool pool_retire(void)
+{
+    pthread_mutex_lock(&g_pool.lock);
+    bool retire = g_pool.live > g_cfg.worker_min;
+    if (retire) {
+        g_pool.live--;
+    }
+    pthread_mutex_unlock(&g_pool.lock);
+    return retire;
+}
+
+// last act of a worker thread; the scaler or shutdown joins it
+static void pool_exited(int id, bool retired)
+{
+    pthread_mutex_lock(&g_pool.lock);
+    if (!retired) {
+        g_pool.live--;
+    }
+    atomic_store(&g_pool.exited[id], true);
+    pthread_mutex_unlock(&g_pool.lock);
+}
+
+static void pool_note_wait(double wait)
+{
+    double seen = atomic_load_explicit(&g_pool.max_wait, memory_order_relaxed);
+    while (wait > seen && !atomic_compare_exchange_weak(&g_pool.max_wait, &seen, wait)) {
+    }
+}
+
+static int pool_live(void)
+{
+    pthread_mutex_lock(&g_pool.lock);
+    int n = g_pool.live;
+    pthread_mutex_unlock(&g_pool.lock);
+    return n;
+}
+
+// a message a worker has taken, from the pop until its reply is handed over
+enum { ITEM_FREE, ITEM_WAITING, ITEM_LLM, ITEM_DONE };
+
+typedef struct WorkItem {
+    struct WorkItem *next; // taken after it
+    int state;             // under WorkList.lock: the engine marks it done
+    QueueMsg msg;
+    TraceCtx tr;
+    Budget b;
+    int n_hist;
+    double t0; // the LLM call started
+    double t1; // ...and ended
+    int llm_rc;
+    struct WorkList *wl;
+    char reply[4096];
+} WorkItem;
+
+/* what a worker holds, oldest first: prompts whose completion is on the
+ * HTTP engine, and messages waiting behind one of those for the same chat
+ */
+typedef struct WorkList {
+    pthread_mutex_t lock;
+    pthread_cond_t cond; // a completion came in
+    WorkItem *head;
+    WorkItem *tail;
+    int n;
+    WorkItem items[LLM_WORKER_INFLIGHT];
+} WorkList;
+
+// a worker thread's handles and scratch space
+typedef struct {
+    const WorkerArg *wa;
+    BotHandle *bot;
+    LlmHandle *llm;
+    const char *llm_model; // what llm sends now
+    // the history copied out of the context store, until the request is encoded
+    LlmMsg hist[CONTEXT_MSGS_MAX];
+    char *hist_buf;
+    size_t hist_cap;
+    WorkList *wl;
+} Worker;
+
+// engine thread: the completion for it came in
+static void item_llm_done(int rc, void *ud)
+{
+    WorkItem *it = ud;
+    double t1 = monotonic_sec();
+    pthread_mutex_lock(&it->wl->lock);
+    it->llm_rc = rc;
+    it->t1 = t1;
+    it->state = ITEM_DONE;
+    pthread_cond_signal(&it->wl->cond);
+    pthread_mutex_unlock(&it->wl->lock);
+}
+
+// fall back to echo; unless shutdown cut it short, left for the restart then
+static void send_echo(Worker *w, WorkItem *it)
+{
+    if (!*w->wa->running) {
+        trace_commit(&it->tr);
+        return;
+    }
+    char echo[sizeof(it->reply)];
+    snprintf(echo, sizeof(echo), "Hello! You said: %s", it->msg.text);
+    send_final(w->wa, w->bot, &it->msg, echo, &it->tr);
+}
+
+// the completion for it is in: send the reply, or the echo if there is none
+static void item_finish(Worker *w, WorkItem *it)
+{
+    trace_stage(&it->tr, TRACE_LLM, it->t0, it->t1);
+    // before the send, so no refresh can land after the reply
+    typing_end(it->msg.chat_id);
+    if (it->llm_rc != 0) {
+        metrics_add(MET_LLM_ERRORS, 1);
+        send_echo(w, it);
+        return;
+    }
+    metrics_observe(MET_LLM, it->t1 - it->t0);
+    budget_observe(it->t1 - it->t0);
+    send_final(w->wa, w->bot, &it->msg, it->reply, &it->tr);
+    remember_reply(w->wa, &it->msg, &it->b, it->n_hist, it->reply);
+}
+
+/* start answering it; returns true if its completion is now on the engine,
+ * false once it is finished (literal, cached and streamed replies, and the
+ * blocking fallback when the engine is off)
+ */
+static bool item_start(Worker *w, WorkItem *it)
+{
+    const WorkerArg *wa = w->wa;
+    QueueMsg *msg = &it->msg;
+
+    // waited past max_queue_age_sec: not worth an LLM call any more
+    if (msg->kind == QUEUE_EXPIRED) {
+        metrics_add(MET_QUEUE_SHED, (uint64_t)msg->merged);
+        log_debug("worker %d: shed %d stale message(s) from user %" PRId64, wa->id,
+                  msg->merged, msg->user_id);
+        if (wa->busy_reply[0]) {
+            send_final(wa, w->bot, msg, wa->busy_reply, &it->tr);
+        } else {
+            msg_finished(wa, msg, 0);
+            trace_commit(&it->tr);
+        }
+        return false;
+    }
+
+    // literal replies from commands: no LLM, indicator, cache or context
+    if (msg->kind != QUEUE_PROMPT) {
+        send_final(wa, w->bot, msg, msg->text, &it->tr);
+        return false;
+    }
+
+    if (msg->merged > 1) {
+        log_debug("worker %d: coalesced %d messages from user %" PRId64,
+                  wa->id, msg->merged, msg->user_id);
+    }
+
+    // the deeper the backlog behind this prompt, the shorter its reply
+    Budget *b = &it->b;
+    budget_pick(queue_depth(), b);
+    if (!b->model) {
+        b->model = wa->llm_model;
+    }
+    if (w->llm && b->model != w->llm_model) {
+        llm_set_model(w->llm, b->model);
+        w->llm_model = b->model;
+    }
+    it->n_hist = w->llm ? history_for(wa, msg, b, w->hist, w->hist_buf, w->hist_cap) : 0;
+
+    // a repeated prompt is answered from memory, without an indicator
+    if (w->llm && wa->llm_cache && it->n_hist == 0 &&
+        cached_reply(wa, msg, b, it->reply, sizeof(it->reply)) == 0) {
+        send_final(wa, w->bot, msg, it->reply, &it->tr);
+        if (wa->llm_context) {
+            context_add_turn(msg->chat_id, msg->text, it->reply);
+        }
+        return false;
+    }
+
+    if (!w->llm) {
+        send_echo(w, it);
+        return false;
+    }
+
+    if (wa->llm_stream) {
+        reply_streamed(wa, w->bot, w->llm, msg, b, w->hist, it->n_hist, &it->tr);
+        return false;
+    }
+
+    // "typing..." shows while the LLM works, unless the reply is quick
+    typing_begin(msg->chat_id);
+    it->state = ITEM_LLM;
+    it->t0 = monotonic_sec();
+    if (llm_chat_submit(w->llm, wa->llm_system_prompt, w->hist, it->n_hist, msg->text,
+                        it->reply, sizeof(it->reply), b->max_tokens, item_llm_done, it) == 0) {
+        return true;
+    }
+    // no engine: generated on this thread
+    it->llm_rc = llm_chat_ctx(w->llm, wa->llm_system_prompt, w->hist, it->n_hist, msg->text,
+                              it->reply, sizeof(it->reply), b->max_tokens);
+    it->t1 = monotonic_sec();
+    item_finish(w, it);
+    return false;
+}
+
+// a slot for the next pop; the caller has checked there is room
+static WorkItem *work_slot(WorkList *wl)
+{
+    WorkItem *it = NULL;
+    pthread_mutex_lock(&wl->lock);
+    for (int i = 0; i < LLM_WORKER_INFLIGHT && !it; i++) {
+        if (wl->items[i].state == ITEM_FREE) {
+            it = &wl->items[i];
+        }
+    }
+    pthread_mutex_unlock(&wl->lock);
+    return it;
+}
+
+static void work_add(WorkList *wl, WorkItem *it)
+{
+    it->state = ITEM_WAITING;
+    it->next = NULL;
+    if (wl->tail) {
+        wl->tail->next = it;
+    } else {
+        wl->head = it;
+    }
+    wl->tail = it;
+    wl->n++;
+}
+
+/* move each chat's oldest item on: start it while it waits, finish it once
+ * its completion is in. later items for that chat stay behind it, so its
+ * replies go out, and prompts see its context, in the order they came
+ */
+static void work_advance(Worker *w)
+{
+    WorkList *wl = w->wl;
+    WorkItem *prev = NULL;
+    WorkItem *it = wl->head;
+    while (it) {
+        bool first = true;
+        for (WorkItem *e = wl->head; e != it && first; e = e->next) {
+            first = e->msg.chat_id != it->msg.chat_id;
+        }
+        pthread_mutex_lock(&wl->lock);
+        int state = it->state;
+        pthread_mutex_unlock(&wl->lock);
+        bool gone = false;
+        if (first && state == ITEM_WAITING) {
+            gone = !item_start(w, it);
+        } else if (first && state == ITEM_DONE) {
+            item_finish(w, it);
+            gone = true;
+        }
+        WorkItem *next = it->next;
+        if (gone) {
+            if (prev) {
+                prev->next = next;
+            } else {
+                wl->head = next;
+            }
+            if (wl->tail == it) {
+                wl->tail = prev;
+            }
+            pthread_mutex_lock(&wl->lock);
+            it->state = ITEM_FREE;
+            pthread_mutex_unlock(&wl->lock);
+            wl->n--;
+        } else {
+            prev = it;
+        }
+        it = next;
+    }
+}
+
+// sleep until a completion comes in; one is on the engine whenever items are held
+static void work_wait(WorkList *wl)
+{
+    pthread_mutex_lock(&wl->lock);
+    for (;;) {
+        bool done = false;
+        for (WorkItem *it = wl->head; it && !done; it = it->next) {
+            done = it->state == ITEM_DONE;
+        }
+        if (done) {
+            break;
+        }
+        pthread_cond_wait(&wl->cond, &wl->lock);
+    }
+    pthread_mutex_unlock(&wl->lock);
+}
+
+/* the worker is leaving: at shutdown what has not started is left for the
+ * restart; completions on the engine (which the run flag cuts short) are
+ * waited for and finished, and otherwise everything held is answered
+ */
+static void work_close(Worker *w)
+{
+    WorkList *wl = w->wl;
+    while (wl->n > 0) {
+        if (!*w->wa->running) {
+            pthread_mutex_lock(&wl->lock);
+            WorkItem *prev = NULL;
+            for (WorkItem *it = wl->head; it; it = it->next) {
+                if (it->state == ITEM_WAITING) {
+                    if (prev) {
+                        prev->next = it->next;
+                    } else {
+                        wl->head = it->next;
+                    }
+                    it->state = ITEM_FREE;
+                    wl->n--;
+                } else {
+                    prev = it;
+                }
+            }
+            wl->tail = prev;
+            pthread_mutex_unlock(&wl->lock);
+        }
+        work_advance(w);
+        if (wl->n > 0) {
+            work_wait(wl);
+        }
+    }
+}
+
+static WorkList *work_new(void)
+{
+    WorkList *wl = calloc(1, sizeof(*wl));
+    if (!wl) {
+        return NULL;
+    }
+    pthread_mutex_init(&wl->lock, NULL);
+    pthread_cond_init(&wl->cond, NULL);
+    for (int i = 0; i < LLM_WORKER_INFLIGHT; i++) {
+        wl->items[i].wl = wl;
+    }
+    return wl;
+}
+
+static void work_free(WorkList *wl)
+{
+    if (!wl) {
+        return;
+    }
+    for (int i = 0; i < LLM_WORKER_INFLIGHT; i++) {
+        queue_msg_release(&wl->items[i].msg);
+    }
+    pthread_cond_destroy(&wl->cond);
+    pthread_mutex_destroy(&wl->lock);
+    free(wl);
+}
+
 static void *worker_main(void *arg)
 {
     WorkerArg *wa = (WorkerArg *)arg;
-    BotHandle *bot = bot_init_send_only(wa->token);
-    if (!bot) {
+    Worker w = {.wa = wa};
+    w.bot = bot_init_send_only(wa->token);
+    w.wl = work_new();
+    if (!w.bot || !w.wl) {
         log_error("worker %d: failed to init bot handle", wa->id);
+        bot_cleanup(w.bot);
+        work_free(w.wl);
+        pool_exited(wa->id, false);
         free(wa);
         return NULL;
     }
-    bot_set_abort_flag(bot, wa->running);
+    bot_set_api_base(w.bot, wa->api_base);
+    bot_set_abort_flag(w.bot, wa->running);
 
     log_info("worker %d: ready", wa->id);
 
     // each worker gets its own LLM handle (curl is not thread-safe)
-    LlmHandle *llm = llm_init(wa->llm_endpoint, wa->llm_model);
-    if (!llm) {
+    w.llm = llm_init(wa->llm_endpoint, wa->llm_model);
+    if (!w.llm) {
         log_warn("worker %d: LLM init failed - will echo instead", wa->id);
     } else {
-        llm_set_abort_flag(llm, wa->running);
+        llm_set_abort_flag(w.llm, wa->running);
     }
+    w.llm_model = wa->llm_model;
+    w.hist_cap = wa->llm_context ? context_chat_cap() : 0;
+    w.hist_buf = w.hist_cap ? malloc(w.hist_cap) : NULL;
 
-    QueueMsg msg;
-    while (queue_pop(&msg) == 0) {
-        // enforce <=1 msg/s per user: sleep delta
-        double now = monotonic_sec();
-        double delta = now - msg.ingress_sec;
-        double wait = (double)wa->reply_delay - delta;
-        if (wait > 0.0) {
-            struct timespec ts_sleep;
-            ts_sleep.tv_sec = (time_t)wait;
-            ts_sleep.tv_nsec = (long)((wait - (double)ts_sleep.tv_sec) * 1e9);
-            while (nanosleep(&ts_sleep, &ts_sleep) < 0 && errno == EINTR) {
-                if (!*wa->running) {
-                    break;
-                }
+    // the queue enforces reply_delay, so a popped message is always due.
+    // while completions are on the engine the worker takes more messages,
+    // up to LLM_WORKER_INFLIGHT, polling often enough to send what comes in
+    WorkList *wl = w.wl;
+    bool retired = false;
+    for (;;) {
+        work_advance(&w);
+        if (wl->n >= LLM_WORKER_INFLIGHT) {
+            work_wait(wl);
+            continue;
+        }
+        WorkItem *it = work_slot(wl);
+        int rc = wl->n > 0        ? queue_pop_worker_timed(wa->id, &it->msg, WORKER_REAP_SEC)
+                 : wa->idle_sec > 0 ? queue_pop_worker_timed(wa->id, &it->msg, wa->idle_sec)
+                                    : queue_pop_worker(wa->id, &it->msg);
+        if (rc == 1) {
+            if (wl->n > 0) {
+                continue;
             }
-            if (!*wa->running) {
-                llm_cleanup(llm);
-                bot_cleanup(bot);
-                log_info("worker %d: exiting (signal)", wa->id);
-                free(wa);
-                return NULL;
+            retired = pool_retire();
+            if (retired) {
+                log_info("worker %d: idle for %.0fs - retiring", wa->id, wa->idle_sec);
+                break;
             }
+            continue;
         }
-
-        // send acknowledgment while LLM is thinking
-        if (llm) {
-            bot_send_message(bot, msg.chat_id, "\xE2\x9C\x8D Thinking...");
-        }
-
-        // generate reply via LLM or fall back to echo
-        char reply[4096];
-        if (llm && llm_chat(llm, wa->llm_system_prompt, msg.text,
-                            reply, sizeof(reply), wa->llm_max_tokens) == 0) {
-            bot_send_message(bot, msg.chat_id, reply);
-        } else {
-            char echo[1100];
-            snprintf(echo, sizeof(echo), "Hello! You said: %s", msg.text);
-            bot_send_message(bot, msg.chat_id, echo);
+        if (rc != 0 || !*wa->running) {
+            break;
         }
+        // includes the reply_delay the queue holds each message for
+        double picked = monotonic_sec();
+        metrics_observe(MET_QUEUE_WAIT, picked - it->msg.ingress_sec);
+        pool_note_wait(picked - it->msg.ingress_sec);
+        trace_begin(&it->tr, it->msg.trace_id, it->msg.chat_id, it->msg.ingress_sec, wa->id,
+                    it->msg.merged);
+        trace_stage(&it->tr, TRACE_QUEUE, it->msg.ingress_sec, picked);
+        work_add(wl, it);
     }
+    work_close(&w);
 
-    llm_cleanup(llm);
-    bot_cleanup(bot);
+    work_free(wl);
+    free(w.hist_buf);
+    llm_cleanup(w.llm);
+    bot_cleanup(w.bot);
     log_info("worker %d: exiting", wa->id);
+    pool_exited(wa->id, retired);
     free(wa);
     return NULL;
 }
 
+// start a worker in the lowest free slot; each gets a send-only bot handle
+static int spawn_worker(void)
+{
+    pthread_mutex_lock(&g_pool.lock);
+    int id = -1;
+    for (int i = 0; i < g_cfg.worker_max && id < 0; i++) {
+        if (!g_pool.used[i]) {
+            id = i;
+        }
+    }
+    if (id < 0) {
+        pthread_mutex_unlock(&g_pool.lock);
+        return -1;
+    }
+    WorkerArg *wa = calloc(1, sizeof(*wa));
+    if (!wa) {
+        pthread_mutex_unlock(&g_pool.lock);
+        log_error("tgbot: alloc worker arg failed");
+        return -1;
+    }
+    wa->id = id;
+    wa->token = g_cfg.token;
+    wa->api_base = g_cfg.api_base;
+    wa->running = &g_running;
+    wa->llm_endpoint = g_cfg.llm_endpoint;
+    wa->llm_model = g_cfg.llm_model;
+    wa->llm_max_tokens = g_cfg.llm_max_tokens;
+    wa->llm_system_prompt = g_cfg.llm_system_prompt;
+    wa->llm_stream = g_cfg.llm_stream;
+    wa->llm_stream_interval = (double)g_cfg.llm_stream_edit_ms / 1000.0;
+    wa->llm_context = g_cfg.llm_context;
+    wa->llm_context_window = g_cfg.llm_context_window;
+    wa->llm_cache = g_cfg.llm_cache;
+    wa->busy_reply = g_cfg.worker_busy_reply;
+    wa->idle_sec = g_cfg.worker_max > g_cfg.worker_min ? (double)g_cfg.worker_idle_sec : 0;
+    atomic_store(&g_pool.exited[id], false);
+    if (pthread_create(&g_pool.threads[id], NULL, worker_main, wa) != 0) {
+        pthread_mutex_unlock(&g_pool.lock);
+        log_error("tgbot: failed to create worker %d", id);
+        free(wa);
+        return -1;
+    }
+    g_pool.used[id] = true;
+    g_pool.live++;
+    pthread_mutex_unlock(&g_pool.lock);
+    return id;
+}
+
+/* grow the pool while messages pile up: to one worker per grow_depth
+ * queued messages, or by one when a pickup waited past grow_wait_ms
+ * (reply_delay aside). retired workers are joined here
+ */
+static void *scaler_main(void *arg)
+{
+    (void)arg;
+    struct timespec tick = {.tv_sec = 0, .tv_nsec = (long)(WORKER_SCALE_TICK_SEC * 1e9)};
+    while (g_running && !atomic_load(&g_pool.stop)) {
+        nanosleep(&tick, NULL);
+
+        for (int i = 0; i < WORKERS_MAX; i++) {
+            if (g_pool.used[i] && atomic_load(&g_pool.exited[i])) {
+                pthread_join(g_pool.threads[i], NULL);
+                pthread_mutex_lock(&g_pool.lock);
+                g_pool.used[i] = false;
+                pthread_mutex_unlock(&g_pool.lock);
+            }
+        }
+
+        int depth = queue_depth();
+        double wait = atomic_exchange(&g_pool.max_wait, 0.0) - (double)g_cfg.reply_delay;
+        int live = pool_live();
+        int want = live;
+        if (depth > live * g_cfg.worker_grow_depth) {
+            want = (depth + g_cfg.worker_grow_depth - 1) / g_cfg.worker_grow_depth;
+        } else if (g_cfg.worker_grow_wait_ms > 0 &&
+                   wait * 1000.0 > (double)g_cfg.worker_grow_wait_ms) {
+            want = live + 1;
+        }
+        if (want < g_cfg.worker_min) {
+            want = g_cfg.worker_min; // replaces workers that failed to start
+        }
+        if (want > g_cfg.worker_max) {
+            want = g_cfg.worker_max;
+        }
+        if (want > live) {
+            int added = 0;
+            while (live + added < want && spawn_worker() >= 0) {
+                added++;
+            }
+            if (added > 0) {
+                log_info("tgbot: %d queued - grew the pool to %d workers", depth, live + added);
+            }
+        }
+    }
+    return NULL;
+}
+
+// gauges sampled on each /metrics scrape
+static double gauge_queue_depth(void)
+{
+    return (double)queue_depth();
+}
+
+static double gauge_workers(void)
+{
+    return (double)pool_live();
+}
+
+static double gauge_queue_rings(void)
+{
+    return (double)queue_ring_count();
+}
+
+static double gauge_ratelimit_chats(void)
+{
+    RateLimitStats rs;
+    ratelimit_stats(&rs);
+    return (double)rs.chats;
+}
+
+static double gauge_cache_entries(void)
+{
+    CacheStats cs;
+    cache_stats(&cs);
+    return (double)cs.entries;
+}
+
+static void register_gauges(void)
+{
+    metrics_gauge("tgbot_queue_depth", "Messages waiting in the queue.", gauge_queue_depth);
+    metrics_gauge("tgbot_queue_rings", "Users with a message ring allocated.", gauge_queue_rings);
+    metrics_gauge("tgbot_workers", "Worker threads in the pool.", gauge_workers);
+    metrics_gauge("tgbot_ratelimit_chats", "Chats tracked by the send governor.",
+                  gauge_ratelimit_chats);
+    if (g_cfg.llm_cache) {
+        metrics_gauge("tgbot_cache_entries", "Replies held in the response cache.",
+                      gauge_cache_entries);
+    }
+}
+
 static void print_banner(const cJSON *me_root)
 {
     const cJSON *result = cJSON_GetObjectItemCaseSensitive(me_root, "result");
@@ -137,34 +894,32 @@ static void print_banner(const cJSON *me_root)
            cJSON_IsNumber(id) ? (int64_t)id->valuedouble : (int64_t)0);
 }
 
-static int64_t handle_update(Whitelist *wl, const cJSON *update)
+// one copy's share of a rate (0 = not limited stays 0)
+static int split_rate(int rate, int procs)
 {
-    const cJSON *uid_json = cJSON_GetObjectItemCaseSensitive(update, "update_id");
-    if (!cJSON_IsNumber(uid_json)) {
-        return -1;
+    if (rate <= 0 || procs <= 1) {
+        return rate;
     }
-    int64_t update_id = (int64_t)uid_json->valuedouble;
+    return rate / procs > 0 ? rate / procs : 1;
+}
 
-    const cJSON *msg = cJSON_GetObjectItemCaseSensitive(update, "message");
-    if (!msg) {
-        return update_id;
+static int64_t handle_update(Whitelist *wl, const UpdateView *u)
+{
+    if (!u->has_update_id) {
+        return -1;
     }
+    int64_t update_id = u->update_id;
 
-    // extract chat first; cheapest rejection path
-    const cJSON *chat = cJSON_GetObjectItemCaseSensitive(msg, "chat");
-    if (!chat) {
+    // chat first; cheapest rejection path
+    if (!u->has_chat_id) {
         return update_id;
     }
-    const cJSON *chat_id_json = cJSON_GetObjectItemCaseSensitive(chat, "id");
-    if (!cJSON_IsNumber(chat_id_json)) {
-        return update_id;
-    }
-    int64_t chat_id = (int64_t)chat_id_json->valuedouble;
+    int64_t chat_id = u->chat_id;
 
     // home-group gating
     if (g_cfg.home_group_id != 0) {
-        const cJSON *chat_type = cJSON_GetObjectItemCaseSensitive(chat, "type");
-        const char *type_str = cJSON_IsString(chat_type) ? chat_type->valuestring : "private";
+        char type_str[32];
+        update_str_copy(&u->chat_type, type_str, sizeof(type_str), "private");
 
         if ((type_str[0] == 'g' || type_str[0] == 's') && chat_id != g_cfg.home_group_id) {
             // ignore messages from non-home groups
@@ -172,15 +927,23 @@ static int64_t handle_update(Whitelist *wl, const cJSON *update)
         }
     }
 
-    const cJSON *from = cJSON_GetObjectItemCaseSensitive(msg, "from");
-    const cJSON *from_id_json = cJSON_GetObjectItemCaseSensitive(from, "id");
-    if (!cJSON_IsNumber(from_id_json)) {
+    if (!u->has_from_id) {
         return update_id;
     }
-    int64_t from_id = (int64_t)from_id_json->valuedouble;
+    int64_t from_id = u->from_id;
 
-    const cJSON *text_json = cJSON_GetObjectItemCaseSensitive(msg, "text");
-    const char *text = cJSON_IsString(text_json) ? text_json->valuestring : "";
+    /* only now pay for decoding the text, straight into the buffer the queue
+     * hands to a worker; decoding never lengthens the raw JSON string
+     */
+    size_t cap = u->text.p && u->text.len < UPDATE_TEXT_MAX ? u->text.len : UPDATE_TEXT_MAX - 1;
+    MsgBuf *buf = queue_buf_new(cap);
+    if (!buf) {
+        log_warn("tgbot: out of memory for a message from user %" PRId64, from_id);
+        metrics_add(MET_QUEUE_DROPS, 1);
+        return update_id;
+    }
+    buf->len = update_str_copy(&u->text, buf->text, cap + 1, "");
+    const char *text = buf->text;
 
     // command dispatch (runs before whitelist gate for admin cmds)
     if (text[0] == '/') {
@@ -191,41 +954,95 @@ static int64_t handle_update(Whitelist *wl, const cJSON *update)
             .chat_id = chat_id,
             .bot_username = g_bot_username,
             .boot_time = g_boot_time,
-            .worker_count = g_cfg.worker_count,
+            .worker_count = pool_live(),
+            .wl_changed = g_cfg.cluster_procs > 1 ? cluster_whitelist_changed : NULL,
         };
-        if (cmd_dispatch(&ctx, text)) {
+        int handled = cmd_dispatch(&ctx, text);
+        queue_buf_free(buf);
+        if (handled) {
             return update_id;
         }
         // unknown slash command - don't forward to LLM
-        queue_push(from_id, chat_id, "Unknown command. Try /help");
+        if (queue_push_reply(from_id, chat_id, "Unknown command. Try /help", QUEUE_REPLY,
+                             trace_next_id()) != 0) {
+            metrics_add(MET_QUEUE_DROPS, 1);
+        }
         return update_id;
     }
 
+    // defer name lookup - only needed for logging
+    char from_name[256];
+    update_str_copy(&u->first_name, from_name, sizeof(from_name), "?");
+
     // whitelist gate
     if (!whitelist_contains(wl, from_id)) {
-        const cJSON *from_name = cJSON_GetObjectItemCaseSensitive(from, "first_name");
-        log_info("tgbot: ignored user %" PRId64 " (%s) - not whitelisted", from_id,
-               cJSON_IsString(from_name) ? from_name->valuestring : "?");
+        log_info("tgbot: ignored user %" PRId64 " (%s) - not whitelisted", from_id, from_name);
+        queue_buf_free(buf);
         return update_id;
     }
 
-    // defer name lookup - only for whitelisted users
-    const cJSON *from_name = cJSON_GetObjectItemCaseSensitive(from, "first_name");
-    log_info("tgbot: [%" PRId64 "] %s: %s", chat_id,
-           cJSON_IsString(from_name) ? from_name->valuestring : "?", text);
+    log_info("tgbot: [%" PRId64 "] %s: %s", chat_id, from_name, text);
+
+    // in multi-process mode the user's owner copy queues it
+    if (cluster_forward(from_id, chat_id, text)) {
+        queue_buf_free(buf);
+        return update_id;
+    }
 
-    // enqueue user message for worker threads (LLM generates the reply)
-    if (queue_push(from_id, chat_id, text) != 0) {
+    // enqueue user message for worker threads (LLM generates the reply);
+    // the queue owns buf from here on
+    int rc = queue_push_buf(from_id, chat_id, buf, trace_next_id());
+    if (rc < 0) {
         log_warn("tgbot: queue full for user %" PRId64 " - message dropped", from_id);
+    } else if (rc > 0) {
+        log_debug("tgbot: queue full for user %" PRId64 " - oldest message dropped", from_id);
+    }
+    if (rc != 0) {
+        metrics_add(MET_QUEUE_DROPS, 1);
     }
 
     return update_id;
 }
 
-static void webhook_on_update(void *ctx, cJSON *update)
+static void webhook_on_update(void *ctx, const UpdateView *update)
 {
     handle_update((Whitelist *)ctx, update);
-    cJSON_Delete(update);
+}
+
+// full-parse fallback for getUpdates bodies the selective scanner declined
+static int handle_updates_cjson(Whitelist *wl, const char *body, size_t len)
+{
+    cJSON *root = cJSON_ParseWithLength(body, len);
+    if (!cJSON_IsTrue(cJSON_GetObjectItemCaseSensitive(root, "ok"))) {
+        cJSON_Delete(root);
+        return -1;
+    }
+
+    const cJSON *result = cJSON_GetObjectItemCaseSensitive(root, "result");
+    const cJSON *upd = NULL;
+    cJSON_ArrayForEach(upd, result)
+    {
+        UpdateView view;
+        update_view_from_cjson(upd, &view);
+        handle_update(wl, &view);
+    }
+
+    cJSON_Delete(root);
+    return 0;
+}
+
+// dispatch every update of one getUpdates batch
+static void handle_batch(Whitelist *wl, const PollBatch *b)
+{
+    UpdateIter it;
+    if (update_iter_init(&it, b->body, b->len) == 0) {
+        UpdateView view;
+        while (update_iter_next(&it, &view) > 0) {
+            handle_update(wl, &view);
+        }
+    } else {
+        handle_updates_cjson(wl, b->body, b->len);
+    }
 }
 
 int main(int argc, char **argv)
@@ -244,37 +1061,107 @@ int main(int argc, char **argv)
     sigemptyset(&sa.sa_mask);
     sigaction(SIGINT, &sa, NULL);
     sigaction(SIGTERM, &sa, NULL);
+    // SIGUSR1 dumps traces once tracing is up; until then, or without it, it is ignored
+    sa.sa_handler = SIG_IGN;
+    sigaction(SIGUSR1, &sa, NULL);
 
     if (config_load(&g_cfg, "tgbot.ini") != 0) {
         return 1;
     }
     config_dump(&g_cfg);
 
+    // the generation budget curve is checked before anything starts
+    if (budget_init(g_cfg.llm_budget_curve, (double)g_cfg.llm_budget_slow_ms / 1000.0,
+                    g_cfg.llm_fallback_model, g_cfg.llm_max_tokens) != 0) {
+        fprintf(stderr, "tgbot: invalid [llm] budget_curve\n");
+        return 1;
+    }
+
+    // fork the copies before any thread exists; the supervisor only restarts them
+    if (g_cfg.cluster_procs > 1) {
+        g_copy = cluster_spawn(g_cfg.cluster_procs, &g_running);
+        if (g_copy < 0) {
+            return 0;
+        }
+        if (g_copy > 0) {
+            // copy 0 keeps the configured names
+            char base[256];
+            snprintf(base, sizeof(base), "%s", g_cfg.log_path);
+            snprintf(g_cfg.log_path, sizeof(g_cfg.log_path), "%.200s.%d", base, g_copy);
+            snprintf(base, sizeof(base), "%s", g_cfg.trace_path);
+            snprintf(g_cfg.trace_path, sizeof(g_cfg.trace_path), "%.200s.%d", base, g_copy);
+            if (g_cfg.worker_journal_path[0]) {
+                snprintf(base, sizeof(base), "%s", g_cfg.worker_journal_path);
+                snprintf(g_cfg.worker_journal_path, sizeof(g_cfg.worker_journal_path), "%.200s.%d",
+                         base, g_copy);
+            }
+        }
+    }
+
     // init logger (stderr-only until this point - safe)
-    if (log_init(g_cfg.log_path, (size_t)g_cfg.log_max_size_mb * 1024UL * 1024UL) != 0) {
+    size_t log_bytes = (size_t)g_cfg.log_max_size_mb * 1024UL * 1024UL;
+    int log_rc = g_cfg.log_mmap ? log_init_mmap(g_cfg.log_path, log_bytes)
+                                : log_init(g_cfg.log_path, log_bytes);
+    if (log_rc != 0) {
         fprintf(stderr, "tgbot: failed to open log file '%s' - logging to stderr only\n",
                 g_cfg.log_path);
     }
+    if (g_cfg.log_async && log_start_async((size_t)g_cfg.log_async_slots) != 0) {
+        log_warn("tgbot: async logging unavailable - writing log lines inline");
+    }
 
     g_boot_time = monotonic_sec();
 
     curl_global_init(CURL_GLOBAL_DEFAULT);
 
+    // one DNS/TLS/connection cache for every handle in the process
+    if (g_cfg.http_share && http_share_init(g_cfg.http2) != 0) {
+        log_warn("tgbot: shared connection cache unavailable - handles cache separately");
+    }
+
+    // shared curl_multi event loop for every bot and LLM transfer
+    if (g_cfg.http_engine && http_engine_start(g_cfg.http_max_connections) != 0) {
+        log_warn("tgbot: HTTP engine failed to start - using blocking transfers");
+    }
+
+    // pace sends from every handle below Telegram's limits; the bot-wide and
+    // per-group rates are split between the copies (a group's members may
+    // belong to any of them), a private chat's rate is its owner's alone
+    int send_rate = split_rate(g_cfg.send_rate, g_cfg.cluster_procs);
+    int group_rate = split_rate(g_cfg.group_rate, g_cfg.cluster_procs);
+    if (ratelimit_init(send_rate, g_cfg.chat_rate, group_rate) != 0) {
+        log_warn("tgbot: send rate governor unavailable - only 429 pauses apply");
+    }
+
     // init bot handle
     BotHandle *bot = bot_init(g_cfg.token);
     if (!bot) {
         log_error("tgbot: failed to initialise bot handle");
+        http_engine_stop();
+        http_share_cleanup();
         log_close();
         curl_global_cleanup();
         return 1;
     }
+    bot_set_api_base(bot, g_cfg.api_base);
     bot_set_abort_flag(bot, &g_running);
 
+    // load the model while getMe and the whitelist run; with several copies
+    // the first one speaks for all of them
+    if (g_copy == 0 && (g_cfg.llm_warmup || g_cfg.llm_keepalive_sec > 0) &&
+        warmup_start(g_cfg.llm_endpoint, g_cfg.llm_model, g_cfg.llm_system_prompt,
+                     g_cfg.llm_warmup, g_cfg.llm_keepalive_sec) < 0) {
+        log_warn("tgbot: LLM warm-up unavailable - the first reply may be slow");
+    }
+
     // verify token with getMe
     cJSON *me = bot_get_me(bot);
     if (!me) {
         log_error("tgbot: getMe failed - bad token?");
+        warmup_stop();
         bot_cleanup(bot);
+        http_engine_stop();
+        http_share_cleanup();
         log_close();
         curl_global_cleanup();
         return 1;
@@ -285,33 +1172,111 @@ int main(int argc, char **argv)
     Whitelist wl;
     if (whitelist_load(&wl, g_cfg.whitelist_path) != 0) {
         log_error("tgbot: failed to load whitelist");
+        warmup_stop();
         bot_cleanup(bot);
+        http_engine_stop();
+        http_share_cleanup();
         log_close();
         curl_global_cleanup();
         return 1;
     }
-    log_info("tgbot: whitelist loaded - %d user(s)", wl.count);
+    log_info("tgbot: whitelist loaded - %d user(s)", whitelist_count(&wl));
 
-    // init message queue
-    if (queue_init(g_cfg.user_ring_size) != 0) {
+    // init message queue, one shard per worker the pool may grow to
+    if (queue_init_sharded(g_cfg.user_ring_size, g_cfg.worker_max) != 0) {
         log_error("tgbot: failed to init message queue");
+        warmup_stop();
         bot_cleanup(bot);
+        http_engine_stop();
+        http_share_cleanup();
         log_close();
         curl_global_cleanup();
         return 1;
     }
+    queue_set_reply_delay((double)g_cfg.reply_delay);
+    queue_set_coalesce((double)g_cfg.coalesce_ms / 1000.0);
+    queue_set_overflow((QueueOverflow)g_cfg.worker_overflow);
+    queue_set_max_age((double)g_cfg.worker_max_queue_age);
+
+    // per-chat history for multi-turn replies
+    if (g_cfg.llm_context &&
+        context_init((size_t)g_cfg.llm_context_chat_kb * 1024UL,
+                     (size_t)g_cfg.llm_context_total_mb * 1024UL * 1024UL) != 0) {
+        log_warn("tgbot: conversation context unavailable - replies are single-turn");
+        g_cfg.llm_context = false;
+    }
+
+    // replies to repeated single-turn prompts
+    if (g_cfg.llm_cache &&
+        cache_init((size_t)g_cfg.llm_cache_kb * 1024UL, g_cfg.llm_cache_ttl) != 0) {
+        log_warn("tgbot: response cache unavailable - every prompt goes to the LLM");
+        g_cfg.llm_cache = false;
+    }
 
-    // spawn workers
-    int nworkers = g_cfg.worker_count;
-    pthread_t *workers = calloc((size_t)nworkers, sizeof(pthread_t));
-    if (!workers) {
-        log_error("tgbot: alloc workers failed");
+    // an endpoint list is balanced across; a single endpoint needs no pool
+    int nbackends = llm_pool_init(g_cfg.llm_endpoint);
+    if (nbackends < 0) {
+        log_error("tgbot: invalid [llm] endpoint list");
+        warmup_stop();
+        cache_destroy();
+        context_destroy();
         queue_destroy();
         bot_cleanup(bot);
+        http_engine_stop();
+        http_share_cleanup();
         log_close();
         curl_global_cleanup();
         return 1;
     }
+    if (nbackends == 1) {
+        llm_pool_destroy();
+    } else {
+        log_info("tgbot: balancing LLM requests over %d endpoints", nbackends);
+        if (g_cfg.llm_health_check_sec > 0 &&
+            llm_pool_start_probe(g_cfg.llm_health_check_sec) != 0) {
+            log_warn("tgbot: LLM health checker failed to start - passive checks only");
+        }
+    }
+
+    if (g_cfg.metrics_enabled) {
+        register_gauges();
+    }
+
+    // sampled per-message traces, written out on SIGUSR1 (`tgbot trace`)
+    if (g_cfg.trace_enabled) {
+        if (trace_init(g_cfg.trace_slots, g_cfg.trace_sample,
+                       (double)g_cfg.trace_slow_ms / 1000.0) != 0 ||
+            trace_start_dumper(g_cfg.trace_path) != 0) {
+            log_warn("tgbot: tracing unavailable - continuing without traces");
+            trace_destroy();
+        } else {
+            // SA_RESTART: whichever thread takes the signal carries on with its syscall
+            struct sigaction dump_sa;
+            memset(&dump_sa, 0, sizeof(dump_sa));
+            dump_sa.sa_handler = on_dump_signal;
+            dump_sa.sa_flags = SA_RESTART;
+            sigemptyset(&dump_sa.sa_mask);
+            sigaction(SIGUSR1, &dump_sa, NULL);
+            log_info("tgbot: tracing 1 in %d replies and any slower than %d ms; "
+                     "SIGUSR1 writes %s", g_cfg.trace_sample, g_cfg.trace_slow_ms,
+                     g_cfg.trace_path);
+        }
+    }
+
+    // what the last run left queued goes back in before anything can pop or push
+    if (g_cfg.worker_journal_path[0]) {
+        if (qjournal_open(g_cfg.worker_journal_path,
+                          (size_t)g_cfg.worker_journal_segment_mb * 1024UL * 1024UL) != 0) {
+            log_warn("tgbot: queue journal %s unavailable - queued messages are lost on restart",
+                     g_cfg.worker_journal_path);
+        } else {
+            int restored = queue_restore_journal();
+            QJournalStats js;
+            qjournal_stats(&js);
+            log_info("tgbot: queue journal %s - %d of %" PRIu64 " message(s) from the last run "
+                     "queued again", g_cfg.worker_journal_path, restored, js.replayed);
+        }
+    }
 
     // block SIGINT/SIGTERM in worker threads - only main thread handles them
     sigset_t block_mask, old_mask;
@@ -320,27 +1285,36 @@ int main(int argc, char **argv)
     sigaddset(&block_mask, SIGTERM);
     pthread_sigmask(SIG_BLOCK, &block_mask, &old_mask);
 
-    // each worker gets a send-only bot handle
-    for (int i = 0; i < nworkers; i++) {
-        WorkerArg *wa = calloc(1, sizeof(*wa));
-        if (!wa) {
-            log_error("tgbot: alloc worker arg failed");
-            break;
-        }
-        wa->id = i;
-        wa->token = g_cfg.token;
-        wa->reply_delay = g_cfg.reply_delay;
-        wa->running = &g_running;
-        wa->llm_endpoint = g_cfg.llm_endpoint;
-        wa->llm_model = g_cfg.llm_model;
-        wa->llm_max_tokens = g_cfg.llm_max_tokens;
-        wa->llm_system_prompt = g_cfg.llm_system_prompt;
-        if (pthread_create(&workers[i], NULL, worker_main, wa) != 0) {
-            log_error("tgbot: failed to create worker %d", i);
-            free(wa);
+    // one indicator per busy chat, however many workers are answering it
+    BotHandle *typing_bot = bot_init_send_only(g_cfg.token);
+    if (typing_bot) {
+        bot_set_api_base(typing_bot, g_cfg.api_base);
+        bot_set_abort_flag(typing_bot, &g_running);
+    }
+    if (!typing_bot || typing_start(send_typing, typing_bot) != 0) {
+        log_warn("tgbot: typing indicator unavailable - replies arrive without one");
+    }
+
+    // spawn workers; threads started from here (and by the scaler) keep the mask
+    for (int i = 0; i < g_cfg.worker_count; i++) {
+        spawn_worker();
+    }
+    if (g_cfg.worker_max > g_cfg.worker_min) {
+        if (pthread_create(&g_pool.scaler, NULL, scaler_main, NULL) != 0) {
+            log_warn("tgbot: worker scaler failed to start - pool stays at %d",
+                     g_cfg.worker_count);
+        } else {
+            g_pool.scaling = true;
+            log_info("tgbot: elastic pool of %d-%d workers (idle retire after %ds)",
+                     g_cfg.worker_min, g_cfg.worker_max, g_cfg.worker_idle_sec);
         }
     }
 
+    // messages for users this copy owns arrive from the other copies
+    if (g_cfg.cluster_procs > 1 && cluster_start(g_copy, g_cfg.cluster_procs, &wl) != 0) {
+        log_warn("tgbot: copy %d cannot reach the others - queueing every user here", g_copy);
+    }
+
     // restore signal mask for main thread
     pthread_sigmask(SIG_SETMASK, &old_mask, NULL);
 
@@ -359,59 +1333,136 @@ int main(int argc, char **argv)
         }
 
         webhook_stop();
-        bot_delete_webhook(bot);
+        if (g_copy == 0) {
+            bot_delete_webhook(bot);
+        }
+    } else if (g_copy > 0) {
+        // copy 0 polls and forwards; this one only serves the users it owns
+        log_info("tgbot: copy %d serving forwarded messages", g_copy);
+        while (g_running) {
+            pause();
+        }
     } else {
         // poll mode - delete any stale webhook first
         bot_delete_webhook(bot);
 
-        int64_t offset = 0;
+        // the poller keeps the next getUpdates in flight while this thread
+        // dispatches the batch before it, so it needs a handle of its own
+        BotHandle *poll_bot = bot_init(g_cfg.token);
+        if (!poll_bot) {
+            log_error("tgbot: failed to initialise polling handle");
+            goto shutdown;
+        }
+        bot_set_api_base(poll_bot, g_cfg.api_base);
+        bot_set_abort_flag(poll_bot, &g_running);
+        if (poller_start(poll_bot, g_cfg.poll_timeout, g_cfg.poll_limit, &g_running) != 0) {
+            log_error("tgbot: failed to start poller");
+            bot_cleanup(poll_bot);
+            goto shutdown;
+        }
+        // no webhook daemon to carry /metrics, so it gets a local one
+        if (g_cfg.metrics_enabled && webhook_metrics_start(g_cfg.metrics_port) != 0) {
+            log_warn("tgbot: metrics server failed to start - continuing without /metrics");
+        }
         log_info("tgbot: entering poll loop (timeout=%ds)...", g_cfg.poll_timeout);
 
-        while (g_running) {
-            cJSON *root = bot_get_updates(bot, offset, g_cfg.poll_timeout, g_cfg.poll_limit);
-            if (!root) {
-                if (!g_running) {
-                    break;
-                }
-                log_warn("tgbot: getUpdates failed, retrying in 5s");
-                // TODO: exponential backoff with jitter on consecutive failures
-                for (int i = 0; i < 5 && g_running; i++) {
-                    sleep(1);
-                }
-                continue;
-            }
-
-            const cJSON *result = cJSON_GetObjectItemCaseSensitive(root, "result");
-
-            const cJSON *upd = NULL;
-            cJSON_ArrayForEach(upd, result)
-            {
-                int64_t uid = handle_update(&wl, upd);
-                if (uid >= 0 && uid >= offset) {
-                    offset = uid + 1;
-                }
-            }
-
-            cJSON_Delete(root);
+        PollBatch batch;
+        while (g_running && poller_next(&batch) == 0) {
+            handle_batch(&wl, &batch);
+            poller_batch_free(&batch);
         }
+        poller_stop();
+        webhook_metrics_stop();
+        bot_cleanup(poll_bot);
     }
 
 shutdown:
     log_info("tgbot: shutting down.");
+    // journaled messages stay queued for the next start instead of going to
+    // workers that are about to exit
+    if (qjournal_active()) {
+        queue_shutdown();
+    }
+    warmup_stop();
+
+    // nothing more to take from the other copies
+    if (g_cfg.cluster_procs > 1) {
+        ClusterStats cls;
+        cluster_stats(&cls);
+        log_info("tgbot: cluster copy %d - %" PRIu64 " forwarded, %" PRIu64 " received, %" PRIu64
+                 " queued here for an unreachable owner", g_copy, cls.forwarded, cls.received,
+                 cls.fallbacks);
+        cluster_stop();
+    }
 
-    // signal workers to exit and join
+    // stop growing the pool, then signal workers to exit and join
+    if (g_pool.scaling) {
+        atomic_store(&g_pool.stop, true);
+        pthread_join(g_pool.scaler, NULL);
+    }
     queue_shutdown();
-    for (int i = 0; i < nworkers; i++) {
-        if (workers[i]) {
-            pthread_join(workers[i], NULL);
+    for (int i = 0; i < WORKERS_MAX; i++) {
+        if (g_pool.used[i]) {
+            pthread_join(g_pool.threads[i], NULL);
         }
     }
-    free(workers);
+    TypingStats ts;
+    typing_stats(&ts);
+    log_info("tgbot: typing indicator - %" PRIu64 " sent, %" PRIu64 " shared, %" PRIu64
+             " not needed", ts.sent, ts.shared, ts.skipped);
+    typing_stop();
+    bot_cleanup(typing_bot);
+    // replies still in flight get a bounded chance to finish (and ack) while
+    // the journal is open; what is left is aborted and answered after restart
+    int undrained = http_engine_drain(HTTP_DRAIN_SEC);
+    if (undrained > 0) {
+        log_warn("tgbot: %d transfer(s) still in flight after %.0fs - aborting", undrained,
+                 HTTP_DRAIN_SEC);
+    }
+    http_engine_stop();
+    sa.sa_handler = SIG_IGN;
+    sigaction(SIGUSR1, &sa, NULL);
+    trace_destroy();
 
+    if (g_cfg.llm_budget_curve[0]) {
+        BudgetStats bs;
+        budget_stats(&bs);
+        log_info("tgbot: generation budget - %" PRIu64 " of %" PRIu64 " reply(s) cut short, %" PRIu64
+                 " sent to the fallback model", bs.reduced, bs.picks, bs.fallback);
+    }
+    if (g_cfg.llm_cache) {
+        CacheStats cs;
+        cache_stats(&cs);
+        log_info("tgbot: response cache - %" PRIu64 " hit(s), %" PRIu64 " miss(es), "
+                 "%" PRIu64 " eviction(s)", cs.hits, cs.misses, cs.evictions);
+    }
+    for (int i = 0; i < llm_pool_size(); i++) {
+        LlmPoolStats ps;
+        if (llm_pool_stats(i, &ps) == 0) {
+            log_info("tgbot: LLM endpoint %d - %lu request(s), %lu failure(s)%s", i,
+                     ps.requests, ps.failures, ps.ejected ? ", ejected" : "");
+        }
+    }
+    RateLimitStats rs;
+    ratelimit_stats(&rs);
+    log_info("tgbot: rate governor - %" PRIu64 " send(s), %" PRIu64 " delayed, %" PRIu64
+             " 429 pause(s)", rs.sends, rs.delayed, rs.pauses);
+    if (qjournal_active()) {
+        QJournalStats js;
+        qjournal_stats(&js);
+        log_info("tgbot: queue journal - %" PRIu64 " message(s) kept for the next start, %" PRIu64
+                 " not journaled, %" PRIu64 " compacted", js.live, js.failed, js.compacted);
+        qjournal_close();
+    }
     queue_destroy();
+    llm_pool_destroy();
+    ratelimit_destroy();
+    cache_destroy();
+    context_destroy();
     whitelist_cleanup(&wl);
     bot_cleanup(bot);
     explicit_bzero(g_cfg.token, sizeof(g_cfg.token));
+    http_share_cleanup();
     curl_global_cleanup();
     log_info("tgbot: clean shutdown complete");
     log_close();
@@ -0,0 +1,416 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "metrics.h"
+#include "config.h"
+
+#include <inttypes.h>
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+/* bucket layout, in microseconds: values below MET_LINEAR get a bucket each;
+ * above that every power of two [2^e, 2^(e+1)) is split into MET_SUB equal
+ * sub-buckets, up to 2^MET_MAX_EXP (about 38 hours), which absorbs the rest
+ */
+#define MET_SUB_BITS 3
+#define MET_SUB (1 << MET_SUB_BITS)
+#define MET_LINEAR (2 * MET_SUB)
+#define MET_MIN_EXP (MET_SUB_BITS + 1)
+#define MET_MAX_EXP 36
+#define MET_BUCKETS (MET_LINEAR + (MET_MAX_EXP - MET_MIN_EXP + 1) * MET_SUB)
+
+typedef struct {
+    _Atomic uint64_t buckets[MET_STAGES][MET_BUCKETS];
+    _Atomic uint64_t sum_us[MET_STAGES];
+    _Atomic uint64_t counters[MET_COUNTERS];
+} MetShard;
+
+typedef struct {
+    const char *name;
+    const char *help;
+    double (*fn)(void);
+} MetGauge;
+
+/* shard slots, taken by a thread's first record and given back when it
+ * exits; a thread that finds none free (or no memory) shares g_spill, which
+ * also holds the counts of the threads that have exited
+ */
+static MetShard *g_shards[METRICS_SHARDS];
+static MetShard g_spill;
+static _Thread_local MetShard *t_shard;
+static pthread_key_t g_shard_key; // destructor hands a thread's shard back
+static pthread_once_t g_key_once = PTHREAD_ONCE_INIT;
+static bool g_key_ok;
+
+static struct {
+    pthread_mutex_t lock;
+    pthread_mutex_t shards; // g_shards: claims, exits and scrapes walking them
+    MetGauge gauges[METRICS_GAUGES_MAX];
+    int ngauges;
+} g_met = {.lock = PTHREAD_MUTEX_INITIALIZER, .shards = PTHREAD_MUTEX_INITIALIZER};
+
+static const struct {
+    const char *name;
+    const char *help;
+} STAGES[MET_STAGES] = {
+    [MET_QUEUE_WAIT] = {"tgbot_queue_wait_seconds", "Time from enqueue to worker pickup."},
+    [MET_RATELIMIT_DELAY] = {"tgbot_ratelimit_delay_seconds",
+                             "Time a send waited for the outbound rate governor."},
+    [MET_LLM] = {"tgbot_llm_seconds", "LLM request latency, start to full reply."},
+    [MET_SEND] = {"tgbot_send_seconds", "Telegram sendMessage/editMessageText round trip."},
+    [MET_WEBHOOK_ACK] = {"tgbot_webhook_ack_seconds",
+                         "Time from webhook request to queued response."},
+};
+
+static const struct {
+    const char *name;
+    const char *help;
+} COUNTERS[MET_COUNTERS] = {
+    [MET_QUEUE_DROPS] = {"tgbot_queue_drops_total", "Messages dropped by a full queue."},
+    [MET_QUEUE_SHED] = {"tgbot_queue_shed_total",
+                        "Messages dropped at pickup for waiting too long."},
+    [MET_WEBHOOK_BUSY] = {"tgbot_webhook_busy_total", "Webhook requests answered 503."},
+    [MET_LLM_ERRORS] = {"tgbot_llm_errors_total", "Failed LLM requests."},
+    [MET_SEND_ERRORS] = {"tgbot_send_errors_total", "Failed Telegram sends."},
+    [MET_RATELIMITED] = {"tgbot_ratelimited_total", "429 answers from Telegram."},
+};
+
+static const double QUANTILES[] = {0.5, 0.9, 0.99, 0.999};
+
+// add src's counts into dst (src's own writer is gone)
+static void fold_shard(MetShard *dst, const MetShard *src)
+{
+    for (int st = 0; st < MET_STAGES; st++) {
+        for (int b = 0; b < MET_BUCKETS; b++) {
+            uint64_t n = atomic_load_explicit(&src->buckets[st][b], memory_order_relaxed);
+            if (n) {
+                atomic_fetch_add_explicit(&dst->buckets[st][b], n, memory_order_relaxed);
+            }
+        }
+        atomic_fetch_add_explicit(&dst->sum_us[st],
+                                  atomic_load_explicit(&src->sum_us[st], memory_order_relaxed),
+                                  memory_order_relaxed);
+    }
+    for (int c = 0; c < MET_COUNTERS; c++) {
+        atomic_fetch_add_explicit(&dst->counters[c],
+                                  atomic_load_explicit(&src->counters[c], memory_order_relaxed),
+                                  memory_order_relaxed);
+    }
+}
+
+/* thread exit: fold the shard into g_spill and free its slot, in one step
+ * under the shards lock so a scrape counts it exactly once
+ */
+static void shard_retire(void *p)
+{
+    MetShard *s = p;
+    t_shard = &g_spill; // records from later thread-exit destructors
+    pthread_mutex_lock(&g_met.shards);
+    fold_shard(&g_spill, s);
+    for (int i = 0; i < METRICS_SHARDS; i++) {
+        if (g_shards[i] == s) {
+            g_shards[i] = NULL;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&g_met.shards);
+    free(s);
+}
+
+static void key_init(void)
+{
+    g_key_ok = pthread_key_create(&g_shard_key, shard_retire) == 0;
+}
+
+static MetShard *shard(void)
+{
+    if (t_shard) {
+        return t_shard;
+    }
+    pthread_once(&g_key_once, key_init);
+    MetShard *s = g_key_ok ? calloc(1, sizeof(*s)) : NULL;
+    if (s && pthread_setspecific(g_shard_key, s) != 0) {
+        free(s);
+        s = NULL;
+    }
+    if (s) {
+        pthread_mutex_lock(&g_met.shards);
+        int i = 0;
+        while (i < METRICS_SHARDS && g_shards[i]) {
+            i++;
+        }
+        if (i < METRICS_SHARDS) {
+            g_shards[i] = s;
+        }
+        pthread_mutex_unlock(&g_met.shards);
+        if (i == METRICS_SHARDS) {
+            pthread_setspecific(g_shard_key, NULL);
+            free(s);
+            s = NULL;
+        }
+    }
+    t_shard = s ? s : &g_spill;
+    return t_shard;
+}
+
+// call fn for every shard in use, the spill shard included
+static void for_each_shard(void (*fn)(MetShard *s, void *ud), void *ud)
+{
+    pthread_mutex_lock(&g_met.shards);
+    fn(&g_spill, ud);
+    for (int i = 0; i < METRICS_SHARDS; i++) {
+        if (g_shards[i]) {
+            fn(g_shards[i], ud);
+        }
+    }
+    pthread_mutex_unlock(&g_met.shards);
+}
+
+static int bucket_of(uint64_t us)
+{
+    if (us < MET_LINEAR) {
+        return (int)us;
+    }
+    int e = 63 - __builtin_clzll(us);
+    if (e > MET_MAX_EXP) {
+        return MET_BUCKETS - 1;
+    }
+    int sub = (int)((us >> (e - MET_SUB_BITS)) & (MET_SUB - 1));
+    return MET_LINEAR + (e - MET_MIN_EXP) * MET_SUB + sub;
+}
+
+// highest value (in microseconds) that lands in bucket idx
+static uint64_t bucket_upper(int idx)
+{
+    if (idx < MET_LINEAR) {
+        return (uint64_t)idx;
+    }
+    int e = MET_MIN_EXP + (idx - MET_LINEAR) / MET_SUB;
+    int sub = (idx - MET_LINEAR) % MET_SUB;
+    uint64_t width = (uint64_t)1 << (e - MET_SUB_BITS);
+    return (uint64_t)(MET_SUB + sub) * width + width - 1;
+}
+
+void metrics_observe(MetStage stage, double sec)
+{
+    if ((int)stage < 0 || stage >= MET_STAGES) {
+        return;
+    }
+    uint64_t us = sec > 0.0 ? (uint64_t)(sec * 1e6) : 0;
+    MetShard *s = shard();
+    atomic_fetch_add_explicit(&s->buckets[stage][bucket_of(us)], 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&s->sum_us[stage], us, memory_order_relaxed);
+}
+
+void metrics_add(MetCounter counter, uint64_t n)
+{
+    if ((int)counter < 0 || counter >= MET_COUNTERS) {
+        return;
+    }
+    atomic_fetch_add_explicit(&shard()->counters[counter], n, memory_order_relaxed);
+}
+
+// aggregation across shards
+
+typedef struct {
+    MetStage stage;
+    uint64_t buckets[MET_BUCKETS];
+    uint64_t count;
+    uint64_t sum_us;
+} StageSum;
+
+static void add_stage(MetShard *s, void *ud)
+{
+    StageSum *a = (StageSum *)ud;
+    for (int b = 0; b < MET_BUCKETS; b++) {
+        uint64_t n = atomic_load_explicit(&s->buckets[a->stage][b], memory_order_relaxed);
+        a->buckets[b] += n;
+        a->count += n;
+    }
+    a->sum_us += atomic_load_explicit(&s->sum_us[a->stage], memory_order_relaxed);
+}
+
+static void sum_stage(MetStage stage, StageSum *a)
+{
+    *a = (StageSum){.stage = stage};
+    for_each_shard(add_stage, a);
+}
+
+static double stage_quantile(const StageSum *a, double q)
+{
+    if (a->count == 0) {
+        return 0.0;
+    }
+    if (q < 0.0) {
+        q = 0.0;
+    } else if (q > 1.0) {
+        q = 1.0;
+    }
+    uint64_t rank = (uint64_t)(q * (double)a->count + 0.999999);
+    if (rank == 0) {
+        rank = 1;
+    }
+    uint64_t seen = 0;
+    for (int b = 0; b < MET_BUCKETS; b++) {
+        seen += a->buckets[b];
+        if (seen >= rank) {
+            return (double)bucket_upper(b) / 1e6;
+        }
+    }
+    return (double)bucket_upper(MET_BUCKETS - 1) / 1e6;
+}
+
+double metrics_quantile(MetStage stage, double q)
+{
+    if ((int)stage < 0 || stage >= MET_STAGES) {
+        return 0.0;
+    }
+    StageSum a;
+    sum_stage(stage, &a);
+    return stage_quantile(&a, q);
+}
+
+uint64_t metrics_count(MetStage stage)
+{
+    if ((int)stage < 0 || stage >= MET_STAGES) {
+        return 0;
+    }
+    StageSum a;
+    sum_stage(stage, &a);
+    return a.count;
+}
+
+typedef struct {
+    MetCounter counter;
+    uint64_t total;
+} CounterSum;
+
+static void add_counter(MetShard *s, void *ud)
+{
+    CounterSum *c = (CounterSum *)ud;
+    c->total += atomic_load_explicit(&s->counters[c->counter], memory_order_relaxed);
+}
+
+uint64_t metrics_counter(MetCounter counter)
+{
+    if ((int)counter < 0 || counter >= MET_COUNTERS) {
+        return 0;
+    }
+    CounterSum c = {.counter = counter};
+    for_each_shard(add_counter, &c);
+    return c.total;
+}
+
+int metrics_gauge(const char *name, const char *help, double (*fn)(void))
+{
+    if (!name || !fn) {
+        return -1;
+    }
+    pthread_mutex_lock(&g_met.lock);
+    if (g_met.ngauges >= METRICS_GAUGES_MAX) {
+        pthread_mutex_unlock(&g_met.lock);
+        return -1;
+    }
+    g_met.gauges[g_met.ngauges++] = (MetGauge){name, help ? help : "", fn};
+    pthread_mutex_unlock(&g_met.lock);
+    return 0;
+}
+
+// rendering
+
+typedef struct {
+    char *buf;
+    size_t cap;
+    size_t len;
+} Out;
+
+__attribute__((format(printf, 2, 3))) static void put(Out *o, const char *fmt, ...)
+{
+    if (o->len + 1 >= o->cap) {
+        return;
+    }
+    va_list ap;
+    va_start(ap, fmt);
+    int n = vsnprintf(o->buf + o->len, o->cap - o->len, fmt, ap);
+    va_end(ap);
+    if (n < 0) {
+        return;
+    }
+    o->len += (size_t)n;
+    if (o->len >= o->cap) {
+        o->len = o->cap - 1; // truncated
+    }
+}
+
+size_t metrics_render(char *buf, size_t cap)
+{
+    if (!buf || cap == 0) {
+        return 0;
+    }
+    Out o = {buf, cap, 0};
+    buf[0] = '\0';
+
+    StageSum a;
+    for (int s = 0; s < MET_STAGES; s++) {
+        sum_stage((MetStage)s, &a);
+        put(&o, "# HELP %s %s\n# TYPE %s summary\n", STAGES[s].name, STAGES[s].help,
+            STAGES[s].name);
+        for (size_t q = 0; q < sizeof(QUANTILES) / sizeof(QUANTILES[0]); q++) {
+            put(&o, "%s{quantile=\"%g\"} %.6f\n", STAGES[s].name, QUANTILES[q],
+                stage_quantile(&a, QUANTILES[q]));
+        }
+        put(&o, "%s_sum %.6f\n%s_count %" PRIu64 "\n", STAGES[s].name,
+            (double)a.sum_us / 1e6, STAGES[s].name, a.count);
+    }
+
+    for (int c = 0; c < MET_COUNTERS; c++) {
+        put(&o, "# HELP %s %s\n# TYPE %s counter\n%s %" PRIu64 "\n", COUNTERS[c].name,
+            COUNTERS[c].help, COUNTERS[c].name, COUNTERS[c].name,
+            metrics_counter((MetCounter)c));
+    }
+
+    pthread_mutex_lock(&g_met.lock);
+    for (int g = 0; g < g_met.ngauges; g++) {
+        const MetGauge *mg = &g_met.gauges[g];
+        put(&o, "# HELP %s %s\n# TYPE %s gauge\n%s %g\n", mg->name, mg->help, mg->name, mg->name,
+            mg->fn());
+    }
+    pthread_mutex_unlock(&g_met.lock);
+    return o.len;
+}
+
+static void zero_shard(MetShard *s, void *ud)
+{
+    (void)ud;
+    for (int st = 0; st < MET_STAGES; st++) {
+        for (int b = 0; b < MET_BUCKETS; b++) {
+            atomic_store_explicit(&s->buckets[st][b], 0, memory_order_relaxed);
+        }
+        atomic_store_explicit(&s->sum_us[st], 0, memory_order_relaxed);
+    }
+    for (int c = 0; c < MET_COUNTERS; c++) {
+        atomic_store_explicit(&s->counters[c], 0, memory_order_relaxed);
+    }
+}
+
+void metrics_reset(void)
+{
+    for_each_shard(zero_shard, NULL);
+    pthread_mutex_lock(&g_met.lock);
+    g_met.ngauges = 0;
+    pthread_mutex_unlock(&g_met.lock);
+}
+
+int metrics_shards_live(void)
+{
+    int n = 0;
+    pthread_mutex_lock(&g_met.shards);
+    for (int i = 0; i < METRICS_SHARDS; i++) {
+        n += g_shards[i] != NULL;
+    }
+    pthread_mutex_unlock(&g_met.shards);
+    return n;
+}
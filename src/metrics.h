@@ -0,0 +1,65 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* process-wide latency histograms and event counters, rendered in the
+ * Prometheus text format
+ * each thread records into a shard of its own with relaxed atomic adds,
+ * so the hot paths never take a lock or share a cache line; a scrape sums
+ * the shards. a thread's shard is folded into a shared one and its slot
+ * freed for the next thread when it exits, so an elastic pool that keeps
+ * replacing workers does not run out of them. histograms are log-linear (HDR-style): 8 sub-buckets per
+ * power of two of microseconds, so any quantile is within 1/8 of the value.
+ */
+
+typedef enum {
+    MET_QUEUE_WAIT,      // enqueue -> worker pickup
+    MET_RATELIMIT_DELAY, // time a send waited for the rate governor
+    MET_LLM,             // one LLM request, start to full reply
+    MET_SEND,            // one sendMessage/editMessageText round trip
+    MET_WEBHOOK_ACK,     // webhook request received -> response queued
+    MET_STAGES
+} MetStage;
+
+typedef enum {
+    MET_QUEUE_DROPS,   // queue_push refused a message or dropped an older one
+    MET_QUEUE_SHED,    // prompts dropped at pickup for waiting past max_queue_age_sec
+    MET_WEBHOOK_BUSY,  // webhook answered 503 (ingress ring full)
+    MET_LLM_ERRORS,    // LLM request failed
+    MET_SEND_ERRORS,   // Telegram send failed
+    MET_RATELIMITED,   // 429 answers from Telegram
+    MET_COUNTERS
+} MetCounter;
+
+// record one latency observation of sec seconds
+void metrics_observe(MetStage stage, double sec);
+
+// add n to a counter
+void metrics_add(MetCounter counter, uint64_t n);
+
+// quantile q (0..1) of a stage in seconds, 0 when nothing was recorded
+double metrics_quantile(MetStage stage, double q);
+
+// number of observations of a stage
+uint64_t metrics_count(MetStage stage);
+
+// value of a counter
+uint64_t metrics_counter(MetCounter counter);
+
+/* export the current value of fn() as a gauge on every scrape
+ * name and help must outlive the process (string literals)
+ * returns 0, or -1 when METRICS_GAUGES_MAX are registered
+ */
+int metrics_gauge(const char *name, const char *help, double (*fn)(void));
+
+/* render every stage, counter and gauge into buf (NUL-terminated)
+ * returns the length written, truncated to cap - 1
+ */
+size_t metrics_render(char *buf, size_t cap);
+
+// zero every histogram and counter and forget the gauges (for tests)
+void metrics_reset(void);
+
+// per-thread shards held by running threads (exported for testability)
+int metrics_shards_live(void);
@@ -0,0 +1,262 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "poller.h"
+#include "config.h"
+#include "logger.h"
+#include "update.h"
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+static struct {
+    pthread_mutex_t lock;
+    pthread_cond_t cond; // batch handed over or taken, or poller stopped
+    pthread_t thread;
+    bool started;
+    bool stop;
+    bool done; // poller thread has exited
+    PollBatch ready;
+    bool has_ready;
+    BotHandle *bot;
+    int timeout;
+    int limit;
+    volatile sig_atomic_t *running;
+} g_poll = {.lock = PTHREAD_MUTEX_INITIALIZER};
+
+static bool still_running(void)
+{
+    return !g_poll.stop && (!g_poll.running || *g_poll.running);
+}
+
+// wait up to sec seconds on g_poll.cond (caller holds g_poll.lock)
+static void timed_wait(double sec)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    long ns = ts.tv_nsec + (long)((sec - (double)(long)sec) * 1e9);
+    ts.tv_sec += (time_t)sec + ns / 1000000000L;
+    ts.tv_nsec = ns % 1000000000L;
+    pthread_cond_timedwait(&g_poll.cond, &g_poll.lock, &ts);
+}
+
+double poller_backoff(int failures, double jitter)
+{
+    double d = (double)POLL_BACKOFF_MIN_SEC;
+    for (int i = 1; i < failures && d < (double)POLL_BACKOFF_MAX_SEC; i++) {
+        d *= 2.0;
+    }
+    if (d > (double)POLL_BACKOFF_MAX_SEC) {
+        d = (double)POLL_BACKOFF_MAX_SEC;
+    }
+    if (jitter < 0.0) {
+        jitter = 0.0;
+    } else if (jitter > 1.0) {
+        jitter = 1.0;
+    }
+    // keep at least half the delay so retries still spread out over time
+    return d * (0.5 + 0.5 * jitter);
+}
+
+// sleep out a backoff, waking early on stop; the run flag is polled since a
+// signal handler cannot signal the condvar
+static void backoff_wait(double sec)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    double until = (double)ts.tv_sec + (double)ts.tv_nsec / 1e9 + sec;
+    pthread_mutex_lock(&g_poll.lock);
+    while (still_running()) {
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        double left = until - ((double)ts.tv_sec + (double)ts.tv_nsec / 1e9);
+        if (left <= 0.0) {
+            break;
+        }
+        timed_wait(left < 1.0 ? left : 1.0);
+    }
+    pthread_mutex_unlock(&g_poll.lock);
+}
+
+/* hand a batch to the dispatcher (the previous one is taken by now) and
+ * wait until it takes this one too: the next poll confirms the batch to
+ * Telegram, so it must not leave while the batch could still be dropped
+ * returns false if polling stopped first (poller_stop frees the batch and
+ * Telegram redelivers it to the next run)
+ */
+static bool hand_over(PollBatch b)
+{
+    pthread_mutex_lock(&g_poll.lock);
+    if (!still_running()) {
+        pthread_mutex_unlock(&g_poll.lock);
+        free(b.body);
+        return false;
+    }
+    g_poll.ready = b;
+    g_poll.has_ready = true;
+    pthread_cond_broadcast(&g_poll.cond);
+    while (g_poll.has_ready && still_running()) {
+        timed_wait(1.0);
+    }
+    bool taken = !g_poll.has_ready;
+    pthread_mutex_unlock(&g_poll.lock);
+    return taken;
+}
+
+static void *poller_main(void *arg)
+{
+    (void)arg;
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    unsigned seed = (unsigned)ts.tv_nsec ^ (unsigned)ts.tv_sec;
+
+    int64_t offset = 0;
+    int failures = 0;
+    for (;;) {
+        pthread_mutex_lock(&g_poll.lock);
+        bool run = still_running();
+        pthread_mutex_unlock(&g_poll.lock);
+        if (!run) {
+            break;
+        }
+
+        const char *body = NULL;
+        size_t len = 0;
+        int64_t next = offset;
+        int rc = bot_get_updates_raw(g_poll.bot, offset, g_poll.timeout, g_poll.limit, &body,
+                                     &len);
+        if (rc == 0 && update_batch_offset(body, len, &next) != 0) {
+            rc = -1;
+        }
+        if (rc != 0) {
+            pthread_mutex_lock(&g_poll.lock);
+            run = still_running();
+            pthread_mutex_unlock(&g_poll.lock);
+            if (!run) {
+                break;
+            }
+            failures++;
+            double wait = poller_backoff(failures, (double)rand_r(&seed) / ((double)RAND_MAX + 1.0));
+            log_warn("poller: getUpdates failed (%d in a row), retrying in %.1fs", failures, wait);
+            backoff_wait(wait);
+            continue;
+        }
+        if (failures > 0) {
+            log_info("poller: getUpdates recovered after %d failure(s)", failures);
+            failures = 0;
+        }
+        if (next == offset) {
+            continue; // long poll timed out empty
+        }
+
+        // the handle's buffer is reused by the next poll, so the batch gets a copy
+        PollBatch b = {.body = malloc(len + 1), .len = len};
+        if (!b.body) {
+            log_error("poller: alloc failed - batch dropped");
+            offset = next;
+            continue;
+        }
+        memcpy(b.body, body, len);
+        b.body[len] = '\0';
+        if (!hand_over(b)) {
+            break;
+        }
+        offset = next;
+    }
+
+    pthread_mutex_lock(&g_poll.lock);
+    g_poll.done = true;
+    pthread_cond_broadcast(&g_poll.cond);
+    pthread_mutex_unlock(&g_poll.lock);
+    return NULL;
+}
+
+int poller_start(BotHandle *bot, int timeout, int limit, volatile sig_atomic_t *running)
+{
+    if (!bot) {
+        return -1;
+    }
+    pthread_mutex_lock(&g_poll.lock);
+    if (g_poll.started) {
+        pthread_mutex_unlock(&g_poll.lock);
+        return -1;
+    }
+    pthread_condattr_t ca;
+    pthread_condattr_init(&ca);
+    pthread_condattr_setclock(&ca, CLOCK_MONOTONIC);
+    pthread_cond_init(&g_poll.cond, &ca);
+    pthread_condattr_destroy(&ca);
+    g_poll.bot = bot;
+    g_poll.timeout = timeout;
+    g_poll.limit = limit;
+    g_poll.running = running;
+    g_poll.stop = false;
+    g_poll.done = false;
+    g_poll.has_ready = false;
+    if (pthread_create(&g_poll.thread, NULL, poller_main, NULL) != 0) {
+        pthread_cond_destroy(&g_poll.cond);
+        pthread_mutex_unlock(&g_poll.lock);
+        return -1;
+    }
+    g_poll.started = true;
+    pthread_mutex_unlock(&g_poll.lock);
+    return 0;
+}
+
+int poller_next(PollBatch *out)
+{
+    if (!out) {
+        return -1;
+    }
+    pthread_mutex_lock(&g_poll.lock);
+    if (!g_poll.started) {
+        pthread_mutex_unlock(&g_poll.lock);
+        return -1;
+    }
+    while (!g_poll.has_ready && !g_poll.done && still_running()) {
+        timed_wait(1.0);
+    }
+    if (!g_poll.has_ready || !still_running()) {
+        pthread_mutex_unlock(&g_poll.lock);
+        return -1;
+    }
+    *out = g_poll.ready;
+    g_poll.has_ready = false;
+    pthread_cond_broadcast(&g_poll.cond);
+    pthread_mutex_unlock(&g_poll.lock);
+    return 0;
+}
+
+void poller_batch_free(PollBatch *b)
+{
+    if (b) {
+        free(b->body);
+        b->body = NULL;
+        b->len = 0;
+    }
+}
+
+void poller_stop(void)
+{
+    pthread_mutex_lock(&g_poll.lock);
+    if (!g_poll.started) {
+        pthread_mutex_unlock(&g_poll.lock);
+        return;
+    }
+    g_poll.stop = true;
+    pthread_cond_broadcast(&g_poll.cond);
+    pthread_mutex_unlock(&g_poll.lock);
+
+    // an in-flight long poll ends on the handle's abort flag or its timeout
+    pthread_join(g_poll.thread, NULL);
+
+    pthread_mutex_lock(&g_poll.lock);
+    if (g_poll.has_ready) {
+        free(g_poll.ready.body);
+        g_poll.has_ready = false;
+    }
+    pthread_cond_destroy(&g_poll.cond);
+    g_poll.started = false;
+    pthread_mutex_unlock(&g_poll.lock);
+}
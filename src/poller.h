@@ -0,0 +1,45 @@
+#pragma once
+
+#include "bot.h"
+
+#include <signal.h>
+#include <stddef.h>
+
+/* pipelined getUpdates long-poller
+ * a background thread owns the polling BotHandle and the update offset: as
+ * soon as a batch arrives it is handed to the dispatcher and the next
+ * getUpdates goes out with the offset past it, so dispatching a batch
+ * overlaps with waiting for the next one. at most one batch waits to be
+ * taken. consecutive failures back off exponentially with jitter.
+ * the poll confirming a batch to Telegram only leaves once poller_next has
+ * taken it, so a batch dropped at shutdown is redelivered to the next run;
+ * updates still being dispatched at a crash are not.
+ */
+
+typedef struct {
+    char *body; // getUpdates response, owned by the batch
+    size_t len;
+} PollBatch;
+
+/* start polling with bot (which the poller then uses exclusively)
+ * running: the process run flag; the poller stops when it drops to 0
+ * returns 0 on success, -1 on error
+ */
+int poller_start(BotHandle *bot, int timeout, int limit, volatile sig_atomic_t *running);
+
+/* wait for the next non-empty batch
+ * returns 0 with *out filled, or -1 once polling has stopped
+ */
+int poller_next(PollBatch *out);
+
+// release a batch returned by poller_next
+void poller_batch_free(PollBatch *b);
+
+// stop the poller thread and drop any batch not yet taken (it was never confirmed)
+void poller_stop(void);
+
+/* seconds to wait after the given number of consecutive failures (>= 1):
+ * doubles from POLL_BACKOFF_MIN_SEC up to POLL_BACKOFF_MAX_SEC, scaled into
+ * [half, full] by jitter in [0, 1). exported for testability.
+ */
+double poller_backoff(int failures, double jitter);
@@ -0,0 +1,1123 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "qjournal.h"
+#include "config.h"
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#define QJ_MAGIC "TGQJRNL1"
+#define QJ_VERSION 1
+
+// record types
+#define QJ_PUSH 1
+#define QJ_ACK 2
+
+// initial live-message table size (power-of-2); doubles at half full
+#define TABLE_INIT 1024
+
+// start of every segment file
+typedef struct {
+    char magic[8];
+    uint32_t version;
+    uint32_t id;    // the file's suffix
+    uint64_t size;  // segment bytes when created
+    uint64_t reserved;
+} QjSegHdr;
+
+_Static_assert(sizeof(QjSegHdr) == 32, "QjSegHdr must be 32 bytes");
+
+/* every record starts with this; len is stored last, so a record a crash
+ * interrupted reads as the zeroes after the last whole one
+ */
+typedef struct {
+    uint32_t len; // record bytes, header included, a multiple of 8; 0 ends the data
+    uint32_t sum; // qj_sum of the len - 8 bytes after this field
+    uint64_t seq;
+    uint8_t type;
+    uint8_t kind; // QueueKind of a push
+    uint16_t reserved;
+    uint32_t merged;
+} QjRec;
+
+// follows a push's QjRec; then text_len bytes of text and a NUL
+typedef struct {
+    int64_t user_id;
+    int64_t chat_id;
+    double wall_sec; // CLOCK_REALTIME of the first arrival
+    uint32_t text_len;
+    uint32_t reserved;
+} QjPush;
+
+_Static_assert(sizeof(QjRec) == 24 && sizeof(QjPush) == 32, "journal records must stay 8-aligned");
+
+typedef struct {
+    uint32_t id;
+    char *map;
+    size_t size;
+    size_t used;   // end of the records written so far
+    size_t synced; // end of what has been handed to msync
+    int live;      // pushes in this segment not acked yet
+    size_t live_bytes; // their record bytes
+    bool moved_out; // compact_oldest copied live messages out of it
+} QjSeg;
+
+// a segment taken out of use, for the journal thread to unmap and delete
+typedef struct QjRetired {
+    struct QjRetired *next;
+    uint32_t id;
+    char *map;
+    size_t size;
+    bool sync_first; // its messages were copied forward: sync the copies first
+} QjRetired;
+
+// where a live message's push record is (seq 0 marks an empty table slot)
+typedef struct {
+    uint64_t seq;
+    uint32_t seg; // segment id
+    uint32_t off;
+} QjEntry;
+
+// a segment left by the previous run, read while opening
+typedef struct {
+    uint32_t id;
+    char *map;    // NULL if it is not a journal segment
+    size_t size;
+    bool ours;    // ours to delete once compacted
+} QjOld;
+
+/* global journal state
+ * segments are kept oldest first with consecutive ids, and only the oldest
+ * is ever deleted, so an ack record never outlives the push it cancels
+ *
+ * pushes and acks only copy into the mapped newest segment under lock; the
+ * file work is the journal thread's: it makes the next segment ahead of the
+ * rotation that needs it, deletes retired segments in order (syncing the
+ * copies of compacted messages first) and hands new appends to msync every
+ * QJOURNAL_SYNC_SEC. only that thread unmaps a segment while it runs
+ */
+static struct {
+    pthread_mutex_t lock;
+    pthread_cond_t wake; // journal thread: work queued, or stopping (CLOCK_MONOTONIC)
+    pthread_cond_t done; // journal thread finished a piece of work
+    pthread_t thread;
+    bool thread_up;
+    bool stopping;
+    QjSeg spare;            // the next segment made ahead (map NULL when none)
+    bool spare_making;      // the thread is creating id spare.id right now
+    double spare_retry;     // creation failed: not again before this
+    QjRetired *retired;     // oldest first
+    QjRetired *retired_tail;
+    bool deleting;          // the thread is working through a batch of them
+    _Atomic bool active;
+    bool replaying; // compacted, not yet handed out: keep every segment as it is
+    char path[LOG_PATH_MAX];
+    size_t seg_size;
+    size_t page;
+    QjSeg *segs;
+    int nsegs;
+    int segs_cap;
+    uint32_t first_id; // id of the first segment this run creates
+    QjEntry *table;
+    size_t table_mask;
+    size_t table_len;
+    uint64_t next_seq;
+    double last_sync;
+    QJournalStats stats;
+} g_qj = {.lock = PTHREAD_MUTEX_INITIALIZER};
+
+static double monotonic_sec(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+static double wall_sec(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+// word-at-a-time checksum; catches torn and stale records, not tampering
+static uint32_t qj_sum(const void *p, size_t n)
+{
+    const unsigned char *b = p;
+    uint64_t h = 0x9E3779B97F4A7C15ULL ^ n;
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        uint64_t w;
+        memcpy(&w, b + i, sizeof(w));
+        h = (h ^ w) * 0xff51afd7ed558ccdULL;
+        h ^= h >> 29;
+    }
+    for (; i < n; i++) {
+        h = (h ^ b[i]) * 0x100000001b3ULL;
+    }
+    h ^= h >> 32;
+    return (uint32_t)h;
+}
+
+static uint32_t align8(size_t n)
+{
+    return (uint32_t)((n + 7) & ~(size_t)7);
+}
+
+static void seg_path(char *out, size_t cap, uint32_t id)
+{
+    snprintf(out, cap, "%s.%u", g_qj.path, id);
+}
+
+// live-message table: open addressing with linear probing (caller holds lock)
+static size_t table_slot(uint64_t seq)
+{
+    uint64_t h = seq * 0x9E3779B97F4A7C15ULL;
+    return (size_t)(h ^ (h >> 32)) & g_qj.table_mask;
+}
+
+static QjEntry *table_find(uint64_t seq)
+{
+    for (size_t i = table_slot(seq);; i = (i + 1) & g_qj.table_mask) {
+        if (g_qj.table[i].seq == seq) {
+            return &g_qj.table[i];
+        }
+        if (g_qj.table[i].seq == 0) {
+            return NULL;
+        }
+    }
+}
+
+static int table_grow(void)
+{
+    size_t cap = (g_qj.table_mask + 1) * 2;
+    QjEntry *t = calloc(cap, sizeof(*t));
+    if (!t) {
+        return -1;
+    }
+    QjEntry *old = g_qj.table;
+    size_t old_cap = g_qj.table_mask + 1;
+    g_qj.table = t;
+    g_qj.table_mask = cap - 1;
+    for (size_t i = 0; i < old_cap; i++) {
+        if (old[i].seq) {
+            size_t j = table_slot(old[i].seq);
+            while (t[j].seq) {
+                j = (j + 1) & g_qj.table_mask;
+            }
+            t[j] = old[i];
+        }
+    }
+    free(old);
+    return 0;
+}
+
+// add or move seq's entry
+static int table_put(uint64_t seq, uint32_t seg, uint32_t off)
+{
+    QjEntry *e = table_find(seq);
+    if (!e) {
+        if ((g_qj.table_len + 1) * 2 > g_qj.table_mask + 1 && table_grow() != 0) {
+            return -1;
+        }
+        size_t i = table_slot(seq);
+        while (g_qj.table[i].seq) {
+            i = (i + 1) & g_qj.table_mask;
+        }
+        e = &g_qj.table[i];
+        e->seq = seq;
+        g_qj.table_len++;
+    }
+    e->seg = seg;
+    e->off = off;
+    return 0;
+}
+
+// remove e, shifting later entries of its probe run back into the gap
+static void table_del(QjEntry *e)
+{
+    size_t mask = g_qj.table_mask;
+    size_t i = (size_t)(e - g_qj.table);
+    size_t j = i;
+    for (;;) {
+        j = (j + 1) & mask;
+        if (g_qj.table[j].seq == 0) {
+            break;
+        }
+        size_t k = table_slot(g_qj.table[j].seq);
+        // an entry whose home lies cyclically in (i, j] is still reachable
+        if (i <= j ? (i < k && k <= j) : (i < k || k <= j)) {
+            continue;
+        }
+        g_qj.table[i] = g_qj.table[j];
+        i = j;
+    }
+    g_qj.table[i].seq = 0;
+    g_qj.table_len--;
+}
+
+// hand what was appended since the last call to msync (caller holds lock)
+static void seg_sync(QjSeg *g, int flags, bool all)
+{
+    size_t from = all ? 0 : g->synced & ~(g_qj.page - 1);
+    if (g->used > from) {
+        msync(g->map + from, g->used - from, flags);
+    }
+    g->synced = g->used;
+}
+
+static QjSeg *seg_by_id(uint32_t id)
+{
+    int i = (int)(id - g_qj.segs[0].id);
+    return i >= 0 && i < g_qj.nsegs ? &g_qj.segs[i] : NULL;
+}
+
+/* create and map the file of segment id into *g
+ * touches nothing shared, so the journal thread runs it unlocked
+ */
+static int seg_map(uint32_t id, QjSeg *g)
+{
+    char path[LOG_PATH_MAX + 16];
+    seg_path(path, sizeof(path), id);
+    int fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0600);
+    if (fd < 0) {
+        return -1;
+    }
+    // a fresh file reads as zeroes, which is what ends the records
+    if (ftruncate(fd, (off_t)g_qj.seg_size) != 0) {
+        close(fd);
+        unlink(path);
+        return -1;
+    }
+    void *map = mmap(NULL, g_qj.seg_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        unlink(path);
+        return -1;
+    }
+
+    QjSegHdr hdr = {.version = QJ_VERSION, .id = id, .size = g_qj.seg_size};
+    memcpy(hdr.magic, QJ_MAGIC, sizeof(hdr.magic));
+    memcpy(map, &hdr, sizeof(hdr));
+
+    *g = (QjSeg){.id = id, .map = map, .size = g_qj.seg_size, .used = sizeof(QjSegHdr)};
+    return 0;
+}
+
+// append a mapped segment as the newest (caller holds lock)
+static int seg_add(const QjSeg *g)
+{
+    if (g_qj.nsegs == g_qj.segs_cap) {
+        int cap = g_qj.segs_cap ? g_qj.segs_cap * 2 : 8;
+        QjSeg *tmp = realloc(g_qj.segs, (size_t)cap * sizeof(*tmp));
+        if (!tmp) {
+            return -1;
+        }
+        g_qj.segs = tmp;
+        g_qj.segs_cap = cap;
+    }
+    g_qj.segs[g_qj.nsegs++] = *g;
+    g_qj.stats.segments = g_qj.nsegs;
+    return 0;
+}
+
+static void seg_unlink(uint32_t id)
+{
+    char path[LOG_PATH_MAX + 16];
+    seg_path(path, sizeof(path), id);
+    unlink(path);
+}
+
+// MS_SYNC every segment in use, here and now (caller holds lock)
+static void sync_all_locked(void)
+{
+    for (int i = 0; i < g_qj.nsegs; i++) {
+        seg_sync(&g_qj.segs[i], MS_SYNC, true);
+    }
+}
+
+// one whole segment's mapping to msync outside the lock
+typedef struct {
+    char *map;
+    size_t len;
+} QjRange;
+
+/* the segments' ranges to msync: all of each when all, otherwise what was
+ * appended since the last call; *n set to the count (caller holds lock)
+ */
+static QjRange *ranges_locked(bool all, int *n)
+{
+    QjRange *r = malloc((size_t)(g_qj.nsegs > 0 ? g_qj.nsegs : 1) * sizeof(*r));
+    *n = 0;
+    for (int i = 0; r && i < g_qj.nsegs; i++) {
+        QjSeg *g = &g_qj.segs[i];
+        size_t from = all ? 0 : g->synced & ~(g_qj.page - 1);
+        if (g->used > from) {
+            r[(*n)++] = (QjRange){g->map + from, g->used - from};
+        }
+        g->synced = g->used;
+    }
+    return r;
+}
+
+// take the oldest segment out of use and delete it (caller holds lock)
+static void seg_drop_oldest(void)
+{
+    QjSeg old = g_qj.segs[0];
+    g_qj.nsegs--;
+    memmove(g_qj.segs, g_qj.segs + 1, (size_t)g_qj.nsegs * sizeof(*g_qj.segs));
+    g_qj.stats.segments = g_qj.nsegs;
+
+    QjRetired *r = g_qj.thread_up ? malloc(sizeof(*r)) : NULL;
+    if (r) {
+        *r = (QjRetired){.id = old.id, .map = old.map, .size = old.size,
+                         .sync_first = old.moved_out};
+        if (g_qj.retired_tail) {
+            g_qj.retired_tail->next = r;
+        } else {
+            g_qj.retired = r;
+        }
+        g_qj.retired_tail = r;
+        pthread_cond_signal(&g_qj.wake);
+        return;
+    }
+    // no journal thread (opening, or it could not start): do it here
+    if (old.moved_out) {
+        sync_all_locked();
+    }
+    munmap(old.map, old.size);
+    seg_unlink(old.id);
+}
+
+// create segment id as the newest, here and now (caller holds lock)
+static int seg_create(uint32_t id)
+{
+    QjSeg g;
+    if (seg_map(id, &g) != 0) {
+        return -1;
+    }
+    if (seg_add(&g) != 0) {
+        munmap(g.map, g.size);
+        seg_unlink(id);
+        return -1;
+    }
+    return 0;
+}
+
+// delete fully acked segments from the oldest on, always keeping the newest
+static void drop_drained(void)
+{
+    while (!g_qj.replaying && g_qj.nsegs > 1 && g_qj.segs[0].live == 0) {
+        seg_drop_oldest();
+    }
+}
+
+/* publish the record written at g->map + g->used: checksum, then len last
+ * returns the record's offset (caller holds lock)
+ */
+static uint32_t commit(QjSeg *g, uint32_t len)
+{
+    char *dst = g->map + g->used;
+    uint32_t sum = qj_sum(dst + 8, len - 8);
+    memcpy(dst + 4, &sum, sizeof(sum));
+    // the compiler must not move the len store ahead of the record it covers
+    atomic_signal_fence(memory_order_release);
+    memcpy(dst, &len, sizeof(len));
+
+    uint32_t off = (uint32_t)g->used;
+    g->used += len;
+    g_qj.stats.bytes += len;
+    if (!g_qj.thread_up) {
+        double now = monotonic_sec();
+        if (now - g_qj.last_sync >= QJOURNAL_SYNC_SEC) {
+            seg_sync(g, MS_ASYNC, false);
+            g_qj.last_sync = now;
+        }
+    }
+    return off;
+}
+
+/* copy the live pushes of the oldest segment into the newest, so it can be
+ * deleted; stops early when the newest fills (caller holds lock)
+ */
+static void compact_oldest(void)
+{
+    QjSeg *old = &g_qj.segs[0];
+    QjSeg *cur = &g_qj.segs[g_qj.nsegs - 1];
+    int moved = 0;
+    size_t off = sizeof(QjSegHdr);
+    while (off < old->used && old->live > 0) {
+        QjRec rec;
+        memcpy(&rec, old->map + off, sizeof(rec));
+        QjEntry *e = rec.type == QJ_PUSH ? table_find(rec.seq) : NULL;
+        if (e && e->seg == old->id && e->off == off) {
+            if (cur->used + rec.len > cur->size) {
+                break;
+            }
+            memcpy(cur->map + cur->used + 4, old->map + off + 4, rec.len - 4);
+            e->off = commit(cur, rec.len);
+            e->seg = cur->id;
+            old->live--;
+            old->live_bytes -= rec.len;
+            cur->live++;
+            cur->live_bytes += rec.len;
+            moved++;
+        }
+        off += rec.len;
+    }
+    if (moved > 0) {
+        // the copies must be on disk before the original is deleted
+        old->moved_out = true;
+        g_qj.stats.compacted += (uint64_t)moved;
+    }
+}
+
+// id the next segment gets (caller holds lock)
+static uint32_t next_id(void)
+{
+    return g_qj.nsegs > 0 ? g_qj.segs[g_qj.nsegs - 1].id + 1 : g_qj.first_id;
+}
+
+/* start the next segment: the one the journal thread made ahead, or (when
+ * a burst outran it) one made here (caller holds lock)
+ */
+static int rotate(void)
+{
+    uint32_t id = next_id();
+    while (g_qj.spare_making && g_qj.spare.id == id) {
+        pthread_cond_wait(&g_qj.done, &g_qj.lock);
+    }
+    if (g_qj.spare.map && g_qj.spare.id == id) {
+        if (seg_add(&g_qj.spare) != 0) {
+            return -1;
+        }
+        g_qj.spare.map = NULL;
+    } else if (seg_create(id) != 0) {
+        return -1;
+    }
+    if (g_qj.thread_up) {
+        pthread_cond_signal(&g_qj.wake); // make the one after
+    }
+    // copying a mostly live segment would only move the backlog around
+    if (!g_qj.replaying && g_qj.nsegs > QJOURNAL_COMPACT_SEGMENTS &&
+        g_qj.segs[0].live_bytes <= g_qj.seg_size / QJOURNAL_COMPACT_SHARE) {
+        compact_oldest();
+    }
+    drop_drained();
+    return 0;
+}
+
+// the newest segment with room for a len-byte record, or NULL (caller holds lock)
+static QjSeg *reserve(size_t len)
+{
+    if (len > g_qj.seg_size - sizeof(QjSegHdr)) {
+        return NULL;
+    }
+    if (g_qj.nsegs == 0 || g_qj.segs[g_qj.nsegs - 1].used + len > g_qj.seg_size) {
+        if (rotate() != 0) {
+            return NULL;
+        }
+    }
+    return &g_qj.segs[g_qj.nsegs - 1];
+}
+
+// append an ack for seq (caller holds lock)
+static void append_ack(uint64_t seq)
+{
+    QjSeg *g = reserve(sizeof(QjRec));
+    if (!g) {
+        return; // replayed again after a restart: a duplicate, never a loss
+    }
+    QjRec rec = {.seq = seq, .type = QJ_ACK};
+    memcpy(g->map + g->used + 4, (const char *)&rec + 4, sizeof(rec) - 4);
+    commit(g, sizeof(rec));
+}
+
+// is this a "<base>.<digits>" segment name? sets *id
+static bool segment_name(const char *name, const char *base, size_t base_len, uint32_t *id)
+{
+    if (strncmp(name, base, base_len) != 0 || name[base_len] != '.') {
+        return false;
+    }
+    const char *d = name + base_len + 1;
+    if (!*d || strlen(d) > 9) {
+        return false;
+    }
+    for (const char *p = d; *p; p++) {
+        if (*p < '0' || *p > '9') {
+            return false;
+        }
+    }
+    *id = (uint32_t)strtoul(d, NULL, 10);
+    return true;
+}
+
+static int cmp_u32(const void *a, const void *b)
+{
+    uint32_t x = *(const uint32_t *)a;
+    uint32_t y = *(const uint32_t *)b;
+    return (x > y) - (x < y);
+}
+
+static int cmp_entry_seq(const void *a, const void *b)
+{
+    uint64_t x = ((const QjEntry *)a)->seq;
+    uint64_t y = ((const QjEntry *)b)->seq;
+    return (x > y) - (x < y);
+}
+
+/* map the previous run's segments (oldest first) into *out
+ * returns the count, or -1 on error (caller holds lock)
+ */
+static int old_list(QjOld **out, uint32_t *max_id)
+{
+    char dir[LOG_PATH_MAX];
+    const char *slash = strrchr(g_qj.path, '/');
+    const char *base = slash ? slash + 1 : g_qj.path;
+    if (!slash) {
+        snprintf(dir, sizeof(dir), ".");
+    } else if (slash == g_qj.path) {
+        snprintf(dir, sizeof(dir), "/");
+    } else {
+        snprintf(dir, sizeof(dir), "%.*s", (int)(slash - g_qj.path), g_qj.path);
+    }
+    size_t base_len = strlen(base);
+    if (base_len == 0) {
+        return -1;
+    }
+
+    DIR *d = opendir(dir);
+    if (!d) {
+        return -1;
+    }
+    uint32_t *ids = NULL;
+    int n = 0;
+    int cap = 0;
+    struct dirent *de;
+    while ((de = readdir(d)) != NULL) {
+        uint32_t id;
+        if (!segment_name(de->d_name, base, base_len, &id)) {
+            continue;
+        }
+        if (n == cap) {
+            cap = cap ? cap * 2 : 16;
+            uint32_t *tmp = realloc(ids, (size_t)cap * sizeof(*tmp));
+            if (!tmp) {
+                free(ids);
+                closedir(d);
+                return -1;
+            }
+            ids = tmp;
+        }
+        ids[n++] = id;
+    }
+    closedir(d);
+    if (n > 1) {
+        qsort(ids, (size_t)n, sizeof(*ids), cmp_u32);
+    }
+
+    QjOld *old = calloc((size_t)(n > 0 ? n : 1), sizeof(*old));
+    if (!old) {
+        free(ids);
+        return -1;
+    }
+    for (int i = 0; i < n; i++) {
+        old[i].id = ids[i];
+        if (ids[i] > *max_id) {
+            *max_id = ids[i];
+        }
+        char path[LOG_PATH_MAX + 16];
+        seg_path(path, sizeof(path), ids[i]);
+        int fd = open(path, O_RDONLY);
+        struct stat st;
+        if (fd < 0 || fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(QjSegHdr)) {
+            if (fd >= 0) {
+                close(fd);
+            }
+            continue;
+        }
+        void *map = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        close(fd);
+        if (map == MAP_FAILED) {
+            continue;
+        }
+        QjSegHdr hdr;
+        memcpy(&hdr, map, sizeof(hdr));
+        static const QjSegHdr zero;
+        if (memcmp(hdr.magic, QJ_MAGIC, sizeof(hdr.magic)) == 0 && hdr.version == QJ_VERSION) {
+            old[i].map = map;
+            old[i].size = (size_t)st.st_size;
+            old[i].ours = true;
+        } else {
+            // created and never written by a run that died; anything else is left alone
+            old[i].ours = memcmp(&hdr, &zero, sizeof(hdr)) == 0;
+            munmap(map, (size_t)st.st_size);
+        }
+    }
+    free(ids);
+    *out = old;
+    return n;
+}
+
+/* fold one old segment's records into the table: a push adds its message,
+ * an ack removes it; stops at the first torn record (caller holds lock)
+ */
+static int old_scan(const QjOld *o, uint32_t idx, uint64_t *max_seq)
+{
+    size_t off = sizeof(QjSegHdr);
+    while (off + sizeof(QjRec) <= o->size) {
+        QjRec rec;
+        memcpy(&rec, o->map + off, sizeof(rec));
+        if (rec.len == 0) {
+            break;
+        }
+        if (rec.len < sizeof(QjRec) || rec.len % 8 || rec.len > o->size - off ||
+            qj_sum(o->map + off + 8, rec.len - 8) != rec.sum) {
+            break;
+        }
+        if (rec.type == QJ_PUSH) {
+            QjPush p;
+            if (rec.len < sizeof(QjRec) + sizeof(p)) {
+                break;
+            }
+            memcpy(&p, o->map + off + sizeof(QjRec), sizeof(p));
+            if ((size_t)p.text_len + 1 > rec.len - sizeof(QjRec) - sizeof(p) ||
+                o->map[off + sizeof(QjRec) + sizeof(p) + p.text_len] != '\0') {
+                break;
+            }
+            if (table_put(rec.seq, idx, (uint32_t)off) != 0) {
+                return -1;
+            }
+        } else if (rec.type == QJ_ACK) {
+            QjEntry *e = table_find(rec.seq);
+            if (e) {
+                table_del(e);
+            }
+        }
+        if (rec.seq > *max_seq) {
+            *max_seq = rec.seq;
+        }
+        off += rec.len;
+    }
+    return 0;
+}
+
+// unmap (and delete, if compacted) the previous run's segments
+static void old_release(QjOld *old, int n, bool unlink_ours)
+{
+    for (int i = 0; i < n; i++) {
+        if (old[i].map) {
+            munmap(old[i].map, old[i].size);
+        }
+        if (unlink_ours && old[i].ours) {
+            char path[LOG_PATH_MAX + 16];
+            seg_path(path, sizeof(path), old[i].id);
+            unlink(path);
+        }
+    }
+    free(old);
+}
+
+static struct timespec abs_timespec(double t)
+{
+    struct timespec ts;
+    ts.tv_sec = (time_t)t;
+    ts.tv_nsec = (long)((t - (double)ts.tv_sec) * 1e9);
+    if (ts.tv_nsec >= 1000000000L) {
+        ts.tv_sec++;
+        ts.tv_nsec -= 1000000000L;
+    }
+    return ts;
+}
+
+// msync ranges outside the lock, then free them
+static void sync_ranges(QjRange *r, int n, int flags)
+{
+    for (int i = 0; i < n; i++) {
+        msync(r[i].map, r[i].len, flags);
+    }
+    free(r);
+}
+
+/* the journal thread: the file work pushes and acks must not wait on
+ * (holds lock except around that work)
+ */
+static void *journal_main(void *arg)
+{
+    (void)arg;
+    pthread_mutex_lock(&g_qj.lock);
+    for (;;) {
+        double now = monotonic_sec();
+        if (g_qj.retired) {
+            // delete in order; first make the copies of compacted messages durable
+            QjRetired *batch = g_qj.retired;
+            g_qj.retired = g_qj.retired_tail = NULL;
+            bool sync = false;
+            for (QjRetired *r = batch; r; r = r->next) {
+                sync |= r->sync_first;
+            }
+            int n = 0;
+            QjRange *ranges = sync ? ranges_locked(true, &n) : NULL;
+            g_qj.deleting = true;
+            pthread_mutex_unlock(&g_qj.lock);
+            sync_ranges(ranges, n, MS_SYNC);
+            while (batch) {
+                QjRetired *next = batch->next;
+                munmap(batch->map, batch->size);
+                seg_unlink(batch->id);
+                free(batch);
+                batch = next;
+            }
+            pthread_mutex_lock(&g_qj.lock);
+            g_qj.deleting = false;
+            pthread_cond_broadcast(&g_qj.done);
+            continue;
+        }
+        if (g_qj.stopping) {
+            break;
+        }
+        if (!g_qj.spare.map && now >= g_qj.spare_retry) {
+            uint32_t id = next_id();
+            g_qj.spare.id = id;
+            g_qj.spare_making = true;
+            pthread_mutex_unlock(&g_qj.lock);
+            QjSeg g;
+            int rc = seg_map(id, &g);
+            pthread_mutex_lock(&g_qj.lock);
+            g_qj.spare_making = false;
+            if (rc == 0) {
+                g_qj.spare = g;
+            } else {
+                g_qj.spare_retry = now + QJOURNAL_SYNC_SEC;
+            }
+            pthread_cond_broadcast(&g_qj.done);
+            continue;
+        }
+        if (now - g_qj.last_sync >= QJOURNAL_SYNC_SEC) {
+            int n = 0;
+            QjRange *ranges = ranges_locked(false, &n);
+            g_qj.last_sync = now;
+            pthread_mutex_unlock(&g_qj.lock);
+            sync_ranges(ranges, n, MS_ASYNC);
+            pthread_mutex_lock(&g_qj.lock);
+            continue;
+        }
+        double until = g_qj.last_sync + QJOURNAL_SYNC_SEC;
+        if (!g_qj.spare.map && g_qj.spare_retry < until) {
+            until = g_qj.spare_retry;
+        }
+        struct timespec ts = abs_timespec(until);
+        pthread_cond_timedwait(&g_qj.wake, &g_qj.lock, &ts);
+    }
+    pthread_mutex_unlock(&g_qj.lock);
+    return NULL;
+}
+
+// drop this run's segment files and state after a failed open (caller holds lock)
+static void open_fail(void)
+{
+    while (g_qj.nsegs > 0) {
+        seg_drop_oldest();
+    }
+    free(g_qj.segs);
+    g_qj.segs = NULL;
+    g_qj.segs_cap = 0;
+    free(g_qj.table);
+    g_qj.table = NULL;
+}
+
+int qjournal_open(const char *path, size_t segment_bytes)
+{
+    pthread_mutex_lock(&g_qj.lock);
+    if (atomic_load(&g_qj.active) || !path || !path[0] || strlen(path) >= sizeof(g_qj.path)) {
+        pthread_mutex_unlock(&g_qj.lock);
+        return -1;
+    }
+    snprintf(g_qj.path, sizeof(g_qj.path), "%s", path);
+    g_qj.page = (size_t)sysconf(_SC_PAGESIZE);
+    size_t seg = segment_bytes > QJOURNAL_SEGMENT_MIN ? segment_bytes : QJOURNAL_SEGMENT_MIN;
+    g_qj.seg_size = (seg + g_qj.page - 1) & ~(g_qj.page - 1);
+    memset(&g_qj.stats, 0, sizeof(g_qj.stats));
+    g_qj.table = calloc(TABLE_INIT, sizeof(*g_qj.table));
+    if (!g_qj.table) {
+        pthread_mutex_unlock(&g_qj.lock);
+        return -1;
+    }
+    g_qj.table_mask = TABLE_INIT - 1;
+    g_qj.table_len = 0;
+
+    // what the previous run left, in the order it was written
+    QjOld *old = NULL;
+    uint32_t max_id = 0;
+    uint64_t max_seq = 0;
+    int nold = old_list(&old, &max_id);
+    if (nold < 0) {
+        open_fail();
+        pthread_mutex_unlock(&g_qj.lock);
+        return -1;
+    }
+    for (int i = 0; i < nold; i++) {
+        if (old[i].map && old_scan(&old[i], (uint32_t)i, &max_seq) != 0) {
+            old_release(old, nold, false);
+            open_fail();
+            pthread_mutex_unlock(&g_qj.lock);
+            return -1;
+        }
+    }
+
+    // its live messages, oldest first
+    size_t nlive = g_qj.table_len;
+    QjEntry *live = malloc((nlive > 0 ? nlive : 1) * sizeof(*live));
+    if (!live) {
+        old_release(old, nold, false);
+        open_fail();
+        pthread_mutex_unlock(&g_qj.lock);
+        return -1;
+    }
+    size_t k = 0;
+    for (size_t i = 0; i <= g_qj.table_mask; i++) {
+        if (g_qj.table[i].seq) {
+            live[k++] = g_qj.table[i];
+        }
+    }
+    qsort(live, nlive, sizeof(*live), cmp_entry_seq);
+    memset(g_qj.table, 0, (g_qj.table_mask + 1) * sizeof(*g_qj.table));
+    g_qj.table_len = 0;
+
+    // compact them into fresh segments, keeping their seqs
+    g_qj.first_id = max_id + 1;
+    g_qj.replaying = true;
+    int rc = rotate();
+    for (size_t i = 0; rc == 0 && i < nlive; i++) {
+        const char *src = old[live[i].seg].map + live[i].off;
+        uint32_t len;
+        memcpy(&len, src, sizeof(len));
+        QjSeg *g = reserve(len);
+        if (!g) {
+            rc = -1;
+            break;
+        }
+        memcpy(g->map + g->used + 4, src + 4, len - 4);
+        uint32_t off = commit(g, len);
+        rc = table_put(live[i].seq, g->id, off);
+        g->live++;
+        g->live_bytes += len;
+    }
+    free(live);
+    if (rc != 0) {
+        old_release(old, nold, false);
+        open_fail();
+        g_qj.replaying = false;
+        pthread_mutex_unlock(&g_qj.lock);
+        return -1;
+    }
+    // the copies reach the disk before the files they came from are deleted
+    sync_all_locked();
+    old_release(old, nold, true);
+
+    g_qj.next_seq = max_seq + 1;
+    g_qj.last_sync = monotonic_sec();
+    g_qj.spare_retry = 0.0;
+    g_qj.stopping = false;
+    pthread_condattr_t ca;
+    pthread_condattr_init(&ca);
+    pthread_condattr_setclock(&ca, CLOCK_MONOTONIC);
+    pthread_cond_init(&g_qj.wake, &ca);
+    pthread_condattr_destroy(&ca);
+    pthread_cond_init(&g_qj.done, NULL);
+    // without the thread the file work is done inline, as while opening
+    g_qj.thread_up = pthread_create(&g_qj.thread, NULL, journal_main, NULL) == 0;
+    atomic_store(&g_qj.active, true);
+    pthread_mutex_unlock(&g_qj.lock);
+    return 0;
+}
+
+bool qjournal_active(void)
+{
+    return atomic_load_explicit(&g_qj.active, memory_order_acquire);
+}
+
+size_t qjournal_replay(QJournalReplayFn fn, void *ud)
+{
+    size_t n = 0;
+    pthread_mutex_lock(&g_qj.lock);
+    double wall = wall_sec();
+    // fn may ack, which appends (and may add a segment) but deletes none
+    // while replaying, so the walk's index and offsets stay valid
+    for (int i = 0; g_qj.replaying && i < g_qj.nsegs; i++) {
+        size_t off = sizeof(QjSegHdr);
+        while (off < g_qj.segs[i].used) {
+            const char *p = g_qj.segs[i].map + off;
+            QjRec rec;
+            memcpy(&rec, p, sizeof(rec));
+            QjEntry *e = rec.type == QJ_PUSH ? table_find(rec.seq) : NULL;
+            if (e && e->seg == g_qj.segs[i].id && e->off == off) {
+                QjPush push;
+                memcpy(&push, p + sizeof(rec), sizeof(push));
+                QJournalEntry je = {
+                    .seq = rec.seq,
+                    .user_id = push.user_id,
+                    .chat_id = push.chat_id,
+                    .age_sec = wall > push.wall_sec ? wall - push.wall_sec : 0.0,
+                    .kind = rec.kind,
+                    .merged = (int)rec.merged,
+                    .text = p + sizeof(rec) + sizeof(push),
+                    .len = push.text_len,
+                };
+                g_qj.stats.replayed++;
+                n++;
+                pthread_mutex_unlock(&g_qj.lock);
+                fn(&je, ud);
+                pthread_mutex_lock(&g_qj.lock);
+            }
+            off += rec.len;
+        }
+    }
+    g_qj.replaying = false;
+    if (g_qj.nsegs > 0) {
+        drop_drained();
+    }
+    pthread_mutex_unlock(&g_qj.lock);
+    return n;
+}
+
+uint64_t qjournal_push(int64_t user_id, int64_t chat_id, int kind, int merged, double age_sec,
+                       const char *text, size_t len)
+{
+    if (!qjournal_active()) {
+        return 0;
+    }
+    size_t rlen = sizeof(QjRec) + sizeof(QjPush) + len + 1;
+    pthread_mutex_lock(&g_qj.lock);
+    QjSeg *g = atomic_load(&g_qj.active) && len < UINT32_MAX ? reserve(rlen) : NULL;
+    if (!g) {
+        g_qj.stats.failed++;
+        pthread_mutex_unlock(&g_qj.lock);
+        return 0;
+    }
+    uint64_t seq = g_qj.next_seq++;
+    QjRec rec = {
+        .seq = seq,
+        .type = QJ_PUSH,
+        .kind = (uint8_t)kind,
+        .merged = (uint32_t)merged,
+    };
+    QjPush p = {
+        .user_id = user_id,
+        .chat_id = chat_id,
+        .wall_sec = wall_sec() - (age_sec > 0 ? age_sec : 0.0),
+        .text_len = (uint32_t)len,
+    };
+    // the padding after the NUL is still the file's zeroes
+    char *dst = g->map + g->used;
+    memcpy(dst + 4, (const char *)&rec + 4, sizeof(rec) - 4);
+    memcpy(dst + sizeof(rec), &p, sizeof(p));
+    memcpy(dst + sizeof(rec) + sizeof(p), text, len);
+    dst[sizeof(rec) + sizeof(p) + len] = '\0';
+    uint32_t off = commit(g, align8(rlen));
+
+    if (table_put(seq, g->id, off) != 0) {
+        append_ack(seq);
+        g_qj.stats.failed++;
+        pthread_mutex_unlock(&g_qj.lock);
+        return 0;
+    }
+    g->live++;
+    g->live_bytes += align8(rlen);
+    g_qj.stats.pushes++;
+    pthread_mutex_unlock(&g_qj.lock);
+    return seq;
+}
+
+void qjournal_ack(uint64_t seq)
+{
+    if (seq == 0 || !qjournal_active()) {
+        return;
+    }
+    pthread_mutex_lock(&g_qj.lock);
+    QjEntry *e = atomic_load(&g_qj.active) ? table_find(seq) : NULL;
+    if (e) {
+        QjSeg *g = seg_by_id(e->seg);
+        if (g) {
+            uint32_t len;
+            memcpy(&len, g->map + e->off, sizeof(len));
+            g->live--;
+            g->live_bytes -= len;
+        }
+        table_del(e);
+        append_ack(seq);
+        g_qj.stats.acks++;
+        drop_drained();
+    }
+    pthread_mutex_unlock(&g_qj.lock);
+}
+
+void qjournal_flush(void)
+{
+    pthread_mutex_lock(&g_qj.lock);
+    if (g_qj.thread_up) {
+        pthread_cond_signal(&g_qj.wake);
+        while (g_qj.retired || g_qj.deleting || g_qj.spare_making ||
+               (!g_qj.spare.map && monotonic_sec() >= g_qj.spare_retry)) {
+            pthread_cond_wait(&g_qj.done, &g_qj.lock);
+        }
+    }
+    pthread_mutex_unlock(&g_qj.lock);
+}
+
+void qjournal_stats(QJournalStats *out)
+{
+    pthread_mutex_lock(&g_qj.lock);
+    *out = g_qj.stats;
+    out->segments = g_qj.nsegs;
+    out->live = g_qj.table_len;
+    pthread_mutex_unlock(&g_qj.lock);
+}
+
+void qjournal_close(void)
+{
+    pthread_mutex_lock(&g_qj.lock);
+    if (!atomic_load(&g_qj.active)) {
+        pthread_mutex_unlock(&g_qj.lock);
+        return;
+    }
+    atomic_store(&g_qj.active, false);
+    if (g_qj.thread_up) {
+        // it finishes the deletions queued so far, then leaves
+        g_qj.stopping = true;
+        pthread_cond_signal(&g_qj.wake);
+        pthread_mutex_unlock(&g_qj.lock);
+        pthread_join(g_qj.thread, NULL);
+        pthread_mutex_lock(&g_qj.lock);
+        g_qj.thread_up = false;
+    }
+    pthread_cond_destroy(&g_qj.wake);
+    pthread_cond_destroy(&g_qj.done);
+    if (g_qj.spare.map) {
+        munmap(g_qj.spare.map, g_qj.spare.size);
+        seg_unlink(g_qj.spare.id);
+        g_qj.spare.map = NULL;
+    }
+    for (int i = 0; i < g_qj.nsegs; i++) {
+        seg_sync(&g_qj.segs[i], MS_SYNC, true);
+        munmap(g_qj.segs[i].map, g_qj.segs[i].size);
+    }
+    free(g_qj.segs);
+    g_qj.segs = NULL;
+    g_qj.nsegs = 0;
+    g_qj.segs_cap = 0;
+    free(g_qj.table);
+    g_qj.table = NULL;
+    g_qj.table_len = 0;
+    g_qj.replaying = false;
+    pthread_mutex_unlock(&g_qj.lock);
+}
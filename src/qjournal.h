@@ -0,0 +1,90 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/* durable journal of queued messages, so a restart loses none of them
+ * the queue appends a push record for every message it accepts and an ack
+ * record once the message is answered (or dropped on purpose), into
+ * memory-mapped segment files "<path>.<n>" of a fixed size. nothing is
+ * fsynced per message: appends are handed to msync (MS_ASYNC) at most every
+ * QJOURNAL_SYNC_SEC, segments are synced fully on close, and a record's
+ * checksum lets a torn tail after a crash be cut off on the next open.
+ * segments are deleted oldest first once everything in them is acked; past
+ * QJOURNAL_COMPACT_SEGMENTS a rotation copies the oldest segment's live
+ * messages forward so one stuck message cannot pin the files behind it
+ *
+ * thread-safe. a push or ack only copies into the mapped newest segment
+ * under the journal's lock; a background thread makes the next segment
+ * ahead of time, deletes drained ones and does the msyncs. the queue never
+ * calls in while holding a shard lock, and the journal never calls back
+ * into the queue
+ */
+
+/* open the journal, reading any segments a previous run left at path
+ * their live messages are compacted into fresh segments (in their original
+ * order) and the old files deleted; qjournal_replay() hands them out
+ * segment_bytes is rounded up to the page size and QJOURNAL_SEGMENT_MIN
+ * returns 0, or -1 (journal stays closed) if path cannot be used
+ */
+int qjournal_open(const char *path, size_t segment_bytes);
+
+// true between a successful qjournal_open() and qjournal_close()
+bool qjournal_active(void);
+
+/* a message left from the previous run
+ * text points into the journal and stays valid until qjournal_close()
+ */
+typedef struct {
+    uint64_t seq;       // pass to qjournal_ack() once it is taken
+    int64_t user_id;
+    int64_t chat_id;
+    double age_sec;     // wall-clock seconds since it first arrived (>= 0)
+    int kind;           // QueueKind
+    int merged;         // messages folded into text
+    const char *text;   // NUL-terminated
+    size_t len;
+} QJournalEntry;
+
+typedef void (*QJournalReplayFn)(const QJournalEntry *e, void *ud);
+
+/* call fn for each message left from the previous run, oldest first
+ * call once after qjournal_open(), before anything is pushed; fn may ack
+ * returns the number of messages handed out
+ */
+size_t qjournal_replay(QJournalReplayFn fn, void *ud);
+
+/* journal a message the queue accepted; age_sec puts its arrival that far
+ * in the past (a merged message keeps its first arrival)
+ * returns the record's seq, or 0 if the journal is closed or the record
+ * could not be written (the message is then queued without it)
+ */
+uint64_t qjournal_push(int64_t user_id, int64_t chat_id, int kind, int merged, double age_sec,
+                       const char *text, size_t len);
+
+// the message pushed as seq is done with (0 and unknown seqs are ignored)
+void qjournal_ack(uint64_t seq);
+
+typedef struct {
+    int segments;       // segment files in use
+    uint64_t live;      // messages pushed and not acked
+    uint64_t pushes;
+    uint64_t acks;
+    uint64_t replayed;  // messages handed out by qjournal_replay()
+    uint64_t compacted; // live messages copied forward out of an old segment
+    uint64_t failed;    // pushes not journaled (segment could not be created)
+    uint64_t bytes;     // record bytes appended
+} QJournalStats;
+
+void qjournal_stats(QJournalStats *out);
+
+/* wait until the background thread has caught up: retired segments are
+ * deleted and the next one is made (a no-op while the journal is closed)
+ */
+void qjournal_flush(void);
+
+/* sync every segment to disk and unmap it; the files stay for the next
+ * qjournal_open(), which replays whatever was not acked
+ */
+void qjournal_close(void);
@@ -2,31 +2,109 @@
 
 #include "queue.h"
 #include "config.h"
+#include "qjournal.h"
 
 #include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <time.h>
 
+// deadline published for a shard with nothing queued
+#define NO_DEADLINE 1e300
+
+// how long a thief backs off when a victim shard's lock is contended
+#define STEAL_RETRY_SEC 0.001
+
+// ring headers carved per slab allocation
+#define RING_SLAB_COUNT 16
+
 typedef struct {
     int64_t chat_id;
-    char text[1024];
     double ingress_sec; // CLOCK_MONOTONIC seconds
+    uint64_t trace_id;  // from queue_push_traced, 0 when untraced
+    MsgBuf *buf;        // the message as pushed, owned by the queue
+    int merged;         // messages folded in by the QUEUE_MERGE overflow policy
+    int njmore;
+    uint64_t jseq;      // journal record (qjournal_push), 0 when not journaled
+    uint64_t *jmore;    // records of the messages QUEUE_MERGE folded in (njmore)
 } Slot;
 
-// per-user ring buffer (FIFO)
+/* per-user ring buffer (FIFO)
+ * header and slot array are one fixed-size object from the shard's slab, so
+ * creating and draining rings never touches malloc in steady state
+ */
 typedef struct UserRing {
     int64_t user_id;
-    Slot *slots;
+    uint64_t hash; // hash_user(user_id), kept for rehashing
     int head; // next read position
     int tail; // next write position
     int count;
-    int cap;               // always a power-of-2
-    int cap_mask;          // cap - 1, for bitmask modulo
-    struct UserRing *next; // hash chain
+    int cap;                  // always a power-of-2
+    int cap_mask;             // cap - 1, for bitmask modulo
+    double next_eligible;     // CLOCK_MONOTONIC time the head may be handed out
+    int heap_idx;             // position in the shard's heap while waiting
+    struct UserRing *rr_next; // ready list link while due
+    struct UserRing *next;    // hash chain, or free list while pooled
+    Slot slots[];
 } UserRing;
 
+// a literal reply waiting on the shard's direct lane
+typedef struct LaneMsg {
+    struct LaneMsg *next;
+    int64_t user_id;
+    int64_t chat_id;
+    double ingress_sec;
+    uint64_t trace_id;
+    QueueKind kind;
+    MsgBuf *buf;
+    uint64_t jseq;
+} LaneMsg;
+
+// slab of RING_SLAB_COUNT ring objects; objects follow the header
+typedef struct RingSlab {
+    struct RingSlab *next;
+    max_align_t pad_; // keeps the objects after it suitably aligned
+} RingSlab;
+
+/* one shard of the queue, normally owned by one worker
+ * every allocated ring is non-empty and is either on the ready list (due,
+ * served round-robin in O(1)) or in the min-heap keyed by next_eligible
+ * (not due yet), so the shard's earliest future deadline is heap[0]. with
+ * reply_delay 0 rings never enter the heap at all. literal replies skip
+ * the rings for the direct lane, which is drained before either.
+ * pending, waiters and next_due are also read without the lock by workers
+ * of other shards deciding whether there is anything to steal
+ */
+typedef struct {
+    _Alignas(64) pthread_mutex_t mtx;
+    pthread_cond_t cond; // bound to CLOCK_MONOTONIC for timed waits
+    UserRing **table; // user hash table, grows with the live ring count
+    unsigned table_mask;
+    UserRing *ready_head;
+    UserRing *ready_tail;
+    UserRing **heap;
+    int heap_len;
+    int heap_cap;
+    LaneMsg *lane_head; // direct lane: FIFO of literal replies
+    LaneMsg *lane_tail;
+    int lane_len;
+    _Atomic int pending;      // messages across this shard's rings and lane
+    _Atomic int waiters;      // workers asleep on cond
+    _Atomic double next_due;  // 0 while anything is due, else heap[0]->next_eligible or NO_DEADLINE
+
+    // allocators (under mtx)
+    RingSlab *slabs;
+    UserRing *ring_pool; // free ring objects
+    int rings_live;
+    int rings_pooled;
+    size_t slab_bytes;
+    size_t text_live_bytes; // MsgBufs held in rings and the lane
+} Shard;
+
 // round up to next power-of-2 for bitmask modulo on ring indices
 static int round_up_pow2(int v)
 {
@@ -44,15 +122,22 @@ static int round_up_pow2(int v)
     return v;
 }
 
-// global queue state
+/* global queue state
+ * a user always hashes to the same shard, so their messages stay in one
+ * ring and keep FIFO order; workers pop from their own shard and steal
+ * due messages from others when theirs has nothing ready
+ */
 static struct {
-    UserRing *buckets[QUEUE_BUCKETS];
-    pthread_mutex_t mtx;
-    pthread_cond_t cond;
-    int total_pending; // total messages across all users
+    Shard *shards;
+    int nshards;
     int ring_size;
-    int shutdown;
-    int rr_bucket;     // round-robin cursor for fair pop
+    int ring_cap;        // ring_size rounded up to a power of two
+    size_t ring_obj;     // bytes per ring object (header + slots)
+    double reply_delay; // written with every shard locked, read with any one
+    double coalesce;    // burst window, same locking as reply_delay
+    double max_age;     // shed prompts older than this at pickup, same locking
+    QueueOverflow overflow; // full-ring policy, same locking
+    _Atomic int shutdown;
 } g_queue;
 
 static double monotonic_sec(void)
@@ -62,7 +147,7 @@ static double monotonic_sec(void)
     return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
 }
 
-static unsigned hash_user(int64_t user_id)
+static uint64_t hash_user(int64_t user_id)
 {
     uint64_t h = (uint64_t)user_id;
     h ^= h >> 33;
@@ -70,14 +155,327 @@ static unsigned hash_user(int64_t user_id)
     h ^= h >> 33;
     h *= 0xc4ceb9fe1a85ec53ULL;
     h ^= h >> 33;
-    return (unsigned)(h & QUEUE_BUCKET_MASK);
+    return h;
+}
+
+uint64_t queue_hash_user(int64_t user_id)
+{
+    return hash_user(user_id);
+}
+
+// low bits pick the bucket, high bits the shard, so the two stay independent
+static Shard *shard_of(uint64_t h)
+{
+    return &g_queue.shards[(h >> 32) % (uint64_t)g_queue.nshards];
+}
+
+// min-heap helpers (caller holds s->mtx)
+static void heap_swap(Shard *s, int a, int b)
+{
+    UserRing *tmp = s->heap[a];
+    s->heap[a] = s->heap[b];
+    s->heap[b] = tmp;
+    s->heap[a]->heap_idx = a;
+    s->heap[b]->heap_idx = b;
+}
+
+static void heap_sift_up(Shard *s, int i)
+{
+    while (i > 0) {
+        int parent = (i - 1) / 2;
+        if (s->heap[parent]->next_eligible <= s->heap[i]->next_eligible) {
+            break;
+        }
+        heap_swap(s, i, parent);
+        i = parent;
+    }
+}
+
+static void heap_sift_down(Shard *s, int i)
+{
+    for (;;) {
+        int l = 2 * i + 1;
+        int r = l + 1;
+        int min = i;
+        if (l < s->heap_len && s->heap[l]->next_eligible < s->heap[min]->next_eligible) {
+            min = l;
+        }
+        if (r < s->heap_len && s->heap[r]->next_eligible < s->heap[min]->next_eligible) {
+            min = r;
+        }
+        if (min == i) {
+            break;
+        }
+        heap_swap(s, i, min);
+        i = min;
+    }
+}
+
+static int heap_insert(Shard *s, UserRing *r)
+{
+    if (s->heap_len == s->heap_cap) {
+        int new_cap = s->heap_cap == 0 ? 64 : s->heap_cap * 2;
+        UserRing **tmp = realloc(s->heap, (size_t)new_cap * sizeof(*tmp));
+        if (!tmp) {
+            return -1;
+        }
+        s->heap = tmp;
+        s->heap_cap = new_cap;
+    }
+    r->heap_idx = s->heap_len;
+    s->heap[s->heap_len++] = r;
+    heap_sift_up(s, r->heap_idx);
+    return 0;
+}
+
+static void heap_remove(Shard *s, UserRing *r)
+{
+    int i = r->heap_idx;
+    s->heap_len--;
+    if (i != s->heap_len) {
+        s->heap[i] = s->heap[s->heap_len];
+        s->heap[i]->heap_idx = i;
+        heap_sift_down(s, i);
+        heap_sift_up(s, i);
+    }
+}
+
+// make room for n rings so later heap_insert calls cannot fail (caller holds s->mtx)
+static int heap_reserve(Shard *s, int n)
+{
+    if (n <= s->heap_cap) {
+        return 0;
+    }
+    int new_cap = s->heap_cap == 0 ? 64 : s->heap_cap;
+    while (new_cap < n) {
+        new_cap *= 2;
+    }
+    UserRing **tmp = realloc(s->heap, (size_t)new_cap * sizeof(*tmp));
+    if (!tmp) {
+        return -1;
+    }
+    s->heap = tmp;
+    s->heap_cap = new_cap;
+    return 0;
+}
+
+// ready list: intrusive FIFO of due rings (caller holds s->mtx)
+static void ready_append(Shard *s, UserRing *r)
+{
+    r->rr_next = NULL;
+    if (s->ready_tail) {
+        s->ready_tail->rr_next = r;
+    } else {
+        s->ready_head = r;
+    }
+    s->ready_tail = r;
+}
+
+static UserRing *ready_pop(Shard *s)
+{
+    UserRing *r = s->ready_head;
+    if (r) {
+        s->ready_head = r->rr_next;
+        if (!s->ready_head) {
+            s->ready_tail = NULL;
+        }
+        r->rr_next = NULL;
+    }
+    return r;
+}
+
+// queue a non-empty ring by its next_eligible (caller holds s->mtx)
+static void ring_schedule(Shard *s, UserRing *r, double now)
+{
+    // capacity was reserved when the ring was created, so this only
+    // falls back to the ready list if that invariant is ever broken
+    if (r->next_eligible <= now || heap_insert(s, r) != 0) {
+        ready_append(s, r);
+    }
+}
+
+// republish the shard's earliest deadline for lock-free readers (caller holds s->mtx)
+static void publish_due(Shard *s)
+{
+    double due = s->lane_head || s->ready_head ? 0.0
+                 : s->heap_len > 0 ? s->heap[0]->next_eligible
+                                   : NO_DEADLINE;
+    atomic_store_explicit(&s->next_due, due, memory_order_relaxed);
+}
+
+MsgBuf *queue_buf_new(size_t cap)
+{
+    MsgBuf *b = malloc(sizeof(*b) + cap + 1);
+    if (b) {
+        b->len = 0;
+        b->text[0] = '\0';
+    }
+    return b;
+}
+
+void queue_buf_free(MsgBuf *buf)
+{
+    free(buf);
+}
+
+static MsgBuf *buf_copy(const char *text)
+{
+    size_t len = strlen(text);
+    MsgBuf *b = queue_buf_new(len);
+    if (b) {
+        memcpy(b->text, text, len + 1);
+        b->len = len;
+    }
+    return b;
+}
+
+// what a queued buffer counts toward QueueMemStats.text_bytes
+static size_t buf_bytes(const MsgBuf *b)
+{
+    return sizeof(*b) + b->len + 1;
 }
 
-// find or create a ring for user_id (caller holds mtx)
-static UserRing *ring_get_or_create(int64_t user_id)
+/* append "\n" and len bytes of text to *dst, growing it
+ * returns 0, or -1 (and *dst unchanged) when out of memory
+ */
+static int buf_append(MsgBuf **dst, const char *text, size_t len)
+{
+    MsgBuf *d = *dst;
+    size_t total = d->len + 1 + len;
+    MsgBuf *grown = realloc(d, sizeof(*grown) + total + 1);
+    if (!grown) {
+        return -1;
+    }
+    grown->text[grown->len] = '\n';
+    memcpy(grown->text + grown->len + 1, text, len);
+    grown->text[total] = '\0';
+    grown->len = total;
+    *dst = grown;
+    return 0;
+}
+
+// drop a queued buffer (caller holds s->mtx)
+static void buf_release(Shard *s, MsgBuf *b)
+{
+    s->text_live_bytes -= buf_bytes(b);
+    free(b);
+}
+
+// give a queued buffer to a popped message (caller holds s->mtx)
+static void buf_hand_out(Shard *s, QueueMsg *out, MsgBuf *b)
+{
+    s->text_live_bytes -= buf_bytes(b);
+    out->buf = b;
+    out->text = b->text;
+    out->len = b->len;
+}
+
+/* note a journal record out stands for, to be acked by queue_msg_done
+ * a record that cannot be noted (out of memory) stays live and is replayed
+ * after a restart: a duplicate, never a loss
+ */
+static void jseq_note(QueueMsg *out, uint64_t seq)
+{
+    if (seq == 0) {
+        return;
+    }
+    if (out->jseqs == out->jseq_cap) {
+        int cap = out->jseq_cap ? out->jseq_cap * 2 : 4;
+        uint64_t *tmp = realloc(out->jseq, (size_t)cap * sizeof(*tmp));
+        if (!tmp) {
+            return;
+        }
+        out->jseq = tmp;
+        out->jseq_cap = cap;
+    }
+    out->jseq[out->jseqs++] = seq;
+}
+
+// move a slot's journal records to out (caller holds s->mtx)
+static void slot_hand_jseqs(QueueMsg *out, Slot *slot)
+{
+    jseq_note(out, slot->jseq);
+    for (int i = 0; i < slot->njmore; i++) {
+        jseq_note(out, slot->jmore[i]);
+    }
+    free(slot->jmore);
+    slot->jmore = NULL;
+    slot->njmore = 0;
+    slot->jseq = 0;
+}
+
+// take a ring object from the pool, carving a new slab if empty (caller holds s->mtx)
+static UserRing *ring_alloc(Shard *s)
 {
-    unsigned idx = hash_user(user_id);
-    UserRing *r = g_queue.buckets[idx];
+    if (!s->ring_pool) {
+        size_t hdr = offsetof(RingSlab, pad_) + sizeof(max_align_t);
+        size_t bytes = hdr + RING_SLAB_COUNT * g_queue.ring_obj;
+        RingSlab *slab = malloc(bytes);
+        if (!slab) {
+            return NULL;
+        }
+        slab->next = s->slabs;
+        s->slabs = slab;
+        s->slab_bytes += bytes;
+        char *base = (char *)slab + hdr;
+        for (int i = RING_SLAB_COUNT - 1; i >= 0; i--) {
+            UserRing *r = (UserRing *)(void *)(base + (size_t)i * g_queue.ring_obj);
+            r->next = s->ring_pool;
+            s->ring_pool = r;
+        }
+        s->rings_pooled += RING_SLAB_COUNT;
+    }
+    UserRing *r = s->ring_pool;
+    s->ring_pool = r->next;
+    s->rings_pooled--;
+    s->rings_live++;
+    memset(r, 0, sizeof(*r));
+    return r;
+}
+
+// unlink a drained, unscheduled ring from its hash chain and pool it (caller holds s->mtx)
+static void ring_free(Shard *s, UserRing *r)
+{
+    UserRing **pp = &s->table[r->hash & s->table_mask];
+    while (*pp && *pp != r) {
+        pp = &(*pp)->next;
+    }
+    if (*pp) {
+        *pp = r->next;
+    }
+    r->next = s->ring_pool;
+    s->ring_pool = r;
+    s->rings_pooled++;
+    s->rings_live--;
+}
+
+// double the hash table once the load factor passes 1 (caller holds s->mtx)
+static void table_grow(Shard *s)
+{
+    unsigned size = s->table_mask + 1;
+    UserRing **t = calloc((size_t)size * 2, sizeof(*t));
+    if (!t) {
+        return; // keep chaining in the old table
+    }
+    unsigned mask = size * 2 - 1;
+    for (unsigned i = 0; i < size; i++) {
+        UserRing *r = s->table[i];
+        while (r) {
+            UserRing *next = r->next;
+            r->next = t[r->hash & mask];
+            t[r->hash & mask] = r;
+            r = next;
+        }
+    }
+    free(s->table);
+    s->table = t;
+    s->table_mask = mask;
+}
+
+// find or create a ring for user_id (caller holds s->mtx); new rings are unscheduled
+static UserRing *ring_get_or_create(Shard *s, int64_t user_id, uint64_t h)
+{
+    UserRing *r = s->table[h & s->table_mask];
     while (r) {
         if (r->user_id == user_id) {
             return r;
@@ -85,197 +483,824 @@ static UserRing *ring_get_or_create(int64_t user_id)
         r = r->next;
     }
 
-    r = calloc(1, sizeof(*r));
+    if (heap_reserve(s, s->rings_live + 1) != 0) {
+        return NULL;
+    }
+    r = ring_alloc(s);
     if (!r) {
         return NULL;
     }
     r->user_id = user_id;
-    r->cap = round_up_pow2(g_queue.ring_size);
+    r->hash = h;
+    r->cap = g_queue.ring_cap;
     r->cap_mask = r->cap - 1;
-    r->slots = calloc((size_t)r->cap, sizeof(Slot));
-    if (!r->slots) {
-        free(r);
-        return NULL;
-    }
+    r->heap_idx = -1;
 
-    r->next = g_queue.buckets[idx];
-    g_queue.buckets[idx] = r;
+    if ((unsigned)s->rings_live > s->table_mask + 1) {
+        table_grow(s);
+    }
+    unsigned idx = (unsigned)(h & s->table_mask);
+    r->next = s->table[idx];
+    s->table[idx] = r;
     return r;
 }
 
-/* find any non-empty ring and pop its head (caller holds mtx)
- * uses round-robin across buckets so one spammy user cannot starve others
- * writes the popped user_id into *out_user_id
- * returns 1 on success, 0 if everything is empty
+// hand out the oldest literal reply, if any (caller holds s->mtx)
+static int lane_pop(Shard *s, QueueMsg *out)
+{
+    LaneMsg *m = s->lane_head;
+    if (!m) {
+        return 0;
+    }
+    s->lane_head = m->next;
+    if (!s->lane_head) {
+        s->lane_tail = NULL;
+    }
+    s->lane_len--;
+    out->user_id = m->user_id;
+    out->chat_id = m->chat_id;
+    out->ingress_sec = m->ingress_sec;
+    out->trace_id = m->trace_id;
+    out->merged = 1;
+    out->kind = m->kind;
+    buf_hand_out(s, out, m->buf);
+    jseq_note(out, m->jseq);
+    free(m);
+    atomic_fetch_sub(&s->pending, 1);
+    return 1;
+}
+
+/* hand out the next due message (caller holds s->mtx)
+ * the direct lane goes first; otherwise the head of the next due ring.
+ * rings whose deadline has passed move from the heap to the tail of the
+ * ready list in deadline order; the popped ring goes back to the tail (or
+ * the heap if its next message is not due yet) - round-robin across users
+ * so one spammy user cannot starve others, at O(1) per pop once due
+ * returns 1 on success, 0 if nothing is due (deadlines ignored on shutdown)
  * frees the ring if it drains to zero (prevents unbounded memory growth)
  */
-static int ring_pop_any(Slot *out, int64_t *out_user_id)
+static int ring_pop_due(Shard *s, QueueMsg *out, double now, int shutdown)
 {
-    int start = g_queue.rr_bucket;
-    for (int i = 0; i < QUEUE_BUCKETS; i++) {
-        int idx = (start + i) & QUEUE_BUCKET_MASK;
-        UserRing *prev = NULL;
-        UserRing *r = g_queue.buckets[idx];
-        while (r) {
-            if (r->count > 0) {
-                *out = r->slots[r->head];
-                *out_user_id = r->user_id;
-                r->head = (r->head + 1) & r->cap_mask;
-                r->count--;
-                g_queue.total_pending--;
-                g_queue.rr_bucket = (idx + 1) & QUEUE_BUCKET_MASK;
-
-                // free the ring if it drained to zero
-                if (r->count == 0) {
-                    if (prev) {
-                        prev->next = r->next;
-                    } else {
-                        g_queue.buckets[idx] = r->next;
-                    }
-                    free(r->slots);
-                    free(r);
-                }
-                return 1;
+    if (lane_pop(s, out)) {
+        publish_due(s);
+        return 1;
+    }
+
+    while (s->heap_len > 0 && s->heap[0]->next_eligible <= now) {
+        UserRing *due = s->heap[0];
+        heap_remove(s, due);
+        ready_append(s, due);
+    }
+    if (!s->ready_head && shutdown && s->heap_len > 0) {
+        UserRing *early = s->heap[0];
+        heap_remove(s, early);
+        ready_append(s, early);
+    }
+
+    UserRing *r = ready_pop(s);
+    if (!r) {
+        return 0;
+    }
+
+    Slot *slot = &r->slots[r->head];
+    out->user_id = r->user_id;
+    out->chat_id = slot->chat_id;
+    out->ingress_sec = slot->ingress_sec;
+    out->trace_id = slot->trace_id;
+    out->merged = slot->merged;
+    out->kind = QUEUE_PROMPT;
+    buf_hand_out(s, out, slot->buf);
+    slot->buf = NULL;
+    slot_hand_jseqs(out, slot);
+
+    r->head = (r->head + 1) & r->cap_mask;
+    r->count--;
+    atomic_fetch_sub(&s->pending, 1);
+
+    // too old to be worth an answer: shed it with the rest of the stale burst
+    if (g_queue.max_age > 0.0 && now - out->ingress_sec > g_queue.max_age) {
+        out->kind = QUEUE_EXPIRED;
+        while (r->count > 0) {
+            Slot *next = &r->slots[r->head];
+            if (next->chat_id != out->chat_id || now - next->ingress_sec <= g_queue.max_age) {
+                break;
+            }
+            out->merged += next->merged;
+            buf_release(s, next->buf);
+            next->buf = NULL;
+            slot_hand_jseqs(out, next);
+            r->head = (r->head + 1) & r->cap_mask;
+            r->count--;
+            atomic_fetch_sub(&s->pending, 1);
+        }
+    }
+
+    // fold the rest of the burst into this message while it fits whole
+    while (out->kind == QUEUE_PROMPT && g_queue.coalesce > 0.0 && r->count > 0) {
+        Slot *next = &r->slots[r->head];
+        if (next->chat_id != out->chat_id ||
+            next->ingress_sec - out->ingress_sec > g_queue.coalesce ||
+            out->len + 1 + next->buf->len >= QUEUE_MERGE_MAX ||
+            buf_append(&out->buf, next->buf->text, next->buf->len) != 0) {
+            break;
+        }
+        out->text = out->buf->text;
+        out->len = out->buf->len;
+        out->merged += next->merged;
+        buf_release(s, next->buf);
+        next->buf = NULL;
+        slot_hand_jseqs(out, next);
+
+        r->head = (r->head + 1) & r->cap_mask;
+        r->count--;
+        atomic_fetch_sub(&s->pending, 1);
+    }
+
+    if (r->count == 0) {
+        ring_free(s, r);
+    } else {
+        double next = r->slots[r->head].ingress_sec + g_queue.reply_delay;
+        r->next_eligible = next > now ? next : now;
+        ring_schedule(s, r, now);
+    }
+    publish_due(s);
+    return 1;
+}
+
+static void shard_free_rings(Shard *s)
+{
+    for (unsigned i = 0; s->table && i <= s->table_mask; i++) {
+        for (UserRing *r = s->table[i]; r; r = r->next) {
+            for (int k = 0; k < r->count; k++) {
+                free(r->slots[(r->head + k) & r->cap_mask].buf);
+                free(r->slots[(r->head + k) & r->cap_mask].jmore);
             }
-            prev = r;
-            r = r->next;
         }
+        s->table[i] = NULL;
+    }
+    s->ready_head = NULL;
+    s->ready_tail = NULL;
+    while (s->lane_head) {
+        LaneMsg *next = s->lane_head->next;
+        free(s->lane_head->buf);
+        free(s->lane_head);
+        s->lane_head = next;
+    }
+    s->lane_tail = NULL;
+    s->lane_len = 0;
+    RingSlab *slab = s->slabs;
+    while (slab) {
+        RingSlab *next = slab->next;
+        free(slab);
+        slab = next;
+    }
+    s->slabs = NULL;
+    s->ring_pool = NULL;
+    s->rings_live = 0;
+    s->rings_pooled = 0;
+    s->slab_bytes = 0;
+    s->text_live_bytes = 0;
+    free(s->heap);
+    s->heap = NULL;
+    s->heap_len = 0;
+    s->heap_cap = 0;
+    atomic_store(&s->pending, 0);
+}
+
+static int shard_init(Shard *s)
+{
+    memset(s, 0, sizeof(*s));
+    if (pthread_mutex_init(&s->mtx, NULL) != 0) {
+        return -1;
+    }
+
+    // deadlines are CLOCK_MONOTONIC, so the condvar must wait on that clock
+    pthread_condattr_t attr;
+    if (pthread_condattr_init(&attr) != 0) {
+        pthread_mutex_destroy(&s->mtx);
+        return -1;
     }
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    int rc = pthread_cond_init(&s->cond, &attr);
+    pthread_condattr_destroy(&attr);
+    if (rc != 0) {
+        pthread_mutex_destroy(&s->mtx);
+        return -1;
+    }
+    s->table = calloc(QUEUE_BUCKETS, sizeof(*s->table));
+    if (!s->table) {
+        pthread_cond_destroy(&s->cond);
+        pthread_mutex_destroy(&s->mtx);
+        return -1;
+    }
+    s->table_mask = QUEUE_BUCKET_MASK;
+    atomic_init(&s->pending, 0);
+    atomic_init(&s->waiters, 0);
+    atomic_init(&s->next_due, NO_DEADLINE);
     return 0;
 }
 
-int queue_init(int ring_size)
+int queue_init_sharded(int ring_size, int shards)
 {
+    if (shards < 1) {
+        shards = 1;
+    }
+    if (shards > QUEUE_SHARDS_MAX) {
+        shards = QUEUE_SHARDS_MAX;
+    }
+
     memset(&g_queue, 0, sizeof(g_queue));
     g_queue.ring_size = ring_size > 0 ? ring_size : 30;
+    g_queue.ring_cap = round_up_pow2(g_queue.ring_size);
+    g_queue.ring_obj = sizeof(UserRing) + (size_t)g_queue.ring_cap * sizeof(Slot);
+    // round objects up so every one in a slab stays aligned
+    g_queue.ring_obj = (g_queue.ring_obj + _Alignof(max_align_t) - 1) &
+                       ~(_Alignof(max_align_t) - 1);
 
-    if (pthread_mutex_init(&g_queue.mtx, NULL) != 0) {
+    // keep each shard on its own cache lines so workers do not false-share
+    void *mem = NULL;
+    if (posix_memalign(&mem, 64, (size_t)shards * sizeof(Shard)) != 0) {
         return -1;
     }
-    if (pthread_cond_init(&g_queue.cond, NULL) != 0) {
-        pthread_mutex_destroy(&g_queue.mtx);
-        return -1;
+    g_queue.shards = mem;
+    for (int i = 0; i < shards; i++) {
+        if (shard_init(&g_queue.shards[i]) != 0) {
+            for (int j = 0; j < i; j++) {
+                free(g_queue.shards[j].table);
+                pthread_cond_destroy(&g_queue.shards[j].cond);
+                pthread_mutex_destroy(&g_queue.shards[j].mtx);
+            }
+            free(g_queue.shards);
+            g_queue.shards = NULL;
+            return -1;
+        }
     }
+    g_queue.nshards = shards;
+    atomic_init(&g_queue.shutdown, 0);
     return 0;
 }
 
+int queue_init(int ring_size)
+{
+    return queue_init_sharded(ring_size, 1);
+}
+
+void queue_set_reply_delay(double delay_sec)
+{
+    // ascending lock order; nothing else ever holds two shard locks blocking
+    for (int i = 0; i < g_queue.nshards; i++) {
+        pthread_mutex_lock(&g_queue.shards[i].mtx);
+    }
+    g_queue.reply_delay = delay_sec > 0.0 ? delay_sec : 0.0;
+    for (int i = g_queue.nshards - 1; i >= 0; i--) {
+        pthread_mutex_unlock(&g_queue.shards[i].mtx);
+    }
+}
+
+void queue_set_coalesce(double window_sec)
+{
+    for (int i = 0; i < g_queue.nshards; i++) {
+        pthread_mutex_lock(&g_queue.shards[i].mtx);
+    }
+    g_queue.coalesce = window_sec > 0.0 ? window_sec : 0.0;
+    for (int i = g_queue.nshards - 1; i >= 0; i--) {
+        pthread_mutex_unlock(&g_queue.shards[i].mtx);
+    }
+}
+
+void queue_set_max_age(double max_age_sec)
+{
+    for (int i = 0; i < g_queue.nshards; i++) {
+        pthread_mutex_lock(&g_queue.shards[i].mtx);
+    }
+    g_queue.max_age = max_age_sec > 0.0 ? max_age_sec : 0.0;
+    for (int i = g_queue.nshards - 1; i >= 0; i--) {
+        pthread_mutex_unlock(&g_queue.shards[i].mtx);
+    }
+}
+
+void queue_set_overflow(QueueOverflow policy)
+{
+    for (int i = 0; i < g_queue.nshards; i++) {
+        pthread_mutex_lock(&g_queue.shards[i].mtx);
+    }
+    g_queue.overflow = policy;
+    for (int i = g_queue.nshards - 1; i >= 0; i--) {
+        pthread_mutex_unlock(&g_queue.shards[i].mtx);
+    }
+}
+
 void queue_destroy(void)
 {
-    pthread_mutex_lock(&g_queue.mtx);
-    for (int i = 0; i < QUEUE_BUCKETS; i++) {
-        UserRing *r = g_queue.buckets[i];
-        while (r) {
-            UserRing *next = r->next;
-            free(r->slots);
-            free(r);
-            r = next;
+    for (int i = 0; i < g_queue.nshards; i++) {
+        Shard *s = &g_queue.shards[i];
+        pthread_mutex_lock(&s->mtx);
+        shard_free_rings(s);
+        free(s->table);
+        s->table = NULL;
+        pthread_mutex_unlock(&s->mtx);
+        pthread_cond_destroy(&s->cond);
+        pthread_mutex_destroy(&s->mtx);
+    }
+    free(g_queue.shards);
+    g_queue.shards = NULL;
+    g_queue.nshards = 0;
+}
+
+// wake one sleeping worker of another shard so it can steal (no locks held)
+static void wake_thief(const Shard *home)
+{
+    for (int i = 0; i < g_queue.nshards; i++) {
+        Shard *s = &g_queue.shards[i];
+        if (s == home || atomic_load(&s->waiters) == 0) {
+            continue;
         }
-        g_queue.buckets[i] = NULL;
+        pthread_mutex_lock(&s->mtx);
+        pthread_cond_signal(&s->cond);
+        pthread_mutex_unlock(&s->mtx);
+        return;
     }
-    g_queue.total_pending = 0;
-    pthread_mutex_unlock(&g_queue.mtx);
+}
 
-    pthread_cond_destroy(&g_queue.cond);
-    pthread_mutex_destroy(&g_queue.mtx);
+/* QUEUE_MERGE on a full ring: append buf to the newest queued message when
+ * it is for the same chat and stays under QUEUE_MERGE_MAX (caller holds s->mtx)
+ * the new message's journal record jseq rides along with the merged one
+ * returns 0 when merged, -1 when the new message has to be dropped
+ */
+static int ring_merge_tail(Shard *s, UserRing *r, int64_t chat_id, const MsgBuf *buf,
+                           uint64_t jseq)
+{
+    Slot *last = &r->slots[(r->tail - 1) & r->cap_mask];
+    if (last->chat_id != chat_id || last->buf->len + 1 + buf->len >= QUEUE_MERGE_MAX) {
+        return -1;
+    }
+    if (jseq) {
+        uint64_t *more = realloc(last->jmore, (size_t)(last->njmore + 1) * sizeof(*more));
+        if (!more) {
+            return -1;
+        }
+        last->jmore = more;
+    }
+    size_t before = buf_bytes(last->buf);
+    if (buf_append(&last->buf, buf->text, buf->len) != 0) {
+        return -1;
+    }
+    s->text_live_bytes += buf_bytes(last->buf) - before;
+    last->merged++;
+    if (jseq) {
+        last->jmore[last->njmore++] = jseq;
+    }
+    return 0;
+}
+
+// append to a ring with room, scheduling it if it was empty (caller holds s->mtx)
+static void ring_append(Shard *s, UserRing *r, const Slot *in, double now)
+{
+    r->slots[r->tail] = *in;
+    s->text_live_bytes += buf_bytes(in->buf);
+    r->tail = (r->tail + 1) & r->cap_mask;
+    r->count++;
+
+    // a fresh ring is scheduled by its first message's deadline
+    if (r->count == 1) {
+        r->next_eligible = in->ingress_sec + g_queue.reply_delay;
+        ring_schedule(s, r, now);
+    }
+    publish_due(s);
+    // seq_cst pairs with the waiters increment in queue_pop_worker
+    atomic_fetch_add(&s->pending, 1);
+}
+
+// append to the direct lane (caller holds s->mtx)
+static void lane_append(Shard *s, LaneMsg *m)
+{
+    s->text_live_bytes += buf_bytes(m->buf);
+    if (s->lane_tail) {
+        s->lane_tail->next = m;
+    } else {
+        s->lane_head = m;
+    }
+    s->lane_tail = m;
+    s->lane_len++;
+    publish_due(s);
+    atomic_fetch_add(&s->pending, 1);
+}
+
+// wake a worker for what was just queued, then drop s->mtx
+static void notify_unlock(Shard *s)
+{
+    bool home_waiting = atomic_load(&s->waiters) > 0;
+    if (home_waiting) {
+        pthread_cond_signal(&s->cond);
+    }
+    pthread_mutex_unlock(&s->mtx);
+
+    // the shard's own worker is busy; let an idle one elsewhere pick it up
+    if (!home_waiting && g_queue.nshards > 1) {
+        wake_thief(s);
+    }
 }
 
 int queue_push(int64_t user_id, int64_t chat_id, const char *text)
 {
-    pthread_mutex_lock(&g_queue.mtx);
+    return queue_push_traced(user_id, chat_id, text, 0);
+}
+
+int queue_push_traced(int64_t user_id, int64_t chat_id, const char *text, uint64_t trace_id)
+{
+    MsgBuf *buf = buf_copy(text);
+    if (!buf) {
+        return -1;
+    }
+    return queue_push_buf(user_id, chat_id, buf, trace_id);
+}
+
+// ack the records of a message the queue refused or dropped, outside any shard lock
+static void ack_dropped(uint64_t jseq, uint64_t *jmore, int njmore)
+{
+    qjournal_ack(jseq);
+    for (int i = 0; i < njmore; i++) {
+        qjournal_ack(jmore[i]);
+    }
+    free(jmore);
+}
+
+int queue_push_buf(int64_t user_id, int64_t chat_id, MsgBuf *buf, uint64_t trace_id)
+{
+    // journaled before the shard lock is taken, never under it
+    uint64_t jseq = qjournal_push(user_id, chat_id, QUEUE_PROMPT, 1, 0.0, buf->text, buf->len);
+    uint64_t h = hash_user(user_id);
+    Shard *s = shard_of(h);
+    pthread_mutex_lock(&s->mtx);
 
-    UserRing *r = ring_get_or_create(user_id);
+    UserRing *r = ring_get_or_create(s, user_id, h);
     if (!r) {
-        pthread_mutex_unlock(&g_queue.mtx);
+        pthread_mutex_unlock(&s->mtx);
+        free(buf);
+        qjournal_ack(jseq);
         return -1;
     }
 
-    // drop newest policy: if ring is full, reject
+    int rc = 0;
+    Slot dropped = {0};
     if (r->count >= r->cap) {
-        pthread_mutex_unlock(&g_queue.mtx);
-        return -1;
+        if (g_queue.overflow == QUEUE_MERGE) {
+            rc = ring_merge_tail(s, r, chat_id, buf, jseq);
+            pthread_mutex_unlock(&s->mtx);
+            free(buf);
+            if (rc != 0) {
+                qjournal_ack(jseq);
+            }
+            return rc;
+        }
+        if (g_queue.overflow != QUEUE_DROP_OLDEST) {
+            pthread_mutex_unlock(&s->mtx);
+            free(buf);
+            qjournal_ack(jseq);
+            return -1;
+        }
+        // the ring keeps its place in the schedule: the user is answered
+        // when the dropped message would have been
+        Slot *old = &r->slots[r->head];
+        buf_release(s, old->buf);
+        old->buf = NULL;
+        dropped = *old;
+        old->jmore = NULL;
+        r->head = (r->head + 1) & r->cap_mask;
+        r->count--;
+        atomic_fetch_sub(&s->pending, 1);
+        rc = 1;
     }
 
-    Slot *s = &r->slots[r->tail];
-    s->chat_id = chat_id;
-    s->ingress_sec = monotonic_sec();
-    size_t tlen = strlen(text);
-    if (tlen >= sizeof(s->text)) {
-        tlen = sizeof(s->text) - 1;
+    double now = monotonic_sec();
+    Slot slot = {
+        .chat_id = chat_id,
+        .ingress_sec = now,
+        .trace_id = trace_id,
+        .buf = buf,
+        .merged = 1,
+        .jseq = jseq,
+    };
+    ring_append(s, r, &slot, now);
+    notify_unlock(s);
+    if (rc == 1) {
+        ack_dropped(dropped.jseq, dropped.jmore, dropped.njmore);
     }
-    memcpy(s->text, text, tlen);
-    s->text[tlen] = '\0';
+    return rc;
+}
 
-    r->tail = (r->tail + 1) & r->cap_mask;
-    r->count++;
-    g_queue.total_pending++;
+int queue_push_reply(int64_t user_id, int64_t chat_id, const char *text, QueueKind kind,
+                     uint64_t trace_id)
+{
+    if (kind == QUEUE_PROMPT) {
+        return queue_push_traced(user_id, chat_id, text, trace_id);
+    }
+    // allocated outside the lock; replies are rare next to prompts
+    LaneMsg *m = malloc(sizeof(*m));
+    MsgBuf *buf = buf_copy(text);
+    if (!m || !buf) {
+        free(m);
+        free(buf);
+        return -1;
+    }
+    m->next = NULL;
+    m->user_id = user_id;
+    m->chat_id = chat_id;
+    m->ingress_sec = monotonic_sec();
+    m->trace_id = trace_id;
+    m->kind = kind;
+    m->buf = buf;
+    m->jseq = qjournal_push(user_id, chat_id, (int)kind, 1, 0.0, buf->text, buf->len);
 
-    pthread_cond_signal(&g_queue.cond);
-    pthread_mutex_unlock(&g_queue.mtx);
+    // the user's shard, so a user's replies keep their order
+    Shard *s = shard_of(hash_user(user_id));
+    pthread_mutex_lock(&s->mtx);
+    if (s->lane_len >= QUEUE_LANE_MAX) {
+        pthread_mutex_unlock(&s->mtx);
+        qjournal_ack(m->jseq);
+        free(buf);
+        free(m);
+        return -1;
+    }
+    lane_append(s, m);
+    notify_unlock(s);
     return 0;
 }
 
-int queue_pop(QueueMsg *out)
+/* queue a journaled message again with its first arrival time, kind and
+ * record; a prompt finding its ring full is merged as QUEUE_MERGE would
+ * (its record riding along), otherwise refused (and acked) when the ring or
+ * lane has no room. returns 0 once buf is the queue's
+ */
+static int restore_one(const QJournalEntry *e, MsgBuf *buf)
 {
-    pthread_mutex_lock(&g_queue.mtx);
+    double now = monotonic_sec();
+    double ingress = now - e->age_sec;
+    uint64_t h = hash_user(e->user_id);
+    Shard *s = shard_of(h);
+    pthread_mutex_lock(&s->mtx);
 
-    while (g_queue.total_pending == 0 && !g_queue.shutdown) {
-        pthread_cond_wait(&g_queue.cond, &g_queue.mtx);
+    if (e->kind == QUEUE_PROMPT) {
+        UserRing *r = ring_get_or_create(s, e->user_id, h);
+        if (r && r->count >= r->cap && g_queue.overflow == QUEUE_MERGE &&
+            ring_merge_tail(s, r, e->chat_id, buf, e->seq) == 0) {
+            pthread_mutex_unlock(&s->mtx);
+            free(buf);
+            return 0;
+        }
+        if (!r || r->count >= r->cap) {
+            pthread_mutex_unlock(&s->mtx);
+            return -1;
+        }
+        Slot slot = {
+            .chat_id = e->chat_id,
+            .ingress_sec = ingress,
+            .buf = buf,
+            .merged = e->merged > 0 ? e->merged : 1,
+            .jseq = e->seq,
+        };
+        ring_append(s, r, &slot, now);
+        notify_unlock(s);
+        return 0;
     }
 
-    if (g_queue.shutdown && g_queue.total_pending == 0) {
-        pthread_mutex_unlock(&g_queue.mtx);
+    LaneMsg *m = s->lane_len < QUEUE_LANE_MAX ? malloc(sizeof(*m)) : NULL;
+    if (!m) {
+        pthread_mutex_unlock(&s->mtx);
         return -1;
     }
+    m->next = NULL;
+    m->user_id = e->user_id;
+    m->chat_id = e->chat_id;
+    m->ingress_sec = ingress;
+    m->trace_id = 0;
+    m->kind = (QueueKind)e->kind;
+    m->buf = buf;
+    m->jseq = e->seq;
+    lane_append(s, m);
+    notify_unlock(s);
+    return 0;
+}
 
-    Slot slot;
-    int64_t user_id = 0;
-    if (!ring_pop_any(&slot, &user_id)) {
-        // spurious wakeup or drained during shutdown
-        pthread_mutex_unlock(&g_queue.mtx);
-        return -1;
+static void restore_cb(const QJournalEntry *e, void *ud)
+{
+    int *restored = ud;
+    MsgBuf *buf = queue_buf_new(e->len);
+    if (buf) {
+        memcpy(buf->text, e->text, e->len + 1);
+        buf->len = e->len;
+        if (restore_one(e, buf) == 0) {
+            (*restored)++;
+            return;
+        }
+        free(buf);
     }
+    qjournal_ack(e->seq);
+}
 
-    out->user_id = user_id;
-    out->chat_id = slot.chat_id;
-    out->ingress_sec = slot.ingress_sec;
-    size_t slen = strlen(slot.text);
-    if (slen >= sizeof(out->text)) {
-        slen = sizeof(out->text) - 1;
+int queue_restore_journal(void)
+{
+    int restored = 0;
+    qjournal_replay(restore_cb, &restored);
+    return restored;
+}
+
+// convert an absolute CLOCK_MONOTONIC time in seconds to a timespec
+static struct timespec abs_timespec(double t)
+{
+    struct timespec ts;
+    ts.tv_sec = (time_t)t;
+    ts.tv_nsec = (long)((t - (double)ts.tv_sec) * 1e9);
+    if (ts.tv_nsec >= 1000000000L) {
+        ts.tv_sec++;
+        ts.tv_nsec -= 1000000000L;
     }
-    memcpy(out->text, slot.text, slen);
-    out->text[slen] = '\0';
+    return ts;
+}
 
-    pthread_mutex_unlock(&g_queue.mtx);
+/* try to take a due message from another shard (caller holds home->mtx)
+ * victims are only trylocked, so two thieves can never deadlock. *wake is
+ * lowered to the earliest deadline seen elsewhere; *pending_elsewhere counts
+ * messages in shards that could not be taken from
+ */
+static int steal(Shard *home, int home_idx, QueueMsg *out, double now, int shutdown,
+                 double *wake, int *pending_elsewhere)
+{
+    for (int k = 1; k < g_queue.nshards; k++) {
+        Shard *v = &g_queue.shards[(home_idx + k) % g_queue.nshards];
+        if (v == home || atomic_load(&v->pending) == 0) {
+            continue;
+        }
+        double due = atomic_load_explicit(&v->next_due, memory_order_relaxed);
+        if (!shutdown && due > now) {
+            if (due < *wake) {
+                *wake = due;
+            }
+            (*pending_elsewhere)++;
+            continue;
+        }
+        if (pthread_mutex_trylock(&v->mtx) != 0) {
+            double retry = now + STEAL_RETRY_SEC;
+            if (retry < *wake) {
+                *wake = retry;
+            }
+            (*pending_elsewhere)++;
+            continue;
+        }
+        int got = ring_pop_due(v, out, now, shutdown);
+        pthread_mutex_unlock(&v->mtx);
+        if (got) {
+            return 1;
+        }
+    }
     return 0;
 }
 
+// queue_pop_worker, giving up (returning 1) at deadline with nothing handed out
+static int pop_until(int worker, QueueMsg *out, double deadline)
+{
+    // the records of a message not marked done stay live for the next start
+    free(out->buf);
+    out->buf = NULL;
+    out->text = "";
+    out->len = 0;
+    out->jseqs = 0;
+
+    int home_idx = worker > 0 ? worker % g_queue.nshards : 0;
+    Shard *home = &g_queue.shards[home_idx];
+    pthread_mutex_lock(&home->mtx);
+
+    /* sleep until the earliest deadline (own or stealable) instead of handing
+     * out a message the worker would have to sit on; on shutdown deadlines are
+     * ignored so the remaining messages drain immediately
+     */
+    for (;;) {
+        int shutdown = atomic_load(&g_queue.shutdown);
+        // journaled messages wait for the next start instead of draining
+        if (shutdown && qjournal_active()) {
+            pthread_mutex_unlock(&home->mtx);
+            return -1;
+        }
+        double now = monotonic_sec();
+        if (ring_pop_due(home, out, now, shutdown)) {
+            // the new heap top may be due sooner than whatever other waiters expect
+            if (atomic_load(&home->pending) > 0 && atomic_load(&home->waiters) > 0) {
+                pthread_cond_signal(&home->cond);
+            }
+            pthread_mutex_unlock(&home->mtx);
+            return 0;
+        }
+
+        // announce ourselves before looking elsewhere; a push that misses
+        // this either sees the waiter or is seen by the scan below
+        atomic_fetch_add(&home->waiters, 1);
+
+        double wake = home->heap_len > 0 ? home->heap[0]->next_eligible : NO_DEADLINE;
+        int pending_elsewhere = 0;
+        if (g_queue.nshards > 1 &&
+            steal(home, home_idx, out, now, shutdown, &wake, &pending_elsewhere)) {
+            atomic_fetch_sub(&home->waiters, 1);
+            pthread_mutex_unlock(&home->mtx);
+            return 0;
+        }
+
+        int idle = atomic_load(&home->pending) == 0 && pending_elsewhere == 0;
+        if ((idle && shutdown) || (!shutdown && now >= deadline)) {
+            atomic_fetch_sub(&home->waiters, 1);
+            pthread_mutex_unlock(&home->mtx);
+            return shutdown ? -1 : 1;
+        }
+        if (deadline < wake) {
+            wake = deadline;
+        }
+        if (wake >= NO_DEADLINE) {
+            pthread_cond_wait(&home->cond, &home->mtx);
+        } else {
+            struct timespec ts = abs_timespec(wake);
+            pthread_cond_timedwait(&home->cond, &home->mtx, &ts);
+        }
+        atomic_fetch_sub(&home->waiters, 1);
+    }
+}
+
+int queue_pop_worker(int worker, QueueMsg *out)
+{
+    return pop_until(worker, out, NO_DEADLINE);
+}
+
+int queue_pop_worker_timed(int worker, QueueMsg *out, double idle_sec)
+{
+    return pop_until(worker, out, monotonic_sec() + idle_sec);
+}
+
+int queue_pop(QueueMsg *out)
+{
+    return queue_pop_worker(0, out);
+}
+
+void queue_msg_done(QueueMsg *msg)
+{
+    for (int i = 0; i < msg->jseqs; i++) {
+        qjournal_ack(msg->jseq[i]);
+    }
+    msg->jseqs = 0;
+}
+
+void queue_msg_release(QueueMsg *msg)
+{
+    free(msg->buf);
+    msg->buf = NULL;
+    msg->text = "";
+    msg->len = 0;
+    free(msg->jseq);
+    msg->jseq = NULL;
+    msg->jseqs = 0;
+    msg->jseq_cap = 0;
+}
+
 void queue_shutdown(void)
 {
-    pthread_mutex_lock(&g_queue.mtx);
-    g_queue.shutdown = 1;
-    pthread_cond_broadcast(&g_queue.cond);
-    pthread_mutex_unlock(&g_queue.mtx);
+    atomic_store(&g_queue.shutdown, 1);
+    for (int i = 0; i < g_queue.nshards; i++) {
+        Shard *s = &g_queue.shards[i];
+        pthread_mutex_lock(&s->mtx);
+        pthread_cond_broadcast(&s->cond);
+        pthread_mutex_unlock(&s->mtx);
+    }
 }
 
 int queue_depth(void)
 {
-    pthread_mutex_lock(&g_queue.mtx);
-    int d = g_queue.total_pending;
-    pthread_mutex_unlock(&g_queue.mtx);
+    int d = 0;
+    for (int i = 0; i < g_queue.nshards; i++) {
+        d += atomic_load(&g_queue.shards[i].pending);
+    }
     return d;
 }
 
+void queue_mem_stats(QueueMemStats *out)
+{
+    memset(out, 0, sizeof(*out));
+    for (int i = 0; i < g_queue.nshards; i++) {
+        Shard *s = &g_queue.shards[i];
+        pthread_mutex_lock(&s->mtx);
+        out->rings_live += s->rings_live;
+        out->rings_pooled += s->rings_pooled;
+        out->ring_bytes += s->slab_bytes;
+        out->text_bytes += s->text_live_bytes;
+        pthread_mutex_unlock(&s->mtx);
+    }
+}
+
 int queue_ring_count(void)
 {
-    pthread_mutex_lock(&g_queue.mtx);
+    // every live ring is non-empty, so live rings are exactly the users queued
     int n = 0;
-    for (int i = 0; i < QUEUE_BUCKETS; i++) {
-        UserRing *r = g_queue.buckets[i];
-        while (r) {
-            n++;
-            r = r->next;
-        }
+    for (int i = 0; i < g_queue.nshards; i++) {
+        Shard *s = &g_queue.shards[i];
+        pthread_mutex_lock(&s->mtx);
+        n += s->rings_live;
+        pthread_mutex_unlock(&s->mtx);
     }
-    pthread_mutex_unlock(&g_queue.mtx);
     return n;
 }
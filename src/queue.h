@@ -1,35 +1,182 @@
 #pragma once
 
+#include <stddef.h>
 #include <stdint.h>
 
 /* per-user message queue with rate-limiting
  * thread-safe: multiple producers (handle_update), multiple consumers (workers)
  *
+ * the queue is split into shards, each with its own lock. a user always
+ * hashes to the same shard, so their messages keep FIFO order; a worker pops
+ * from its own shard and steals due messages from the others when its own
+ * has none ready
+ *
  * initialise the global queue (call once from main before spawning workers)
  * ring_size: per-user ring buffer depth (e.g. 30)
+ * shards: number of shards, normally the worker count (clamped to 1..QUEUE_SHARDS_MAX)
  * returns 0 on success
  */
+int queue_init_sharded(int ring_size, int shards);
+
+// single-shard queue; same as queue_init_sharded(ring_size, 1)
 int queue_init(int ring_size);
 
+/* message text, allocated once at ingress and passed by pointer from then
+ * on: whoever holds the pointer owns it - the producer until it is pushed,
+ * the queue while it waits, the worker once popped. Telegram's 4096
+ * characters fit whole; nothing is truncated on the way
+ */
+typedef struct {
+    size_t len; // strlen(text)
+    char text[];
+} MsgBuf;
+
+// a buffer with room for cap bytes of text and the NUL, holding ""; NULL when out of memory
+MsgBuf *queue_buf_new(size_t cap);
+
+// free a buffer that was never pushed (NULL is ignored)
+void queue_buf_free(MsgBuf *buf);
+
+/* set the per-user rate-limit floor: a message is not handed out by
+ * queue_pop until delay_sec after its ingress time (0 disables; default 0)
+ */
+void queue_set_reply_delay(double delay_sec);
+
+/* coalesce bursts: a pop also takes the user's following messages to the
+ * same chat that arrived within window_sec of the first, joined by newlines
+ * into one QueueMsg, while the result stays under QUEUE_MERGE_MAX bytes
+ * (0 disables; default 0)
+ */
+void queue_set_coalesce(double window_sec);
+
+/* what queue_push does when the user's ring is already full
+ * DROP_NEWEST refuses the new message; DROP_OLDEST discards the user's
+ * oldest queued message to make room; MERGE appends the text to the user's
+ * newest queued message (same chat) and drops the newest only if the
+ * result would reach QUEUE_MERGE_MAX bytes
+ */
+typedef enum {
+    QUEUE_DROP_NEWEST,
+    QUEUE_DROP_OLDEST,
+    QUEUE_MERGE,
+} QueueOverflow;
+
+// set the full-ring policy (default QUEUE_DROP_NEWEST)
+void queue_set_overflow(QueueOverflow policy);
+
+/* shed stale prompts: a prompt picked up more than max_age_sec after its
+ * ingress is not handed out for an answer; the pop returns it (with the
+ * user's other expired messages to the same chat) as one QUEUE_EXPIRED
+ * message instead (0 disables; default 0)
+ */
+void queue_set_max_age(double max_age_sec);
+
+/* the hash that places a user in a shard; multi-process mode uses it to
+ * pick the user's owner process, so the two agree across processes
+ */
+uint64_t queue_hash_user(int64_t user_id);
+
 // tear down the global queue and free all memory
 void queue_destroy(void);
 
-// enqueue a message for a user; timestamps the message on ingress
-// returns 0 on success, -1 if the user's ring is full (drop newest policy)
+/* journaling: while qjournal_open() has a journal open, every accepted
+ * message is recorded there (before the shard lock is taken) and acked once
+ * the worker calls queue_msg_done() for it, or the overflow policy drops
+ * it. a message a worker had popped but not finished when the process
+ * stopped is replayed by the next start, so queue_destroy() loses nothing
+ *
+ * queue the messages a previous run left in the journal, in their original
+ * per-user order, with ingress set back by their age so reply_delay and
+ * max_queue_age count from when they first arrived. a prompt that no
+ * longer fits its ring is merged into the newest under QUEUE_MERGE (set
+ * the policy first), anything else that does not fit is dropped. call once
+ * after qjournal_open(), before any push; returns the number kept
+ */
+int queue_restore_journal(void);
+
+/* enqueue a message for a user; timestamps the message on ingress
+ * returns 0 on success (or merged under QUEUE_MERGE), 1 if it was queued by
+ * dropping the user's oldest message (QUEUE_DROP_OLDEST), -1 if refused
+ */
 int queue_push(int64_t user_id, int64_t chat_id, const char *text);
 
-// a popped message ready for the worker to send
+/* queue_push() carrying a trace id (trace_next_id()) through to the worker;
+ * a coalesced pop keeps the id of its first message
+ */
+int queue_push_traced(int64_t user_id, int64_t chat_id, const char *text, uint64_t trace_id);
+
+/* queue_push_traced() handing over a buffer instead of copying the text
+ * the queue takes ownership either way: it is freed if the push is refused
+ */
+int queue_push_buf(int64_t user_id, int64_t chat_id, MsgBuf *buf, uint64_t trace_id);
+
+/* what a queued message asks the worker to do
+ * prompts go through the per-user rings (reply_delay, coalescing) to the
+ * LLM; replies and system messages are literal text for the chat, queued on
+ * each shard's direct lane and handed out ahead of any prompt
+ */
+typedef enum {
+    QUEUE_PROMPT, // user text for the LLM
+    QUEUE_REPLY,  // canned command reply (/start, /help, unknown command)
+    QUEUE_SYSTEM, // admin and access notices (/allow, /revoke, /status, denials)
+    QUEUE_EXPIRED, // prompt(s) shed by queue_set_max_age; text is the first, not to be answered
+} QueueKind;
+
+/* queue literal text for the worker to send as is (kind QUEUE_REPLY or
+ * QUEUE_SYSTEM; a QUEUE_PROMPT is queue_push_traced). served FIFO per shard
+ * before any ring, with no reply_delay and never coalesced with prompts
+ * returns 0 on success, -1 if the shard's lane is full (QUEUE_LANE_MAX)
+ */
+int queue_push_reply(int64_t user_id, int64_t chat_id, const char *text, QueueKind kind,
+                     uint64_t trace_id);
+
+/* a popped message ready for the worker to send
+ * zero-initialise it before the first pop; every pop into it frees the
+ * buffer it held, and queue_msg_release() frees the last one. it also
+ * carries the journal records of every message folded into it, which
+ * queue_msg_done() acks; a pop into it without that leaves them live
+ */
 typedef struct {
     int64_t user_id;
     int64_t chat_id;
-    char text[1024];
-    double ingress_sec; // CLOCK_MONOTONIC seconds at enqueue time
+    const char *text;   // buf->text
+    size_t len;         // strlen(text)
+    MsgBuf *buf;        // owned by this QueueMsg until the next pop or release
+    double ingress_sec; // CLOCK_MONOTONIC seconds at enqueue time (first message)
+    uint64_t trace_id;  // from queue_push_traced (first message), 0 when untraced
+    int merged;         // messages folded into text (1 unless coalescing)
+    QueueKind kind;     // QUEUE_PROMPT unless queued with queue_push_reply
+    uint64_t *jseq;     // journal records behind it (qjournal_push seqs)
+    int jseqs;
+    int jseq_cap;
 } QueueMsg;
 
-// block until a message is available (or shutdown is signalled)
-// returns 0 on success and fills *out, -1 on shutdown
+/* block until a message is due (or shutdown is signalled)
+ * worker selects the home shard (worker % shards); other shards are only
+ * stolen from. sleeps until the earliest per-user deadline rather than
+ * returning early. returns 0 on success and fills *out, -1 on shutdown
+ * once every shard has drained - or at once while the journal is open,
+ * leaving what is queued to be replayed by the next start
+ */
+int queue_pop_worker(int worker, QueueMsg *out);
+
+/* queue_pop_worker() that gives up after idle_sec without a message
+ * returns 0 with *out filled, 1 on timeout, -1 on shutdown once drained
+ */
+int queue_pop_worker_timed(int worker, QueueMsg *out, double idle_sec);
+
+// queue_pop_worker() with home shard 0
 int queue_pop(QueueMsg *out);
 
+/* the message was answered, or given up on for good: ack its journal
+ * records. not for one cut short by shutdown - that one is replayed by the
+ * next start. safe to repeat; a no-op while journaling is off
+ */
+void queue_msg_done(QueueMsg *msg);
+
+// free the buffer a popped message holds (without acking it); safe to repeat
+void queue_msg_release(QueueMsg *msg);
+
 // signal all blocked workers to wake up and exit
 void queue_shutdown(void);
 
@@ -38,3 +185,16 @@ int queue_depth(void);
 
 // return the number of allocated user rings (thread-safe)
 int queue_ring_count(void);
+
+/* allocator footprint across all shards (thread-safe)
+ * ring objects (header + slot array) come from slabs that are kept for
+ * reuse; message text is the producers' exactly sized MsgBufs
+ */
+typedef struct {
+    int rings_live;    // rings holding messages
+    int rings_pooled;  // ring objects free for reuse
+    size_t ring_bytes; // slab memory backing live and pooled rings
+    size_t text_bytes; // MsgBufs of queued messages (header, text and NUL)
+} QueueMemStats;
+
+void queue_mem_stats(QueueMemStats *out);
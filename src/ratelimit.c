@@ -0,0 +1,335 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "ratelimit.h"
+#include "config.h"
+#include "logger.h"
+#include "metrics.h"
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <time.h>
+
+/* each bucket is kept as the time it next refills completely (GCRA): a send
+ * at t is allowed once t >= full - (burst - 1) * interval, and moves full to
+ * max(full, t) + interval. one double per bucket, no refill timer.
+ */
+typedef struct {
+    double interval; // seconds per token, 0 = not limited
+    double slack;    // (burst - 1) * interval
+} Rate;
+
+typedef struct ChatBucket {
+    int64_t chat_id;
+    double full;
+    struct ChatBucket *next;
+} ChatBucket;
+
+static struct {
+    pthread_mutex_t lock;
+    int ready;
+    Rate global;
+    Rate chat;
+    Rate group;
+    double global_full;
+    double pause_until;
+    ChatBucket **table;
+    unsigned table_mask;
+    int chats;
+    uint64_t sends;
+    uint64_t delayed;
+    uint64_t pauses;
+} g_rl = {.lock = PTHREAD_MUTEX_INITIALIZER};
+
+static double monotonic_sec(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+static Rate make_rate(double per_sec, int burst)
+{
+    Rate r = {0.0, 0.0};
+    if (per_sec > 0.0) {
+        r.interval = 1.0 / per_sec;
+        r.slack = (double)(burst > 1 ? burst - 1 : 0) * r.interval;
+    }
+    return r;
+}
+
+// earliest time a bucket allows a send
+static double allowed_at(const Rate *r, double full)
+{
+    return r->interval > 0.0 ? full - r->slack : 0.0;
+}
+
+static void take(const Rate *r, double *full, double at)
+{
+    if (r->interval > 0.0) {
+        *full = (*full > at ? *full : at) + r->interval;
+    }
+}
+
+// MurmurHash3 fmix64
+static uint64_t hash_id(int64_t id)
+{
+    uint64_t h = (uint64_t)id;
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+    h *= 0xc4ceb9fe1a85ec53ULL;
+    h ^= h >> 33;
+    return h;
+}
+
+// per-chat buckets (caller holds g_rl.lock)
+
+// drop buckets that have refilled; they are indistinguishable from new ones
+static void table_prune(double now)
+{
+    for (unsigned i = 0; i <= g_rl.table_mask; i++) {
+        ChatBucket **pp = &g_rl.table[i];
+        while (*pp) {
+            ChatBucket *b = *pp;
+            if (b->full <= now) {
+                *pp = b->next;
+                free(b);
+                g_rl.chats--;
+            } else {
+                pp = &b->next;
+            }
+        }
+    }
+}
+
+// double the hash table once the load factor passes 1
+static void table_grow(void)
+{
+    unsigned size = g_rl.table_mask + 1;
+    ChatBucket **t = calloc((size_t)size * 2, sizeof(*t));
+    if (!t) {
+        return; // keep chaining in the old table
+    }
+    unsigned mask = size * 2 - 1;
+    for (unsigned i = 0; i < size; i++) {
+        ChatBucket *b = g_rl.table[i];
+        while (b) {
+            ChatBucket *next = b->next;
+            unsigned slot = (unsigned)(hash_id(b->chat_id) & mask);
+            b->next = t[slot];
+            t[slot] = b;
+            b = next;
+        }
+    }
+    free(g_rl.table);
+    g_rl.table = t;
+    g_rl.table_mask = mask;
+}
+
+static ChatBucket *chat_find(int64_t chat_id)
+{
+    unsigned slot = (unsigned)(hash_id(chat_id) & g_rl.table_mask);
+    for (ChatBucket *b = g_rl.table[slot]; b; b = b->next) {
+        if (b->chat_id == chat_id) {
+            return b;
+        }
+    }
+    return NULL;
+}
+
+static ChatBucket *chat_get(int64_t chat_id, double now)
+{
+    ChatBucket *b = chat_find(chat_id);
+    if (b) {
+        return b;
+    }
+    if (g_rl.chats >= (int)g_rl.table_mask + 1) {
+        table_prune(now);
+        if (g_rl.chats >= (int)g_rl.table_mask + 1) {
+            table_grow();
+        }
+    }
+    b = malloc(sizeof(*b));
+    if (!b) {
+        return NULL; // the send goes out limited by the global bucket only
+    }
+    unsigned slot = (unsigned)(hash_id(chat_id) & g_rl.table_mask);
+    b->chat_id = chat_id;
+    b->full = now;
+    b->next = g_rl.table[slot];
+    g_rl.table[slot] = b;
+    g_rl.chats++;
+    return b;
+}
+
+static const Rate *chat_rate(int64_t chat_id)
+{
+    return chat_id < 0 ? &g_rl.group : &g_rl.chat;
+}
+
+// earliest time a send to chat_id may go (caller holds g_rl.lock)
+static double send_time(int64_t chat_id, double now, const ChatBucket *b)
+{
+    double at = now;
+    if (g_rl.pause_until > at) {
+        at = g_rl.pause_until;
+    }
+    if (!g_rl.ready) {
+        return at;
+    }
+    double g = allowed_at(&g_rl.global, g_rl.global_full);
+    if (g > at) {
+        at = g;
+    }
+    if (b) {
+        double c = allowed_at(chat_rate(chat_id), b->full);
+        if (c > at) {
+            at = c;
+        }
+    }
+    return at;
+}
+
+int ratelimit_init(int global_per_sec, int chat_per_min, int group_per_min)
+{
+    if (global_per_sec < 0 || chat_per_min < 0 || group_per_min < 0) {
+        return -1;
+    }
+    pthread_mutex_lock(&g_rl.lock);
+    if (g_rl.ready) {
+        pthread_mutex_unlock(&g_rl.lock);
+        return -1;
+    }
+    g_rl.table = calloc(RATELIMIT_BUCKETS, sizeof(*g_rl.table));
+    if (!g_rl.table) {
+        pthread_mutex_unlock(&g_rl.lock);
+        return -1;
+    }
+    g_rl.table_mask = RATELIMIT_BUCKETS - 1;
+    g_rl.chats = 0;
+    // the global bucket holds one second's worth so a quiet bot answers a
+    // burst of chats at once
+    g_rl.global = make_rate((double)global_per_sec, global_per_sec);
+    g_rl.chat = make_rate((double)chat_per_min / 60.0, RATELIMIT_CHAT_BURST);
+    g_rl.group = make_rate((double)group_per_min / 60.0, RATELIMIT_GROUP_BURST);
+    g_rl.global_full = 0.0;
+    g_rl.sends = 0;
+    g_rl.delayed = 0;
+    g_rl.ready = 1;
+    pthread_mutex_unlock(&g_rl.lock);
+    return 0;
+}
+
+void ratelimit_destroy(void)
+{
+    pthread_mutex_lock(&g_rl.lock);
+    if (g_rl.ready) {
+        for (unsigned i = 0; i <= g_rl.table_mask; i++) {
+            ChatBucket *b = g_rl.table[i];
+            while (b) {
+                ChatBucket *next = b->next;
+                free(b);
+                b = next;
+            }
+        }
+        free(g_rl.table);
+        g_rl.table = NULL;
+        g_rl.chats = 0;
+        g_rl.ready = 0;
+    }
+    g_rl.pause_until = 0.0;
+    g_rl.pauses = 0;
+    pthread_mutex_unlock(&g_rl.lock);
+}
+
+double ratelimit_reserve(int64_t chat_id)
+{
+    pthread_mutex_lock(&g_rl.lock);
+    double now = monotonic_sec();
+    ChatBucket *b = g_rl.ready ? chat_get(chat_id, now) : NULL;
+    double at = send_time(chat_id, now, b);
+    if (g_rl.ready) {
+        take(&g_rl.global, &g_rl.global_full, at);
+        if (b) {
+            take(chat_rate(chat_id), &b->full, at);
+        }
+    }
+    g_rl.sends++;
+    if (at > now) {
+        g_rl.delayed++;
+    }
+    pthread_mutex_unlock(&g_rl.lock);
+    return at - now;
+}
+
+double ratelimit_peek(int64_t chat_id)
+{
+    pthread_mutex_lock(&g_rl.lock);
+    double now = monotonic_sec();
+    const ChatBucket *b = g_rl.ready ? chat_find(chat_id) : NULL;
+    double wait = send_time(chat_id, now, b) - now;
+    pthread_mutex_unlock(&g_rl.lock);
+    return wait;
+}
+
+int ratelimit_acquire(int64_t chat_id, volatile sig_atomic_t *abort_flag)
+{
+    double start = monotonic_sec();
+    double until = start + ratelimit_reserve(chat_id);
+    for (;;) {
+        if (abort_flag && *abort_flag == 0) {
+            return -1;
+        }
+        // a 429 seen by another sender meanwhile extends the wait
+        pthread_mutex_lock(&g_rl.lock);
+        if (g_rl.pause_until > until) {
+            until = g_rl.pause_until;
+        }
+        pthread_mutex_unlock(&g_rl.lock);
+
+        double left = until - monotonic_sec();
+        if (left <= 0.0) {
+            metrics_observe(MET_RATELIMIT_DELAY, monotonic_sec() - start);
+            return 0;
+        }
+        // sleep in slices so shutdown is not held up by a long pause
+        if (left > RATELIMIT_SLEEP_SLICE) {
+            left = RATELIMIT_SLEEP_SLICE;
+        }
+        struct timespec ts;
+        ts.tv_sec = (time_t)left;
+        ts.tv_nsec = (long)((left - (double)ts.tv_sec) * 1e9);
+        nanosleep(&ts, NULL);
+    }
+}
+
+void ratelimit_pause(double seconds)
+{
+    if (seconds <= 0.0) {
+        return;
+    }
+    pthread_mutex_lock(&g_rl.lock);
+    double until = monotonic_sec() + seconds;
+    int extended = until > g_rl.pause_until;
+    if (extended) {
+        g_rl.pause_until = until;
+        g_rl.pauses++;
+    }
+    pthread_mutex_unlock(&g_rl.lock);
+    if (extended) {
+        log_warn("ratelimit: Telegram asked to back off - holding all sends for %.0fs", seconds);
+    }
+}
+
+void ratelimit_stats(RateLimitStats *out)
+{
+    if (!out) {
+        return;
+    }
+    pthread_mutex_lock(&g_rl.lock);
+    out->sends = g_rl.sends;
+    out->delayed = g_rl.delayed;
+    out->pauses = g_rl.pauses;
+    out->chats = g_rl.chats;
+    pthread_mutex_unlock(&g_rl.lock);
+}
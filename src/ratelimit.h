@@ -0,0 +1,49 @@
+#pragma once
+
+#include <signal.h>
+#include <stdint.h>
+
+/* process-wide outbound send governor shared by every BotHandle
+ * a global token bucket (Telegram's ~30 messages/s per bot) plus one bucket
+ * per chat: private chats (id > 0) and groups/channels (id < 0) have their
+ * own rates. a send is scheduled at the earliest instant every bucket it
+ * draws from allows, so bursts are spread out instead of being rejected.
+ * a 429 Retry-After pauses every sender, not just the one that hit it.
+ * all calls are thread-safe; until ratelimit_init() only pauses apply.
+ */
+
+/* global_per_sec: messages per second across all chats (0 = not limited)
+ * chat_per_min / group_per_min: per private chat / per group (0 = not limited)
+ * returns 0 on success, -1 on error
+ */
+int ratelimit_init(int global_per_sec, int chat_per_min, int group_per_min);
+
+// forget every bucket and any pause
+void ratelimit_destroy(void);
+
+/* reserve a send to chat_id and return the seconds to wait before it may go
+ * (0 when it may go now). the reservation is committed: the caller must send
+ * after the delay, and later callers are scheduled behind it
+ */
+double ratelimit_reserve(int64_t chat_id);
+
+/* reserve a send to chat_id and sleep until it may go
+ * returns 0 when the send may go, -1 if *abort_flag dropped to 0 meanwhile
+ * (abort_flag may be NULL)
+ */
+int ratelimit_acquire(int64_t chat_id, volatile sig_atomic_t *abort_flag);
+
+// seconds until chat_id could send without waiting; reserves nothing
+double ratelimit_peek(int64_t chat_id);
+
+// hold every send for seconds (a 429 Retry-After); never shortens a pause
+void ratelimit_pause(double seconds);
+
+typedef struct {
+    uint64_t sends;   // reservations made
+    uint64_t delayed; // reservations that had to wait
+    uint64_t pauses;  // 429 pauses applied
+    int chats;        // per-chat buckets currently tracked
+} RateLimitStats;
+
+void ratelimit_stats(RateLimitStats *out);
@@ -0,0 +1,143 @@
+#include "respbuf.h"
+#include "logger.h"
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+// smallest allocation
+#define RESPBUF_MIN 4096
+
+void respbuf_init(RespBuf *b, size_t max, const char *tag)
+{
+    memset(b, 0, sizeof(*b));
+    b->max = max;
+    b->tag = tag;
+}
+
+void respbuf_free(RespBuf *b)
+{
+    free(b->data);
+    b->data = NULL;
+    b->len = 0;
+    b->cap = 0;
+    b->peak = 0;
+    b->small_runs = 0;
+}
+
+static size_t round_up_pow2(size_t n)
+{
+    size_t c = RESPBUF_MIN;
+    while (c < n && c <= SIZE_MAX / 2) {
+        c *= 2;
+    }
+    return c;
+}
+
+void respbuf_begin(RespBuf *b, CURL *easy)
+{
+    b->easy = easy;
+
+    // judge the previous response against the current capacity
+    if (b->cap > RESPBUF_RETAIN && b->len < b->cap / 4) {
+        b->small_runs++;
+        if (b->len > b->peak) {
+            b->peak = b->len;
+        }
+    } else {
+        b->small_runs = 0;
+        b->peak = 0;
+    }
+
+    if (b->small_runs >= RESPBUF_SHRINK_AFTER) {
+        // keep room for twice the recent peak, never below the retained size
+        size_t want = round_up_pow2(b->peak * 2 + 1);
+        if (want < RESPBUF_RETAIN) {
+            want = RESPBUF_RETAIN;
+        }
+        if (want < b->cap) {
+            char *tmp = realloc(b->data, want);
+            if (tmp) {
+                b->data = tmp;
+                b->cap = want;
+            }
+        }
+        b->small_runs = 0;
+        b->peak = 0;
+    }
+
+    b->len = 0;
+    if (b->data) {
+        b->data[0] = '\0';
+    }
+}
+
+int respbuf_reserve(RespBuf *b, size_t n)
+{
+    if (n > SIZE_MAX - b->len - 1) {
+        return -1;
+    }
+    size_t need = b->len + n + 1;
+    if (b->max && need > b->max) {
+        return -1;
+    }
+    if (need <= b->cap) {
+        return 0;
+    }
+    size_t new_cap = b->cap ? b->cap : RESPBUF_MIN;
+    while (new_cap < need) {
+        if (new_cap > SIZE_MAX / 2) {
+            return -1;
+        }
+        new_cap *= 2;
+    }
+    if (b->max && new_cap > b->max) {
+        new_cap = b->max;
+    }
+    char *tmp = realloc(b->data, new_cap);
+    if (!tmp) {
+        return -1;
+    }
+    b->data = tmp;
+    b->cap = new_cap;
+    return 0;
+}
+
+int respbuf_append(RespBuf *b, const void *data, size_t n)
+{
+    if (respbuf_reserve(b, n) != 0) {
+        return -1;
+    }
+    memcpy(b->data + b->len, data, n);
+    b->len += n;
+    b->data[b->len] = '\0';
+    return 0;
+}
+
+size_t respbuf_write_cb(char *ptr, size_t size, size_t nmemb, void *userdata)
+{
+    RespBuf *b = (RespBuf *)userdata;
+
+    // guard against size_t overflow on 32bit targets
+    if (nmemb != 0 && size > SIZE_MAX / nmemb) {
+        return 0;
+    }
+    size_t bytes = size * nmemb;
+
+    // first chunk: headers are in, so size the buffer for the whole body
+    if (b->len == 0 && b->easy) {
+        curl_off_t cl = -1;
+        if (curl_easy_getinfo(b->easy, CURLINFO_CONTENT_LENGTH_DOWNLOAD_T, &cl) == CURLE_OK &&
+            cl > 0 && (b->max == 0 || (curl_off_t)b->max > cl)) {
+            respbuf_reserve(b, (size_t)cl);
+        }
+    }
+
+    if (respbuf_append(b, ptr, bytes) != 0) {
+        if (b->max && b->len + bytes + 1 > b->max) {
+            log_error("%s: response too large (>%zu bytes)", b->tag ? b->tag : "http", b->max);
+        }
+        return 0; // signal error to curl
+    }
+    return bytes;
+}
@@ -0,0 +1,49 @@
+#pragma once
+
+#include <curl/curl.h>
+#include <stddef.h>
+
+/* retained HTTP response buffer
+ * a handle keeps one of these across requests so steady-state responses are
+ * received without reallocating. the first write of a transfer presizes from
+ * Content-Length when the server sends one. capacity that keeps going unused
+ * is given back: after RESPBUF_SHRINK_AFTER consecutive responses below a
+ * quarter of a buffer larger than RESPBUF_RETAIN, it shrinks to fit them.
+ */
+
+// capacity always kept once allocated
+#define RESPBUF_RETAIN (64 * 1024)
+
+// consecutive small responses before an oversized buffer is shrunk
+#define RESPBUF_SHRINK_AFTER 16
+
+typedef struct {
+    char *data;      // NUL-terminated while len > 0
+    size_t len;
+    size_t cap;
+    size_t max;      // hard limit including the terminator (0 = unlimited)
+    size_t peak;     // largest len since the last shrink check
+    int small_runs;  // consecutive responses that used < cap / 4
+    CURL *easy;      // transfer being received, used to read Content-Length
+    const char *tag; // log prefix for the oversized error
+} RespBuf;
+
+// zero-initialised buffers are also valid; max 0 means unlimited
+void respbuf_init(RespBuf *b, size_t max, const char *tag);
+
+// release the storage
+void respbuf_free(RespBuf *b);
+
+/* prepare to receive a new response on easy: clears len and applies the
+ * shrink policy to the previous response's footprint
+ */
+void respbuf_begin(RespBuf *b, CURL *easy);
+
+// ensure room for n more bytes plus a terminator; returns 0 or -1
+int respbuf_reserve(RespBuf *b, size_t n);
+
+// append bytes; returns 0 or -1 (over max or allocation failure)
+int respbuf_append(RespBuf *b, const void *data, size_t n);
+
+// CURLOPT_WRITEFUNCTION adapter; userdata is the RespBuf
+size_t respbuf_write_cb(char *ptr, size_t size, size_t nmemb, void *userdata);
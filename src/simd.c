@@ -0,0 +1,230 @@
+#include "simd.h"
+
+#include <stdint.h>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#define SIMD_AVX2 1
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#define SIMD_SSE2 1
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+#include <arm_neon.h>
+#define SIMD_NEON 1
+#endif
+
+const char *simd_backend(void)
+{
+#if defined(SIMD_AVX2)
+    return "avx2";
+#elif defined(SIMD_SSE2)
+    return "sse2";
+#elif defined(SIMD_NEON)
+    return "neon";
+#else
+    return "scalar";
+#endif
+}
+
+static int json_special(unsigned char c)
+{
+    return c < 0x20 || c == '"' || c == '\\';
+}
+
+size_t simd_json_plain(const char *s, size_t n)
+{
+    size_t i = 0;
+#if defined(SIMD_AVX2)
+    const __m256i ctl = _mm256_set1_epi8(0x1F);
+    const __m256i quote = _mm256_set1_epi8('"');
+    const __m256i bslash = _mm256_set1_epi8('\\');
+    for (; i + 32 <= n; i += 32) {
+        __m256i v = _mm256_loadu_si256((const __m256i *)(const void *)(s + i));
+        // max(v, 0x1f) == 0x1f exactly for the bytes below 0x20
+        __m256i hit = _mm256_or_si256(_mm256_cmpeq_epi8(_mm256_max_epu8(v, ctl), ctl),
+                                      _mm256_or_si256(_mm256_cmpeq_epi8(v, quote),
+                                                      _mm256_cmpeq_epi8(v, bslash)));
+        unsigned mask = (unsigned)_mm256_movemask_epi8(hit);
+        if (mask) {
+            return i + (size_t)__builtin_ctz(mask);
+        }
+    }
+#elif defined(SIMD_SSE2)
+    const __m128i ctl = _mm_set1_epi8(0x1F);
+    const __m128i quote = _mm_set1_epi8('"');
+    const __m128i bslash = _mm_set1_epi8('\\');
+    for (; i + 16 <= n; i += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i *)(const void *)(s + i));
+        __m128i hit = _mm_or_si128(_mm_cmpeq_epi8(_mm_max_epu8(v, ctl), ctl),
+                                   _mm_or_si128(_mm_cmpeq_epi8(v, quote), _mm_cmpeq_epi8(v, bslash)));
+        unsigned mask = (unsigned)_mm_movemask_epi8(hit);
+        if (mask) {
+            return i + (size_t)__builtin_ctz(mask);
+        }
+    }
+#elif defined(SIMD_NEON)
+    const uint8x16_t ctl = vdupq_n_u8(0x20);
+    const uint8x16_t quote = vdupq_n_u8('"');
+    const uint8x16_t bslash = vdupq_n_u8('\\');
+    for (; i + 16 <= n; i += 16) {
+        uint8x16_t v = vld1q_u8((const uint8_t *)s + i);
+        uint8x16_t hit = vorrq_u8(vcltq_u8(v, ctl), vorrq_u8(vceqq_u8(v, quote), vceqq_u8(v, bslash)));
+        if (vmaxvq_u8(hit)) {
+            break; // the scalar loop finds it within these 16 bytes
+        }
+    }
+#endif
+    while (i < n && !json_special((unsigned char)s[i])) {
+        i++;
+    }
+    return i;
+}
+
+size_t simd_ascii_run(const char *s, size_t n)
+{
+    size_t i = 0;
+#if defined(SIMD_AVX2)
+    for (; i + 32 <= n; i += 32) {
+        __m256i v = _mm256_loadu_si256((const __m256i *)(const void *)(s + i));
+        unsigned mask = (unsigned)_mm256_movemask_epi8(v);
+        if (mask) {
+            return i + (size_t)__builtin_ctz(mask);
+        }
+    }
+#elif defined(SIMD_SSE2)
+    for (; i + 16 <= n; i += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i *)(const void *)(s + i));
+        unsigned mask = (unsigned)_mm_movemask_epi8(v);
+        if (mask) {
+            return i + (size_t)__builtin_ctz(mask);
+        }
+    }
+#elif defined(SIMD_NEON)
+    for (; i + 16 <= n; i += 16) {
+        if (vmaxvq_u8(vld1q_u8((const uint8_t *)s + i)) >= 0x80) {
+            break;
+        }
+    }
+#endif
+    while (i < n && (unsigned char)s[i] < 0x80) {
+        i++;
+    }
+    return i;
+}
+
+// length of the valid multi-byte sequence at s[0..n), or 0 if there is none
+static size_t utf8_seq(const unsigned char *s, size_t n)
+{
+    unsigned char c = s[0];
+    size_t len;
+    unsigned char lo = 0x80;
+    unsigned char hi = 0xBF;
+    if (c >= 0xC2 && c <= 0xDF) {
+        len = 2;
+    } else if (c >= 0xE0 && c <= 0xEF) {
+        len = 3;
+        if (c == 0xE0) {
+            lo = 0xA0; // overlong
+        } else if (c == 0xED) {
+            hi = 0x9F; // surrogates
+        }
+    } else if (c >= 0xF0 && c <= 0xF4) {
+        len = 4;
+        if (c == 0xF0) {
+            lo = 0x90; // overlong
+        } else if (c == 0xF4) {
+            hi = 0x8F; // above U+10FFFF
+        }
+    } else {
+        return 0;
+    }
+    if (n < len || s[1] < lo || s[1] > hi) {
+        return 0;
+    }
+    for (size_t k = 2; k < len; k++) {
+        if ((s[k] & 0xC0) != 0x80) {
+            return 0;
+        }
+    }
+    return len;
+}
+
+size_t simd_utf8_valid(const char *s, size_t n)
+{
+    const unsigned char *u = (const unsigned char *)s;
+    size_t i = 0;
+    for (;;) {
+        i += simd_ascii_run(s + i, n - i);
+        if (i == n) {
+            return n;
+        }
+        size_t len = utf8_seq(u + i, n - i);
+        if (len == 0) {
+            return i;
+        }
+        i += len;
+    }
+}
+
+size_t simd_utf8_cut(const char *s, size_t n)
+{
+    size_t i = n;
+    size_t back = 0;
+    while (i > 0 && back < 4 && ((unsigned char)s[i - 1] & 0xC0) == 0x80) {
+        i--;
+        back++;
+    }
+    if (i == 0) {
+        return n;
+    }
+    unsigned char lead = (unsigned char)s[i - 1];
+    size_t need = 1;
+    if (lead >= 0xF0) {
+        need = 4;
+    } else if (lead >= 0xE0) {
+        need = 3;
+    } else if (lead >= 0xC0) {
+        need = 2;
+    }
+    return (back + 1 >= need) ? n : i - 1;
+}
+
+size_t simd_utf8_fit(const char *s, size_t n, size_t max_units)
+{
+    if (n <= max_units) {
+        return n; // every character takes at least one byte per unit
+    }
+    const unsigned char *u = (const unsigned char *)s;
+    size_t i = 0;
+    size_t units = 0;
+    for (;;) {
+        size_t room = max_units - units;
+        size_t run = simd_ascii_run(s + i, n - i < room ? n - i : room);
+        i += run;
+        units += run;
+        if (i == n || units == max_units) {
+            return i;
+        }
+        size_t len = u[i] >= 0xF0 ? 4 : u[i] >= 0xE0 ? 3 : 2;
+        size_t cost = len == 4 ? 2 : 1; // a surrogate pair above the BMP
+        if (i + len > n || units + cost > max_units) {
+            return i;
+        }
+        i += len;
+        units += cost;
+    }
+}
+
+size_t simd_utf8_repair(char *s, size_t n)
+{
+    size_t fixed = 0;
+    size_t i = 0;
+    for (;;) {
+        i += simd_utf8_valid(s + i, n - i);
+        if (i == n) {
+            return fixed;
+        }
+        s[i++] = '?';
+        fixed++;
+    }
+}
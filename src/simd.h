@@ -0,0 +1,36 @@
+#pragma once
+
+#include <stddef.h>
+
+/* vectorised text scans for the reply path
+ * AVX2, SSE2 or NEON is picked at compile time (-march=native decides);
+ * other targets and the tail of every buffer use the scalar loop. looking
+ * for a single byte ('<' in think-tag stripping) is left to memchr, which
+ * libc already vectorises.
+ */
+
+// "avx2", "sse2", "neon" or "scalar"
+const char *simd_backend(void);
+
+// length of the prefix of s[0..n) that JSON copies verbatim (no quote,
+// backslash or control character)
+size_t simd_json_plain(const char *s, size_t n);
+
+// length of the prefix of s[0..n) that is plain ASCII
+size_t simd_ascii_run(const char *s, size_t n);
+
+// length of the longest prefix of s[0..n) that is valid UTF-8
+size_t simd_utf8_valid(const char *s, size_t n);
+
+// length of the longest prefix of s[0..n) that does not end inside a character
+size_t simd_utf8_cut(const char *s, size_t n);
+
+/* byte length of the longest prefix of valid UTF-8 s[0..n) that is at
+ * most max_units UTF-16 code units (how Telegram counts message length)
+ * and does not split a character
+ */
+size_t simd_utf8_fit(const char *s, size_t n, size_t max_units);
+
+// replace every byte that is not part of a valid UTF-8 sequence with '?'
+// (the length does not change); returns the number of bytes replaced
+size_t simd_utf8_repair(char *s, size_t n);
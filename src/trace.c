@@ -0,0 +1,267 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "trace.h"
+#include "logger.h"
+
+#include <errno.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <semaphore.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+static const char *const STAGE_NAMES[TRACE_STAGES] = {
+    [TRACE_QUEUE] = "queue_wait",
+    [TRACE_THINKING] = "thinking",
+    [TRACE_LLM] = "llm",
+    [TRACE_SEND] = "send",
+};
+
+static atomic_uint_fast64_t g_next_id;
+static atomic_bool g_enabled;
+
+static struct {
+    pthread_mutex_t lock;
+    TraceCtx *ring;
+    size_t mask;
+    uint64_t written; // traces ever committed; the newest is ring[(written - 1) & mask]
+    uint64_t sample;
+    double slow_sec;
+
+    sem_t wake;
+    atomic_bool dumper_running; // read from signal handlers
+    atomic_bool dumper_stop;
+    pthread_t dumper;
+    char path[256];
+} g_trace = {.lock = PTHREAD_MUTEX_INITIALIZER};
+
+int trace_init(int slots, int sample, double slow_sec)
+{
+    if (slots < 1 || sample < 0 || slow_sec < 0) {
+        return -1;
+    }
+    size_t cap = 1;
+    while (cap < (size_t)slots) {
+        cap <<= 1;
+    }
+    TraceCtx *ring = calloc(cap, sizeof(*ring));
+    if (!ring) {
+        return -1;
+    }
+
+    pthread_mutex_lock(&g_trace.lock);
+    free(g_trace.ring);
+    g_trace.ring = ring;
+    g_trace.mask = cap - 1;
+    g_trace.written = 0;
+    g_trace.sample = (uint64_t)sample;
+    g_trace.slow_sec = slow_sec;
+    pthread_mutex_unlock(&g_trace.lock);
+    atomic_store(&g_enabled, true);
+    return 0;
+}
+
+uint64_t trace_next_id(void)
+{
+    if (!atomic_load_explicit(&g_enabled, memory_order_relaxed)) {
+        return 0;
+    }
+    return atomic_fetch_add_explicit(&g_next_id, 1, memory_order_relaxed) + 1;
+}
+
+void trace_begin(TraceCtx *t, uint64_t id, int64_t chat_id, double ingress, int worker,
+                 int merged)
+{
+    memset(t, 0, sizeof(*t));
+    t->id = id;
+    t->chat_id = chat_id;
+    t->ingress = ingress;
+    t->worker = worker;
+    t->merged = merged;
+}
+
+void trace_stage(TraceCtx *t, TraceStage stage, double t0, double t1)
+{
+    if (!t->id || (unsigned)stage >= TRACE_STAGES) {
+        return;
+    }
+    if (t->start[stage] == 0) {
+        t->start[stage] = t0;
+    }
+    t->end[stage] = t1;
+}
+
+// end of the last stage that ran, or ingress when none did
+static double trace_end(const TraceCtx *t)
+{
+    double end = t->ingress;
+    for (int s = 0; s < TRACE_STAGES; s++) {
+        if (t->end[s] > end) {
+            end = t->end[s];
+        }
+    }
+    return end;
+}
+
+int trace_commit(const TraceCtx *t)
+{
+    if (!t->id) {
+        return 0;
+    }
+    pthread_mutex_lock(&g_trace.lock);
+    int keep = g_trace.ring &&
+               ((g_trace.sample > 0 && t->id % g_trace.sample == 0) ||
+                (g_trace.slow_sec > 0 && trace_end(t) - t->ingress >= g_trace.slow_sec));
+    if (keep) {
+        g_trace.ring[g_trace.written & g_trace.mask] = *t;
+        g_trace.written++;
+    }
+    pthread_mutex_unlock(&g_trace.lock);
+    return keep;
+}
+
+size_t trace_count(void)
+{
+    pthread_mutex_lock(&g_trace.lock);
+    size_t n = 0;
+    if (g_trace.ring) {
+        n = g_trace.written > g_trace.mask + 1 ? g_trace.mask + 1 : (size_t)g_trace.written;
+    }
+    pthread_mutex_unlock(&g_trace.lock);
+    return n;
+}
+
+// one complete ("X") event; timestamps are microseconds of CLOCK_MONOTONIC
+static void put_span(FILE *f, const char *name, const TraceCtx *t, double t0, double t1)
+{
+    fprintf(f,
+            ",\n{\"name\":\"%s\",\"cat\":\"tgbot\",\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f,"
+            "\"pid\":%d,\"tid\":%" PRIu64 ",\"args\":{\"chat\":%" PRId64 ",\"merged\":%d}}",
+            name, t0 * 1e6, (t1 - t0) * 1e6, t->worker + 1, t->id, t->chat_id, t->merged);
+}
+
+int trace_dump(const char *path)
+{
+    // copy the ring out so formatting never holds up trace_commit
+    pthread_mutex_lock(&g_trace.lock);
+    size_t n = 0;
+    TraceCtx *snap = NULL;
+    if (g_trace.ring) {
+        size_t cap = g_trace.mask + 1;
+        n = g_trace.written > cap ? cap : (size_t)g_trace.written;
+        snap = malloc((n ? n : 1) * sizeof(*snap));
+        for (size_t i = 0; snap && i < n; i++) {
+            snap[i] = g_trace.ring[(g_trace.written - n + i) & g_trace.mask];
+        }
+    }
+    pthread_mutex_unlock(&g_trace.lock);
+    if (!snap) {
+        log_error("trace: nothing to dump (tracing off or out of memory)");
+        return -1;
+    }
+
+    char tmp[300];
+    snprintf(tmp, sizeof(tmp), "%s.tmp", path);
+    FILE *f = fopen(tmp, "w");
+    if (!f) {
+        log_error("trace: cannot write %s: %s", tmp, strerror(errno));
+        free(snap);
+        return -1;
+    }
+
+    fprintf(f, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n"
+               "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":0,\"args\":{\"name\":\"tgbot\"}}");
+    unsigned long long seen_workers = 0; // process_name emitted, for workers 0..63
+    for (size_t i = 0; i < n; i++) {
+        const TraceCtx *t = &snap[i];
+        if (t->worker >= 0 && t->worker < 64 && !(seen_workers & (1ULL << t->worker))) {
+            seen_workers |= 1ULL << t->worker;
+            fprintf(f,
+                    ",\n{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":%d,"
+                    "\"args\":{\"name\":\"worker %d\"}}",
+                    t->worker + 1, t->worker);
+        }
+        fprintf(f,
+                ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":%d,\"tid\":%" PRIu64
+                ",\"args\":{\"name\":\"msg %" PRIu64 " chat %" PRId64 "\"}}",
+                t->worker + 1, t->id, t->id, t->chat_id);
+        put_span(f, "reply", t, t->ingress, trace_end(t));
+        for (int s = 0; s < TRACE_STAGES; s++) {
+            if (t->start[s] != 0) {
+                put_span(f, STAGE_NAMES[s], t, t->start[s], t->end[s]);
+            }
+        }
+    }
+    fprintf(f, "\n]}\n");
+    free(snap);
+
+    int err = ferror(f);
+    if (fclose(f) != 0 || err || rename(tmp, path) != 0) {
+        log_error("trace: failed to write %s", path);
+        unlink(tmp);
+        return -1;
+    }
+    log_info("trace: wrote %zu trace(s) to %s", n, path);
+    return 0;
+}
+
+static void *dumper_main(void *arg)
+{
+    (void)arg;
+    for (;;) {
+        while (sem_wait(&g_trace.wake) != 0 && errno == EINTR) {
+        }
+        if (atomic_load(&g_trace.dumper_stop)) {
+            break;
+        }
+        trace_dump(g_trace.path);
+    }
+    return NULL;
+}
+
+int trace_start_dumper(const char *path)
+{
+    if (atomic_load(&g_trace.dumper_running) || !path || !path[0]) {
+        return -1;
+    }
+    snprintf(g_trace.path, sizeof(g_trace.path), "%s", path);
+    if (sem_init(&g_trace.wake, 0, 0) != 0) {
+        return -1;
+    }
+    atomic_store(&g_trace.dumper_stop, false);
+    if (pthread_create(&g_trace.dumper, NULL, dumper_main, NULL) != 0) {
+        sem_destroy(&g_trace.wake);
+        return -1;
+    }
+    atomic_store(&g_trace.dumper_running, true);
+    return 0;
+}
+
+void trace_request_dump(void)
+{
+    // sem_post is on the async-signal-safe list; the dumper does the rest
+    if (atomic_load(&g_trace.dumper_running)) {
+        sem_post(&g_trace.wake);
+    }
+}
+
+void trace_destroy(void)
+{
+    atomic_store(&g_enabled, false);
+    if (atomic_load(&g_trace.dumper_running)) {
+        atomic_store(&g_trace.dumper_stop, true);
+        sem_post(&g_trace.wake);
+        pthread_join(g_trace.dumper, NULL);
+        sem_destroy(&g_trace.wake);
+        atomic_store(&g_trace.dumper_running, false);
+    }
+    pthread_mutex_lock(&g_trace.lock);
+    free(g_trace.ring);
+    g_trace.ring = NULL;
+    g_trace.written = 0;
+    pthread_mutex_unlock(&g_trace.lock);
+}
@@ -0,0 +1,72 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* per-message traces, ingress to final send
+ * handle_update takes a trace id and the queue carries it to the worker,
+ * which stamps each stage into a TraceCtx on its stack. at the end of the
+ * reply trace_commit keeps the trace if its id is sampled (1 in sample) or
+ * the reply was slower than slow_sec, so sporadic slow replies are caught
+ * without tracing everything. kept traces are copied as fixed-size binary
+ * records into a ring of the newest `slots` traces; nothing is formatted
+ * until a dump, which writes Chrome trace event JSON (chrome://tracing,
+ * ui.perfetto.dev) with one track per message, grouped by worker.
+ */
+
+typedef enum {
+    TRACE_QUEUE,    // enqueue -> worker pickup (includes reply_delay)
+    TRACE_THINKING, // "Thinking..." placeholder send (streamed replies)
+    TRACE_LLM,      // LLM request, start to full reply
+    TRACE_SEND,     // final sendMessage/editMessageText
+    TRACE_STAGES
+} TraceStage;
+
+typedef struct {
+    uint64_t id;                // 0: not traced
+    int64_t chat_id;
+    double ingress;             // CLOCK_MONOTONIC seconds at enqueue
+    double start[TRACE_STAGES]; // 0 for stages that did not run
+    double end[TRACE_STAGES];
+    int worker;
+    int merged; // messages coalesced into this reply
+} TraceCtx;
+
+/* enable tracing with a ring of `slots` traces (rounded up to a power of two)
+ * sample: keep 1 in sample traces regardless of latency (0 = slow ones only)
+ * slow_sec: also keep any reply slower than this, ingress to last stage (0 = off)
+ * returns 0, or -1 on bad arguments or allocation failure
+ */
+int trace_init(int slots, int sample, double slow_sec);
+
+// a fresh trace id, or 0 while tracing is off
+uint64_t trace_next_id(void);
+
+// start a trace for a popped message (id 0 leaves every trace call a no-op)
+void trace_begin(TraceCtx *t, uint64_t id, int64_t chat_id, double ingress, int worker,
+                 int merged);
+
+/* record that stage ran from t0 to t1 (CLOCK_MONOTONIC seconds)
+ * a stage recorded twice keeps its first start and last end
+ */
+void trace_stage(TraceCtx *t, TraceStage stage, double t0, double t1);
+
+// keep the trace if it is sampled or slow; returns 1 if kept
+int trace_commit(const TraceCtx *t);
+
+// traces currently held in the ring
+size_t trace_count(void);
+
+// write every held trace to path as Chrome trace JSON (via a temp file + rename)
+int trace_dump(const char *path);
+
+/* dump to path whenever trace_request_dump() is called (e.g. on SIGUSR1)
+ * from a background thread, so the signal handler stays async-signal-safe
+ */
+int trace_start_dumper(const char *path);
+
+// ask the dumper thread for a dump; async-signal-safe
+void trace_request_dump(void);
+
+// stop the dumper, free the ring and turn tracing off
+void trace_destroy(void);
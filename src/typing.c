@@ -0,0 +1,208 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "typing.h"
+#include "config.h"
+#include "logger.h"
+#include "ratelimit.h"
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <string.h>
+#include <time.h>
+
+typedef struct {
+    int64_t chat_id;
+    int refs;    // replies in progress; 0 marks a free slot
+    bool shown;  // an action went out for this busy spell
+    double due;  // next action, CLOCK_MONOTONIC seconds
+} TypingChat;
+
+static struct {
+    pthread_mutex_t lock;
+    pthread_cond_t wake;
+    TypingChat chats[TYPING_CHATS_MAX];
+    int busy;
+    bool running;
+    bool stop;
+    pthread_t thread;
+    TypingSendFn send;
+    void *ud;
+    atomic_uint_fast64_t sent;
+    atomic_uint_fast64_t shared;
+    atomic_uint_fast64_t skipped;
+} g_typing = {.lock = PTHREAD_MUTEX_INITIALIZER};
+
+static double monotonic_sec(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+static void add_seconds(struct timespec *ts, double sec)
+{
+    time_t whole = (time_t)sec;
+    long nsec = ts->tv_nsec + (long)((sec - (double)whole) * 1e9);
+    ts->tv_sec += whole + nsec / 1000000000L;
+    ts->tv_nsec = nsec % 1000000000L;
+}
+
+// busy slot of chat_id, or NULL; caller holds the lock
+static TypingChat *find_chat(int64_t chat_id)
+{
+    for (int i = 0; i < TYPING_CHATS_MAX; i++) {
+        if (g_typing.chats[i].refs > 0 && g_typing.chats[i].chat_id == chat_id) {
+            return &g_typing.chats[i];
+        }
+    }
+    return NULL;
+}
+
+static void *typing_main(void *arg)
+{
+    (void)arg;
+    int64_t due[TYPING_CHATS_MAX];
+    pthread_mutex_lock(&g_typing.lock);
+    while (!g_typing.stop) {
+        // claim what is due under the lock, send without it
+        double now = monotonic_sec();
+        int n = 0;
+        for (int i = 0; i < TYPING_CHATS_MAX; i++) {
+            TypingChat *tc = &g_typing.chats[i];
+            if (tc->refs > 0 && tc->due <= now) {
+                tc->due = now + TYPING_REFRESH_SEC;
+                tc->shown = true;
+                due[n++] = tc->chat_id;
+            }
+        }
+        pthread_mutex_unlock(&g_typing.lock);
+
+        for (int i = 0; i < n; i++) {
+            // a reply that went out meanwhile would be followed by a stray indicator
+            pthread_mutex_lock(&g_typing.lock);
+            bool busy = find_chat(due[i]) != NULL;
+            pthread_mutex_unlock(&g_typing.lock);
+            if (!busy || ratelimit_peek(due[i]) > 0) {
+                continue;
+            }
+            if (g_typing.send(due[i], g_typing.ud) == 0) {
+                atomic_fetch_add_explicit(&g_typing.sent, 1, memory_order_relaxed);
+            }
+        }
+
+        pthread_mutex_lock(&g_typing.lock);
+        if (!g_typing.stop) {
+            struct timespec ts;
+            clock_gettime(CLOCK_MONOTONIC, &ts);
+            add_seconds(&ts, TYPING_TICK_SEC);
+            pthread_cond_timedwait(&g_typing.wake, &g_typing.lock, &ts);
+        }
+    }
+    pthread_mutex_unlock(&g_typing.lock);
+    return NULL;
+}
+
+int typing_start(TypingSendFn send, void *ud)
+{
+    if (!send) {
+        return -1;
+    }
+    pthread_mutex_lock(&g_typing.lock);
+    if (g_typing.running) {
+        pthread_mutex_unlock(&g_typing.lock);
+        return -1;
+    }
+    pthread_condattr_t ca;
+    pthread_condattr_init(&ca);
+    pthread_condattr_setclock(&ca, CLOCK_MONOTONIC);
+    pthread_cond_init(&g_typing.wake, &ca);
+    pthread_condattr_destroy(&ca);
+
+    memset(g_typing.chats, 0, sizeof(g_typing.chats));
+    g_typing.busy = 0;
+    g_typing.send = send;
+    g_typing.ud = ud;
+    g_typing.stop = false;
+    if (pthread_create(&g_typing.thread, NULL, typing_main, NULL) != 0) {
+        pthread_cond_destroy(&g_typing.wake);
+        pthread_mutex_unlock(&g_typing.lock);
+        log_error("typing: cannot start thread");
+        return -1;
+    }
+    g_typing.running = true;
+    pthread_mutex_unlock(&g_typing.lock);
+    return 0;
+}
+
+void typing_begin(int64_t chat_id)
+{
+    pthread_mutex_lock(&g_typing.lock);
+    if (!g_typing.running) {
+        pthread_mutex_unlock(&g_typing.lock);
+        return;
+    }
+    TypingChat *tc = find_chat(chat_id);
+    if (tc) {
+        tc->refs++;
+        atomic_fetch_add_explicit(&g_typing.shared, 1, memory_order_relaxed);
+    } else {
+        for (int i = 0; i < TYPING_CHATS_MAX && !tc; i++) {
+            if (g_typing.chats[i].refs == 0) {
+                tc = &g_typing.chats[i];
+            }
+        }
+        if (tc) {
+            *tc = (TypingChat){.chat_id = chat_id, .refs = 1,
+                               .due = monotonic_sec() + TYPING_GRACE_SEC};
+            g_typing.busy++;
+        } else {
+            // the reply still goes out, just without an indicator
+            atomic_fetch_add_explicit(&g_typing.skipped, 1, memory_order_relaxed);
+        }
+    }
+    pthread_mutex_unlock(&g_typing.lock);
+}
+
+void typing_end(int64_t chat_id)
+{
+    pthread_mutex_lock(&g_typing.lock);
+    TypingChat *tc = g_typing.running ? find_chat(chat_id) : NULL;
+    if (tc && --tc->refs == 0) {
+        if (!tc->shown) {
+            atomic_fetch_add_explicit(&g_typing.skipped, 1, memory_order_relaxed);
+        }
+        g_typing.busy--;
+    }
+    pthread_mutex_unlock(&g_typing.lock);
+}
+
+void typing_stats(TypingStats *out)
+{
+    out->sent = atomic_load_explicit(&g_typing.sent, memory_order_relaxed);
+    out->shared = atomic_load_explicit(&g_typing.shared, memory_order_relaxed);
+    out->skipped = atomic_load_explicit(&g_typing.skipped, memory_order_relaxed);
+    pthread_mutex_lock(&g_typing.lock);
+    out->busy = g_typing.busy;
+    pthread_mutex_unlock(&g_typing.lock);
+}
+
+void typing_stop(void)
+{
+    pthread_mutex_lock(&g_typing.lock);
+    if (!g_typing.running) {
+        pthread_mutex_unlock(&g_typing.lock);
+        return;
+    }
+    g_typing.stop = true;
+    pthread_cond_signal(&g_typing.wake);
+    pthread_mutex_unlock(&g_typing.lock);
+    pthread_join(g_typing.thread, NULL);
+
+    pthread_mutex_lock(&g_typing.lock);
+    pthread_cond_destroy(&g_typing.wake);
+    memset(g_typing.chats, 0, sizeof(g_typing.chats));
+    g_typing.busy = 0;
+    g_typing.running = false;
+    pthread_mutex_unlock(&g_typing.lock);
+}
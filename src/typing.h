@@ -0,0 +1,37 @@
+#pragma once
+
+#include <stdint.h>
+
+/* typing indicator service
+ * workers mark a chat busy while its reply is being generated; one thread
+ * sends sendChatAction("typing") for every busy chat, first after
+ * TYPING_GRACE_SEC (so fast replies never show one) and then every
+ * TYPING_REFRESH_SEC until the last reply in progress for that chat ends.
+ * several replies to the same chat share one indicator. a refresh is
+ * skipped while the rate governor is holding that chat back, since a late
+ * indicator is worth nothing.
+ */
+
+// sends one chat action; called on the typing thread only
+typedef int (*TypingSendFn)(int64_t chat_id, void *ud);
+
+// start the typing thread; returns 0 on success, -1 if already running
+int typing_start(TypingSendFn send, void *ud);
+
+// a reply for chat_id is in progress (no-op when the service is not running)
+void typing_begin(int64_t chat_id);
+
+// that reply was sent or abandoned
+void typing_end(int64_t chat_id);
+
+typedef struct {
+    uint64_t sent;    // chat actions sent
+    uint64_t shared;  // typing_begin calls that joined a chat already busy
+    uint64_t skipped; // replies finished within the grace, or table full
+    int busy;         // chats busy right now
+} TypingStats;
+
+void typing_stats(TypingStats *out);
+
+// stop the thread and forget every chat
+void typing_stop(void);
@@ -0,0 +1,662 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "update.h"
+#include "cJSON.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+// nesting deeper than this is left to cJSON (Telegram updates stay well below)
+#define SCAN_MAX_DEPTH 64
+
+// "first occurrence wins" bookkeeping, matching cJSON_GetObjectItemCaseSensitive
+enum {
+    SEEN_UPDATE_ID = 1u << 0,
+    SEEN_MESSAGE = 1u << 1,
+    SEEN_CHAT = 1u << 2,
+    SEEN_CHAT_ID = 1u << 3,
+    SEEN_CHAT_TYPE = 1u << 4,
+    SEEN_FROM = 1u << 5,
+    SEEN_FROM_ID = 1u << 6,
+    SEEN_FIRST_NAME = 1u << 7,
+    SEEN_TEXT = 1u << 8,
+    SEEN_OK = 1u << 9,
+    SEEN_RESULT = 1u << 10,
+};
+
+typedef struct {
+    UpdateView *v;
+    unsigned seen;
+    bool ok;            // getUpdates: "ok" was true
+    const char *result; // getUpdates: first byte after '[' of "result"
+} ScanCtx;
+
+// called with p at the member's value; returns the byte after it or NULL
+typedef const char *(*member_fn)(const char *p, const char *end, const UpdStr *key, ScanCtx *c,
+                                 int depth);
+
+static const char *skip_value(const char *p, const char *end, int depth);
+
+static const char *skip_ws(const char *p, const char *end)
+{
+    while (p < end && (*p == ' ' || *p == '\t' || *p == '\n' || *p == '\r')) {
+        p++;
+    }
+    return p;
+}
+
+static int is_hex(char c)
+{
+    return (c >= '0' && c <= '9') || (c >= 'a' && c <= 'f') || (c >= 'A' && c <= 'F');
+}
+
+static int hex_val(char c)
+{
+    if (c >= '0' && c <= '9') {
+        return c - '0';
+    }
+    if (c >= 'a' && c <= 'f') {
+        return c - 'a' + 10;
+    }
+    return c - 'A' + 10;
+}
+
+// p at the opening quote; validates escapes, returns the byte after the closing quote
+static const char *scan_string(const char *p, const char *end, UpdStr *out)
+{
+    if (p >= end || *p != '"') {
+        return NULL;
+    }
+    const char *start = ++p;
+    bool escaped = false;
+    while (p < end) {
+        // jump straight to the next byte that needs attention
+        const char *q = p;
+        while (q < end && *q != '"' && *q != '\\') {
+            q++;
+        }
+        if (q >= end) {
+            return NULL;
+        }
+        if (*q == '"') {
+            if (out) {
+                out->p = start;
+                out->len = (size_t)(q - start);
+                out->escaped = escaped;
+            }
+            return q + 1;
+        }
+        escaped = true;
+        if (end - q < 2) {
+            return NULL;
+        }
+        switch (q[1]) {
+        case '"': case '\\': case '/': case 'b': case 'f': case 'n': case 'r': case 't':
+            p = q + 2;
+            break;
+        case 'u':
+            if (end - q < 6 || !is_hex(q[2]) || !is_hex(q[3]) || !is_hex(q[4]) || !is_hex(q[5])) {
+                return NULL;
+            }
+            p = q + 6;
+            break;
+        default:
+            return NULL;
+        }
+    }
+    return NULL;
+}
+
+// JSON number; integral values up to 18 digits are converted exactly
+static const char *scan_number(const char *p, const char *end, int64_t *out)
+{
+    const char *start = p;
+    if (p < end && *p == '-') {
+        p++;
+    }
+    const char *digits = p;
+    while (p < end && *p >= '0' && *p <= '9') {
+        p++;
+    }
+    if (p == digits) {
+        return NULL;
+    }
+    const char *digits_end = p;
+    bool integral = true;
+    if (p < end && *p == '.') {
+        integral = false;
+        const char *f = ++p;
+        while (p < end && *p >= '0' && *p <= '9') {
+            p++;
+        }
+        if (p == f) {
+            return NULL;
+        }
+    }
+    if (p < end && (*p == 'e' || *p == 'E')) {
+        integral = false;
+        p++;
+        if (p < end && (*p == '+' || *p == '-')) {
+            p++;
+        }
+        const char *e = p;
+        while (p < end && *p >= '0' && *p <= '9') {
+            p++;
+        }
+        if (p == e) {
+            return NULL;
+        }
+    }
+
+    if (!out) {
+        return p;
+    }
+    if (integral && digits_end - digits <= 18) {
+        int64_t v = 0;
+        for (const char *d = digits; d < digits_end; d++) {
+            v = v * 10 + (*d - '0');
+        }
+        *out = (*start == '-') ? -v : v;
+        return p;
+    }
+
+    // same truncation cJSON users get from (int64_t)valuedouble
+    char tmp[64];
+    size_t n = (size_t)(p - start);
+    if (n >= sizeof(tmp)) {
+        return NULL;
+    }
+    memcpy(tmp, start, n);
+    tmp[n] = '\0';
+    double d = strtod(tmp, NULL);
+    if (d >= 9.2e18) {
+        *out = INT64_MAX;
+    } else if (d <= -9.2e18) {
+        *out = INT64_MIN;
+    } else {
+        *out = (int64_t)d;
+    }
+    return p;
+}
+
+static const char *scan_literal(const char *p, const char *end, const char *lit)
+{
+    size_t n = strlen(lit);
+    if ((size_t)(end - p) < n || memcmp(p, lit, n) != 0) {
+        return NULL;
+    }
+    return p + n;
+}
+
+// p at '{'; fn (optional) handles each member value, others are skipped
+static const char *scan_object(const char *p, const char *end, member_fn fn, ScanCtx *c,
+                               int depth)
+{
+    if (depth > SCAN_MAX_DEPTH) {
+        return NULL;
+    }
+    p = skip_ws(p + 1, end);
+    if (p < end && *p == '}') {
+        return p + 1;
+    }
+    for (;;) {
+        UpdStr key;
+        p = scan_string(p, end, &key);
+        // escaped keys would need decoding to compare; leave them to cJSON
+        if (!p || key.escaped) {
+            return NULL;
+        }
+        p = skip_ws(p, end);
+        if (p >= end || *p != ':') {
+            return NULL;
+        }
+        p = skip_ws(p + 1, end);
+        p = fn ? fn(p, end, &key, c, depth) : skip_value(p, end, depth);
+        if (!p) {
+            return NULL;
+        }
+        p = skip_ws(p, end);
+        if (p >= end) {
+            return NULL;
+        }
+        if (*p == '}') {
+            return p + 1;
+        }
+        if (*p != ',') {
+            return NULL;
+        }
+        p = skip_ws(p + 1, end);
+    }
+}
+
+static const char *scan_array(const char *p, const char *end, int depth)
+{
+    if (depth > SCAN_MAX_DEPTH) {
+        return NULL;
+    }
+    p = skip_ws(p + 1, end);
+    if (p < end && *p == ']') {
+        return p + 1;
+    }
+    for (;;) {
+        p = skip_value(p, end, depth);
+        if (!p) {
+            return NULL;
+        }
+        p = skip_ws(p, end);
+        if (p >= end) {
+            return NULL;
+        }
+        if (*p == ']') {
+            return p + 1;
+        }
+        if (*p != ',') {
+            return NULL;
+        }
+        p++;
+    }
+}
+
+// validate and skip any value; depth is that of the enclosing container
+static const char *skip_value(const char *p, const char *end, int depth)
+{
+    p = skip_ws(p, end);
+    if (p >= end) {
+        return NULL;
+    }
+    switch (*p) {
+    case '"':
+        return scan_string(p, end, NULL);
+    case '{':
+        return scan_object(p, end, NULL, NULL, depth + 1);
+    case '[':
+        return scan_array(p, end, depth + 1);
+    case 't':
+        return scan_literal(p, end, "true");
+    case 'f':
+        return scan_literal(p, end, "false");
+    case 'n':
+        return scan_literal(p, end, "null");
+    default:
+        return scan_number(p, end, NULL);
+    }
+}
+
+static bool key_is(const UpdStr *k, const char *name)
+{
+    size_t n = strlen(name);
+    return k->len == n && memcmp(k->p, name, n) == 0;
+}
+
+// field takers: claim the first occurrence, skip repeats and wrong types
+
+static const char *take_int(const char *p, const char *end, int depth, ScanCtx *c, unsigned bit,
+                            bool *has, int64_t *out)
+{
+    if (c->seen & bit) {
+        return skip_value(p, end, depth);
+    }
+    c->seen |= bit;
+    if (p < end && (*p == '-' || (*p >= '0' && *p <= '9'))) {
+        const char *q = scan_number(p, end, out);
+        if (q) {
+            *has = true;
+        }
+        return q;
+    }
+    return skip_value(p, end, depth);
+}
+
+static const char *take_str(const char *p, const char *end, int depth, ScanCtx *c, unsigned bit,
+                            UpdStr *out)
+{
+    if (c->seen & bit) {
+        return skip_value(p, end, depth);
+    }
+    c->seen |= bit;
+    if (p < end && *p == '"') {
+        return scan_string(p, end, out);
+    }
+    return skip_value(p, end, depth);
+}
+
+static const char *take_obj(const char *p, const char *end, int depth, ScanCtx *c, unsigned bit,
+                            member_fn fn)
+{
+    if (c->seen & bit) {
+        return skip_value(p, end, depth);
+    }
+    c->seen |= bit;
+    if (p < end && *p == '{') {
+        return scan_object(p, end, fn, c, depth + 1);
+    }
+    return skip_value(p, end, depth);
+}
+
+static const char *chat_member(const char *p, const char *end, const UpdStr *key, ScanCtx *c,
+                               int depth)
+{
+    if (key_is(key, "id")) {
+        return take_int(p, end, depth, c, SEEN_CHAT_ID, &c->v->has_chat_id, &c->v->chat_id);
+    }
+    if (key_is(key, "type")) {
+        return take_str(p, end, depth, c, SEEN_CHAT_TYPE, &c->v->chat_type);
+    }
+    return skip_value(p, end, depth);
+}
+
+static const char *from_member(const char *p, const char *end, const UpdStr *key, ScanCtx *c,
+                               int depth)
+{
+    if (key_is(key, "id")) {
+        return take_int(p, end, depth, c, SEEN_FROM_ID, &c->v->has_from_id, &c->v->from_id);
+    }
+    if (key_is(key, "first_name")) {
+        return take_str(p, end, depth, c, SEEN_FIRST_NAME, &c->v->first_name);
+    }
+    return skip_value(p, end, depth);
+}
+
+static const char *message_member(const char *p, const char *end, const UpdStr *key, ScanCtx *c,
+                                  int depth)
+{
+    if (key_is(key, "chat")) {
+        return take_obj(p, end, depth, c, SEEN_CHAT, chat_member);
+    }
+    if (key_is(key, "from")) {
+        return take_obj(p, end, depth, c, SEEN_FROM, from_member);
+    }
+    if (key_is(key, "text")) {
+        return take_str(p, end, depth, c, SEEN_TEXT, &c->v->text);
+    }
+    return skip_value(p, end, depth);
+}
+
+static const char *update_member(const char *p, const char *end, const UpdStr *key, ScanCtx *c,
+                                 int depth)
+{
+    if (key_is(key, "update_id")) {
+        return take_int(p, end, depth, c, SEEN_UPDATE_ID, &c->v->has_update_id, &c->v->update_id);
+    }
+    if (key_is(key, "message")) {
+        return take_obj(p, end, depth, c, SEEN_MESSAGE, message_member);
+    }
+    return skip_value(p, end, depth);
+}
+
+// p at '{' of an update; depth is that of the enclosing container
+static const char *scan_update(const char *p, const char *end, UpdateView *v, int depth)
+{
+    memset(v, 0, sizeof(*v));
+    ScanCtx c = {.v = v};
+    return scan_object(p, end, update_member, &c, depth + 1);
+}
+
+int update_view_parse(const char *json, size_t len, UpdateView *v)
+{
+    if (!json || !v) {
+        return -1;
+    }
+    const char *end = json + len;
+    const char *p = skip_ws(json, end);
+    if (p >= end || *p != '{') {
+        return -1;
+    }
+    if (!scan_update(p, end, v, 0)) {
+        memset(v, 0, sizeof(*v));
+        return -1;
+    }
+    return 0;
+}
+
+static void set_str(UpdStr *s, const cJSON *item)
+{
+    if (cJSON_IsString(item) && item->valuestring) {
+        s->p = item->valuestring;
+        s->len = strlen(item->valuestring);
+        s->escaped = false;
+    }
+}
+
+void update_view_from_cjson(const cJSON *update, UpdateView *v)
+{
+    memset(v, 0, sizeof(*v));
+
+    const cJSON *uid = cJSON_GetObjectItemCaseSensitive(update, "update_id");
+    if (cJSON_IsNumber(uid)) {
+        v->has_update_id = true;
+        v->update_id = (int64_t)uid->valuedouble;
+    }
+
+    const cJSON *msg = cJSON_GetObjectItemCaseSensitive(update, "message");
+    const cJSON *chat = cJSON_GetObjectItemCaseSensitive(msg, "chat");
+    const cJSON *chat_id = cJSON_GetObjectItemCaseSensitive(chat, "id");
+    if (cJSON_IsNumber(chat_id)) {
+        v->has_chat_id = true;
+        v->chat_id = (int64_t)chat_id->valuedouble;
+    }
+    set_str(&v->chat_type, cJSON_GetObjectItemCaseSensitive(chat, "type"));
+
+    const cJSON *from = cJSON_GetObjectItemCaseSensitive(msg, "from");
+    const cJSON *from_id = cJSON_GetObjectItemCaseSensitive(from, "id");
+    if (cJSON_IsNumber(from_id)) {
+        v->has_from_id = true;
+        v->from_id = (int64_t)from_id->valuedouble;
+    }
+    set_str(&v->first_name, cJSON_GetObjectItemCaseSensitive(from, "first_name"));
+    set_str(&v->text, cJSON_GetObjectItemCaseSensitive(msg, "text"));
+}
+
+static const char *body_member(const char *p, const char *end, const UpdStr *key, ScanCtx *c,
+                               int depth)
+{
+    if (key_is(key, "ok") && !(c->seen & SEEN_OK)) {
+        c->seen |= SEEN_OK;
+        const char *q = scan_literal(p, end, "true");
+        if (q) {
+            c->ok = true;
+            return q;
+        }
+        return skip_value(p, end, depth);
+    }
+    if (key_is(key, "result") && !(c->seen & SEEN_RESULT)) {
+        c->seen |= SEEN_RESULT;
+        if (p < end && *p == '[') {
+            c->result = p + 1;
+        }
+    }
+    return skip_value(p, end, depth);
+}
+
+int update_iter_init(UpdateIter *it, const char *body, size_t len)
+{
+    if (!it || !body) {
+        return -1;
+    }
+    const char *end = body + len;
+    const char *p = skip_ws(body, end);
+    if (p >= end || *p != '{') {
+        return -1;
+    }
+
+    // one validating pass over everything, so iteration itself cannot fail
+    ScanCtx c = {0};
+    if (!scan_object(p, end, body_member, &c, 1) || !c.ok || !c.result) {
+        return -1;
+    }
+    it->p = c.result;
+    it->end = end;
+    return 0;
+}
+
+int update_iter_next(UpdateIter *it, UpdateView *v)
+{
+    const char *p = skip_ws(it->p, it->end);
+    if (p >= it->end || *p == ']') {
+        it->p = it->end;
+        return 0;
+    }
+
+    // elements sit one level below the body object validated in init
+    const char *q = (*p == '{') ? scan_update(p, it->end, v, 2) : NULL;
+    if (!q) {
+        memset(v, 0, sizeof(*v));
+        q = skip_value(p, it->end, 2);
+        if (!q) {
+            it->p = it->end;
+            return 0;
+        }
+    }
+
+    q = skip_ws(q, it->end);
+    if (q < it->end && *q == ',') {
+        q++;
+    }
+    it->p = q;
+    return 1;
+}
+
+// append one code point as UTF-8 if it fits before out_cap - 1
+static size_t put_utf8(char *out, size_t o, size_t out_cap, uint32_t cp)
+{
+    char b[4];
+    size_t n;
+    if (cp < 0x80) {
+        b[0] = (char)cp;
+        n = 1;
+    } else if (cp < 0x800) {
+        b[0] = (char)(0xC0 | (cp >> 6));
+        b[1] = (char)(0x80 | (cp & 0x3F));
+        n = 2;
+    } else if (cp < 0x10000) {
+        b[0] = (char)(0xE0 | (cp >> 12));
+        b[1] = (char)(0x80 | ((cp >> 6) & 0x3F));
+        b[2] = (char)(0x80 | (cp & 0x3F));
+        n = 3;
+    } else {
+        b[0] = (char)(0xF0 | (cp >> 18));
+        b[1] = (char)(0x80 | ((cp >> 12) & 0x3F));
+        b[2] = (char)(0x80 | ((cp >> 6) & 0x3F));
+        b[3] = (char)(0x80 | (cp & 0x3F));
+        n = 4;
+    }
+    if (o + n >= out_cap) {
+        return o;
+    }
+    memcpy(out + o, b, n);
+    return o + n;
+}
+
+static uint32_t hex4(const char *p)
+{
+    return (uint32_t)((hex_val(p[0]) << 12) | (hex_val(p[1]) << 8) | (hex_val(p[2]) << 4) |
+                      hex_val(p[3]));
+}
+
+size_t update_str_copy(const UpdStr *s, char *out, size_t out_cap, const char *fallback)
+{
+    if (!out || out_cap == 0) {
+        return 0;
+    }
+    if (!s || !s->p) {
+        const char *f = fallback ? fallback : "";
+        size_t n = strlen(f);
+        if (n >= out_cap) {
+            n = out_cap - 1;
+        }
+        memcpy(out, f, n);
+        out[n] = '\0';
+        return n;
+    }
+
+    if (!s->escaped) {
+        size_t n = s->len < out_cap - 1 ? s->len : out_cap - 1;
+        memcpy(out, s->p, n);
+        out[n] = '\0';
+        return n;
+    }
+
+    // escapes were validated by scan_string, so lookahead is in bounds
+    size_t o = 0;
+    const char *p = s->p;
+    const char *end = s->p + s->len;
+    while (p < end && o + 1 < out_cap) {
+        if (*p != '\\') {
+            out[o++] = *p++;
+            continue;
+        }
+        char e = p[1];
+        p += 2;
+        switch (e) {
+        case 'b': out[o++] = '\b'; break;
+        case 'f': out[o++] = '\f'; break;
+        case 'n': out[o++] = '\n'; break;
+        case 'r': out[o++] = '\r'; break;
+        case 't': out[o++] = '\t'; break;
+        case 'u': {
+            uint32_t cp = hex4(p);
+            p += 4;
+            if (cp >= 0xD800 && cp <= 0xDBFF) {
+                // high surrogate: combine with a following low surrogate
+                if (end - p >= 6 && p[0] == '\\' && p[1] == 'u') {
+                    uint32_t lo = hex4(p + 2);
+                    if (lo >= 0xDC00 && lo <= 0xDFFF) {
+                        cp = 0x10000 + ((cp - 0xD800) << 10) + (lo - 0xDC00);
+                        p += 6;
+                    } else {
+                        cp = 0xFFFD;
+                    }
+                } else {
+                    cp = 0xFFFD;
+                }
+            } else if (cp >= 0xDC00 && cp <= 0xDFFF) {
+                cp = 0xFFFD;
+            }
+            size_t next = put_utf8(out, o, out_cap, cp);
+            if (next == o) {
+                p = end; // no room for the whole sequence
+            }
+            o = next;
+            break;
+        }
+        default: // '"', '\\', '/'
+            out[o++] = e;
+            break;
+        }
+    }
+    out[o] = '\0';
+    return o;
+}
+
+int update_batch_offset(const char *body, size_t len, int64_t *offset)
+{
+    if (!body || !offset) {
+        return -1;
+    }
+    UpdateIter it;
+    if (update_iter_init(&it, body, len) == 0) {
+        UpdateView v;
+        while (update_iter_next(&it, &v) > 0) {
+            if (v.has_update_id && v.update_id >= *offset) {
+                *offset = v.update_id + 1;
+            }
+        }
+        return 0;
+    }
+
+    cJSON *root = cJSON_ParseWithLength(body, len);
+    if (!cJSON_IsTrue(cJSON_GetObjectItemCaseSensitive(root, "ok"))) {
+        cJSON_Delete(root);
+        return -1;
+    }
+    const cJSON *upd = NULL;
+    cJSON_ArrayForEach(upd, cJSON_GetObjectItemCaseSensitive(root, "result"))
+    {
+        const cJSON *id = cJSON_GetObjectItemCaseSensitive(upd, "update_id");
+        if (cJSON_IsNumber(id) && (int64_t)id->valuedouble >= *offset) {
+            *offset = (int64_t)id->valuedouble + 1;
+        }
+    }
+    cJSON_Delete(root);
+    return 0;
+}
@@ -0,0 +1,76 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// forward-declare opaque cJSON so callers don't need the header
+typedef struct cJSON cJSON;
+
+/* selective, allocation-free view of a Telegram update
+ * only the fields handle_update() needs are located; everything else
+ * (entities, photos, reply_to_message, ...) is skipped over without being
+ * materialised. strings are slices of the original buffer and stay
+ * JSON-escaped until update_str_copy() decodes them, so a view is only valid
+ * while the buffer it was scanned from is.
+ */
+
+// largest decoded message text handled (4096 UTF-16 units can need 3 bytes each)
+#define UPDATE_TEXT_MAX (4096 * 3 + 1)
+
+typedef struct {
+    const char *p; // NULL if the field is absent or not a string
+    size_t len;    // raw length between the quotes
+    bool escaped;  // contains backslash escapes
+} UpdStr;
+
+typedef struct {
+    bool has_update_id;
+    bool has_chat_id;
+    bool has_from_id;
+    int64_t update_id;
+    int64_t chat_id;
+    int64_t from_id;
+    UpdStr chat_type;
+    UpdStr first_name;
+    UpdStr text;
+} UpdateView;
+
+/* scan a single update object
+ * returns 0 on success, -1 if the input is malformed or uses something the
+ * scanner leaves to cJSON (escaped keys, very deep nesting); callers then
+ * fall back to cJSON_Parse + update_view_from_cjson()
+ */
+int update_view_parse(const char *json, size_t len, UpdateView *v);
+
+// fill a view from an already parsed update; strings point into the tree
+void update_view_from_cjson(const cJSON *update, UpdateView *v);
+
+// iterator over the result array of a getUpdates response
+typedef struct {
+    const char *p;
+    const char *end;
+} UpdateIter;
+
+/* validate a whole {"ok":true,"result":[...]} body and position the iterator
+ * on the first element. returns 0, or -1 if the body is not ok, malformed,
+ * or needs the cJSON fallback; nothing is consumed in that case
+ */
+int update_iter_init(UpdateIter *it, const char *body, size_t len);
+
+/* fill v with the next update; elements that are not objects produce a view
+ * without an update_id. returns 1 when v was filled, 0 at the end
+ */
+int update_iter_next(UpdateIter *it, UpdateView *v);
+
+/* decode a string slice into out (always NUL-terminated when out_cap > 0)
+ * an absent string decodes to fallback (may be NULL for "")
+ * returns the decoded length
+ */
+size_t update_str_copy(const UpdStr *s, char *out, size_t out_cap, const char *fallback);
+
+/* advance *offset past the highest update_id in a getUpdates body, without
+ * dispatching anything (the selective scanner, with the cJSON fallback)
+ * returns 0, or -1 if the body is not an ok response
+ */
+int update_batch_offset(const char *body, size_t len, int64_t *offset);
@@ -0,0 +1,201 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "warmup.h"
+#include "config.h"
+#include "llm.h"
+#include "llmpool.h"
+#include "logger.h"
+#include "metrics.h"
+
+#include <pthread.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+typedef struct {
+    char base[LLM_POOL_BASE_MAX];
+    pthread_t thread;
+} WarmEndpoint;
+
+static struct {
+    pthread_mutex_t lock;
+    pthread_cond_t wake;
+    WarmEndpoint ep[LLM_POOL_MAX];
+    int n;
+    bool started;
+    volatile sig_atomic_t running; // abort flag of every warm-up handle
+    char model[128];
+    char system_prompt[512];
+    bool warm;
+    int keepalive_sec;
+    int warmed;
+    int done;
+    unsigned long keepalives;
+} g_warm = {.lock = PTHREAD_MUTEX_INITIALIZER};
+
+static double monotonic_sec(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+// LLM requests the workers have finished, successful or not
+static unsigned long long llm_activity(void)
+{
+    return metrics_count(MET_LLM) + metrics_counter(MET_LLM_ERRORS);
+}
+
+// sleep sec seconds, or less if warmup_stop is called; returns false once stopping
+static bool nap(double sec)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    time_t whole = (time_t)sec;
+    long nsec = ts.tv_nsec + (long)((sec - (double)whole) * 1e9);
+    ts.tv_sec += whole + nsec / 1000000000L;
+    ts.tv_nsec = nsec % 1000000000L;
+    pthread_mutex_lock(&g_warm.lock);
+    if (g_warm.running) {
+        pthread_cond_timedwait(&g_warm.wake, &g_warm.lock, &ts);
+    }
+    bool running = g_warm.running != 0;
+    pthread_mutex_unlock(&g_warm.lock);
+    return running;
+}
+
+static void *warm_main(void *arg)
+{
+    const WarmEndpoint *ep = (const WarmEndpoint *)arg;
+    LlmHandle *llm = llm_init(ep->base, g_warm.model);
+    if (!llm) {
+        log_warn("warmup: %s: cannot create LLM handle", ep->base);
+        pthread_mutex_lock(&g_warm.lock);
+        g_warm.done++;
+        pthread_mutex_unlock(&g_warm.lock);
+        return NULL;
+    }
+    llm_set_direct(llm, 1);
+    llm_set_abort_flag(llm, &g_warm.running);
+
+    if (g_warm.warm) {
+        double t0 = monotonic_sec();
+        int rc = llm_warm(llm, g_warm.system_prompt);
+        double took = monotonic_sec() - t0;
+        pthread_mutex_lock(&g_warm.lock);
+        g_warm.done++;
+        g_warm.warmed += rc == 0;
+        bool running = g_warm.running != 0;
+        pthread_mutex_unlock(&g_warm.lock);
+        if (rc == 0) {
+            log_info("warmup: %s ready in %.1fs", ep->base, took);
+        } else if (running) {
+            log_warn("warmup: %s did not answer (%.1fs) - first reply may be slow", ep->base,
+                     took);
+        }
+    }
+
+    // any finished request counts as traffic, whichever endpoint served it
+    unsigned long long seen = llm_activity();
+    double last_active = monotonic_sec();
+    while (g_warm.keepalive_sec > 0 && nap(WARMUP_TICK_SEC)) {
+        double now = monotonic_sec();
+        unsigned long long activity = llm_activity();
+        if (activity != seen) {
+            seen = activity;
+            last_active = now;
+        } else if (now - last_active >= (double)g_warm.keepalive_sec) {
+            if (llm_warm(llm, g_warm.system_prompt) != 0 && g_warm.running) {
+                log_warn("warmup: keep-alive to %s failed", ep->base);
+            }
+            pthread_mutex_lock(&g_warm.lock);
+            g_warm.keepalives++;
+            pthread_mutex_unlock(&g_warm.lock);
+            last_active = monotonic_sec();
+        }
+    }
+    llm_cleanup(llm);
+    return NULL;
+}
+
+int warmup_start(const char *endpoints, const char *model, const char *system_prompt, bool warm,
+                 int keepalive_sec)
+{
+    if (!endpoints || keepalive_sec < 0 || g_warm.started) {
+        return -1;
+    }
+
+    // the same list llm_pool_init was given
+    char bases[LLM_POOL_MAX][LLM_POOL_BASE_MAX];
+    int n = llm_pool_parse(endpoints, bases, LLM_POOL_MAX);
+    if (n < 0) {
+        log_error("warmup: too many endpoints or endpoint too long");
+    }
+    if (n <= 0) {
+        return -1;
+    }
+    for (int i = 0; i < n; i++) {
+        memcpy(g_warm.ep[i].base, bases[i], sizeof(g_warm.ep[i].base));
+    }
+
+    snprintf(g_warm.model, sizeof(g_warm.model), "%s", model ? model : "");
+    snprintf(g_warm.system_prompt, sizeof(g_warm.system_prompt), "%s",
+             system_prompt ? system_prompt : "");
+    g_warm.warm = warm;
+    g_warm.keepalive_sec = keepalive_sec;
+    g_warm.warmed = g_warm.done = 0;
+    g_warm.keepalives = 0;
+    g_warm.running = 1;
+
+    pthread_condattr_t ca;
+    pthread_condattr_init(&ca);
+    pthread_condattr_setclock(&ca, CLOCK_MONOTONIC);
+    pthread_cond_init(&g_warm.wake, &ca);
+    pthread_condattr_destroy(&ca);
+
+    // started before main blocks SIGINT/SIGTERM for its threads; keep them
+    // off these so the main thread's pause() is the one that wakes
+    sigset_t all, old;
+    sigfillset(&all);
+    pthread_sigmask(SIG_BLOCK, &all, &old);
+    g_warm.n = 0;
+    for (int i = 0; i < n; i++) {
+        if (pthread_create(&g_warm.ep[i].thread, NULL, warm_main, &g_warm.ep[i]) != 0) {
+            log_warn("warmup: cannot start thread for %s", g_warm.ep[i].base);
+            break;
+        }
+        g_warm.n++;
+    }
+    pthread_sigmask(SIG_SETMASK, &old, NULL);
+    g_warm.started = true;
+    return g_warm.n;
+}
+
+void warmup_stats(WarmupStats *out)
+{
+    pthread_mutex_lock(&g_warm.lock);
+    out->endpoints = g_warm.n;
+    out->warmed = g_warm.warmed;
+    out->done = g_warm.done;
+    out->keepalives = g_warm.keepalives;
+    pthread_mutex_unlock(&g_warm.lock);
+}
+
+void warmup_stop(void)
+{
+    if (!g_warm.started) {
+        return;
+    }
+    pthread_mutex_lock(&g_warm.lock);
+    g_warm.running = 0;
+    pthread_cond_broadcast(&g_warm.wake);
+    pthread_mutex_unlock(&g_warm.lock);
+    for (int i = 0; i < g_warm.n; i++) {
+        pthread_join(g_warm.ep[i].thread, NULL);
+    }
+    pthread_cond_destroy(&g_warm.wake);
+    g_warm.n = 0;
+    g_warm.started = false;
+}
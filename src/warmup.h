@@ -0,0 +1,31 @@
+#pragma once
+
+#include <stdbool.h>
+
+/* LLM warm-up and keep-alive ([llm] warmup, keepalive_sec)
+ * one thread per endpoint of the [llm] endpoint list sends llm_warm as
+ * soon as it starts, so the model loads while getMe and the whitelist do
+ * instead of during the first user's request. with keepalive_sec > 0 the
+ * thread then repeats it whenever no LLM request has finished for that
+ * long, for servers that unload an idle model.
+ */
+
+/* endpoints: the comma-separated [llm] endpoint list; model may be empty
+ * warm: send the first request now (otherwise only keep-alives are sent)
+ * keepalive_sec: 0 = no keep-alive; the threads exit after warming up
+ * returns the number of endpoints handled, or -1 on error
+ */
+int warmup_start(const char *endpoints, const char *model, const char *system_prompt, bool warm,
+                 int keepalive_sec);
+
+typedef struct {
+    int endpoints; // threads started
+    int warmed;    // endpoints whose first warm-up request succeeded
+    int done;      // endpoints whose first warm-up request finished
+    unsigned long keepalives; // keep-alive requests sent
+} WarmupStats;
+
+void warmup_stats(WarmupStats *out);
+
+// abort any request in flight and join the threads
+void warmup_stop(void);
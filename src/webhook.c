@@ -3,17 +3,26 @@
 #include "webhook.h"
 #include "cJSON.h"
 #include "config.h"
+#include "ingress.h"
 #include "logger.h"
+#include "metrics.h"
 
+#include <arpa/inet.h>
 #include <inttypes.h>
 #include <microhttpd.h>
+#include <netinet/in.h>
 #include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <strings.h>
+#include <time.h>
 
 #define PB_POOL_MAX 64
+#define PB_INLINE_BYTES 4096 // covers nearly every Telegram update
+#define DISPATCHERS_MAX 8
 
 // constant-time string comparison to prevent timing side-channel on secret
 static int ct_strcmp(const char *a, const char *b)
@@ -30,19 +39,47 @@ static int ct_strcmp(const char *a, const char *b)
     return result != 0;
 }
 
-typedef struct {
-    char *data;
+static double monotonic_sec(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+/* a request body; most updates fit the inline buffer, so only a larger
+ * body reaches the heap, sized once from its Content-Length
+ */
+typedef struct PostBody {
+    struct PostBody *next; // cache free-list link
+    struct PbCache *home;  // cache it returns to; NULL for a one-off body
+    char *data;            // inline_buf, or a heap buffer for a larger body
     size_t len;
     size_t cap;
+    double t0; // request arrival, for the ack latency
+    char inline_buf[PB_INLINE_BYTES];
 } PostBody;
 
+/* one body cache per MHD thread, so a request takes no lock. bodies are
+ * released on the dispatcher threads, which push them onto their cache's
+ * returned stack; only the owning thread pops, and it takes the whole stack
+ * at once, so the push needs no ABA protection
+ */
+typedef struct PbCache {
+    PostBody *free;               // owner thread only
+    _Atomic(PostBody *) returned; // pushed by any thread
+    int created;                  // bodies belonging to this cache
+    struct PbCache *next;         // every cache, for teardown
+} PbCache;
+
+static _Thread_local PbCache *t_pb_cache;
+static _Thread_local unsigned t_pb_generation;
+
 static struct {
-    PostBody pool[PB_POOL_MAX];
-    int free_stack[PB_POOL_MAX]; // indices of free slots
-    int free_top;                // stack pointer
-    int pool_size;               // configured pool size (<= PB_POOL_MAX)
-    pthread_mutex_t mtx;
-} g_pb_pool;
+    pthread_mutex_t lock; // the cache list only
+    PbCache *caches;
+    int per_thread; // bodies a cache keeps; beyond that they are one-off
+    atomic_uint generation; // bumped per teardown, retiring stale thread caches
+} g_pb = {.lock = PTHREAD_MUTEX_INITIALIZER};
 
 static void pb_pool_init(int pool_size)
 {
@@ -52,30 +89,56 @@ static void pb_pool_init(int pool_size)
     if (pool_size > PB_POOL_MAX) {
         pool_size = PB_POOL_MAX;
     }
-    pthread_mutex_init(&g_pb_pool.mtx, NULL);
-    g_pb_pool.pool_size = pool_size;
-    g_pb_pool.free_top = pool_size;
-    for (int i = 0; i < pool_size; i++) {
-        g_pb_pool.free_stack[i] = i;
-        g_pb_pool.pool[i].data = NULL;
-        g_pb_pool.pool[i].len = 0;
-        g_pb_pool.pool[i].cap = 0;
+    g_pb.per_thread = pool_size;
+}
+
+// this thread's cache, created on its first request
+static PbCache *pb_cache(void)
+{
+    unsigned gen = atomic_load(&g_pb.generation);
+    if (t_pb_cache && t_pb_generation == gen) {
+        return t_pb_cache;
+    }
+    PbCache *c = calloc(1, sizeof(*c));
+    if (!c) {
+        return NULL;
     }
+    pthread_mutex_lock(&g_pb.lock);
+    c->next = g_pb.caches;
+    g_pb.caches = c;
+    pthread_mutex_unlock(&g_pb.lock);
+    t_pb_cache = c;
+    t_pb_generation = gen;
+    return c;
 }
 
 static PostBody *pb_acquire(void)
 {
+    PbCache *c = pb_cache();
     PostBody *pb = NULL;
-    pthread_mutex_lock(&g_pb_pool.mtx);
-    if (g_pb_pool.free_top > 0) {
-        int idx = g_pb_pool.free_stack[--g_pb_pool.free_top];
-        pb = &g_pb_pool.pool[idx];
-        pb->len = 0; // reset for reuse (keep existing cap/data buffer)
+    if (c) {
+        if (!c->free) {
+            c->free = atomic_exchange_explicit(&c->returned, NULL, memory_order_acquire);
+        }
+        pb = c->free;
+        if (pb) {
+            c->free = pb->next;
+        } else if (c->created < g_pb.per_thread && (pb = malloc(sizeof(*pb))) != NULL) {
+            pb->home = c;
+            c->created++;
+        }
     }
-    pthread_mutex_unlock(&g_pb_pool.mtx);
     if (!pb) {
-        pb = calloc(1, sizeof(*pb)); // fallback: heap alloc
+        pb = malloc(sizeof(*pb)); // cache exhausted: freed again on release
+        if (!pb) {
+            return NULL;
+        }
+        pb->home = NULL;
     }
+    pb->next = NULL;
+    pb->data = pb->inline_buf;
+    pb->cap = sizeof(pb->inline_buf);
+    pb->len = 0;
     return pb;
 }
 
@@ -83,26 +146,76 @@ static void pb_release(PostBody *pb)
 {
     if (!pb)
         return;
-    if (pb >= g_pb_pool.pool && pb < g_pb_pool.pool + g_pb_pool.pool_size) {
-        pb->len = 0;
-        pthread_mutex_lock(&g_pb_pool.mtx);
-        int idx = (int)(pb - g_pb_pool.pool);
-        g_pb_pool.free_stack[g_pb_pool.free_top++] = idx;
-        pthread_mutex_unlock(&g_pb_pool.mtx);
-    } else {
+    if (pb->data != pb->inline_buf) {
         free(pb->data);
+        pb->data = pb->inline_buf;
+    }
+    PbCache *c = pb->home;
+    if (!c) {
         free(pb);
+    } else if (c == t_pb_cache) {
+        pb->next = c->free;
+        c->free = pb;
+    } else {
+        PostBody *head = atomic_load_explicit(&c->returned, memory_order_relaxed);
+        do {
+            pb->next = head;
+        } while (!atomic_compare_exchange_weak_explicit(&c->returned, &head, pb,
+                                                        memory_order_release,
+                                                        memory_order_relaxed));
     }
 }
 
+/* grow pb to hold need bytes. leaving the inline buffer, take the whole
+ * declared body at once; a body without a usable length doubles
+ */
+static int pb_reserve(PostBody *pb, struct MHD_Connection *conn, size_t need)
+{
+    bool inline_data = pb->data == pb->inline_buf;
+    size_t cap = pb->cap * 2;
+    if (inline_data) {
+        const char *cl = MHD_lookup_connection_value(conn, MHD_HEADER_KIND, "Content-Length");
+        unsigned long long declared = cl ? strtoull(cl, NULL, 10) : 0;
+        if (declared < RESPONSE_BUF_MAX && declared + 1 > cap) {
+            cap = (size_t)declared + 1;
+        }
+    }
+    while (cap < need) {
+        cap *= 2;
+    }
+    char *buf = inline_data ? malloc(cap) : realloc(pb->data, cap);
+    if (!buf) {
+        return -1;
+    }
+    if (inline_data) {
+        memcpy(buf, pb->inline_buf, pb->len);
+    }
+    pb->data = buf;
+    pb->cap = cap;
+    return 0;
+}
+
+// free every cached body; call once no request or dispatcher holds one
 static void pb_pool_destroy(void)
 {
-    for (int i = 0; i < g_pb_pool.pool_size; i++) {
-        free(g_pb_pool.pool[i].data);
-        g_pb_pool.pool[i].data = NULL;
-        g_pb_pool.pool[i].cap = 0;
+    pthread_mutex_lock(&g_pb.lock);
+    PbCache *c = g_pb.caches;
+    g_pb.caches = NULL;
+    atomic_fetch_add(&g_pb.generation, 1);
+    pthread_mutex_unlock(&g_pb.lock);
+    while (c) {
+        PostBody *lists[2] = {c->free, atomic_load(&c->returned)};
+        for (int i = 0; i < 2; i++) {
+            while (lists[i]) {
+                PostBody *next = lists[i]->next;
+                free(lists[i]);
+                lists[i] = next;
+            }
+        }
+        PbCache *next = c->next;
+        free(c);
+        c = next;
     }
-    pthread_mutex_destroy(&g_pb_pool.mtx);
 }
 
 static struct {
@@ -110,8 +223,64 @@ static struct {
     char secret[256];
     webhook_update_cb update_cb;
     void *update_ctx;
+    Ingress ring; // accepted bodies waiting for a dispatcher
+    pthread_t dispatchers[DISPATCHERS_MAX];
+    int ndispatchers;
+    bool metrics; // serve GET /metrics beside POST /webhook
 } g_webhook;
 
+// standalone /metrics server for poll mode
+static struct MHD_Daemon *g_metrics_daemon;
+
+// render the current metrics into a response the daemon frees once sent
+static struct MHD_Response *metrics_response(void)
+{
+    char *text = malloc(METRICS_TEXT_MAX);
+    if (!text) {
+        return NULL;
+    }
+    size_t len = metrics_render(text, METRICS_TEXT_MAX);
+    struct MHD_Response *resp = MHD_create_response_from_buffer(len, text, MHD_RESPMEM_MUST_FREE);
+    if (!resp) {
+        free(text);
+        return NULL;
+    }
+    MHD_add_response_header(resp, MHD_HTTP_HEADER_CONTENT_TYPE,
+                            "text/plain; version=0.0.4; charset=utf-8");
+    return resp;
+}
+
+// parse one accepted body and hand it to the update callback
+static void dispatch_body(PostBody *pb)
+{
+    // scan only the fields we need; anything unusual takes the full parse
+    if (pb->data && pb->len > 0 && g_webhook.update_cb) {
+        UpdateView view;
+        if (update_view_parse(pb->data, pb->len, &view) == 0) {
+            g_webhook.update_cb(g_webhook.update_ctx, &view);
+        } else {
+            cJSON *root = cJSON_ParseWithLength(pb->data, pb->len);
+            if (root) {
+                update_view_from_cjson(root, &view);
+                g_webhook.update_cb(g_webhook.update_ctx, &view);
+                cJSON_Delete(root);
+            }
+        }
+    }
+    pb_release(pb);
+}
+
+// drains the ingress ring off the MHD threads until webhook_stop() closes it
+static void *dispatcher_main(void *arg)
+{
+    (void)arg;
+    PostBody *pb;
+    while ((pb = ingress_pop(&g_webhook.ring)) != NULL) {
+        dispatch_body(pb);
+    }
+    return NULL;
+}
+
 static enum MHD_Result on_request(void *cls, struct MHD_Connection *conn, const char *url,
                                   const char *method, const char *version, const char *upload_data,
                                   size_t *upload_data_size, void **req_cls)
@@ -124,6 +293,7 @@ static enum MHD_Result on_request(void *cls, struct MHD_Connection *conn, const
         if (!pb) {
             return MHD_NO;
         }
+        pb->t0 = monotonic_sec();
         *req_cls = pb;
         return MHD_YES; // continue to receive data
     }
@@ -138,18 +308,9 @@ static enum MHD_Result on_request(void *cls, struct MHD_Connection *conn, const
             *upload_data_size = 0;
             return MHD_YES;
         }
-        if (need > pb->cap) {
-            size_t new_cap = pb->cap == 0 ? 4096 : pb->cap * 2;
-            while (new_cap < need) {
-                new_cap *= 2;
-            }
-            char *tmp = realloc(pb->data, new_cap);
-            if (!tmp) {
-                *upload_data_size = 0;
-                return MHD_YES;
-            }
-            pb->data = tmp;
-            pb->cap = new_cap;
+        if (need > pb->cap && pb_reserve(pb, conn, need) != 0) {
+            *upload_data_size = 0;
+            return MHD_YES;
         }
         memcpy(pb->data + pb->len, upload_data, *upload_data_size);
         pb->len += *upload_data_size;
@@ -161,6 +322,12 @@ static enum MHD_Result on_request(void *cls, struct MHD_Connection *conn, const
     struct MHD_Response *resp = NULL;
     unsigned int status = MHD_HTTP_OK;
 
+    if (g_webhook.metrics && strcmp(method, "GET") == 0 && strcmp(url, "/metrics") == 0) {
+        resp = metrics_response();
+        status = resp ? MHD_HTTP_OK : MHD_HTTP_SERVICE_UNAVAILABLE;
+        goto send;
+    }
+
     // only accept POST /webhook
     if (strcmp(method, "POST") != 0 || strcmp(url, "/webhook") != 0) {
         status = MHD_HTTP_NOT_FOUND;
@@ -199,17 +366,20 @@ static enum MHD_Result on_request(void *cls, struct MHD_Connection *conn, const
         goto send;
     }
 
-    // parse JSON body
-    if (pb->data && pb->len > 0) {
-        cJSON *root = cJSON_Parse(pb->data);
-        if (root && g_webhook.update_cb) {
-            g_webhook.update_cb(g_webhook.update_ctx, root);
-        } else {
-            cJSON_Delete(root);
-        }
+    // ack straight away; parsing and routing happen on a dispatcher thread,
+    // which now owns pb. a full ring asks Telegram to retry later
+    double t0 = pb->t0;
+    if (ingress_push(&g_webhook.ring, pb) != 0) {
+        log_warn("webhook: ingress ring full - asking for redelivery");
+        metrics_add(MET_WEBHOOK_BUSY, 1);
+        status = MHD_HTTP_SERVICE_UNAVAILABLE;
+        resp = MHD_create_response_from_buffer(4, (void *)"busy", MHD_RESPMEM_PERSISTENT);
+        goto send;
     }
+    pb = NULL;
 
     resp = MHD_create_response_from_buffer(2, (void *)"ok", MHD_RESPMEM_PERSISTENT);
+    metrics_observe(MET_WEBHOOK_ACK, monotonic_sec() - t0);
 
 send:
     if (!resp) {
@@ -230,6 +400,17 @@ void webhook_set_update_cb(webhook_update_cb cb)
     g_webhook.update_cb = cb;
 }
 
+// close the ring, let the dispatchers drain what was already acked, join them
+static void stop_dispatchers(void)
+{
+    ingress_close(&g_webhook.ring);
+    for (int i = 0; i < g_webhook.ndispatchers; i++) {
+        pthread_join(g_webhook.dispatchers[i], NULL);
+    }
+    g_webhook.ndispatchers = 0;
+    ingress_destroy(&g_webhook.ring);
+}
+
 int webhook_start(const Config *cfg, void *update_ctx)
 {
     if (g_webhook.daemon) {
@@ -239,8 +420,36 @@ int webhook_start(const Config *cfg, void *update_ctx)
 
     pb_pool_init(cfg->webhook_pool_size);
 
+    int slots = cfg->webhook_ingress_slots > 0 ? cfg->webhook_ingress_slots
+                                               : CFG_DEFAULT_WEBHOOK_INGRESS_SLOTS;
+    if (ingress_init(&g_webhook.ring, (size_t)slots) != 0) {
+        log_error("webhook: failed to allocate ingress ring");
+        pb_pool_destroy();
+        return -1;
+    }
+
+    int ndisp = cfg->webhook_dispatchers > 0 ? cfg->webhook_dispatchers
+                                             : CFG_DEFAULT_WEBHOOK_DISPATCHERS;
+    if (ndisp > DISPATCHERS_MAX) {
+        ndisp = DISPATCHERS_MAX;
+    }
+    g_webhook.ndispatchers = 0;
+    for (int i = 0; i < ndisp; i++) {
+        if (pthread_create(&g_webhook.dispatchers[i], NULL, dispatcher_main, NULL) != 0) {
+            log_error("webhook: failed to start dispatcher %d", i);
+            break;
+        }
+        g_webhook.ndispatchers++;
+    }
+    if (g_webhook.ndispatchers == 0) {
+        ingress_destroy(&g_webhook.ring);
+        pb_pool_destroy();
+        return -1;
+    }
+
     snprintf(g_webhook.secret, sizeof(g_webhook.secret), "%s", cfg->webhook_secret);
     g_webhook.update_ctx = update_ctx;
+    g_webhook.metrics = cfg->metrics_enabled;
 
     g_webhook.daemon = MHD_start_daemon(MHD_USE_EPOLL_INTERNALLY | MHD_USE_ERROR_LOG,
                                         (uint16_t)cfg->webhook_port, NULL, NULL, // accept policy
@@ -248,14 +457,20 @@ int webhook_start(const Config *cfg, void *update_ctx)
                                         MHD_OPTION_THREAD_POOL_SIZE,
                                         (unsigned int)cfg->webhook_threads,
                                         MHD_OPTION_CONNECTION_MEMORY_LIMIT,
-                                        (size_t)RESPONSE_BUF_MAX, MHD_OPTION_END);
+                                        (size_t)RESPONSE_BUF_MAX,
+                                        // [cluster] copies all listen on the port
+                                        MHD_OPTION_LISTENING_ADDRESS_REUSE,
+                                        (unsigned int)(cfg->cluster_procs > 1), MHD_OPTION_END);
 
     if (!g_webhook.daemon) {
         log_error("webhook: failed to start MHD_Daemon on port %d", cfg->webhook_port);
+        stop_dispatchers();
+        pb_pool_destroy();
         return -1;
     }
 
-    log_info("webhook: listening on 0.0.0.0:%d", cfg->webhook_port);
+    log_info("webhook: listening on 0.0.0.0:%d (ingress=%d dispatchers=%d)", cfg->webhook_port,
+             slots, g_webhook.ndispatchers);
     return 0;
 }
 
@@ -264,6 +479,8 @@ void webhook_stop(void)
     if (g_webhook.daemon) {
         MHD_stop_daemon(g_webhook.daemon);
         g_webhook.daemon = NULL;
+        // no producers are left, so everything acked gets dispatched
+        stop_dispatchers();
         pb_pool_destroy();
         log_info("webhook: stopped");
     }
@@ -273,3 +490,69 @@ bool webhook_running(void)
 {
     return g_webhook.daemon != NULL;
 }
+
+static enum MHD_Result on_metrics_request(void *cls, struct MHD_Connection *conn,
+                                          const char *url, const char *method,
+                                          const char *version, const char *upload_data,
+                                          size_t *upload_data_size, void **req_cls)
+{
+    static int marker;
+    (void)cls;
+    (void)version;
+    (void)upload_data;
+
+    if (*req_cls == NULL) {
+        *req_cls = &marker;
+        return MHD_YES;
+    }
+    if (*upload_data_size > 0) {
+        *upload_data_size = 0; // nothing here takes a body
+        return MHD_YES;
+    }
+    *req_cls = NULL;
+
+    struct MHD_Response *resp = NULL;
+    unsigned int status = MHD_HTTP_OK;
+    if (strcmp(method, "GET") != 0 || strcmp(url, "/metrics") != 0) {
+        status = MHD_HTTP_NOT_FOUND;
+        resp = MHD_create_response_from_buffer(9, (void *)"not found", MHD_RESPMEM_PERSISTENT);
+    } else if (!(resp = metrics_response())) {
+        status = MHD_HTTP_SERVICE_UNAVAILABLE;
+        resp = MHD_create_response_from_buffer(0, (void *)"", MHD_RESPMEM_PERSISTENT);
+    }
+    enum MHD_Result ret = MHD_queue_response(conn, status, resp);
+    MHD_destroy_response(resp);
+    return ret;
+}
+
+int webhook_metrics_start(int port)
+{
+    if (g_metrics_daemon) {
+        return -1;
+    }
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons((uint16_t)port);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+    // one polling thread is plenty for a scraper every few seconds
+    g_metrics_daemon = MHD_start_daemon(MHD_USE_INTERNAL_POLLING_THREAD | MHD_USE_ERROR_LOG,
+                                        (uint16_t)port, NULL, NULL, on_metrics_request, NULL,
+                                        MHD_OPTION_SOCK_ADDR, (struct sockaddr *)&addr,
+                                        MHD_OPTION_END);
+    if (!g_metrics_daemon) {
+        log_error("webhook: failed to start metrics server on 127.0.0.1:%d", port);
+        return -1;
+    }
+    log_info("webhook: serving /metrics on 127.0.0.1:%d", port);
+    return 0;
+}
+
+void webhook_metrics_stop(void)
+{
+    if (g_metrics_daemon) {
+        MHD_stop_daemon(g_metrics_daemon);
+        g_metrics_daemon = NULL;
+    }
+}
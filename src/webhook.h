@@ -1,28 +1,39 @@
 #pragma once
 
 #include "cfg.h"
+#include "update.h"
 
 #include <stdbool.h>
 
-// forward-declare opaque cJSON so callers don't need the header
-typedef struct cJSON cJSON;
-
 /* start the webhook HTTP server. blocks the calling thread's setup; the
- * actual request handling runs on internal libmicrohttpd threads
+ * actual request handling runs on internal libmicrohttpd threads, which only
+ * validate and enqueue each body before acking. dispatcher threads drain the
+ * ingress ring and run the update callback
  * returns 0 on success
  */
 int webhook_start(const Config *cfg, void *update_ctx);
 
-// stop the webhook server and free resources
+// stop the webhook server, dispatch every already-acked update, free resources
 void webhook_stop(void);
 
 // returns true if the webhook server is currently running
 bool webhook_running(void);
 
-/* callback type for processing a parsed update JSON object
+/* callback type for processing one update; runs on a dispatcher thread
+ * the view (and the strings it points at) is only valid during the call.
  * update_ctx is the opaque pointer passed to webhook_start()
  */
-typedef void (*webhook_update_cb)(void *ctx, cJSON *update);
+typedef void (*webhook_update_cb)(void *ctx, const UpdateView *update);
 
 // set the callback that the webhook handler calls for each update
 void webhook_set_update_cb(webhook_update_cb cb);
+
+/* serve GET /metrics alone on 127.0.0.1:port, for poll mode where no webhook
+ * daemon runs (with the webhook enabled, cfg->metrics_enabled adds the route
+ * to it instead)
+ * returns 0 on success, -1 on error
+ */
+int webhook_metrics_start(int port);
+
+// stop the standalone metrics server (no-op when not running)
+void webhook_metrics_stop(void);
@@ -5,10 +5,13 @@
 
 #include <errno.h>
 #include <inttypes.h>
+#include <sched.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/file.h>
 #include <sys/stat.h>
+#include <unistd.h>
 
 static int cmp_i64(const void *a, const void *b)
 {
@@ -17,14 +20,14 @@ static int cmp_i64(const void *a, const void *b)
     return (va > vb) - (va < vb);
 }
 
-static int bsearch_idx(const Whitelist *wl, int64_t user_id, bool *found)
+static int bsearch_idx(const WhitelistSnap *s, int64_t user_id, bool *found)
 {
-    int lo = 0, hi = wl->count;
+    int lo = 0, hi = s->count;
     while (lo < hi) {
         int mid = lo + (hi - lo) / 2;
-        if (wl->ids[mid] < user_id) {
+        if (s->ids[mid] < user_id) {
             lo = mid + 1;
-        } else if (wl->ids[mid] > user_id) {
+        } else if (s->ids[mid] > user_id) {
             hi = mid;
         } else {
             *found = true;
@@ -35,59 +38,287 @@ static int bsearch_idx(const Whitelist *wl, int64_t user_id, bool *found)
     return lo;
 }
 
-static int read_ids(Whitelist *wl)
+// stands in for the snapshot of a whitelist that was never loaded
+static const WhitelistSnap k_empty;
+
+static WhitelistSnap *snap_alloc(int count)
+{
+    WhitelistSnap *s = malloc(sizeof(*s) + (size_t)count * sizeof(s->ids[0]));
+    if (s) {
+        s->count = count;
+    }
+    return s;
+}
+
+// reader side: pin the current snapshot; pair with snap_release
+static const WhitelistSnap *snap_acquire(const Whitelist *wl, unsigned *idx)
+{
+    Whitelist *w = (Whitelist *)wl;
+    *idx = atomic_load(&w->epoch) & 1;
+    atomic_fetch_add(&w->readers[*idx], 1);
+    return atomic_load(&w->snap);
+}
+
+static void snap_release(const Whitelist *wl, unsigned idx)
+{
+    atomic_fetch_sub(&((Whitelist *)wl)->readers[idx], 1);
+}
+
+/* writer side: publish next and free the previous snapshot once every
+ * reader that could have loaded it has left. a reader may read the epoch,
+ * stall, and only then pin the parity it read, so one flip is not enough:
+ * flip and drain each parity in turn. by the time both have been seen at
+ * zero after the store, any reader still pinned incremented after it and
+ * can only have loaded next; the flips keep new readers off the parity
+ * being drained (caller holds wl->lock)
+ */
+static void snap_publish(Whitelist *wl, WhitelistSnap *next)
+{
+    WhitelistSnap *prev = atomic_exchange(&wl->snap, next);
+    for (int phase = 0; phase < 2; phase++) {
+        unsigned old = atomic_fetch_add(&wl->epoch, 1) & 1;
+        while (atomic_load(&wl->readers[old]) != 0) {
+            sched_yield();
+        }
+    }
+    free(prev);
+}
+
+// build a sorted, duplicate-free snapshot from ids (takes no ownership)
+static WhitelistSnap *snap_from(int64_t *ids, int n)
+{
+    if (n > 1) {
+        qsort(ids, (size_t)n, sizeof(ids[0]), cmp_i64);
+    }
+    int u = 0;
+    for (int i = 0; i < n; i++) {
+        if (u == 0 || ids[u - 1] != ids[i]) {
+            ids[u++] = ids[i];
+        }
+    }
+    WhitelistSnap *s = snap_alloc(u);
+    if (s && u > 0) {
+        memcpy(s->ids, ids, (size_t)u * sizeof(ids[0]));
+    }
+    return s;
+}
+
+static void journal_path(const Whitelist *wl, char *out, size_t cap)
+{
+    snprintf(out, cap, "%s.journal", wl->path);
+}
+
+// apply one "+id" / "-id" journal entry to a sorted growable array
+static int apply_entry(int64_t **ids, int *n, int *cap, char op, int64_t id)
+{
+    int lo = 0, hi = *n;
+    while (lo < hi) {
+        int mid = lo + (hi - lo) / 2;
+        if ((*ids)[mid] < id) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    bool found = lo < *n && (*ids)[lo] == id;
+    if (op == '+' && !found) {
+        if (*n == *cap) {
+            int new_cap = *cap ? *cap * 2 : 64;
+            int64_t *tmp = realloc(*ids, (size_t)new_cap * sizeof(**ids));
+            if (!tmp) {
+                return -1;
+            }
+            *ids = tmp;
+            *cap = new_cap;
+        }
+        memmove(&(*ids)[lo + 1], &(*ids)[lo], (size_t)(*n - lo) * sizeof(**ids));
+        (*ids)[lo] = id;
+        (*n)++;
+    } else if (op == '-' && found) {
+        memmove(&(*ids)[lo], &(*ids)[lo + 1], (size_t)(*n - lo - 1) * sizeof(**ids));
+        (*n)--;
+    }
+    return 0;
+}
+
+/* build the snapshot the files hold: the base, then the journal replayed
+ * over it; *ops counts the journal entries (caller holds the journal flock)
+ */
+static WhitelistSnap *read_ids(const Whitelist *wl, int *ops)
 {
+    *ops = 0;
     FILE *fp = fopen(wl->path, "r");
     if (!fp) {
-        if (errno == ENOENT) {
-            // first run - create an empty file with restrictive permissions
-            fp = fopen(wl->path, "w");
-            if (fp) {
-                fchmod(fileno(fp), 0600);
-                fclose(fp);
-            }
-            wl->count = 0;
-            return 0;
+        if (errno != ENOENT) {
+            perror("whitelist: open");
+            return NULL;
         }
-        perror("whitelist: open");
-        return -1;
+        // first run - create an empty file with restrictive permissions
+        fp = fopen(wl->path, "w");
+        if (fp) {
+            fchmod(fileno(fp), 0600);
+            fclose(fp);
+        }
+        fp = NULL;
     }
 
-    wl->count = 0;
+    int64_t *ids = NULL;
+    int n = 0;
+    int cap = 0;
     char line[64];
-    while (fgets(line, sizeof(line), fp)) {
-        if (wl->count >= WHITELIST_MAX) {
-            log_warn("whitelist: max capacity (%d) reached", WHITELIST_MAX);
-            break;
+    while (fp && fgets(line, sizeof(line), fp)) {
+        int64_t id = 0;
+        if (sscanf(line, "%" SCNd64, &id) != 1) {
+            continue;
+        }
+        if (n == cap) {
+            int new_cap = cap ? cap * 2 : 64;
+            int64_t *tmp = realloc(ids, (size_t)new_cap * sizeof(*ids));
+            if (!tmp) {
+                free(ids);
+                fclose(fp);
+                return NULL;
+            }
+            ids = tmp;
+            cap = new_cap;
         }
+        ids[n++] = id;
+    }
+    if (fp) {
+        fclose(fp);
+    }
+
+    // sort for binary search in whitelist_contains, then replay the journal
+    WhitelistSnap *base = snap_from(ids, n);
+    if (!base) {
+        free(ids);
+        return NULL;
+    }
+    n = base->count;
+
+    char jpath[sizeof(wl->path) + 16];
+    journal_path(wl, jpath, sizeof(jpath));
+    FILE *jf = fopen(jpath, "r");
+    while (jf && fgets(line, sizeof(line), jf)) {
         int64_t id = 0;
-        if (sscanf(line, "%" SCNd64, &id) == 1) {
-            wl->ids[wl->count++] = id;
+        if ((line[0] == '+' || line[0] == '-') && sscanf(line + 1, "%" SCNd64, &id) == 1) {
+            if (apply_entry(&ids, &n, &cap, line[0], id) != 0) {
+                fclose(jf);
+                free(ids);
+                free(base);
+                return NULL;
+            }
+            (*ops)++;
         }
     }
+    if (jf) {
+        fclose(jf);
+    }
 
-    fclose(fp);
-    // sort for binary search in whitelist_contains
-    if (wl->count > 1) {
-        qsort(wl->ids, (size_t)wl->count, sizeof(wl->ids[0]), cmp_i64);
+    WhitelistSnap *s = base;
+    if (*ops > 0) {
+        s = snap_alloc(n);
+        if (!s) {
+            free(ids);
+            free(base);
+            return NULL;
+        }
+        if (n > 0) {
+            memcpy(s->ids, ids, (size_t)n * sizeof(ids[0]));
+        }
+        free(base);
     }
+    free(ids);
+    return s;
+}
+
+// open the journal for appending (creating it 0600 if needed)
+static int journal_open(Whitelist *wl, const char *mode)
+{
+    char jpath[sizeof(wl->path) + 16];
+    journal_path(wl, jpath, sizeof(jpath));
+    wl->journal = fopen(jpath, mode);
+    if (!wl->journal) {
+        log_error("whitelist: journal: %s", strerror(errno));
+        return -1;
+    }
+    fchmod(fileno(wl->journal), 0600);
     return 0;
 }
 
+static int save_snap(const Whitelist *wl, const WhitelistSnap *s);
+
+/* fold the journal into the base file (caller holds wl->lock)
+ * copies of a cluster share the files, and one may have missed a change
+ * another journaled, so the base is rebuilt from the files - not from this
+ * copy's snapshot - under an exclusive flock that also keeps every append
+ * out until the journal is truncated
+ */
+static int compact(Whitelist *wl)
+{
+    if (!wl->journal) {
+        return -1;
+    }
+    int fd = fileno(wl->journal);
+    if (flock(fd, LOCK_EX) != 0) {
+        log_error("whitelist: journal lock: %s", strerror(errno));
+        return -1;
+    }
+    int ops = 0;
+    WhitelistSnap *disk = read_ids(wl, &ops);
+    int rc = disk ? save_snap(wl, disk) : -1;
+    // the base now holds every entry; replaying a stale journal is idempotent
+    if (rc == 0 && ftruncate(fd, 0) != 0) {
+        log_error("whitelist: journal truncate: %s", strerror(errno));
+        rc = -1;
+    }
+    flock(fd, LOCK_UN);
+    free(disk);
+    if (rc == 0) {
+        wl->journal_ops = 0;
+    }
+    return rc;
+}
+
 int whitelist_load(Whitelist *wl, const char *path)
 {
     if (!wl || !path) {
         return -1;
     }
     memset(wl, 0, sizeof(*wl));
-    if (pthread_rwlock_init(&wl->lock, NULL) != 0) {
+    if (pthread_mutex_init(&wl->lock, NULL) != 0) {
         return -1;
     }
+    atomic_init(&wl->snap, NULL);
+    atomic_init(&wl->epoch, 0);
+    atomic_init(&wl->readers[0], 0);
+    atomic_init(&wl->readers[1], 0);
     snprintf(wl->path, sizeof(wl->path), "%s", path);
-    return read_ids(wl);
+
+    if (journal_open(wl, "a") != 0) {
+        pthread_mutex_destroy(&wl->lock);
+        return -1;
+    }
+    // shared: a compaction elsewhere is never seen half done
+    flock(fileno(wl->journal), LOCK_SH);
+    WhitelistSnap *s = read_ids(wl, &wl->journal_ops);
+    flock(fileno(wl->journal), LOCK_UN);
+    atomic_store(&wl->snap, s);
+    int rc = s ? 0 : -1;
+    if (rc == 0 && wl->journal_ops > 0) {
+        rc = compact(wl);
+    }
+    if (rc != 0) {
+        fclose(wl->journal);
+        wl->journal = NULL;
+        free(atomic_load(&wl->snap));
+        atomic_store(&wl->snap, NULL);
+        pthread_mutex_destroy(&wl->lock);
+    }
+    return rc;
 }
 
-int whitelist_save(const Whitelist *wl)
+static int save_snap(const Whitelist *wl, const WhitelistSnap *s)
 {
     // atomic save: write a temp file, then rename() over the real path
     char tmp_path[sizeof(wl->path) + 8];
@@ -100,8 +331,8 @@ int whitelist_save(const Whitelist *wl)
     }
     // restrict permissions before writing sensitive user IDs
     fchmod(fileno(fp), 0600);
-    for (int i = 0; i < wl->count; i++) {
-        if (fprintf(fp, "%" PRId64 "\n", wl->ids[i]) < 0) {
+    for (int i = 0; s && i < s->count; i++) {
+        if (fprintf(fp, "%" PRId64 "\n", s->ids[i]) < 0) {
             log_error("whitelist: write: %s", strerror(errno));
             fclose(fp);
             remove(tmp_path);
@@ -121,72 +352,151 @@ int whitelist_save(const Whitelist *wl)
     return 0;
 }
 
+int whitelist_save(const Whitelist *wl)
+{
+    unsigned idx;
+    const WhitelistSnap *s = snap_acquire(wl, &idx);
+    int rc = save_snap(wl, s);
+    snap_release(wl, idx);
+    return rc;
+}
+
 bool whitelist_contains(const Whitelist *wl, int64_t user_id)
 {
-    pthread_rwlock_rdlock((pthread_rwlock_t *)&wl->lock);
+    unsigned idx;
+    const WhitelistSnap *s = snap_acquire(wl, &idx);
     bool found = false;
-    bsearch_idx(wl, user_id, &found);
-    pthread_rwlock_unlock((pthread_rwlock_t *)&wl->lock);
+    if (s) {
+        bsearch_idx(s, user_id, &found);
+    }
+    snap_release(wl, idx);
     return found;
 }
 
-int whitelist_add(Whitelist *wl, int64_t user_id)
+// append one entry, publish the new snapshot, compact when due (caller holds wl->lock)
+static int commit_change(Whitelist *wl, WhitelistSnap *next, char op, int64_t user_id)
 {
-    pthread_rwlock_wrlock(&wl->lock);
-    bool found = false;
-    int pos = bsearch_idx(wl, user_id, &found);
-    if (found) {
-        pthread_rwlock_unlock(&wl->lock);
-        return 1; // already present
-    }
-    if (wl->count >= WHITELIST_MAX) {
-        pthread_rwlock_unlock(&wl->lock);
-        log_warn("whitelist: full");
+    // shared flock: appends from several copies may interleave, not a compaction
+    bool ok = wl->journal && flock(fileno(wl->journal), LOCK_SH) == 0;
+    ok = ok && fprintf(wl->journal, "%c%" PRId64 "\n", op, user_id) >= 0 &&
+         fflush(wl->journal) == 0;
+    if (wl->journal) {
+        flock(fileno(wl->journal), LOCK_UN);
+    }
+    if (!ok) {
+        log_error("whitelist: journal write: %s", strerror(errno));
+        free(next);
         return -1;
     }
-    // shift elements right to make room at sorted position
-    if (pos < wl->count) {
-        memmove(&wl->ids[pos + 1], &wl->ids[pos], (size_t)(wl->count - pos) * sizeof(wl->ids[0]));
+    snap_publish(wl, next);
+    if (++wl->journal_ops >= WHITELIST_COMPACT_OPS) {
+        // the change is already durable in the journal; compaction can wait
+        if (compact(wl) != 0) {
+            log_warn("whitelist: compaction failed, journal keeps growing");
+        }
     }
-    wl->ids[pos] = user_id;
-    wl->count++;
-    int rc = whitelist_save(wl);
-    pthread_rwlock_unlock(&wl->lock);
-    return rc;
+    return 0;
 }
 
-int whitelist_remove(Whitelist *wl, int64_t user_id)
+/* add ('+') or remove ('-') user_id under wl->lock; journal records the
+ * change on disk, otherwise it only updates memory
+ */
+static int update(Whitelist *wl, int64_t user_id, char op, bool journal)
 {
-    pthread_rwlock_wrlock(&wl->lock);
+    pthread_mutex_lock(&wl->lock);
+    const WhitelistSnap *cur = atomic_load(&wl->snap);
+    if (!cur) {
+        cur = &k_empty;
+    }
     bool found = false;
-    int idx = bsearch_idx(wl, user_id, &found);
-    if (!found) {
-        pthread_rwlock_unlock(&wl->lock);
-        return 1; // not found
+    int pos = bsearch_idx(cur, user_id, &found);
+    if (found == (op == '+')) {
+        pthread_mutex_unlock(&wl->lock);
+        return 1; // already present / not found
     }
 
-    // shift remaining entries left with memmove
-    int remaining = wl->count - idx - 1;
-    if (remaining > 0) {
-        memmove(&wl->ids[idx], &wl->ids[idx + 1], (size_t)remaining * sizeof(wl->ids[0]));
+    WhitelistSnap *next = snap_alloc(op == '+' ? cur->count + 1 : cur->count - 1);
+    if (!next) {
+        pthread_mutex_unlock(&wl->lock);
+        log_warn("whitelist: out of memory");
+        return -1;
     }
-    wl->count--;
-    int rc = whitelist_save(wl);
-    pthread_rwlock_unlock(&wl->lock);
+    memcpy(next->ids, cur->ids, (size_t)pos * sizeof(cur->ids[0]));
+    if (op == '+') {
+        // copy around the sorted insertion point
+        next->ids[pos] = user_id;
+        memcpy(&next->ids[pos + 1], &cur->ids[pos],
+               (size_t)(cur->count - pos) * sizeof(cur->ids[0]));
+    } else {
+        memcpy(&next->ids[pos], &cur->ids[pos + 1],
+               (size_t)(cur->count - pos - 1) * sizeof(cur->ids[0]));
+    }
+
+    int rc = 0;
+    if (journal) {
+        rc = commit_change(wl, next, op, user_id);
+    } else {
+        snap_publish(wl, next);
+    }
+    pthread_mutex_unlock(&wl->lock);
     return rc;
 }
 
+int whitelist_add(Whitelist *wl, int64_t user_id)
+{
+    return update(wl, user_id, '+', true);
+}
+
+int whitelist_remove(Whitelist *wl, int64_t user_id)
+{
+    return update(wl, user_id, '-', true);
+}
+
+int whitelist_apply(Whitelist *wl, char op, int64_t user_id)
+{
+    if (op != '+' && op != '-') {
+        return -1;
+    }
+    return update(wl, user_id, op, false);
+}
+
 int whitelist_count(const Whitelist *wl)
 {
-    pthread_rwlock_rdlock((pthread_rwlock_t *)&wl->lock);
-    int n = wl->count;
-    pthread_rwlock_unlock((pthread_rwlock_t *)&wl->lock);
+    unsigned idx;
+    const WhitelistSnap *s = snap_acquire(wl, &idx);
+    int n = s ? s->count : 0;
+    snap_release(wl, idx);
+    return n;
+}
+
+int whitelist_copy(const Whitelist *wl, int64_t *out, size_t cap)
+{
+    unsigned idx;
+    const WhitelistSnap *s = snap_acquire(wl, &idx);
+    int n = s ? s->count : 0;
+    size_t k = (size_t)n < cap ? (size_t)n : cap;
+    if (k > 0) {
+        memcpy(out, s->ids, k * sizeof(out[0]));
+    }
+    snap_release(wl, idx);
     return n;
 }
 
 void whitelist_cleanup(Whitelist *wl)
 {
-    if (wl) {
-        pthread_rwlock_destroy(&wl->lock);
+    if (!wl) {
+        return;
+    }
+    pthread_mutex_lock(&wl->lock);
+    if (wl->journal_ops > 0 && atomic_load(&wl->snap)) {
+        compact(wl);
+    }
+    if (wl->journal) {
+        fclose(wl->journal);
+        wl->journal = NULL;
     }
+    free(atomic_load(&wl->snap));
+    atomic_store(&wl->snap, NULL);
+    pthread_mutex_unlock(&wl->lock);
+    pthread_mutex_destroy(&wl->lock);
 }
@@ -3,34 +3,65 @@
 #include "config.h"
 
 #include <pthread.h>
+#include <stdatomic.h>
 #include <stdbool.h>
+#include <stddef.h>
 #include <stdint.h>
+#include <stdio.h>
 
+/* immutable sorted id array; replaced wholesale on every change */
 typedef struct {
-    int64_t ids[WHITELIST_MAX];
     int count;
+    int64_t ids[];
+} WhitelistSnap;
+
+/* readers load the current snapshot through an atomic pointer and never
+ * block; writers serialise on a mutex, publish a new snapshot, and free the
+ * old one once every reader that could have seen it has left (two reader
+ * counters; an update flips away from and drains each in turn). on disk the
+ * whitelist is the base file of ids plus an append-only "+id" / "-id"
+ * journal that is folded back into the base after WHITELIST_COMPACT_OPS
+ * entries. several processes may share the files: appends take a shared
+ * flock on the journal, and a compaction rebuilds the base from the files
+ * (never from memory) under an exclusive one.
+ */
+typedef struct {
+    _Atomic(WhitelistSnap *) snap;
+    _Atomic unsigned epoch;
+    _Atomic int readers[2];
+    pthread_mutex_t lock; // writers only
+    FILE *journal;
+    int journal_ops;
     char path[256];
-    pthread_rwlock_t lock;
 } Whitelist;
 
-// load the whitelist from disk; creates file if missing
+// load the whitelist from disk (base file, then journal); creates file if missing
 int whitelist_load(Whitelist *wl, const char *path);
 
-// persist the current in-memory whitelist back to disk
+// persist the current in-memory whitelist back to the base file
 int whitelist_save(const Whitelist *wl);
 
-// check whether a user_id is on the whitelist
+// check whether a user_id is on the whitelist (lock-free)
 bool whitelist_contains(const Whitelist *wl, int64_t user_id);
 
-// add a user_id to the whitelist and save
+// add a user_id to the whitelist and journal it
+// returns 0 on success, 1 if already present, -1 on error
 int whitelist_add(Whitelist *wl, int64_t user_id);
 
-// remove a user_id from the whitelist and save
+// remove a user_id from the whitelist and journal it
 // returns 0 on success, 1 if not found, -1 on error
 int whitelist_remove(Whitelist *wl, int64_t user_id);
 
-// return the current whitelist count (thread-safe)
+/* apply a change another process already journaled: '+' adds, '-' removes,
+ * in memory only. returns 0 on success, 1 if there was nothing to do, -1 on error
+ */
+int whitelist_apply(Whitelist *wl, char op, int64_t user_id);
+
+// return the current whitelist count (lock-free)
 int whitelist_count(const Whitelist *wl);
 
-// destroy the rwlock; call once during shutdown
+// copy up to cap ids, ascending, into out; returns the total count
+int whitelist_copy(const Whitelist *wl, int64_t *out, size_t cap);
+
+// compact the journal, free the snapshot and destroy the mutex; call once during shutdown
 void whitelist_cleanup(Whitelist *wl);
@@ -17,6 +17,7 @@ import time
 import random
 import threading
 from http.server import HTTPServer, BaseHTTPRequestHandler
+from socketserver import ThreadingMixIn
 
 # Default bot token for matching URL paths
 TOKEN = "TESTTOKEN123"
@@ -132,6 +133,10 @@ class MockHandler(BaseHTTPRequestHandler):
             self._handle_get_updates()
         elif method == "sendMessage":
             self._handle_send_message(body)
+        elif method == "editMessageText":
+            self._handle_edit_message_text(body)
+        elif method == "sendChatAction":
+            self._send_json(200, self._ok_response(True))
         elif method == "setWebhook":
             self._handle_set_webhook(body)
         elif method == "deleteWebhook":
@@ -208,6 +213,27 @@ class MockHandler(BaseHTTPRequestHandler):
             self._send_json(200, self._ok_response(updates))
             return
 
+        if scenario == "stamped":
+            # one update per poll, past the offset it was asked with; its text
+            # is the server's clock, so a test can tell when each poll left
+            offset = 0
+            if "offset=" in self.path:
+                offset = int(self.path.split("offset=", 1)[1].split("&", 1)[0])
+            update_id = max(offset, 1)
+            updates = [
+                {
+                    "update_id": update_id,
+                    "message": {
+                        "message_id": update_id,
+                        "from": {"id": 42, "is_bot": False, "first_name": "Test"},
+                        "chat": {"id": 42, "type": "private"},
+                        "text": repr(time.time()),
+                    },
+                },
+            ]
+            self._send_json(200, self._ok_response(updates))
+            return
+
         if scenario == "partial-read":
             # Send partial JSON and close connection
             partial = b'{"ok": true, "res'
@@ -228,9 +254,22 @@ class MockHandler(BaseHTTPRequestHandler):
     def _handle_send_message(self, body):
         try:
             data = json.loads(body) if body else {}
+        except UnicodeDecodeError:
+            self._send_json(
+                400, self._error_response(400, "Bad Request: text must be encoded in UTF-8")
+            )
+            return
         except json.JSONDecodeError:
             data = {}
 
+        # Telegram counts UTF-16 code units
+        if len(data.get("text", "").encode("utf-16-le")) // 2 > 4096:
+            self._send_json(400, self._error_response(400, "Bad Request: message is too long"))
+            return
+
+        if self.server.scenario == "slow-send" and data.get("text", "").startswith("slow"):
+            time.sleep(0.3)
+
         result = {
             "message_id": random.randint(1, 999999),
             "from": {
@@ -247,6 +286,25 @@ class MockHandler(BaseHTTPRequestHandler):
         }
         self._send_json(200, self._ok_response(result))
 
+    def _handle_edit_message_text(self, body):
+        try:
+            data = json.loads(body) if body else {}
+        except json.JSONDecodeError:
+            data = {}
+
+        if "message_id" not in data or "chat_id" not in data:
+            self._send_json(
+                400, self._error_response(400, "Bad Request: message to edit not found")
+            )
+            return
+
+        result = {
+            "message_id": data["message_id"],
+            "chat": {"id": data["chat_id"], "type": "private"},
+            "text": data.get("text", ""),
+        }
+        self._send_json(200, self._ok_response(result))
+
     def _handle_set_webhook(self, body):
         self._send_json(
             200,
@@ -260,10 +318,17 @@ class MockHandler(BaseHTTPRequestHandler):
         )
 
 
-class MockTgServer(HTTPServer):
+class MockTgServer(ThreadingMixIn, HTTPServer):
     """HTTPServer with configurable test parameters."""
 
     allow_reuse_address = True
+    daemon_threads = True
+
+    def process_request(self, request, client_address):
+        # one request at a time, except where a slow one must not hold up the rest
+        if self.scenario == "slow-send":
+            return ThreadingMixIn.process_request(self, request, client_address)
+        return HTTPServer.process_request(self, request, client_address)
 
     def __init__(self, port=0, **kwargs):
         self.fail_rate = kwargs.get("fail_rate", 0.0)
@@ -292,10 +357,12 @@ def main():
         choices=[
             "duplicate-updates",
             "out-of-order",
+            "stamped",
             "429-retry",
             "partial-read",
             "slow-response",
             "401-unauthorized",
+            "slow-send",
         ],
         help="Test scenario to activate",
     )
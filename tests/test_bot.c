@@ -6,9 +6,12 @@
 #include "test.h"
 #include "../src/bot.h"
 #include "../src/config.h"
+#include "../src/http.h"
+#include "../src/ratelimit.h"
 #include "../lib/cJSON.h"
 
 #include <signal.h>
+#include <stdatomic.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -112,6 +115,48 @@ TEST(bot_get_me_mock)
     stop_mock(&ms);
 }
 
+// a loopback API base is reachable over plain http without the test hook;
+// any other http:// base is refused before a connection is made
+TEST(bot_api_base_http_loopback_only)
+{
+    MockServer ms = start_mock(NULL);
+    ASSERT(ms.port > 0);
+
+    BotHandle *bot = bot_init("TESTTOKEN123");
+    ASSERT_NOT_NULL(bot);
+    char base[128];
+    snprintf(base, sizeof(base), "http://127.0.0.1:%d/bot", ms.port);
+    bot_set_api_base(bot, base);
+    cJSON *me = bot_get_me(bot);
+    ASSERT_NOT_NULL(me);
+    cJSON_Delete(me);
+
+    bot_set_api_base(bot, "http://10.255.255.1:1/bot");
+    ASSERT_NULL(bot_get_me(bot));
+    bot_set_api_base(bot, "http://localhost.example:1/bot");
+    ASSERT_NULL(bot_get_me(bot));
+    // a userinfo or look-alike prefix does not make the host local
+    bot_set_api_base(bot, "http://127.0.0.1@10.255.255.1:1/bot");
+    ASSERT_NULL(bot_get_me(bot));
+
+    ASSERT(bot_is_loopback_http("http://127.0.0.1:8081/bot"));
+    ASSERT(bot_is_loopback_http("http://127.45.6.7/bot"));
+    ASSERT(bot_is_loopback_http("http://localhost:8081/bot"));
+    ASSERT(bot_is_loopback_http("http://LOCALHOST/bot"));
+    ASSERT(bot_is_loopback_http("http://[::1]:8081/bot"));
+    ASSERT(!bot_is_loopback_http("http://127.evil.example/bot"));
+    ASSERT(!bot_is_loopback_http("http://127.0.0.1@evil.example/bot"));
+    ASSERT(!bot_is_loopback_http("http://localhost:1@evil.example/bot"));
+    ASSERT(!bot_is_loopback_http("http://localhost.example/bot"));
+    ASSERT(!bot_is_loopback_http("http://128.0.0.1/bot"));
+    ASSERT(!bot_is_loopback_http("https://127.0.0.1/bot")); // TLS anyway
+    ASSERT(!bot_is_loopback_http("http://"));
+    ASSERT(!bot_is_loopback_http("not a url"));
+
+    bot_cleanup(bot);
+    stop_mock(&ms);
+}
+
 // "sendMessage" against mock server
 TEST(bot_send_message_mock)
 {
@@ -128,6 +173,55 @@ TEST(bot_send_message_mock)
     stop_mock(&ms);
 }
 
+// text Telegram would refuse (broken UTF-8, over 4096 characters) is fixed up on the way out
+TEST(bot_send_message_sanitised)
+{
+    MockServer ms = start_mock(NULL);
+    ASSERT(ms.port > 0);
+
+    BotHandle *bot = make_test_bot(ms.port);
+    ASSERT_NOT_NULL(bot);
+
+    ASSERT_EQ(bot_send_message(bot, 42, "bad \xC3\x28 byte, split \xE2\x9C"), 0);
+    // 3000 two-byte and 1500 four-byte characters: 6000 UTF-16 units
+    static char long_text[3000 * 2 + 1500 * 4 + 1];
+    size_t o = 0;
+    for (int i = 0; i < 3000; i++) {
+        memcpy(long_text + o, "\xC3\xA9", 2);
+        o += 2;
+    }
+    for (int i = 0; i < 1500; i++) {
+        memcpy(long_text + o, "\xF0\x9F\x98\x80", 4);
+        o += 4;
+    }
+    long_text[o] = '\0';
+    ASSERT_EQ(bot_send_message(bot, 42, long_text), 0);
+
+    bot_cleanup(bot);
+    stop_mock(&ms);
+}
+
+// a 429 on a send pauses the governor and the send is retried after it
+TEST(bot_send_message_429_pauses)
+{
+    MockServer ms = start_mock("429-retry");
+    ASSERT(ms.port > 0);
+
+    BotHandle *bot = make_test_bot(ms.port);
+    ASSERT_NOT_NULL(bot);
+
+    RateLimitStats before, after;
+    ratelimit_stats(&before);
+    ASSERT_EQ(bot_send_message(bot, 42, "hello after a pause"), 0);
+    ratelimit_stats(&after);
+    ASSERT_EQ(after.pauses - before.pauses, 1);
+    ASSERT_EQ(after.sends - before.sends, 2); // the retry was scheduled too
+
+    ratelimit_destroy();
+    bot_cleanup(bot);
+    stop_mock(&ms);
+}
+
 // "getUpdates" against mock server (empty result)
 TEST(bot_get_updates_mock)
 {
@@ -149,6 +243,26 @@ TEST(bot_get_updates_mock)
     stop_mock(&ms);
 }
 
+// raw getUpdates body is handed back without a cJSON tree
+TEST(bot_get_updates_raw_mock)
+{
+    MockServer ms = start_mock(NULL);
+    ASSERT(ms.port > 0);
+
+    BotHandle *bot = make_test_bot(ms.port);
+    ASSERT_NOT_NULL(bot);
+
+    const char *body = NULL;
+    size_t len = 0;
+    ASSERT_EQ(bot_get_updates_raw(bot, 0, 1, 10, &body, &len), 0);
+    ASSERT_NOT_NULL(body);
+    ASSERT(len > 0);
+    ASSERT_NOT_NULL(strstr(body, "\"result\""));
+
+    bot_cleanup(bot);
+    stop_mock(&ms);
+}
+
 // connection refused - no listener on port
 TEST(bot_connection_refused)
 {
@@ -179,6 +293,10 @@ TEST(bot_invalid_token_401)
     cJSON *updates = bot_get_updates(bot, 0, 1, 10);
     ASSERT_NULL(updates); // mock returns 401, bot should fail
 
+    const char *body = NULL;
+    size_t len = 0;
+    ASSERT_EQ(bot_get_updates_raw(bot, 0, 1, 10, &body, &len), -1);
+
     bot_cleanup(bot);
     stop_mock(&ms);
 }
@@ -200,6 +318,265 @@ TEST(bot_partial_read_no_crash)
     stop_mock(&ms);
 }
 
+// sendMessage reports the new message id, which editMessageText can target
+TEST(bot_send_then_edit_mock)
+{
+    MockServer ms = start_mock(NULL);
+    ASSERT(ms.port > 0);
+
+    BotHandle *bot = make_test_bot(ms.port);
+    ASSERT_NOT_NULL(bot);
+
+    int64_t mid = 0;
+    ASSERT_EQ(bot_send_message_id(bot, 42, "placeholder", &mid), 0);
+    ASSERT(mid > 0);
+    ASSERT_EQ(bot_edit_message_text(bot, 42, mid, "partial"), 0);
+    ASSERT_EQ(bot_edit_message_text(bot, 42, mid, "partial reply, now complete"), 0);
+
+    bot_cleanup(bot);
+    stop_mock(&ms);
+}
+
+// getMe routed through the shared curl_multi engine
+TEST(bot_get_me_via_engine)
+{
+    MockServer ms = start_mock(NULL);
+    ASSERT(ms.port > 0);
+    ASSERT_EQ(http_engine_start(8), 0);
+    ASSERT(http_engine_running());
+
+    BotHandle *bot = make_test_bot(ms.port);
+    ASSERT_NOT_NULL(bot);
+
+    cJSON *me = bot_get_me(bot);
+    ASSERT_NOT_NULL(me);
+    const cJSON *result = cJSON_GetObjectItemCaseSensitive(me, "result");
+    const cJSON *username = cJSON_GetObjectItemCaseSensitive(result, "username");
+    ASSERT(cJSON_IsString(username));
+    ASSERT_STR_EQ(username->valuestring, "test_bot");
+    cJSON_Delete(me);
+
+    bot_cleanup(bot);
+    http_engine_stop();
+    ASSERT(!http_engine_running());
+    stop_mock(&ms);
+}
+
+// async sends return immediately and all complete on the engine thread
+TEST(bot_send_message_async_engine)
+{
+    MockServer ms = start_mock(NULL);
+    ASSERT(ms.port > 0);
+    ASSERT_EQ(http_engine_start(8), 0);
+
+    BotHandle *bot = make_test_bot(ms.port);
+    ASSERT_NOT_NULL(bot);
+
+    for (int i = 0; i < 8; i++) {
+        ASSERT_EQ(bot_send_message_async(bot, 42, "async hello"), 0);
+    }
+
+    // wait (bounded) for the engine to drain
+    for (int i = 0; i < 100 && http_inflight() > 0; i++) {
+        usleep(50000);
+    }
+    ASSERT_EQ(http_inflight(), 0);
+
+    // the handle is still usable for blocking calls afterwards
+    ASSERT_EQ(bot_send_message(bot, 42, "sync after async"), 0);
+
+    bot_cleanup(bot);
+    http_engine_stop();
+    stop_mock(&ms);
+}
+
+// without a running engine submit is refused and async falls back to blocking
+TEST(bot_send_message_async_fallback)
+{
+    MockServer ms = start_mock(NULL);
+    ASSERT(ms.port > 0);
+    ASSERT(!http_engine_running());
+
+    BotHandle *bot = make_test_bot(ms.port);
+    ASSERT_NOT_NULL(bot);
+
+    CURL *easy = curl_easy_init();
+    ASSERT_NOT_NULL(easy);
+    ASSERT_EQ(http_submit(easy, NULL, NULL), -1);
+    curl_easy_cleanup(easy);
+
+    ASSERT_EQ(bot_send_message_async(bot, 42, "fallback"), 0);
+    ASSERT_EQ(http_inflight(), 0);
+
+    bot_cleanup(bot);
+    stop_mock(&ms);
+}
+
+// outcomes seen by bot_send_message_then's callback
+static atomic_int g_sent_ok;
+static atomic_int g_sent_retry;
+static atomic_int g_sent_failed;
+
+static void count_sent(int rc, void *ud)
+{
+    (void)ud;
+    atomic_fetch_add(rc == 0 ? &g_sent_ok : rc == BOT_SEND_RETRY ? &g_sent_retry : &g_sent_failed,
+                     1);
+}
+
+// the callback hears exactly once how every send ended
+TEST(bot_send_message_then_reports)
+{
+    atomic_store(&g_sent_ok, 0);
+    atomic_store(&g_sent_retry, 0);
+    atomic_store(&g_sent_failed, 0);
+    MockServer ms = start_mock("429-retry");
+    ASSERT(ms.port > 0);
+    BotHandle *bot = make_test_bot(ms.port);
+    ASSERT_NOT_NULL(bot);
+
+    // the first answer is a 429, the rest go through
+    ASSERT_EQ(http_engine_start(8), 0);
+    ASSERT_EQ(bot_send_message_then(bot, 42, "first", count_sent, NULL), 0);
+    for (int i = 0; i < 100 && atomic_load(&g_sent_retry) == 0; i++) {
+        usleep(50000);
+    }
+    ASSERT_EQ(atomic_load(&g_sent_retry), 1);
+    // these wait out the 1s pause the 429 left, then go through
+    for (int i = 0; i < 3; i++) {
+        ASSERT_EQ(bot_send_message_then(bot, 42, "then", count_sent, NULL), 0);
+    }
+    for (int i = 0; i < 100 && atomic_load(&g_sent_ok) < 3; i++) {
+        usleep(50000);
+    }
+    ASSERT_EQ(atomic_load(&g_sent_ok), 3);
+    http_engine_stop();
+
+    // no engine: sent blocking, and told before the call returns
+    ASSERT_EQ(bot_send_message_then(bot, 42, "blocking", count_sent, NULL), 0);
+    ASSERT_EQ(atomic_load(&g_sent_ok), 4);
+    // a closed port fails
+    bot_set_api_base(bot, "http://127.0.0.1:1/bot");
+    ASSERT_EQ(bot_send_message_then(bot, 42, "nowhere", count_sent, NULL), -1);
+    ASSERT_EQ(atomic_load(&g_sent_failed), 1);
+    ASSERT_EQ(atomic_load(&g_sent_retry), 1);
+
+    bot_cleanup(bot);
+    stop_mock(&ms);
+}
+
+// a queued reply survives the abort flag dropping and finishes in the drain
+TEST(bot_send_message_then_drains)
+{
+    atomic_store(&g_sent_ok, 0);
+    atomic_store(&g_sent_failed, 0);
+    MockServer ms = start_mock("slow-send");
+    ASSERT(ms.port > 0);
+    BotHandle *bot = make_test_bot(ms.port);
+    ASSERT_NOT_NULL(bot);
+    volatile sig_atomic_t running = 1;
+    bot_set_abort_flag(bot, &running);
+
+    ASSERT_EQ(http_engine_start(8), 0);
+    ASSERT_EQ(bot_send_message_then(bot, 42, "slow reply", count_sent, NULL), 0);
+    running = 0;
+    ASSERT_EQ(http_engine_drain(5.0), 0);
+    ASSERT_EQ(atomic_load(&g_sent_ok), 1);
+    ASSERT_EQ(atomic_load(&g_sent_failed), 0);
+    // nothing in flight: returns at once
+    ASSERT_EQ(http_engine_drain(5.0), 0);
+    http_engine_stop();
+
+    bot_cleanup(bot);
+    stop_mock(&ms);
+}
+
+// completion order of the sends in bot_send_message_then_ordered
+static atomic_int g_done_n;
+static atomic_int g_done_order[4];
+
+static void note_sent(int rc, void *ud)
+{
+    if (rc == 0) {
+        atomic_store(&g_done_order[atomic_fetch_add(&g_done_n, 1)], (int)(intptr_t)ud);
+    }
+}
+
+// a fast reply does not overtake a slow one to the same chat; other chats are not held
+TEST(bot_send_message_then_ordered)
+{
+    atomic_store(&g_done_n, 0);
+    MockServer ms = start_mock("slow-send");
+    ASSERT(ms.port > 0);
+    BotHandle *bot = make_test_bot(ms.port);
+    ASSERT_NOT_NULL(bot);
+
+    ASSERT_EQ(http_engine_start(8), 0);
+    ASSERT_EQ(bot_send_message_then(bot, 42, "slow first", note_sent, (void *)1), 0);
+    ASSERT_EQ(bot_send_message_then(bot, 42, "second", note_sent, (void *)2), 0);
+    ASSERT_EQ(bot_send_message_then(bot, 7, "other chat", note_sent, (void *)3), 0);
+    ASSERT_EQ(http_engine_drain(5.0), 0);
+    http_engine_stop();
+    ASSERT_EQ(atomic_load(&g_done_n), 3);
+    ASSERT_EQ(atomic_load(&g_done_order[0]), 3);
+    ASSERT_EQ(atomic_load(&g_done_order[1]), 1);
+    ASSERT_EQ(atomic_load(&g_done_order[2]), 2);
+
+    bot_cleanup(bot);
+    stop_mock(&ms);
+}
+
+// chat actions go out blocking, or on the engine without holding the caller
+TEST(bot_send_chat_action_mock)
+{
+    MockServer ms = start_mock(NULL);
+    ASSERT(ms.port > 0);
+
+    BotHandle *bot = make_test_bot(ms.port);
+    ASSERT_NOT_NULL(bot);
+    ASSERT_EQ(bot_send_chat_action(bot, 42, "typing"), 0);
+    ASSERT_EQ(bot_send_chat_action_async(bot, 42, "typing"), 0); // no engine: blocking
+
+    ASSERT_EQ(http_engine_start(8), 0);
+    for (int i = 0; i < 4; i++) {
+        ASSERT_EQ(bot_send_chat_action_async(bot, 42, "typing"), 0);
+    }
+    for (int i = 0; i < 100 && http_inflight() > 0; i++) {
+        usleep(50000);
+    }
+    ASSERT_EQ(http_inflight(), 0);
+
+    bot_cleanup(bot);
+    http_engine_stop();
+    stop_mock(&ms);
+}
+
+// workers on separate handles reuse one pooled connection through the share
+TEST(bot_shared_cache_across_handles)
+{
+    MockServer ms = start_mock(NULL);
+    ASSERT(ms.port > 0);
+    ASSERT_EQ(http_share_init(false), 0);
+    ASSERT_EQ(http_share_init(false), 0); // idempotent
+
+    BotHandle *a = make_test_bot(ms.port);
+    BotHandle *b = make_test_bot(ms.port);
+    ASSERT_NOT_NULL(a);
+    ASSERT_NOT_NULL(b);
+
+    for (int i = 0; i < 4; i++) {
+        ASSERT_EQ(bot_send_message(i % 2 ? a : b, 42, "shared"), 0);
+    }
+    cJSON *me = bot_get_me(b);
+    ASSERT_NOT_NULL(me);
+    cJSON_Delete(me);
+
+    bot_cleanup(a);
+    bot_cleanup(b);
+    http_share_cleanup();
+    stop_mock(&ms);
+}
+
 int main(void)
 {
     printf("=== test_bot ===\n");
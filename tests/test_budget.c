@@ -0,0 +1,97 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "test.h"
+#include "../src/budget.h"
+
+#include <stdio.h>
+
+TEST(budget_bad_curves)
+{
+    ASSERT_EQ(budget_init("8", 0, NULL, 512), -1);          // no tokens
+    ASSERT_EQ(budget_init("8:x", 0, NULL, 512), -1);
+    ASSERT_EQ(budget_init("0:256", 0, NULL, 512), -1);      // depth 0 is the idle budget
+    ASSERT_EQ(budget_init("8:1024", 0, NULL, 512), -1);     // above max_tokens
+    ASSERT_EQ(budget_init("8:256, 8:128", 0, NULL, 512), -1); // depths must rise
+    ASSERT_EQ(budget_init("8:128, 16:256", 0, NULL, 512), -1); // tokens must not
+    ASSERT_EQ(budget_init("1:9,2:9,3:9,4:9,5:9,6:9,7:9,8:9,9:9", 0, NULL, 512), -1); // too many
+}
+
+TEST(budget_disabled_is_full)
+{
+    ASSERT_EQ(budget_init("", 1.0, "tiny", 512), 0);
+    Budget b;
+    budget_pick(1000, &b);
+    ASSERT_EQ(b.max_tokens, 512);
+    ASSERT_EQ(b.level, 0);
+    ASSERT(b.model == NULL); // no curve: the fallback is never used
+}
+
+TEST(budget_follows_depth)
+{
+    ASSERT_EQ(budget_init(" 8 : 256, 32:128 ,64:64, ", 0, NULL, 512), 0);
+    Budget b;
+    budget_pick(0, &b);
+    ASSERT_EQ(b.max_tokens, 512);
+    budget_pick(7, &b);
+    ASSERT_EQ(b.max_tokens, 512);
+    budget_pick(8, &b);
+    ASSERT_EQ(b.max_tokens, 256);
+    ASSERT_EQ(b.level, 1);
+    budget_pick(40, &b);
+    ASSERT_EQ(b.max_tokens, 128);
+    budget_pick(500, &b);
+    ASSERT_EQ(b.max_tokens, 64);
+    ASSERT_EQ(b.level, 3);
+    ASSERT(b.model == NULL);
+    // back to the full budget once the backlog is gone
+    budget_pick(0, &b);
+    ASSERT_EQ(b.max_tokens, 512);
+
+    BudgetStats bs;
+    budget_stats(&bs);
+    ASSERT_EQ(bs.picks, 6);
+    ASSERT_EQ(bs.reduced, 3);
+    ASSERT_EQ(bs.fallback, 0);
+    ASSERT_EQ(bs.level, 0);
+}
+
+TEST(budget_slow_drops_a_step)
+{
+    ASSERT_EQ(budget_init("8:256, 32:128", 2.0, "tiny", 512), 0);
+    Budget b;
+    budget_observe(1.0);
+    budget_pick(1, &b);
+    ASSERT_EQ(b.max_tokens, 512);
+
+    // the average climbs past 2 s
+    for (int i = 0; i < 20; i++) {
+        budget_observe(5.0);
+    }
+    BudgetStats bs;
+    budget_stats(&bs);
+    ASSERT(bs.latency > 2.0);
+    budget_pick(1, &b);
+    ASSERT_EQ(b.max_tokens, 256);
+    ASSERT(b.model == NULL);
+    budget_pick(8, &b);
+    ASSERT_EQ(b.max_tokens, 128);
+    ASSERT_STR_EQ(b.model, "tiny"); // the deepest step
+    budget_pick(100, &b);
+    ASSERT_EQ(b.level, 2); // already at the bottom
+    // slow or not, an empty queue gets the full budget and model
+    budget_pick(0, &b);
+    ASSERT_EQ(b.max_tokens, 512);
+    ASSERT(b.model == NULL);
+
+    budget_stats(&bs);
+    ASSERT_EQ(bs.fallback, 2);
+    budget_reset();
+    budget_stats(&bs);
+    ASSERT_EQ(bs.picks, 0);
+}
+
+int main(void)
+{
+    printf("=== test_budget ===\n");
+    return test_summarise();
+}
@@ -0,0 +1,195 @@
+#define _POSIX_C_SOURCE 200809L
+#define _DEFAULT_SOURCE
+
+#include "test.h"
+#include "../src/cache.h"
+#include "../src/config.h"
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+static const char *SYS = "be brief";
+
+TEST(cache_normalise_variants)
+{
+    char out[64];
+    ASSERT_EQ(cache_normalise("  Hi!  ", out, sizeof(out)), 2);
+    ASSERT_STR_EQ(out, "hi");
+    cache_normalise("What   can\tyou\n do??", out, sizeof(out));
+    ASSERT_STR_EQ(out, "what can you do");
+    cache_normalise("v1.2 is out. ok.", out, sizeof(out));
+    ASSERT_STR_EQ(out, "v1.2 is out. ok");
+    ASSERT_EQ(cache_normalise("?!. ", out, sizeof(out)), 0);
+    ASSERT_STR_EQ(out, "");
+    ASSERT_EQ(cache_normalise(NULL, out, sizeof(out)), 0);
+
+    // non-ASCII bytes pass through untouched
+    cache_normalise("\xD0\x9F\xD1\x80\xD0\xB8\xD0\xB2\xD0\xB5\xD1\x82", out, sizeof(out));
+    ASSERT_STR_EQ(out, "\xD0\x9F\xD1\x80\xD0\xB8\xD0\xB2\xD0\xB5\xD1\x82");
+
+    // bounded by out_cap
+    char small[4];
+    ASSERT_EQ(cache_normalise("abcdef", small, sizeof(small)), 3);
+    ASSERT_STR_EQ(small, "abc");
+}
+
+TEST(cache_hit_and_miss)
+{
+    char out[256];
+    ASSERT_EQ(cache_lookup("m", SYS, "hi", 512, out, sizeof(out)), -1); // not initialised
+
+    ASSERT_EQ(cache_init(64 * 1024, 60), 0);
+    ASSERT_EQ(cache_lookup("m", SYS, "hi", 512, out, sizeof(out)), -1);
+    ASSERT_EQ(cache_store("m", SYS, "hi", 512, "Hello there!"), 0);
+
+    ASSERT_EQ(cache_lookup("m", SYS, "Hi!", 512, out, sizeof(out)), 0);
+    ASSERT_STR_EQ(out, "Hello there!");
+    ASSERT_EQ(cache_lookup("m", SYS, "  HI ", 512, out, sizeof(out)), 0);
+
+    // every key component matters
+    ASSERT_EQ(cache_lookup("other", SYS, "hi", 512, out, sizeof(out)), -1);
+    ASSERT_EQ(cache_lookup("m", "be verbose", "hi", 512, out, sizeof(out)), -1);
+    ASSERT_EQ(cache_lookup("m", SYS, "hi", 256, out, sizeof(out)), -1);
+    ASSERT_EQ(cache_lookup("m", NULL, "hi", 512, out, sizeof(out)), -1);
+
+    // a reply that does not fit the caller's buffer is a miss
+    char tiny[4];
+    ASSERT_EQ(cache_lookup("m", SYS, "hi", 512, tiny, sizeof(tiny)), -1);
+
+    // storing again replaces the entry
+    ASSERT_EQ(cache_store("m", SYS, "HI", 512, "Hey."), 0);
+    ASSERT_EQ(cache_lookup("m", SYS, "hi", 512, out, sizeof(out)), 0);
+    ASSERT_STR_EQ(out, "Hey.");
+
+    CacheStats st;
+    cache_stats(&st);
+    ASSERT_EQ(st.hits, 3);
+    ASSERT_EQ(st.misses, 6);
+    ASSERT_EQ(st.entries, 1);
+    ASSERT(st.bytes > 0);
+    cache_destroy();
+}
+
+TEST(cache_uncacheable_prompts)
+{
+    ASSERT_EQ(cache_init(64 * 1024, 60), 0);
+    char out[64];
+    ASSERT_EQ(cache_store("m", SYS, "   ", 512, "x"), -1);
+
+    char longp[CACHE_PROMPT_MAX + 10];
+    memset(longp, 'a', sizeof(longp) - 1);
+    longp[sizeof(longp) - 1] = '\0';
+    ASSERT_EQ(cache_store("m", SYS, longp, 512, "x"), -1);
+    ASSERT_EQ(cache_lookup("m", SYS, longp, 512, out, sizeof(out)), -1);
+
+    CacheStats st;
+    cache_stats(&st);
+    ASSERT_EQ(st.entries, 0);
+    cache_destroy();
+}
+
+TEST(cache_ttl_expiry)
+{
+    ASSERT_EQ(cache_init(64 * 1024, 1), 0);
+    char out[64];
+    ASSERT_EQ(cache_store("m", SYS, "hi", 512, "hello"), 0);
+    ASSERT_EQ(cache_lookup("m", SYS, "hi", 512, out, sizeof(out)), 0);
+    usleep(1100000);
+    ASSERT_EQ(cache_lookup("m", SYS, "hi", 512, out, sizeof(out)), -1);
+
+    CacheStats st;
+    cache_stats(&st);
+    ASSERT_EQ(st.entries, 0); // the expired entry was dropped on lookup
+    ASSERT_EQ(st.evictions, 0);
+    cache_destroy();
+}
+
+TEST(cache_lru_eviction_bounded)
+{
+    ASSERT_EQ(cache_init(4096, 60), 0);
+    char prompt[32];
+    char out[512];
+    char reply[200];
+    memset(reply, 'r', sizeof(reply) - 1);
+    reply[sizeof(reply) - 1] = '\0';
+
+    ASSERT_EQ(cache_store("m", SYS, "keep me", 512, "kept"), 0);
+    for (int i = 0; i < 200; i++) {
+        snprintf(prompt, sizeof(prompt), "prompt %d", i);
+        ASSERT_EQ(cache_store("m", SYS, prompt, 512, reply), 0);
+        // touching an entry keeps it at the front of the LRU
+        ASSERT_EQ(cache_lookup("m", SYS, "keep me", 512, out, sizeof(out)), 0);
+
+        CacheStats st;
+        cache_stats(&st);
+        ASSERT(st.bytes <= 4096);
+    }
+    ASSERT_EQ(cache_lookup("m", SYS, "prompt 0", 512, out, sizeof(out)), -1);
+    ASSERT_EQ(cache_lookup("m", SYS, "prompt 199", 512, out, sizeof(out)), 0);
+
+    CacheStats st;
+    cache_stats(&st);
+    ASSERT(st.evictions > 0);
+    ASSERT(st.entries < 200);
+
+    // an entry bigger than the whole cache is refused
+    char huge[8192];
+    memset(huge, 'h', sizeof(huge) - 1);
+    huge[sizeof(huge) - 1] = '\0';
+    ASSERT_EQ(cache_store("m", SYS, "huge", 512, huge), -1);
+    cache_destroy();
+}
+
+#define CC_THREADS 4
+#define CC_OPS 5000
+
+static void *cache_worker(void *arg)
+{
+    int id = (int)(intptr_t)arg;
+    int bad = 0;
+    char prompt[32];
+    char reply[64];
+    char out[64];
+    for (int i = 0; i < CC_OPS; i++) {
+        int k = (id * 7 + i) % 64;
+        snprintf(prompt, sizeof(prompt), "question %d", k);
+        snprintf(reply, sizeof(reply), "answer %d", k);
+        if (cache_lookup("m", SYS, prompt, 512, out, sizeof(out)) == 0) {
+            bad += strcmp(out, reply) != 0;
+        } else {
+            cache_store("m", SYS, prompt, 512, reply);
+        }
+    }
+    return (void *)(intptr_t)bad;
+}
+
+TEST(cache_concurrent)
+{
+    ASSERT_EQ(cache_init(4096, 60), 0);
+    pthread_t t[CC_THREADS];
+    for (int i = 0; i < CC_THREADS; i++) {
+        ASSERT_EQ(pthread_create(&t[i], NULL, cache_worker, (void *)(intptr_t)i), 0);
+    }
+    int bad = 0;
+    for (int i = 0; i < CC_THREADS; i++) {
+        void *rv;
+        pthread_join(t[i], &rv);
+        bad += (int)(intptr_t)rv;
+    }
+    ASSERT_EQ(bad, 0);
+
+    CacheStats st;
+    cache_stats(&st);
+    ASSERT_EQ(st.hits + st.misses, (uint64_t)CC_THREADS * CC_OPS);
+    ASSERT(st.bytes <= 4096);
+    cache_destroy();
+}
+
+int main(void)
+{
+    printf("=== test_cache ===\n");
+    return test_summarise();
+}
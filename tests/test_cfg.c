@@ -4,6 +4,7 @@
 #include "test.h"
 #include "../src/cfg.h"
 #include "../src/config.h"
+#include "../src/queue.h"
 
 #include <stdio.h>
 #include <stdlib.h>
@@ -42,9 +43,14 @@ TEST(cfg_load_ini_values)
         "[bot]\n"
         "token = abc123\n"
         "reply_delay = 5\n"
+        "coalesce_ms = 2500\n"
+        "send_rate = 20\n"
+        "chat_rate = 0\n"
+        "group_rate = 15\n"
         "poll_timeout = 45\n"
         "poll_limit = 50\n"
         "whitelist_path = /tmp/wl.txt\n"
+        "api_base = http://127.0.0.1:18081/bot\n"
         "\n"
         "[webhook]\n"
         "enabled = true\n"
@@ -52,32 +58,117 @@ TEST(cfg_load_ini_values)
         "secret = mysecret\n"
         "threads = 8\n"
         "pool_size = 16\n"
+        "ingress_slots = 1024\n"
+        "dispatchers = 2\n"
         "\n"
         "[workers]\n"
         "count = 4\n"
+        "min = 2\n"
+        "max = 12\n"
+        "grow_depth = 8\n"
+        "grow_wait_ms = 500\n"
+        "idle_sec = 30\n"
         "ring_size = 64\n"
+        "overflow = merge\n"
+        "max_queue_age_sec = 120\n"
+        "busy_reply = Busy, try later.\n"
+        "journal_path = /tmp/tgbot-q.journal\n"
+        "journal_segment_mb = 16\n"
+        "\n"
+        "[metrics]\n"
+        "enabled = yes\n"
+        "port = 9100\n"
+        "\n"
+        "[trace]\n"
+        "enabled = true\n"
+        "sample = 10\n"
+        "slow_ms = 2500\n"
+        "slots = 128\n"
+        "path = /tmp/trace.json\n"
+        "\n"
+        "[cluster]\n"
+        "procs = 4\n"
         "\n"
         "[log]\n"
         "path = /tmp/test.log\n"
-        "max_size_mb = 50\n");
+        "max_size_mb = 50\n"
+        "async = false\n"
+        "async_slots = 256\n"
+        "mmap = yes\n"
+        "\n"
+        "[llm]\n"
+        "context = true\n"
+        "context_window = 8192\n"
+        "context_chat_kb = 32\n"
+        "context_total_mb = 64\n"
+        "cache = yes\n"
+        "cache_kb = 64\n"
+        "cache_ttl = 30\n"
+        "health_check_sec = 0\n"
+        "warmup = no\n"
+        "keepalive_sec = 240\n"
+        "budget_curve = 8:256, 32:64\n"
+        "budget_slow_ms = 4000\n"
+        "fallback_model = tiny\n");
 
     Config cfg;
     ASSERT_EQ(config_load(&cfg, TMP_INI), 0);
 
     ASSERT_STR_EQ(cfg.token, "abc123");
     ASSERT_EQ(cfg.reply_delay, 5);
+    ASSERT_EQ(cfg.coalesce_ms, 2500);
+    ASSERT_EQ(cfg.send_rate, 20);
+    ASSERT_EQ(cfg.chat_rate, 0);
+    ASSERT_EQ(cfg.group_rate, 15);
     ASSERT_EQ(cfg.poll_timeout, 45);
     ASSERT_EQ(cfg.poll_limit, 50);
     ASSERT_STR_EQ(cfg.whitelist_path, "/tmp/wl.txt");
+    ASSERT_STR_EQ(cfg.api_base, "http://127.0.0.1:18081/bot");
     ASSERT(cfg.webhook_enabled);
     ASSERT_EQ(cfg.webhook_port, 9000);
     ASSERT_STR_EQ(cfg.webhook_secret, "mysecret");
     ASSERT_EQ(cfg.webhook_threads, 8);
     ASSERT_EQ(cfg.webhook_pool_size, 16);
+    ASSERT_EQ(cfg.webhook_ingress_slots, 1024);
+    ASSERT_EQ(cfg.webhook_dispatchers, 2);
     ASSERT_EQ(cfg.worker_count, 4);
+    ASSERT_EQ(cfg.worker_min, 2);
+    ASSERT_EQ(cfg.worker_max, 12);
+    ASSERT_EQ(cfg.worker_grow_depth, 8);
+    ASSERT_EQ(cfg.worker_grow_wait_ms, 500);
+    ASSERT_EQ(cfg.worker_idle_sec, 30);
     ASSERT_EQ(cfg.user_ring_size, 64);
+    ASSERT_EQ(cfg.worker_overflow, QUEUE_MERGE);
+    ASSERT_EQ(cfg.worker_max_queue_age, 120);
+    ASSERT_STR_EQ(cfg.worker_busy_reply, "Busy, try later.");
+    ASSERT_STR_EQ(cfg.worker_journal_path, "/tmp/tgbot-q.journal");
+    ASSERT_EQ(cfg.worker_journal_segment_mb, 16);
     ASSERT_STR_EQ(cfg.log_path, "/tmp/test.log");
     ASSERT_EQ(cfg.log_max_size_mb, 50);
+    ASSERT(!cfg.log_async);
+    ASSERT_EQ(cfg.log_async_slots, 256);
+    ASSERT(cfg.log_mmap);
+    ASSERT(cfg.llm_context);
+    ASSERT_EQ(cfg.llm_context_window, 8192);
+    ASSERT_EQ(cfg.llm_context_chat_kb, 32);
+    ASSERT_EQ(cfg.llm_context_total_mb, 64);
+    ASSERT(cfg.llm_cache);
+    ASSERT_EQ(cfg.llm_cache_kb, 64);
+    ASSERT_EQ(cfg.llm_cache_ttl, 30);
+    ASSERT_EQ(cfg.llm_health_check_sec, 0);
+    ASSERT(!cfg.llm_warmup);
+    ASSERT_EQ(cfg.llm_keepalive_sec, 240);
+    ASSERT_STR_EQ(cfg.llm_budget_curve, "8:256, 32:64");
+    ASSERT_EQ(cfg.llm_budget_slow_ms, 4000);
+    ASSERT_STR_EQ(cfg.llm_fallback_model, "tiny");
+    ASSERT(cfg.metrics_enabled);
+    ASSERT_EQ(cfg.metrics_port, 9100);
+    ASSERT(cfg.trace_enabled);
+    ASSERT_EQ(cfg.trace_sample, 10);
+    ASSERT_EQ(cfg.trace_slow_ms, 2500);
+    ASSERT_EQ(cfg.trace_slots, 128);
+    ASSERT_STR_EQ(cfg.trace_path, "/tmp/trace.json");
+    ASSERT_EQ(cfg.cluster_procs, 4);
 
     cleanup_ini();
 }
@@ -151,6 +242,10 @@ TEST(cfg_missing_ini_uses_env)
     ASSERT_EQ(config_load(&cfg, "/tmp/nonexistent_tgbot_cfg.ini"), 0);
     ASSERT_STR_EQ(cfg.token, "env_only_token");
     ASSERT_EQ(cfg.reply_delay, CFG_DEFAULT_REPLY_DELAY);
+    ASSERT_EQ(cfg.coalesce_ms, CFG_DEFAULT_COALESCE_MS);
+    ASSERT_EQ(cfg.send_rate, CFG_DEFAULT_SEND_RATE);
+    ASSERT_EQ(cfg.chat_rate, CFG_DEFAULT_CHAT_RATE);
+    ASSERT_EQ(cfg.group_rate, CFG_DEFAULT_GROUP_RATE);
     ASSERT_EQ(cfg.poll_timeout, CFG_DEFAULT_POLL_TIMEOUT);
 
     clear_env();
@@ -181,6 +276,49 @@ TEST(cfg_integer_clamping)
     ASSERT(cfg.user_ring_size <= 256);
 
     cleanup_ini();
+
+    // count is kept inside [min, max]
+    write_ini(
+        "[bot]\n"
+        "token = tok\n"
+        "\n"
+        "[workers]\n"
+        "count = 2\n"
+        "min = 6\n"
+        "max = 3\n");
+    ASSERT_EQ(config_load(&cfg, TMP_INI), 0);
+    ASSERT_EQ(cfg.worker_min, 6);
+    ASSERT_EQ(cfg.worker_max, 6);
+    ASSERT_EQ(cfg.worker_count, 6);
+
+    cleanup_ini();
+}
+
+// overflow takes one of three names; anything else is a parse error
+TEST(cfg_overflow_policy)
+{
+    clear_env();
+    write_ini(
+        "[bot]\n"
+        "token = tok\n"
+        "\n"
+        "[workers]\n"
+        "overflow = drop-oldest\n"
+        "busy_reply =\n");
+    Config cfg;
+    ASSERT_EQ(config_load(&cfg, TMP_INI), 0);
+    ASSERT_EQ(cfg.worker_overflow, QUEUE_DROP_OLDEST);
+    ASSERT_STR_EQ(cfg.worker_busy_reply, "");
+
+    write_ini(
+        "[bot]\n"
+        "token = tok\n"
+        "\n"
+        "[workers]\n"
+        "overflow = drop-everything\n");
+    ASSERT_EQ(config_load(&cfg, TMP_INI), -1);
+
+    cleanup_ini();
 }
 
 // NULL config pointer -> error
@@ -198,9 +336,52 @@ TEST(cfg_defaults)
     Config cfg;
     ASSERT_EQ(config_load(&cfg, NULL), 0);
     ASSERT_EQ(cfg.worker_count, CFG_DEFAULT_WORKER_COUNT);
+    ASSERT_EQ(cfg.worker_min, CFG_DEFAULT_WORKER_COUNT); // fixed pool
+    ASSERT_EQ(cfg.worker_max, CFG_DEFAULT_WORKER_COUNT);
+    ASSERT_EQ(cfg.worker_grow_depth, CFG_DEFAULT_WORKER_GROW_DEPTH);
+    ASSERT_EQ(cfg.worker_grow_wait_ms, CFG_DEFAULT_WORKER_GROW_WAIT_MS);
+    ASSERT_EQ(cfg.worker_idle_sec, CFG_DEFAULT_WORKER_IDLE_SEC);
     ASSERT_EQ(cfg.user_ring_size, CFG_DEFAULT_USER_RING_SIZE);
+    ASSERT_EQ(cfg.worker_overflow, QUEUE_DROP_NEWEST);
+    ASSERT_EQ(cfg.worker_max_queue_age, 0);
+    ASSERT_STR_EQ(cfg.worker_busy_reply, CFG_DEFAULT_WORKER_BUSY_REPLY);
+    ASSERT_STR_EQ(cfg.worker_journal_path, "");
+    ASSERT_EQ(cfg.worker_journal_segment_mb, CFG_DEFAULT_WORKER_JOURNAL_SEGMENT_MB);
     ASSERT_EQ(cfg.webhook_port, CFG_DEFAULT_WEBHOOK_PORT);
+    ASSERT_EQ(cfg.webhook_ingress_slots, CFG_DEFAULT_WEBHOOK_INGRESS_SLOTS);
+    ASSERT_EQ(cfg.webhook_dispatchers, CFG_DEFAULT_WEBHOOK_DISPATCHERS);
     ASSERT(!cfg.webhook_enabled);
+    ASSERT(cfg.http_engine);
+    ASSERT_EQ(cfg.http_max_connections, CFG_DEFAULT_HTTP_MAX_CONNS);
+    ASSERT(cfg.http_share);
+    ASSERT(!cfg.http2);
+    ASSERT(!cfg.metrics_enabled);
+    ASSERT_STR_EQ(cfg.api_base, API_BASE);
+    ASSERT_EQ(cfg.metrics_port, CFG_DEFAULT_METRICS_PORT);
+    ASSERT(!cfg.trace_enabled);
+    ASSERT_EQ(cfg.trace_sample, CFG_DEFAULT_TRACE_SAMPLE);
+    ASSERT_EQ(cfg.trace_slow_ms, CFG_DEFAULT_TRACE_SLOW_MS);
+    ASSERT_EQ(cfg.trace_slots, CFG_DEFAULT_TRACE_SLOTS);
+    ASSERT_STR_EQ(cfg.trace_path, CFG_DEFAULT_TRACE_PATH);
+    ASSERT_EQ(cfg.cluster_procs, CFG_DEFAULT_CLUSTER_PROCS);
+    ASSERT(!cfg.llm_stream);
+    ASSERT_EQ(cfg.llm_stream_edit_ms, CFG_DEFAULT_LLM_STREAM_EDIT_MS);
+    ASSERT(cfg.log_async);
+    ASSERT_EQ(cfg.log_async_slots, LOG_DEFAULT_ASYNC_SLOTS);
+    ASSERT(!cfg.log_mmap);
+    ASSERT(!cfg.llm_context);
+    ASSERT_EQ(cfg.llm_context_window, CFG_DEFAULT_LLM_CONTEXT_WINDOW);
+    ASSERT_EQ(cfg.llm_context_chat_kb, CFG_DEFAULT_LLM_CONTEXT_CHAT_KB);
+    ASSERT_EQ(cfg.llm_context_total_mb, CFG_DEFAULT_LLM_CONTEXT_TOTAL_MB);
+    ASSERT(!cfg.llm_cache);
+    ASSERT_EQ(cfg.llm_cache_kb, CFG_DEFAULT_LLM_CACHE_KB);
+    ASSERT_EQ(cfg.llm_cache_ttl, CFG_DEFAULT_LLM_CACHE_TTL);
+    ASSERT_EQ(cfg.llm_health_check_sec, CFG_DEFAULT_LLM_HEALTH_CHECK_SEC);
+    ASSERT(cfg.llm_warmup);
+    ASSERT_EQ(cfg.llm_keepalive_sec, CFG_DEFAULT_LLM_KEEPALIVE_SEC);
+    ASSERT_STR_EQ(cfg.llm_budget_curve, "");
+    ASSERT_EQ(cfg.llm_budget_slow_ms, CFG_DEFAULT_LLM_BUDGET_SLOW_MS);
+    ASSERT_STR_EQ(cfg.llm_fallback_model, "");
 
     clear_env();
 }
@@ -0,0 +1,235 @@
+#define _POSIX_C_SOURCE 200809L
+#define _DEFAULT_SOURCE
+
+#include "test.h"
+#include "../src/cluster.h"
+#include "../src/queue.h"
+#include "../src/whitelist.h"
+
+#include <signal.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#define USERS 40000
+
+// first user id (from 1) that copy owner of procs owns
+static int64_t user_owned_by(int owner, int procs)
+{
+    int64_t u = 1;
+    while (cluster_owner(u, procs) != owner) {
+        u++;
+    }
+    return u;
+}
+
+TEST(cluster_owner_spread_and_stability)
+{
+    ASSERT_EQ(cluster_owner(12345, 1), 0);
+    ASSERT_EQ(cluster_owner(12345, 0), 0);
+
+    int counts[4] = {0};
+    int moved = 0;
+    for (int64_t u = 1; u <= USERS; u++) {
+        int o4 = cluster_owner(u, 4);
+        ASSERT(o4 >= 0 && o4 < 4);
+        counts[o4]++;
+        ASSERT_EQ(cluster_owner(u, 4), o4);
+        // growing to 5 copies only moves users onto the new one
+        int o5 = cluster_owner(u, 5);
+        if (o5 != o4) {
+            ASSERT_EQ(o5, 4);
+            moved++;
+        }
+    }
+    for (int i = 0; i < 4; i++) {
+        ASSERT(counts[i] > USERS / 4 * 9 / 10 && counts[i] < USERS / 4 * 11 / 10);
+    }
+    ASSERT(moved > USERS / 5 * 9 / 10 && moved < USERS / 5 * 11 / 10);
+}
+
+TEST(cluster_forward_without_peers)
+{
+    // not started: everything is queued by the caller
+    ASSERT_EQ(cluster_forward(1, 1, "hi"), 0);
+    ASSERT_EQ(cluster_start(0, 1, NULL), -1);
+    ASSERT_EQ(cluster_start(2, 2, NULL), -1);
+
+    ASSERT_EQ(queue_init(8), 0);
+    ASSERT_EQ(cluster_start(0, 2, NULL), 0);
+    ASSERT_EQ(cluster_start(0, 2, NULL), -1); // already started
+    ClusterStats before;
+    cluster_stats(&before);
+
+    ASSERT_EQ(cluster_forward(user_owned_by(0, 2), 1, "mine"), 0);
+    // copy 1 was never started, so its message stays here
+    ASSERT_EQ(cluster_forward(user_owned_by(1, 2), 1, "theirs"), 0);
+    cluster_whitelist_changed('+', 5); // nobody to tell; must not block
+
+    ClusterStats after;
+    cluster_stats(&after);
+    ASSERT_EQ(after.forwarded, before.forwarded);
+    ASSERT_EQ(after.fallbacks, before.fallbacks + 1);
+    cluster_stop();
+    queue_shutdown();
+    queue_destroy();
+}
+
+/* send a 'W' datagram to copy 0 of this process's cluster from a child,
+ * running as uid when it is >= 0; the head mirrors cluster.c's Datagram
+ */
+static void send_whitelist_as(int uid, int64_t user_id)
+{
+    pid_t pid = fork();
+    if (pid == 0) {
+        if (uid >= 0 && setuid((uid_t)uid) != 0) {
+            _exit(1);
+        }
+        struct {
+            char type, op;
+            int64_t user_id, chat_id;
+        } d = {.type = 'W', .op = '+', .user_id = user_id};
+        struct sockaddr_un sa = {.sun_family = AF_UNIX};
+        int n = snprintf(sa.sun_path + 1, sizeof(sa.sun_path) - 1, "tgbot-cluster-%d-0",
+                         (int)getppid());
+        int fd = socket(AF_UNIX, SOCK_DGRAM, 0);
+        ssize_t sent = sendto(fd, &d, sizeof(d), 0, (struct sockaddr *)&sa,
+                              (socklen_t)(offsetof(struct sockaddr_un, sun_path) + 1 + (size_t)n));
+        _exit(sent == (ssize_t)sizeof(d) ? 0 : 2);
+    }
+    int status = 0;
+    waitpid(pid, &status, 0);
+}
+
+TEST(cluster_drops_foreign_senders)
+{
+    const char *path = "/tmp/tgbot_test_cluster_uid_wl";
+    unlink(path);
+    Whitelist wl;
+    ASSERT_EQ(whitelist_load(&wl, path), 0);
+    ASSERT_EQ(queue_init(8), 0);
+    ASSERT_EQ(cluster_start(0, 2, &wl), 0);
+
+    // the abstract socket has no permissions: anyone can reach it
+    if (geteuid() == 0) {
+        send_whitelist_as(65534, 901);
+    }
+    send_whitelist_as(-1, 902);
+    for (int i = 0; i < 200 && !whitelist_contains(&wl, 902); i++) {
+        usleep(10000);
+    }
+    ASSERT(whitelist_contains(&wl, 902));
+    ASSERT(!whitelist_contains(&wl, 901));
+
+    cluster_stop();
+    queue_shutdown();
+    queue_destroy();
+    whitelist_cleanup(&wl);
+    unlink(path);
+    unlink("/tmp/tgbot_test_cluster_uid_wl.journal");
+}
+
+// one copy's side of cluster_forward_between_copies; returns 'k' on success
+static char copy_main(int idx)
+{
+    char path[64];
+    snprintf(path, sizeof(path), "/tmp/tgbot_test_cluster_wl.%d", idx);
+    unlink(path);
+    Whitelist wl;
+    if (whitelist_load(&wl, path) != 0 || queue_init(8) != 0) {
+        return 'i';
+    }
+    char rc = 'k';
+    if (cluster_start(idx, 2, &wl) != 0) {
+        rc = 'b';
+    } else if (idx == 1) {
+        // copy 0 may not be up yet; until it is, messages fall back to here
+        int64_t u0 = user_owned_by(0, 2);
+        int sent = 0;
+        for (int i = 0; i < 300 && !sent; i++) {
+            sent = cluster_forward(u0, 55, "hello from copy 1");
+            if (!sent) {
+                usleep(10000);
+            }
+        }
+        if (!sent) {
+            rc = 'f';
+        } else if (cluster_forward(user_owned_by(1, 2), 1, "mine") != 0) {
+            rc = 'o';
+        } else {
+            cluster_whitelist_changed('+', 777);
+        }
+    } else {
+        int64_t u0 = user_owned_by(0, 2);
+        for (int i = 0; i < 500 && queue_depth() == 0; i++) {
+            usleep(10000);
+        }
+        QueueMsg msg = {0};
+        if (queue_depth() == 0 || queue_pop(&msg) != 0) {
+            rc = 'q';
+        } else if (msg.user_id != u0 || msg.chat_id != 55 ||
+                   strcmp(msg.text, "hello from copy 1") != 0) {
+            rc = 'm';
+        } else {
+            for (int i = 0; i < 500 && !whitelist_contains(&wl, 777); i++) {
+                usleep(10000);
+            }
+            ClusterStats cs;
+            cluster_stats(&cs);
+            if (!whitelist_contains(&wl, 777)) {
+                rc = 'w';
+            } else if (cs.received != 1) {
+                rc = 'r';
+            }
+        }
+        queue_msg_release(&msg);
+    }
+    cluster_stop();
+    queue_shutdown();
+    queue_destroy();
+    whitelist_cleanup(&wl);
+    unlink(path);
+    snprintf(path, sizeof(path), "/tmp/tgbot_test_cluster_wl.%d.journal", idx);
+    unlink(path);
+    return rc;
+}
+
+TEST(cluster_forward_between_copies)
+{
+    int fds[2];
+    ASSERT_EQ(pipe(fds), 0);
+    volatile sig_atomic_t running = 1;
+    int idx = cluster_spawn(2, &running);
+    if (idx >= 0) {
+        // a copy: report and leave with status 0 so it is not restarted
+        close(fds[0]);
+        char out[2] = {(char)('0' + idx), copy_main(idx)};
+        ssize_t n = write(fds[1], out, sizeof(out));
+        (void)n;
+        _exit(0);
+    }
+    close(fds[1]);
+    ASSERT_EQ(idx, -1); // returns once both copies exited
+
+    char res[2] = {'-', '-'};
+    char buf[2];
+    while (read(fds[0], buf, sizeof(buf)) == (ssize_t)sizeof(buf)) {
+        if (buf[0] == '0' || buf[0] == '1') {
+            res[buf[0] - '0'] = buf[1];
+        }
+    }
+    close(fds[0]);
+    ASSERT_EQ(res[0], 'k');
+    ASSERT_EQ(res[1], 'k');
+}
+
+int main(void)
+{
+    printf("=== test_cluster ===\n");
+    return test_summarise();
+}
@@ -31,6 +31,8 @@ static void cleanup_test_file(void)
     char tmp[280];
     snprintf(tmp, sizeof(tmp), "%s.tmp", TEST_WL_FILE);
     unlink(tmp);
+    snprintf(tmp, sizeof(tmp), "%s.journal", TEST_WL_FILE);
+    unlink(tmp);
 }
 static double monotonic_sec(void)
 {
@@ -85,11 +87,13 @@ TEST(cmd_dispatch_start)
     int rc = cmd_dispatch(&ctx, "/start");
     ASSERT_EQ(rc, 1);
 
-    QueueMsg out;
+    QueueMsg out = {0};
     ASSERT_EQ(queue_pop(&out), 0);
     ASSERT(strstr(out.text, "Hello") != NULL);
+    ASSERT_EQ(out.kind, QUEUE_REPLY); // sent as is, not answered by the LLM
 
     teardown_cmd();
+    queue_msg_release(&out);
 }
 
 // /help queues help text
@@ -101,7 +105,7 @@ TEST(cmd_dispatch_help)
     int rc = cmd_dispatch(&ctx, "/help");
     ASSERT_EQ(rc, 1);
 
-    QueueMsg out;
+    QueueMsg out = {0};
     ASSERT_EQ(queue_pop(&out), 0);
     ASSERT(strstr(out.text, "/start") != NULL);
     ASSERT(strstr(out.text, "/help") != NULL);
@@ -109,6 +113,7 @@ TEST(cmd_dispatch_help)
     ASSERT(strstr(out.text, "/status") != NULL);
 
     teardown_cmd();
+    queue_msg_release(&out);
 }
 
 // unknown command returns 0
@@ -144,11 +149,12 @@ TEST(cmd_dispatch_allow_non_admin)
     int rc = cmd_dispatch(&ctx, "/allow 123");
     ASSERT_EQ(rc, 1);
 
-    QueueMsg out;
+    QueueMsg out = {0};
     ASSERT_EQ(queue_pop(&out), 0);
     ASSERT(strstr(out.text, "permission denied") != NULL);
 
     teardown_cmd();
+    queue_msg_release(&out);
 }
 
 // /allow from admin -> adds user to whitelist
@@ -164,12 +170,13 @@ TEST(cmd_dispatch_allow_admin)
     ASSERT(whitelist_contains(&g_test_wl, 555));
 
     // pop admin confirmation message
-    QueueMsg out;
+    QueueMsg out = {0};
     ASSERT_EQ(queue_pop(&out), 0);
     ASSERT(strstr(out.text, "555") != NULL);
     ASSERT(strstr(out.text, "added") != NULL);
 
     teardown_cmd();
+    queue_msg_release(&out);
 }
 
 // /revoke from admin -> removes user
@@ -187,12 +194,13 @@ TEST(cmd_dispatch_revoke_admin)
 
     ASSERT(!whitelist_contains(&g_test_wl, 777));
 
-    QueueMsg out;
+    QueueMsg out = {0};
     ASSERT_EQ(queue_pop(&out), 0);
     ASSERT(strstr(out.text, "777") != NULL);
     ASSERT(strstr(out.text, "removed") != NULL);
 
     teardown_cmd();
+    queue_msg_release(&out);
 }
 // /status from admin -> operational info
 TEST(cmd_dispatch_status_admin)
@@ -203,7 +211,7 @@ TEST(cmd_dispatch_status_admin)
     int rc = cmd_dispatch(&ctx, "/status");
     ASSERT_EQ(rc, 1);
 
-    QueueMsg out;
+    QueueMsg out = {0};
     ASSERT_EQ(queue_pop(&out), 0);
     ASSERT(strstr(out.text, "uptime") != NULL);
     ASSERT(strstr(out.text, "queue") != NULL);
@@ -211,6 +219,7 @@ TEST(cmd_dispatch_status_admin)
     ASSERT(strstr(out.text, "workers") != NULL);
 
     teardown_cmd();
+    queue_msg_release(&out);
 }
 
 // /status from non-admin -> permission denied
@@ -222,11 +231,12 @@ TEST(cmd_dispatch_status_non_admin)
     int rc = cmd_dispatch(&ctx, "/status");
     ASSERT_EQ(rc, 1);
 
-    QueueMsg out;
+    QueueMsg out = {0};
     ASSERT_EQ(queue_pop(&out), 0);
     ASSERT(strstr(out.text, "permission denied") != NULL);
 
     teardown_cmd();
+    queue_msg_release(&out);
 }
 
 // /help@testbot suffix is handled correctly
@@ -238,11 +248,12 @@ TEST(cmd_dispatch_at_suffix)
     int rc = cmd_dispatch(&ctx, "/help@testbot");
     ASSERT_EQ(rc, 1);
 
-    QueueMsg out;
+    QueueMsg out = {0};
     ASSERT_EQ(queue_pop(&out), 0);
     ASSERT(strstr(out.text, "/help") != NULL);
 
     teardown_cmd();
+    queue_msg_release(&out);
 }
 
 // /allow with no argument -> usage message
@@ -254,11 +265,12 @@ TEST(cmd_dispatch_allow_no_arg)
     int rc = cmd_dispatch(&ctx, "/allow");
     ASSERT_EQ(rc, 1);
 
-    QueueMsg out;
+    QueueMsg out = {0};
     ASSERT_EQ(queue_pop(&out), 0);
     ASSERT(strstr(out.text, "Usage") != NULL);
 
     teardown_cmd();
+    queue_msg_release(&out);
 }
 
 // /allow with non-numeric argument -> Invalid user ID
@@ -270,11 +282,12 @@ TEST(cmd_dispatch_allow_non_numeric)
     int rc = cmd_dispatch(&ctx, "/allow notanumber");
     ASSERT_EQ(rc, 1);
 
-    QueueMsg out;
+    QueueMsg out = {0};
     ASSERT_EQ(queue_pop(&out), 0);
     ASSERT(strstr(out.text, "Invalid user ID") != NULL);
 
     teardown_cmd();
+    queue_msg_release(&out);
 }
 
 // /allow 0 -> Invalid user ID
@@ -286,11 +299,12 @@ TEST(cmd_dispatch_allow_zero)
     int rc = cmd_dispatch(&ctx, "/allow 0");
     ASSERT_EQ(rc, 1);
 
-    QueueMsg out;
+    QueueMsg out = {0};
     ASSERT_EQ(queue_pop(&out), 0);
     ASSERT(strstr(out.text, "Invalid user ID") != NULL);
 
     teardown_cmd();
+    queue_msg_release(&out);
 }
 
 // /revoke with non-numeric argument -> Invalid user ID
@@ -302,11 +316,12 @@ TEST(cmd_dispatch_revoke_non_numeric)
     int rc = cmd_dispatch(&ctx, "/revoke abc");
     ASSERT_EQ(rc, 1);
 
-    QueueMsg out;
+    QueueMsg out = {0};
     ASSERT_EQ(queue_pop(&out), 0);
     ASSERT(strstr(out.text, "Invalid user ID") != NULL);
 
     teardown_cmd();
+    queue_msg_release(&out);
 }
 
 // /allow enqueues TWO messages: admin confirmation + welcome to target
@@ -319,18 +334,52 @@ TEST(cmd_dispatch_allow_enqueues_both)
     ASSERT_EQ(rc, 1);
 
     // first pop: admin confirmation (to sender 1000)
-    QueueMsg out1;
+    QueueMsg out1 = {0};
     ASSERT_EQ(queue_pop(&out1), 0);
     ASSERT_EQ(out1.user_id, 1000);
     ASSERT(strstr(out1.text, "888") != NULL);
     ASSERT(strstr(out1.text, "added") != NULL);
+    ASSERT_EQ(out1.kind, QUEUE_SYSTEM);
 
     // second pop: welcome to target user 888
-    QueueMsg out2;
+    QueueMsg out2 = {0};
     ASSERT_EQ(queue_pop(&out2), 0);
     ASSERT_EQ(out2.user_id, 888);
+    ASSERT_EQ(out2.kind, QUEUE_SYSTEM);
     ASSERT(strstr(out2.text, "granted") != NULL || strstr(out2.text, "access") != NULL);
 
+    teardown_cmd();
+    queue_msg_release(&out1);
+    queue_msg_release(&out2);
+}
+
+static char g_changed_op;
+static int64_t g_changed_id;
+
+static void record_change(char op, int64_t user_id)
+{
+    g_changed_op = op;
+    g_changed_id = user_id;
+}
+
+// a successful /allow or /revoke is reported (multi-process mode broadcasts it)
+TEST(cmd_dispatch_whitelist_change_callback)
+{
+    setup_cmd();
+
+    CmdCtx ctx = make_ctx(1000, 1000, "testbot");
+    ctx.wl_changed = record_change;
+    ASSERT_EQ(cmd_dispatch(&ctx, "/allow 4242"), 1);
+    ASSERT_EQ(g_changed_op, '+');
+    ASSERT_EQ(g_changed_id, 4242);
+
+    g_changed_op = 0;
+    ASSERT_EQ(cmd_dispatch(&ctx, "/allow 4242"), 1); // already there
+    ASSERT_EQ(g_changed_op, 0);
+
+    ASSERT_EQ(cmd_dispatch(&ctx, "/revoke 4242"), 1);
+    ASSERT_EQ(g_changed_op, '-');
+
     teardown_cmd();
 }
 
@@ -355,11 +404,12 @@ TEST(cmd_dispatch_at_ourbot_works)
     int rc = cmd_dispatch(&ctx, "/start@testbot");
     ASSERT_EQ(rc, 1);
 
-    QueueMsg out;
+    QueueMsg out = {0};
     ASSERT_EQ(queue_pop(&out), 0);
     ASSERT(strstr(out.text, "Hello") != NULL);
 
     teardown_cmd();
+    queue_msg_release(&out);
 }
 
 int main(void)
@@ -0,0 +1,242 @@
+#define _POSIX_C_SOURCE 200809L
+#define _DEFAULT_SOURCE
+
+#include "test.h"
+#include "../src/config.h"
+#include "../src/context.h"
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define BIG_BUDGET 1000000
+
+static char g_buf[64 * 1024];
+static LlmMsg g_msgs[CONTEXT_MSGS_MAX];
+
+static int get_all(int64_t chat_id, int budget)
+{
+    return context_get(chat_id, budget, g_msgs, CONTEXT_MSGS_MAX, g_buf, sizeof(g_buf));
+}
+
+static void add_numbered(int64_t chat_id, int i, size_t pad)
+{
+    char user[2048];
+    char reply[2048];
+    snprintf(user, sizeof(user), "question %d %.*s", i, (int)pad,
+             "................................................................"
+             "................................................................");
+    snprintf(reply, sizeof(reply), "answer %d", i);
+    context_add_turn(chat_id, user, reply);
+}
+
+TEST(context_order_and_roles)
+{
+    ASSERT_EQ(context_init(16 * 1024, 1024 * 1024), 0);
+    ASSERT_EQ(get_all(1, BIG_BUDGET), 0);
+
+    ASSERT_EQ(context_add_turn(1, "hi", "hello"), 0);
+    ASSERT_EQ(context_add_turn(1, "how are you?", "fine"), 0);
+    ASSERT_EQ(context_add_turn(2, "other chat", "ok"), 0);
+
+    ASSERT_EQ(get_all(1, BIG_BUDGET), 4);
+    ASSERT_STR_EQ(g_msgs[0].role, "user");
+    ASSERT_STR_EQ(g_msgs[0].content, "hi");
+    ASSERT_STR_EQ(g_msgs[1].role, "assistant");
+    ASSERT_STR_EQ(g_msgs[1].content, "hello");
+    ASSERT_STR_EQ(g_msgs[2].content, "how are you?");
+    ASSERT_STR_EQ(g_msgs[3].content, "fine");
+
+    ASSERT_EQ(get_all(2, BIG_BUDGET), 2);
+    ASSERT_STR_EQ(g_msgs[0].content, "other chat");
+
+    context_forget(1);
+    ASSERT_EQ(get_all(1, BIG_BUDGET), 0);
+    ASSERT_EQ(get_all(2, BIG_BUDGET), 2);
+
+    // a buffer too small for the history is an error, not a partial copy
+    char small[8];
+    ASSERT_EQ(context_get(2, BIG_BUDGET, g_msgs, CONTEXT_MSGS_MAX, small, sizeof(small)), -1);
+    context_destroy();
+}
+
+// every request's history is the previous one plus a turn, except at a trim
+TEST(context_prefix_stable_across_turns)
+{
+    ASSERT_EQ(context_init(64 * 1024, 1024 * 1024), 0);
+
+    int budget = 400;
+    char prev[64][64];
+    int prev_n = 0;
+    int trims = 0;
+    for (int i = 0; i < 200; i++) {
+        int n = get_all(7, budget);
+        ASSERT(n >= 0 && n % 2 == 0);
+
+        int tokens = 0;
+        for (int k = 0; k < n; k++) {
+            tokens += context_estimate_tokens(strlen(g_msgs[k].content));
+        }
+        ASSERT(tokens <= budget);
+
+        int extends = n >= prev_n;
+        for (int k = 0; extends && k < prev_n; k++) {
+            extends = strcmp(g_msgs[k].content, prev[k]) == 0;
+        }
+        if (!extends) {
+            trims++;
+            // the trim cuts deep, so the next several turns repeat the prefix
+            ASSERT(n < prev_n);
+            ASSERT_STR_EQ(g_msgs[0].role, "user");
+        }
+        for (int k = 0; k < n && k < 64; k++) {
+            snprintf(prev[k], sizeof(prev[k]), "%s", g_msgs[k].content);
+        }
+        prev_n = n;
+
+        add_numbered(7, i, 20);
+    }
+    ASSERT(trims > 0);
+    ASSERT(trims < 200 / 4);
+    context_destroy();
+}
+
+// trimming to the budget leaves the newest turns and is remembered
+TEST(context_budget_trim_keeps_newest)
+{
+    ASSERT_EQ(context_init(64 * 1024, 1024 * 1024), 0);
+    for (int i = 0; i < 20; i++) {
+        add_numbered(3, i, 30);
+    }
+    ASSERT_EQ(get_all(3, BIG_BUDGET), 40);
+
+    int n = get_all(3, 100);
+    ASSERT(n > 0 && n < 40);
+    ASSERT_STR_EQ(g_msgs[n - 1].content, "answer 19");
+
+    // the trim persisted: a bigger budget does not bring old turns back
+    ASSERT_EQ(get_all(3, BIG_BUDGET), n);
+
+    // no room beside the request: nothing is sent and nothing is dropped
+    ASSERT_EQ(get_all(3, 0), 0);
+    ASSERT_EQ(get_all(3, BIG_BUDGET), n);
+    context_destroy();
+}
+
+TEST(context_per_chat_cap)
+{
+    ASSERT_EQ(context_init(2048, 1024 * 1024), 0);
+    for (int i = 0; i < 100; i++) {
+        add_numbered(5, i, 60);
+        ASSERT(context_bytes() <= 2048);
+    }
+    int n = get_all(5, BIG_BUDGET);
+    ASSERT(n >= 2);
+    ASSERT_STR_EQ(g_msgs[n - 1].content, "answer 99");
+
+    // a turn bigger than the whole cap forgets the chat
+    char huge[4096];
+    memset(huge, 'x', sizeof(huge) - 1);
+    huge[sizeof(huge) - 1] = '\0';
+    ASSERT_EQ(context_add_turn(5, huge, "ok"), -1);
+    ASSERT_EQ(get_all(5, BIG_BUDGET), 0);
+    context_destroy();
+}
+
+TEST(context_message_cap)
+{
+    ASSERT_EQ(context_init(64 * 1024, 1024 * 1024), 0);
+    for (int i = 0; i < CONTEXT_MSGS_MAX * 2; i++) {
+        ASSERT_EQ(context_add_turn(9, "q", "a"), 0);
+        ASSERT(get_all(9, BIG_BUDGET) <= CONTEXT_MSGS_MAX);
+    }
+    context_destroy();
+}
+
+// the global cap evicts the least recently active chats first
+TEST(context_global_lru)
+{
+    ASSERT_EQ(context_init(2048, 8 * 1024), 0);
+    for (int64_t chat = 1; chat <= 8; chat++) {
+        add_numbered(chat, 0, 60);
+    }
+    size_t per_chat = context_bytes() / 8;
+    ASSERT(per_chat > 0);
+
+    // fill every arena to near the cap, keeping chat 1 warm throughout
+    for (int i = 1; i < 20; i++) {
+        for (int64_t chat = 1; chat <= 8; chat++) {
+            add_numbered(chat, i, 60);
+            ASSERT(get_all(1, BIG_BUDGET) > 0);
+            ASSERT(context_bytes() <= 8 * 1024);
+        }
+    }
+    ASSERT(get_all(1, BIG_BUDGET) > 0);
+    ASSERT(get_all(8, BIG_BUDGET) > 0); // most recent writer
+    int gone = 0;
+    for (int64_t chat = 2; chat <= 7; chat++) {
+        gone += get_all(chat, BIG_BUDGET) == 0;
+    }
+    ASSERT(gone > 0);
+    context_destroy();
+}
+
+TEST(context_uninitialised)
+{
+    ASSERT_EQ(context_add_turn(1, "a", "b"), -1);
+    ASSERT_EQ(get_all(1, BIG_BUDGET), -1);
+    context_forget(1);
+    context_destroy();
+    ASSERT_EQ(context_init(100, 100), -1); // below the minimum arena
+}
+
+#define CC_THREADS 4
+#define CC_TURNS 2000
+
+static void *ctx_worker(void *arg)
+{
+    int id = (int)(intptr_t)arg;
+    LlmMsg msgs[CONTEXT_MSGS_MAX];
+    char *buf = malloc(context_chat_cap());
+    int bad = 0;
+    for (int i = 0; buf && i < CC_TURNS; i++) {
+        int64_t chat = (id + i) % 16;
+        char user[64];
+        snprintf(user, sizeof(user), "t%d m%d", id, i);
+        context_add_turn(chat, user, "reply");
+        int n = context_get(chat, 200, msgs, CONTEXT_MSGS_MAX, buf, context_chat_cap());
+        if (n < 0 || n % 2 != 0 || (n > 0 && strcmp(msgs[0].role, "user") != 0)) {
+            bad++;
+        }
+        if (i % 97 == 0) {
+            context_forget(chat);
+        }
+    }
+    free(buf);
+    return (void *)(intptr_t)bad;
+}
+
+TEST(context_concurrent)
+{
+    ASSERT_EQ(context_init(4096, 32 * 1024), 0);
+    pthread_t t[CC_THREADS];
+    for (int i = 0; i < CC_THREADS; i++) {
+        ASSERT_EQ(pthread_create(&t[i], NULL, ctx_worker, (void *)(intptr_t)i), 0);
+    }
+    int bad = 0;
+    for (int i = 0; i < CC_THREADS; i++) {
+        void *rv;
+        pthread_join(t[i], &rv);
+        bad += (int)(intptr_t)rv;
+    }
+    ASSERT_EQ(bad, 0);
+    ASSERT(context_bytes() <= 32 * 1024);
+    context_destroy();
+}
+
+int main(void)
+{
+    printf("=== test_context ===\n");
+    return test_summarise();
+}
@@ -0,0 +1,180 @@
+#define _POSIX_C_SOURCE 200809L
+#define _DEFAULT_SOURCE
+
+#include "test.h"
+#include "../src/ingress.h"
+
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// items are small integers, offset so none is NULL
+#define ITEM(n) ((void *)(uintptr_t)((n) + 1))
+#define ITEM_VAL(p) ((int)((uintptr_t)(p)-1))
+
+TEST(ingress_fifo_and_full)
+{
+    Ingress r;
+    ASSERT_EQ(ingress_init(&r, 5), 0); // rounds up to 8
+
+    for (int i = 0; i < 8; i++) {
+        ASSERT_EQ(ingress_push(&r, ITEM(i)), 0);
+    }
+    ASSERT_EQ(ingress_push(&r, ITEM(8)), -1);
+    ASSERT_EQ(ingress_depth(&r), 8);
+
+    for (int i = 0; i < 8; i++) {
+        void *p = ingress_pop(&r);
+        ASSERT_NOT_NULL(p);
+        ASSERT_EQ(ITEM_VAL(p), i);
+    }
+    ASSERT_NULL(ingress_try_pop(&r));
+    ASSERT_EQ(ingress_depth(&r), 0);
+
+    // cells are reusable after wrapping
+    for (int lap = 0; lap < 3; lap++) {
+        for (int i = 0; i < 8; i++) {
+            ASSERT_EQ(ingress_push(&r, ITEM(i)), 0);
+        }
+        for (int i = 0; i < 8; i++) {
+            ASSERT_EQ(ITEM_VAL(ingress_pop(&r)), i);
+        }
+    }
+
+    ASSERT_EQ(ingress_push(&r, NULL), -1);
+    ingress_destroy(&r);
+}
+
+// items pushed before close are still handed out, then NULL
+TEST(ingress_close_drains)
+{
+    Ingress r;
+    ASSERT_EQ(ingress_init(&r, 16), 0);
+    ASSERT_EQ(ingress_push(&r, ITEM(1)), 0);
+    ASSERT_EQ(ingress_push(&r, ITEM(2)), 0);
+    ingress_close(&r);
+    ASSERT_EQ(ingress_push(&r, ITEM(3)), -1);
+
+    ASSERT_EQ(ITEM_VAL(ingress_pop(&r)), 1);
+    ASSERT_EQ(ITEM_VAL(ingress_pop(&r)), 2);
+    ASSERT_NULL(ingress_pop(&r));
+    ASSERT_NULL(ingress_pop(&r)); // close is sticky
+    ingress_destroy(&r);
+}
+
+#define MP_PRODUCERS 4
+#define MP_PER_PRODUCER 20000
+
+typedef struct {
+    Ingress *r;
+    int id;
+    int dropped;
+} Producer;
+
+static void *producer_main(void *arg)
+{
+    Producer *p = (Producer *)arg;
+    for (int i = 0; i < MP_PER_PRODUCER; i++) {
+        int v = p->id * MP_PER_PRODUCER + i;
+        // spin on full, as an MHD thread would answer 503 and be retried
+        while (ingress_push(p->r, ITEM(v)) != 0) {
+            p->dropped++;
+            sched_yield();
+        }
+    }
+    return NULL;
+}
+
+typedef struct {
+    Ingress *r;
+    int count;
+    int last[MP_PRODUCERS];
+    int out_of_order;
+} Consumer;
+
+static void *consumer_main(void *arg)
+{
+    Consumer *c = (Consumer *)arg;
+    for (int i = 0; i < MP_PRODUCERS; i++) {
+        c->last[i] = -1;
+    }
+    void *item;
+    while ((item = ingress_pop(c->r)) != NULL) {
+        int v = ITEM_VAL(item);
+        int prod = v / MP_PER_PRODUCER;
+        int seq = v % MP_PER_PRODUCER;
+        if (seq <= c->last[prod]) {
+            c->out_of_order++;
+        }
+        c->last[prod] = seq;
+        c->count++;
+    }
+    return NULL;
+}
+
+// every item from every producer arrives once, in per-producer order
+TEST(ingress_multi_producer)
+{
+    Ingress r;
+    ASSERT_EQ(ingress_init(&r, 64), 0);
+
+    Consumer c;
+    memset(&c, 0, sizeof(c));
+    c.r = &r;
+    pthread_t ct;
+    ASSERT_EQ(pthread_create(&ct, NULL, consumer_main, &c), 0);
+
+    Producer prods[MP_PRODUCERS];
+    pthread_t pt[MP_PRODUCERS];
+    for (int i = 0; i < MP_PRODUCERS; i++) {
+        prods[i] = (Producer){.r = &r, .id = i};
+        ASSERT_EQ(pthread_create(&pt[i], NULL, producer_main, &prods[i]), 0);
+    }
+    for (int i = 0; i < MP_PRODUCERS; i++) {
+        pthread_join(pt[i], NULL);
+    }
+    ingress_close(&r);
+    pthread_join(ct, NULL);
+
+    ASSERT_EQ(c.count, MP_PRODUCERS * MP_PER_PRODUCER);
+    ASSERT_EQ(c.out_of_order, 0);
+    for (int i = 0; i < MP_PRODUCERS; i++) {
+        ASSERT_EQ(c.last[i], MP_PER_PRODUCER - 1);
+    }
+    ingress_destroy(&r);
+}
+
+// several consumers share the work and all exit on close
+TEST(ingress_multi_consumer_close)
+{
+    Ingress r;
+    ASSERT_EQ(ingress_init(&r, 32), 0);
+
+    Consumer cs[3];
+    pthread_t ct[3];
+    for (int i = 0; i < 3; i++) {
+        memset(&cs[i], 0, sizeof(cs[i]));
+        cs[i].r = &r;
+        ASSERT_EQ(pthread_create(&ct[i], NULL, consumer_main, &cs[i]), 0);
+    }
+
+    Producer p = {.r = &r, .id = 0};
+    producer_main(&p);
+    ingress_close(&r);
+
+    int total = 0;
+    for (int i = 0; i < 3; i++) {
+        pthread_join(ct[i], NULL);
+        total += cs[i].count;
+    }
+    ASSERT_EQ(total, MP_PER_PRODUCER);
+    ingress_destroy(&r);
+}
+
+int main(void)
+{
+    printf("=== test_ingress ===\n");
+    return test_summarise();
+}
@@ -0,0 +1,180 @@
+#include "test.h"
+#include "../src/jsonw.h"
+#include "../lib/cJSON.h"
+
+#include <stdio.h>
+#include <string.h>
+
+// helper: parse the writer's output back with cJSON
+static cJSON *reparse(JsonW *w)
+{
+    const char *out = jsonw_finish(w, NULL);
+    return out ? cJSON_Parse(out) : NULL;
+}
+
+TEST(jsonw_send_message_shape)
+{
+    JsonW w;
+    jsonw_init(&w);
+    jsonw_obj_begin(&w);
+    jsonw_kv_int(&w, "chat_id", -1001234567890LL);
+    jsonw_kv_str(&w, "text", "hello");
+    jsonw_obj_end(&w);
+
+    size_t len = 0;
+    const char *out = jsonw_finish(&w, &len);
+    ASSERT_NOT_NULL(out);
+    ASSERT_STR_EQ(out, "{\"chat_id\":-1001234567890,\"text\":\"hello\"}");
+    ASSERT_EQ(len, strlen(out));
+    jsonw_free(&w);
+}
+
+TEST(jsonw_nested_matches_cjson)
+{
+    JsonW w;
+    jsonw_init(&w);
+    jsonw_obj_begin(&w);
+    jsonw_kv_str(&w, "model", "qwen");
+    jsonw_kv_int(&w, "max_tokens", 512);
+    jsonw_kv_num(&w, "temperature", 0.7);
+    jsonw_kv_bool(&w, "stream", true);
+    jsonw_key(&w, "messages");
+    jsonw_arr_begin(&w);
+    for (int i = 0; i < 2; i++) {
+        jsonw_obj_begin(&w);
+        jsonw_kv_str(&w, "role", i ? "user" : "system");
+        jsonw_kv_str(&w, "content", i ? "hi" : "be brief");
+        jsonw_obj_end(&w);
+    }
+    jsonw_arr_end(&w);
+    jsonw_obj_end(&w);
+
+    // same document cJSON would have printed
+    cJSON *root = cJSON_CreateObject();
+    cJSON_AddStringToObject(root, "model", "qwen");
+    cJSON_AddNumberToObject(root, "max_tokens", 512);
+    cJSON_AddNumberToObject(root, "temperature", 0.7);
+    cJSON_AddBoolToObject(root, "stream", 1);
+    cJSON *msgs = cJSON_AddArrayToObject(root, "messages");
+    for (int i = 0; i < 2; i++) {
+        cJSON *m = cJSON_CreateObject();
+        cJSON_AddStringToObject(m, "role", i ? "user" : "system");
+        cJSON_AddStringToObject(m, "content", i ? "hi" : "be brief");
+        cJSON_AddItemToArray(msgs, m);
+    }
+    char *expect = cJSON_PrintUnformatted(root);
+    cJSON_Delete(root);
+
+    ASSERT_STR_EQ(jsonw_finish(&w, NULL), expect);
+    cJSON_free(expect);
+    jsonw_free(&w);
+}
+
+TEST(jsonw_escapes_round_trip)
+{
+    static const char tricky[] = "quote\" back\\ nl\n cr\r tab\t bs\b ff\f ctl\x01\x1f "
+                                 "utf8 \xC3\xA9\xE2\x9C\x8D /slash";
+    JsonW w;
+    jsonw_init(&w);
+    jsonw_obj_begin(&w);
+    jsonw_kv_str(&w, "text", tricky);
+    jsonw_obj_end(&w);
+
+    ASSERT_NOT_NULL(strstr(jsonw_finish(&w, NULL), "\\u0001\\u001f"));
+    cJSON *root = reparse(&w);
+    ASSERT_NOT_NULL(root);
+    const cJSON *text = cJSON_GetObjectItemCaseSensitive(root, "text");
+    ASSERT(cJSON_IsString(text));
+    ASSERT_STR_EQ(text->valuestring, tricky);
+    cJSON_Delete(root);
+    jsonw_free(&w);
+}
+
+TEST(jsonw_numbers)
+{
+    JsonW w;
+    jsonw_init(&w);
+    jsonw_arr_begin(&w);
+    jsonw_int(&w, INT64_MIN);
+    jsonw_int(&w, INT64_MAX);
+    jsonw_num(&w, 0.1);
+    jsonw_num(&w, 1.0 / 3.0);
+    jsonw_bool(&w, false);
+    jsonw_arr_end(&w);
+    ASSERT_STR_EQ(jsonw_finish(&w, NULL),
+                  "[-9223372036854775808,9223372036854775807,0.1,0.33333333333333331,false]");
+    jsonw_free(&w);
+}
+
+TEST(jsonw_reset_reuses_buffer)
+{
+    JsonW w;
+    jsonw_init(&w);
+    char big[3000];
+    memset(big, 'x', sizeof(big) - 1);
+    big[sizeof(big) - 1] = '\0';
+
+    jsonw_obj_begin(&w);
+    jsonw_kv_str(&w, "text", big);
+    jsonw_obj_end(&w);
+    ASSERT_NOT_NULL(jsonw_finish(&w, NULL));
+    char *buf = w.buf;
+    size_t cap = w.cap;
+
+    // later, smaller documents encode into the same allocation
+    for (int i = 0; i < 100; i++) {
+        jsonw_reset(&w);
+        jsonw_obj_begin(&w);
+        jsonw_kv_int(&w, "chat_id", i);
+        jsonw_kv_str(&w, "text", "again");
+        jsonw_obj_end(&w);
+        ASSERT_NOT_NULL(jsonw_finish(&w, NULL));
+    }
+    ASSERT(w.buf == buf);
+    ASSERT_EQ(w.cap, cap);
+    ASSERT_STR_EQ(w.buf, "{\"chat_id\":99,\"text\":\"again\"}");
+    jsonw_free(&w);
+}
+
+TEST(jsonw_errors_are_sticky)
+{
+    JsonW w;
+    jsonw_init(&w);
+
+    // unbalanced
+    jsonw_obj_begin(&w);
+    ASSERT_NULL(jsonw_finish(&w, NULL));
+
+    // key without value
+    jsonw_reset(&w);
+    jsonw_obj_begin(&w);
+    jsonw_key(&w, "dangling");
+    ASSERT_NULL(jsonw_finish(&w, NULL));
+
+    // close with nothing open
+    jsonw_reset(&w);
+    jsonw_obj_end(&w);
+    jsonw_obj_begin(&w);
+    jsonw_obj_end(&w);
+    ASSERT_NULL(jsonw_finish(&w, NULL));
+
+    // too deep
+    jsonw_reset(&w);
+    for (int i = 0; i < JSONW_MAX_DEPTH + 1; i++) {
+        jsonw_arr_begin(&w);
+    }
+    ASSERT_NULL(jsonw_finish(&w, NULL));
+
+    // reset clears the error
+    jsonw_reset(&w);
+    jsonw_arr_begin(&w);
+    jsonw_arr_end(&w);
+    ASSERT_STR_EQ(jsonw_finish(&w, NULL), "[]");
+    jsonw_free(&w);
+}
+
+int main(void)
+{
+    printf("=== test_jsonw ===\n");
+    return test_summarise();
+}
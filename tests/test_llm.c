@@ -1,7 +1,18 @@
+#define _DEFAULT_SOURCE
+
 #include "test.h"
+#include "http.h"
 #include "llm.h"
 
+#include <arpa/inet.h>
+#include <curl/curl.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdatomic.h>
 #include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
 
 // helper: copy string into mutable buffer and call llm_strip_think_tags
 static void strip(const char *input, char *out, size_t out_cap, size_t *out_len)
@@ -176,6 +187,313 @@ TEST(strip_realistic_model_output)
                   "but you can check your local weather service!");
 }
 
+// ── streaming think filter ───────────────────────────────────────────
+
+// helper: run input through the streaming filter in chunks of `step` bytes
+// and trim trailing whitespace like llm_strip_think_tags does
+static size_t stream_filter(const char *input, size_t step, char *out, size_t out_cap)
+{
+    LlmThinkFilter f;
+    llm_think_filter_init(&f);
+    size_t len = strlen(input);
+    size_t n = 0;
+    for (size_t i = 0; i < len; i += step) {
+        size_t chunk = (len - i < step) ? len - i : step;
+        n += llm_think_filter_feed(&f, input + i, chunk, out + n, out_cap - n);
+    }
+    n += llm_think_filter_finish(&f, out + n, out_cap - n);
+    while (n > 0 && (out[n - 1] == ' ' || out[n - 1] == '\n' || out[n - 1] == '\t' ||
+                     out[n - 1] == '\r')) {
+        n--;
+    }
+    out[n] = '\0';
+    return n;
+}
+
+TEST(stream_filter_matches_strip_any_split)
+{
+    static const char *cases[] = {
+        "Hello, world!",
+        "<think>reasoning</think>Answer",
+        "<think>\nstep\n</think>\n\nThe answer is 42.",
+        "Before<think/>After",
+        "Before<think />After",
+        "A<think>x</think>B<think>y</think>C",
+        "<THINK>upper</THINK>visible",
+        "x < y and <thin>tag</thin>",
+        "<<think>hidden</think>shown",
+        "<think>unclosed reasoning forever",
+        "text then <think",
+        "a </think> stray close",
+        "<think>a</thin></think>b",
+        "<think><think>nested</think>tail</think>",
+    };
+    for (size_t c = 0; c < sizeof(cases) / sizeof(cases[0]); c++) {
+        char expect[256];
+        snprintf(expect, sizeof(expect), "%s", cases[c]);
+        llm_strip_think_tags(expect);
+
+        for (size_t step = 1; step <= strlen(cases[c]); step++) {
+            char got[256];
+            stream_filter(cases[c], step, got, sizeof(got));
+            ASSERT_STR_EQ(got, expect);
+        }
+    }
+}
+
+TEST(stream_filter_holds_back_split_tag)
+{
+    LlmThinkFilter f;
+    llm_think_filter_init(&f);
+    char out[64];
+
+    // "<thi" could still become a tag, so nothing past "ok " is released yet
+    ASSERT_EQ(llm_think_filter_feed(&f, "ok <thi", 7, out, sizeof(out)), 3);
+    ASSERT_STR_EQ(out, "ok ");
+    ASSERT_EQ(llm_think_filter_feed(&f, "nk>secret</th", 13, out, sizeof(out)), 0);
+    ASSERT_EQ(llm_think_filter_feed(&f, "ink>done", 8, out, sizeof(out)), 4);
+    ASSERT_STR_EQ(out, "done");
+    ASSERT_EQ(llm_think_filter_finish(&f, out, sizeof(out)), 0);
+}
+
+TEST(stream_filter_output_bounded)
+{
+    LlmThinkFilter f;
+    llm_think_filter_init(&f);
+    char out[4];
+    ASSERT_EQ(llm_think_filter_feed(&f, "abcdef", 6, out, sizeof(out)), 3);
+    ASSERT_STR_EQ(out, "abc");
+}
+
+// ── SSE parser ───────────────────────────────────────────────────────
+
+static const char k_sse_body[] =
+    ": keep-alive\n"
+    "data: {\"choices\":[{\"delta\":{\"role\":\"assistant\"}}]}\n\n"
+    "data: {\"choices\":[{\"delta\":{\"content\":\"<think>plan\"}}]}\n\n"
+    "data: {\"choices\":[{\"delta\":{\"content\":\"</think>\\n\\nHel\"}}]}\r\n\r\n"
+    "data: {\"choices\":[{\"delta\":{\"content\":\"lo \\u00e9!\"}}]}\n\n"
+    "data: [DONE]\n\n";
+
+TEST(sse_parse_any_split)
+{
+    size_t len = strlen(k_sse_body);
+    for (size_t step = 1; step <= len; step++) {
+        LlmSse p;
+        llm_sse_init(&p);
+        char out[128];
+        size_t out_len = 0;
+        int rc = 0;
+        for (size_t i = 0; i < len && rc == 0; i += step) {
+            size_t chunk = (len - i < step) ? len - i : step;
+            rc = llm_sse_feed(&p, k_sse_body + i, chunk, out, sizeof(out), &out_len);
+        }
+        ASSERT_EQ(rc, 0);
+        ASSERT(p.done);
+        ASSERT_EQ(p.events, 5);
+        out[out_len] = '\0';
+        ASSERT_STR_EQ(out, "Hello \xC3\xA9!");
+        llm_sse_free(&p);
+    }
+}
+
+TEST(sse_parse_malformed_event)
+{
+    LlmSse p;
+    llm_sse_init(&p);
+    char out[64];
+    size_t out_len = 0;
+    const char *bad = "data: {\"choices\":[\n";
+    ASSERT_EQ(llm_sse_feed(&p, bad, strlen(bad), out, sizeof(out), &out_len), -1);
+    llm_sse_free(&p);
+
+    llm_sse_init(&p);
+    const char *err = "data: {\"error\":{\"message\":\"model not loaded\"}}\n";
+    ASSERT_EQ(llm_sse_feed(&p, err, strlen(err), out, sizeof(out), &out_len), -1);
+    llm_sse_free(&p);
+}
+
+TEST(sse_parse_plain_json_has_no_events)
+{
+    // a server that ignores "stream": true sends an ordinary completion
+    LlmSse p;
+    llm_sse_init(&p);
+    char out[64];
+    size_t out_len = 0;
+    const char *plain = "{\"choices\":[{\"message\":{\"content\":\"hi\"}}]}\n";
+    ASSERT_EQ(llm_sse_feed(&p, plain, strlen(plain), out, sizeof(out), &out_len), 0);
+    ASSERT_EQ(p.events, 0);
+    ASSERT_EQ(out_len, 0);
+    llm_sse_free(&p);
+}
+
+// the next turn's request starts with this turn's request, byte for byte
+TEST(encode_history_prefix_repeats)
+{
+    LlmMsg hist[4] = {
+        {"user", "hi"},
+        {"assistant", "hello \"there\""},
+        {"user", "and now?"},
+        {"assistant", "now this"},
+    };
+    JsonW a, b;
+    jsonw_init(&a);
+    jsonw_init(&b);
+    size_t len_a = 0, len_b = 0;
+    const char *body_a = llm_encode_request(&a, "m", "sys", hist, 2, "and now?", 256, 1, &len_a);
+    const char *body_b = llm_encode_request(&b, "m", "sys", hist, 4, "next", 256, 1, &len_b);
+    ASSERT_NOT_NULL(body_a);
+    ASSERT_NOT_NULL(body_b);
+    ASSERT(len_b > len_a);
+
+    // body_a ends "...}]}": everything before the closing brackets repeats
+    ASSERT_EQ(memcmp(body_a, body_b, len_a - 2), 0);
+    ASSERT(strstr(body_a, "\"role\":\"system\"") < strstr(body_a, "\"role\":\"assistant\""));
+
+    // no history encodes exactly like the single-turn request
+    size_t len_c = 0;
+    const char *body_c = llm_encode_request(&a, NULL, NULL, NULL, 0, "x", 32, 0, &len_c);
+    ASSERT_STR_EQ(body_c, "{\"max_tokens\":32,\"temperature\":0.7,"
+                          "\"messages\":[{\"role\":\"user\",\"content\":\"x\"}]}");
+    jsonw_free(&a);
+    jsonw_free(&b);
+}
+
+// ── submitted completions ────────────────────────────────────────────
+
+static const char HELD_REPLY[] =
+    "HTTP/1.1 200 OK\r\nContent-Type: application/json\r\n"
+    "Content-Length: 48\r\nConnection: close\r\n\r\n"
+    "{\"choices\":[{\"message\":{\"content\":\"hi there\"}}]}";
+
+#define HELD_WANT 3
+
+static atomic_int g_held; // requests open at once when the server answered
+
+// take requests until HELD_WANT are open (or 3s pass), then answer them all
+static void *held_server(void *arg)
+{
+    int fd = *(int *)arg;
+    int open_fds[HELD_WANT];
+    int n = 0;
+    while (n < HELD_WANT) {
+        struct pollfd p = {.fd = fd, .events = POLLIN};
+        if (poll(&p, 1, 3000) <= 0) {
+            break;
+        }
+        int c = accept(fd, NULL, NULL);
+        if (c < 0) {
+            break;
+        }
+        char req[4096];
+        size_t len = 0;
+        ssize_t r;
+        while (len < sizeof(req) - 1 && (r = recv(c, req + len, sizeof(req) - 1 - len, 0)) > 0) {
+            len += (size_t)r;
+            req[len] = '\0';
+            if (strstr(req, "\r\n\r\n") && strrchr(req, '}') > strstr(req, "\r\n\r\n")) {
+                break;
+            }
+        }
+        open_fds[n++] = c;
+    }
+    atomic_store(&g_held, n);
+    for (int i = 0; i < n; i++) {
+        ssize_t w = send(open_fds[i], HELD_REPLY, sizeof(HELD_REPLY) - 1, MSG_NOSIGNAL);
+        (void)w;
+        close(open_fds[i]);
+    }
+    return NULL;
+}
+
+static int listen_local(int *port)
+{
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (fd < 0) {
+        return -1;
+    }
+    struct sockaddr_in addr = {.sin_family = AF_INET, .sin_port = 0};
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    socklen_t len = sizeof(addr);
+    if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0 || listen(fd, 8) != 0 ||
+        getsockname(fd, (struct sockaddr *)&addr, &len) != 0) {
+        close(fd);
+        return -1;
+    }
+    *port = ntohs(addr.sin_port);
+    return fd;
+}
+
+static atomic_int g_ok;
+static atomic_int g_failed;
+
+static void count_done(int rc, void *ud)
+{
+    (void)ud;
+    atomic_fetch_add(rc == 0 ? &g_ok : &g_failed, 1);
+}
+
+static void wait_calls(int want)
+{
+    for (int i = 0; i < 500 && atomic_load(&g_ok) + atomic_load(&g_failed) < want; i++) {
+        usleep(10000);
+    }
+}
+
+// one handle on one thread keeps several completions in flight at once
+TEST(submit_keeps_several_in_flight)
+{
+    curl_global_init(CURL_GLOBAL_DEFAULT);
+    LlmHandle *llm = llm_init("http://127.0.0.1:1", NULL);
+    ASSERT_NOT_NULL(llm);
+    char out[HELD_WANT][64];
+    // no engine: refused, the caller goes blocking instead
+    ASSERT_EQ(llm_chat_submit(llm, NULL, NULL, 0, "x", out[0], sizeof(out[0]), 8,
+                              count_done, NULL), -1);
+
+    int port = 0;
+    int fd = listen_local(&port);
+    ASSERT(fd >= 0);
+    pthread_t srv;
+    ASSERT_EQ(pthread_create(&srv, NULL, held_server, &fd), 0);
+    ASSERT_EQ(http_engine_start(8), 0);
+    llm_cleanup(llm);
+    char ep[64];
+    snprintf(ep, sizeof(ep), "http://127.0.0.1:%d", port);
+    llm = llm_init(ep, NULL);
+    ASSERT_NOT_NULL(llm);
+
+    atomic_store(&g_ok, 0);
+    atomic_store(&g_failed, 0);
+    for (int i = 0; i < HELD_WANT; i++) {
+        LlmMsg hist[1] = {{"user", "earlier"}};
+        ASSERT_EQ(llm_chat_submit(llm, "sys", hist, 1, "prompt", out[i], sizeof(out[i]), 8,
+                                  count_done, NULL), 0);
+    }
+    wait_calls(HELD_WANT);
+    pthread_join(srv, NULL);
+    close(fd);
+    ASSERT_EQ(atomic_load(&g_held), HELD_WANT);
+    ASSERT_EQ(atomic_load(&g_ok), HELD_WANT);
+    for (int i = 0; i < HELD_WANT; i++) {
+        ASSERT_STR_EQ(out[i], "hi there");
+    }
+
+    // nothing listening: reported through done, with the error text
+    llm_cleanup(llm);
+    llm = llm_init("http://127.0.0.1:1", NULL);
+    ASSERT_NOT_NULL(llm);
+    ASSERT_EQ(llm_chat_submit(llm, NULL, NULL, 0, "x", out[0], sizeof(out[0]), 8,
+                              count_done, NULL), 0);
+    wait_calls(HELD_WANT + 1);
+    ASSERT_EQ(atomic_load(&g_failed), 1);
+    ASSERT_STR_EQ(out[0], "[llm error: request failed]");
+
+    http_engine_stop();
+    llm_cleanup(llm);
+    curl_global_cleanup();
+}
+
 int main(void)
 {
     printf("test_llm\n");
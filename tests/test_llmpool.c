@@ -0,0 +1,312 @@
+#define _POSIX_C_SOURCE 200809L
+#define _DEFAULT_SOURCE
+
+#include "test.h"
+#include "../src/config.h"
+#include "../src/llmpool.h"
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+static bool is_ejected(int idx)
+{
+    LlmPoolStats st;
+    return llm_pool_stats(idx, &st) == 0 && st.ejected;
+}
+
+TEST(pool_parse_list)
+{
+    ASSERT_EQ(llm_pool_size(), 0);
+    ASSERT_EQ(llm_pool_acquire(-1), -1); // not initialised
+
+    ASSERT_EQ(llm_pool_init(" http://a:1234/ ,http://b:1234,, http://c:1234 "), 3);
+    ASSERT_EQ(llm_pool_size(), 3);
+    ASSERT_STR_EQ(llm_pool_url(0), "http://a:1234/v1/chat/completions");
+    ASSERT_STR_EQ(llm_pool_url(1), "http://b:1234/v1/chat/completions");
+    ASSERT_STR_EQ(llm_pool_url(2), "http://c:1234/v1/chat/completions");
+    ASSERT_NULL(llm_pool_url(3));
+    ASSERT_NULL(llm_pool_url(-1));
+
+    // a bad list leaves the previous pool alone
+    ASSERT_EQ(llm_pool_init(" , ,"), -1);
+    ASSERT_EQ(llm_pool_size(), 3);
+
+    char many[LLM_POOL_MAX * 16 + 16] = "";
+    for (int i = 0; i <= LLM_POOL_MAX; i++) {
+        char one[16];
+        snprintf(one, sizeof(one), "http://h%d,", i);
+        strcat(many, one);
+    }
+    ASSERT_EQ(llm_pool_init(many), -1);
+
+    ASSERT_EQ(llm_pool_init("http://solo:1234"), 1);
+    ASSERT_EQ(llm_pool_size(), 1);
+    llm_pool_destroy();
+    ASSERT_EQ(llm_pool_size(), 0);
+}
+
+TEST(pool_parse_bases)
+{
+    char bases[3][LLM_POOL_BASE_MAX];
+    ASSERT_EQ(llm_pool_parse("\thttp://a:1//, ,http://b", bases, 3), 2);
+    ASSERT_STR_EQ(bases[0], "http://a:1");
+    ASSERT_STR_EQ(bases[1], "http://b");
+    ASSERT_EQ(llm_pool_parse("", bases, 3), 0);
+    ASSERT_EQ(llm_pool_parse("http://a,http://b,http://c,http://d", bases, 3), -1);
+
+    char longest[LLM_POOL_BASE_MAX + 1];
+    memset(longest, 'x', sizeof(longest) - 1);
+    longest[sizeof(longest) - 1] = '\0';
+    ASSERT_EQ(llm_pool_parse(longest, bases, 3), -1);
+    longest[LLM_POOL_BASE_MAX - 1] = '\0'; // fits with its NUL
+    ASSERT_EQ(llm_pool_parse(longest, bases, 3), 1);
+}
+
+TEST(pool_least_outstanding)
+{
+    ASSERT_EQ(llm_pool_init("http://a,http://b,http://c"), 3);
+
+    // three requests in flight land on three different backends
+    int a = llm_pool_acquire(-1);
+    int b = llm_pool_acquire(-1);
+    int c = llm_pool_acquire(-1);
+    ASSERT(a != b && b != c && a != c);
+
+    // the one that finishes first gets the next request
+    llm_pool_release(b, true, 0.1);
+    ASSERT_EQ(llm_pool_acquire(-1), b);
+
+    llm_pool_release(a, true, 0.1);
+    llm_pool_release(b, true, 0.1);
+    llm_pool_release(c, true, 0.1);
+
+    LlmPoolStats st;
+    ASSERT_EQ(llm_pool_stats(b, &st), 0);
+    ASSERT_EQ(st.inflight, 0);
+    ASSERT_EQ(st.requests, 2);
+    ASSERT(st.latency > 0.0);
+    ASSERT_EQ(llm_pool_stats(3, &st), -1);
+
+    // with equal load the faster backend wins
+    ASSERT_EQ(llm_pool_init("http://a,http://b"), 2);
+    llm_pool_release(llm_pool_acquire(-1), true, 0.5);
+    llm_pool_release(llm_pool_acquire(-1), true, 0.5);
+    int fast = llm_pool_acquire(-1);
+    llm_pool_release(fast, true, 0.1);
+    for (int i = 0; i < 4; i++) {
+        int pick = llm_pool_acquire(-1);
+        ASSERT_EQ(pick, fast);
+        llm_pool_release(pick, true, 0.1);
+    }
+    llm_pool_destroy();
+}
+
+TEST(pool_eject_after_failures)
+{
+    ASSERT_EQ(llm_pool_init("http://a,http://b"), 2);
+
+    for (int i = 0; i < LLM_POOL_FAIL_MAX - 1; i++) {
+        llm_pool_release(0, false, 0.0);
+    }
+    ASSERT(!is_ejected(0));
+    // a success in between resets the count
+    llm_pool_release(0, true, 0.1);
+    for (int i = 0; i < LLM_POOL_FAIL_MAX - 1; i++) {
+        llm_pool_release(0, false, 0.0);
+    }
+    ASSERT(!is_ejected(0));
+    llm_pool_release(0, false, 0.0);
+    ASSERT(is_ejected(0));
+
+    // every request now goes to the healthy backend
+    for (int i = 0; i < 5; i++) {
+        int pick = llm_pool_acquire(-1);
+        ASSERT_EQ(pick, 1);
+        llm_pool_release(pick, true, 0.1);
+    }
+
+    LlmPoolStats st;
+    ASSERT_EQ(llm_pool_stats(0, &st), 0);
+    ASSERT_EQ(st.failures, LLM_POOL_FAIL_MAX * 2 - 1);
+    llm_pool_destroy();
+}
+
+TEST(pool_avoid_and_fail_open)
+{
+    ASSERT_EQ(llm_pool_init("http://a,http://b"), 2);
+
+    // a retry passes over the backend that just failed it
+    int first = llm_pool_acquire(-1);
+    int second = llm_pool_acquire(first);
+    ASSERT(second != first);
+    llm_pool_release(first, true, 0.1);
+    llm_pool_release(second, true, 0.1);
+
+    // ... unless nothing else is available
+    for (int i = 0; i < LLM_POOL_FAIL_MAX; i++) {
+        llm_pool_release(1, false, 0.0);
+    }
+    ASSERT(is_ejected(1));
+    int pick = llm_pool_acquire(0);
+    ASSERT_EQ(pick, 0);
+    llm_pool_release(pick, true, 0.1);
+
+    // with everything ejected the pool still answers
+    for (int i = 0; i < LLM_POOL_FAIL_MAX; i++) {
+        llm_pool_release(0, false, 0.0);
+    }
+    ASSERT(is_ejected(0));
+    pick = llm_pool_acquire(-1);
+    ASSERT(pick == 0 || pick == 1);
+    llm_pool_release(pick, false, 0.0);
+    llm_pool_destroy();
+}
+
+TEST(pool_slow_backend_ejected)
+{
+    ASSERT_EQ(llm_pool_init("http://a,http://b"), 2);
+    llm_pool_release(llm_pool_acquire(-1), true, 0.5);
+    llm_pool_release(llm_pool_acquire(-1), true, 0.5);
+
+    // backend 1 starts answering far slower than backend 0
+    for (int i = 0; i < 20 && !is_ejected(1); i++) {
+        ASSERT_EQ(llm_pool_acquire(0), 1);
+        llm_pool_release(1, true, LLM_POOL_SLOW_MIN_SEC * LLM_POOL_SLOW_FACTOR * 2.0);
+    }
+    ASSERT(is_ejected(1));
+    ASSERT(!is_ejected(0));
+
+    // requests it was already serving do not clear it
+    llm_pool_release(1, true, 0.1);
+    ASSERT(is_ejected(1));
+    ASSERT_EQ(llm_pool_acquire(-1), 0);
+    llm_pool_release(0, true, 0.5);
+    llm_pool_destroy();
+}
+
+// ── active checks ────────────────────────────────────────────────────
+
+static const char OK_REPLY[] =
+    "HTTP/1.1 200 OK\r\nContent-Type: application/json\r\n"
+    "Content-Length: 11\r\nConnection: close\r\n\r\n{\"data\":[]}";
+
+// answer every connection with 200 until the listening socket is shut down
+static void *health_server(void *arg)
+{
+    int fd = *(int *)arg;
+    for (;;) {
+        int c = accept(fd, NULL, NULL);
+        if (c < 0) {
+            break;
+        }
+        char req[1024];
+        ssize_t n = recv(c, req, sizeof(req), 0);
+        (void)n;
+        ssize_t w = send(c, OK_REPLY, sizeof(OK_REPLY) - 1, MSG_NOSIGNAL);
+        (void)w;
+        close(c);
+    }
+    return NULL;
+}
+
+static int listen_local(int *port)
+{
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (fd < 0) {
+        return -1;
+    }
+    struct sockaddr_in addr = {.sin_family = AF_INET, .sin_port = 0};
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    socklen_t len = sizeof(addr);
+    if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0 || listen(fd, 8) != 0 ||
+        getsockname(fd, (struct sockaddr *)&addr, &len) != 0) {
+        close(fd);
+        return -1;
+    }
+    *port = ntohs(addr.sin_port);
+    return fd;
+}
+
+TEST(pool_probe_reinstates)
+{
+    int port = 0;
+    int fd = listen_local(&port);
+    ASSERT(fd >= 0);
+    pthread_t srv;
+    ASSERT_EQ(pthread_create(&srv, NULL, health_server, &fd), 0);
+
+    // port 1 refuses connections
+    char list[128];
+    snprintf(list, sizeof(list), "http://127.0.0.1:%d, http://127.0.0.1:1", port);
+    ASSERT_EQ(llm_pool_init(list), 2);
+
+    for (int i = 0; i < LLM_POOL_FAIL_MAX; i++) {
+        llm_pool_release(0, false, 0.0);
+    }
+    ASSERT(is_ejected(0));
+
+    llm_pool_check();
+    ASSERT(!is_ejected(0)); // answered its probe, back before the backoff ends
+    for (int i = 0; i < LLM_POOL_FAIL_MAX - 1; i++) {
+        llm_pool_check();
+    }
+    ASSERT(!is_ejected(0));
+    ASSERT(is_ejected(1)); // failed every probe
+
+    // the prober thread starts and stops cleanly
+    ASSERT_EQ(llm_pool_start_probe(1), 0);
+    ASSERT_EQ(llm_pool_start_probe(1), -1);
+    llm_pool_destroy();
+
+    shutdown(fd, SHUT_RDWR);
+    close(fd);
+    pthread_join(srv, NULL);
+}
+
+// ── concurrency ──────────────────────────────────────────────────────
+
+#define PC_THREADS 4
+#define PC_OPS 20000
+
+static void *pool_worker(void *arg)
+{
+    int id = (int)(intptr_t)arg;
+    for (int i = 0; i < PC_OPS; i++) {
+        int be = llm_pool_acquire(-1);
+        llm_pool_release(be, (i + id) % 50 != 0, 0.01 * (double)(be + 1));
+    }
+    return NULL;
+}
+
+TEST(pool_concurrent)
+{
+    ASSERT_EQ(llm_pool_init("http://a,http://b,http://c"), 3);
+    pthread_t t[PC_THREADS];
+    for (int i = 0; i < PC_THREADS; i++) {
+        ASSERT_EQ(pthread_create(&t[i], NULL, pool_worker, (void *)(intptr_t)i), 0);
+    }
+    for (int i = 0; i < PC_THREADS; i++) {
+        pthread_join(t[i], NULL);
+    }
+
+    unsigned long total = 0;
+    for (int i = 0; i < 3; i++) {
+        LlmPoolStats st;
+        ASSERT_EQ(llm_pool_stats(i, &st), 0);
+        ASSERT_EQ(st.inflight, 0);
+        total += st.requests;
+    }
+    ASSERT_EQ(total, (unsigned long)PC_THREADS * PC_OPS);
+    llm_pool_destroy();
+}
+
+int main(void)
+{
+    printf("=== test_llmpool ===\n");
+    return test_summarise();
+}
@@ -1,9 +1,11 @@
 #define _POSIX_C_SOURCE 200809L
+#define _GNU_SOURCE // memmem
 
 #include "test.h"
 #include "../src/logger.h"
 
 #include <errno.h>
+#include <fcntl.h>
 #include <pthread.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -64,6 +66,27 @@ static int count_substr(const char *haystack, const char *needle)
     return count;
 }
 
+// run a reader with stdout redirected to a file; returns what it printed
+static char *capture_reader(const char *path, int n, long since)
+{
+    char out_path[300];
+    snprintf(out_path, sizeof(out_path), "%s.out", path);
+    fflush(stdout);
+    int saved = dup(STDOUT_FILENO);
+    int fd = open(out_path, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+    dup2(fd, STDOUT_FILENO);
+    close(fd);
+    int rc = since >= 0 ? log_read_since(path, since) : log_read_last_n(path, n);
+    fflush(stdout);
+    dup2(saved, STDOUT_FILENO);
+    close(saved);
+
+    size_t len;
+    char *buf = rc == 0 ? read_file_contents(out_path, &len) : NULL;
+    unlink(out_path);
+    return buf;
+}
+
 // tests
 TEST(basic_write_and_read)
 {
@@ -346,6 +369,315 @@ TEST(init_rejects_tiny_cap)
     cleanup_file(path);
 }
 
+// async mode
+TEST(async_lines_reach_file_after_flush)
+{
+    const char *path = tmp_log_path();
+    ASSERT_EQ(log_init(path, 65536), 0);
+    log_set_level(LOG_DEBUG);
+    ASSERT_EQ(log_start_async(64), 0);
+
+    log_info("async one");
+    log_info("async two");
+    log_flush();
+
+    size_t len;
+    char *buf = read_file_contents(path, &len);
+    ASSERT_NOT_NULL(buf);
+    char *one = strstr(buf, "async one");
+    char *two = strstr(buf, "async two");
+    ASSERT_NOT_NULL(one);
+    ASSERT_NOT_NULL(two);
+    ASSERT(one < two);
+    free(buf);
+
+    log_close();
+    cleanup_file(path);
+}
+
+// a line too long for a ring cell goes inline, after the lines queued before it
+TEST(async_long_line_keeps_order)
+{
+    const char *path = tmp_log_path();
+    ASSERT_EQ(log_init(path, 65536), 0);
+    log_set_level(LOG_DEBUG);
+    ASSERT_EQ(log_start_async(64), 0);
+
+    char big[1500];
+    memset(big, 'x', sizeof(big) - 1);
+    big[sizeof(big) - 1] = '\0';
+    log_info("before long");
+    log_info("long %s", big);
+    log_info("after long");
+    log_close();
+
+    size_t len;
+    char *buf = read_file_contents(path, &len);
+    ASSERT_NOT_NULL(buf);
+    char *a = strstr(buf, "before long");
+    char *b = strstr(buf, "long xxx");
+    char *c = strstr(buf, "after long");
+    ASSERT(a && b && c);
+    ASSERT(a < b && b < c);
+    free(buf);
+    cleanup_file(path);
+}
+
+// a ring far smaller than the burst still loses nothing
+TEST(async_full_ring_drops_nothing)
+{
+    const char *path = tmp_log_path();
+    ASSERT_EQ(log_init(path, 1024 * 1024), 0);
+    log_set_level(LOG_DEBUG);
+    ASSERT_EQ(log_start_async(2), 0);
+
+    for (int i = 0; i < 2000; i++) {
+        log_info("burst %04d", i);
+    }
+    log_close();
+
+    size_t len;
+    char *buf = read_file_contents(path, &len);
+    ASSERT_NOT_NULL(buf);
+    ASSERT_EQ(count_substr(buf, "] burst "), 2000);
+    // file order follows call order
+    char *p = buf;
+    int in_order = 1;
+    for (int i = 0; i < 2000 && in_order; i++) {
+        char want[32];
+        snprintf(want, sizeof(want), "burst %04d", i);
+        char *q = strstr(p, want);
+        in_order = q != NULL;
+        p = q ? q : p;
+    }
+    ASSERT(in_order);
+    free(buf);
+    cleanup_file(path);
+}
+
+// batched writes keep the cap and the single-marker invariant under contention
+TEST(async_concurrent_wrap)
+{
+    const char *path = tmp_log_path();
+    size_t cap = 8192;
+    ASSERT_EQ(log_init(path, cap), 0);
+    log_set_level(LOG_DEBUG);
+    ASSERT_EQ(log_start_async(256), 0);
+
+    pthread_t threads[THREAD_COUNT];
+    int ids[THREAD_COUNT];
+    for (int i = 0; i < THREAD_COUNT; i++) {
+        ids[i] = i;
+        pthread_create(&threads[i], NULL, writer_thread, &ids[i]);
+    }
+    for (int i = 0; i < THREAD_COUNT; i++) {
+        pthread_join(threads[i], NULL);
+    }
+    log_close();
+
+    size_t len;
+    char *buf = read_file_contents(path, &len);
+    ASSERT_NOT_NULL(buf);
+    ASSERT(len <= cap);
+    ASSERT(count_substr(buf, MARKER) == 1);
+    free(buf);
+
+    // the recovered position continues cleanly in synchronous mode
+    ASSERT_EQ(log_init(path, cap), 0);
+    log_info("after async reopen");
+    log_close();
+    buf = read_file_contents(path, &len);
+    ASSERT_NOT_NULL(buf);
+    ASSERT(strstr(buf, "after async reopen") != NULL);
+    ASSERT(count_substr(buf, MARKER) == 1);
+    free(buf);
+    cleanup_file(path);
+}
+
+// mmap mode
+TEST(mmap_fixed_size_with_header)
+{
+    const char *path = tmp_log_path();
+    size_t cap = 4096;
+    ASSERT_EQ(log_init_mmap(path, cap), 0);
+    log_set_level(LOG_DEBUG);
+    log_info("mapped hello");
+    log_close();
+
+    size_t len;
+    char *buf = read_file_contents(path, &len);
+    ASSERT_NOT_NULL(buf);
+    ASSERT_EQ(len, cap);
+    ASSERT(memcmp(buf, "#TGBLOG\n", 8) == 0);
+    ASSERT(memmem(buf, len, "[INFO ] mapped hello\n", 21) != NULL);
+    ASSERT_EQ(log_read_last_n(path, 1), 0);
+    free(buf);
+    cleanup_file(path);
+}
+
+TEST(mmap_wrap_and_recover)
+{
+    const char *path = tmp_log_path();
+    size_t cap = 2048;
+    for (int cycle = 0; cycle < 3; cycle++) {
+        ASSERT_EQ(log_init_mmap(path, cap), 0);
+        log_set_level(LOG_DEBUG);
+        for (int i = 0; i < 100; i++) {
+            log_info("cycle %d line %04d pad pad pad pad pad pad", cycle, i);
+        }
+        log_close();
+
+        size_t len;
+        char *buf = read_file_contents(path, &len);
+        ASSERT_NOT_NULL(buf);
+        ASSERT_EQ(len, cap);
+        ASSERT_EQ(count_substr(buf + 64, MARKER), 1);
+        // the newest line sits right before the marker
+        char *m = strstr(buf + 64, MARKER);
+        char want[64];
+        snprintf(want, sizeof(want), "cycle %d line 0099 pad pad pad pad pad pad\n", cycle);
+        size_t wl = strlen(want);
+        ASSERT((size_t)(m - buf) >= wl && memcmp(m - wl, want, wl) == 0);
+        free(buf);
+    }
+    ASSERT_EQ(log_read_last_n(path, 3), 0);
+    cleanup_file(path);
+}
+
+// a stdio log is kept as <path>.1 rather than overwritten
+TEST(mmap_moves_old_format_aside)
+{
+    const char *path = tmp_log_path();
+    ASSERT_EQ(log_init(path, 4096), 0);
+    log_info("old format line");
+    log_close();
+
+    ASSERT_EQ(log_init_mmap(path, 4096), 0);
+    log_info("new format line");
+    log_close();
+
+    char old[300];
+    snprintf(old, sizeof(old), "%s.1", path);
+    size_t len;
+    char *buf = read_file_contents(old, &len);
+    ASSERT_NOT_NULL(buf);
+    ASSERT(strstr(buf, "old format line") != NULL);
+    free(buf);
+
+    buf = read_file_contents(path, &len);
+    ASSERT_NOT_NULL(buf);
+    ASSERT(memmem(buf, len, "new format line", 15) != NULL);
+    ASSERT(memmem(buf, len, "old format line", 15) == NULL);
+    free(buf);
+    cleanup_file(old);
+    cleanup_file(path);
+}
+
+TEST(mmap_async_concurrent)
+{
+    const char *path = tmp_log_path();
+    size_t cap = 8192;
+    ASSERT_EQ(log_init_mmap(path, cap), 0);
+    log_set_level(LOG_DEBUG);
+    ASSERT_EQ(log_start_async(128), 0);
+
+    pthread_t threads[THREAD_COUNT];
+    int ids[THREAD_COUNT];
+    for (int i = 0; i < THREAD_COUNT; i++) {
+        ids[i] = i;
+        pthread_create(&threads[i], NULL, writer_thread, &ids[i]);
+    }
+    for (int i = 0; i < THREAD_COUNT; i++) {
+        pthread_join(threads[i], NULL);
+    }
+    log_close();
+
+    size_t len;
+    char *buf = read_file_contents(path, &len);
+    ASSERT_NOT_NULL(buf);
+    ASSERT_EQ(len, cap);
+    ASSERT_EQ(count_substr(buf + 64, MARKER), 1);
+    free(buf);
+    cleanup_file(path);
+}
+
+// the reverse reader returns exactly the newest n lines, oldest first
+TEST(read_last_n_exact_after_wrap)
+{
+    const char *path = tmp_log_path();
+    ASSERT_EQ(log_init(path, 2048), 0);
+    log_set_level(LOG_DEBUG);
+    for (int i = 0; i < 200; i++) {
+        log_info("seq %04d pad pad pad pad pad pad pad", i);
+    }
+    log_close();
+
+    char *out = capture_reader(path, 3, -1);
+    ASSERT_NOT_NULL(out);
+    ASSERT_EQ(count_substr(out, "\n"), 3);
+    char *a = strstr(out, "seq 0197");
+    char *b = strstr(out, "seq 0198");
+    char *c = strstr(out, "seq 0199");
+    ASSERT(a && b && c && a < b && b < c);
+    ASSERT(strstr(out, MARKER) == NULL);
+    free(out);
+    cleanup_file(path);
+}
+
+TEST(read_last_n_mmap_more_than_present)
+{
+    const char *path = tmp_log_path();
+    ASSERT_EQ(log_init_mmap(path, 16384), 0);
+    log_set_level(LOG_DEBUG);
+    for (int i = 0; i < 10; i++) {
+        log_info("mm %d", i);
+    }
+    log_close();
+
+    char *out = capture_reader(path, 1000, -1);
+    ASSERT_NOT_NULL(out);
+    ASSERT_EQ(count_substr(out, "] mm "), 10);
+    ASSERT(strncmp(out, "[", 1) == 0);
+    ASSERT(strstr(out, "#TGBLOG") == NULL);
+    free(out);
+    cleanup_file(path);
+}
+
+// --since skips lines older than the window without reading them all
+TEST(read_since_skips_old_lines)
+{
+    const char *path = tmp_log_path();
+    FILE *fp = fopen(path, "wb");
+    ASSERT_NOT_NULL(fp);
+    for (int i = 0; i < 500; i++) {
+        fprintf(fp, "[2020-01-01 00:%02d:%02d] [INFO ] ancient %03d\n", i / 60 % 60, i % 60, i);
+        if (i % 100 == 0) {
+            fprintf(fp, "unstamped continuation\n");
+        }
+    }
+    fclose(fp);
+
+    ASSERT_EQ(log_init(path, 1024 * 1024), 0);
+    log_info("fresh one");
+    log_info("fresh two");
+    log_close();
+
+    char *out = capture_reader(path, 0, 600);
+    ASSERT_NOT_NULL(out);
+    ASSERT(strstr(out, "ancient") == NULL);
+    ASSERT(strstr(out, "fresh one") != NULL);
+    ASSERT(strstr(out, "fresh two") != NULL);
+    free(out);
+
+    // a window reaching back past everything prints the whole log
+    out = capture_reader(path, 0, 20L * 365 * 86400);
+    ASSERT_NOT_NULL(out);
+    ASSERT(strncmp(out, "[2020-01-01 00:00:00] [INFO ] ancient 000", 41) == 0);
+    ASSERT(strstr(out, "fresh two") != NULL);
+    free(out);
+    cleanup_file(path);
+}
+
 int main(void)
 {
     return test_summarise();
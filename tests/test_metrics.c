@@ -0,0 +1,205 @@
+#define _POSIX_C_SOURCE 200809L
+#define _DEFAULT_SOURCE
+
+#include "test.h"
+#include "../src/config.h"
+#include "../src/metrics.h"
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static double near(double got, double want)
+{
+    double d = got - want;
+    return (d < 0 ? -d : d) / want;
+}
+
+static double gauge_seven(void)
+{
+    return 7.0;
+}
+
+TEST(metrics_empty)
+{
+    metrics_reset();
+    ASSERT_EQ(metrics_count(MET_LLM), 0);
+    ASSERT(metrics_quantile(MET_LLM, 0.99) == 0.0);
+    ASSERT_EQ(metrics_counter(MET_QUEUE_DROPS), 0);
+    // out-of-range ids are ignored
+    metrics_observe(MET_STAGES, 1.0);
+    metrics_add(MET_COUNTERS, 1);
+    ASSERT(metrics_quantile(MET_STAGES, 0.5) == 0.0);
+    ASSERT_EQ(metrics_counter(MET_COUNTERS), 0);
+}
+
+TEST(metrics_quantiles_within_an_eighth)
+{
+    metrics_reset();
+    // 1 ms .. 1000 ms, one each: the q-quantile is q seconds
+    for (int i = 1; i <= 1000; i++) {
+        metrics_observe(MET_LLM, (double)i / 1000.0);
+    }
+    ASSERT_EQ(metrics_count(MET_LLM), 1000);
+    ASSERT(near(metrics_quantile(MET_LLM, 0.5), 0.5) <= 0.125);
+    ASSERT(near(metrics_quantile(MET_LLM, 0.9), 0.9) <= 0.125);
+    ASSERT(near(metrics_quantile(MET_LLM, 0.99), 0.99) <= 0.125);
+    // quantiles report a bucket's upper bound, so never under the true value
+    ASSERT(metrics_quantile(MET_LLM, 0.99) >= 0.99);
+    ASSERT(metrics_quantile(MET_LLM, 0.5) <= metrics_quantile(MET_LLM, 0.9));
+    // other stages are separate
+    ASSERT_EQ(metrics_count(MET_SEND), 0);
+}
+
+TEST(metrics_tiny_and_huge_values)
+{
+    metrics_reset();
+    metrics_observe(MET_SEND, 0.0);
+    metrics_observe(MET_SEND, -1.0); // clock step: counted as zero
+    metrics_observe(MET_SEND, 0.000005);
+    ASSERT_EQ(metrics_count(MET_SEND), 3);
+    ASSERT(metrics_quantile(MET_SEND, 0.5) == 0.0);
+    ASSERT(near(metrics_quantile(MET_SEND, 1.0), 0.000005) < 0.001);
+
+    // past the last bucket is clamped, not lost
+    metrics_observe(MET_QUEUE_WAIT, 1e9);
+    ASSERT_EQ(metrics_count(MET_QUEUE_WAIT), 1);
+    ASSERT(metrics_quantile(MET_QUEUE_WAIT, 0.5) > 60000.0);
+}
+
+TEST(metrics_counters_add)
+{
+    metrics_reset();
+    metrics_add(MET_QUEUE_DROPS, 1);
+    metrics_add(MET_QUEUE_DROPS, 2);
+    metrics_add(MET_RATELIMITED, 5);
+    ASSERT_EQ(metrics_counter(MET_QUEUE_DROPS), 3);
+    ASSERT_EQ(metrics_counter(MET_RATELIMITED), 5);
+    ASSERT_EQ(metrics_counter(MET_SEND_ERRORS), 0);
+}
+
+TEST(metrics_render_prometheus_text)
+{
+    metrics_reset();
+    metrics_observe(MET_QUEUE_WAIT, 0.25);
+    metrics_observe(MET_QUEUE_WAIT, 0.75);
+    metrics_add(MET_QUEUE_DROPS, 4);
+    ASSERT_EQ(metrics_gauge("tgbot_test_gauge", "A test gauge.", gauge_seven), 0);
+    ASSERT_EQ(metrics_gauge(NULL, "x", gauge_seven), -1);
+
+    char *buf = malloc(METRICS_TEXT_MAX);
+    ASSERT_NOT_NULL(buf);
+    size_t len = metrics_render(buf, METRICS_TEXT_MAX);
+    ASSERT_EQ(len, strlen(buf));
+    ASSERT_NOT_NULL(strstr(buf, "# TYPE tgbot_queue_wait_seconds summary\n"));
+    ASSERT_NOT_NULL(strstr(buf, "tgbot_queue_wait_seconds{quantile=\"0.99\"} "));
+    ASSERT_NOT_NULL(strstr(buf, "tgbot_queue_wait_seconds_sum 1.000000\n"));
+    ASSERT_NOT_NULL(strstr(buf, "tgbot_queue_wait_seconds_count 2\n"));
+    ASSERT_NOT_NULL(strstr(buf, "tgbot_llm_seconds_count 0\n"));
+    ASSERT_NOT_NULL(strstr(buf, "# TYPE tgbot_queue_drops_total counter\ntgbot_queue_drops_total 4\n"));
+    ASSERT_NOT_NULL(strstr(buf, "# TYPE tgbot_test_gauge gauge\ntgbot_test_gauge 7\n"));
+    ASSERT(buf[len - 1] == '\n');
+
+    // a short buffer truncates but stays terminated
+    char small[64];
+    len = metrics_render(small, sizeof(small));
+    ASSERT_EQ(len, sizeof(small) - 1);
+    ASSERT_EQ(strlen(small), len);
+    free(buf);
+}
+
+TEST(metrics_gauge_limit)
+{
+    metrics_reset();
+    for (int i = 0; i < METRICS_GAUGES_MAX; i++) {
+        ASSERT_EQ(metrics_gauge("tgbot_g", "", gauge_seven), 0);
+    }
+    ASSERT_EQ(metrics_gauge("tgbot_g", "", gauge_seven), -1);
+    metrics_reset();
+    ASSERT_EQ(metrics_gauge("tgbot_g", "", gauge_seven), 0);
+    metrics_reset();
+}
+
+#define THREADS 8
+#define PER_THREAD 20000
+
+static void *observer(void *arg)
+{
+    (void)arg;
+    for (int i = 0; i < PER_THREAD; i++) {
+        metrics_observe(MET_RATELIMIT_DELAY, 0.001);
+        metrics_add(MET_SEND_ERRORS, 1);
+    }
+    return NULL;
+}
+
+TEST(metrics_concurrent_shards_sum)
+{
+    metrics_reset();
+    pthread_t t[THREADS];
+    for (int i = 0; i < THREADS; i++) {
+        ASSERT_EQ(pthread_create(&t[i], NULL, observer, NULL), 0);
+    }
+    // scraping while the shards are written must not disturb them
+    char *buf = malloc(METRICS_TEXT_MAX);
+    ASSERT_NOT_NULL(buf);
+    for (int i = 0; i < 20; i++) {
+        metrics_render(buf, METRICS_TEXT_MAX);
+    }
+    free(buf);
+    for (int i = 0; i < THREADS; i++) {
+        pthread_join(t[i], NULL);
+    }
+    ASSERT_EQ(metrics_count(MET_RATELIMIT_DELAY), (uint64_t)THREADS * PER_THREAD);
+    ASSERT_EQ(metrics_counter(MET_SEND_ERRORS), (uint64_t)THREADS * PER_THREAD);
+    ASSERT(near(metrics_quantile(MET_RATELIMIT_DELAY, 0.999), 0.001) <= 0.125);
+}
+
+// one pool worker's lifetime: a few records, then it retires
+static void *short_lived(void *arg)
+{
+    (void)arg;
+    metrics_observe(MET_LLM, 0.002);
+    metrics_add(MET_LLM_ERRORS, 1);
+    return NULL;
+}
+
+static void *shards_held(void *arg)
+{
+    int *out = arg;
+    metrics_add(MET_LLM_ERRORS, 0);
+    *out = metrics_shards_live();
+    return NULL;
+}
+
+TEST(metrics_exited_threads_give_back_shards)
+{
+    metrics_reset();
+    int before = metrics_shards_live();
+    // many more thread lifetimes than there are shards
+    for (int i = 0; i < METRICS_SHARDS * 3; i++) {
+        pthread_t t;
+        ASSERT_EQ(pthread_create(&t, NULL, short_lived, NULL), 0);
+        pthread_join(t, NULL);
+    }
+    ASSERT_EQ(metrics_shards_live(), before);
+    // their counts were folded in, not lost
+    ASSERT_EQ(metrics_count(MET_LLM), (uint64_t)METRICS_SHARDS * 3);
+    ASSERT_EQ(metrics_counter(MET_LLM_ERRORS), (uint64_t)METRICS_SHARDS * 3);
+
+    // and the next thread still gets a shard of its own
+    int held = 0;
+    pthread_t t;
+    ASSERT_EQ(pthread_create(&t, NULL, shards_held, &held), 0);
+    pthread_join(t, NULL);
+    ASSERT_EQ(held, before + 1);
+    ASSERT_EQ(metrics_shards_live(), before);
+    metrics_reset();
+}
+
+int main(void)
+{
+    printf("=== test_metrics ===\n");
+    return test_summarise();
+}
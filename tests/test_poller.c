@@ -0,0 +1,248 @@
+#define _POSIX_C_SOURCE 200809L
+#define _DEFAULT_SOURCE
+// enable http
+#define TESTING
+
+#include "test.h"
+#include "../src/bot.h"
+#include "../src/config.h"
+#include "../src/poller.h"
+#include "../src/update.h"
+
+#include <pthread.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+// mock server, as in test_bot
+typedef struct {
+    pid_t pid;
+    int port;
+} MockServer;
+
+static MockServer start_mock(const char *scenario)
+{
+    MockServer ms = {.pid = -1, .port = 0};
+    int pipefd[2];
+    if (pipe(pipefd) != 0) {
+        return ms;
+    }
+    pid_t pid = fork();
+    if (pid < 0) {
+        close(pipefd[0]);
+        close(pipefd[1]);
+        return ms;
+    }
+    if (pid == 0) {
+        close(pipefd[0]);
+        dup2(pipefd[1], STDOUT_FILENO);
+        close(pipefd[1]);
+        if (scenario) {
+            execlp("python3", "python3", "mock_tg_server.py", "--scenario", scenario, NULL);
+        } else {
+            execlp("python3", "python3", "mock_tg_server.py", NULL);
+        }
+        _exit(127);
+    }
+    close(pipefd[1]);
+    // read the whole line: closing the pipe before the mock has written its
+    // newline kills it with EPIPE
+    char buf[32] = {0};
+    size_t got = 0;
+    while (got < sizeof(buf) - 1 && !memchr(buf, '\n', got)) {
+        ssize_t n = read(pipefd[0], buf + got, sizeof(buf) - 1 - got);
+        if (n <= 0) {
+            break;
+        }
+        got += (size_t)n;
+    }
+    close(pipefd[0]);
+    ms.port = atoi(buf);
+    ms.pid = pid;
+    usleep(200000);
+    return ms;
+}
+
+static void stop_mock(MockServer *ms)
+{
+    if (ms->pid > 0) {
+        kill(ms->pid, SIGTERM);
+        int status;
+        waitpid(ms->pid, &status, 0);
+        ms->pid = -1;
+    }
+}
+
+static BotHandle *make_test_bot(int port, volatile sig_atomic_t *running)
+{
+    BotHandle *bot = bot_init("TESTTOKEN123");
+    if (!bot) {
+        return NULL;
+    }
+    char base[128];
+    snprintf(base, sizeof(base), "http://127.0.0.1:%d/bot", port);
+    bot_set_api_base(bot, base);
+    bot_set_allow_http(bot, 1);
+    bot_set_abort_flag(bot, running);
+    return bot;
+}
+
+static double now_sec(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+static volatile sig_atomic_t g_running;
+
+// drop the run flag after a short delay, like SIGTERM would
+static void *stopper(void *arg)
+{
+    (void)arg;
+    usleep(500000);
+    g_running = 0;
+    return NULL;
+}
+
+// tests
+
+TEST(poller_backoff_schedule)
+{
+    ASSERT(poller_backoff(1, 0.0) == (double)POLL_BACKOFF_MIN_SEC * 0.5);
+    ASSERT(poller_backoff(1, 1.0) == (double)POLL_BACKOFF_MIN_SEC);
+    ASSERT(poller_backoff(3, 1.0) == (double)POLL_BACKOFF_MIN_SEC * 4.0);
+    double prev = 0.0;
+    for (int f = 1; f < 10; f++) {
+        double d = poller_backoff(f, 1.0);
+        ASSERT(d >= prev);
+        prev = d;
+    }
+    // capped, and jitter outside [0, 1] is clamped
+    ASSERT(poller_backoff(1000, 1.0) == (double)POLL_BACKOFF_MAX_SEC);
+    ASSERT(poller_backoff(1000, 7.0) == (double)POLL_BACKOFF_MAX_SEC);
+    ASSERT(poller_backoff(1000, -1.0) == (double)POLL_BACKOFF_MAX_SEC * 0.5);
+}
+
+TEST(poller_not_started)
+{
+    PollBatch b;
+    ASSERT_EQ(poller_next(&b), -1);
+    ASSERT_EQ(poller_start(NULL, 1, 10, NULL), -1);
+    poller_stop(); // no-op
+}
+
+TEST(poller_hands_over_batches)
+{
+    MockServer ms = start_mock("out-of-order");
+    ASSERT(ms.port > 0);
+    g_running = 1;
+    BotHandle *bot = make_test_bot(ms.port, &g_running);
+    ASSERT_NOT_NULL(bot);
+
+    ASSERT_EQ(poller_start(bot, 1, 100, &g_running), 0);
+    ASSERT_EQ(poller_start(bot, 1, 100, &g_running), -1); // already running
+
+    PollBatch b;
+    ASSERT_EQ(poller_next(&b), 0);
+    ASSERT_NOT_NULL(b.body);
+    ASSERT_EQ(strlen(b.body), b.len);
+    ASSERT_NOT_NULL(strstr(b.body, "\"seven\""));
+    int64_t off = 0;
+    ASSERT_EQ(update_batch_offset(b.body, b.len, &off), 0);
+    ASSERT_EQ(off, 8);
+    poller_batch_free(&b);
+    ASSERT_NULL(b.body);
+
+    // the mock ignores the offset; updates already handed over are not
+    // handed over again, so nothing more arrives before the flag drops
+    pthread_t t;
+    ASSERT_EQ(pthread_create(&t, NULL, stopper, NULL), 0);
+    ASSERT_EQ(poller_next(&b), -1);
+    pthread_join(t, NULL);
+
+    poller_stop();
+    ASSERT_EQ(poller_next(&b), -1);
+    bot_cleanup(bot);
+    stop_mock(&ms);
+}
+
+static double wall_sec(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+TEST(poller_confirms_only_taken_batches)
+{
+    MockServer ms = start_mock("stamped");
+    ASSERT(ms.port > 0);
+    g_running = 1;
+    BotHandle *bot = make_test_bot(ms.port, &g_running);
+    ASSERT_NOT_NULL(bot);
+    ASSERT_EQ(poller_start(bot, 1, 100, &g_running), 0);
+
+    // leave the first batch waiting: the poll past it must not go out yet
+    usleep(500000);
+    PollBatch b;
+    ASSERT_EQ(poller_next(&b), 0);
+    double taken = wall_sec();
+    int64_t off = 0;
+    ASSERT_EQ(update_batch_offset(b.body, b.len, &off), 0);
+    ASSERT_EQ(off, 2);
+    poller_batch_free(&b);
+
+    ASSERT_EQ(poller_next(&b), 0);
+    ASSERT_EQ(update_batch_offset(b.body, b.len, &off), 0);
+    ASSERT_EQ(off, 3);
+    const char *stamp = strstr(b.body, "\"text\"");
+    ASSERT_NOT_NULL(stamp);
+    stamp = strchr(stamp + 6, '"');
+    ASSERT_NOT_NULL(stamp);
+    // asked for with offset=2 only after the first batch was taken
+    ASSERT(atof(stamp + 1) >= taken - 0.05);
+    poller_batch_free(&b);
+
+    // a batch still waiting at shutdown is dropped unconfirmed
+    g_running = 0;
+    ASSERT_EQ(poller_next(&b), -1);
+    poller_stop();
+    bot_cleanup(bot);
+    stop_mock(&ms);
+}
+
+TEST(poller_stops_on_run_flag)
+{
+    MockServer ms = start_mock("401-unauthorized");
+    ASSERT(ms.port > 0);
+    g_running = 1;
+    BotHandle *bot = make_test_bot(ms.port, &g_running);
+    ASSERT_NOT_NULL(bot);
+
+    // every poll fails, so the poller sits in backoff until the flag drops
+    ASSERT_EQ(poller_start(bot, 1, 100, &g_running), 0);
+    pthread_t t;
+    ASSERT_EQ(pthread_create(&t, NULL, stopper, NULL), 0);
+    double t0 = now_sec();
+    PollBatch b;
+    ASSERT_EQ(poller_next(&b), -1);
+    ASSERT(now_sec() - t0 < 3.0);
+    pthread_join(t, NULL);
+
+    t0 = now_sec();
+    poller_stop();
+    ASSERT(now_sec() - t0 < 2.0);
+    bot_cleanup(bot);
+    stop_mock(&ms);
+}
+
+int main(void)
+{
+    printf("=== test_poller ===\n");
+    return test_summarise();
+}
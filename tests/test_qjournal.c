@@ -0,0 +1,460 @@
+#define _POSIX_C_SOURCE 200809L
+#define _DEFAULT_SOURCE
+
+#include "test.h"
+#include "../src/config.h"
+#include "../src/qjournal.h"
+#include "../src/queue.h"
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+static char g_dir[64];
+static char g_path[128];
+
+static double monotonic_sec(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+/* segment files in the journal directory once the journal thread has
+ * caught up: those in use plus, while open, the next one made ahead
+ */
+static int count_segments(void)
+{
+    qjournal_flush();
+    DIR *d = opendir(g_dir);
+    int n = 0;
+    struct dirent *de;
+    while (d && (de = readdir(d)) != NULL) {
+        n += strncmp(de->d_name, "q.journal.", 10) == 0;
+    }
+    if (d) {
+        closedir(d);
+    }
+    return n;
+}
+
+static void clear_dir(void)
+{
+    DIR *d = opendir(g_dir);
+    struct dirent *de;
+    while (d && (de = readdir(d)) != NULL) {
+        if (de->d_name[0] != '.') {
+            char p[512];
+            snprintf(p, sizeof(p), "%s/%s", g_dir, de->d_name);
+            unlink(p);
+        }
+    }
+    if (d) {
+        closedir(d);
+    }
+}
+
+// replayed entries, copied out
+typedef struct {
+    int n;
+    uint64_t seq[64];
+    int64_t user[64];
+    int kind[64];
+    int merged[64];
+    double age[64];
+    char text[64][64];
+} Seen;
+
+static void collect(const QJournalEntry *e, void *ud)
+{
+    Seen *s = ud;
+    if (s->n < 64) {
+        s->seq[s->n] = e->seq;
+        s->user[s->n] = e->user_id;
+        s->kind[s->n] = e->kind;
+        s->merged[s->n] = e->merged;
+        s->age[s->n] = e->age_sec;
+        snprintf(s->text[s->n], sizeof(s->text[0]), "%s", e->text);
+    }
+    s->n++;
+}
+
+static void ack_all(const QJournalEntry *e, void *ud)
+{
+    (void)ud;
+    qjournal_ack(e->seq);
+}
+
+TEST(qjournal_setup)
+{
+    snprintf(g_dir, sizeof(g_dir), "/tmp/tgbot_qj_XXXXXX");
+    ASSERT_NOT_NULL(mkdtemp(g_dir));
+    snprintf(g_path, sizeof(g_path), "%s/q.journal", g_dir);
+    ASSERT_EQ(qjournal_open("/nonexistent-dir/q.journal", 0), -1);
+    ASSERT(!qjournal_active());
+    ASSERT_EQ(qjournal_push(1, 1, QUEUE_PROMPT, 1, 0, "x", 1), 0); // closed: not journaled
+}
+
+TEST(qjournal_unacked_survive_reopen)
+{
+    ASSERT_EQ(qjournal_open(g_path, 0), 0);
+    ASSERT(qjournal_active());
+    Seen seen = {0};
+    ASSERT_EQ(qjournal_replay(collect, &seen), 0);
+
+    uint64_t a = qjournal_push(10, 100, QUEUE_PROMPT, 1, 0, "first", 5);
+    uint64_t b = qjournal_push(10, 100, QUEUE_PROMPT, 3, 60.0, "second", 6);
+    uint64_t c = qjournal_push(20, 200, QUEUE_REPLY, 1, 0, "third", 5);
+    ASSERT(a > 0 && b > a && c > b);
+    qjournal_ack(a);
+    qjournal_ack(a); // repeated and unknown acks are ignored
+    qjournal_ack(999999);
+    QJournalStats js;
+    qjournal_stats(&js);
+    ASSERT_EQ(js.live, 2);
+    ASSERT_EQ(js.pushes, 3);
+    ASSERT_EQ(js.acks, 1);
+    qjournal_close();
+    ASSERT(!qjournal_active());
+
+    ASSERT_EQ(qjournal_open(g_path, 0), 0);
+    ASSERT_EQ(qjournal_replay(collect, &seen), 2);
+    ASSERT_EQ(seen.n, 2);
+    ASSERT_EQ(seen.seq[0], b);
+    ASSERT_STR_EQ(seen.text[0], "second");
+    ASSERT_EQ(seen.user[0], 10);
+    ASSERT_EQ(seen.merged[0], 3);
+    ASSERT(seen.age[0] >= 59.0 && seen.age[0] < 120.0); // kept its first arrival
+    ASSERT_STR_EQ(seen.text[1], "third");
+    ASSERT_EQ(seen.kind[1], QUEUE_REPLY);
+    ASSERT(seen.age[1] < 30.0);
+    // the old segment was compacted into one fresh one (and a spare)
+    ASSERT_EQ(count_segments(), 2);
+
+    // new seqs continue past the replayed ones
+    uint64_t d = qjournal_push(30, 300, QUEUE_PROMPT, 1, 0, "fourth", 6);
+    ASSERT(d > c);
+    qjournal_ack(b);
+    qjournal_ack(c);
+    qjournal_ack(d);
+    qjournal_close();
+
+    ASSERT_EQ(qjournal_open(g_path, 0), 0);
+    Seen none = {0};
+    ASSERT_EQ(qjournal_replay(collect, &none), 0);
+    qjournal_close();
+}
+
+TEST(qjournal_rotates_and_drops_drained)
+{
+    clear_dir();
+    ASSERT_EQ(qjournal_open(g_path, QJOURNAL_SEGMENT_MIN), 0);
+    qjournal_replay(collect, &(Seen){0});
+
+    char text[1000];
+    memset(text, 'r', sizeof(text) - 1);
+    text[sizeof(text) - 1] = '\0';
+    uint64_t seqs[300];
+    for (int i = 0; i < 300; i++) {
+        seqs[i] = qjournal_push(i, i, QUEUE_PROMPT, 1, 0, text, sizeof(text) - 1);
+        ASSERT(seqs[i] > 0);
+    }
+    QJournalStats js;
+    qjournal_stats(&js);
+    ASSERT(js.segments >= 4); // 300 KB of records in 64 KiB segments
+    ASSERT_EQ(count_segments(), js.segments + 1);
+
+    for (int i = 0; i < 300; i++) {
+        qjournal_ack(seqs[i]);
+    }
+    qjournal_stats(&js);
+    ASSERT_EQ(js.live, 0);
+    ASSERT_EQ(js.segments, 1); // only the newest stays
+    ASSERT_EQ(count_segments(), 2);
+
+    // a record bigger than a segment is refused, not split
+    static char huge[QJOURNAL_SEGMENT_MIN];
+    memset(huge, 'h', sizeof(huge) - 1);
+    ASSERT_EQ(qjournal_push(1, 1, QUEUE_PROMPT, 1, 0, huge, sizeof(huge) - 1), 0);
+    qjournal_stats(&js);
+    ASSERT_EQ(js.failed, 1);
+    qjournal_close();
+}
+
+TEST(qjournal_compacts_pinned_segment)
+{
+    clear_dir();
+    ASSERT_EQ(qjournal_open(g_path, QJOURNAL_SEGMENT_MIN), 0);
+    qjournal_replay(collect, &(Seen){0});
+
+    // one message never taken, then a long stream that is
+    uint64_t pinned = qjournal_push(7, 70, QUEUE_PROMPT, 1, 0, "pinned", 6);
+    ASSERT(pinned > 0);
+    char text[1000];
+    memset(text, 's', sizeof(text) - 1);
+    text[sizeof(text) - 1] = '\0';
+    for (int i = 0; i < 2000; i++) {
+        qjournal_ack(qjournal_push(i, i, QUEUE_PROMPT, 1, 0, text, sizeof(text) - 1));
+    }
+    QJournalStats js;
+    qjournal_stats(&js);
+    ASSERT(js.compacted >= 1);
+    ASSERT(js.segments <= QJOURNAL_COMPACT_SEGMENTS + 1);
+    ASSERT_EQ(js.live, 1);
+    qjournal_close();
+
+    ASSERT_EQ(qjournal_open(g_path, QJOURNAL_SEGMENT_MIN), 0);
+    Seen seen = {0};
+    ASSERT_EQ(qjournal_replay(collect, &seen), 1);
+    ASSERT_EQ(seen.seq[0], pinned);
+    ASSERT_STR_EQ(seen.text[0], "pinned");
+    qjournal_replay(ack_all, NULL); // a second call hands out nothing
+    qjournal_close();
+}
+
+TEST(qjournal_torn_tail_cut)
+{
+    clear_dir();
+    ASSERT_EQ(qjournal_open(g_path, 0), 0);
+    qjournal_replay(collect, &(Seen){0});
+    qjournal_push(1, 1, QUEUE_PROMPT, 1, 0, "kept one", 8);
+    qjournal_push(1, 1, QUEUE_PROMPT, 1, 0, "kept two", 8);
+    qjournal_push(1, 1, QUEUE_PROMPT, 1, 0, "torn", 4);
+    qjournal_close();
+
+    // flip a byte of the last record's text, as a crash mid-write would leave it
+    DIR *d = opendir(g_dir);
+    struct dirent *de;
+    char seg[512] = "";
+    while ((de = readdir(d)) != NULL) {
+        if (strncmp(de->d_name, "q.journal.", 10) == 0) {
+            snprintf(seg, sizeof(seg), "%s/%s", g_dir, de->d_name);
+        }
+    }
+    closedir(d);
+    int fd = open(seg, O_RDWR);
+    ASSERT(fd >= 0);
+    char buf[4096];
+    ssize_t got = pread(fd, buf, sizeof(buf), 0);
+    ASSERT(got > 0);
+    char *torn = NULL;
+    for (ssize_t i = 0; i + 4 <= got && !torn; i++) {
+        torn = memcmp(buf + i, "torn", 4) == 0 ? buf + i : NULL;
+    }
+    ASSERT_NOT_NULL(torn);
+    torn[0] = 'T';
+    ASSERT_EQ(pwrite(fd, torn, 1, torn - buf), 1);
+    close(fd);
+
+    ASSERT_EQ(qjournal_open(g_path, 0), 0);
+    Seen seen = {0};
+    ASSERT_EQ(qjournal_replay(collect, &seen), 2);
+    ASSERT_STR_EQ(seen.text[0], "kept one");
+    ASSERT_STR_EQ(seen.text[1], "kept two");
+    qjournal_close();
+}
+
+TEST(qjournal_queue_restart_keeps_order)
+{
+    clear_dir();
+    ASSERT_EQ(qjournal_open(g_path, 0), 0);
+    ASSERT_EQ(queue_init_sharded(8, 2), 0);
+    ASSERT_EQ(queue_restore_journal(), 0);
+    queue_set_overflow(QUEUE_MERGE);
+
+    ASSERT_EQ(queue_push(1, 10, "a1"), 0);
+    ASSERT_EQ(queue_push(2, 20, "b1"), 0);
+    ASSERT_EQ(queue_push(1, 10, "a2"), 0);
+    ASSERT_EQ(queue_push_reply(2, 20, "help text", QUEUE_REPLY, 0), 0);
+    // fill user 3's ring, then merge one more into its newest message
+    for (int i = 0; i < 8; i++) {
+        char t[8];
+        snprintf(t, sizeof(t), "c%d", i);
+        ASSERT_EQ(queue_push(3, 30, t), 0);
+    }
+    ASSERT_EQ(queue_push(3, 30, "c8"), 0);
+
+    // answer one: it is acked, the rest stay journaled through shutdown
+    QueueMsg out = {0};
+    ASSERT_EQ(queue_pop(&out), 0);
+    ASSERT_STR_EQ(out.text, "help text");
+    queue_msg_done(&out);
+    queue_shutdown();
+    ASSERT_EQ(queue_pop(&out), -1); // nothing drains while journaled
+    ASSERT_EQ(queue_depth(), 11);
+    queue_destroy();
+    qjournal_close();
+
+    // the next start
+    ASSERT_EQ(qjournal_open(g_path, 0), 0);
+    ASSERT_EQ(queue_init_sharded(8, 1), 0);
+    queue_set_overflow(QUEUE_MERGE);
+    // c8 has its own record and is folded into c7 again
+    ASSERT_EQ(queue_restore_journal(), 12);
+    ASSERT_EQ(queue_depth(), 11);
+    double now = monotonic_sec();
+    char got1[4][8];
+    int n1 = 0;
+    int merged_c7 = 0;
+    for (int i = 0; i < 11; i++) {
+        ASSERT_EQ(queue_pop(&out), 0);
+        ASSERT(out.ingress_sec <= now);
+        ASSERT_EQ(out.kind, QUEUE_PROMPT);
+        if (out.user_id == 1 && n1 < 4) {
+            snprintf(got1[n1++], sizeof(got1[0]), "%s", out.text);
+        }
+        if (out.user_id == 3 && strcmp(out.text, "c7\nc8") == 0) {
+            merged_c7 = out.merged;
+            ASSERT_EQ(out.jseqs, 2);
+        }
+        queue_msg_done(&out);
+    }
+    ASSERT_EQ(n1, 2);
+    ASSERT_STR_EQ(got1[0], "a1");
+    ASSERT_STR_EQ(got1[1], "a2");
+    ASSERT_EQ(merged_c7, 2);
+
+    // all taken: nothing is left for a third start
+    QJournalStats js;
+    qjournal_stats(&js);
+    ASSERT_EQ(js.live, 0);
+    queue_shutdown();
+    queue_destroy();
+    queue_msg_release(&out);
+    qjournal_close();
+
+    ASSERT_EQ(qjournal_open(g_path, 0), 0);
+    ASSERT_EQ(queue_init(8), 0);
+    ASSERT_EQ(queue_restore_journal(), 0);
+    queue_destroy();
+    qjournal_close();
+}
+
+TEST(qjournal_restore_respects_ring_size)
+{
+    clear_dir();
+    ASSERT_EQ(qjournal_open(g_path, 0), 0);
+    ASSERT_EQ(queue_init(8), 0);
+    queue_restore_journal();
+    for (int i = 0; i < 8; i++) {
+        ASSERT_EQ(queue_push(5, 50, "m"), 0);
+    }
+    queue_destroy();
+    qjournal_close();
+
+    // restarted with smaller rings: what does not fit is dropped and acked
+    ASSERT_EQ(qjournal_open(g_path, 0), 0);
+    ASSERT_EQ(queue_init(4), 0);
+    ASSERT_EQ(queue_restore_journal(), 4);
+    QJournalStats js;
+    qjournal_stats(&js);
+    ASSERT_EQ(js.replayed, 8);
+    ASSERT_EQ(js.live, 4);
+    queue_destroy();
+    qjournal_close();
+}
+
+TEST(qjournal_popped_not_done_replayed)
+{
+    clear_dir();
+    ASSERT_EQ(qjournal_open(g_path, 0), 0);
+    ASSERT_EQ(queue_init(8), 0);
+    queue_restore_journal();
+    ASSERT_EQ(queue_push(6, 60, "answered"), 0);
+    ASSERT_EQ(queue_push(6, 60, "in flight"), 0);
+    QueueMsg out = {0};
+    ASSERT_EQ(queue_pop(&out), 0);
+    queue_msg_done(&out);
+    queue_msg_done(&out); // repeating it acks nothing twice
+    // popped, then cut short by shutdown before the reply went out
+    ASSERT_EQ(queue_pop(&out), 0);
+    ASSERT_STR_EQ(out.text, "in flight");
+    QJournalStats js;
+    qjournal_stats(&js);
+    ASSERT_EQ(js.live, 1);
+    ASSERT_EQ(js.acks, 1);
+    queue_msg_release(&out);
+    queue_destroy();
+    qjournal_close();
+
+    ASSERT_EQ(qjournal_open(g_path, 0), 0);
+    ASSERT_EQ(queue_init(8), 0);
+    ASSERT_EQ(queue_restore_journal(), 1);
+    ASSERT_EQ(queue_pop(&out), 0);
+    ASSERT_STR_EQ(out.text, "in flight");
+    queue_msg_done(&out);
+    qjournal_stats(&js);
+    ASSERT_EQ(js.live, 0);
+    queue_msg_release(&out);
+    queue_destroy();
+    qjournal_close();
+}
+
+// producers and workers at once, every message journaled and acked
+static void *producer(void *arg)
+{
+    int64_t base = (int64_t)(intptr_t)arg;
+    for (int i = 0; i < 2000; i++) {
+        queue_push(base + i % 16, base, "concurrent message text");
+    }
+    return NULL;
+}
+
+static void *consumer(void *arg)
+{
+    int id = (int)(intptr_t)arg;
+    QueueMsg m = {0};
+    while (queue_pop_worker(id, &m) == 0) {
+        queue_msg_done(&m);
+    }
+    queue_msg_release(&m);
+    return NULL;
+}
+
+TEST(qjournal_concurrent_push_pop)
+{
+    clear_dir();
+    ASSERT_EQ(qjournal_open(g_path, QJOURNAL_SEGMENT_MIN), 0);
+    ASSERT_EQ(queue_init_sharded(64, 4), 0);
+    queue_restore_journal();
+    pthread_t prod[4];
+    pthread_t cons[4];
+    for (int i = 0; i < 4; i++) {
+        pthread_create(&cons[i], NULL, consumer, (void *)(intptr_t)i);
+    }
+    for (int i = 0; i < 4; i++) {
+        pthread_create(&prod[i], NULL, producer, (void *)(intptr_t)((i + 1) * 1000));
+    }
+    for (int i = 0; i < 4; i++) {
+        pthread_join(prod[i], NULL);
+    }
+    // let the workers drain, then stop them
+    for (int i = 0; i < 500 && queue_depth() > 0; i++) {
+        usleep(2000);
+    }
+    queue_shutdown();
+    for (int i = 0; i < 4; i++) {
+        pthread_join(cons[i], NULL);
+    }
+    QJournalStats js;
+    qjournal_stats(&js);
+    ASSERT_EQ(js.live, (uint64_t)queue_depth());
+    ASSERT_EQ(js.pushes, js.acks + js.live);
+    queue_destroy();
+    qjournal_close();
+
+    clear_dir();
+    rmdir(g_dir);
+}
+
+int main(void)
+{
+    printf("=== test_qjournal ===\n");
+    return test_summarise();
+}
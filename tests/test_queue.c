@@ -6,6 +6,7 @@
 #include "../src/queue.h"
 
 #include <pthread.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -27,7 +28,7 @@ TEST(queue_message_idempotency)
     const char *msg = "Hello, world! 🤖";
     ASSERT_EQ(queue_push(100, 200, msg), 0);
 
-    QueueMsg out;
+    QueueMsg out = {0};
     ASSERT_EQ(queue_pop(&out), 0);
     ASSERT_EQ(out.user_id, 100);
     ASSERT_EQ(out.chat_id, 200);
@@ -35,6 +36,7 @@ TEST(queue_message_idempotency)
 
     queue_shutdown();
     queue_destroy();
+    queue_msg_release(&out);
 }
 
 // queue overflow: pushing beyond ring capacity returns -1, no crash
@@ -54,7 +56,7 @@ TEST(queue_overflow_no_crash)
     ASSERT_EQ(queue_push(42, 100, "overflow"), -1);
 
     // drain and verify first message is intact
-    QueueMsg out;
+    QueueMsg out = {0};
     ASSERT_EQ(queue_pop(&out), 0);
     ASSERT_STR_EQ(out.text, "msg 0");
 
@@ -63,6 +65,7 @@ TEST(queue_overflow_no_crash)
 
     queue_shutdown();
     queue_destroy();
+    queue_msg_release(&out);
 }
 
 // multiple users: round-robin fairness
@@ -82,10 +85,11 @@ TEST(queue_round_robin_fairness)
     // pop all 9 messages; verify we see all users (not just one)
     int user_seen[4] = {0}; // indices 1-3
     for (int i = 0; i < 9; i++) {
-        QueueMsg out;
+        QueueMsg out = {0};
         ASSERT_EQ(queue_pop(&out), 0);
         ASSERT(out.user_id >= 1 && out.user_id <= 3);
         user_seen[out.user_id]++;
+        queue_msg_release(&out);
     }
 
     // each user must have exactly 3 messages popped
@@ -103,8 +107,9 @@ static int g_pop_result = 99;
 static void *shutdown_pop_thread(void *arg)
 {
     (void)arg;
-    QueueMsg msg;
+    QueueMsg msg = {0};
     g_pop_result = queue_pop(&msg);
+    queue_msg_release(&msg);
     return NULL;
 }
 
@@ -135,13 +140,14 @@ TEST(queue_ingress_timestamp)
     ASSERT_EQ(queue_push(1, 1, "timing"), 0);
     double after = monotonic_sec();
 
-    QueueMsg out;
+    QueueMsg out = {0};
     ASSERT_EQ(queue_pop(&out), 0);
     ASSERT(out.ingress_sec >= before);
     ASSERT(out.ingress_sec <= after);
 
     queue_shutdown();
     queue_destroy();
+    queue_msg_release(&out);
 }
 
 // rate limiter: worker should delay based on ingress timestamp
@@ -152,7 +158,7 @@ TEST(queue_rate_limiter_delay)
 
     ASSERT_EQ(queue_push(1, 1, "rate-test"), 0);
 
-    QueueMsg out;
+    QueueMsg out = {0};
     ASSERT_EQ(queue_pop(&out), 0);
 
     // simulate worker reply_delay = 1 second
@@ -167,6 +173,7 @@ TEST(queue_rate_limiter_delay)
 
     queue_shutdown();
     queue_destroy();
+    queue_msg_release(&out);
 }
 
 // high-throughput: push/pop 10000 messages without crash or corruption
@@ -196,12 +203,13 @@ TEST(queue_high_throughput)
 
         // drain what we pushed
         for (int i = 0; i < to_push; i++) {
-            QueueMsg out;
+            QueueMsg out = {0};
             if (queue_pop(&out) == 0) {
                 popped++;
             } else {
                 break;
             }
+            queue_msg_release(&out);
         }
     }
 
@@ -212,25 +220,39 @@ TEST(queue_high_throughput)
     queue_destroy();
 }
 
-// text truncation: message longer than 1023 bytes is clipped, not overflow
-TEST(queue_text_truncation)
+// long text: a full 4096-character message comes out whole, not clipped
+TEST(queue_long_text_whole)
 {
     ASSERT_EQ(queue_init(8), 0);
 
-    // build a 2000-byte message
-    char big[2001];
-    memset(big, 'X', 2000);
-    big[2000] = '\0';
+    // 4096 three-byte characters, as Telegram allows
+    static char big[4096 * 3 + 1];
+    for (int i = 0; i < 4096; i++) {
+        memcpy(big + i * 3, "\xE2\x82\xAC", 3);
+    }
+    big[4096 * 3] = '\0';
 
     ASSERT_EQ(queue_push(1, 1, big), 0);
 
-    QueueMsg out;
+    QueueMsg out = {0};
+    ASSERT_EQ(queue_pop(&out), 0);
+    ASSERT_EQ(out.len, sizeof(big) - 1);
+    ASSERT_STR_EQ(out.text, big);
+
+    // a buffer handed over at ingress is the one the worker gets
+    MsgBuf *buf = queue_buf_new(5);
+    ASSERT_NOT_NULL(buf);
+    memcpy(buf->text, "owned", 6);
+    buf->len = 5;
+    ASSERT_EQ(queue_push_buf(1, 1, buf, 3), 0);
     ASSERT_EQ(queue_pop(&out), 0);
-    // text should be truncated to sizeof(out.text)-1 = 1023
-    ASSERT_EQ((int)strlen(out.text), 1023);
+    ASSERT(out.buf == buf);
+    ASSERT_STR_EQ(out.text, "owned");
+    ASSERT_EQ(out.trace_id, 3);
 
     queue_shutdown();
     queue_destroy();
+    queue_msg_release(&out);
 }
 
 // helper for concurrent producer test
@@ -266,7 +288,7 @@ TEST(queue_concurrent_producers)
 
     // drain all messages - should not crash
     int count = 0;
-    QueueMsg out;
+    QueueMsg out = {0};
     queue_shutdown();
     while (queue_pop(&out) == 0) {
         count++;
@@ -277,6 +299,7 @@ TEST(queue_concurrent_producers)
     ASSERT(count > 0);
 
     queue_destroy();
+    queue_msg_release(&out);
 }
 
 // idle ring freed: push from user, drain to zero, push again succeeds
@@ -286,7 +309,7 @@ TEST(queue_idle_ring_freed)
 
     // push and drain - ring should be freed on drain
     ASSERT_EQ(queue_push(999, 999, "first"), 0);
-    QueueMsg out;
+    QueueMsg out = {0};
     ASSERT_EQ(queue_pop(&out), 0);
     ASSERT_STR_EQ(out.text, "first");
     ASSERT_EQ(out.user_id, 999);
@@ -298,6 +321,7 @@ TEST(queue_idle_ring_freed)
 
     queue_shutdown();
     queue_destroy();
+    queue_msg_release(&out);
 }
 
 // many transient users: rings freed, no unbounded memory growth
@@ -308,20 +332,22 @@ TEST(queue_transient_users_no_leak)
     // simulate 200 transient users each sending one message
     for (int i = 0; i < 200; i++) {
         ASSERT_EQ(queue_push((int64_t)(10000 + i), (int64_t)(10000 + i), "hi"), 0);
-        QueueMsg out;
+        QueueMsg out = {0};
         ASSERT_EQ(queue_pop(&out), 0);
         ASSERT_EQ(out.user_id, (int64_t)(10000 + i));
+        queue_msg_release(&out);
     }
 
     // all rings should have been freed after draining
     // push/pop cycle for a new user should still work fine
     ASSERT_EQ(queue_push(1, 1, "still works"), 0);
-    QueueMsg out;
+    QueueMsg out = {0};
     ASSERT_EQ(queue_pop(&out), 0);
     ASSERT_STR_EQ(out.text, "still works");
 
     queue_shutdown();
     queue_destroy();
+    queue_msg_release(&out);
 }
 
 // queue_depth() returns correct pending count
@@ -336,7 +362,7 @@ TEST(queue_depth_tracking)
     ASSERT_EQ(queue_push(3, 3, "c"), 0);
     ASSERT_EQ(queue_depth(), 3);
 
-    QueueMsg out;
+    QueueMsg out = {0};
     ASSERT_EQ(queue_pop(&out), 0);
     ASSERT_EQ(queue_depth(), 2);
 
@@ -346,6 +372,7 @@ TEST(queue_depth_tracking)
 
     queue_shutdown();
     queue_destroy();
+    queue_msg_release(&out);
 }
 
 // queue_ring_count() returns correct number of allocated user rings
@@ -362,7 +389,7 @@ TEST(queue_ring_count_tracking)
     ASSERT_EQ(queue_ring_count(), 3);
 
     // drain user 10 - pop round-robins, so drain one from each
-    QueueMsg out;
+    QueueMsg out = {0};
     ASSERT_EQ(queue_pop(&out), 0); // pops from one user
     // ring freed on drain -> count should drop
     ASSERT_EQ(queue_ring_count(), 2);
@@ -375,6 +402,7 @@ TEST(queue_ring_count_tracking)
 
     queue_shutdown();
     queue_destroy();
+    queue_msg_release(&out);
 }
 
 // concurrent producers: verify message integrity
@@ -399,7 +427,7 @@ TEST(queue_concurrent_integrity)
     // drain and verify each message matches expected format "tN-mM"
     int count = 0;
     int valid = 0;
-    QueueMsg out;
+    QueueMsg out = {0};
     while (queue_pop(&out) == 0) {
         count++;
         int tid, mid;
@@ -414,6 +442,699 @@ TEST(queue_concurrent_integrity)
     ASSERT_EQ(valid, count);
 
     queue_destroy();
+    queue_msg_release(&out);
+}
+
+// reply delay: pop sleeps until the message is due instead of returning early
+TEST(queue_reply_delay_defers_pop)
+{
+    ASSERT_EQ(queue_init(8), 0);
+    queue_set_reply_delay(0.3);
+
+    ASSERT_EQ(queue_push(1, 1, "later"), 0);
+
+    QueueMsg out = {0};
+    ASSERT_EQ(queue_pop(&out), 0);
+    double waited = monotonic_sec() - out.ingress_sec;
+    ASSERT(waited >= 0.29);
+    ASSERT(waited < 1.0);
+    ASSERT_STR_EQ(out.text, "later");
+
+    queue_shutdown();
+    queue_destroy();
+    queue_msg_release(&out);
+}
+
+static void *timed_pop_thread(void *arg)
+{
+    double *done_at = (double *)arg;
+    QueueMsg msg = {0};
+    if (queue_pop(&msg) == 0) {
+        *done_at = monotonic_sec();
+    }
+    queue_msg_release(&msg);
+    return NULL;
+}
+
+// reply delay: two consumers both get their message at the deadline,
+// the second is not serialised behind the first one's wait
+TEST(queue_reply_delay_parallel_consumers)
+{
+    ASSERT_EQ(queue_init(8), 0);
+    queue_set_reply_delay(0.3);
+
+    double start = monotonic_sec();
+    double done[2] = {0.0, 0.0};
+    pthread_t t[2];
+    for (int i = 0; i < 2; i++) {
+        pthread_create(&t[i], NULL, timed_pop_thread, &done[i]);
+    }
+
+    ASSERT_EQ(queue_push(1, 1, "a"), 0);
+    ASSERT_EQ(queue_push(2, 2, "b"), 0);
+
+    for (int i = 0; i < 2; i++) {
+        pthread_join(t[i], NULL);
+    }
+    for (int i = 0; i < 2; i++) {
+        ASSERT(done[i] - start >= 0.29);
+        ASSERT(done[i] - start < 0.6);
+    }
+
+    queue_shutdown();
+    queue_destroy();
+}
+
+// reply delay: a due message from one user is served while another user's
+// later message is still waiting
+TEST(queue_reply_delay_earliest_deadline_first)
+{
+    ASSERT_EQ(queue_init(8), 0);
+    queue_set_reply_delay(0.2);
+
+    ASSERT_EQ(queue_push(1, 1, "first"), 0);
+    usleep(100000);
+    ASSERT_EQ(queue_push(2, 2, "second"), 0);
+
+    QueueMsg out = {0};
+    ASSERT_EQ(queue_pop(&out), 0);
+    ASSERT_EQ(out.user_id, 1);
+    ASSERT_EQ(queue_pop(&out), 0);
+    ASSERT_EQ(out.user_id, 2);
+    ASSERT(monotonic_sec() - out.ingress_sec >= 0.19);
+
+    queue_shutdown();
+    queue_destroy();
+    queue_msg_release(&out);
+}
+
+// shutdown drains pending messages without waiting for their deadlines
+TEST(queue_reply_delay_shutdown_drains)
+{
+    ASSERT_EQ(queue_init(8), 0);
+    queue_set_reply_delay(10.0);
+
+    ASSERT_EQ(queue_push(1, 1, "pending"), 0);
+    queue_shutdown();
+
+    double start = monotonic_sec();
+    QueueMsg out = {0};
+    ASSERT_EQ(queue_pop(&out), 0);
+    ASSERT(monotonic_sec() - start < 1.0);
+    ASSERT_EQ(queue_pop(&out), -1);
+
+    queue_destroy();
+    queue_msg_release(&out);
+}
+
+// coalescing: a burst pops as one message, later arrivals stay separate
+TEST(queue_coalesce_merges_burst)
+{
+    ASSERT_EQ(queue_init(8), 0);
+    queue_set_coalesce(0.2);
+
+    ASSERT_EQ(queue_push(1, 10, "hi"), 0);
+    ASSERT_EQ(queue_push(1, 10, "are you there?"), 0);
+    ASSERT_EQ(queue_push(1, 10, "hello??"), 0);
+    ASSERT_EQ(queue_push(2, 20, "other user"), 0);
+    ASSERT_EQ(queue_depth(), 4);
+
+    QueueMsg out = {0};
+    ASSERT_EQ(queue_pop(&out), 0);
+    ASSERT_EQ(out.user_id, 1);
+    ASSERT_EQ(out.merged, 3);
+    ASSERT_STR_EQ(out.text, "hi\nare you there?\nhello??");
+    ASSERT_EQ(queue_depth(), 1);
+
+    ASSERT_EQ(queue_pop(&out), 0);
+    ASSERT_EQ(out.user_id, 2);
+    ASSERT_EQ(out.merged, 1);
+    ASSERT_STR_EQ(out.text, "other user");
+    ASSERT_EQ(queue_ring_count(), 0);
+
+    // outside the window of the first message: answered on its own
+    ASSERT_EQ(queue_push(1, 10, "early"), 0);
+    usleep(300000);
+    ASSERT_EQ(queue_push(1, 10, "late"), 0);
+    ASSERT_EQ(queue_pop(&out), 0);
+    ASSERT_STR_EQ(out.text, "early");
+    ASSERT_EQ(queue_pop(&out), 0);
+    ASSERT_STR_EQ(out.text, "late");
+
+    queue_shutdown();
+    queue_destroy();
+    queue_msg_release(&out);
+}
+
+// a trace id rides through the queue; a coalesced pop keeps the first one
+TEST(queue_carries_trace_id)
+{
+    ASSERT_EQ(queue_init(8), 0);
+    QueueMsg out = {0};
+    ASSERT_EQ(queue_push_traced(1, 10, "traced", 77), 0);
+    ASSERT_EQ(queue_push(2, 20, "plain"), 0);
+    ASSERT_EQ(queue_pop(&out), 0);
+    ASSERT_EQ(out.trace_id, 77);
+    ASSERT_EQ(queue_pop(&out), 0);
+    ASSERT_EQ(out.trace_id, 0);
+
+    queue_set_coalesce(5.0);
+    ASSERT_EQ(queue_push_traced(3, 30, "first", 5), 0);
+    ASSERT_EQ(queue_push_traced(3, 30, "second", 6), 0);
+    ASSERT_EQ(queue_pop(&out), 0);
+    ASSERT_EQ(out.merged, 2);
+    ASSERT_EQ(out.trace_id, 5);
+    queue_set_coalesce(0);
+
+    queue_shutdown();
+    queue_destroy();
+    queue_msg_release(&out);
+}
+
+// literal replies skip reply_delay and coalescing and go ahead of prompts
+TEST(queue_direct_lane_first)
+{
+    ASSERT_EQ(queue_init(8), 0);
+    queue_set_reply_delay(1.0);
+    queue_set_coalesce(5.0);
+
+    ASSERT_EQ(queue_push(1, 10, "a"), 0);
+    ASSERT_EQ(queue_push(1, 10, "b"), 0);
+    ASSERT_EQ(queue_push_reply(1, 10, "Unknown command. Try /help", QUEUE_REPLY, 9), 0);
+    ASSERT_EQ(queue_push_reply(2, 20, "permission denied", QUEUE_SYSTEM, 0), 0);
+    ASSERT_EQ(queue_depth(), 4);
+
+    QueueMsg out = {0};
+    double t0 = monotonic_sec();
+    ASSERT_EQ(queue_pop(&out), 0);
+    ASSERT_EQ(out.kind, QUEUE_REPLY);
+    ASSERT_EQ(out.user_id, 1);
+    ASSERT_EQ(out.trace_id, 9);
+    ASSERT_EQ(out.merged, 1);
+    ASSERT_STR_EQ(out.text, "Unknown command. Try /help");
+    ASSERT_EQ(queue_pop(&out), 0);
+    ASSERT_EQ(out.kind, QUEUE_SYSTEM);
+    ASSERT_EQ(out.chat_id, 20);
+    ASSERT(monotonic_sec() - t0 < 0.5);
+    ASSERT_EQ(queue_depth(), 2);
+
+    // the prompts still wait out reply_delay and merge with each other only
+    ASSERT_EQ(queue_pop(&out), 0);
+    ASSERT(monotonic_sec() - t0 >= 0.9);
+    ASSERT_EQ(out.kind, QUEUE_PROMPT);
+    ASSERT_EQ(out.merged, 2);
+    ASSERT_STR_EQ(out.text, "a\nb");
+
+    // a prompt kind is just queue_push_traced
+    ASSERT_EQ(queue_push_reply(3, 30, "to the llm", QUEUE_PROMPT, 0), 0);
+    ASSERT_EQ(queue_ring_count(), 1);
+
+    queue_shutdown();
+    queue_destroy();
+    queue_msg_release(&out);
+}
+
+// another shard's lane is stolen from at once; a full lane refuses
+TEST(queue_direct_lane_steal_and_full)
+{
+    ASSERT_EQ(queue_init_sharded(8, 2), 0);
+    queue_set_reply_delay(5.0);
+
+    // a user that lives on shard 1, popped by shard 0's worker
+    int64_t user = 1;
+    while ((queue_hash_user(user) >> 32) % 2 != 1) {
+        user++;
+    }
+    ASSERT_EQ(queue_push(user, user, "prompt"), 0);
+    ASSERT_EQ(queue_push_reply(user, user, "reply", QUEUE_REPLY, 0), 0);
+    QueueMsg out = {0};
+    ASSERT_EQ(queue_pop_worker_timed(0, &out, 1.0), 0);
+    ASSERT_STR_EQ(out.text, "reply");
+    ASSERT_EQ(queue_pop_worker_timed(0, &out, 0.2), 1); // the prompt is not due yet
+
+    for (int i = 1; i < QUEUE_LANE_MAX; i++) {
+        ASSERT_EQ(queue_push_reply(user, user, "x", QUEUE_SYSTEM, 0), 0);
+    }
+    ASSERT_EQ(queue_push_reply(user, user, "last", QUEUE_SYSTEM, 0), 0);
+    ASSERT_EQ(queue_push_reply(user, user, "refused", QUEUE_SYSTEM, 0), -1);
+    ASSERT_EQ(queue_depth(), QUEUE_LANE_MAX + 1);
+
+    // queued replies are freed with the queue
+    queue_shutdown();
+    queue_destroy();
+    queue_msg_release(&out);
+}
+
+// a full ring drops the oldest message or merges into the newest, as configured
+TEST(queue_overflow_policies)
+{
+    ASSERT_EQ(queue_init(4), 0);
+    QueueMsg out = {0};
+
+    queue_set_overflow(QUEUE_DROP_OLDEST);
+    ASSERT_EQ(queue_push(1, 10, "m0"), 0);
+    ASSERT_EQ(queue_push(1, 10, "m1"), 0);
+    ASSERT_EQ(queue_push(1, 10, "m2"), 0);
+    ASSERT_EQ(queue_push(1, 10, "m3"), 0);
+    ASSERT_EQ(queue_push(1, 10, "m4"), 1);
+    ASSERT_EQ(queue_depth(), 4);
+    ASSERT_EQ(queue_pop(&out), 0);
+    ASSERT_STR_EQ(out.text, "m1");
+    for (int i = 0; i < 3; i++) {
+        ASSERT_EQ(queue_pop(&out), 0);
+    }
+    ASSERT_STR_EQ(out.text, "m4");
+    ASSERT_EQ(queue_ring_count(), 0);
+
+    queue_set_overflow(QUEUE_MERGE);
+    for (int i = 0; i < 4; i++) {
+        ASSERT_EQ(queue_push(1, 10, "x"), 0);
+    }
+    ASSERT_EQ(queue_push(1, 10, "more"), 0);
+    ASSERT_EQ(queue_push(1, 10, "and more"), 0);
+    ASSERT_EQ(queue_push(1, 99, "other chat"), -1);
+    ASSERT_EQ(queue_depth(), 4);
+    for (int i = 0; i < 4; i++) {
+        ASSERT_EQ(queue_pop(&out), 0);
+    }
+    ASSERT_STR_EQ(out.text, "x\nmore\nand more");
+    ASSERT_EQ(out.merged, 3);
+
+    // no room left in the newest message: the new one is dropped after all
+    static char big[QUEUE_MERGE_MAX / 2 + 1];
+    memset(big, 'b', sizeof(big) - 1);
+    big[sizeof(big) - 1] = '\0';
+    for (int i = 0; i < 4; i++) {
+        ASSERT_EQ(queue_push(1, 10, big), 0);
+    }
+    ASSERT_EQ(queue_push(1, 10, big), -1);
+    while (queue_depth() > 0) {
+        ASSERT_EQ(queue_pop(&out), 0);
+        ASSERT_EQ(out.merged, 1);
+    }
+
+    queue_set_overflow(QUEUE_DROP_NEWEST);
+    queue_shutdown();
+    queue_destroy();
+    queue_msg_release(&out);
+}
+
+// prompts that waited past the max age come out as one QUEUE_EXPIRED per chat
+TEST(queue_max_age_sheds)
+{
+    ASSERT_EQ(queue_init(8), 0);
+    queue_set_max_age(0.2);
+
+    ASSERT_EQ(queue_push(1, 10, "stale 1"), 0);
+    ASSERT_EQ(queue_push(1, 10, "stale 2"), 0);
+    ASSERT_EQ(queue_push_reply(1, 10, "a reply never expires", QUEUE_REPLY, 0), 0);
+    usleep(300000);
+    ASSERT_EQ(queue_push(1, 10, "fresh"), 0);
+
+    QueueMsg out = {0};
+    ASSERT_EQ(queue_pop(&out), 0);
+    ASSERT_EQ(out.kind, QUEUE_REPLY);
+    ASSERT_EQ(queue_pop(&out), 0);
+    ASSERT_EQ(out.kind, QUEUE_EXPIRED);
+    ASSERT_EQ(out.merged, 2);
+    ASSERT_STR_EQ(out.text, "stale 1");
+    ASSERT_EQ(queue_pop(&out), 0);
+    ASSERT_EQ(out.kind, QUEUE_PROMPT);
+    ASSERT_STR_EQ(out.text, "fresh");
+    ASSERT_EQ(queue_depth(), 0);
+
+    queue_set_max_age(0);
+    queue_shutdown();
+    queue_destroy();
+    queue_msg_release(&out);
+}
+
+// coalescing stops at a chat change or when the merged text would not fit
+TEST(queue_coalesce_boundaries)
+{
+    ASSERT_EQ(queue_init(8), 0);
+    QueueMsg out = {0};
+
+    // off by default
+    ASSERT_EQ(queue_push(1, 10, "a"), 0);
+    ASSERT_EQ(queue_push(1, 10, "b"), 0);
+    ASSERT_EQ(queue_pop(&out), 0);
+    ASSERT_EQ(out.merged, 1);
+    ASSERT_EQ(queue_pop(&out), 0);
+    ASSERT_STR_EQ(out.text, "b");
+
+    queue_set_coalesce(5.0);
+    ASSERT_EQ(queue_push(1, 10, "private"), 0);
+    ASSERT_EQ(queue_push(1, 99, "in a group"), 0);
+    ASSERT_EQ(queue_pop(&out), 0);
+    ASSERT_STR_EQ(out.text, "private");
+    ASSERT_EQ(queue_pop(&out), 0);
+    ASSERT_EQ(out.chat_id, 99);
+
+    static char big[QUEUE_MERGE_MAX / 2 + 1];
+    memset(big, 'x', sizeof(big) - 1);
+    big[sizeof(big) - 1] = '\0';
+    ASSERT_EQ(queue_push(1, 10, big), 0);
+    ASSERT_EQ(queue_push(1, 10, big), 0);
+    ASSERT_EQ(queue_push(1, 10, "tail"), 0);
+    ASSERT_EQ(queue_pop(&out), 0);
+    ASSERT_EQ(out.merged, 1);
+    ASSERT_EQ(strlen(out.text), sizeof(big) - 1);
+    ASSERT_EQ(queue_pop(&out), 0);
+    ASSERT_EQ(out.merged, 2);
+    ASSERT_EQ(strlen(out.text), sizeof(big) - 1 + 5);
+    ASSERT_EQ(queue_depth(), 0);
+
+    queue_shutdown();
+    queue_destroy();
+    queue_msg_release(&out);
+}
+
+// memory: text is held in buffers sized to the message, not 1 KiB slots
+TEST(queue_mem_text_proportional)
+{
+    ASSERT_EQ(queue_init(8), 0);
+
+    QueueMemStats st;
+    queue_mem_stats(&st);
+    ASSERT_EQ(st.rings_live, 0);
+    ASSERT_EQ(st.text_bytes, 0);
+
+    ASSERT_EQ(queue_push(1, 1, "hi"), 0);
+    queue_mem_stats(&st);
+    ASSERT_EQ(st.rings_live, 1);
+    ASSERT_EQ(st.text_bytes, sizeof(MsgBuf) + 3);
+
+    char big[700];
+    memset(big, 'x', sizeof(big) - 1);
+    big[sizeof(big) - 1] = '\0';
+    ASSERT_EQ(queue_push(1, 1, big), 0);
+    queue_mem_stats(&st);
+    ASSERT_EQ(st.text_bytes, sizeof(MsgBuf) + 3 + sizeof(MsgBuf) + 700);
+
+    QueueMsg out = {0};
+    ASSERT_EQ(queue_pop(&out), 0);
+    ASSERT_STR_EQ(out.text, "hi");
+    ASSERT_EQ(queue_pop(&out), 0);
+    ASSERT_STR_EQ(out.text, big);
+
+    // drained: the ring object goes back to the pool, the text to the worker
+    queue_mem_stats(&st);
+    ASSERT_EQ(st.rings_live, 0);
+    ASSERT(st.rings_pooled > 0);
+    ASSERT_EQ(st.text_bytes, 0);
+
+    queue_shutdown();
+    queue_destroy();
+    queue_msg_release(&out);
+}
+
+// memory: churning users reuse pooled rings instead of allocating more slabs
+TEST(queue_mem_ring_reuse)
+{
+    ASSERT_EQ(queue_init(30), 0);
+
+    QueueMsg out = {0};
+    ASSERT_EQ(queue_push(1, 1, "warm"), 0);
+    ASSERT_EQ(queue_pop(&out), 0);
+    QueueMemStats before;
+    queue_mem_stats(&before);
+
+    for (int i = 0; i < 500; i++) {
+        ASSERT_EQ(queue_push((int64_t)(20000 + i), 1, "hello"), 0);
+        ASSERT_EQ(queue_pop(&out), 0);
+    }
+    QueueMemStats after;
+    queue_mem_stats(&after);
+    ASSERT_EQ(after.ring_bytes, before.ring_bytes);
+    ASSERT_EQ(after.text_bytes, 0);
+
+    queue_shutdown();
+    queue_destroy();
+    queue_msg_release(&out);
+}
+
+// memory: 1000 concurrent users with short messages stay around 1 KiB each
+TEST(queue_mem_many_users_bounded)
+{
+    ASSERT_EQ(queue_init(30), 0);
+    for (int i = 0; i < 1000; i++) {
+        ASSERT_EQ(queue_push((int64_t)(30000 + i), 1, "short message"), 0);
+    }
+
+    QueueMemStats st;
+    queue_mem_stats(&st);
+    ASSERT_EQ(st.rings_live, 1000);
+    ASSERT_EQ(st.text_bytes, 1000 * (sizeof(MsgBuf) + 14));
+    ASSERT(st.ring_bytes / 1000 < 2048); // was ~33 KiB per user
+
+    queue_shutdown();
+    QueueMsg out = {0};
+    while (queue_pop(&out) == 0) {
+    }
+    queue_destroy();
+    queue_msg_release(&out);
+}
+
+// fairness: due users are served strictly round-robin, in arrival order
+TEST(queue_fair_round_robin)
+{
+    ASSERT_EQ(queue_init(8), 0);
+    for (int m = 0; m < 3; m++) {
+        for (int u = 1; u <= 5; u++) {
+            ASSERT_EQ(queue_push(u, u, "x"), 0);
+        }
+    }
+    // a late user joins the back of the rotation, not the front
+    ASSERT_EQ(queue_push(6, 6, "late"), 0);
+
+    QueueMsg out = {0};
+    for (int u = 1; u <= 5; u++) {
+        ASSERT_EQ(queue_pop(&out), 0);
+        ASSERT_EQ(out.user_id, u);
+    }
+    ASSERT_EQ(queue_pop(&out), 0);
+    ASSERT_EQ(out.user_id, 6);
+    for (int m = 1; m < 3; m++) {
+        for (int u = 1; u <= 5; u++) {
+            ASSERT_EQ(queue_pop(&out), 0);
+            ASSERT_EQ(out.user_id, u);
+        }
+    }
+    ASSERT_EQ(queue_ring_count(), 0);
+
+    queue_shutdown();
+    queue_destroy();
+    queue_msg_release(&out);
+}
+
+// the user table grows past its initial size without losing or mixing users
+TEST(queue_table_grows_with_users)
+{
+    ASSERT_EQ(queue_init(4), 0);
+    int users = 5000;
+    for (int i = 0; i < users; i++) {
+        ASSERT_EQ(queue_push((int64_t)(70000 + i), (int64_t)i, "a"), 0);
+    }
+    for (int i = 0; i < users; i++) {
+        ASSERT_EQ(queue_push((int64_t)(70000 + i), (int64_t)i, "b"), 0);
+    }
+    ASSERT_EQ(queue_ring_count(), users);
+    ASSERT_EQ(queue_depth(), users * 2);
+
+    // first lap yields every user's "a" once, then every "b"
+    QueueMsg out = {0};
+    for (int i = 0; i < users; i++) {
+        ASSERT_EQ(queue_pop(&out), 0);
+        ASSERT_EQ(out.user_id, 70000 + i);
+        ASSERT_EQ(out.chat_id, i);
+        ASSERT_STR_EQ(out.text, "a");
+    }
+    for (int i = 0; i < users; i++) {
+        ASSERT_EQ(queue_pop(&out), 0);
+        ASSERT_STR_EQ(out.text, "b");
+    }
+    ASSERT_EQ(queue_ring_count(), 0);
+
+    queue_shutdown();
+    queue_destroy();
+    queue_msg_release(&out);
+}
+
+// sharded: a worker whose own shard is empty steals due messages elsewhere
+TEST(queue_sharded_steal_from_any_shard)
+{
+    ASSERT_EQ(queue_init_sharded(8, 4), 0);
+
+    // 64 users spread over every shard; worker 3 alone drains them all
+    for (int i = 0; i < 64; i++) {
+        ASSERT_EQ(queue_push((int64_t)(500 + i), 1, "s"), 0);
+    }
+    ASSERT_EQ(queue_depth(), 64);
+    ASSERT_EQ(queue_ring_count(), 64);
+
+    QueueMsg out = {0};
+    for (int i = 0; i < 64; i++) {
+        ASSERT_EQ(queue_pop_worker(3, &out), 0);
+    }
+    ASSERT_EQ(queue_depth(), 0);
+    ASSERT_EQ(queue_ring_count(), 0);
+
+    queue_shutdown();
+    ASSERT_EQ(queue_pop_worker(3, &out), -1);
+    queue_destroy();
+    queue_msg_release(&out);
+}
+
+// an idle worker's timed pop gives up; a message that is not due yet
+// does not count as work
+TEST(queue_pop_timed_idle)
+{
+    ASSERT_EQ(queue_init_sharded(8, 4), 0);
+    QueueMsg out = {0};
+    double t0 = monotonic_sec();
+    ASSERT_EQ(queue_pop_worker_timed(2, &out, 0.05), 1);
+    double waited = monotonic_sec() - t0;
+    ASSERT(waited >= 0.049 && waited < 1.0);
+
+    queue_set_reply_delay(0.3);
+    ASSERT_EQ(queue_push(42, 1, "later"), 0);
+    ASSERT_EQ(queue_pop_worker_timed(2, &out, 0.05), 1);
+    ASSERT_EQ(queue_pop_worker_timed(2, &out, 1.0), 0);
+    ASSERT_STR_EQ(out.text, "later");
+    queue_set_reply_delay(0);
+
+    ASSERT_EQ(queue_push(43, 1, "now"), 0);
+    ASSERT_EQ(queue_pop_worker_timed(1, &out, 0.05), 0);
+    queue_shutdown();
+    ASSERT_EQ(queue_pop_worker_timed(1, &out, 0.05), -1);
+    queue_destroy();
+    queue_msg_release(&out);
+}
+
+#define SHARD_WORKERS 4
+#define SHARD_USERS 32
+#define SHARD_MSGS 40
+
+typedef struct {
+    int worker;
+    int popped;
+    int last_seq[SHARD_USERS];
+    int out_of_order;
+} ShardWorker;
+
+static void *shard_worker_main(void *arg)
+{
+    ShardWorker *w = (ShardWorker *)arg;
+    for (int i = 0; i < SHARD_USERS; i++) {
+        w->last_seq[i] = -1;
+    }
+    QueueMsg out = {0};
+    while (queue_pop_worker(w->worker, &out) == 0) {
+        int u = (int)(out.user_id - 7000);
+        int seq = atoi(out.text);
+        // a later message can only go to the same or another worker after
+        // the earlier one was handed out, never before it
+        if (u >= 0 && u < SHARD_USERS && seq <= w->last_seq[u]) {
+            w->out_of_order++;
+        }
+        if (u >= 0 && u < SHARD_USERS) {
+            w->last_seq[u] = seq;
+        }
+        w->popped++;
+    }
+    queue_msg_release(&out);
+    return NULL;
+}
+
+static void *shard_producer_main(void *arg)
+{
+    int base = *(int *)arg;
+    char buf[16];
+    for (int m = 0; m < SHARD_MSGS; m++) {
+        for (int u = base; u < base + SHARD_USERS / 2; u++) {
+            snprintf(buf, sizeof(buf), "%d", m);
+            while (queue_push((int64_t)(7000 + u), 1, buf) != 0) {
+                usleep(100); // ring full; workers are draining
+            }
+        }
+    }
+    return NULL;
+}
+
+// sharded: concurrent producers and workers lose nothing, and each worker
+// sees every user's messages in push order
+TEST(queue_sharded_concurrent_fifo)
+{
+    ASSERT_EQ(queue_init_sharded(8, SHARD_WORKERS), 0);
+
+    ShardWorker workers[SHARD_WORKERS];
+    pthread_t wt[SHARD_WORKERS];
+    for (int i = 0; i < SHARD_WORKERS; i++) {
+        memset(&workers[i], 0, sizeof(workers[i]));
+        workers[i].worker = i;
+        pthread_create(&wt[i], NULL, shard_worker_main, &workers[i]);
+    }
+
+    int bases[2] = {0, SHARD_USERS / 2};
+    pthread_t pt[2];
+    for (int i = 0; i < 2; i++) {
+        pthread_create(&pt[i], NULL, shard_producer_main, &bases[i]);
+    }
+    for (int i = 0; i < 2; i++) {
+        pthread_join(pt[i], NULL);
+    }
+
+    queue_shutdown();
+    int total = 0;
+    int disorder = 0;
+    for (int i = 0; i < SHARD_WORKERS; i++) {
+        pthread_join(wt[i], NULL);
+        total += workers[i].popped;
+        disorder += workers[i].out_of_order;
+    }
+    ASSERT_EQ(total, SHARD_USERS * SHARD_MSGS);
+    ASSERT_EQ(disorder, 0);
+    ASSERT_EQ(queue_depth(), 0);
+
+    queue_destroy();
+}
+
+static void *blocking_pop_worker1(void *arg)
+{
+    QueueMsg *out = (QueueMsg *)arg;
+    return (void *)(intptr_t)queue_pop_worker(1, out);
+}
+
+// sharded: an idle worker asleep on its own shard is woken for a push that
+// lands on a shard whose owner is busy
+TEST(queue_sharded_push_wakes_idle_thief)
+{
+    ASSERT_EQ(queue_init_sharded(8, 2), 0);
+
+    QueueMsg out = {0};
+    memset(&out, 0, sizeof(out));
+    pthread_t t;
+    pthread_create(&t, NULL, blocking_pop_worker1, &out);
+    usleep(50000); // let it go to sleep
+
+    // push to many users so at least one lands on shard 0
+    for (int i = 0; i < 16; i++) {
+        queue_push((int64_t)(9000 + i), 9, "wake");
+    }
+
+    double t0 = monotonic_sec();
+    void *rc = NULL;
+    pthread_join(t, &rc);
+    ASSERT_EQ((int)(intptr_t)rc, 0);
+    ASSERT(monotonic_sec() - t0 < 1.0);
+    ASSERT_STR_EQ(out.text, "wake");
+
+    queue_shutdown();
+    while (queue_pop_worker(0, &out) == 0) {
+    }
+    queue_destroy();
+    queue_msg_release(&out);
 }
 
 int main(void)
@@ -443,9 +1164,10 @@ TEST(queue_property_no_overwrite)
 
     // pop all and verify content matches original (no corruption)
     for (int i = 0; i < 8; i++) {
-        QueueMsg out;
+        QueueMsg out = {0};
         ASSERT_EQ(queue_pop(&out), 0);
         ASSERT_STR_EQ(out.text, expected[i]);
+        queue_msg_release(&out);
     }
 
     queue_shutdown();
@@ -466,11 +1188,12 @@ TEST(queue_property_fifo_order)
 
     // pop and verify FIFO order
     for (int i = 0; i < 20; i++) {
-        QueueMsg out;
+        QueueMsg out = {0};
         ASSERT_EQ(queue_pop(&out), 0);
         char expected[64];
         snprintf(expected, sizeof(expected), "msg-%03d", i);
         ASSERT_STR_EQ(out.text, expected);
+        queue_msg_release(&out);
     }
 
     queue_shutdown();
@@ -492,7 +1215,7 @@ TEST(queue_property_bounded_memory)
     queue_shutdown();
 
     // pop all
-    QueueMsg out;
+    QueueMsg out = {0};
     while (queue_pop(&out) == 0) {
         // drain
     }
@@ -502,6 +1225,7 @@ TEST(queue_property_bounded_memory)
     ASSERT_EQ(queue_depth(), 0);
 
     queue_destroy();
+    queue_msg_release(&out);
 }
 
 // Capacity is always power-of-2: test this indirectly,
@@ -527,10 +1251,11 @@ TEST(queue_property_capacity_pow2)
         ASSERT_EQ(queue_push(1, 1, "overflow"), -1);
 
         queue_shutdown();
-        QueueMsg out;
+        QueueMsg out = {0};
         while (queue_pop(&out) == 0) {
         }
         queue_destroy();
+        queue_msg_release(&out);
     }
 }
 
@@ -547,8 +1272,8 @@ TEST(queue_property_hash_distribution)
     // can only verify through ring_count that all 1000 are present
     ASSERT_EQ(queue_ring_count(), 1000);
 
-    /* The queue uses 64 buckets internally (QUEUE_BUCKETS).
-     * Average load = 1000/64 ≈ 15.6
+    /* The user table starts at 64 buckets (QUEUE_BUCKETS) and grows to keep
+     * the load factor at or below 1, so all 1000 users end up spread out.
      * We can't inspect buckets directly, but if the hash is severely broken,
      * one bucket would have all 1000 and round-robin would break.
      * We verify by checking that round-robin pops from multiple users
@@ -558,7 +1283,7 @@ TEST(queue_property_hash_distribution)
 
     int unique_users[20] = {0};
     int unique_count = 0;
-    QueueMsg out;
+    QueueMsg out = {0};
     for (int i = 0; i < 20 && queue_pop(&out) == 0; i++) {
         int found = 0;
         for (int j = 0; j < unique_count; j++) {
@@ -581,4 +1306,5 @@ TEST(queue_property_hash_distribution)
     }
 
     queue_destroy();
+    queue_msg_release(&out);
 }
@@ -0,0 +1,166 @@
+#define _POSIX_C_SOURCE 200809L
+#define _DEFAULT_SOURCE
+
+#include "test.h"
+#include "../src/config.h"
+#include "../src/metrics.h"
+#include "../src/ratelimit.h"
+
+#include <pthread.h>
+#include <signal.h>
+#include <stdio.h>
+#include <time.h>
+
+static double now_sec(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+TEST(ratelimit_uninitialised_passes)
+{
+    for (int i = 0; i < 100; i++) {
+        ASSERT(ratelimit_reserve(42) == 0.0);
+    }
+    ASSERT(ratelimit_peek(42) == 0.0);
+    ASSERT_EQ(ratelimit_init(-1, 60, 20), -1);
+    ratelimit_destroy();
+}
+
+TEST(ratelimit_chat_burst_then_rate)
+{
+    ASSERT_EQ(ratelimit_init(0, 60, 20), 0);
+    ASSERT_EQ(ratelimit_init(0, 60, 20), -1); // already initialised
+
+    // a private chat bursts, then gets one message a second
+    for (int i = 0; i < RATELIMIT_CHAT_BURST; i++) {
+        ASSERT(ratelimit_reserve(42) == 0.0);
+    }
+    double w1 = ratelimit_reserve(42);
+    double w2 = ratelimit_reserve(42);
+    ASSERT(w1 > 0.9 && w1 <= 1.0);
+    ASSERT(w2 > 1.9 && w2 <= 2.0);
+    ASSERT(ratelimit_peek(42) > 2.9);
+
+    // other chats are not affected
+    ASSERT(ratelimit_peek(43) == 0.0);
+    ASSERT(ratelimit_reserve(43) == 0.0);
+
+    // a group gets 20 a minute: 3 s apart after its burst
+    for (int i = 0; i < RATELIMIT_GROUP_BURST; i++) {
+        ASSERT(ratelimit_reserve(-100) == 0.0);
+    }
+    double g = ratelimit_reserve(-100);
+    ASSERT(g > 2.9 && g <= 3.0);
+
+    RateLimitStats st;
+    ratelimit_stats(&st);
+    ASSERT_EQ(st.delayed, 3);
+    ASSERT_EQ(st.chats, 3);
+    ratelimit_destroy();
+}
+
+TEST(ratelimit_global_spreads_chats)
+{
+    ASSERT_EQ(ratelimit_init(10, 0, 0), 0);
+    // one second's worth goes at once, the rest 100 ms apart
+    for (int i = 0; i < 10; i++) {
+        ASSERT(ratelimit_reserve(i + 1) == 0.0);
+    }
+    double w = ratelimit_reserve(100);
+    ASSERT(w > 0.09 && w <= 0.1);
+    w = ratelimit_reserve(101);
+    ASSERT(w > 0.19 && w <= 0.2);
+    ratelimit_destroy();
+}
+
+TEST(ratelimit_pause_holds_everyone)
+{
+    ASSERT_EQ(ratelimit_init(0, 0, 0), 0);
+    ratelimit_pause(0.3);
+    ratelimit_pause(0.1); // never shortens
+    ASSERT(ratelimit_peek(7) > 0.2);
+    ASSERT(ratelimit_peek(-7) > 0.2);
+
+    uint64_t waits = metrics_count(MET_RATELIMIT_DELAY);
+    double t0 = now_sec();
+    ASSERT_EQ(ratelimit_acquire(7, NULL), 0);
+    ASSERT(now_sec() - t0 >= 0.29);
+    ASSERT(ratelimit_peek(7) == 0.0);
+    // the wait is recorded as the send's rate-limit delay
+    ASSERT_EQ(metrics_count(MET_RATELIMIT_DELAY), waits + 1);
+    ASSERT(metrics_quantile(MET_RATELIMIT_DELAY, 1.0) >= 0.29);
+
+    RateLimitStats st;
+    ratelimit_stats(&st);
+    ASSERT_EQ(st.pauses, 1);
+    ratelimit_destroy();
+}
+
+TEST(ratelimit_acquire_aborts)
+{
+    ASSERT_EQ(ratelimit_init(0, 0, 0), 0);
+    ratelimit_pause(30.0);
+    volatile sig_atomic_t running = 0;
+    double t0 = now_sec();
+    ASSERT_EQ(ratelimit_acquire(7, &running), -1);
+    ASSERT(now_sec() - t0 < 1.0);
+    ratelimit_destroy();
+    ASSERT(ratelimit_peek(7) == 0.0); // destroy clears the pause
+}
+
+TEST(ratelimit_idle_chats_pruned)
+{
+    ASSERT_EQ(ratelimit_init(0, 6000, 6000), 0);
+    // each chat's bucket refills within 10 ms, so idle ones are reclaimed
+    // instead of growing the table without bound
+    for (int round = 0; round < 5; round++) {
+        for (int i = 0; i < RATELIMIT_BUCKETS; i++) {
+            ratelimit_reserve(round * 1000 + i + 1);
+        }
+        struct timespec ts = {0, 20 * 1000 * 1000};
+        nanosleep(&ts, NULL);
+    }
+    RateLimitStats st;
+    ratelimit_stats(&st);
+    ASSERT(st.chats <= RATELIMIT_BUCKETS * 2);
+    ratelimit_destroy();
+}
+
+#define RC_THREADS 4
+#define RC_OPS 2000
+
+static void *reserve_worker(void *arg)
+{
+    int id = (int)(intptr_t)arg;
+    for (int i = 0; i < RC_OPS; i++) {
+        ratelimit_reserve((int64_t)((id * 31 + i) % 97) - 48);
+    }
+    return NULL;
+}
+
+TEST(ratelimit_concurrent)
+{
+    ASSERT_EQ(ratelimit_init(1000, 6000, 6000), 0);
+    pthread_t t[RC_THREADS];
+    for (int i = 0; i < RC_THREADS; i++) {
+        ASSERT_EQ(pthread_create(&t[i], NULL, reserve_worker, (void *)(intptr_t)i), 0);
+    }
+    for (int i = 0; i < RC_THREADS; i++) {
+        pthread_join(t[i], NULL);
+    }
+    RateLimitStats st;
+    ratelimit_stats(&st);
+    ASSERT_EQ(st.sends, (uint64_t)RC_THREADS * RC_OPS);
+    // the global bucket schedules the next send about 7 s out
+    double w = ratelimit_reserve(1);
+    ASSERT(w > 6.0 && w < 7.1);
+    ratelimit_destroy();
+}
+
+int main(void)
+{
+    printf("=== test_ratelimit ===\n");
+    return test_summarise();
+}
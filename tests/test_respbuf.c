@@ -0,0 +1,118 @@
+#include "test.h"
+#include "../src/respbuf.h"
+
+#include <stdio.h>
+#include <string.h>
+
+// feed n bytes of 'x' through the curl write adapter in 1 KiB chunks
+static size_t feed(RespBuf *b, size_t n)
+{
+    char chunk[1024];
+    memset(chunk, 'x', sizeof(chunk));
+    size_t total = 0;
+    while (total < n) {
+        size_t k = (n - total < sizeof(chunk)) ? n - total : sizeof(chunk);
+        size_t w = respbuf_write_cb(chunk, 1, k, b);
+        total += w;
+        if (w != k) {
+            break;
+        }
+    }
+    return total;
+}
+
+TEST(respbuf_append_terminates)
+{
+    RespBuf b;
+    respbuf_init(&b, 0, "test");
+    respbuf_begin(&b, NULL);
+    ASSERT_EQ(respbuf_append(&b, "{\"ok\":", 6), 0);
+    ASSERT_EQ(respbuf_append(&b, "true}", 5), 0);
+    ASSERT_EQ(b.len, 11);
+    ASSERT_STR_EQ(b.data, "{\"ok\":true}");
+    respbuf_free(&b);
+}
+
+TEST(respbuf_reused_without_realloc)
+{
+    RespBuf b;
+    respbuf_init(&b, 0, "test");
+    respbuf_begin(&b, NULL);
+    ASSERT_EQ(feed(&b, 20000), 20000);
+    char *data = b.data;
+    size_t cap = b.cap;
+
+    for (int i = 0; i < 50; i++) {
+        respbuf_begin(&b, NULL);
+        ASSERT_EQ(b.len, 0);
+        ASSERT_EQ(feed(&b, 10000 + (size_t)i * 100), 10000 + (size_t)i * 100);
+    }
+    ASSERT(b.data == data);
+    ASSERT_EQ(b.cap, cap);
+    respbuf_free(&b);
+}
+
+TEST(respbuf_max_enforced)
+{
+    RespBuf b;
+    respbuf_init(&b, 8192, "test");
+    respbuf_begin(&b, NULL);
+    // the limit counts the terminator, so one byte short of max fits
+    ASSERT_EQ(feed(&b, 8191), 8191);
+    respbuf_begin(&b, NULL);
+    ASSERT(feed(&b, 8192) < 8192);
+    ASSERT(b.cap <= 8192);
+    respbuf_free(&b);
+}
+
+TEST(respbuf_shrinks_after_small_streak)
+{
+    RespBuf b;
+    respbuf_init(&b, 0, "test");
+    respbuf_begin(&b, NULL);
+    ASSERT_EQ(feed(&b, 400 * 1024), 400 * 1024);
+    size_t big = b.cap;
+    ASSERT(big > RESPBUF_RETAIN);
+
+    // one small response does not give memory back
+    respbuf_begin(&b, NULL);
+    feed(&b, 2000);
+    respbuf_begin(&b, NULL);
+    ASSERT_EQ(b.cap, big);
+
+    // a sustained run of small ones does
+    for (int i = 0; i < RESPBUF_SHRINK_AFTER; i++) {
+        feed(&b, 2000);
+        respbuf_begin(&b, NULL);
+    }
+    ASSERT(b.cap < big);
+    ASSERT(b.cap >= RESPBUF_RETAIN);
+
+    // and the buffer still works afterwards
+    ASSERT_EQ(feed(&b, 3000), 3000);
+    ASSERT_EQ(b.len, 3000);
+    respbuf_free(&b);
+}
+
+TEST(respbuf_large_response_resets_streak)
+{
+    RespBuf b;
+    respbuf_init(&b, 0, "test");
+    respbuf_begin(&b, NULL);
+    feed(&b, 400 * 1024);
+    size_t big = b.cap;
+
+    for (int i = 0; i < RESPBUF_SHRINK_AFTER * 3; i++) {
+        respbuf_begin(&b, NULL);
+        // every fourth response is large again, so the capacity stays
+        feed(&b, (i % 4 == 3) ? 300 * 1024 : 1000);
+    }
+    ASSERT_EQ(b.cap, big);
+    respbuf_free(&b);
+}
+
+int main(void)
+{
+    printf("=== test_respbuf ===\n");
+    return test_summarise();
+}
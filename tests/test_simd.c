@@ -0,0 +1,124 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "test.h"
+#include "../src/simd.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// byte-at-a-time references for the vector scans
+static size_t ref_json_plain(const char *s, size_t n)
+{
+    size_t i = 0;
+    while (i < n && (unsigned char)s[i] >= 0x20 && s[i] != '"' && s[i] != '\\') {
+        i++;
+    }
+    return i;
+}
+
+static size_t ref_ascii_run(const char *s, size_t n)
+{
+    size_t i = 0;
+    while (i < n && (unsigned char)s[i] < 0x80) {
+        i++;
+    }
+    return i;
+}
+
+TEST(simd_backend_named)
+{
+    const char *b = simd_backend();
+    ASSERT(strcmp(b, "avx2") == 0 || strcmp(b, "sse2") == 0 || strcmp(b, "neon") == 0 ||
+           strcmp(b, "scalar") == 0);
+    printf("  simd backend: %s\n", b);
+}
+
+TEST(simd_json_plain_every_position)
+{
+    // each special byte at every offset of a buffer longer than two vectors
+    static const char specials[] = {'"', '\\', '\n', '\x01', '\x1f'};
+    char buf[80];
+    for (size_t k = 0; k < sizeof(specials); k++) {
+        for (size_t pos = 0; pos < sizeof(buf); pos++) {
+            memset(buf, 'a', sizeof(buf));
+            buf[pos] = specials[k];
+            ASSERT_EQ(simd_json_plain(buf, sizeof(buf)), pos);
+        }
+    }
+    // bytes >= 0x80 and the edges of the control range are plain
+    memset(buf, '\xC3', sizeof(buf));
+    buf[10] = ' ';
+    buf[20] = '\x7f';
+    buf[30] = '\xff';
+    ASSERT_EQ(simd_json_plain(buf, sizeof(buf)), sizeof(buf));
+    ASSERT_EQ(simd_json_plain(buf, 0), 0);
+}
+
+TEST(simd_matches_reference_random)
+{
+    srand(7);
+    char buf[257];
+    for (int iter = 0; iter < 2000; iter++) {
+        size_t n = (size_t)(rand() % (int)sizeof(buf));
+        for (size_t i = 0; i < n; i++) {
+            // mostly plain text, with the occasional byte of interest
+            int r = rand() % 64;
+            buf[i] = (char)(r == 0 ? '"' : r == 1 ? '\n' : r == 2 ? 0xE2 : 'a' + r % 26);
+        }
+        size_t off = (size_t)rand() % (n + 1); // unaligned starts
+        ASSERT_EQ(simd_json_plain(buf + off, n - off), ref_json_plain(buf + off, n - off));
+        ASSERT_EQ(simd_ascii_run(buf + off, n - off), ref_ascii_run(buf + off, n - off));
+    }
+}
+
+TEST(simd_utf8_valid_sequences)
+{
+    static const char ok[] = "plain ascii, \xC3\xA9, \xE2\x9C\x8D, \xF0\x9F\x98\x80 and more text here";
+    ASSERT_EQ(simd_utf8_valid(ok, sizeof(ok) - 1), sizeof(ok) - 1);
+    ASSERT_EQ(simd_utf8_valid("ab\xC3\x28", 4), 2);           // bad continuation
+    ASSERT_EQ(simd_utf8_valid("ab\xC0\xAF", 4), 2);           // overlong
+    ASSERT_EQ(simd_utf8_valid("ab\xE0\x80\xAF", 5), 2);       // overlong 3-byte
+    ASSERT_EQ(simd_utf8_valid("ab\xED\xA0\x80", 5), 2);       // surrogate
+    ASSERT_EQ(simd_utf8_valid("ab\xF4\x90\x80\x80", 6), 2);   // above U+10FFFF
+    ASSERT_EQ(simd_utf8_valid("ab\x80", 3), 2);               // stray continuation
+    ASSERT_EQ(simd_utf8_valid("ab\xE2\x9C", 4), 2);           // cut short
+}
+
+TEST(simd_utf8_cut_and_fit)
+{
+    ASSERT_EQ(simd_utf8_cut("ab\xE2\x9C", 4), 2);
+    ASSERT_EQ(simd_utf8_cut("ab\xE2\x9C\x8D", 5), 5);
+    ASSERT_EQ(simd_utf8_cut("ab", 2), 2);
+
+    // "é" is one unit in two bytes, an emoji two units in four bytes
+    static const char mix[] = "ab\xC3\xA9\xF0\x9F\x98\x80z";
+    size_t n = sizeof(mix) - 1;
+    ASSERT_EQ(simd_utf8_fit(mix, n, 100), n);
+    ASSERT_EQ(simd_utf8_fit(mix, n, 2), 2);
+    ASSERT_EQ(simd_utf8_fit(mix, n, 3), 4);
+    ASSERT_EQ(simd_utf8_fit(mix, n, 4), 4); // the emoji's pair does not fit
+    ASSERT_EQ(simd_utf8_fit(mix, n, 5), 8);
+    ASSERT_EQ(simd_utf8_fit(mix, n, 6), n);
+
+    // a long ASCII text is cut at exactly max_units
+    char big[5000];
+    memset(big, 'x', sizeof(big));
+    ASSERT_EQ(simd_utf8_fit(big, sizeof(big), 4096), 4096);
+}
+
+TEST(simd_utf8_repair_marks_bad_bytes)
+{
+    char s[] = "ok \xC3\x28 then \xFF\xFE end \xE2\x9C\x8D";
+    size_t n = strlen(s);
+    ASSERT_EQ(simd_utf8_repair(s, n), 3);
+    ASSERT_STR_EQ(s, "ok ?( then ?? end \xE2\x9C\x8D");
+    ASSERT_EQ(simd_utf8_valid(s, n), n);
+    ASSERT_EQ(simd_utf8_repair(s, n), 0);
+}
+
+int main(void)
+{
+    printf("=== test_simd ===\n");
+    return test_summarise();
+}
@@ -51,7 +51,7 @@ TEST(stress_queue_fairness)
 
     // pop all and count per-user
     int counts[FAIR_NTHREADS] = {0};
-    QueueMsg out;
+    QueueMsg out = {0};
     while (queue_pop(&out) == 0) {
         for (int i = 0; i < FAIR_NTHREADS; i++) {
             if (out.user_id == 1000 + i) {
@@ -75,6 +75,7 @@ TEST(stress_queue_fairness)
     }
 
     queue_destroy();
+    queue_msg_release(&out);
 }
 
 // # queue push after shutdown
@@ -90,7 +91,7 @@ TEST(stress_queue_push_after_shutdown)
     // push may succeed (it writes to ring), pop should eventually drain
     (void)rc;
 
-    QueueMsg out;
+    QueueMsg out = {0};
     // try to pop - with shutdown flag, if queue has items it pops them,
     // once empty returns -1
     int pop_rc = queue_pop(&out);
@@ -102,6 +103,7 @@ TEST(stress_queue_push_after_shutdown)
     ASSERT_EQ(queue_pop(&out), -1);
 
     queue_destroy();
+    queue_msg_release(&out);
 }
 
 // # double shutdown
@@ -171,12 +173,13 @@ static pthread_mutex_t g_consumed_mtx = PTHREAD_MUTEX_INITIALIZER;
 static void *consumer_thread(void *arg)
 {
     (void)arg;
-    QueueMsg out;
+    QueueMsg out = {0};
     while (queue_pop(&out) == 0) {
         pthread_mutex_lock(&g_consumed_mtx);
         g_consumed_count++;
         pthread_mutex_unlock(&g_consumed_mtx);
     }
+    queue_msg_release(&out);
     return NULL;
 }
 
@@ -0,0 +1,213 @@
+#define _POSIX_C_SOURCE 200809L
+#define _DEFAULT_SOURCE
+
+#include "test.h"
+#include "../lib/cJSON.h"
+#include "../src/logger.h"
+#include "../src/trace.h"
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define TRACE_TEST_PATH "/tmp/tgbot_test_trace.json"
+#define THREADS 4
+#define PER_THREAD 2000
+
+// a finished trace: 100 ms queued, 1 s of LLM, 50 ms send
+static void fake_reply(TraceCtx *t, uint64_t id, double ingress, double llm_sec)
+{
+    trace_begin(t, id, 42, ingress, 1, 1);
+    trace_stage(t, TRACE_QUEUE, ingress, ingress + 0.1);
+    trace_stage(t, TRACE_LLM, ingress + 0.1, ingress + 0.1 + llm_sec);
+    trace_stage(t, TRACE_SEND, ingress + 0.1 + llm_sec, ingress + 0.15 + llm_sec);
+}
+
+static cJSON *load_dump(void)
+{
+    FILE *f = fopen(TRACE_TEST_PATH, "r");
+    if (!f) {
+        return NULL;
+    }
+    static char buf[1 << 20];
+    size_t n = fread(buf, 1, sizeof(buf) - 1, f);
+    fclose(f);
+    buf[n] = '\0';
+    return cJSON_Parse(buf);
+}
+
+// number of events named name whose tid is id
+static int count_events(const cJSON *root, const char *name, uint64_t id)
+{
+    int n = 0;
+    const cJSON *ev = NULL;
+    cJSON_ArrayForEach(ev, cJSON_GetObjectItemCaseSensitive(root, "traceEvents"))
+    {
+        const cJSON *nm = cJSON_GetObjectItemCaseSensitive(ev, "name");
+        const cJSON *tid = cJSON_GetObjectItemCaseSensitive(ev, "tid");
+        if (cJSON_IsString(nm) && strcmp(nm->valuestring, name) == 0 && cJSON_IsNumber(tid) &&
+            (uint64_t)tid->valuedouble == id) {
+            n++;
+        }
+    }
+    return n;
+}
+
+TEST(trace_off_is_a_no_op)
+{
+    trace_destroy();
+    ASSERT_EQ(trace_next_id(), 0);
+    TraceCtx t;
+    fake_reply(&t, 0, 10.0, 1.0);
+    ASSERT(t.start[TRACE_LLM] == 0);
+    ASSERT_EQ(trace_commit(&t), 0);
+    ASSERT_EQ(trace_count(), 0);
+    ASSERT_EQ(trace_dump(TRACE_TEST_PATH), -1);
+    ASSERT_EQ(trace_init(0, 1, 0), -1);
+    ASSERT_EQ(trace_init(64, -1, 0), -1);
+}
+
+TEST(trace_head_sampling)
+{
+    ASSERT_EQ(trace_init(64, 4, 0), 0);
+    int kept = 0;
+    for (int i = 0; i < 20; i++) {
+        uint64_t id = trace_next_id();
+        ASSERT(id != 0);
+        TraceCtx t;
+        fake_reply(&t, id, 10.0, 0.01);
+        kept += trace_commit(&t);
+    }
+    // ids run on from earlier tests, so exactly every fourth is kept
+    ASSERT_EQ(kept, 5);
+    ASSERT_EQ(trace_count(), 5);
+    trace_destroy();
+}
+
+TEST(trace_keeps_slow_replies)
+{
+    ASSERT_EQ(trace_init(64, 0, 2.0), 0);
+    TraceCtx t;
+    fake_reply(&t, 7, 10.0, 0.5);
+    ASSERT_EQ(trace_commit(&t), 0);
+    fake_reply(&t, 8, 10.0, 3.0);
+    ASSERT_EQ(trace_commit(&t), 1);
+    ASSERT_EQ(trace_count(), 1);
+    trace_destroy();
+}
+
+TEST(trace_stage_twice_spans_both)
+{
+    TraceCtx t;
+    trace_begin(&t, 1, 1, 1.0, 0, 1);
+    trace_stage(&t, TRACE_SEND, 2.0, 2.5);
+    trace_stage(&t, TRACE_SEND, 3.0, 3.5); // fallback send after a failed edit
+    ASSERT(t.start[TRACE_SEND] == 2.0);
+    ASSERT(t.end[TRACE_SEND] == 3.5);
+    trace_stage(&t, TRACE_STAGES, 1.0, 2.0); // ignored
+}
+
+TEST(trace_dump_chrome_json)
+{
+    ASSERT_EQ(trace_init(64, 1, 0), 0);
+    // 100 traces into 64 slots: the oldest 36 are overwritten
+    for (uint64_t id = 1; id <= 100; id++) {
+        TraceCtx t;
+        fake_reply(&t, id, (double)id, 1.0);
+        ASSERT_EQ(trace_commit(&t), 1);
+    }
+    ASSERT_EQ(trace_count(), 64);
+    unlink(TRACE_TEST_PATH);
+    ASSERT_EQ(trace_dump(TRACE_TEST_PATH), 0);
+
+    cJSON *root = load_dump();
+    ASSERT_NOT_NULL(root);
+    ASSERT_EQ(count_events(root, "reply", 100), 1);
+    ASSERT_EQ(count_events(root, "llm", 100), 1);
+    ASSERT_EQ(count_events(root, "queue_wait", 37), 1);
+    ASSERT_EQ(count_events(root, "reply", 36), 0);
+    ASSERT_EQ(count_events(root, "thinking", 100), 0); // stage did not run
+
+    // spans are microseconds: the reply runs from ingress to the end of the send
+    const cJSON *ev = NULL;
+    int checked = 0;
+    cJSON_ArrayForEach(ev, cJSON_GetObjectItemCaseSensitive(root, "traceEvents"))
+    {
+        const cJSON *nm = cJSON_GetObjectItemCaseSensitive(ev, "name");
+        const cJSON *tid = cJSON_GetObjectItemCaseSensitive(ev, "tid");
+        if (!cJSON_IsString(nm) || strcmp(nm->valuestring, "reply") != 0 ||
+            (uint64_t)tid->valuedouble != 50) {
+            continue;
+        }
+        ASSERT_STR_EQ(cJSON_GetObjectItemCaseSensitive(ev, "ph")->valuestring, "X");
+        double ts = cJSON_GetObjectItemCaseSensitive(ev, "ts")->valuedouble;
+        double dur = cJSON_GetObjectItemCaseSensitive(ev, "dur")->valuedouble;
+        ASSERT(ts > 50e6 - 1 && ts < 50e6 + 1);
+        ASSERT(dur > 1.15e6 - 1 && dur < 1.15e6 + 1);
+        ASSERT_EQ(cJSON_GetObjectItemCaseSensitive(ev, "pid")->valueint, 2);
+        checked++;
+    }
+    ASSERT_EQ(checked, 1);
+    cJSON_Delete(root);
+    unlink(TRACE_TEST_PATH);
+    trace_destroy();
+}
+
+TEST(trace_dumper_on_request)
+{
+    ASSERT_EQ(trace_init(64, 1, 0), 0);
+    TraceCtx t;
+    fake_reply(&t, 5, 1.0, 0.2);
+    trace_commit(&t);
+    unlink(TRACE_TEST_PATH);
+    ASSERT_EQ(trace_start_dumper(TRACE_TEST_PATH), 0);
+    ASSERT_EQ(trace_start_dumper(TRACE_TEST_PATH), -1); // already running
+    trace_request_dump();
+    int found = 0;
+    for (int i = 0; i < 200 && !found; i++) {
+        found = access(TRACE_TEST_PATH, F_OK) == 0;
+        usleep(10000);
+    }
+    ASSERT(found);
+    trace_destroy();
+    unlink(TRACE_TEST_PATH);
+    trace_request_dump(); // no dumper: ignored
+}
+
+static void *committer(void *arg)
+{
+    (void)arg;
+    for (int i = 0; i < PER_THREAD; i++) {
+        TraceCtx t;
+        fake_reply(&t, trace_next_id(), 1.0, 0.1);
+        trace_commit(&t);
+    }
+    return NULL;
+}
+
+TEST(trace_concurrent_commits)
+{
+    ASSERT_EQ(trace_init(THREADS * PER_THREAD, 1, 0), 0);
+    pthread_t th[THREADS];
+    for (int i = 0; i < THREADS; i++) {
+        ASSERT_EQ(pthread_create(&th[i], NULL, committer, NULL), 0);
+    }
+    // dumping while workers commit must not disturb them
+    for (int i = 0; i < 5; i++) {
+        trace_dump(TRACE_TEST_PATH);
+    }
+    for (int i = 0; i < THREADS; i++) {
+        pthread_join(th[i], NULL);
+    }
+    ASSERT_EQ(trace_count(), (size_t)(THREADS * PER_THREAD));
+    unlink(TRACE_TEST_PATH);
+    trace_destroy();
+}
+
+int main(void)
+{
+    printf("=== test_trace ===\n");
+    return test_summarise();
+}
@@ -0,0 +1,139 @@
+#define _POSIX_C_SOURCE 200809L
+#define _DEFAULT_SOURCE
+
+#include "test.h"
+#include "../src/config.h"
+#include "../src/ratelimit.h"
+#include "../src/typing.h"
+
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <unistd.h>
+
+// what the typing thread sent, per chat id 0..15
+static struct {
+    pthread_mutex_t lock;
+    int sent[16];
+} g_rec = {.lock = PTHREAD_MUTEX_INITIALIZER};
+
+static int record_send(int64_t chat_id, void *ud)
+{
+    (void)ud;
+    pthread_mutex_lock(&g_rec.lock);
+    if (chat_id >= 0 && chat_id < 16) {
+        g_rec.sent[chat_id]++;
+    }
+    pthread_mutex_unlock(&g_rec.lock);
+    return 0;
+}
+
+static int sent_to(int64_t chat_id)
+{
+    pthread_mutex_lock(&g_rec.lock);
+    int n = g_rec.sent[chat_id];
+    pthread_mutex_unlock(&g_rec.lock);
+    return n;
+}
+
+static void sleep_sec(double sec)
+{
+    usleep((useconds_t)(sec * 1e6));
+}
+
+TEST(typing_off_is_a_no_op)
+{
+    ASSERT_EQ(typing_start(NULL, NULL), -1);
+    typing_begin(1);
+    typing_end(1);
+    TypingStats ts;
+    typing_stats(&ts);
+    ASSERT_EQ(ts.busy, 0);
+    ASSERT_EQ(ts.shared, 0);
+    typing_stop(); // not running: ignored
+}
+
+TEST(typing_fast_reply_never_shows)
+{
+    ASSERT_EQ(typing_start(record_send, NULL), 0);
+    ASSERT_EQ(typing_start(record_send, NULL), -1); // already running
+    typing_begin(1);
+    typing_end(1); // answered within the grace
+    sleep_sec(TYPING_GRACE_SEC + 3 * TYPING_TICK_SEC);
+    ASSERT_EQ(sent_to(1), 0);
+    TypingStats ts;
+    typing_stats(&ts);
+    ASSERT_EQ(ts.sent, 0);
+    ASSERT_EQ(ts.skipped, 1);
+    ASSERT_EQ(ts.busy, 0);
+    typing_stop();
+}
+
+TEST(typing_shared_and_refreshed)
+{
+    ASSERT_EQ(typing_start(record_send, NULL), 0);
+    // two replies in progress for chat 2 share one indicator
+    typing_begin(2);
+    typing_begin(2);
+    typing_begin(3);
+    TypingStats ts;
+    typing_stats(&ts);
+    ASSERT_EQ(ts.busy, 2);
+    ASSERT_EQ(ts.shared, 1);
+
+    sleep_sec(TYPING_GRACE_SEC + 3 * TYPING_TICK_SEC);
+    ASSERT_EQ(sent_to(2), 1);
+    ASSERT_EQ(sent_to(3), 1);
+    typing_end(3);
+
+    // chat 2 is still busy, so it is refreshed before Telegram's 5 s run out
+    typing_end(2);
+    sleep_sec(TYPING_REFRESH_SEC);
+    ASSERT_EQ(sent_to(2), 2);
+    ASSERT_EQ(sent_to(3), 1);
+
+    typing_end(2);
+    typing_stats(&ts);
+    ASSERT_EQ(ts.busy, 0);
+    typing_end(2); // unbalanced end: ignored
+    typing_stop();
+}
+
+TEST(typing_held_back_by_pause)
+{
+    ASSERT_EQ(typing_start(record_send, NULL), 0);
+    // while a 429 pause holds every send, an indicator would only add to it
+    ratelimit_pause(2.0);
+    typing_begin(4);
+    sleep_sec(TYPING_GRACE_SEC + 3 * TYPING_TICK_SEC);
+    ASSERT_EQ(sent_to(4), 0);
+    typing_end(4);
+    typing_stop();
+    ratelimit_destroy();
+}
+
+TEST(typing_table_full)
+{
+    ASSERT_EQ(typing_start(record_send, NULL), 0);
+    TypingStats before;
+    typing_stats(&before);
+    for (int64_t c = 0; c <= TYPING_CHATS_MAX; c++) {
+        typing_begin(1000 + c);
+    }
+    TypingStats ts;
+    typing_stats(&ts);
+    ASSERT_EQ(ts.busy, TYPING_CHATS_MAX);
+    ASSERT_EQ(ts.skipped, before.skipped + 1);
+    for (int64_t c = 0; c <= TYPING_CHATS_MAX; c++) {
+        typing_end(1000 + c);
+    }
+    typing_stats(&ts);
+    ASSERT_EQ(ts.busy, 0);
+    typing_stop();
+}
+
+int main(void)
+{
+    printf("=== test_typing ===\n");
+    return test_summarise();
+}
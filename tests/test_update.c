@@ -0,0 +1,284 @@
+#include "test.h"
+#include "../src/update.h"
+#include "../lib/cJSON.h"
+
+#include <stdio.h>
+#include <string.h>
+
+// helper: scan body and check every field against the cJSON-derived view
+static int matches_cjson(const char *body)
+{
+    UpdateView v;
+    if (update_view_parse(body, strlen(body), &v) != 0) {
+        return 0;
+    }
+    cJSON *root = cJSON_Parse(body);
+    if (!root) {
+        return 0;
+    }
+    UpdateView r;
+    update_view_from_cjson(root, &r);
+
+    int ok = v.has_update_id == r.has_update_id && v.has_chat_id == r.has_chat_id &&
+             v.has_from_id == r.has_from_id;
+    ok = ok && (!v.has_update_id || v.update_id == r.update_id);
+    ok = ok && (!v.has_chat_id || v.chat_id == r.chat_id);
+    ok = ok && (!v.has_from_id || v.from_id == r.from_id);
+
+    const UpdStr *vs[] = {&v.chat_type, &v.first_name, &v.text};
+    const UpdStr *rs[] = {&r.chat_type, &r.first_name, &r.text};
+    for (size_t i = 0; ok && i < 3; i++) {
+        char a[256];
+        char b[256];
+        ok = !vs[i]->p == !rs[i]->p;
+        update_str_copy(vs[i], a, sizeof(a), "-");
+        update_str_copy(rs[i], b, sizeof(b), "-");
+        ok = ok && strcmp(a, b) == 0;
+    }
+    cJSON_Delete(root);
+    return ok;
+}
+
+TEST(update_private_message)
+{
+    const char *body = "{\"update_id\":123456789,\"message\":{\"message_id\":7,"
+                       "\"from\":{\"id\":42,\"is_bot\":false,\"first_name\":\"Ann\"},"
+                       "\"chat\":{\"id\":42,\"type\":\"private\"},\"date\":1700000000,"
+                       "\"text\":\"hello there\"}}";
+    UpdateView v;
+    ASSERT_EQ(update_view_parse(body, strlen(body), &v), 0);
+    ASSERT(v.has_update_id);
+    ASSERT_EQ(v.update_id, 123456789);
+    ASSERT_EQ(v.chat_id, 42);
+    ASSERT_EQ(v.from_id, 42);
+
+    char text[UPDATE_TEXT_MAX];
+    ASSERT_EQ(update_str_copy(&v.text, text, sizeof(text), ""), strlen("hello there"));
+    ASSERT_STR_EQ(text, "hello there");
+    ASSERT(matches_cjson(body));
+}
+
+TEST(update_group_negative_id)
+{
+    const char *body = "{\"message\":{\"chat\":{\"type\":\"supergroup\",\"id\":-1001234567890},"
+                       "\"from\":{\"id\":7,\"first_name\":\"Bo\"},\"text\":\"/help@bot\"},"
+                       "\"update_id\":5}";
+    UpdateView v;
+    ASSERT_EQ(update_view_parse(body, strlen(body), &v), 0);
+    ASSERT_EQ(v.chat_id, -1001234567890LL);
+    char type[32];
+    update_str_copy(&v.chat_type, type, sizeof(type), "private");
+    ASSERT_STR_EQ(type, "supergroup");
+    ASSERT(matches_cjson(body));
+}
+
+// fields handle_update() never reads are skipped without being materialised
+TEST(update_skips_unrelated_members)
+{
+    const char *body = "{\"update_id\":1,\"message\":{\"entities\":[{\"type\":\"bold\","
+                       "\"offset\":0,\"length\":3}],\"photo\":[[1,2],{\"a\":null}],"
+                       "\"reply_to_message\":{\"text\":\"nested\",\"chat\":{\"id\":9}},"
+                       "\"chat\":{\"id\":3},\"from\":{\"id\":4},\"text\":\"outer\","
+                       "\"x\":1.5e3,\"y\":true,\"z\":false}}";
+    UpdateView v;
+    ASSERT_EQ(update_view_parse(body, strlen(body), &v), 0);
+    ASSERT_EQ(v.chat_id, 3);
+    char text[64];
+    update_str_copy(&v.text, text, sizeof(text), "");
+    ASSERT_STR_EQ(text, "outer");
+    ASSERT(matches_cjson(body));
+}
+
+TEST(update_missing_and_wrong_types)
+{
+    ASSERT(matches_cjson("{}"));
+    ASSERT(matches_cjson("{\"update_id\":1}"));
+    ASSERT(matches_cjson("{\"update_id\":\"1\",\"message\":[]}"));
+    ASSERT(matches_cjson("{\"update_id\":2,\"message\":{\"chat\":{\"id\":\"x\"},\"text\":5}}"));
+    ASSERT(matches_cjson("{\"update_id\":3,\"message\":{\"chat\":null,\"from\":{\"id\":1}}}"));
+
+    UpdateView v;
+    const char *body = "{\"update_id\":4,\"message\":{\"text\":null}}";
+    ASSERT_EQ(update_view_parse(body, strlen(body), &v), 0);
+    ASSERT_NULL(v.text.p);
+    ASSERT(!v.has_chat_id);
+}
+
+// the first duplicate key wins, the same as cJSON_GetObjectItemCaseSensitive
+TEST(update_duplicate_keys)
+{
+    const char *body = "{\"update_id\":1,\"update_id\":2,\"message\":{\"text\":\"a\","
+                       "\"text\":\"b\",\"chat\":{\"id\":5},\"chat\":{\"id\":6}}}";
+    UpdateView v;
+    ASSERT_EQ(update_view_parse(body, strlen(body), &v), 0);
+    ASSERT_EQ(v.update_id, 1);
+    ASSERT_EQ(v.chat_id, 5);
+    ASSERT(matches_cjson(body));
+}
+
+TEST(update_escaped_text)
+{
+    const char *body = "{\"update_id\":1,\"message\":{\"text\":"
+                       "\"q\\\"b\\\\s\\/n\\nt\\t\\u00e9\\u20ac\\ud83d\\ude00\"}}";
+    UpdateView v;
+    ASSERT_EQ(update_view_parse(body, strlen(body), &v), 0);
+    ASSERT(v.text.escaped);
+    char text[64];
+    update_str_copy(&v.text, text, sizeof(text), "");
+    ASSERT_STR_EQ(text, "q\"b\\s/n\nt\t\xc3\xa9\xe2\x82\xac\xf0\x9f\x98\x80");
+    ASSERT(matches_cjson(body));
+}
+
+// a lone surrogate decodes to U+FFFD instead of failing the update
+TEST(update_lone_surrogate)
+{
+    const char *body = "{\"update_id\":1,\"message\":{\"text\":\"a\\ud83dz\\udc00\"}}";
+    UpdateView v;
+    ASSERT_EQ(update_view_parse(body, strlen(body), &v), 0);
+    char text[32];
+    update_str_copy(&v.text, text, sizeof(text), "");
+    ASSERT_STR_EQ(text, "a\xef\xbf\xbdz\xef\xbf\xbd");
+}
+
+// the decoder never splits a multi-byte sequence when out is too small
+TEST(update_copy_truncates_cleanly)
+{
+    const char *body = "{\"message\":{\"text\":\"ab\\u20ac\"}}";
+    UpdateView v;
+    ASSERT_EQ(update_view_parse(body, strlen(body), &v), 0);
+    char text[5];
+    ASSERT_EQ(update_str_copy(&v.text, text, sizeof(text), ""), 2);
+    ASSERT_STR_EQ(text, "ab");
+
+    char tiny[3];
+    ASSERT_EQ(update_str_copy(NULL, tiny, sizeof(tiny), "fallback"), 2);
+    ASSERT_STR_EQ(tiny, "fa");
+}
+
+// anything the scanner declines is left for the cJSON fallback
+TEST(update_rejects_to_fallback)
+{
+    UpdateView v;
+    const char *bad[] = {
+        "",
+        "[]",
+        "{\"update_id\":1",
+        "{\"update_id\":1,}",
+        "{\"update_id\":01x}",
+        "{\"message\":{\"text\":\"unterminated}}",
+        "{\"message\":{\"text\":\"bad \\x escape\"}}",
+        "{\"message\":{\"text\":\"\\u12\"}}",
+        "{\"upd\\u0061te_id\":1}", // escaped key
+        "{\"a\":tru}",
+    };
+    for (size_t i = 0; i < sizeof(bad) / sizeof(bad[0]); i++) {
+        ASSERT_EQ(update_view_parse(bad[i], strlen(bad[i]), &v), -1);
+        ASSERT(!v.has_update_id || bad[i][0] == '\0');
+    }
+
+    // nesting past the scanner's limit
+    char deep[512];
+    size_t n = 0;
+    n += (size_t)snprintf(deep, sizeof(deep), "{\"x\":");
+    for (int i = 0; i < 100; i++) {
+        deep[n++] = '[';
+    }
+    for (int i = 0; i < 100; i++) {
+        deep[n++] = ']';
+    }
+    deep[n++] = '}';
+    ASSERT_EQ(update_view_parse(deep, n, &v), -1);
+}
+
+// the length bounds the scan; bytes past it are never read
+TEST(update_respects_length)
+{
+    const char *body = "{\"update_id\":77}garbage";
+    UpdateView v;
+    ASSERT_EQ(update_view_parse(body, 16, &v), 0);
+    ASSERT_EQ(v.update_id, 77);
+    ASSERT_EQ(update_view_parse(body, 15, &v), -1);
+}
+
+TEST(update_iter_multiple)
+{
+    const char *body = "{\"ok\":true,\"result\":[{\"update_id\":10,\"message\":{\"chat\":"
+                       "{\"id\":1},\"from\":{\"id\":2},\"text\":\"one\"}}, 42 ,"
+                       "{\"update_id\":11,\"edited_message\":{}},"
+                       "{\"update_id\":12,\"message\":{\"text\":\"three\"}}]}";
+    UpdateIter it;
+    ASSERT_EQ(update_iter_init(&it, body, strlen(body)), 0);
+
+    UpdateView v;
+    ASSERT_EQ(update_iter_next(&it, &v), 1);
+    ASSERT_EQ(v.update_id, 10);
+    ASSERT_EQ(v.from_id, 2);
+
+    ASSERT_EQ(update_iter_next(&it, &v), 1); // non-object element
+    ASSERT(!v.has_update_id);
+
+    ASSERT_EQ(update_iter_next(&it, &v), 1);
+    ASSERT_EQ(v.update_id, 11);
+    ASSERT(!v.has_chat_id);
+
+    ASSERT_EQ(update_iter_next(&it, &v), 1);
+    ASSERT_EQ(v.update_id, 12);
+    char text[16];
+    update_str_copy(&v.text, text, sizeof(text), "");
+    ASSERT_STR_EQ(text, "three");
+
+    ASSERT_EQ(update_iter_next(&it, &v), 0);
+    ASSERT_EQ(update_iter_next(&it, &v), 0);
+}
+
+TEST(update_iter_empty_and_errors)
+{
+    UpdateIter it;
+    UpdateView v;
+    const char *empty = " {\"result\":[],\"ok\":true} ";
+    ASSERT_EQ(update_iter_init(&it, empty, strlen(empty)), 0);
+    ASSERT_EQ(update_iter_next(&it, &v), 0);
+
+    const char *not_ok = "{\"ok\":false,\"error_code\":409,\"result\":[]}";
+    ASSERT_EQ(update_iter_init(&it, not_ok, strlen(not_ok)), -1);
+
+    const char *no_result = "{\"ok\":true}";
+    ASSERT_EQ(update_iter_init(&it, no_result, strlen(no_result)), -1);
+
+    // malformed tail: rejected up front so no update is half-handled
+    const char *truncated = "{\"ok\":true,\"result\":[{\"update_id\":1},{\"update_id\":";
+    ASSERT_EQ(update_iter_init(&it, truncated, strlen(truncated)), -1);
+
+    const char *bom = "\xef\xbb\xbf{\"ok\":true,\"result\":[]}";
+    ASSERT_EQ(update_iter_init(&it, bom, strlen(bom)), -1);
+}
+
+TEST(update_batch_offset_scan)
+{
+    int64_t off = 6;
+    const char *body = "{\"ok\":true,\"result\":[{\"update_id\":5},{\"update_id\":9},"
+                       "{\"update_id\":7}]}";
+    ASSERT_EQ(update_batch_offset(body, strlen(body), &off), 0);
+    ASSERT_EQ(off, 10);
+
+    // an empty batch leaves the offset alone
+    const char *empty = "{\"ok\":true,\"result\":[]}";
+    ASSERT_EQ(update_batch_offset(empty, strlen(empty), &off), 0);
+    ASSERT_EQ(off, 10);
+
+    // bodies the scanner declines go through cJSON
+    const char *escaped = "{\"ok\":true,\"result\":[{\"update\\u005fid\":12}]}";
+    ASSERT_EQ(update_batch_offset(escaped, strlen(escaped), &off), 0);
+    ASSERT_EQ(off, 13);
+
+    const char *not_ok = "{\"ok\":false,\"error_code\":409}";
+    ASSERT_EQ(update_batch_offset(not_ok, strlen(not_ok), &off), -1);
+    ASSERT_EQ(update_batch_offset("{\"ok\":tr", 9, &off), -1);
+    ASSERT_EQ(off, 13);
+}
+
+int main(void)
+{
+    printf("=== test_update ===\n");
+    return test_summarise();
+}
@@ -0,0 +1,168 @@
+#define _POSIX_C_SOURCE 200809L
+#define _DEFAULT_SOURCE
+
+#include "test.h"
+#include "../src/llmpool.h"
+#include "../src/metrics.h"
+#include "../src/warmup.h"
+
+#include <arpa/inet.h>
+#include <curl/curl.h>
+#include <netinet/in.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+static const char COMPLETION_REPLY[] =
+    "HTTP/1.1 200 OK\r\nContent-Type: application/json\r\n"
+    "Content-Length: 47\r\nConnection: close\r\n\r\n"
+    "{\"choices\":[{\"message\":{\"content\":\"<think>\"}}]}";
+
+static atomic_int g_requests;
+static atomic_int g_well_formed; // had the system prompt and a one-token limit
+
+// answer every connection with a completion until the socket is shut down
+static void *llm_server(void *arg)
+{
+    int fd = *(int *)arg;
+    for (;;) {
+        int c = accept(fd, NULL, NULL);
+        if (c < 0) {
+            break;
+        }
+        char req[4096];
+        size_t len = 0;
+        ssize_t n;
+        // the body follows the headers; read until it has come in
+        while (len < sizeof(req) - 1 &&
+               (n = recv(c, req + len, sizeof(req) - 1 - len, 0)) > 0) {
+            len += (size_t)n;
+            req[len] = '\0';
+            if (strstr(req, "\r\n\r\n") && strrchr(req, '}') > strstr(req, "\r\n\r\n")) {
+                break;
+            }
+        }
+        req[len] = '\0';
+        atomic_fetch_add(&g_requests, 1);
+        if (strstr(req, "warm system prompt") && strstr(req, "\"max_tokens\":1")) {
+            atomic_fetch_add(&g_well_formed, 1);
+        }
+        ssize_t w = send(c, COMPLETION_REPLY, sizeof(COMPLETION_REPLY) - 1, MSG_NOSIGNAL);
+        (void)w;
+        close(c);
+    }
+    return NULL;
+}
+
+static int listen_local(int *port)
+{
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (fd < 0) {
+        return -1;
+    }
+    struct sockaddr_in addr = {.sin_family = AF_INET, .sin_port = 0};
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    socklen_t len = sizeof(addr);
+    if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0 || listen(fd, 8) != 0 ||
+        getsockname(fd, (struct sockaddr *)&addr, &len) != 0) {
+        close(fd);
+        return -1;
+    }
+    *port = ntohs(addr.sin_port);
+    return fd;
+}
+
+static int g_port;
+static int g_fd = -1;
+static pthread_t g_srv;
+
+static void wait_done(int want)
+{
+    WarmupStats ws;
+    for (int i = 0; i < 500; i++) {
+        warmup_stats(&ws);
+        if (ws.done >= want) {
+            return;
+        }
+        usleep(10000);
+    }
+}
+
+TEST(warmup_bad_lists)
+{
+    ASSERT_EQ(warmup_start(NULL, "", "", true, 0), -1);
+    ASSERT_EQ(warmup_start(" , ,", "", "", true, 0), -1);
+    ASSERT_EQ(warmup_start("http://127.0.0.1:1", "", "", true, -1), -1);
+    warmup_stop(); // never started: ignored
+}
+
+TEST(warmup_each_endpoint_once)
+{
+    curl_global_init(CURL_GLOBAL_DEFAULT);
+    g_fd = listen_local(&g_port);
+    ASSERT(g_fd >= 0);
+    ASSERT_EQ(pthread_create(&g_srv, NULL, llm_server, &g_fd), 0);
+
+    // the pool points elsewhere; warm-up still reaches each endpoint itself
+    ASSERT_EQ(llm_pool_init("http://127.0.0.1:1, http://127.0.0.1:2"), 2);
+    char list[128];
+    snprintf(list, sizeof(list), "http://127.0.0.1:%d/, http://127.0.0.1:1", g_port);
+    atomic_store(&g_requests, 0);
+    ASSERT_EQ(warmup_start(list, "", "warm system prompt", true, 0), 2);
+    ASSERT_EQ(warmup_start(list, "", "warm system prompt", true, 0), -1); // already started
+    wait_done(2);
+
+    WarmupStats ws;
+    warmup_stats(&ws);
+    ASSERT_EQ(ws.endpoints, 2);
+    ASSERT_EQ(ws.done, 2);
+    ASSERT_EQ(ws.warmed, 1); // a "<think>"-only answer still counts: the server replied
+    ASSERT_EQ(ws.keepalives, 0);
+    ASSERT_EQ(atomic_load(&g_requests), 1);
+    ASSERT_EQ(atomic_load(&g_well_formed), 1);
+    warmup_stop();
+    llm_pool_destroy();
+}
+
+TEST(warmup_keepalive_only_while_idle)
+{
+    char list[64];
+    snprintf(list, sizeof(list), "http://127.0.0.1:%d", g_port);
+    atomic_store(&g_requests, 0);
+    ASSERT_EQ(warmup_start(list, "", "warm system prompt", false, 1), 1);
+
+    // workers finishing LLM requests keep it quiet
+    for (int i = 0; i < 12; i++) {
+        metrics_observe(MET_LLM, 0.1);
+        usleep(200000);
+    }
+    ASSERT_EQ(atomic_load(&g_requests), 0);
+
+    // idle: a keep-alive goes out within a second or two
+    for (int i = 0; i < 300 && atomic_load(&g_requests) == 0; i++) {
+        usleep(10000);
+    }
+    ASSERT(atomic_load(&g_requests) >= 1);
+    WarmupStats ws = {0};
+    for (int i = 0; i < 100 && ws.keepalives == 0; i++) {
+        warmup_stats(&ws);
+        usleep(10000);
+    }
+    ASSERT(ws.keepalives >= 1);
+    ASSERT_EQ(ws.done, 0); // no first warm-up was asked for
+    warmup_stop();
+
+    shutdown(g_fd, SHUT_RDWR);
+    close(g_fd);
+    pthread_join(g_srv, NULL);
+    curl_global_cleanup();
+}
+
+int main(void)
+{
+    printf("=== test_warmup ===\n");
+    return test_summarise();
+}
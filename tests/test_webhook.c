@@ -4,6 +4,7 @@
 #include "test.h"
 #include "../src/cfg.h"
 #include "../src/config.h"
+#include "../src/metrics.h"
 #include "../src/queue.h"
 #include "../src/webhook.h"
 #include "../lib/cJSON.h"
@@ -16,6 +17,7 @@
 #include <stdlib.h>
 #include <string.h>
 #include <sys/socket.h>
+#include <time.h>
 #include <unistd.h>
 
 // setup
@@ -25,13 +27,19 @@
 static int g_update_count = 0;
 static pthread_mutex_t g_update_mtx = PTHREAD_MUTEX_INITIALIZER;
 
-static void test_update_cb(void *ctx, cJSON *update)
+static int g_update_delay_us = 0; // simulated slow routing
+static size_t g_last_text_len;    // raw text length of the latest update
+
+static void test_update_cb(void *ctx, const UpdateView *update)
 {
     (void)ctx;
+    if (g_update_delay_us > 0) {
+        usleep((useconds_t)g_update_delay_us);
+    }
     pthread_mutex_lock(&g_update_mtx);
     g_update_count++;
+    g_last_text_len = update->text.len;
     pthread_mutex_unlock(&g_update_mtx);
-    cJSON_Delete(update);
 }
 
 static int get_update_count(void)
@@ -282,6 +290,74 @@ TEST(webhook_reject_wrong_path)
     teardown_webhook();
 }
 
+static int get_metrics(int port, char *resp, size_t cap)
+{
+    char request[256];
+    int n = snprintf(request, sizeof(request),
+                     "GET /metrics HTTP/1.1\r\n"
+                     "Host: 127.0.0.1:%d\r\n"
+                     "\r\n",
+                     port);
+    return raw_http_request("127.0.0.1", port, request, (size_t)n, resp, cap);
+}
+
+// GET /metrics is only routed when [metrics] is enabled
+TEST(webhook_metrics_route)
+{
+    setup_webhook();
+    char resp[8192];
+    ASSERT_EQ(get_metrics(TEST_PORT, resp, sizeof(resp)), 404);
+    teardown_webhook();
+
+    memset(&g_test_cfg, 0, sizeof(g_test_cfg));
+    g_test_cfg.webhook_enabled = true;
+    g_test_cfg.webhook_port = TEST_PORT;
+    snprintf(g_test_cfg.webhook_secret, sizeof(g_test_cfg.webhook_secret), "%s", TEST_SECRET);
+    g_test_cfg.metrics_enabled = true;
+    queue_init(8);
+    webhook_set_update_cb(test_update_cb);
+    ASSERT_EQ(webhook_start(&g_test_cfg, NULL), 0);
+    usleep(100000);
+
+    // an accepted update records its ack time
+    uint64_t acks = metrics_count(MET_WEBHOOK_ACK);
+    int status = 0;
+    send_webhook_post("{\"update_id\":7}", TEST_SECRET, &status);
+    ASSERT_EQ(status, 200);
+    ASSERT_EQ(metrics_count(MET_WEBHOOK_ACK), acks + 1);
+
+    ASSERT_EQ(get_metrics(TEST_PORT, resp, sizeof(resp)), 200);
+    ASSERT_NOT_NULL(strstr(resp, "text/plain"));
+    ASSERT_NOT_NULL(strstr(resp, "# TYPE tgbot_queue_wait_seconds summary"));
+
+    teardown_webhook();
+}
+
+// poll mode: a standalone server on loopback carries only /metrics
+TEST(webhook_metrics_standalone)
+{
+    ASSERT_EQ(webhook_metrics_start(TEST_PORT + 1), 0);
+    ASSERT_EQ(webhook_metrics_start(TEST_PORT + 1), -1); // already running
+    usleep(100000);
+
+    char resp[8192];
+    ASSERT_EQ(get_metrics(TEST_PORT + 1, resp, sizeof(resp)), 200);
+    ASSERT_NOT_NULL(strstr(resp, "# TYPE tgbot_queue_wait_seconds summary"));
+
+    char request[256];
+    int n = snprintf(request, sizeof(request),
+                     "GET /webhook HTTP/1.1\r\n"
+                     "Host: 127.0.0.1:%d\r\n"
+                     "\r\n",
+                     TEST_PORT + 1);
+    ASSERT_EQ(raw_http_request("127.0.0.1", TEST_PORT + 1, request, (size_t)n, resp,
+                               sizeof(resp)), 404);
+
+    webhook_metrics_stop();
+    webhook_metrics_stop(); // no-op
+    ASSERT_EQ(get_metrics(TEST_PORT + 1, resp, sizeof(resp)), -1);
+}
+
 // server is addressable via LAN
 TEST(webhook_addressable_via_lan)
 {
@@ -524,6 +600,30 @@ TEST(webhook_pool_exhaustion_fallback)
     teardown_webhook();
 }
 
+// a slow update callback no longer holds up the ack; stop drains what was acked
+TEST(webhook_ack_before_dispatch)
+{
+    // set before the dispatcher starts and cleared after it is joined
+    g_update_delay_us = 200000;
+    setup_webhook();
+
+    struct timespec t0, t1;
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    for (int i = 0; i < 3; i++) {
+        const char *body = "{\"update_id\":18,\"message\":{\"text\":\"slow\"}}";
+        int status = 0;
+        send_webhook_post(body, TEST_SECRET, &status);
+        ASSERT_EQ(status, 200);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+    double elapsed = (double)(t1.tv_sec - t0.tv_sec) + (double)(t1.tv_nsec - t0.tv_nsec) / 1e9;
+    ASSERT(elapsed < 0.5); // three synchronous callbacks would take 0.6s
+
+    teardown_webhook();
+    g_update_delay_us = 0;
+    ASSERT_EQ(get_update_count(), 3);
+}
+
 int main(void)
 {
     printf("=== test_webhook ===\n");
@@ -656,6 +756,40 @@ TEST(webhook_adversarial_long_string_value)
     teardown_webhook();
 }
 
+// bodies past the inline buffer arrive whole, in any number of reads
+TEST(webhook_large_body_intact)
+{
+    setup_webhook();
+
+    size_t sizes[] = {100, 4000, 4200, 9000, 64 * 1024};
+    for (size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+        size_t buf_sz = sizes[i] + 128;
+        char *body = malloc(buf_sz);
+        ASSERT_NOT_NULL(body);
+        int prefix = snprintf(body, buf_sz,
+                              "{\"update_id\":%d,\"message\":{\"chat\":{\"id\":1},"
+                              "\"text\":\"", 200 + (int)i);
+        memset(body + prefix, 'a' + (int)i, sizes[i]);
+        snprintf(body + prefix + sizes[i], buf_sz - (size_t)prefix - sizes[i], "\"}}");
+
+        int before = get_update_count();
+        int status = 0;
+        send_webhook_post(body, TEST_SECRET, &status);
+        ASSERT_EQ(status, 200);
+        for (int w = 0; w < 100 && get_update_count() == before; w++) {
+            usleep(10000);
+        }
+        ASSERT_EQ(get_update_count(), before + 1);
+        pthread_mutex_lock(&g_update_mtx);
+        size_t got = g_last_text_len;
+        pthread_mutex_unlock(&g_update_mtx);
+        ASSERT_EQ(got, sizes[i]);
+        free(body);
+    }
+
+    teardown_webhook();
+}
+
 // binary garbage as POST body
 TEST(webhook_adversarial_binary_garbage)
 {
@@ -31,6 +31,20 @@ static void cleanup_test_file(void)
     char tmp[280];
     snprintf(tmp, sizeof(tmp), "%s.tmp", TEST_WL_FILE);
     unlink(tmp);
+    snprintf(tmp, sizeof(tmp), "%s.journal", TEST_WL_FILE);
+    unlink(tmp);
+}
+
+static long file_size(const char *path)
+{
+    FILE *f = fopen(path, "rb");
+    if (!f) {
+        return -1;
+    }
+    fseek(f, 0, SEEK_END);
+    long n = ftell(f);
+    fclose(f);
+    return n;
 }
 
 
@@ -41,7 +55,7 @@ TEST(whitelist_load_empty)
     create_test_file("");
     Whitelist wl;
     ASSERT_EQ(whitelist_load(&wl, TEST_WL_FILE), 0);
-    ASSERT_EQ(wl.count, 0);
+    ASSERT_EQ(whitelist_count(&wl), 0);
     whitelist_cleanup(&wl);
     cleanup_test_file();
 }
@@ -51,7 +65,7 @@ TEST(whitelist_load_multiple)
     create_test_file("100\n200\n300\n");
     Whitelist wl;
     ASSERT_EQ(whitelist_load(&wl, TEST_WL_FILE), 0);
-    ASSERT_EQ(wl.count, 3);
+    ASSERT_EQ(whitelist_count(&wl), 3);
     ASSERT(whitelist_contains(&wl, 100));
     ASSERT(whitelist_contains(&wl, 200));
     ASSERT(whitelist_contains(&wl, 300));
@@ -67,11 +81,11 @@ TEST(whitelist_add_and_contains)
     ASSERT_EQ(whitelist_load(&wl, TEST_WL_FILE), 0);
     ASSERT_EQ(whitelist_add(&wl, 42), 0);
     ASSERT(whitelist_contains(&wl, 42));
-    ASSERT_EQ(wl.count, 1);
+    ASSERT_EQ(whitelist_count(&wl), 1);
 
     // adding again returns 1 (already present)
     ASSERT_EQ(whitelist_add(&wl, 42), 1);
-    ASSERT_EQ(wl.count, 1);
+    ASSERT_EQ(whitelist_count(&wl), 1);
     whitelist_cleanup(&wl);
     cleanup_test_file();
 }
@@ -81,10 +95,10 @@ TEST(whitelist_remove)
     create_test_file("10\n20\n30\n");
     Whitelist wl;
     ASSERT_EQ(whitelist_load(&wl, TEST_WL_FILE), 0);
-    ASSERT_EQ(wl.count, 3);
+    ASSERT_EQ(whitelist_count(&wl), 3);
 
     ASSERT_EQ(whitelist_remove(&wl, 20), 0);
-    ASSERT_EQ(wl.count, 2);
+    ASSERT_EQ(whitelist_count(&wl), 2);
     ASSERT(!whitelist_contains(&wl, 20));
     ASSERT(whitelist_contains(&wl, 10));
     ASSERT(whitelist_contains(&wl, 30));
@@ -106,7 +120,7 @@ TEST(whitelist_persistence)
     // reload from disk
     Whitelist wl2;
     ASSERT_EQ(whitelist_load(&wl2, TEST_WL_FILE), 0);
-    ASSERT_EQ(wl2.count, 2);
+    ASSERT_EQ(whitelist_count(&wl2), 2);
     ASSERT(whitelist_contains(&wl2, 111));
     ASSERT(whitelist_contains(&wl2, 222));
     whitelist_cleanup(&wl);
@@ -120,8 +134,10 @@ TEST(whitelist_sorted_after_load)
     Whitelist wl;
     ASSERT_EQ(whitelist_load(&wl, TEST_WL_FILE), 0);
     // verify sorted order
-    ASSERT(wl.ids[0] <= wl.ids[1]);
-    ASSERT(wl.ids[1] <= wl.ids[2]);
+    int64_t ids[3];
+    ASSERT_EQ(whitelist_copy(&wl, ids, 3), 3);
+    ASSERT(ids[0] <= ids[1]);
+    ASSERT(ids[1] <= ids[2]);
     whitelist_cleanup(&wl);
     cleanup_test_file();
 }
@@ -131,7 +147,7 @@ TEST(whitelist_create_missing_file)
     cleanup_test_file(); // ensure it doesn't exist
     Whitelist wl;
     ASSERT_EQ(whitelist_load(&wl, TEST_WL_FILE), 0);
-    ASSERT_EQ(wl.count, 0);
+    ASSERT_EQ(whitelist_count(&wl), 0);
     whitelist_cleanup(&wl);
     cleanup_test_file();
 }
@@ -168,8 +184,8 @@ TEST(whitelist_concurrent_add_remove)
     }
 
     // no crash, no ASan race report - that's the assertion
-    ASSERT(wl.count >= 0);
-    ASSERT(wl.count <= WHITELIST_MAX);
+    ASSERT(whitelist_count(&wl) >= 0);
+    ASSERT(whitelist_count(&wl) <= 50);
     whitelist_cleanup(&wl);
     cleanup_test_file();
 }
@@ -213,59 +229,240 @@ TEST(whitelist_concurrent_read_write)
         pthread_join(readers[i], NULL);
     }
 
-    ASSERT(wl.count >= 0);
+    ASSERT(whitelist_count(&wl) >= 0);
+    whitelist_cleanup(&wl);
+    cleanup_test_file();
+}
+
+/* a reader that reads the epoch, stalls, and pins the stale parity only
+ * after one publish has finished - the snapshot it then loads must outlive the
+ * next publish. readers follow snap_acquire()'s steps by hand to stall
+ * between them
+ */
+typedef struct {
+    Whitelist *wl;
+    _Atomic bool done;
+} WlPublish;
+
+static void *wl_publish_thread(void *arg)
+{
+    WlPublish *p = arg;
+    whitelist_add(p->wl, 3);
+    atomic_store(&p->done, true);
+    return NULL;
+}
+
+TEST(whitelist_stalled_reader_spans_two_publishes)
+{
+    create_test_file("1\n");
+    Whitelist wl;
+    ASSERT_EQ(whitelist_load(&wl, TEST_WL_FILE), 0);
+
+    unsigned idx = atomic_load(&wl.epoch) & 1;       // reader reads the epoch...
+    ASSERT_EQ(whitelist_add(&wl, 2), 0);             // ...a publish completes...
+    atomic_fetch_add(&wl.readers[idx], 1);           // ...then it pins the old parity
+    const WhitelistSnap *snap = atomic_load(&wl.snap);
+
+    WlPublish p = {.wl = &wl};
+    pthread_t writer;
+    pthread_create(&writer, NULL, wl_publish_thread, &p);
+    usleep(50000);
+    ASSERT(!atomic_load(&p.done)); // the next publish waits for the reader
+    ASSERT_EQ(snap->count, 2);
+    ASSERT_EQ(snap->ids[0], 1);
+    ASSERT_EQ(snap->ids[1], 2);
+    atomic_fetch_sub(&wl.readers[idx], 1);
+    pthread_join(writer, NULL);
+    ASSERT(atomic_load(&p.done));
+    ASSERT(whitelist_contains(&wl, 3));
+    whitelist_cleanup(&wl);
+    cleanup_test_file();
+}
+
+#define WL_SLOW_READS 300
+static void *wl_slow_reader_thread(void *arg)
+{
+    Whitelist *wl = arg;
+    long bad = 0;
+    for (int i = 0; i < WL_SLOW_READS; i++) {
+        unsigned idx = atomic_load(&wl->epoch) & 1;
+        if (i % 3 == 0) {
+            usleep(100); // stall between reading the epoch and pinning
+        }
+        atomic_fetch_add(&wl->readers[idx], 1);
+        const WhitelistSnap *s = atomic_load(&wl->snap);
+        if (i % 3 == 1) {
+            usleep(100); // stall while holding the snapshot
+        }
+        // id 1 is never removed; ASan reports a snapshot freed under us
+        bool seen = false;
+        for (int k = 0; k < s->count; k++) {
+            seen |= s->ids[k] == 1;
+            bad += k > 0 && s->ids[k - 1] >= s->ids[k];
+        }
+        bad += !seen;
+        atomic_fetch_sub(&wl->readers[idx], 1);
+    }
+    return (void *)bad;
+}
+
+static void *wl_burst_writer_thread(void *arg)
+{
+    Whitelist *wl = arg;
+    for (int i = 0; i < WL_OPS_PER_THREAD * 5; i++) {
+        int64_t id = (int64_t)(i % 20) + 3000;
+        whitelist_add(wl, id);
+        whitelist_remove(wl, id);
+    }
+    return NULL;
+}
+
+TEST(whitelist_slow_readers_back_to_back_publishes)
+{
+    create_test_file("1\n");
+    Whitelist wl;
+    ASSERT_EQ(whitelist_load(&wl, TEST_WL_FILE), 0);
+
+    pthread_t readers[4];
+    pthread_t writers[2];
+    for (int i = 0; i < 4; i++) {
+        pthread_create(&readers[i], NULL, wl_slow_reader_thread, &wl);
+    }
+    for (int i = 0; i < 2; i++) {
+        pthread_create(&writers[i], NULL, wl_burst_writer_thread, &wl);
+    }
+    for (int i = 0; i < 4; i++) {
+        void *bad = NULL;
+        pthread_join(readers[i], &bad);
+        ASSERT_EQ((long)bad, 0);
+    }
+    for (int i = 0; i < 2; i++) {
+        pthread_join(writers[i], NULL);
+    }
+    ASSERT_EQ(whitelist_count(&wl), 1);
     whitelist_cleanup(&wl);
     cleanup_test_file();
 }
 
 // boundary tests
-// fill whitelist; next add must fail with -1
-TEST(whitelist_boundary_max_capacity)
+// the whitelist grows well past the old fixed 256-entry ceiling
+#define WL_MANY 5000
+TEST(whitelist_grows_without_ceiling)
 {
     create_test_file("");
     Whitelist wl;
     ASSERT_EQ(whitelist_load(&wl, TEST_WL_FILE), 0);
 
-    for (int i = 0; i < WHITELIST_MAX; i++) {
-        int rc = whitelist_add(&wl, (int64_t)(i + 1));
+    for (int i = 0; i < WL_MANY; i++) {
+        // descending, so every add inserts at the front
+        int rc = whitelist_add(&wl, (int64_t)(WL_MANY - i));
         ASSERT_EQ(rc, 0);
     }
-    ASSERT_EQ(wl.count, WHITELIST_MAX);
+    ASSERT_EQ(whitelist_count(&wl), WL_MANY);
 
     // sorted invariant
-    for (int i = 1; i < wl.count; i++) {
-        ASSERT(wl.ids[i - 1] < wl.ids[i]);
+    int64_t *ids = malloc(WL_MANY * sizeof(*ids));
+    ASSERT_NOT_NULL(ids);
+    ASSERT_EQ(whitelist_copy(&wl, ids, WL_MANY), WL_MANY);
+    for (int i = 1; i < WL_MANY; i++) {
+        ASSERT(ids[i - 1] < ids[i]);
     }
-
-    // one more must be rejected
-    ASSERT_EQ(whitelist_add(&wl, (int64_t)(WHITELIST_MAX + 1)), -1);
-    ASSERT_EQ(wl.count, WHITELIST_MAX);
+    free(ids);
+    ASSERT(whitelist_contains(&wl, 1));
+    ASSERT(whitelist_contains(&wl, WL_MANY));
+    ASSERT(!whitelist_contains(&wl, WL_MANY + 1));
 
     whitelist_cleanup(&wl);
     cleanup_test_file();
 }
 
-// Load file with more than WHITELIST_MAX lines; extra lines silently dropped
-TEST(whitelist_boundary_overloaded_file)
+// a large file loads completely, deduplicated and sorted
+TEST(whitelist_large_file)
 {
-    // write WHITELIST_MAX + 50 IDs to file
     FILE *f = fopen(TEST_WL_FILE, "w");
     ASSERT_NOT_NULL(f);
-    for (int i = 0; i < WHITELIST_MAX + 50; i++) {
-        fprintf(f, "%d\n", i + 1);
+    for (int i = 0; i < 20000; i++) {
+        fprintf(f, "%d\n", (i * 7919) % 20000 + 1);
     }
+    fprintf(f, "1\n2\n");
     fclose(f);
 
     Whitelist wl;
     ASSERT_EQ(whitelist_load(&wl, TEST_WL_FILE), 0);
-    ASSERT_EQ(wl.count, WHITELIST_MAX);
+    ASSERT_EQ(whitelist_count(&wl), 20000);
+    ASSERT(whitelist_contains(&wl, 1));
+    ASSERT(whitelist_contains(&wl, 20000));
 
-    // sorted invariant after truncated load
-    for (int i = 1; i < wl.count; i++) {
-        ASSERT(wl.ids[i - 1] < wl.ids[i]);
-    }
+    whitelist_cleanup(&wl);
+    cleanup_test_file();
+}
+
+// changes are journaled, replayed on load, and folded into the base file
+TEST(whitelist_journal_replay_and_compaction)
+{
+    create_test_file("5\n6\n");
+    char jpath[280];
+    snprintf(jpath, sizeof(jpath), "%s.journal", TEST_WL_FILE);
+
+    Whitelist wl;
+    ASSERT_EQ(whitelist_load(&wl, TEST_WL_FILE), 0);
+    ASSERT_EQ(whitelist_add(&wl, 7), 0);
+    ASSERT_EQ(whitelist_remove(&wl, 5), 0);
+
+    // an add only appends; the base file is untouched until compaction
+    ASSERT_EQ(file_size(TEST_WL_FILE), 4);
+    ASSERT(file_size(jpath) > 0);
 
+    // a second process view replays base + journal
+    Whitelist wl2;
+    ASSERT_EQ(whitelist_load(&wl2, TEST_WL_FILE), 0);
+    ASSERT_EQ(whitelist_count(&wl2), 2);
+    ASSERT(!whitelist_contains(&wl2, 5));
+    ASSERT(whitelist_contains(&wl2, 6));
+    ASSERT(whitelist_contains(&wl2, 7));
+    whitelist_cleanup(&wl2);
+
+    // enough entries trigger compaction: base holds everything, journal resets
+    for (int i = 0; i < WHITELIST_COMPACT_OPS; i++) {
+        ASSERT_EQ(whitelist_add(&wl, (int64_t)(1000 + i)), 0);
+    }
+    ASSERT(file_size(jpath) < 64);
     whitelist_cleanup(&wl);
+
+    Whitelist wl3;
+    ASSERT_EQ(whitelist_load(&wl3, TEST_WL_FILE), 0);
+    ASSERT_EQ(whitelist_count(&wl3), 2 + WHITELIST_COMPACT_OPS);
+    ASSERT(whitelist_contains(&wl3, 1000 + WHITELIST_COMPACT_OPS - 1));
+    whitelist_cleanup(&wl3);
+    cleanup_test_file();
+}
+
+// cluster copies share the files: one that missed a change must not erase it
+TEST(whitelist_shared_files_compaction_keeps_missed_change)
+{
+    create_test_file("1\n");
+    Whitelist a, b;
+    ASSERT_EQ(whitelist_load(&a, TEST_WL_FILE), 0);
+    ASSERT_EQ(whitelist_load(&b, TEST_WL_FILE), 0);
+
+    ASSERT_EQ(whitelist_add(&a, 42), 0); // b never hears about it
+    ASSERT_EQ(whitelist_remove(&a, 1), 0);
+    ASSERT(!whitelist_contains(&b, 42));
+    for (int i = 0; i < WHITELIST_COMPACT_OPS; i++) {
+        ASSERT_EQ(whitelist_add(&b, (int64_t)(5000 + i)), 0); // b compacts
+    }
+    ASSERT_EQ(whitelist_add(&a, 43), 0); // a's stream still appends after it
+    whitelist_cleanup(&b);
+    whitelist_cleanup(&a);
+
+    Whitelist c;
+    ASSERT_EQ(whitelist_load(&c, TEST_WL_FILE), 0);
+    ASSERT(whitelist_contains(&c, 42));
+    ASSERT(whitelist_contains(&c, 43));
+    ASSERT(!whitelist_contains(&c, 1));
+    ASSERT(whitelist_contains(&c, 5000));
+    ASSERT_EQ(whitelist_count(&c), 2 + WHITELIST_COMPACT_OPS);
+    whitelist_cleanup(&c);
     cleanup_test_file();
 }
 
@@ -275,9 +472,8 @@ TEST(whitelist_load_garbage_lines)
     create_test_file("100\nhello\n\n200\n100\nxyz\n300\n");
     Whitelist wl;
     ASSERT_EQ(whitelist_load(&wl, TEST_WL_FILE), 0);
-    // sscanf skips non-numeric lines; duplicates are loaded (sorted + dedup is not done)
-    // At minimum, 100, 200, 300 must be present and count >= 3
-    ASSERT(wl.count >= 3);
+    // sscanf skips non-numeric lines; duplicates collapse into one entry
+    ASSERT_EQ(whitelist_count(&wl), 3);
     ASSERT(whitelist_contains(&wl, 100));
     ASSERT(whitelist_contains(&wl, 200));
     ASSERT(whitelist_contains(&wl, 300));
@@ -302,16 +498,48 @@ TEST(whitelist_negative_and_large_ids)
     ASSERT(whitelist_contains(&wl, INT64_MIN));
 
     // sorted: INT64_MIN < -999 < INT64_MAX
-    ASSERT(wl.ids[0] == INT64_MIN);
-    ASSERT(wl.ids[1] == -999);
-    ASSERT(wl.ids[2] == INT64_MAX);
+    int64_t ids[3];
+    ASSERT_EQ(whitelist_copy(&wl, ids, 3), 3);
+    ASSERT(ids[0] == INT64_MIN);
+    ASSERT(ids[1] == -999);
+    ASSERT(ids[2] == INT64_MAX);
 
     // remove and verify
     ASSERT_EQ(whitelist_remove(&wl, -999), 0);
     ASSERT(!whitelist_contains(&wl, -999));
-    ASSERT_EQ(wl.count, 2);
+    ASSERT_EQ(whitelist_count(&wl), 2);
+
+    whitelist_cleanup(&wl);
+    cleanup_test_file();
+}
 
+// changes another process journaled: memory only, the file is untouched
+TEST(whitelist_apply_memory_only)
+{
+    create_test_file("10\n");
+    Whitelist wl;
+    ASSERT_EQ(whitelist_load(&wl, TEST_WL_FILE), 0);
+    long before = file_size(TEST_WL_FILE);
+
+    ASSERT_EQ(whitelist_apply(&wl, '+', 20), 0);
+    ASSERT(whitelist_contains(&wl, 20));
+    ASSERT_EQ(whitelist_apply(&wl, '+', 20), 1);
+    ASSERT_EQ(whitelist_apply(&wl, '-', 10), 0);
+    ASSERT(!whitelist_contains(&wl, 10));
+    ASSERT_EQ(whitelist_apply(&wl, '-', 10), 1);
+    ASSERT_EQ(whitelist_apply(&wl, '?', 30), -1);
     whitelist_cleanup(&wl);
+
+    char journal[280];
+    snprintf(journal, sizeof(journal), "%s.journal", TEST_WL_FILE);
+    ASSERT(file_size(journal) <= 0);
+    ASSERT_EQ(file_size(TEST_WL_FILE), before);
+
+    Whitelist wl2;
+    ASSERT_EQ(whitelist_load(&wl2, TEST_WL_FILE), 0);
+    ASSERT(whitelist_contains(&wl2, 10));
+    ASSERT(!whitelist_contains(&wl2, 20));
+    whitelist_cleanup(&wl2);
     cleanup_test_file();
 }
 